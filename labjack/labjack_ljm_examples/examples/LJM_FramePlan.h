@@ -0,0 +1,446 @@
+/**
+ * Name: LJM_FramePlan.h
+ * Desc: Packs register reads and writes into as few Modbus Feedback (MBFB)
+ *       packets as a device's MaxBytesPerMB allows, merging frames with
+ *       contiguous addresses into array frames. C++ only.
+**/
+
+#ifndef LJM_FRAME_PLAN
+#define LJM_FRAME_PLAN
+
+#include <vector>
+
+#include "LabJackM.h"
+
+#include "LJM_Utilities.h"
+
+// Bytes in an MBFB command/response header: MBAP (7 bytes) + function code
+enum { MBFB_HEADER_SIZE = 8 };
+
+// Bytes in a Feedback frame header: direction, 2 address bytes, register count
+enum { MBFB_FRAME_HEADER_SIZE = 4 };
+
+// The register count of a Feedback frame is a single byte
+enum { MBFB_MAX_REGISTERS_PER_FRAME = 255 };
+
+/**
+ * Desc: Returns the number of 16-bit registers that numValues values of type
+ *       occupy. LJM_BYTE values are packed two per register.
+**/
+int NumRegistersForValues(int type, int numValues);
+
+/**
+ * Desc: Returns the largest number of values of type that fit in numRegisters
+ *       registers.
+**/
+int NumValuesForRegisters(int type, int numRegisters);
+
+/**
+ * Desc: One frame of a FramePlan. valueOffset is the index of the frame's
+ *       first value in FramePlan::Values(). buffer is non-zero for a frame
+ *       of a buffer register, which keeps its address when split.
+**/
+struct PlanFrame
+{
+	int address;
+	int type;
+	int write;
+	int numValues;
+	int valueOffset;
+	int buffer;
+};
+
+/**
+ * Desc: A contiguous run of frames that fits in one Feedback packet.
+**/
+struct PlanPacket
+{
+	std::vector<int> aAddresses;
+	std::vector<int> aTypes;
+	std::vector<int> aWrites;
+	std::vector<int> aNumValues;
+	int valueOffset;
+	int commandBytes;
+	int responseBytes;
+};
+
+/**
+ * Name: FramePlan
+ * Desc: Collects read/write frames, then executes them with the fewest
+ *       LJM_MBFBComm round trips that MaxBytesPerMB allows.
+ * Note: A frame that continues the previous frame (same direction and type,
+ *       address immediately following) is merged into it, so adding sorted
+ *       addresses produces array reads/writes. Merging does not change the
+ *       layout of Values(), so callers can keep the offsets AddRead/AddWrite
+ *       return.
+ * Note: Frames are executed in the order they were added. Frames too large for
+ *       one packet are split across packets.
+**/
+class FramePlan
+{
+public:
+	FramePlan(int maxBytesPerMB = LJM_DEFAULT_FEEDBACK_ALLOCATION_SIZE);
+
+	/**
+	 * Desc: Sets the packet size limit, usually from LJM_GetHandleInfo.
+	**/
+	void SetMaxBytesPerMB(int maxBytesPerMB);
+	int GetMaxBytesPerMB() const { return maxBytesPerMB; }
+
+	/**
+	 * Desc: Appends a read of numValues values starting at address. Returns
+	 *       the offset of the first value in Values().
+	**/
+	int AddRead(int address, int type, int numValues = 1);
+
+	/**
+	 * Desc: Appends a write of numValues values from aValues starting at
+	 *       address. Returns the offset of the first value in Values().
+	**/
+	int AddWrite(int address, int type, const double * aValues, int numValues = 1);
+	int AddWrite(int address, int type, double value);
+
+	/**
+	 * Desc: Like AddRead and AddWrite, for a buffer register such as
+	 *       LUA_SOURCE_WRITE or LUA_DEBUG_DATA: every value goes through
+	 *       address, so the frame is split across packets without advancing
+	 *       the address, and isn't merged with neighbouring frames.
+	 * Note: Read an even number of LJM_BYTE values if other frames follow:
+	 *       LJM_UpdateValues consumes only the odd count from the response's
+	 *       whole registers, shifting the values of the frames after it.
+	**/
+	int AddBufferRead(int address, int type, int numValues);
+	int AddBufferWrite(int address, int type, const double * aValues, int numValues);
+
+	/**
+	 * Desc: Removes all frames and values. The packet size limit is kept.
+	**/
+	void Clear();
+
+	int NumFrames() const { return (int)frames.size(); }
+	const std::vector<PlanFrame> & Frames() const { return frames; }
+
+	/**
+	 * Desc: Returns the number of Feedback packets Execute will send.
+	**/
+	int NumPackets();
+
+	/**
+	 * Desc: Returns the packets Execute will send.
+	**/
+	const std::vector<PlanPacket> & Packets();
+
+	/**
+	 * Desc: Sends every packet to handle and updates Values() with the read
+	 *       results.
+	 * Para: errorAddress, updated with the device-reported address of an error
+	 *           if one occurs. May be NULL.
+	 * Retr: LJME_NOERROR or the first error. Packets after an error are not sent.
+	 * Note: Frames LJM_AddressesToMBFB leaves out of a packet are sent in an
+	 *       extra packet, counted in RoundTrips.
+	**/
+	int Execute(int handle, int * errorAddress);
+
+	/**
+	 * Desc: Values of all frames, in the order they were added. Read values
+	 *       are valid after a successful Execute.
+	**/
+	double * Values() { return values.empty() ? NULL : &values[0]; }
+	const double * Values() const { return values.empty() ? NULL : &values[0]; }
+	int NumValues() const { return (int)values.size(); }
+
+	/**
+	 * Desc: Total number of Feedback packets sent by Execute since construction.
+	**/
+	long long RoundTrips() const { return roundTrips; }
+
+private:
+	void AddFrame(int address, int type, int write, int numValues, int buffer = 0);
+	void BuildPackets();
+
+	int maxBytesPerMB;
+	std::vector<PlanFrame> frames;
+	std::vector<double> values;
+	std::vector<PlanPacket> packets;
+	bool packetsValid;
+	std::vector<unsigned char> aMBFB;
+	long long roundTrips;
+};
+
+
+// Source
+
+inline int NumRegistersForValues(int type, int numValues)
+{
+	if (type == LJM_UINT16) {
+		return numValues;
+	}
+	if (type == LJM_BYTE) {
+		return (numValues + 1) / 2;
+	}
+	return numValues * 2;
+}
+
+inline int NumValuesForRegisters(int type, int numRegisters)
+{
+	if (type == LJM_UINT16) {
+		return numRegisters;
+	}
+	if (type == LJM_BYTE) {
+		return numRegisters * 2;
+	}
+	return numRegisters / 2;
+}
+
+inline FramePlan::FramePlan(int maxBytesPerMB) :
+	maxBytesPerMB(LJM_DEFAULT_FEEDBACK_ALLOCATION_SIZE),
+	packetsValid(false),
+	roundTrips(0)
+{
+	SetMaxBytesPerMB(maxBytesPerMB);
+}
+
+inline void FramePlan::SetMaxBytesPerMB(int newMaxBytesPerMB)
+{
+	if (newMaxBytesPerMB <= MBFB_HEADER_SIZE + MBFB_FRAME_HEADER_SIZE + 4) {
+		newMaxBytesPerMB = LJM_DEFAULT_FEEDBACK_ALLOCATION_SIZE;
+	}
+	if (newMaxBytesPerMB != maxBytesPerMB) {
+		maxBytesPerMB = newMaxBytesPerMB;
+		packetsValid = false;
+	}
+}
+
+inline int FramePlan::AddRead(int address, int type, int numValues)
+{
+	int offset = (int)values.size();
+	values.resize(values.size() + numValues, 0.0);
+	AddFrame(address, type, LJM_READ, numValues);
+	return offset;
+}
+
+inline int FramePlan::AddWrite(int address, int type, const double * aValues,
+	int numValues)
+{
+	int offset = (int)values.size();
+	values.insert(values.end(), aValues, aValues + numValues);
+	AddFrame(address, type, LJM_WRITE, numValues);
+	return offset;
+}
+
+inline int FramePlan::AddWrite(int address, int type, double value)
+{
+	return AddWrite(address, type, &value, 1);
+}
+
+inline int FramePlan::AddBufferRead(int address, int type, int numValues)
+{
+	int offset = (int)values.size();
+	values.resize(values.size() + numValues, 0.0);
+	AddFrame(address, type, LJM_READ, numValues, 1);
+	return offset;
+}
+
+inline int FramePlan::AddBufferWrite(int address, int type, const double * aValues,
+	int numValues)
+{
+	int offset = (int)values.size();
+	values.insert(values.end(), aValues, aValues + numValues);
+	AddFrame(address, type, LJM_WRITE, numValues, 1);
+	return offset;
+}
+
+inline void FramePlan::AddFrame(int address, int type, int write, int numValues,
+	int buffer)
+{
+	packetsValid = false;
+
+	if (!frames.empty() && !buffer && !frames.back().buffer) {
+		PlanFrame & last = frames.back();
+		// Odd LJM_BYTE counts end mid-register, so they can't be continued
+		int lastEndsOnRegister = !(last.type == LJM_BYTE && last.numValues % 2);
+		if (last.write == write && last.type == type && lastEndsOnRegister &&
+			last.address + NumRegistersForValues(type, last.numValues) == address)
+		{
+			last.numValues += numValues;
+			return;
+		}
+	}
+
+	PlanFrame frame;
+	frame.address = address;
+	frame.type = type;
+	frame.write = write;
+	frame.numValues = numValues;
+	frame.valueOffset = (int)values.size() - numValues;
+	frame.buffer = buffer;
+	frames.push_back(frame);
+}
+
+inline void FramePlan::Clear()
+{
+	frames.clear();
+	values.clear();
+	packets.clear();
+	packetsValid = false;
+}
+
+inline void FramePlan::BuildPackets()
+{
+	size_t frameI;
+	int address, numValues, valueOffset;
+	int registers, regsThatFit, valuesThatFit;
+	int commandCost, responseCost;
+	PlanPacket packet;
+
+	packets.clear();
+
+	packet.valueOffset = 0;
+	packet.commandBytes = MBFB_HEADER_SIZE;
+	packet.responseBytes = MBFB_HEADER_SIZE;
+
+	for (frameI = 0; frameI < frames.size(); frameI++) {
+		const PlanFrame & frame = frames[frameI];
+		address = frame.address;
+		numValues = frame.numValues;
+		valueOffset = frame.valueOffset;
+
+		while (numValues > 0) {
+			if (packet.aAddresses.empty()) {
+				packet.valueOffset = valueOffset;
+			}
+
+			// How many registers of this frame fit in the current packet?
+			if (frame.write == LJM_WRITE) {
+				regsThatFit = (maxBytesPerMB - packet.commandBytes -
+					MBFB_FRAME_HEADER_SIZE) / LJM_BYTES_PER_REGISTER;
+			}
+			else {
+				if (maxBytesPerMB - packet.commandBytes < MBFB_FRAME_HEADER_SIZE) {
+					regsThatFit = 0;
+				}
+				else {
+					regsThatFit = (maxBytesPerMB - packet.responseBytes) /
+						LJM_BYTES_PER_REGISTER;
+				}
+			}
+			if (regsThatFit > MBFB_MAX_REGISTERS_PER_FRAME) {
+				regsThatFit = MBFB_MAX_REGISTERS_PER_FRAME;
+			}
+
+			registers = NumRegistersForValues(frame.type, numValues);
+			valuesThatFit = registers <= regsThatFit ?
+				numValues : NumValuesForRegisters(frame.type, regsThatFit);
+
+			if (valuesThatFit <= 0) {
+				// Current packet is full
+				packets.push_back(packet);
+				packet = PlanPacket();
+				packet.commandBytes = MBFB_HEADER_SIZE;
+				packet.responseBytes = MBFB_HEADER_SIZE;
+				continue;
+			}
+
+			registers = NumRegistersForValues(frame.type, valuesThatFit);
+			commandCost = MBFB_FRAME_HEADER_SIZE;
+			responseCost = 0;
+			if (frame.write == LJM_WRITE) {
+				commandCost += registers * LJM_BYTES_PER_REGISTER;
+			}
+			else {
+				responseCost += registers * LJM_BYTES_PER_REGISTER;
+			}
+
+			packet.aAddresses.push_back(address);
+			packet.aTypes.push_back(frame.type);
+			packet.aWrites.push_back(frame.write);
+			packet.aNumValues.push_back(valuesThatFit);
+			packet.commandBytes += commandCost;
+			packet.responseBytes += responseCost;
+
+			if (!frame.buffer) {
+				address += registers;
+			}
+			numValues -= valuesThatFit;
+			valueOffset += valuesThatFit;
+		}
+	}
+
+	if (!packet.aAddresses.empty()) {
+		packets.push_back(packet);
+	}
+
+	packetsValid = true;
+}
+
+inline int FramePlan::NumPackets()
+{
+	return (int)Packets().size();
+}
+
+inline const std::vector<PlanPacket> & FramePlan::Packets()
+{
+	if (!packetsValid) {
+		BuildPackets();
+	}
+	return packets;
+}
+
+inline int FramePlan::Execute(int handle, int * errorAddress)
+{
+	size_t packetI;
+	int firstFrame, numFrames, valueOffset, frameI, err;
+	int localErrorAddress = INITIAL_ERR_ADDRESS;
+
+	if (errorAddress == NULL) {
+		errorAddress = &localErrorAddress;
+	}
+
+	Packets();
+	aMBFB.resize(maxBytesPerMB);
+
+	for (packetI = 0; packetI < packets.size(); packetI++) {
+		PlanPacket & packet = packets[packetI];
+		firstFrame = 0;
+		valueOffset = packet.valueOffset;
+
+		// LJM_AddressesToMBFB may fit fewer frames than planned, such as
+		// when its own size rules are stricter, so the frames it leaves out
+		// are sent in the packets after
+		while (firstFrame < (int)packet.aAddresses.size()) {
+			numFrames = (int)packet.aAddresses.size() - firstFrame;
+			err = LJM_AddressesToMBFB(maxBytesPerMB, &packet.aAddresses[firstFrame],
+				&packet.aTypes[firstFrame], &packet.aWrites[firstFrame],
+				&packet.aNumValues[firstFrame], &values[valueOffset], &numFrames,
+				&aMBFB[0]);
+			if (err == LJME_FRAMES_OMITTED_DUE_TO_PACKET_SIZE && numFrames <= 0) {
+				return LJME_INVALID_MAXBYTESPERMBFB;
+			}
+			if (err != LJME_NOERROR && err != LJME_FRAMES_OMITTED_DUE_TO_PACKET_SIZE) {
+				return err;
+			}
+
+			++roundTrips;
+			err = LJM_MBFBComm(handle, LJM_DEFAULT_UNIT_ID, &aMBFB[0], errorAddress);
+			if (err != LJME_NOERROR) {
+				return err;
+			}
+
+			err = LJM_UpdateValues(&aMBFB[0], &packet.aTypes[firstFrame],
+				&packet.aWrites[firstFrame], &packet.aNumValues[firstFrame], numFrames,
+				&values[valueOffset]);
+			if (err != LJME_NOERROR) {
+				return err;
+			}
+
+			for (frameI = firstFrame; frameI < firstFrame + numFrames; frameI++) {
+				valueOffset += packet.aNumValues[frameI];
+			}
+			firstFrame += numFrames;
+		}
+	}
+
+	return LJME_NOERROR;
+}
+
+#endif // #define LJM_FRAME_PLAN
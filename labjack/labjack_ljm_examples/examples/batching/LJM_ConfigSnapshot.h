@@ -0,0 +1,674 @@
+/**
+ * Name: LJM_ConfigSnapshot.h
+ * Desc: Treats a device's configuration as data. A ConfigSnapshot holds typed
+ *       register values, reads them all with as few array reads as possible,
+ *       and saves and loads them as a text file. ApplyConfigSnapshot makes a
+ *       device match a desired snapshot, writing only the registers that
+ *       differ. C++ only.
+**/
+
+#ifndef LJM_CONFIG_SNAPSHOT
+#define LJM_CONFIG_SNAPSHOT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../LJM_FramePlan.h"
+
+#include "LJM_ConfigTransaction.h"
+
+/**
+ * Desc: The registers AddDefaultRegisters adds: the power-up defaults that
+ *       config/read_config.c, ethernet/read_ethernet_config.c,
+ *       wifi/read_wifi_config.c and watchdog/read_watchdog_config.c read,
+ *       plus the Lua defaults and the settings of the T7's 14 AINs.
+ *       WIFI_PASSWORD_DEFAULT is write-only, so it can't be part of a
+ *       snapshot.
+**/
+const char * const CONFIG_SNAPSHOT_DEFAULT_REGISTERS[] = {
+	"DEVICE_NAME_DEFAULT",
+	"POWER_ETHERNET_DEFAULT", "POWER_WIFI_DEFAULT", "POWER_AIN_DEFAULT",
+	"POWER_LED_DEFAULT",
+	"ETHERNET_IP_DEFAULT", "ETHERNET_SUBNET_DEFAULT", "ETHERNET_GATEWAY_DEFAULT",
+	"ETHERNET_DNS_DEFAULT", "ETHERNET_ALTDNS_DEFAULT", "ETHERNET_DHCP_ENABLE_DEFAULT",
+	"WIFI_IP_DEFAULT", "WIFI_SUBNET_DEFAULT", "WIFI_GATEWAY_DEFAULT",
+	"WIFI_DHCP_ENABLE_DEFAULT", "WIFI_SSID_DEFAULT",
+	"WATCHDOG_ENABLE_DEFAULT", "WATCHDOG_ADVANCED_DEFAULT", "WATCHDOG_TIMEOUT_S_DEFAULT",
+	"WATCHDOG_STARTUP_DELAY_S_DEFAULT", "WATCHDOG_STRICT_ENABLE_DEFAULT",
+	"WATCHDOG_STRICT_KEY_DEFAULT", "WATCHDOG_RESET_ENABLE_DEFAULT",
+	"WATCHDOG_DIO_ENABLE_DEFAULT", "WATCHDOG_DIO_STATE_DEFAULT",
+	"WATCHDOG_DIO_DIRECTION_DEFAULT", "WATCHDOG_DIO_INHIBIT_DEFAULT",
+	"WATCHDOG_DAC0_ENABLE_DEFAULT", "WATCHDOG_DAC0_DEFAULT",
+	"WATCHDOG_DAC1_ENABLE_DEFAULT", "WATCHDOG_DAC1_DEFAULT",
+	"LUA_RUN_DEFAULT", "LUA_DEBUG_ENABLE_DEFAULT", "LUA_DEBUG_NUM_BYTES_DEFAULT",
+	"AIN#(0:13)_RANGE", "AIN#(0:13)_NEGATIVE_CH", "AIN#(0:13)_RESOLUTION_INDEX",
+	"AIN#(0:13)_SETTLING_US"
+};
+enum { CONFIG_SNAPSHOT_NUM_DEFAULT_REGISTERS = sizeof(CONFIG_SNAPSHOT_DEFAULT_REGISTERS) /
+	sizeof(CONFIG_SNAPSHOT_DEFAULT_REGISTERS[0]) };
+
+/**
+ * Desc: One register of a snapshot. text holds the value of LJM_STRING
+ *       registers, value the value of every other type.
+**/
+struct ConfigSnapshotEntry
+{
+	std::string name;
+	int address;
+	int type;
+	double value;
+	std::string text;
+};
+
+/**
+ * Name: ConfigSnapshot
+ * Desc: Register values, in the order they were added.
+ *
+ *       Names may hold one range, like ljm_constants.json does:
+ *       "AIN#(0:13)_RANGE" stands for AIN0_RANGE to AIN13_RANGE.
+ *
+ *       Save writes one "NAME = VALUE" line per register. IP address
+ *       registers are written in dotted form, strings in double quotes, and
+ *       lines starting with # are comments. Load accepts the same format,
+ *       ranges included, so a desired-state file can be as short as:
+ *           # Every device in the rack
+ *           POWER_WIFI_DEFAULT = 0
+ *           AIN#(0:13)_RANGE = 10
+**/
+class ConfigSnapshot
+{
+public:
+	ConfigSnapshot();
+
+	/**
+	 * Desc: Adds registers, with a value of 0, unless already present.
+	 * Retr: LJME_NOERROR, or LJME_INVALID_NAME for a name LJM doesn't know.
+	**/
+	int Add(const char * name);
+	int AddDefaultRegisters();
+
+	/**
+	 * Desc: Adds entry, or replaces the entry of the same name, without
+	 *       looking its name up. entry.address and entry.type must be right.
+	**/
+	void AddEntry(const ConfigSnapshotEntry & entry);
+
+	/**
+	 * Desc: Sets the value of registers, adding them if needed. SetString is
+	 *       for LJM_STRING registers.
+	 * Retr: LJME_NOERROR, LJME_INVALID_NAME for a name LJM doesn't know, or
+	 *       LJME_UNKNOWN_VALUE_TYPE for SetString of a register that isn't a
+	 *       string, or the other way around.
+	**/
+	int Set(const char * name, double value);
+	int SetString(const char * name, const char * text);
+
+	/**
+	 * Desc: Returns the entry of name, or NULL.
+	**/
+	const ConfigSnapshotEntry * Find(const char * name) const;
+
+	const std::vector<ConfigSnapshotEntry> & Entries() const { return entries; }
+	int NumEntries() const { return (int)entries.size(); }
+	void Clear();
+
+	/**
+	 * Desc: Reads every entry from handle, sorted by address so contiguous
+	 *       registers become array reads, in as few Feedback packets as
+	 *       MaxBytesPerMB allows.
+	 * Para: errorAddress, updated with the device-reported address of an error
+	 *           if one occurs. May be NULL.
+	**/
+	int Read(int handle, int * errorAddress);
+
+	/**
+	 * Desc: Frames and Feedback packets the last Read sent.
+	**/
+	int LastReadFrames() const { return lastReadFrames; }
+	long long LastReadRoundTrips() const { return lastReadRoundTrips; }
+
+	/**
+	 * Desc: Writes the snapshot to file, after a "# comment" line if comment
+	 *       isn't NULL.
+	**/
+	void Write(FILE * file, const char * comment) const;
+
+	/**
+	 * Retr: LJME_NOERROR, or LJME_UNKNOWN_ERROR if path can't be written.
+	**/
+	int Save(const char * path, const char * comment) const;
+
+	/**
+	 * Desc: Adds or sets the registers in path.
+	 * Para: errorLine, set to the number of the line that couldn't be parsed.
+	 *           May be NULL.
+	 * Retr: LJME_NOERROR, LJME_CONSTANTS_FILE_NOT_FOUND if path can't be
+	 *       read, or the Set/SetString error of the bad line.
+	**/
+	int Load(const char * path, int * errorLine);
+
+private:
+	template<class Setter>
+	int ForEachName(const char * name, Setter setter);
+	int Entry(const std::string & name, ConfigSnapshotEntry ** entry);
+
+	std::vector<ConfigSnapshotEntry> entries;
+	std::map<std::string, size_t> entryIndexes;
+	int lastReadFrames;
+	long long lastReadRoundTrips;
+};
+
+/**
+ * Desc: What ApplyConfigSnapshot did. Registers the cache already knew weren't
+ *       read.
+**/
+struct ConfigApplyReport
+{
+	int numRegisters;
+	int numRead;
+	int numChanged;
+	long long readRoundTrips;
+	long long writeRoundTrips;
+	double ms;
+	std::vector<std::string> changed;
+};
+
+/**
+ * Desc: Returns the entries of desired whose value differs from current, or
+ *       that current doesn't have. Entries are matched by address, so
+ *       alternate names match.
+**/
+std::vector<ConfigSnapshotEntry> DiffConfigSnapshots(const ConfigSnapshot & current,
+	const ConfigSnapshot & desired);
+
+/**
+ * Desc: Makes handle's configuration match desired. Reads the registers of
+ *       desired whose values cache doesn't know, then writes the ones that
+ *       differ, in desired's order, merged into array writes and as few
+ *       Feedback packets as possible. Nothing is written when nothing
+ *       differs.
+ * Para: cache, the device's ConfigCache, as used with ConfigTransaction. May
+ *           be NULL. Updated with every numeric value of desired.
+ *       report, may be NULL.
+ *       errorAddress, may be NULL.
+ * Retr: LJME_NOERROR or the first error. On a write error the cache forgets
+ *       the registers that were to be written.
+ * Note: Use this from a FleetOperation to provision many devices at once;
+ *       each device's time then depends on how many of its registers
+ *       differ, not on how many desired holds.
+**/
+int ApplyConfigSnapshot(int handle, const ConfigSnapshot & desired, ConfigCache * cache,
+	ConfigApplyReport * report, int * errorAddress);
+
+/**
+ * Desc: Returns whether name is an IP address setting such as ETHERNET_IP or
+ *       WIFI_GATEWAY_DEFAULT, which snapshots write in dotted form.
+**/
+bool IsConfigIPRegister(const std::string & name, int type);
+
+
+// Source
+
+inline bool IsConfigIPRegister(const std::string & name, int type)
+{
+	static const char * const SUFFIXES[] = {"_IP", "_SUBNET", "_GATEWAY", "_DNS", "_ALTDNS"};
+	size_t i;
+	std::string base = name;
+
+	if (type != LJM_UINT32) {
+		return false;
+	}
+	if (base.size() > 8 && base.compare(base.size() - 8, 8, "_DEFAULT") == 0) {
+		base.erase(base.size() - 8);
+	}
+	for (i = 0; i < sizeof(SUFFIXES) / sizeof(SUFFIXES[0]); i++) {
+		size_t length = strlen(SUFFIXES[i]);
+		if (base.size() > length && base.compare(base.size() - length, length, SUFFIXES[i]) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+inline ConfigSnapshot::ConfigSnapshot():
+	lastReadFrames(0),
+	lastReadRoundTrips(0)
+{
+}
+
+inline void ConfigSnapshot::Clear()
+{
+	entries.clear();
+	entryIndexes.clear();
+}
+
+// Calls setter(entry) for the entry of name, or of each name of its range
+template<class Setter>
+inline int ConfigSnapshot::ForEachName(const char * name, Setter setter)
+{
+	int first, last, index, numChars = 0, err;
+	const char * hash = strchr(name, '#');
+	ConfigSnapshotEntry * entry;
+
+	if (hash == NULL) {
+		err = Entry(name, &entry);
+		return err != LJME_NOERROR ? err : setter(*entry);
+	}
+
+	if (sscanf(hash, "#(%d:%d)%n", &first, &last, &numChars) != 2 || numChars == 0 ||
+		first < 0 || last < first)
+	{
+		return LJME_INVALID_NAME;
+	}
+	std::string prefix(name, hash - name);
+	std::string suffix(hash + numChars);
+	for (index = first; index <= last; index++) {
+		char number[16];
+		snprintf(number, sizeof(number), "%d", index);
+		err = Entry(prefix + number + suffix, &entry);
+		if (err == LJME_NOERROR) {
+			err = setter(*entry);
+		}
+		if (err != LJME_NOERROR) {
+			return err;
+		}
+	}
+	return LJME_NOERROR;
+}
+
+// Finds or adds the entry of a single register
+inline int ConfigSnapshot::Entry(const std::string & name, ConfigSnapshotEntry ** entry)
+{
+	int address, type, err;
+	std::map<std::string, size_t>::iterator found = entryIndexes.find(name);
+
+	if (found != entryIndexes.end()) {
+		*entry = &entries[found->second];
+		return LJME_NOERROR;
+	}
+
+	err = LJM_NameToAddress(name.c_str(), &address, &type);
+	if (err != LJME_NOERROR || address == LJM_INVALID_NAME_ADDRESS) {
+		return LJME_INVALID_NAME;
+	}
+
+	ConfigSnapshotEntry added;
+	added.name = name;
+	added.address = address;
+	added.type = type;
+	added.value = 0;
+	entryIndexes[name] = entries.size();
+	entries.push_back(added);
+	*entry = &entries.back();
+	return LJME_NOERROR;
+}
+
+inline void ConfigSnapshot::AddEntry(const ConfigSnapshotEntry & entry)
+{
+	std::map<std::string, size_t>::iterator found = entryIndexes.find(entry.name);
+	if (found != entryIndexes.end()) {
+		entries[found->second] = entry;
+		return;
+	}
+	entryIndexes[entry.name] = entries.size();
+	entries.push_back(entry);
+}
+
+inline int ConfigSnapshot::Add(const char * name)
+{
+	return ForEachName(name, [](ConfigSnapshotEntry &) { return LJME_NOERROR; });
+}
+
+inline int ConfigSnapshot::AddDefaultRegisters()
+{
+	int i, err;
+	for (i = 0; i < CONFIG_SNAPSHOT_NUM_DEFAULT_REGISTERS; i++) {
+		err = Add(CONFIG_SNAPSHOT_DEFAULT_REGISTERS[i]);
+		if (err != LJME_NOERROR) {
+			return err;
+		}
+	}
+	return LJME_NOERROR;
+}
+
+inline int ConfigSnapshot::Set(const char * name, double value)
+{
+	return ForEachName(name, [value](ConfigSnapshotEntry & entry) {
+		if (entry.type == LJM_STRING) {
+			return LJME_UNKNOWN_VALUE_TYPE;
+		}
+		entry.value = NormalizeConfigValue(entry.type, value);
+		return LJME_NOERROR;
+	});
+}
+
+inline int ConfigSnapshot::SetString(const char * name, const char * text)
+{
+	return ForEachName(name, [text](ConfigSnapshotEntry & entry) {
+		if (entry.type != LJM_STRING) {
+			return LJME_UNKNOWN_VALUE_TYPE;
+		}
+		// The device stores at most LJM_STRING_ALLOCATION_SIZE - 1 characters
+		entry.text.assign(text, strnlen(text, LJM_STRING_ALLOCATION_SIZE - 1));
+		return LJME_NOERROR;
+	});
+}
+
+inline const ConfigSnapshotEntry * ConfigSnapshot::Find(const char * name) const
+{
+	std::map<std::string, size_t>::const_iterator found = entryIndexes.find(name);
+	return found == entryIndexes.end() ? NULL : &entries[found->second];
+}
+
+inline int ConfigSnapshot::Read(int handle, int * errorAddress)
+{
+	int deviceType, connectionType, serialNumber, ipAddress, port, maxBytesPerMB, err;
+	size_t i, j;
+	FramePlan plan;
+	std::vector<size_t> order(entries.size());
+	std::vector<int> offsets(entries.size());
+
+	err = LJM_GetHandleInfo(handle, &deviceType, &connectionType, &serialNumber,
+		&ipAddress, &port, &maxBytesPerMB);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+	plan.SetMaxBytesPerMB(maxBytesPerMB);
+
+	for (i = 0; i < order.size(); i++) {
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+		return entries[a].address < entries[b].address;
+	});
+
+	// Strings are read as bytes, which Feedback frames can carry
+	for (i = 0; i < order.size(); i++) {
+		const ConfigSnapshotEntry & entry = entries[order[i]];
+		if (entry.type == LJM_STRING) {
+			offsets[order[i]] = plan.AddRead(entry.address, LJM_BYTE,
+				LJM_STRING_ALLOCATION_SIZE);
+		}
+		else {
+			offsets[order[i]] = plan.AddRead(entry.address, entry.type);
+		}
+	}
+	lastReadFrames = plan.NumFrames();
+	lastReadRoundTrips = plan.NumPackets();
+	if (plan.NumFrames() == 0) {
+		return LJME_NOERROR;
+	}
+
+	err = plan.Execute(handle, errorAddress);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+
+	for (i = 0; i < entries.size(); i++) {
+		const double * values = plan.Values() + offsets[i];
+		if (entries[i].type == LJM_STRING) {
+			entries[i].text.clear();
+			for (j = 0; j < LJM_STRING_ALLOCATION_SIZE - 1 && values[j] != 0; j++) {
+				entries[i].text += (char)(unsigned char)values[j];
+			}
+		}
+		else {
+			entries[i].value = values[0];
+		}
+	}
+	return LJME_NOERROR;
+}
+
+inline void ConfigSnapshot::Write(FILE * file, const char * comment) const
+{
+	size_t i, j;
+	char IPv4String[LJM_IPv4_STRING_SIZE];
+
+	if (comment != NULL) {
+		fprintf(file, "# %s\n", comment);
+	}
+	for (i = 0; i < entries.size(); i++) {
+		const ConfigSnapshotEntry & entry = entries[i];
+		fprintf(file, "%s = ", entry.name.c_str());
+		if (entry.type == LJM_STRING) {
+			fputc('"', file);
+			for (j = 0; j < entry.text.size(); j++) {
+				if (entry.text[j] == '"' || entry.text[j] == '\\') {
+					fputc('\\', file);
+				}
+				fputc(entry.text[j], file);
+			}
+			fputs("\"\n", file);
+		}
+		else if (IsConfigIPRegister(entry.name, entry.type) &&
+			LJM_NumberToIP((unsigned int)entry.value, IPv4String) == LJME_NOERROR)
+		{
+			fprintf(file, "%s\n", IPv4String);
+		}
+		else if (entry.type == LJM_FLOAT32) {
+			// Enough digits for the value to read back as the same float
+			fprintf(file, "%.9g\n", entry.value);
+		}
+		else {
+			fprintf(file, "%.0f\n", entry.value);
+		}
+	}
+}
+
+inline int ConfigSnapshot::Save(const char * path, const char * comment) const
+{
+	FILE * file = fopen(path, "w");
+	if (file == NULL) {
+		return LJME_UNKNOWN_ERROR;
+	}
+	Write(file, comment);
+	return fclose(file) == 0 ? LJME_NOERROR : LJME_UNKNOWN_ERROR;
+}
+
+inline int ConfigSnapshot::Load(const char * path, int * errorLine)
+{
+	char line[LJM_MAX_NAME_SIZE + LJM_STRING_ALLOCATION_SIZE * 2];
+	int lineNumber = 0, err = LJME_NOERROR;
+	FILE * file = fopen(path, "r");
+
+	if (file == NULL) {
+		return LJME_CONSTANTS_FILE_NOT_FOUND;
+	}
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		lineNumber++;
+		char * start = line;
+		char * end = line + strlen(line);
+		while (end > start && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' ||
+			end[-1] == '\t'))
+		{
+			*--end = '\0';
+		}
+		while (*start == ' ' || *start == '\t') {
+			start++;
+		}
+		if (*start == '\0' || *start == '#') {
+			continue;
+		}
+
+		char * equals = strchr(start, '=');
+		if (equals == NULL) {
+			err = LJME_INVALID_NAME;
+			break;
+		}
+		char * nameEnd = equals;
+		while (nameEnd > start && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t')) {
+			nameEnd--;
+		}
+		std::string name(start, nameEnd - start);
+		char * value = equals + 1;
+		while (*value == ' ' || *value == '\t') {
+			value++;
+		}
+
+		if (*value == '"') {
+			std::string text;
+			for (value++; *value != '\0' && *value != '"'; value++) {
+				if (*value == '\\' && value[1] != '\0') {
+					value++;
+				}
+				text += *value;
+			}
+			err = *value == '"' ? SetString(name.c_str(), text.c_str()) : LJME_INVALID_VALUE;
+		}
+		else {
+			unsigned int ip;
+			char * parsedEnd;
+			double number = strtod(value, &parsedEnd);
+			if (strchr(value, '.') != strrchr(value, '.') &&
+				LJM_IPToNumber(value, &ip) == LJME_NOERROR)
+			{
+				err = Set(name.c_str(), ip);
+			}
+			else if (parsedEnd != value && *parsedEnd == '\0') {
+				err = Set(name.c_str(), number);
+			}
+			else {
+				err = LJME_INVALID_VALUE;
+			}
+		}
+		if (err != LJME_NOERROR) {
+			break;
+		}
+	}
+	fclose(file);
+
+	if (err != LJME_NOERROR && errorLine != NULL) {
+		*errorLine = lineNumber;
+	}
+	return err;
+}
+
+inline std::vector<ConfigSnapshotEntry> DiffConfigSnapshots(const ConfigSnapshot & current,
+	const ConfigSnapshot & desired)
+{
+	size_t i;
+	std::map<int, const ConfigSnapshotEntry *> byAddress;
+	std::map<int, const ConfigSnapshotEntry *>::const_iterator found;
+	std::vector<ConfigSnapshotEntry> changes;
+
+	for (i = 0; i < current.Entries().size(); i++) {
+		byAddress[current.Entries()[i].address] = &current.Entries()[i];
+	}
+	for (i = 0; i < desired.Entries().size(); i++) {
+		const ConfigSnapshotEntry & entry = desired.Entries()[i];
+		found = byAddress.find(entry.address);
+		if (found == byAddress.end() ||
+			(entry.type == LJM_STRING && found->second->text != entry.text) ||
+			(entry.type != LJM_STRING && NormalizeConfigValue(entry.type, found->second->value) !=
+				NormalizeConfigValue(entry.type, entry.value)))
+		{
+			changes.push_back(entry);
+		}
+	}
+	return changes;
+}
+
+inline int ApplyConfigSnapshot(int handle, const ConfigSnapshot & desired, ConfigCache * cache,
+	ConfigApplyReport * report, int * errorAddress)
+{
+	int deviceType, connectionType, serialNumber, ipAddress, port, maxBytesPerMB, err;
+	size_t i, j;
+	double known;
+	ConfigSnapshot current, toRead;
+	ConfigApplyReport localReport;
+	FramePlan plan;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if (report == NULL) {
+		report = &localReport;
+	}
+	report->numRegisters = desired.NumEntries();
+	report->numRead = 0;
+	report->numChanged = 0;
+	report->readRoundTrips = 0;
+	report->writeRoundTrips = 0;
+	report->changed.clear();
+
+	err = LJM_GetHandleInfo(handle, &deviceType, &connectionType, &serialNumber,
+		&ipAddress, &port, &maxBytesPerMB);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+	plan.SetMaxBytesPerMB(maxBytesPerMB);
+
+	// Current values: from the cache where it knows them, read otherwise.
+	// The entries are already resolved, so no name is looked up again.
+	for (i = 0; i < desired.Entries().size(); i++) {
+		const ConfigSnapshotEntry & entry = desired.Entries()[i];
+		if (entry.type != LJM_STRING && cache != NULL && cache->Lookup(entry.address, &known)) {
+			ConfigSnapshotEntry cached = entry;
+			cached.value = known;
+			current.AddEntry(cached);
+		}
+		else {
+			toRead.AddEntry(entry);
+		}
+	}
+	report->numRead = toRead.NumEntries();
+	if (report->numRead > 0) {
+		err = toRead.Read(handle, errorAddress);
+		report->readRoundTrips = toRead.LastReadRoundTrips();
+		if (err != LJME_NOERROR) {
+			return err;
+		}
+		for (i = 0; i < toRead.Entries().size(); i++) {
+			current.AddEntry(toRead.Entries()[i]);
+		}
+	}
+
+	std::vector<ConfigSnapshotEntry> changes = DiffConfigSnapshots(current, desired);
+	for (i = 0; i < changes.size(); i++) {
+		if (changes[i].type == LJM_STRING) {
+			double bytes[LJM_STRING_ALLOCATION_SIZE] = {0};
+			for (j = 0; j < changes[i].text.size(); j++) {
+				bytes[j] = (unsigned char)changes[i].text[j];
+			}
+			plan.AddWrite(changes[i].address, LJM_BYTE, bytes, LJM_STRING_ALLOCATION_SIZE);
+		}
+		else {
+			plan.AddWrite(changes[i].address, changes[i].type, changes[i].value);
+		}
+		report->changed.push_back(changes[i].name);
+	}
+	report->numChanged = (int)changes.size();
+
+	if (plan.NumFrames() > 0) {
+		report->writeRoundTrips = plan.NumPackets();
+		err = plan.Execute(handle, errorAddress);
+	}
+
+	if (cache != NULL) {
+		if (err == LJME_NOERROR) {
+			for (i = 0; i < desired.Entries().size(); i++) {
+				const ConfigSnapshotEntry & entry = desired.Entries()[i];
+				if (entry.type != LJM_STRING) {
+					cache->Store(entry.address, NormalizeConfigValue(entry.type, entry.value));
+				}
+			}
+		}
+		else {
+			for (i = 0; i < changes.size(); i++) {
+				cache->Forget(changes[i].address);
+			}
+		}
+	}
+
+	report->ms = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+	return err;
+}
+
+#endif // #define LJM_CONFIG_SNAPSHOT
@@ -0,0 +1,398 @@
+/**
+ * Name: LJM_ConfigTransaction.h
+ * Desc: Gathers configuration writes, drops the ones that would write a value
+ *       the device is already known to hold, and sends the rest with the
+ *       fewest Feedback packets MaxBytesPerMB allows. C++ only.
+**/
+
+#ifndef LJM_CONFIG_TRANSACTION
+#define LJM_CONFIG_TRANSACTION
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../LJM_FramePlan.h"
+
+// The T7 names its analog inputs AIN#(0:254)
+enum { CONFIG_MAX_AIN_CHANNEL = 254 };
+
+/**
+ * Desc: Returns value as the device stores it for type, so cached values
+ *       compare equal to what the device would read back.
+**/
+double NormalizeConfigValue(int type, double value);
+
+/**
+ * Name: ConfigCache
+ * Desc: The last value written to each register of one device, as known from
+ *       committed ConfigTransactions. Keep one ConfigCache per device for as
+ *       long as the device keeps its configuration.
+ * Note: Clear the cache when the device restarts, or when other code writes
+ *       its configuration.
+**/
+class ConfigCache
+{
+public:
+	bool Lookup(int address, double * value) const;
+	void Store(int address, double value) { values[address] = value; }
+	void Forget(int address) { values.erase(address); }
+	void Clear() { values.clear(); }
+
+	int NumEntries() const { return (int)values.size(); }
+	const std::map<int, double> & Entries() const { return values; }
+
+private:
+	std::map<int, double> values;
+};
+
+/**
+ * Name: ConfigTransaction
+ * Desc: Write/WriteAddress queue a write unless the cache, or an earlier write
+ *       in the same transaction, shows the register already holds the value.
+ *       Commit sends the queued writes and updates the cache.
+ *
+ *       AIN_ALL_x writes set AINn_x for every channel, so by name:
+ *           - writing AIN_ALL_x forgets the cached AINn_x values,
+ *           - writing AINn_x forgets the cached AIN_ALL_x value.
+ *       WriteAddress can't recognize these registers; use Write for them.
+ *
+ * Note: Writes are sent in the order they were queued, merging consecutive
+ *       registers into array writes. SetSortByAddress(true) sorts them by
+ *       address first, which merges interleaved per-channel settings (range,
+ *       resolution, settling for each AIN) into one array write per setting.
+ *       Only sort when the order of the writes does not matter.
+ * Note: Registers that act on each write rather than hold a setting (stream
+ *       out buffers, STREAM_ENABLE, ..._SET_LOOP) must be written with
+ *       WriteUncached so they are never dropped.
+**/
+class ConfigTransaction
+{
+public:
+	/**
+	 * Para: handle, an open device handle. MaxBytesPerMB is read from it.
+	 *       cache, the device's cache. May be NULL, in which case only repeated
+	 *           writes within the transaction are dropped.
+	**/
+	ConfigTransaction(int handle, ConfigCache * cache = NULL);
+
+	/**
+	 * Desc: Queues a write of a named register, unless it is redundant.
+	 * Retr: LJME_NOERROR, or the LJM_NameToAddress error for an unknown name.
+	**/
+	int Write(const char * name, double value);
+	int WriteAddress(int address, int type, double value);
+
+	/**
+	 * Desc: Queues a write that is always sent.
+	**/
+	int WriteUncached(const char * name, double value);
+	void WriteAddressUncached(int address, int type, double value);
+
+	void SetSortByAddress(bool sort) { sortByAddress = sort; }
+
+	/**
+	 * Desc: Sends the queued writes, then empties the transaction.
+	 * Para: errorAddress, updated with the address of the write that failed,
+	 *           if the device reported one. May be NULL.
+	 * Retr: LJME_NOERROR or the first error. On error, writes after the failing
+	 *       packet are not sent, and the cache forgets every register this
+	 *       transaction touched.
+	**/
+	int Commit(int * errorAddress);
+
+	/**
+	 * Desc: Empties the transaction without sending anything.
+	**/
+	void Discard();
+
+	/**
+	 * Desc: Writes queued, and redundant writes dropped, since the last
+	 *       Commit or Discard.
+	**/
+	int NumQueued() const { return (int)writes.size(); }
+	int NumSkipped() const { return numSkipped; }
+
+	/**
+	 * Desc: Feedback packets sent by this transaction's commits.
+	**/
+	long long RoundTrips() const { return plan.RoundTrips(); }
+
+private:
+	struct PendingWrite
+	{
+		int address;
+		int type;
+		double value;
+	};
+
+	// A register's value as far as this transaction knows: a queued value,
+	// or unknown because an AIN_ALL_x write changed it
+	struct Overlay
+	{
+		bool known;
+		double value;
+	};
+
+	// Addresses of AIN_ALL_x and of the AINn_x registers it sets
+	struct AINAlias
+	{
+		bool valid;
+		int allAddress;
+		int firstAddress;
+		int stride;
+	};
+
+	bool Known(int address, double * value) const;
+	void Queue(int address, int type, double value);
+	const AINAlias & AliasFor(const std::string & suffix);
+	void ForgetChannels(const AINAlias & alias);
+
+	int handle;
+	ConfigCache * cache;
+	bool sortByAddress;
+	int numSkipped;
+
+	std::vector<PendingWrite> writes;
+	std::map<int, Overlay> overlay;
+	std::map<std::string, AINAlias> aliases;
+	FramePlan plan;
+};
+
+
+// Source
+
+inline double NormalizeConfigValue(int type, double value)
+{
+	switch (type) {
+	case LJM_FLOAT32:
+		return (float)value;
+	case LJM_UINT16:
+		return (unsigned short)(long long)value;
+	case LJM_UINT32:
+		return (unsigned int)(long long)value;
+	case LJM_INT32:
+		return (int)(long long)value;
+	case LJM_BYTE:
+		return (unsigned char)(long long)value;
+	default:
+		return value;
+	}
+}
+
+inline bool ConfigCache::Lookup(int address, double * value) const
+{
+	std::map<int, double>::const_iterator found = values.find(address);
+	if (found == values.end()) {
+		return false;
+	}
+	*value = found->second;
+	return true;
+}
+
+inline ConfigTransaction::ConfigTransaction(int handle, ConfigCache * cache) :
+	handle(handle),
+	cache(cache),
+	sortByAddress(false),
+	numSkipped(0)
+{
+	int deviceType, connectionType, serialNumber, ipAddress, port, maxBytesPerMB;
+	int err = LJM_GetHandleInfo(handle, &deviceType, &connectionType, &serialNumber,
+		&ipAddress, &port, &maxBytesPerMB);
+	PrintErrorIfError(err, "ConfigTransaction: LJM_GetHandleInfo(%d, ...)", handle);
+	if (err == LJME_NOERROR) {
+		plan.SetMaxBytesPerMB(maxBytesPerMB);
+	}
+}
+
+inline bool ConfigTransaction::Known(int address, double * value) const
+{
+	std::map<int, Overlay>::const_iterator found = overlay.find(address);
+	if (found != overlay.end()) {
+		*value = found->second.value;
+		return found->second.known;
+	}
+	return cache != NULL && cache->Lookup(address, value);
+}
+
+inline void ConfigTransaction::Queue(int address, int type, double value)
+{
+	PendingWrite write;
+	write.address = address;
+	write.type = type;
+	write.value = value;
+	writes.push_back(write);
+
+	overlay[address].known = true;
+	overlay[address].value = NormalizeConfigValue(type, value);
+}
+
+inline int ConfigTransaction::WriteAddress(int address, int type, double value)
+{
+	double known;
+	if (Known(address, &known) && known == NormalizeConfigValue(type, value)) {
+		++numSkipped;
+		return LJME_NOERROR;
+	}
+	Queue(address, type, value);
+	return LJME_NOERROR;
+}
+
+inline void ConfigTransaction::WriteAddressUncached(int address, int type, double value)
+{
+	PendingWrite write;
+	write.address = address;
+	write.type = type;
+	write.value = value;
+	writes.push_back(write);
+
+	// The register's value afterwards isn't a setting worth remembering
+	overlay[address].known = false;
+}
+
+inline int ConfigTransaction::WriteUncached(const char * name, double value)
+{
+	int address, type;
+	int err = LJM_NameToAddress(name, &address, &type);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+	if (address == LJM_INVALID_NAME_ADDRESS) {
+		return LJME_INVALID_NAME;
+	}
+	WriteAddressUncached(address, type, value);
+	return LJME_NOERROR;
+}
+
+inline int ConfigTransaction::Write(const char * name, double value)
+{
+	int address, type, channel, numChars = 0;
+	double known;
+	int err = LJM_NameToAddress(name, &address, &type);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+	if (address == LJM_INVALID_NAME_ADDRESS) {
+		return LJME_INVALID_NAME;
+	}
+
+	if (Known(address, &known) && known == NormalizeConfigValue(type, value)) {
+		++numSkipped;
+		return LJME_NOERROR;
+	}
+
+	if (strncmp(name, "AIN_ALL_", 8) == 0) {
+		const AINAlias & alias = AliasFor(name + 8);
+		if (alias.valid) {
+			ForgetChannels(alias);
+		}
+	}
+	else if (sscanf(name, "AIN%d_%n", &channel, &numChars) == 1 && numChars > 0) {
+		const AINAlias & alias = AliasFor(name + numChars);
+		if (alias.valid) {
+			overlay[alias.allAddress].known = false;
+		}
+	}
+
+	Queue(address, type, value);
+	return LJME_NOERROR;
+}
+
+inline const ConfigTransaction::AINAlias & ConfigTransaction::AliasFor(
+	const std::string & suffix)
+{
+	std::map<std::string, AINAlias>::iterator found = aliases.find(suffix);
+	if (found != aliases.end()) {
+		return found->second;
+	}
+
+	AINAlias & alias = aliases[suffix];
+	int type, secondAddress;
+	alias.valid =
+		LJM_NameToAddress(("AIN_ALL_" + suffix).c_str(), &alias.allAddress, &type) ==
+			LJME_NOERROR &&
+		LJM_NameToAddress(("AIN0_" + suffix).c_str(), &alias.firstAddress, &type) ==
+			LJME_NOERROR &&
+		LJM_NameToAddress(("AIN1_" + suffix).c_str(), &secondAddress, &type) ==
+			LJME_NOERROR &&
+		alias.allAddress != LJM_INVALID_NAME_ADDRESS &&
+		alias.firstAddress != LJM_INVALID_NAME_ADDRESS &&
+		secondAddress > alias.firstAddress;
+	alias.stride = alias.valid ? secondAddress - alias.firstAddress : 0;
+	return alias;
+}
+
+inline void ConfigTransaction::ForgetChannels(const AINAlias & alias)
+{
+	int lastAddress = alias.firstAddress + alias.stride * CONFIG_MAX_AIN_CHANNEL;
+	std::vector<int> addresses;
+	std::map<int, Overlay>::iterator overlayIt;
+	std::map<int, double>::const_iterator cacheIt;
+	size_t i;
+
+	for (overlayIt = overlay.lower_bound(alias.firstAddress);
+		overlayIt != overlay.end() && overlayIt->first <= lastAddress; ++overlayIt)
+	{
+		addresses.push_back(overlayIt->first);
+	}
+	if (cache != NULL) {
+		for (cacheIt = cache->Entries().lower_bound(alias.firstAddress);
+			cacheIt != cache->Entries().end() && cacheIt->first <= lastAddress; ++cacheIt)
+		{
+			addresses.push_back(cacheIt->first);
+		}
+	}
+
+	for (i = 0; i < addresses.size(); i++) {
+		if ((addresses[i] - alias.firstAddress) % alias.stride == 0) {
+			overlay[addresses[i]].known = false;
+		}
+	}
+}
+
+inline int ConfigTransaction::Commit(int * errorAddress)
+{
+	size_t writeI;
+	int err = LJME_NOERROR;
+	std::map<int, Overlay>::iterator it;
+
+	if (sortByAddress) {
+		std::stable_sort(writes.begin(), writes.end(),
+			[](const PendingWrite & a, const PendingWrite & b) { return a.address < b.address; });
+	}
+
+	plan.Clear();
+	for (writeI = 0; writeI < writes.size(); writeI++) {
+		plan.AddWrite(writes[writeI].address, writes[writeI].type, writes[writeI].value);
+	}
+	if (plan.NumFrames() > 0) {
+		err = plan.Execute(handle, errorAddress);
+	}
+
+	if (cache != NULL) {
+		for (it = overlay.begin(); it != overlay.end(); ++it) {
+			if (err == LJME_NOERROR && it->second.known) {
+				cache->Store(it->first, it->second.value);
+			}
+			else {
+				cache->Forget(it->first);
+			}
+		}
+	}
+
+	Discard();
+	return err;
+}
+
+inline void ConfigTransaction::Discard()
+{
+	writes.clear();
+	overlay.clear();
+	numSkipped = 0;
+}
+
+#endif // #define LJM_CONFIG_TRANSACTION
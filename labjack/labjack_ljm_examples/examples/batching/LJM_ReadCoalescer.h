@@ -0,0 +1,294 @@
+/**
+ * Name: LJM_ReadCoalescer.h
+ * Desc: Collects register reads issued by many callers within a short batching
+ *       window and performs them together with the fewest Feedback packets.
+ *       Results are delivered through std::future. C++11 only.
+**/
+
+#ifndef LJM_READ_COALESCER
+#define LJM_READ_COALESCER
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../LJM_FramePlan.h"
+
+/**
+ * Desc: The result of one coalesced read. err is LJME_NOERROR on success.
+**/
+struct CoalescedRead
+{
+	int err;
+	double value;
+};
+
+/**
+ * Desc: Counters for a ReadCoalescer. Latency is measured from the Read call
+ *       until the result is available.
+**/
+struct ReadCoalescerStats
+{
+	long long requests;
+	long long uniqueReads;
+	long long batches;
+	long long roundTrips;
+	double totalLatencyUS;
+	double maxLatencyUS;
+};
+
+/**
+ * Name: ReadCoalescer
+ * Desc: Owns a background thread that performs the reads for a handle. Each
+ *       batch waits windowUS microseconds after the first pending read for
+ *       more reads to arrive, then:
+ *           - merges duplicate reads of the same register,
+ *           - sorts by address so contiguous registers become array reads,
+ *           - packs the reads into packets bounded by MaxBytesPerMB.
+ *       If a batch fails, its reads are retried one at a time so that a single
+ *       bad register does not fail the others.
+ * Note: The handle must not be used by other threads while the coalescer runs.
+**/
+class ReadCoalescer
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	/**
+	 * Para: handle, an open device handle. MaxBytesPerMB is read from it.
+	 *       windowUS, how long to wait for more reads after the first one.
+	 *       maxPending, a batch is started immediately once this many reads
+	 *           are pending.
+	**/
+	ReadCoalescer(int handle, unsigned int windowUS = 500, int maxPending = 256);
+	~ReadCoalescer();
+
+	/**
+	 * Desc: Queues a read of a named register. Returns a future for the result.
+	**/
+	std::future<CoalescedRead> Read(const char * name);
+
+	/**
+	 * Desc: Queues a read of a register by address and type.
+	**/
+	std::future<CoalescedRead> ReadAddress(int address, int type);
+
+	ReadCoalescerStats GetStats();
+
+private:
+	struct PendingRead
+	{
+		int address;
+		int type;
+		Clock::time_point queued;
+		std::shared_ptr<std::promise<CoalescedRead> > promise;
+	};
+
+	void Run();
+	void PerformBatch(std::vector<PendingRead> & batch);
+	void Fulfill(PendingRead & read, int err, double value);
+
+	int handle;
+	std::chrono::microseconds window;
+	size_t maxPending;
+
+	std::mutex mutex;
+	std::condition_variable pendingCondition;
+	std::vector<PendingRead> pending;
+	bool stopping;
+
+	FramePlan plan;
+	ReadCoalescerStats stats;
+	std::thread worker;
+};
+
+
+// Source
+
+inline ReadCoalescer::ReadCoalescer(int handle, unsigned int windowUS, int maxPending) :
+	handle(handle),
+	window(windowUS),
+	maxPending(maxPending > 0 ? maxPending : 1),
+	stopping(false)
+{
+	int deviceType, connectionType, serialNumber, ipAddress, port, maxBytesPerMB;
+	int err = LJM_GetHandleInfo(handle, &deviceType, &connectionType, &serialNumber,
+		&ipAddress, &port, &maxBytesPerMB);
+	PrintErrorIfError(err, "ReadCoalescer: LJM_GetHandleInfo(%d, ...)", handle);
+	if (err == LJME_NOERROR) {
+		plan.SetMaxBytesPerMB(maxBytesPerMB);
+	}
+
+	stats.requests = 0;
+	stats.uniqueReads = 0;
+	stats.batches = 0;
+	stats.roundTrips = 0;
+	stats.totalLatencyUS = 0;
+	stats.maxLatencyUS = 0;
+
+	worker = std::thread(&ReadCoalescer::Run, this);
+}
+
+inline ReadCoalescer::~ReadCoalescer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	pendingCondition.notify_all();
+	worker.join();
+}
+
+inline std::future<CoalescedRead> ReadCoalescer::Read(const char * name)
+{
+	int address = LJM_INVALID_NAME_ADDRESS;
+	int type = LJM_FLOAT32;
+	int err = LJM_NameToAddress(name, &address, &type);
+	if (err != LJME_NOERROR || address == LJM_INVALID_NAME_ADDRESS) {
+		std::promise<CoalescedRead> failed;
+		CoalescedRead result = {err != LJME_NOERROR ? err : LJME_INVALID_NAME, 0.0};
+		failed.set_value(result);
+		return failed.get_future();
+	}
+	return ReadAddress(address, type);
+}
+
+inline std::future<CoalescedRead> ReadCoalescer::ReadAddress(int address, int type)
+{
+	PendingRead read;
+	read.address = address;
+	read.type = type;
+	read.queued = Clock::now();
+	read.promise = std::make_shared<std::promise<CoalescedRead> >();
+	std::future<CoalescedRead> future = read.promise->get_future();
+
+	bool wake;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.push_back(read);
+		wake = pending.size() == 1 || pending.size() >= maxPending;
+	}
+	if (wake) {
+		pendingCondition.notify_one();
+	}
+
+	return future;
+}
+
+inline ReadCoalescerStats ReadCoalescer::GetStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+inline void ReadCoalescer::Run()
+{
+	std::vector<PendingRead> batch;
+	Clock::time_point deadline;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		while (!stopping && pending.empty()) {
+			pendingCondition.wait(lock);
+		}
+		if (stopping && pending.empty()) {
+			return;
+		}
+
+		// Give other callers the window to add their reads to this batch
+		deadline = pending.front().queued + window;
+		while (!stopping && pending.size() < maxPending &&
+			pendingCondition.wait_until(lock, deadline) != std::cv_status::timeout)
+		{
+		}
+
+		batch.swap(pending);
+		pending.clear();
+
+		lock.unlock();
+		PerformBatch(batch);
+		batch.clear();
+		lock.lock();
+	}
+}
+
+inline void ReadCoalescer::PerformBatch(std::vector<PendingRead> & batch)
+{
+	size_t readI;
+	int err, errorAddress = INITIAL_ERR_ADDRESS;
+	long long roundTripsBefore = plan.RoundTrips();
+	long long roundTrips;
+	double value;
+	std::map<std::pair<int, int>, int> offsets;
+	std::map<std::pair<int, int>, int>::iterator found;
+	std::vector<std::pair<std::pair<int, int>, size_t> > order;
+
+	// Sort by address so that contiguous registers merge into array frames
+	order.reserve(batch.size());
+	for (readI = 0; readI < batch.size(); readI++) {
+		order.push_back(std::make_pair(
+			std::make_pair(batch[readI].address, batch[readI].type), readI));
+	}
+	std::stable_sort(order.begin(), order.end(),
+		[](const std::pair<std::pair<int, int>, size_t> & a,
+			const std::pair<std::pair<int, int>, size_t> & b) { return a.first < b.first; });
+
+	plan.Clear();
+	for (readI = 0; readI < order.size(); readI++) {
+		if (offsets.find(order[readI].first) == offsets.end()) {
+			offsets[order[readI].first] = plan.AddRead(order[readI].first.first,
+				order[readI].first.second);
+		}
+	}
+
+	err = plan.Execute(handle, &errorAddress);
+
+	for (readI = 0; readI < batch.size(); readI++) {
+		PendingRead & read = batch[readI];
+		if (err == LJME_NOERROR) {
+			found = offsets.find(std::make_pair(read.address, read.type));
+			Fulfill(read, LJME_NOERROR, plan.Values()[found->second]);
+		}
+		else {
+			// Isolate the failing register(s) with individual reads
+			int readErr = LJM_eReadAddress(handle, read.address, read.type, &value);
+			Fulfill(read, readErr, readErr == LJME_NOERROR ? value : 0.0);
+		}
+	}
+
+	roundTrips = plan.RoundTrips() - roundTripsBefore;
+	if (err != LJME_NOERROR) {
+		roundTrips += (long long)batch.size();
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	stats.requests += (long long)batch.size();
+	stats.uniqueReads += (long long)offsets.size();
+	stats.batches += 1;
+	stats.roundTrips += roundTrips;
+}
+
+inline void ReadCoalescer::Fulfill(PendingRead & read, int err, double value)
+{
+	double latencyUS = std::chrono::duration<double, std::micro>(
+		Clock::now() - read.queued).count();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.totalLatencyUS += latencyUS;
+		if (latencyUS > stats.maxLatencyUS) {
+			stats.maxLatencyUS = latencyUS;
+		}
+	}
+
+	CoalescedRead result = {err, value};
+	read.promise->set_value(result);
+}
+
+#endif // #define LJM_READ_COALESCER
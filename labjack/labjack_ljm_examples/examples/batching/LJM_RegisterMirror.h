@@ -0,0 +1,344 @@
+/**
+ * Name: LJM_RegisterMirror.h
+ * Desc: Keeps a local copy of a declared set of registers up to date from one
+ *       poller thread. Any number of reader threads take consistent snapshots
+ *       of the copy without locking and without talking to the device, so
+ *       device traffic does not grow with the number of readers. C++11 only.
+**/
+
+#ifndef LJM_REGISTER_MIRROR
+#define LJM_REGISTER_MIRROR
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../LJM_FramePlan.h"
+
+/**
+ * Desc: A consistent copy of every mirrored value.
+ *       err is the result of the most recent refresh. On a failed refresh the
+ *       values and updated time of the last successful refresh are kept, so
+ *       AgeMS shows how stale they are.
+ *       sequence counts successful refreshes; it is 0 until the first one.
+**/
+struct MirrorSnapshot
+{
+	int err;
+	int errorAddress;
+	long long sequence;
+	std::chrono::steady_clock::time_point updated;
+	std::vector<double> values;
+
+	double AgeMS() const
+	{
+		return std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - updated).count();
+	}
+};
+
+/**
+ * Desc: Counters for a RegisterMirror. snapshotRetries counts snapshots that
+ *       had to be copied again because the poller overwrote them mid-copy.
+ *       Snapshots themselves are not counted, so readers share no counter.
+**/
+struct RegisterMirrorStats
+{
+	long long refreshes;
+	long long errors;
+	long long roundTrips;
+	long long snapshotRetries;
+};
+
+/**
+ * Name: RegisterMirror
+ * Desc: Registers are declared before Start, then refreshed every intervalUS
+ *       with the fewest Feedback packets MaxBytesPerMB allows. Each refresh is
+ *       published through a seqlock over two buffers: the poller writes the
+ *       buffer readers are not using, so a reader only copies again if a
+ *       whole refresh completes while it is copying.
+ * Note: Declare contiguous registers in address order (e.g. AIN0, AIN1, ...)
+ *       so they are read as one array frame.
+ * Note: The handle must not be used by other threads while the mirror runs.
+**/
+class RegisterMirror
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	/**
+	 * Para: handle, an open device handle. MaxBytesPerMB is read from it.
+	 *       intervalUS, the time between the starts of two refreshes. A refresh
+	 *           that overruns the interval delays the next one rather than
+	 *           causing a burst of catch-up refreshes.
+	**/
+	RegisterMirror(int handle, unsigned int intervalUS = 10000);
+	~RegisterMirror();
+
+	/**
+	 * Desc: Adds a named register to the mirror. Must be called before the
+	 *       first Start.
+	 * Para: index, output. The index of the value in MirrorSnapshot::values.
+	 * Retr: LJME_NOERROR, LJME_INVALID_NAME, or LJME_UNKNOWN_ERROR if the
+	 *       mirror has been started.
+	**/
+	int Declare(const char * name, int * index);
+
+	/**
+	 * Desc: Adds numValues registers of type starting at address. Returns the
+	 *       index of the first value, or -1 if the mirror has been started.
+	**/
+	int DeclareAddress(int address, int type, int numValues = 1);
+
+	int NumValues() const { return plan.NumValues(); }
+
+	/**
+	 * Desc: Starts the poller thread. Does nothing if it is already running.
+	**/
+	void Start();
+	void Stop();
+
+	/**
+	 * Desc: Copies the latest values into snapshot. Never blocks on the poller
+	 *       or the device. snapshot.values is only reallocated the first time.
+	 * Retr: The error of the most recent refresh, as snapshot.err.
+	**/
+	int Snapshot(MirrorSnapshot & snapshot) const;
+
+	RegisterMirrorStats GetStats() const;
+
+private:
+	struct Slot
+	{
+		std::atomic<unsigned long long> seq;
+		std::atomic<long long> sequence;
+		std::atomic<long long> updatedNS;
+		std::unique_ptr<std::atomic<double>[]> values;
+	};
+
+	void Run();
+	void Publish(const double * aValues, Clock::time_point updated);
+
+	int handle;
+	std::chrono::microseconds interval;
+	FramePlan plan;
+
+	// Publish n writes slots[n % 2], then sets published to n
+	Slot slots[2];
+	std::atomic<long long> published;
+	std::atomic<int> lastError;
+	std::atomic<int> lastErrorAddress;
+
+	std::atomic<long long> refreshes;
+	std::atomic<long long> errors;
+	std::atomic<long long> roundTrips;
+	mutable std::atomic<long long> snapshotRetries;
+
+	std::mutex mutex;
+	std::condition_variable stopCondition;
+	bool running;
+	std::thread poller;
+};
+
+
+// Source
+
+inline RegisterMirror::RegisterMirror(int handle, unsigned int intervalUS) :
+	handle(handle),
+	interval(intervalUS),
+	published(0),
+	lastError(LJME_NOERROR),
+	lastErrorAddress(INITIAL_ERR_ADDRESS),
+	refreshes(0),
+	errors(0),
+	roundTrips(0),
+	snapshotRetries(0),
+	running(false)
+{
+	int deviceType, connectionType, serialNumber, ipAddress, port, maxBytesPerMB;
+	int err = LJM_GetHandleInfo(handle, &deviceType, &connectionType, &serialNumber,
+		&ipAddress, &port, &maxBytesPerMB);
+	PrintErrorIfError(err, "RegisterMirror: LJM_GetHandleInfo(%d, ...)", handle);
+	if (err == LJME_NOERROR) {
+		plan.SetMaxBytesPerMB(maxBytesPerMB);
+	}
+
+	slots[0].seq = slots[1].seq = 0;
+	slots[0].sequence = slots[1].sequence = 0;
+	slots[0].updatedNS = slots[1].updatedNS = 0;
+}
+
+inline RegisterMirror::~RegisterMirror()
+{
+	Stop();
+}
+
+inline int RegisterMirror::Declare(const char * name, int * index)
+{
+	int address = LJM_INVALID_NAME_ADDRESS;
+	int type = LJM_FLOAT32;
+	int err = LJM_NameToAddress(name, &address, &type);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+	if (address == LJM_INVALID_NAME_ADDRESS) {
+		return LJME_INVALID_NAME;
+	}
+
+	*index = DeclareAddress(address, type);
+	return *index < 0 ? LJME_UNKNOWN_ERROR : LJME_NOERROR;
+}
+
+inline int RegisterMirror::DeclareAddress(int address, int type, int numValues)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	// Readers may be copying the value buffers once the mirror has started
+	if (slots[0].values) {
+		return -1;
+	}
+	return plan.AddRead(address, type, numValues);
+}
+
+inline void RegisterMirror::Start()
+{
+	int slotI, valueI;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (running) {
+		return;
+	}
+
+	for (slotI = 0; slotI < 2 && !slots[slotI].values; slotI++) {
+		slots[slotI].values.reset(new std::atomic<double>[plan.NumValues()]);
+		for (valueI = 0; valueI < plan.NumValues(); valueI++) {
+			slots[slotI].values[valueI].store(0.0, std::memory_order_relaxed);
+		}
+	}
+
+	running = true;
+	poller = std::thread(&RegisterMirror::Run, this);
+}
+
+inline void RegisterMirror::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!running) {
+			return;
+		}
+		running = false;
+	}
+	stopCondition.notify_all();
+	poller.join();
+}
+
+inline void RegisterMirror::Run()
+{
+	int err, errorAddress;
+	Clock::time_point now, next = Clock::now();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (running) {
+		lock.unlock();
+
+		errorAddress = INITIAL_ERR_ADDRESS;
+		err = plan.Execute(handle, &errorAddress);
+		now = Clock::now();
+		if (err == LJME_NOERROR) {
+			Publish(plan.Values(), now);
+			++refreshes;
+		}
+		else {
+			++errors;
+			lastErrorAddress = errorAddress;
+		}
+		lastError = err;
+		roundTrips = plan.RoundTrips();
+
+		// Fixed rate, but skip refreshes that were missed
+		next += interval;
+		if (next < now) {
+			next = now;
+		}
+
+		lock.lock();
+		stopCondition.wait_until(lock, next, [this]() { return !running; });
+	}
+}
+
+inline void RegisterMirror::Publish(const double * aValues, Clock::time_point updated)
+{
+	int valueI;
+	long long n = published.load(std::memory_order_relaxed) + 1;
+	Slot & slot = slots[n % 2];
+	unsigned long long seq = slot.seq.load(std::memory_order_relaxed);
+
+	// An odd seq tells readers the slot is being written
+	slot.seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for (valueI = 0; valueI < plan.NumValues(); valueI++) {
+		slot.values[valueI].store(aValues[valueI], std::memory_order_relaxed);
+	}
+	slot.sequence.store(n, std::memory_order_relaxed);
+	slot.updatedNS.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		updated.time_since_epoch()).count(), std::memory_order_relaxed);
+
+	slot.seq.store(seq + 2, std::memory_order_release);
+	published.store(n, std::memory_order_release);
+}
+
+inline int RegisterMirror::Snapshot(MirrorSnapshot & snapshot) const
+{
+	int valueI;
+	int numValues = plan.NumValues();
+	long long n;
+	unsigned long long seqBefore, seqAfter;
+
+	snapshot.values.resize(numValues);
+	snapshot.err = lastError.load();
+	snapshot.errorAddress = lastErrorAddress.load();
+
+	while (true) {
+		n = published.load(std::memory_order_acquire);
+		if (n == 0) {
+			snapshot.sequence = 0;
+			snapshot.updated = Clock::time_point();
+			return snapshot.err;
+		}
+
+		const Slot & slot = slots[n % 2];
+		seqBefore = slot.seq.load(std::memory_order_acquire);
+		if ((seqBefore & 1) == 0) {
+			for (valueI = 0; valueI < numValues; valueI++) {
+				snapshot.values[valueI] = slot.values[valueI].load(std::memory_order_relaxed);
+			}
+			snapshot.sequence = slot.sequence.load(std::memory_order_relaxed);
+			snapshot.updated = Clock::time_point(std::chrono::duration_cast<Clock::duration>(
+				std::chrono::nanoseconds(slot.updatedNS.load(std::memory_order_relaxed))));
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			seqAfter = slot.seq.load(std::memory_order_relaxed);
+			if (seqBefore == seqAfter) {
+				return snapshot.err;
+			}
+		}
+		++snapshotRetries;
+	}
+}
+
+inline RegisterMirrorStats RegisterMirror::GetStats() const
+{
+	RegisterMirrorStats stats;
+	stats.refreshes = refreshes;
+	stats.errors = errors;
+	stats.roundTrips = roundTrips;
+	stats.snapshotRetries = snapshotRetries;
+	return stats;
+}
+
+#endif // #define LJM_REGISTER_MIRROR
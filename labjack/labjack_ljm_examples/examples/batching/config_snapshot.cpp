@@ -0,0 +1,141 @@
+/**
+ * Name: config_snapshot.cpp
+ * Desc: Reads the whole configuration of a device into a ConfigSnapshot,
+ *       saves it to config_snapshot.txt and compares that with reading the
+ *       same registers one at a time, as config/read_config.c and the other
+ *       read_*_config examples do.
+ *       Then applies a desired state: the file given as an argument, or
+ *       without one, the snapshot with AIN0-AIN3 set to the +/-1 V range.
+ *       Applies it again to show that nothing is written the second time,
+ *       and finally restores the configuration that was read.
+ * Usage: config_snapshot [desired-state file]
+**/
+
+// For printf
+#include <stdio.h>
+
+#include <chrono>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_ConfigSnapshot.h"
+
+const char * SNAPSHOT_PATH = "config_snapshot.txt";
+
+/**
+ * Desc: Reads every register of snapshot with its own LJM_eReadName or
+ *       LJM_eReadNameString call and returns the milliseconds that took.
+**/
+double ReadOneByOne(int handle, const ConfigSnapshot & snapshot);
+
+/**
+ * Desc: Applies desired to handle and prints a result row.
+**/
+void Apply(int handle, const ConfigSnapshot & desired, ConfigCache & cache,
+	const char * description);
+
+int main(int argc, char * argv[])
+{
+	int err, handle, errorLine = 0;
+	int errorAddress = INITIAL_ERR_ADDRESS;
+	ConfigSnapshot snapshot, desired;
+	ConfigCache cache;
+
+	// Open first found LabJack
+	err = LJM_Open(LJM_dtANY, LJM_ctANY, "LJM_idANY", &handle);
+	ErrorCheck(err, "LJM_Open");
+
+	PrintDeviceInfoFromHandle(handle);
+	printf("\n");
+
+	err = snapshot.AddDefaultRegisters();
+	ErrorCheck(err, "ConfigSnapshot::AddDefaultRegisters");
+
+	double oneByOneMS = ReadOneByOne(handle, snapshot);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	err = snapshot.Read(handle, &errorAddress);
+	ErrorCheckWithAddress(err, errorAddress, "ConfigSnapshot::Read");
+	double snapshotMS = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+
+	printf("Reading %d registers:\n", snapshot.NumEntries());
+	printf("    one at a time:    %3d round trips %8.1f ms\n", snapshot.NumEntries(),
+		oneByOneMS);
+	printf("    ConfigSnapshot:   %3lld round trips %8.1f ms (%d frames)\n\n",
+		snapshot.LastReadRoundTrips(), snapshotMS, snapshot.LastReadFrames());
+
+	err = snapshot.Save(SNAPSHOT_PATH, "Configuration read by config_snapshot");
+	ErrorCheck(err, "ConfigSnapshot::Save(%s)", SNAPSHOT_PATH);
+	printf("Saved to %s\n\n", SNAPSHOT_PATH);
+
+	if (argc > 1) {
+		err = desired.Load(argv[1], &errorLine);
+		ErrorCheck(err, "ConfigSnapshot::Load(%s), line %d", argv[1], errorLine);
+	}
+	else {
+		err = desired.Load(SNAPSHOT_PATH, &errorLine);
+		ErrorCheck(err, "ConfigSnapshot::Load(%s), line %d", SNAPSHOT_PATH, errorLine);
+		err = desired.Set("AIN#(0:3)_RANGE", 1.0);
+		ErrorCheck(err, "ConfigSnapshot::Set(AIN#(0:3)_RANGE)");
+	}
+
+	printf("%-24s %9s %5s %8s %12s %9s\n", "", "Registers", "Read", "Changed",
+		"Round trips", "Time");
+	Apply(handle, desired, cache, "Apply desired state");
+	Apply(handle, desired, cache, "Apply it again");
+	Apply(handle, snapshot, cache, "Restore the snapshot");
+
+	// Close
+	err = LJM_Close(handle);
+	ErrorCheck(err, "LJM_Close");
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+double ReadOneByOne(int handle, const ConfigSnapshot & snapshot)
+{
+	int err;
+	size_t i;
+	double value;
+	char text[LJM_STRING_ALLOCATION_SIZE];
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (i = 0; i < snapshot.Entries().size(); i++) {
+		const ConfigSnapshotEntry & entry = snapshot.Entries()[i];
+		if (entry.type == LJM_STRING) {
+			err = LJM_eReadNameString(handle, entry.name.c_str(), text);
+		}
+		else {
+			err = LJM_eReadName(handle, entry.name.c_str(), &value);
+		}
+		ErrorCheck(err, "Reading %s", entry.name.c_str());
+	}
+
+	return std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+void Apply(int handle, const ConfigSnapshot & desired, ConfigCache & cache,
+	const char * description)
+{
+	int errorAddress = INITIAL_ERR_ADDRESS;
+	size_t i;
+	ConfigApplyReport report;
+
+	int err = ApplyConfigSnapshot(handle, desired, &cache, &report, &errorAddress);
+	ErrorCheckWithAddress(err, errorAddress, "ApplyConfigSnapshot");
+
+	printf("%-24s %9d %5d %8d %12lld %6.1f ms\n", description, report.numRegisters,
+		report.numRead, report.numChanged, report.readRoundTrips + report.writeRoundTrips,
+		report.ms);
+	for (i = 0; i < report.changed.size(); i++) {
+		printf("%24s %s\n", "", report.changed[i].c_str());
+	}
+}
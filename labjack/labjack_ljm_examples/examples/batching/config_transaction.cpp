@@ -0,0 +1,145 @@
+/**
+ * Name: config_transaction.cpp
+ * Desc: Configures 14 AINs and stream settings the way testing/c-r_speed_test.c
+ *       (one LJM_eWriteNames call per AIN) and stream/stream_example.c (one
+ *       WriteNameOrDie call per setting) do, then with a ConfigTransaction,
+ *       and prints the round trips and time each takes.
+**/
+
+// For printf
+#include <stdio.h>
+
+#include <chrono>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_ConfigTransaction.h"
+
+enum { NUM_AIN = 14 };
+
+enum { NUM_AIN_SETTINGS = 3 };
+const char * AIN_SETTINGS[NUM_AIN_SETTINGS] = {"RANGE", "RESOLUTION_INDEX", "SETTLING_US"};
+
+enum { NUM_STREAM_SETTINGS = 6 };
+const char * STREAM_SETTINGS[NUM_STREAM_SETTINGS] = {"STREAM_BUFFER_SIZE_BYTES",
+	"STREAM_TRIGGER_INDEX", "STREAM_CLOCK_SOURCE", "STREAM_RESOLUTION_INDEX",
+	"STREAM_SETTLING_US", "AIN_ALL_NEGATIVE_CH"};
+const double STREAM_VALUES[NUM_STREAM_SETTINGS] = {0, 0, 0, 0, 0, LJM_GND};
+
+/**
+ * Desc: Writes the configuration with one LJM_eWriteNames call per AIN and one
+ *       LJM_eWriteName call per stream setting, as the existing examples do.
+**/
+void ConfigureOneByOne(int handle, double range);
+
+/**
+ * Desc: Writes the same configuration with one ConfigTransaction.
+**/
+void ConfigureWithTransaction(int handle, ConfigCache & cache, double range,
+	const char * description);
+
+/**
+ * Desc: Prints a result row.
+**/
+void PrintResult(const char * description, int numWrites, int numSent,
+	long long roundTrips, double ms);
+
+int main()
+{
+	int err;
+	int handle;
+	ConfigCache cache;
+
+	// Open first found LabJack
+	err = LJM_Open(LJM_dtANY, LJM_ctANY, "LJM_idANY", &handle);
+	ErrorCheck(err, "LJM_Open");
+
+	PrintDeviceInfoFromHandle(handle);
+	printf("\n");
+
+	printf("%-34s %7s %5s %12s %9s\n", "", "Writes", "Sent", "Round trips", "Time");
+
+	ConfigureOneByOne(handle, 10.0);
+
+	ConfigureWithTransaction(handle, cache, 10.0, "ConfigTransaction, empty cache");
+	ConfigureWithTransaction(handle, cache, 10.0, "ConfigTransaction, same again");
+	ConfigureWithTransaction(handle, cache, 1.0, "ConfigTransaction, new AIN range");
+
+	// Close
+	err = LJM_Close(handle);
+	ErrorCheck(err, "LJM_Close");
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+void ConfigureOneByOne(int handle, double range)
+{
+	int err, i, settingI;
+	int errorAddress = INITIAL_ERR_ADDRESS;
+	char names[NUM_AIN_SETTINGS][LJM_MAX_NAME_SIZE];
+	const char * aNames[NUM_AIN_SETTINGS] = {names[0], names[1], names[2]};
+	double aValues[NUM_AIN_SETTINGS] = {range, 0, 0};
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (i = 0; i < NUM_STREAM_SETTINGS; i++) {
+		WriteNameOrDie(handle, STREAM_SETTINGS[i], STREAM_VALUES[i]);
+	}
+	for (i = 0; i < NUM_AIN; i++) {
+		for (settingI = 0; settingI < NUM_AIN_SETTINGS; settingI++) {
+			sprintf(names[settingI], "AIN%d_%s", i, AIN_SETTINGS[settingI]);
+		}
+		err = LJM_eWriteNames(handle, NUM_AIN_SETTINGS, aNames, aValues, &errorAddress);
+		ErrorCheckWithAddress(err, errorAddress, "LJM_eWriteNames");
+	}
+
+	double ms = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+	PrintResult("One call per AIN / stream setting", NUM_AIN * NUM_AIN_SETTINGS +
+		NUM_STREAM_SETTINGS, NUM_AIN * NUM_AIN_SETTINGS + NUM_STREAM_SETTINGS,
+		NUM_AIN + NUM_STREAM_SETTINGS, ms);
+}
+
+void ConfigureWithTransaction(int handle, ConfigCache & cache, double range,
+	const char * description)
+{
+	int err, i, settingI, numSent;
+	int errorAddress = INITIAL_ERR_ADDRESS;
+	char name[LJM_MAX_NAME_SIZE];
+	double aValues[NUM_AIN_SETTINGS] = {range, 0, 0};
+	ConfigTransaction transaction(handle, &cache);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (i = 0; i < NUM_STREAM_SETTINGS; i++) {
+		err = transaction.Write(STREAM_SETTINGS[i], STREAM_VALUES[i]);
+		ErrorCheck(err, "ConfigTransaction::Write(%s)", STREAM_SETTINGS[i]);
+	}
+	for (i = 0; i < NUM_AIN; i++) {
+		for (settingI = 0; settingI < NUM_AIN_SETTINGS; settingI++) {
+			sprintf(name, "AIN%d_%s", i, AIN_SETTINGS[settingI]);
+			err = transaction.Write(name, aValues[settingI]);
+			ErrorCheck(err, "ConfigTransaction::Write(%s)", name);
+		}
+	}
+
+	numSent = transaction.NumQueued();
+	err = transaction.Commit(&errorAddress);
+	ErrorCheckWithAddress(err, errorAddress, "ConfigTransaction::Commit");
+
+	double ms = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+	PrintResult(description, NUM_AIN * NUM_AIN_SETTINGS + NUM_STREAM_SETTINGS, numSent,
+		transaction.RoundTrips(), ms);
+}
+
+void PrintResult(const char * description, int numWrites, int numSent,
+	long long roundTrips, double ms)
+{
+	printf("%-34s %7d %5d %12lld %6.1f ms\n", description, numWrites, numSent,
+		roundTrips, ms);
+}
@@ -0,0 +1,126 @@
+/**
+ * Name: read_coalescing.cpp
+ * Desc: Compares reading the comfortbot sensor channels with one LJM_eReadName
+ *       call per channel (as trade_fair.py does) against reading them through
+ *       a ReadCoalescer, and reports the round trips saved and the latency.
+**/
+
+// For printf
+#include <stdio.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_ReadCoalescer.h"
+
+// Radiant temperature, humidity, ambient temperature and the two anemometers
+enum { NUM_CHANNELS = 5 };
+const char * CHANNEL_NAMES[NUM_CHANNELS] = {"AIN12", "AIN1", "AIN13", "AIN2", "AIN3"};
+
+/**
+ * Desc: Reads each channel with its own LJM_eReadName call, numIterations times.
+**/
+void SequentialReads(int handle, int numIterations);
+
+/**
+ * Desc: Starts one thread per channel. Each thread reads its channel through
+ *       coalescer numIterations times, like independent sensor tasks would.
+**/
+void CoalescedReads(int handle, int numIterations, unsigned int windowUS);
+
+int main()
+{
+	const int NUM_ITERATIONS = 200;
+	const unsigned int WINDOW_US = 500;
+
+	int err;
+	int handle;
+
+	// Open first found LabJack
+	err = LJM_Open(LJM_dtANY, LJM_ctANY, "LJM_idANY", &handle);
+	ErrorCheck(err, "LJM_Open");
+
+	PrintDeviceInfoFromHandle(handle);
+	printf("\n");
+
+	SequentialReads(handle, NUM_ITERATIONS);
+	printf("\n");
+
+	CoalescedReads(handle, NUM_ITERATIONS, WINDOW_US);
+
+	// Close
+	err = LJM_Close(handle);
+	ErrorCheck(err, "LJM_Close");
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+void SequentialReads(int handle, int numIterations)
+{
+	int i, chanI, err;
+	double value;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (i = 0; i < numIterations; i++) {
+		for (chanI = 0; chanI < NUM_CHANNELS; chanI++) {
+			err = LJM_eReadName(handle, CHANNEL_NAMES[chanI], &value);
+			ErrorCheck(err, "LJM_eReadName(%s)", CHANNEL_NAMES[chanI]);
+		}
+	}
+
+	double totalMS = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+
+	printf("Sequential LJM_eReadName, %d iterations of %d channels:\n",
+		numIterations, NUM_CHANNELS);
+	printf("    Round trips: %d\n", numIterations * NUM_CHANNELS);
+	printf("    Time taken: %.1f ms\n", totalMS);
+	printf("    Average time per iteration: %.3f ms\n", totalMS / numIterations);
+}
+
+void CoalescedReads(int handle, int numIterations, unsigned int windowUS)
+{
+	int chanI;
+	std::vector<std::thread> threads;
+	ReadCoalescer coalescer(handle, windowUS);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (chanI = 0; chanI < NUM_CHANNELS; chanI++) {
+		threads.push_back(std::thread([&coalescer, chanI, numIterations]() {
+			int i;
+			for (i = 0; i < numIterations; i++) {
+				CoalescedRead result = coalescer.Read(CHANNEL_NAMES[chanI]).get();
+				PrintErrorIfError(result.err, "ReadCoalescer::Read(%s)",
+					CHANNEL_NAMES[chanI]);
+			}
+		}));
+	}
+	for (chanI = 0; chanI < NUM_CHANNELS; chanI++) {
+		threads[chanI].join();
+	}
+
+	double totalMS = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+	ReadCoalescerStats stats = coalescer.GetStats();
+
+	printf("ReadCoalescer (%u us window), %d threads x %d reads:\n", windowUS,
+		NUM_CHANNELS, numIterations);
+	printf("    Requests: %lld in %lld batches\n", stats.requests, stats.batches);
+	printf("    Round trips: %lld (%lld saved)\n", stats.roundTrips,
+		stats.requests - stats.roundTrips);
+	printf("    Time taken: %.1f ms\n", totalMS);
+	printf("    Average time per iteration: %.3f ms\n", totalMS / numIterations);
+	if (stats.requests > 0) {
+		printf("    Read latency: average %.1f us, max %.1f us\n",
+			stats.totalLatencyUS / stats.requests, stats.maxLatencyUS);
+	}
+}
@@ -0,0 +1,164 @@
+/**
+ * Name: register_mirror.cpp
+ * Desc: Compares reader threads that each call LJM_eReadNames (as
+ *       ain/dual_ain_loop.c does) with reader threads that take snapshots of
+ *       a RegisterMirror. In the first case every read is a device round
+ *       trip and readers wait for each other; in the second, device traffic
+ *       is set by the refresh interval whatever the number of readers.
+**/
+
+// For printf
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_RegisterMirror.h"
+
+enum { NUM_NAMES = 5 };
+const char * NAMES[NUM_NAMES] = {"AIN0", "AIN1", "AIN2", "AIN3", "FIO_STATE"};
+
+enum { DURATION_MS = 1000 };
+enum { REFRESH_INTERVAL_US = 10000 };
+
+const int READER_COUNTS[] = {1, 4, 16};
+enum { NUM_READER_COUNTS = sizeof(READER_COUNTS) / sizeof(READER_COUNTS[0]) };
+
+/**
+ * Desc: Runs numReaders threads that each call LJM_eReadNames in a loop for
+ *       DURATION_MS, then prints the reads and round trips per second.
+**/
+void DirectReaders(int handle, int numReaders);
+
+/**
+ * Desc: Runs numReaders threads that each take RegisterMirror snapshots in a
+ *       loop for DURATION_MS, then prints the snapshots and device round
+ *       trips per second and the average snapshot age.
+**/
+void MirrorReaders(RegisterMirror & mirror, int numReaders);
+
+int main()
+{
+	int err, i, index;
+	int handle;
+
+	// Open first found LabJack
+	err = LJM_Open(LJM_dtANY, LJM_ctANY, "LJM_idANY", &handle);
+	ErrorCheck(err, "LJM_Open");
+
+	PrintDeviceInfoFromHandle(handle);
+	printf("\n");
+
+	for (i = 0; i < NUM_READER_COUNTS; i++) {
+		DirectReaders(handle, READER_COUNTS[i]);
+	}
+	printf("\n");
+
+	{
+		RegisterMirror mirror(handle, REFRESH_INTERVAL_US);
+		for (i = 0; i < NUM_NAMES; i++) {
+			err = mirror.Declare(NAMES[i], &index);
+			ErrorCheck(err, "RegisterMirror::Declare(%s)", NAMES[i]);
+		}
+		mirror.Start();
+
+		for (i = 0; i < NUM_READER_COUNTS; i++) {
+			MirrorReaders(mirror, READER_COUNTS[i]);
+		}
+
+		mirror.Stop();
+	}
+
+	// Close
+	err = LJM_Close(handle);
+	ErrorCheck(err, "LJM_Close");
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+void DirectReaders(int handle, int numReaders)
+{
+	int readerI;
+	std::atomic<long long> numReads(0);
+	std::vector<std::thread> readers;
+	std::chrono::steady_clock::time_point end =
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(DURATION_MS);
+
+	for (readerI = 0; readerI < numReaders; readerI++) {
+		readers.push_back(std::thread([handle, end, &numReads]() {
+			int err, errorAddress = INITIAL_ERR_ADDRESS;
+			double aValues[NUM_NAMES];
+			while (std::chrono::steady_clock::now() < end) {
+				err = LJM_eReadNames(handle, NUM_NAMES, NAMES, aValues, &errorAddress);
+				ErrorCheckWithAddress(err, errorAddress, "LJM_eReadNames");
+				++numReads;
+			}
+		}));
+	}
+	for (readerI = 0; readerI < numReaders; readerI++) {
+		readers[readerI].join();
+	}
+
+	// Each read is one round trip, and readers queue behind each other for the device
+	printf("%2d readers calling LJM_eReadNames: %6.0f round trips/s, %6.0f reads/s per reader\n",
+		numReaders, numReads * 1000.0 / DURATION_MS,
+		numReads * 1000.0 / DURATION_MS / numReaders);
+}
+
+void MirrorReaders(RegisterMirror & mirror, int numReaders)
+{
+	int readerI;
+	std::atomic<long long> numSnapshots(0);
+	std::atomic<long long> numSnapshotErrors(0);
+	std::atomic<double> totalAgeMS(0.0);
+	std::vector<std::thread> readers;
+	RegisterMirrorStats before = mirror.GetStats();
+	std::chrono::steady_clock::time_point end =
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(DURATION_MS);
+
+	for (readerI = 0; readerI < numReaders; readerI++) {
+		readers.push_back(std::thread([&mirror, end, &numSnapshots, &numSnapshotErrors,
+			&totalAgeMS]()
+		{
+			long long count = 0, errorCount = 0;
+			double ageMS = 0.0, expected;
+			MirrorSnapshot snapshot;
+			while (std::chrono::steady_clock::now() < end) {
+				if (mirror.Snapshot(snapshot) != LJME_NOERROR) {
+					++errorCount;
+				}
+				if (snapshot.sequence > 0) {
+					ageMS += snapshot.AgeMS();
+				}
+				++count;
+			}
+			// Each reader keeps its own counts and adds them once at the end
+			numSnapshots += count;
+			numSnapshotErrors += errorCount;
+			expected = totalAgeMS.load();
+			while (!totalAgeMS.compare_exchange_weak(expected, expected + ageMS)) {
+			}
+		}));
+	}
+	for (readerI = 0; readerI < numReaders; readerI++) {
+		readers[readerI].join();
+	}
+
+	RegisterMirrorStats after = mirror.GetStats();
+	printf("%2d readers taking snapshots: %10.0f snapshots/s, %6.0f round trips/s, "
+		"average age %.2f ms, %lld errors, %lld retries\n",
+		numReaders, numSnapshots * 1000.0 / DURATION_MS,
+		(after.roundTrips - before.roundTrips) * 1000.0 / DURATION_MS,
+		numSnapshots > 0 ? totalAgeMS / numSnapshots : 0.0, numSnapshotErrors.load(),
+		after.snapshotRetries - before.snapshotRetries);
+}
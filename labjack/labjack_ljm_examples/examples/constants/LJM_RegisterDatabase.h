@@ -0,0 +1,922 @@
+/**
+ * Name: LJM_RegisterDatabase.h
+ * Desc: Reads the register database compile_constants.py builds from
+ *       ljm_constants.json. Opening it maps the file into memory; register
+ *       names, addresses, constants and error codes are then found by binary
+ *       search in the mapped file, without parsing or allocating. A register
+ *       range such as AIN#(0:254) is one descriptor, not 255 names.
+ *       C++11 only.
+ * Note: Names are matched without regard to case and scopes with regard to
+ *       it, as LJM_NameToAddress and LJM_LookupConstantValue do. Like LJM,
+ *       the database has no UINT64 registers.
+**/
+
+#ifndef LJM_REGISTER_DATABASE
+#define LJM_REGISTER_DATABASE
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#include "LabJackM.h"
+
+/**
+ * File layout, little-endian, each section 8-byte aligned:
+ *     RegisterDatabaseHeader
+ *     RegisterDatabaseRegister[numRegisters], in ljm_constants.json order
+ *     RegisterDatabaseName[numNames], by key then first index
+ *     RegisterDatabaseAddress[numAddresses], by address
+ *     RegisterDatabaseScope[numScopes], by name
+ *     RegisterDatabaseConstant[numConstants], grouped by scope, by name
+ *     RegisterDatabaseError[numErrors], by code
+ *     RegisterDatabaseError[numErrors], by name
+ *     Null-terminated strings; offset 0 is ""
+ * A name key is the upper case name, with a range replaced by # ("AIN#_RANGE"
+ * for AIN#(0:254)_RANGE). The element at index i of a range register is at
+ * address + (i - first) * stride.
+ * Bump REGISTER_DATABASE_FORMAT_VERSION in this file and in
+ * compile_constants.py when the layout changes.
+**/
+enum { REGISTER_DATABASE_FORMAT_VERSION = 1 };
+enum { REGISTER_DATABASE_VERSION_SIZE = 32 };
+
+// RegisterDatabaseRegister::readwrite
+enum {
+	REGISTER_DATABASE_READ = 0x1,
+	REGISTER_DATABASE_WRITE = 0x2
+};
+
+// RegisterDatabaseRegister::flags
+enum {
+	REGISTER_DATABASE_RANGE = 0x1,
+	REGISTER_DATABASE_STREAMABLE = 0x2,
+	REGISTER_DATABASE_BUFFER = 0x4,
+	REGISTER_DATABASE_BETA = 0x8
+};
+
+// RegisterDatabaseName::flags
+enum {
+	REGISTER_DATABASE_NAME_RANGE = 0x1,
+	REGISTER_DATABASE_NAME_ALTERNATE = 0x2
+};
+
+// RegisterDatabaseRegister::deviceMask
+enum {
+	REGISTER_DATABASE_T7 = 0x1,
+	REGISTER_DATABASE_T4 = 0x2,
+	REGISTER_DATABASE_DIGIT = 0x4
+};
+
+struct RegisterDatabaseHeader
+{
+	char magic[8];
+	uint32_t formatVersion;
+	uint32_t headerSize;
+	uint32_t fileSize;
+	uint32_t sourceChecksum;
+	char constantsVersion[REGISTER_DATABASE_VERSION_SIZE];
+	uint32_t numRegisters, registersOffset;
+	uint32_t numNames, namesOffset;
+	uint32_t numAddresses, addressesOffset;
+	uint32_t numScopes, scopesOffset;
+	uint32_t numConstants, constantsOffset;
+	uint32_t numErrors, errorCodesOffset, errorNamesOffset;
+	uint32_t stringsOffset, stringsSize;
+	uint32_t maxSpanRegisters;
+	uint32_t reserved;
+};
+
+struct RegisterDatabaseRegister
+{
+	uint32_t nameOffset;
+	uint32_t keyOffset;
+	uint32_t address;
+	int32_t type;
+	uint16_t first, last;
+	uint16_t stride;
+	uint8_t readwrite;
+	uint8_t flags;
+	uint16_t deviceMask;
+	uint16_t reserved;
+	uint32_t tagsOffset;
+};
+
+struct RegisterDatabaseName
+{
+	uint32_t keyOffset;
+	uint32_t registerIndex;
+	uint16_t first, last;
+	uint32_t flags;
+};
+
+struct RegisterDatabaseAddress
+{
+	uint32_t address;
+	uint32_t endAddress;
+	uint32_t registerIndex;
+};
+
+struct RegisterDatabaseScope
+{
+	uint32_t nameOffset;
+	uint32_t firstConstant;
+	uint32_t numConstants;
+};
+
+struct RegisterDatabaseConstant
+{
+	uint32_t nameOffset;
+	uint32_t reserved;
+	double value;
+};
+
+struct RegisterDatabaseError
+{
+	int32_t code;
+	uint32_t nameOffset;
+	uint32_t descriptionOffset;
+};
+
+static_assert(sizeof(RegisterDatabaseHeader) == 124, "RegisterDatabaseHeader layout");
+static_assert(sizeof(RegisterDatabaseRegister) == 32, "RegisterDatabaseRegister layout");
+static_assert(sizeof(RegisterDatabaseName) == 16, "RegisterDatabaseName layout");
+static_assert(sizeof(RegisterDatabaseAddress) == 12, "RegisterDatabaseAddress layout");
+static_assert(sizeof(RegisterDatabaseScope) == 12, "RegisterDatabaseScope layout");
+static_assert(sizeof(RegisterDatabaseConstant) == 16, "RegisterDatabaseConstant layout");
+static_assert(sizeof(RegisterDatabaseError) == 12, "RegisterDatabaseError layout");
+
+/**
+ * Desc: A register, or one element of a register range. The strings point
+ *       into the mapped file and are valid until the database is closed.
+ *       index is -1, and first and last 0, for a register that isn't a range.
+**/
+struct RegisterInfo
+{
+	const char * name;
+	const char * tags;
+	int address;
+	int type;
+	int numRegisters;
+	int index;
+	int first;
+	int last;
+	bool readable;
+	bool writable;
+	bool streamable;
+	bool isBuffer;
+	bool beta;
+	int deviceMask;
+};
+
+/**
+ * Name: RegisterDatabase
+ * Desc: A register database file mapped read-only. Lookups don't change it,
+ *       so any number of threads may use one RegisterDatabase at once.
+**/
+class RegisterDatabase
+{
+public:
+	RegisterDatabase();
+	~RegisterDatabase();
+
+	/**
+	 * Desc: Maps path and checks its layout.
+	 * Retr: LJME_NOERROR, LJME_CONSTANTS_FILE_NOT_FOUND if path can't be
+	 *       opened, or LJME_INVALID_CONSTANTS_FILE if it isn't a database of
+	 *       this format version.
+	**/
+	int Open(const char * path);
+	void Close();
+	bool IsOpen() const;
+
+	/**
+	 * Desc: The version from the header of the ljm_constants.json the
+	 *       database was compiled from, and the CRC-32 of that file.
+	**/
+	const char * ConstantsVersion() const;
+	unsigned int SourceChecksum() const;
+
+	/**
+	 * Desc: Like LJM_NameToAddress: takes a register name or alternate name,
+	 *       e.g. "AIN3" or "FIO0", and returns its address and type.
+	 * Retr: LJME_NOERROR, or LJME_INVALID_NAME with address and type set to
+	 *       LJM_INVALID_NAME_ADDRESS.
+	**/
+	int NameToAddress(const char * name, int * address, int * type) const;
+
+	/**
+	 * Desc: Like NameToAddress, returning all the register's metadata.
+	**/
+	int LookupName(const char * name, RegisterInfo * info) const;
+
+	/**
+	 * Desc: Returns the name of the register that starts at address, e.g.
+	 *       "AIN3" for 6. info may be NULL.
+	 * Para: name, allocated to LJM_MAX_NAME_SIZE.
+	 * Retr: LJME_NOERROR, or LJME_INVALID_ADDRESS.
+	**/
+	int AddressToName(int address, char * name, RegisterInfo * info) const;
+
+	/**
+	 * Desc: Like LJM_AddressToType.
+	 * Retr: LJME_NOERROR, or LJME_INVALID_ADDRESS with type set to
+	 *       LJM_INVALID_NAME_ADDRESS.
+	**/
+	int AddressToType(int address, int * type) const;
+
+	/**
+	 * Desc: The registers as described in ljm_constants.json, ranges not
+	 *       expanded, for 0 <= registerIndex < NumRegisters().
+	**/
+	int NumRegisters() const;
+	int GetRegister(int registerIndex, RegisterInfo * info) const;
+
+	/**
+	 * Desc: Like LJM_LookupConstantValue and LJM_LookupConstantName. scope is
+	 *       the name of the register the constants belong to, as written in
+	 *       ljm_constants.json, e.g. "WIFI_STATUS".
+	 * Para: constantName, for LookupConstantName allocated to
+	 *           LJM_MAX_NAME_SIZE.
+	 * Retr: LJME_NOERROR, LJME_INVALID_NAME if scope or constantName isn't
+	 *       found, or LJME_INVALID_VALUE if value isn't.
+	**/
+	int LookupConstantValue(const char * scope, const char * constantName,
+		double * value) const;
+	int LookupConstantName(const char * scope, double value,
+		char * constantName) const;
+
+	/**
+	 * Desc: Like LJM_ErrorToString, without the LJM-side details LJM adds to
+	 *       some errors.
+	 * Para: errorString, allocated to LJM_MAX_NAME_SIZE.
+	**/
+	void ErrorToString(int errorCode, char * errorString) const;
+
+	/**
+	 * Desc: Returns the code of an error name, e.g. 1294 for
+	 *       "LJME_INVALID_NAME".
+	 * Retr: LJME_NOERROR, or LJME_INVALID_NAME.
+	**/
+	int ErrorNameToCode(const char * errorName, int * errorCode) const;
+
+	/**
+	 * Desc: Returns the description ljm_constants.json gives errorCode, or
+	 *       "" if it gives none or errorCode isn't found.
+	**/
+	const char * ErrorDescription(int errorCode) const;
+
+	RegisterDatabase(const RegisterDatabase &) = delete;
+	RegisterDatabase & operator=(const RegisterDatabase &) = delete;
+
+private:
+	bool Validate() const;
+	bool SectionFits(uint32_t offset, uint32_t count, size_t entrySize) const;
+	const char * String(uint32_t offset) const;
+	const RegisterDatabaseRegister * Registers() const;
+	const RegisterDatabaseName * Names() const;
+	const RegisterDatabaseAddress * Addresses() const;
+	const RegisterDatabaseError * FindError(int errorCode) const;
+	bool FindName(const char * key, int index, RegisterInfo * info) const;
+	void FillInfo(uint32_t registerIndex, int index, RegisterInfo * info) const;
+
+	const unsigned char * data;
+	size_t size;
+	const RegisterDatabaseHeader * header;
+
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+};
+
+/**
+ * Desc: Copies source into destination, upper case, or returns false if it
+ *       doesn't fit in destinationSize.
+**/
+bool RegisterDatabaseUpper(const char * source, char * destination,
+	size_t destinationSize);
+
+
+// Source
+
+static const char REGISTER_DATABASE_MAGIC[8] = {'L', 'J', 'M', 'R', 'E', 'G', 'D', 'B'};
+
+inline bool RegisterDatabaseUpper(const char * source, char * destination,
+	size_t destinationSize)
+{
+	size_t i;
+	for (i = 0; source[i] != '\0'; i++) {
+		if (i + 1 >= destinationSize) {
+			return false;
+		}
+		destination[i] = (char)toupper((unsigned char)source[i]);
+	}
+	destination[i] = '\0';
+	return true;
+}
+
+inline RegisterDatabase::RegisterDatabase():
+	data(NULL), size(0), header(NULL)
+{
+#ifdef _WIN32
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+#endif
+}
+
+inline RegisterDatabase::~RegisterDatabase()
+{
+	Close();
+}
+
+inline int RegisterDatabase::Open(const char * path)
+{
+	Close();
+
+#ifdef _WIN32
+	LARGE_INTEGER fileSize;
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return LJME_CONSTANTS_FILE_NOT_FOUND;
+	}
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(RegisterDatabaseHeader)) {
+		Close();
+		return LJME_INVALID_CONSTANTS_FILE;
+	}
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		Close();
+		return LJME_INVALID_CONSTANTS_FILE;
+	}
+	data = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == NULL) {
+		Close();
+		return LJME_INVALID_CONSTANTS_FILE;
+	}
+	size = (size_t)fileSize.QuadPart;
+#else
+	struct stat status;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return LJME_CONSTANTS_FILE_NOT_FOUND;
+	}
+	if (fstat(fd, &status) != 0 || status.st_size < (off_t)sizeof(RegisterDatabaseHeader)) {
+		close(fd);
+		return LJME_INVALID_CONSTANTS_FILE;
+	}
+	void * mapped = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	// The mapping stays valid after the descriptor is closed
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		return LJME_INVALID_CONSTANTS_FILE;
+	}
+	data = (const unsigned char *)mapped;
+	size = (size_t)status.st_size;
+#endif
+
+	header = (const RegisterDatabaseHeader *)data;
+	if (!Validate()) {
+		Close();
+		return LJME_INVALID_CONSTANTS_FILE;
+	}
+	return LJME_NOERROR;
+}
+
+inline void RegisterDatabase::Close()
+{
+#ifdef _WIN32
+	if (data != NULL) {
+		UnmapViewOfFile(data);
+	}
+	if (mapping != NULL) {
+		CloseHandle(mapping);
+		mapping = NULL;
+	}
+	if (file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (data != NULL) {
+		munmap((void *)data, size);
+	}
+#endif
+	data = NULL;
+	size = 0;
+	header = NULL;
+}
+
+inline bool RegisterDatabase::IsOpen() const
+{
+	return header != NULL;
+}
+
+inline bool RegisterDatabase::SectionFits(uint32_t offset, uint32_t count,
+	size_t entrySize) const
+{
+	return offset % 8 == 0 && offset >= header->headerSize &&
+		(uint64_t)offset + (uint64_t)count * entrySize <= size;
+}
+
+// Checked once at Open, so that lookups can trust every offset and index
+inline bool RegisterDatabase::Validate() const
+{
+	uint32_t i;
+
+	if (memcmp(header->magic, REGISTER_DATABASE_MAGIC, sizeof(header->magic)) != 0 ||
+		header->formatVersion != REGISTER_DATABASE_FORMAT_VERSION ||
+		header->headerSize < sizeof(RegisterDatabaseHeader) ||
+		header->fileSize != size ||
+		memchr(header->constantsVersion, '\0', REGISTER_DATABASE_VERSION_SIZE) == NULL)
+	{
+		return false;
+	}
+	if (!SectionFits(header->registersOffset, header->numRegisters, sizeof(RegisterDatabaseRegister)) ||
+		!SectionFits(header->namesOffset, header->numNames, sizeof(RegisterDatabaseName)) ||
+		!SectionFits(header->addressesOffset, header->numAddresses, sizeof(RegisterDatabaseAddress)) ||
+		!SectionFits(header->scopesOffset, header->numScopes, sizeof(RegisterDatabaseScope)) ||
+		!SectionFits(header->constantsOffset, header->numConstants, sizeof(RegisterDatabaseConstant)) ||
+		!SectionFits(header->errorCodesOffset, header->numErrors, sizeof(RegisterDatabaseError)) ||
+		!SectionFits(header->errorNamesOffset, header->numErrors, sizeof(RegisterDatabaseError)) ||
+		header->stringsSize == 0 ||
+		(uint64_t)header->stringsOffset + header->stringsSize > size ||
+		data[header->stringsOffset + header->stringsSize - 1] != '\0')
+	{
+		return false;
+	}
+
+	for (i = 0; i < header->numRegisters; i++) {
+		const RegisterDatabaseRegister & reg = Registers()[i];
+		if (reg.nameOffset >= header->stringsSize || reg.keyOffset >= header->stringsSize ||
+			reg.tagsOffset >= header->stringsSize || reg.stride == 0 || reg.first > reg.last)
+		{
+			return false;
+		}
+	}
+	for (i = 0; i < header->numNames; i++) {
+		const RegisterDatabaseName & name = Names()[i];
+		if (name.keyOffset >= header->stringsSize || name.registerIndex >= header->numRegisters ||
+			name.last - name.first != Registers()[name.registerIndex].last -
+				Registers()[name.registerIndex].first)
+		{
+			return false;
+		}
+	}
+	for (i = 0; i < header->numAddresses; i++) {
+		const RegisterDatabaseAddress & address = Addresses()[i];
+		if (address.registerIndex >= header->numRegisters ||
+			address.endAddress - address.address > header->maxSpanRegisters)
+		{
+			return false;
+		}
+	}
+	const RegisterDatabaseScope * scopes =
+		(const RegisterDatabaseScope *)(data + header->scopesOffset);
+	for (i = 0; i < header->numScopes; i++) {
+		if (scopes[i].nameOffset >= header->stringsSize ||
+			(uint64_t)scopes[i].firstConstant + scopes[i].numConstants > header->numConstants)
+		{
+			return false;
+		}
+	}
+	const RegisterDatabaseConstant * constants =
+		(const RegisterDatabaseConstant *)(data + header->constantsOffset);
+	for (i = 0; i < header->numConstants; i++) {
+		if (constants[i].nameOffset >= header->stringsSize) {
+			return false;
+		}
+	}
+	const RegisterDatabaseError * errors[2] = {
+		(const RegisterDatabaseError *)(data + header->errorCodesOffset),
+		(const RegisterDatabaseError *)(data + header->errorNamesOffset)};
+	for (i = 0; i < 2 * header->numErrors; i++) {
+		const RegisterDatabaseError & error = errors[i % 2][i / 2];
+		if (error.nameOffset >= header->stringsSize ||
+			error.descriptionOffset >= header->stringsSize)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+inline const char * RegisterDatabase::String(uint32_t offset) const
+{
+	return (const char *)data + header->stringsOffset + offset;
+}
+
+inline const RegisterDatabaseRegister * RegisterDatabase::Registers() const
+{
+	return (const RegisterDatabaseRegister *)(data + header->registersOffset);
+}
+
+inline const RegisterDatabaseName * RegisterDatabase::Names() const
+{
+	return (const RegisterDatabaseName *)(data + header->namesOffset);
+}
+
+inline const RegisterDatabaseAddress * RegisterDatabase::Addresses() const
+{
+	return (const RegisterDatabaseAddress *)(data + header->addressesOffset);
+}
+
+inline const char * RegisterDatabase::ConstantsVersion() const
+{
+	return IsOpen() ? header->constantsVersion : "";
+}
+
+inline unsigned int RegisterDatabase::SourceChecksum() const
+{
+	return IsOpen() ? header->sourceChecksum : 0;
+}
+
+inline int RegisterDatabase::NumRegisters() const
+{
+	return IsOpen() ? (int)header->numRegisters : 0;
+}
+
+inline void RegisterDatabase::FillInfo(uint32_t registerIndex, int index,
+	RegisterInfo * info) const
+{
+	const RegisterDatabaseRegister & reg = Registers()[registerIndex];
+	bool range = (reg.flags & REGISTER_DATABASE_RANGE) != 0;
+
+	info->name = String(reg.nameOffset);
+	info->tags = String(reg.tagsOffset);
+	info->address = (int)reg.address;
+	if (range && index >= 0) {
+		info->address += (index - reg.first) * reg.stride;
+	}
+	info->type = reg.type;
+	info->numRegisters = reg.stride;
+	info->index = range ? index : -1;
+	info->first = reg.first;
+	info->last = reg.last;
+	info->readable = (reg.readwrite & REGISTER_DATABASE_READ) != 0;
+	info->writable = (reg.readwrite & REGISTER_DATABASE_WRITE) != 0;
+	info->streamable = (reg.flags & REGISTER_DATABASE_STREAMABLE) != 0;
+	info->isBuffer = (reg.flags & REGISTER_DATABASE_BUFFER) != 0;
+	info->beta = (reg.flags & REGISTER_DATABASE_BETA) != 0;
+	info->deviceMask = reg.deviceMask;
+}
+
+inline int RegisterDatabase::GetRegister(int registerIndex, RegisterInfo * info) const
+{
+	if (registerIndex < 0 || registerIndex >= NumRegisters()) {
+		return LJME_INVALID_INDEX;
+	}
+	FillInfo((uint32_t)registerIndex, Registers()[registerIndex].first, info);
+	if (info->index >= 0) {
+		// The whole range is described, not its first element
+		info->index = -1;
+	}
+	return LJME_NOERROR;
+}
+
+// index is the number parsed from the name for a key with #, -1 otherwise
+inline bool RegisterDatabase::FindName(const char * key, int index,
+	RegisterInfo * info) const
+{
+	const RegisterDatabaseName * names = Names();
+	uint32_t low = 0, high = header->numNames, middle;
+
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		if (strcmp(String(names[middle].keyOffset), key) < 0) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+
+	// Several ranges may share a key, e.g. the DIO# alternate names
+	for (; low < header->numNames && strcmp(String(names[low].keyOffset), key) == 0; low++) {
+		const RegisterDatabaseName & name = names[low];
+		if (index < 0 && !(name.flags & REGISTER_DATABASE_NAME_RANGE)) {
+			FillInfo(name.registerIndex, -1, info);
+			return true;
+		}
+		if (index >= 0 && (name.flags & REGISTER_DATABASE_NAME_RANGE) &&
+			index >= name.first && index <= name.last)
+		{
+			FillInfo(name.registerIndex, Registers()[name.registerIndex].first +
+				index - name.first, info);
+			return true;
+		}
+	}
+	return false;
+}
+
+inline int RegisterDatabase::LookupName(const char * name, RegisterInfo * info) const
+{
+	char upper[LJM_MAX_NAME_SIZE];
+	char key[LJM_MAX_NAME_SIZE];
+	size_t start, end, digit, length;
+
+	if (!IsOpen()) {
+		return LJME_CONSTANTS_FILE_NOT_FOUND;
+	}
+	if (!RegisterDatabaseUpper(name, upper, sizeof(upper)) || strchr(upper, '#') != NULL) {
+		return LJME_INVALID_NAME;
+	}
+	if (FindName(upper, -1, info)) {
+		return LJME_NOERROR;
+	}
+
+	// Otherwise try each run of digits as the index of a range, so that
+	// I2C_SPEED_THROTTLE isn't taken for element 2 of I#C_SPEED_THROTTLE
+	length = strlen(upper);
+	for (start = 0; start < length; start = end) {
+		if (!isdigit((unsigned char)upper[start])) {
+			end = start + 1;
+			continue;
+		}
+		for (end = start; end < length && isdigit((unsigned char)upper[end]); end++) {}
+		for (digit = start; digit + 1 < end && upper[digit] == '0'; digit++) {}
+		if (end - digit > 5) {
+			continue;
+		}
+
+		memcpy(key, upper, start);
+		key[start] = '#';
+		memcpy(key + start + 1, upper + end, length - end + 1);
+		if (FindName(key, atoi(upper + start), info)) {
+			return LJME_NOERROR;
+		}
+	}
+	return LJME_INVALID_NAME;
+}
+
+inline int RegisterDatabase::NameToAddress(const char * name, int * address,
+	int * type) const
+{
+	RegisterInfo info;
+	int err = LookupName(name, &info);
+	if (err != LJME_NOERROR) {
+		*address = LJM_INVALID_NAME_ADDRESS;
+		*type = LJM_INVALID_NAME_ADDRESS;
+		return err;
+	}
+	*address = info.address;
+	*type = info.type;
+	return LJME_NOERROR;
+}
+
+inline int RegisterDatabase::AddressToName(int address, char * name,
+	RegisterInfo * info) const
+{
+	const RegisterDatabaseAddress * addresses;
+	uint32_t low, high, middle, i, target;
+	int found = -1, foundIndex = -1;
+
+	if (!IsOpen()) {
+		return LJME_CONSTANTS_FILE_NOT_FOUND;
+	}
+	if (address < 0) {
+		return LJME_INVALID_ADDRESS;
+	}
+	target = (uint32_t)address;
+	addresses = Addresses();
+
+	// The first entry starting after address
+	low = 0;
+	high = header->numAddresses;
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		if (addresses[middle].address <= target) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+
+	// Walk back over the entries whose ranges could reach address, keeping
+	// the last one that isn't beta, since the entries of one address are
+	// ordered non-beta first
+	for (i = low; i > 0; i--) {
+		const RegisterDatabaseAddress & entry = addresses[i - 1];
+		if ((uint64_t)entry.address + header->maxSpanRegisters <= target) {
+			break;
+		}
+		const RegisterDatabaseRegister & reg = Registers()[entry.registerIndex];
+		uint32_t offset = target - entry.address;
+		if (target < entry.endAddress && offset % reg.stride == 0) {
+			found = (int)entry.registerIndex;
+			foundIndex = reg.first + (int)(offset / reg.stride);
+			if (!(reg.flags & REGISTER_DATABASE_BETA)) {
+				break;
+			}
+		}
+	}
+	if (found < 0) {
+		return LJME_INVALID_ADDRESS;
+	}
+
+	const RegisterDatabaseRegister & reg = Registers()[found];
+	if (name != NULL) {
+		const char * key = String(reg.keyOffset);
+		const char * hash = strchr(key, '#');
+		if (reg.flags & REGISTER_DATABASE_RANGE && hash != NULL) {
+			snprintf(name, LJM_MAX_NAME_SIZE, "%.*s%d%s", (int)(hash - key), key,
+				foundIndex, hash + 1);
+		}
+		else {
+			snprintf(name, LJM_MAX_NAME_SIZE, "%s", key);
+		}
+	}
+	if (info != NULL) {
+		FillInfo((uint32_t)found, foundIndex, info);
+	}
+	return LJME_NOERROR;
+}
+
+inline int RegisterDatabase::AddressToType(int address, int * type) const
+{
+	RegisterInfo info;
+	int err = AddressToName(address, NULL, &info);
+	*type = err == LJME_NOERROR ? info.type : LJM_INVALID_NAME_ADDRESS;
+	return err;
+}
+
+inline int RegisterDatabase::LookupConstantValue(const char * scope,
+	const char * constantName, double * value) const
+{
+	char upper[LJM_MAX_NAME_SIZE];
+	const RegisterDatabaseScope * scopes;
+	const RegisterDatabaseConstant * constants;
+	uint32_t low, high, middle;
+	int cmp;
+
+	if (!IsOpen()) {
+		return LJME_CONSTANTS_FILE_NOT_FOUND;
+	}
+	if (!RegisterDatabaseUpper(constantName, upper, sizeof(upper))) {
+		return LJME_INVALID_NAME;
+	}
+
+	scopes = (const RegisterDatabaseScope *)(data + header->scopesOffset);
+	low = 0;
+	high = header->numScopes;
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		cmp = strcmp(String(scopes[middle].nameOffset), scope);
+		if (cmp == 0) {
+			break;
+		}
+		if (cmp < 0) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+	if (low >= high) {
+		return LJME_INVALID_NAME;
+	}
+
+	constants = (const RegisterDatabaseConstant *)(data + header->constantsOffset) +
+		scopes[middle].firstConstant;
+	low = 0;
+	high = scopes[middle].numConstants;
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		cmp = strcmp(String(constants[middle].nameOffset), upper);
+		if (cmp == 0) {
+			*value = constants[middle].value;
+			return LJME_NOERROR;
+		}
+		if (cmp < 0) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+	return LJME_INVALID_NAME;
+}
+
+inline int RegisterDatabase::LookupConstantName(const char * scope, double value,
+	char * constantName) const
+{
+	const RegisterDatabaseScope * scopes;
+	const RegisterDatabaseConstant * constants;
+	uint32_t i, j;
+
+	constantName[0] = '\0';
+	if (!IsOpen()) {
+		return LJME_CONSTANTS_FILE_NOT_FOUND;
+	}
+
+	// Scopes hold a handful of constants each, sorted by name, so a scan
+	// is as fast as a value index would be
+	scopes = (const RegisterDatabaseScope *)(data + header->scopesOffset);
+	for (i = 0; i < header->numScopes; i++) {
+		if (strcmp(String(scopes[i].nameOffset), scope) != 0) {
+			continue;
+		}
+		constants = (const RegisterDatabaseConstant *)(data + header->constantsOffset) +
+			scopes[i].firstConstant;
+		for (j = 0; j < scopes[i].numConstants; j++) {
+			if (constants[j].value == value) {
+				snprintf(constantName, LJM_MAX_NAME_SIZE, "%s",
+					String(constants[j].nameOffset));
+				return LJME_NOERROR;
+			}
+		}
+		return LJME_INVALID_VALUE;
+	}
+	return LJME_INVALID_NAME;
+}
+
+inline const RegisterDatabaseError * RegisterDatabase::FindError(int errorCode) const
+{
+	const RegisterDatabaseError * errors;
+	uint32_t low, high, middle;
+
+	if (!IsOpen()) {
+		return NULL;
+	}
+	errors = (const RegisterDatabaseError *)(data + header->errorCodesOffset);
+	low = 0;
+	high = header->numErrors;
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		if (errors[middle].code == errorCode) {
+			return &errors[middle];
+		}
+		if (errors[middle].code < errorCode) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+	return NULL;
+}
+
+inline void RegisterDatabase::ErrorToString(int errorCode, char * errorString) const
+{
+	const RegisterDatabaseError * error = FindError(errorCode);
+	if (error != NULL) {
+		snprintf(errorString, LJM_MAX_NAME_SIZE, "%s", String(error->nameOffset));
+	}
+	else {
+		snprintf(errorString, LJM_MAX_NAME_SIZE,
+			"Error code '%d' not found in register database", errorCode);
+	}
+}
+
+inline const char * RegisterDatabase::ErrorDescription(int errorCode) const
+{
+	const RegisterDatabaseError * error = FindError(errorCode);
+	return error != NULL ? String(error->descriptionOffset) : "";
+}
+
+inline int RegisterDatabase::ErrorNameToCode(const char * errorName, int * errorCode) const
+{
+	char upper[LJM_MAX_NAME_SIZE];
+	const RegisterDatabaseError * errors;
+	uint32_t low, high, middle;
+	int cmp;
+
+	if (!IsOpen()) {
+		return LJME_CONSTANTS_FILE_NOT_FOUND;
+	}
+	if (!RegisterDatabaseUpper(errorName, upper, sizeof(upper))) {
+		return LJME_INVALID_NAME;
+	}
+	errors = (const RegisterDatabaseError *)(data + header->errorNamesOffset);
+	low = 0;
+	high = header->numErrors;
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		cmp = strcmp(String(errors[middle].nameOffset), upper);
+		if (cmp == 0) {
+			*errorCode = errors[middle].code;
+			return LJME_NOERROR;
+		}
+		if (cmp < 0) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+	return LJME_INVALID_NAME;
+}
+
+#endif // #define LJM_REGISTER_DATABASE
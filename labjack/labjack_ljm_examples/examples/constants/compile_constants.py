@@ -0,0 +1,235 @@
+"""
+Compiles ljm_constants.json into the binary register database read by
+LJM_RegisterDatabase.h, so programs that need register metadata can mmap one
+file instead of parsing the JSON at startup.
+
+Usage:
+    python compile_constants.py [ljm_constants.json] [ljm_constants.bin]
+
+The defaults are the constants file setup.sh installs and ljm_constants.bin
+in the current directory. The layout is described in LJM_RegisterDatabase.h;
+bump FORMAT_VERSION in both files when it changes.
+
+"""
+
+import json
+import struct
+import sys
+import zlib
+
+DEFAULT_SOURCE = "/usr/local/share/LabJack/LJM/ljm_constants.json"
+DEFAULT_OUTPUT = "ljm_constants.bin"
+
+MAGIC = b"LJMREGDB"
+FORMAT_VERSION = 1
+HEADER_SIZE = 128
+VERSION_SIZE = 32
+
+# Types LJM_NameToAddress returns, and the registers per element of each.
+# LJM doesn't resolve registers of other types (UINT64), so neither does the
+# database.
+TYPES = {
+    "UINT16": (0, 1),
+    "UINT32": (1, 2),
+    "INT32": (2, 2),
+    "FLOAT32": (3, 2),
+    "BYTE": (99, 1),
+    "STRING": (98, 25),
+}
+
+DEVICES = {"T7": 0x1, "T4": 0x2, "DIGIT": 0x4}
+
+READ = 0x1
+WRITE = 0x2
+
+REGISTER_RANGE = 0x1
+REGISTER_STREAMABLE = 0x2
+REGISTER_BUFFER = 0x4
+REGISTER_BETA = 0x8
+
+NAME_RANGE = 0x1
+NAME_ALTERNATE = 0x2
+
+HEADER_FORMAT = "<8sIIII%ds17I" % VERSION_SIZE
+REGISTER_FORMAT = "<IIIiHHHBBHHI"
+NAME_FORMAT = "<IIHHI"
+ADDRESS_FORMAT = "<III"
+SCOPE_FORMAT = "<III"
+CONSTANT_FORMAT = "<IId"
+ERROR_FORMAT = "<iII"
+
+
+class StringPool:
+    """Null-terminated strings, each stored once. Offset 0 is ""."""
+
+    def __init__(self):
+        self.data = bytearray(b"\0")
+        self.offsets = {"": 0}
+
+    def add(self, string):
+        if string not in self.offsets:
+            self.offsets[string] = len(self.data)
+            self.data += string.encode("utf-8") + b"\0"
+        return self.offsets[string]
+
+
+def parse_name(name):
+    """Splits "AIN#(0:254)_RANGE" into ("AIN#_RANGE", 0, 254), and a name
+    without a range into (name, None, None). Keys are upper case, since LJM
+    matches names without regard to case."""
+    hash_i = name.find("#(")
+    if hash_i < 0:
+        return name.upper(), None, None
+    close_i = name.index(")", hash_i)
+    first, last = name[hash_i + 2:close_i].split(":")
+    key = name[:hash_i] + "#" + name[close_i + 1:]
+    if "#(" in key[hash_i + 1:]:
+        raise ValueError("%s has more than one range" % name)
+    return key.upper(), int(first), int(last)
+
+
+def device_mask(devices):
+    mask = 0
+    for device in devices:
+        if isinstance(device, dict):
+            device = device["device"]
+        mask |= DEVICES.get(device, 0)
+    return mask
+
+
+def align(data, size=8):
+    data += b"\0" * (-len(data) % size)
+
+
+def compile_constants(source):
+    constants = json.loads(source.decode("utf-8"))
+    strings = StringPool()
+    registers = []
+    names = []
+    scopes = []
+
+    all_registers = [(r, 0) for r in constants["registers"]]
+    all_registers += [(r, REGISTER_BETA) for r in constants.get("registers_beta", [])]
+    for register, beta in all_registers:
+        if register["type"] not in TYPES:
+            continue
+        ljm_type, stride = TYPES[register["type"]]
+        key, first, last = parse_name(register["name"])
+
+        flags = beta
+        if first is not None:
+            flags |= REGISTER_RANGE
+        else:
+            first = last = 0
+        if register.get("streamable"):
+            flags |= REGISTER_STREAMABLE
+        if register.get("isBuffer"):
+            flags |= REGISTER_BUFFER
+        readwrite = 0
+        if "R" in register["readwrite"]:
+            readwrite |= READ
+        if "W" in register["readwrite"]:
+            readwrite |= WRITE
+
+        index = len(registers)
+        registers.append((strings.add(register["name"]), strings.add(key),
+            register["address"], ljm_type, first, last, stride, readwrite, flags,
+            device_mask(register["devices"]), 0, strings.add(",".join(register.get("tags", [])))))
+
+        name_flags = NAME_RANGE if flags & REGISTER_RANGE else 0
+        names.append((key, index, first, last, name_flags))
+        for altname in register.get("altnames", []):
+            alt_key, alt_first, alt_last = parse_name(altname)
+            if (alt_first is None) != (name_flags == 0) or \
+                    (alt_first is not None and alt_last - alt_first != last - first):
+                raise ValueError("%s doesn't match the range of %s" % (altname, register["name"]))
+            if alt_first is None:
+                alt_first = alt_last = 0
+            names.append((alt_key, index, alt_first, alt_last, name_flags | NAME_ALTERNATE))
+
+        if register.get("constants"):
+            scopes.append((register["name"], [(c["name"].upper(), float(c["value"]))
+                for c in register["constants"]]))
+
+    # Sorted by key, then by first index, so the ranges sharing a key (DIO#
+    # is four altnames) are adjacent
+    names.sort(key=lambda n: (n[0].encode("utf-8"), n[2]))
+    for i in range(1, len(names)):
+        if names[i][0] == names[i - 1][0] and (names[i][4] & NAME_RANGE == 0 or
+                names[i][2] <= names[i - 1][3]):
+            raise ValueError("%s is defined twice" % names[i][0])
+
+    # Sorted by address; non-beta first so it is the name an address maps to
+    addresses = []
+    for index, register in enumerate(registers):
+        count = register[5] - register[4] + 1
+        addresses.append((register[2], register[2] + count * register[6], index))
+    max_span = max(a[1] - a[0] for a in addresses)
+    addresses.sort(key=lambda a: (a[0], registers[a[2]][8] & REGISTER_BETA, a[2]))
+
+    scopes.sort(key=lambda s: s[0].encode("utf-8"))
+    errors = [(e["error"], e["string"].upper(), e.get("description", ""))
+        for e in constants["errors"]]
+    errors_by_code = [(e[0], strings.add(e[1]), strings.add(e[2]))
+        for e in sorted(errors, key=lambda e: e[0])]
+    errors_by_name = [(e[0], strings.add(e[1]), strings.add(e[2]))
+        for e in sorted(errors, key=lambda e: (e[1].encode("utf-8"), e[0]))]
+
+    body = bytearray()
+
+    def section(entries, entry_format):
+        align(body)
+        offset = HEADER_SIZE + len(body)
+        for entry in entries:
+            body.extend(struct.pack(entry_format, *entry))
+        return offset
+
+    registers_offset = section(registers, REGISTER_FORMAT)
+    names_offset = section([(strings.add(n[0]),) + n[1:] for n in names], NAME_FORMAT)
+    addresses_offset = section(addresses, ADDRESS_FORMAT)
+    scope_entries = []
+    constant_entries = []
+    for scope_name, scope_constants in scopes:
+        scope_entries.append((strings.add(scope_name), len(constant_entries), len(scope_constants)))
+        for name, value in sorted(scope_constants, key=lambda c: c[0].encode("utf-8")):
+            constant_entries.append((strings.add(name), 0, value))
+    scopes_offset = section(scope_entries, SCOPE_FORMAT)
+    constants_offset = section(constant_entries, CONSTANT_FORMAT)
+    error_codes_offset = section(errors_by_code, ERROR_FORMAT)
+    error_names_offset = section(errors_by_name, ERROR_FORMAT)
+    align(body)
+    strings_offset = HEADER_SIZE + len(body)
+    body += strings.data
+
+    version = constants.get("header", {}).get("version", "").encode("utf-8")[:VERSION_SIZE - 1]
+    header = struct.pack(HEADER_FORMAT, MAGIC, FORMAT_VERSION, HEADER_SIZE,
+        HEADER_SIZE + len(body), zlib.crc32(source) & 0xffffffff, version,
+        len(registers), registers_offset,
+        len(names), names_offset,
+        len(addresses), addresses_offset,
+        len(scope_entries), scopes_offset,
+        len(constant_entries), constants_offset,
+        len(errors), error_codes_offset, error_names_offset,
+        strings_offset, len(strings.data),
+        max_span, 0)
+    header += b"\0" * (HEADER_SIZE - len(header))
+    return header + bytes(body), len(registers), len(names), len(errors)
+
+
+def main():
+    source_path = sys.argv[1] if len(sys.argv) > 1 else DEFAULT_SOURCE
+    output_path = sys.argv[2] if len(sys.argv) > 2 else DEFAULT_OUTPUT
+
+    with open(source_path, "rb") as f:
+        source = f.read()
+    database, num_registers, num_names, num_errors = compile_constants(source)
+    with open(output_path, "wb") as f:
+        f.write(database)
+
+    print("%s (%d bytes) -> %s (%d bytes): %d registers, %d names, %d errors" % \
+        (source_path, len(source), output_path, len(database), num_registers,
+        num_names, num_errors))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,199 @@
+/**
+ * Name: constants_startup.cpp
+ * Desc: Measures the startup cost of looking up register metadata:
+ *           - LJM_LoadConstantsFromFile, which parses ljm_constants.json,
+ *             followed by LJM_NameToAddress for a few names,
+ *           - RegisterDatabase::Open, which maps the file
+ *             compile_constants.py built, followed by the same lookups,
+ *       then the cost of one lookup with each. Finally checks that every
+ *       register address in the database maps to a name that
+ *       LJM_NameToAddress resolves to the same address and type.
+ * Usage: constants_startup [ljm_constants.bin [ljm_constants.json]]
+ *        Without a JSON path, the constants file LJM is configured with is
+ *        used. Build ljm_constants.bin from that same file with:
+ *            python compile_constants.py <ljm_constants.json>
+**/
+
+// For printf
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_RegisterDatabase.h"
+
+enum { NUM_STARTUPS = 5 };
+enum { NUM_LOOKUPS = 2000 };
+
+// What a program typically looks up at startup
+enum { NUM_NAMES = 8 };
+const char * NAMES[NUM_NAMES] = {"AIN0", "AIN0_RANGE", "AIN3_EF_READ_A", "FIO0",
+	"DIO17", "STREAM_SCANRATE_HZ", "SERIAL_NUMBER", "WIFI_SSID"};
+
+typedef int (*LookupFunction)(void * context, const char * name, int * address, int * type);
+
+/**
+ * Desc: Returns the median of NUM_STARTUPS runs of open followed by a lookup
+ *       of each of NAMES, in milliseconds. Exits if a lookup fails.
+**/
+template<class Open>
+double MedianStartupMS(Open open, LookupFunction lookup, void * context,
+	const char * description);
+
+/**
+ * Desc: Returns the microseconds per lookup of NAMES[i % NUM_NAMES].
+**/
+double LookupUS(LookupFunction lookup, void * context);
+
+int LJMLookup(void * context, const char * name, int * address, int * type);
+int DatabaseLookup(void * context, const char * name, int * address, int * type);
+
+/**
+ * Desc: Checks the database against LJM and prints the differences.
+ * Retr: The number of differences.
+**/
+int CompareWithLJM(const RegisterDatabase & database);
+
+int main(int argc, char * argv[])
+{
+	int err;
+	double value = 0;
+	char jsonPath[LJM_MAX_NAME_SIZE];
+	const char * databasePath = argc > 1 ? argv[1] : "ljm_constants.bin";
+	RegisterDatabase database;
+
+	if (argc > 2) {
+		snprintf(jsonPath, sizeof(jsonPath), "%s", argv[2]);
+	}
+	else {
+		err = LJM_ReadLibraryConfigStringS(LJM_CONSTANTS_FILE, jsonPath);
+		ErrorCheck(err, "LJM_ReadLibraryConfigStringS(LJM_CONSTANTS_FILE)");
+	}
+
+	err = database.Open(databasePath);
+	ErrorCheck(err, "RegisterDatabase::Open(%s)", databasePath);
+	printf("%s: constants version %s, CRC-32 %08x\n", databasePath,
+		database.ConstantsVersion(), database.SourceChecksum());
+	printf("%s\n\n", jsonPath);
+
+	double ljmMS = MedianStartupMS([&]() {
+		return LJM_LoadConstantsFromFile(jsonPath);
+	}, LJMLookup, NULL, "LJM_LoadConstantsFromFile");
+	double databaseMS = MedianStartupMS([&]() {
+		return database.Open(databasePath);
+	}, DatabaseLookup, &database, "RegisterDatabase::Open");
+
+	printf("Startup with %d lookups, median of %d:\n", NUM_NAMES, NUM_STARTUPS);
+	printf("    LJM_LoadConstantsFromFile + LJM_NameToAddress:  %9.3f ms\n", ljmMS);
+	printf("    RegisterDatabase::Open + NameToAddress:         %9.3f ms\n", databaseMS);
+	printf("One lookup:\n");
+	printf("    LJM_NameToAddress:                              %9.3f us\n",
+		LookupUS(LJMLookup, NULL));
+	printf("    RegisterDatabase::NameToAddress:                %9.3f us\n\n",
+		LookupUS(DatabaseLookup, &database));
+
+	err = database.LookupConstantValue("WIFI_STATUS", "ASSOCIATED", &value);
+	ErrorCheck(err, "RegisterDatabase::LookupConstantValue(WIFI_STATUS, ASSOCIATED)");
+	printf("WIFI_STATUS ASSOCIATED = %.0f\n\n", value);
+
+	int numDifferences = CompareWithLJM(database);
+
+	WaitForUserIfWindows();
+
+	return numDifferences == 0 ? LJME_NOERROR : LJME_INVALID_CONSTANTS_FILE;
+}
+
+template<class Open>
+double MedianStartupMS(Open open, LookupFunction lookup, void * context,
+	const char * description)
+{
+	int startupI, nameI, err, address, type;
+	std::vector<double> ms;
+
+	for (startupI = 0; startupI < NUM_STARTUPS; startupI++) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		err = open();
+		ErrorCheck(err, "%s", description);
+		for (nameI = 0; nameI < NUM_NAMES; nameI++) {
+			err = lookup(context, NAMES[nameI], &address, &type);
+			ErrorCheck(err, "%s lookup of %s", description, NAMES[nameI]);
+		}
+		ms.push_back(std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count());
+	}
+	std::sort(ms.begin(), ms.end());
+	return ms[ms.size() / 2];
+}
+
+double LookupUS(LookupFunction lookup, void * context)
+{
+	int i, address, type;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (i = 0; i < NUM_LOOKUPS; i++) {
+		lookup(context, NAMES[i % NUM_NAMES], &address, &type);
+	}
+	return std::chrono::duration<double, std::micro>(
+		std::chrono::steady_clock::now() - start).count() / NUM_LOOKUPS;
+}
+
+int LJMLookup(void *, const char * name, int * address, int * type)
+{
+	return LJM_NameToAddress(name, address, type);
+}
+
+int DatabaseLookup(void * context, const char * name, int * address, int * type)
+{
+	return ((const RegisterDatabase *)context)->NameToAddress(name, address, type);
+}
+
+int CompareWithLJM(const RegisterDatabase & database)
+{
+	int registerI, index, err, ljmAddress, ljmType, address, type;
+	int numChecked = 0, numDifferences = 0;
+	char name[LJM_MAX_NAME_SIZE];
+	RegisterInfo reg, element;
+
+	for (registerI = 0; registerI < database.NumRegisters(); registerI++) {
+		err = database.GetRegister(registerI, &reg);
+		ErrorCheck(err, "RegisterDatabase::GetRegister(%d)", registerI);
+		for (index = reg.first; index <= reg.last; index++) {
+			address = reg.address + (index - reg.first) * reg.numRegisters;
+			err = database.AddressToName(address, name, &element);
+			if (err != LJME_NOERROR) {
+				printf("%s: no name for address %d\n", reg.name, address);
+				numDifferences++;
+				continue;
+			}
+
+			numChecked++;
+			err = LJM_NameToAddress(name, &ljmAddress, &ljmType);
+			if (err != LJME_NOERROR) {
+				printf("%s: not known to LJM_NameToAddress, error %d\n", name, err);
+				numDifferences++;
+				continue;
+			}
+			err = database.NameToAddress(name, &address, &type);
+			if (err != LJME_NOERROR) {
+				printf("%s: no address for name, error %d\n", name, err);
+				numDifferences++;
+				continue;
+			}
+			if (ljmAddress != address || ljmType != type || element.address != address) {
+				printf("%s: LJM address %d type %d, database address %d type %d\n",
+					name, ljmAddress, ljmType, address, type);
+				numDifferences++;
+			}
+		}
+	}
+	printf("Checked %d names against LJM_NameToAddress: %d differences\n", numChecked,
+		numDifferences);
+	return numDifferences;
+}
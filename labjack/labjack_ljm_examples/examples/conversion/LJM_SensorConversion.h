@@ -0,0 +1,403 @@
+/**
+ * Name: LJM_SensorConversion.h
+ * Desc: Converts AIN volts to sensor readings a whole stream block at a time.
+ *       trade_fair.py and the single-sensor scripts convert each reading
+ *       with inline Python math. Every one of those conversions, and any
+ *       linear sensor, has the form
+ *           y = (a * v + b) / (c * v + d)
+ *       so one kernel converts a block of interleaved scans in place with
+ *       SIMD, taking each channel's coefficients from a table laid out like
+ *       the block. AVX, SSE2 and NEON are used when the compiler targets
+ *       them. C++11 only.
+**/
+
+#ifndef LJM_SENSOR_CONVERSION
+#define LJM_SENSOR_CONVERSION
+
+#include <vector>
+
+#include "LabJackM.h"
+
+#if defined(__AVX__)
+	#include <immintrin.h>
+	#define SENSOR_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+	#include <emmintrin.h>
+	#define SENSOR_SIMD_SSE2
+#elif defined(__aarch64__)
+	#include <arm_neon.h>
+	#define SENSOR_SIMD_NEON
+#endif
+
+/**
+ * Desc: The sensor on a channel.
+ *       SENSOR_VOLTS: the volts, unchanged.
+ *       SENSOR_LINEAR: volts * scale + offset, like humidity.py and
+ *           anemometer.py.
+ *       SENSOR_RTD_DIVIDER: an RTD under a series resistor,
+ *           R = seriesOhms * v / (supplyVolts - v) and
+ *           T = (R - r0Ohms) / (r0Ohms * alpha), like radiant_temperature.py.
+ *       SENSOR_THERMISTOR_DIVIDER: a thermistor under a series resistor,
+ *           R = seriesOhms * v / (supplyVolts - v) and
+ *           T = referenceC * seriesOhms / R, like ambient_temperature.py.
+**/
+enum SensorType {
+	SENSOR_VOLTS,
+	SENSOR_LINEAR,
+	SENSOR_RTD_DIVIDER,
+	SENSOR_THERMISTOR_DIVIDER
+};
+
+/**
+ * Desc: Describes the sensor on one channel. Fields that type doesn't use
+ *       are ignored. Use the functions below to fill it in.
+**/
+struct SensorDescriptor
+{
+	SensorType type;
+	double scale;
+	double offset;
+	double seriesOhms;
+	double supplyVolts;
+	double r0Ohms;
+	double alpha;
+	double referenceC;
+};
+
+SensorDescriptor VoltsSensor();
+SensorDescriptor LinearSensor(double scale, double offset = 0);
+SensorDescriptor RtdDividerSensor(double seriesOhms, double supplyVolts,
+	double r0Ohms, double alpha);
+SensorDescriptor ThermistorDividerSensor(double seriesOhms, double supplyVolts,
+	double referenceC);
+
+/**
+ * Desc: The comfortbot sensors, with the constants of trade_fair.py: the
+ *       100 ohm RTD radiant temperature sensor (T = (R - 100) / 0.3851), the
+ *       humidity sensor (100 * V / 4.915), the 3000 ohm thermistor ambient
+ *       temperature sensor (T = 3000 / R * 25) and the anemometers
+ *       (5.08 * V / 5 m/s).
+**/
+SensorDescriptor ComfortbotRadiantSensor();
+SensorDescriptor ComfortbotHumiditySensor();
+SensorDescriptor ComfortbotAmbientSensor();
+SensorDescriptor ComfortbotAnemometerSensor();
+
+/**
+ * Desc: The coefficients of y = (a * v + b) / (c * v + d) for a sensor.
+**/
+struct SensorCoefficients
+{
+	double a;
+	double b;
+	double c;
+	double d;
+};
+
+/**
+ * Retr: LJME_NOERROR, or LJME_INVALID_PARAMETER if sensor has an unknown
+ *       type or its conversion divides by zero for every voltage.
+**/
+int SensorCoefficientsFor(const SensorDescriptor & sensor,
+	SensorCoefficients * coefficients);
+
+/**
+ * Desc: Converts one reading. The kernels compute the same expression.
+**/
+double ConvertSensorVolts(const SensorCoefficients & coefficients, double volts);
+
+/**
+ * Desc: Returns "AVX", "SSE2", "NEON" or "scalar", the kernel this build uses.
+**/
+const char * SensorSimdName();
+
+/**
+ * Name: SensorBlockConverter
+ * Desc: Converts blocks of interleaved scans, as LJM_eStreamRead returns
+ *       them, in place. Channel i of each scan is converted with the i-th
+ *       descriptor.
+ * Note: The coefficient table repeats the channels' coefficients for as
+ *       many scans as there are SIMD lanes, so each vector of data lines up
+ *       with a vector of coefficients no matter how many channels there
+ *       are.
+**/
+class SensorBlockConverter
+{
+public:
+	SensorBlockConverter();
+
+	/**
+	 * Desc: Sets the channels, in scan list order.
+	 * Retr: LJME_NOERROR, or the error of SensorCoefficientsFor for the
+	 *       first bad descriptor, in which case the channels are unchanged.
+	**/
+	int SetChannels(const std::vector<SensorDescriptor> & sensors);
+
+	int NumChannels() const { return numChannels; }
+
+	/**
+	 * Desc: Converts numValues values in place. aData must start at the
+	 *       first channel of a scan; a partial scan at the end is converted
+	 *       as far as it goes.
+	**/
+	void Convert(double * aData, int numValues) const;
+
+private:
+	int numChannels;
+	std::vector<double> a;
+	std::vector<double> b;
+	std::vector<double> c;
+	std::vector<double> d;
+};
+
+/**
+ * Desc: Converts numValues values of one channel in place.
+**/
+void ConvertSensorBlock(const SensorCoefficients & coefficients, double * aValues,
+	int numValues);
+
+
+// Source
+
+#if defined(SENSOR_SIMD_AVX)
+	static const int SENSOR_SIMD_LANES = 4;
+#elif defined(SENSOR_SIMD_SSE2) || defined(SENSOR_SIMD_NEON)
+	static const int SENSOR_SIMD_LANES = 2;
+#else
+	static const int SENSOR_SIMD_LANES = 1;
+#endif
+
+inline SensorDescriptor VoltsSensor()
+{
+	SensorDescriptor sensor;
+	sensor.type = SENSOR_VOLTS;
+	sensor.scale = 1;
+	sensor.offset = 0;
+	sensor.seriesOhms = 0;
+	sensor.supplyVolts = 0;
+	sensor.r0Ohms = 0;
+	sensor.alpha = 0;
+	sensor.referenceC = 0;
+	return sensor;
+}
+
+inline SensorDescriptor LinearSensor(double scale, double offset)
+{
+	SensorDescriptor sensor = VoltsSensor();
+	sensor.type = SENSOR_LINEAR;
+	sensor.scale = scale;
+	sensor.offset = offset;
+	return sensor;
+}
+
+inline SensorDescriptor RtdDividerSensor(double seriesOhms, double supplyVolts,
+	double r0Ohms, double alpha)
+{
+	SensorDescriptor sensor = VoltsSensor();
+	sensor.type = SENSOR_RTD_DIVIDER;
+	sensor.seriesOhms = seriesOhms;
+	sensor.supplyVolts = supplyVolts;
+	sensor.r0Ohms = r0Ohms;
+	sensor.alpha = alpha;
+	return sensor;
+}
+
+inline SensorDescriptor ThermistorDividerSensor(double seriesOhms, double supplyVolts,
+	double referenceC)
+{
+	SensorDescriptor sensor = VoltsSensor();
+	sensor.type = SENSOR_THERMISTOR_DIVIDER;
+	sensor.seriesOhms = seriesOhms;
+	sensor.supplyVolts = supplyVolts;
+	sensor.referenceC = referenceC;
+	return sensor;
+}
+
+inline SensorDescriptor ComfortbotRadiantSensor()
+{
+	return RtdDividerSensor(100, 4.915, 100, 0.003851);
+}
+
+inline SensorDescriptor ComfortbotHumiditySensor()
+{
+	return LinearSensor(100 / 4.915);
+}
+
+inline SensorDescriptor ComfortbotAmbientSensor()
+{
+	return ThermistorDividerSensor(3000, 4.915, 25);
+}
+
+inline SensorDescriptor ComfortbotAnemometerSensor()
+{
+	return LinearSensor(5.08 / 5);
+}
+
+inline int SensorCoefficientsFor(const SensorDescriptor & sensor,
+	SensorCoefficients * coefficients)
+{
+	double s = sensor.seriesOhms;
+	double vs = sensor.supplyVolts;
+	double r0 = sensor.r0Ohms;
+	double k;
+
+	switch (sensor.type) {
+	case SENSOR_VOLTS:
+		*coefficients = {1, 0, 0, 1};
+		return LJME_NOERROR;
+
+	case SENSOR_LINEAR:
+		*coefficients = {sensor.scale, sensor.offset, 0, 1};
+		return LJME_NOERROR;
+
+	case SENSOR_RTD_DIVIDER:
+		// (s*v/(vs - v) - r0) / (r0*alpha)
+		//     = ((s + r0)*v - r0*vs) / (r0*alpha*(vs - v))
+		k = r0 * sensor.alpha;
+		if (k == 0 || vs == 0) {
+			return LJME_INVALID_PARAMETER;
+		}
+		*coefficients = {s + r0, -r0 * vs, -k, k * vs};
+		return LJME_NOERROR;
+
+	case SENSOR_THERMISTOR_DIVIDER:
+		// referenceC*s / (s*v/(vs - v)) = referenceC*(vs - v) / v
+		if (s == 0) {
+			return LJME_INVALID_PARAMETER;
+		}
+		*coefficients = {-sensor.referenceC, sensor.referenceC * vs, 1, 0};
+		return LJME_NOERROR;
+
+	default:
+		return LJME_INVALID_PARAMETER;
+	}
+}
+
+inline double ConvertSensorVolts(const SensorCoefficients & coefficients, double volts)
+{
+	return (coefficients.a * volts + coefficients.b) /
+		(coefficients.c * volts + coefficients.d);
+}
+
+inline const char * SensorSimdName()
+{
+#if defined(SENSOR_SIMD_AVX)
+	return "AVX";
+#elif defined(SENSOR_SIMD_SSE2)
+	return "SSE2";
+#elif defined(SENSOR_SIMD_NEON)
+	return "NEON";
+#else
+	return "scalar";
+#endif
+}
+
+// Converts count values, a multiple of SENSOR_SIMD_LANES, with the
+// coefficients at the same positions
+static inline void SensorKernel(double * aData, const double * a, const double * b,
+	const double * c, const double * d, int count)
+{
+	int i = 0;
+
+#if defined(SENSOR_SIMD_AVX)
+	for (; i < count; i += 4) {
+		__m256d v = _mm256_loadu_pd(aData + i);
+		__m256d numerator = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(a + i), v),
+			_mm256_loadu_pd(b + i));
+		__m256d denominator = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(c + i), v),
+			_mm256_loadu_pd(d + i));
+		_mm256_storeu_pd(aData + i, _mm256_div_pd(numerator, denominator));
+	}
+#elif defined(SENSOR_SIMD_SSE2)
+	for (; i < count; i += 2) {
+		__m128d v = _mm_loadu_pd(aData + i);
+		__m128d numerator = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(a + i), v),
+			_mm_loadu_pd(b + i));
+		__m128d denominator = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(c + i), v),
+			_mm_loadu_pd(d + i));
+		_mm_storeu_pd(aData + i, _mm_div_pd(numerator, denominator));
+	}
+#elif defined(SENSOR_SIMD_NEON)
+	for (; i < count; i += 2) {
+		float64x2_t v = vld1q_f64(aData + i);
+		float64x2_t numerator = vaddq_f64(vmulq_f64(vld1q_f64(a + i), v), vld1q_f64(b + i));
+		float64x2_t denominator = vaddq_f64(vmulq_f64(vld1q_f64(c + i), v), vld1q_f64(d + i));
+		vst1q_f64(aData + i, vdivq_f64(numerator, denominator));
+	}
+#endif
+
+	for (; i < count; i++) {
+		aData[i] = (a[i] * aData[i] + b[i]) / (c[i] * aData[i] + d[i]);
+	}
+}
+
+inline SensorBlockConverter::SensorBlockConverter() :
+	numChannels(0)
+{
+}
+
+inline int SensorBlockConverter::SetChannels(const std::vector<SensorDescriptor> & sensors)
+{
+	std::vector<SensorCoefficients> coefficients(sensors.size());
+	for (size_t i = 0; i < sensors.size(); i++) {
+		int err = SensorCoefficientsFor(sensors[i], &coefficients[i]);
+		if (err != LJME_NOERROR) {
+			return err;
+		}
+	}
+
+	numChannels = (int)sensors.size();
+	int tableSize = numChannels * SENSOR_SIMD_LANES;
+	a.resize(tableSize);
+	b.resize(tableSize);
+	c.resize(tableSize);
+	d.resize(tableSize);
+	for (int i = 0; i < tableSize; i++) {
+		const SensorCoefficients & channel = coefficients[i % numChannels];
+		a[i] = channel.a;
+		b[i] = channel.b;
+		c[i] = channel.c;
+		d[i] = channel.d;
+	}
+	return LJME_NOERROR;
+}
+
+inline void SensorBlockConverter::Convert(double * aData, int numValues) const
+{
+	int tableSize = (int)a.size();
+	int i = 0;
+
+	if (tableSize == 0) {
+		return;
+	}
+
+	for (; i + tableSize <= numValues; i += tableSize) {
+		SensorKernel(aData + i, &a[0], &b[0], &c[0], &d[0], tableSize);
+	}
+	for (int j = 0; i < numValues; i++, j++) {
+		aData[i] = (a[j] * aData[i] + b[j]) / (c[j] * aData[i] + d[j]);
+	}
+}
+
+inline void ConvertSensorBlock(const SensorCoefficients & coefficients, double * aValues,
+	int numValues)
+{
+	// A one-channel table, one value per lane
+	double a[SENSOR_SIMD_LANES], b[SENSOR_SIMD_LANES], c[SENSOR_SIMD_LANES], d[SENSOR_SIMD_LANES];
+	for (int lane = 0; lane < SENSOR_SIMD_LANES; lane++) {
+		a[lane] = coefficients.a;
+		b[lane] = coefficients.b;
+		c[lane] = coefficients.c;
+		d[lane] = coefficients.d;
+	}
+
+	int i = 0;
+	for (; i + SENSOR_SIMD_LANES <= numValues; i += SENSOR_SIMD_LANES) {
+		SensorKernel(aValues + i, a, b, c, d, SENSOR_SIMD_LANES);
+	}
+	for (; i < numValues; i++) {
+		aValues[i] = ConvertSensorVolts(coefficients, aValues[i]);
+	}
+}
+
+#endif // #ifndef LJM_SENSOR_CONVERSION
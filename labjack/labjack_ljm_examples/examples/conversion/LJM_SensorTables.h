@@ -0,0 +1,496 @@
+/**
+ * Name: LJM_SensorTables.h
+ * Desc: Temperature conversion tables built by the compiler. A thermistor
+ *       read with the Steinhart-Hart equation needs a log per sample, and an
+ *       RTD read with the Callendar-Van Dusen equation needs a square root
+ *       or, below 0 C, an iteration. trade_fair.py avoids both with linear
+ *       approximations that are off by degrees away from 25 C.
+ *       MakeThermistorTable and MakeRtdTable evaluate the exact curves for
+ *       one sensor model, divider and excitation voltage at compile time
+ *       into a table over AIN volts, and SensorTable::Convert interpolates
+ *       it without branches: a multiply, two clamps and a cubic per sample.
+ *       C++14 only, for the constexpr loops.
+**/
+
+#ifndef LJM_SENSOR_TABLES
+#define LJM_SENSOR_TABLES
+
+#include <math.h>
+
+// Kelvin at 0 C
+#define SENSOR_KELVIN_OFFSET 273.15
+
+/**
+ * Desc: Compile-time natural log and square root, for the table builders.
+ *       Accurate to a few units in the last place for positive, finite x.
+**/
+constexpr double ConstexprLog(double x);
+constexpr double ConstexprSqrt(double x);
+
+/**
+ * Desc: A thermistor's Steinhart-Hart coefficients:
+ *       1 / T = A + B * ln(R) + C * ln(R)^3, with T in kelvin.
+**/
+struct SteinhartHart
+{
+	double a;
+	double b;
+	double c;
+};
+
+/**
+ * Desc: Steinhart-Hart coefficients for a thermistor specified by its
+ *       resistance at 25 C and its beta, with c = 0.
+**/
+constexpr SteinhartHart SteinhartHartFromBeta(double r25Ohms, double beta);
+
+/**
+ * Desc: Callendar-Van Dusen coefficients of a platinum RTD:
+ *       R(T) = R0 * (1 + A*T + B*T^2 + C*(T - 100)*T^3), with the C term
+ *       only below 0 C.
+**/
+struct CallendarVanDusen
+{
+	double r0Ohms;
+	double a;
+	double b;
+	double c;
+};
+
+/**
+ * Desc: How the sensor is wired: the sensor from AIN to ground, seriesOhms
+ *       from excitationVolts to AIN, as in trade_fair.py, so
+ *       R = seriesOhms * v / (excitationVolts - v).
+**/
+struct SensorDivider
+{
+	double seriesOhms;
+	double excitationVolts;
+};
+
+/**
+ * Desc: The exact conversions the tables are built from, in C, for the
+ *       volts at AIN. The runtime versions use the math library.
+**/
+constexpr double ThermistorCelsius(const SteinhartHart & model, const SensorDivider & divider,
+	double volts);
+constexpr double RtdCelsius(const CallendarVanDusen & model, const SensorDivider & divider,
+	double volts);
+double ThermistorCelsiusExact(const SteinhartHart & model, const SensorDivider & divider,
+	double volts);
+double RtdCelsiusExact(const CallendarVanDusen & model, const SensorDivider & divider,
+	double volts);
+
+enum SensorTableInterpolation {
+	SENSOR_TABLE_LINEAR,
+	SENSOR_TABLE_CUBIC
+};
+
+/**
+ * Name: SensorTable
+ * Desc: NUM_SEGMENTS equal segments over [minVolts, maxVolts], each a cubic
+ *       in the position within the segment. Linear tables have zero
+ *       quadratic and cubic terms, so both interpolate with the same code.
+ *       Cubic segments are Hermite interpolants of the exact curve's values
+ *       and slopes at the segment ends.
+ *       Volts outside the range convert to the temperature at the nearest
+ *       end, and NaN converts to the temperature at minVolts.
+**/
+template <int NUM_SEGMENTS>
+struct SensorTable
+{
+	double minVolts;
+	double maxVolts;
+	double segmentsPerVolt;
+	double coefficients[NUM_SEGMENTS][4];
+
+	double Convert(double volts) const;
+
+	/**
+	 * Desc: Converts numValues values in place.
+	 * Para: stride, the distance between values, e.g. the number of
+	 *           channels in an interleaved stream block, with aData pointing
+	 *           at the channel's first value.
+	**/
+	void ConvertBlock(double * aData, int numValues, int stride = 1) const;
+};
+
+/**
+ * Desc: Builds a table of a thermistor's temperatures between the AIN volts
+ *       at maxCelsius and at minCelsius. Use it to initialize a constexpr
+ *       variable so the compiler builds it.
+**/
+template <int NUM_SEGMENTS>
+constexpr SensorTable<NUM_SEGMENTS> MakeThermistorTable(const SteinhartHart & model,
+	const SensorDivider & divider, double minCelsius, double maxCelsius,
+	SensorTableInterpolation interpolation = SENSOR_TABLE_CUBIC);
+
+/**
+ * Desc: The same for an RTD.
+**/
+template <int NUM_SEGMENTS>
+constexpr SensorTable<NUM_SEGMENTS> MakeRtdTable(const CallendarVanDusen & model,
+	const SensorDivider & divider, double minCelsius, double maxCelsius,
+	SensorTableInterpolation interpolation = SENSOR_TABLE_CUBIC);
+
+
+/**
+ * Desc: The comfortbot's temperature channels as cubic tables, built once at
+ *       compile time: the ambient thermistor from -20 to 80 C and the
+ *       radiant Pt100 from -50 to 150 C.
+**/
+enum { COMFORTBOT_TABLE_SEGMENTS = 256 };
+const SensorTable<COMFORTBOT_TABLE_SEGMENTS> & ComfortbotAmbientTable();
+const SensorTable<COMFORTBOT_TABLE_SEGMENTS> & ComfortbotRadiantTable();
+
+// Source
+
+constexpr double ConstexprLog(double x)
+{
+	// x = m * 2^e with m in [1, 2), then ln(m) = 2 * atanh((m - 1) / (m + 1))
+	double ln2 = 0.693147180559945309417;
+	int e = 0;
+	while (x >= 2) {
+		x /= 2;
+		++e;
+	}
+	while (x < 1) {
+		x *= 2;
+		--e;
+	}
+	double z = (x - 1) / (x + 1);
+	double z2 = z * z;
+	double term = z;
+	double sum = 0;
+	for (int k = 1; k < 60; k += 2) {
+		sum += term / k;
+		term *= z2;
+	}
+	return e * ln2 + 2 * sum;
+}
+
+constexpr double ConstexprSqrt(double x)
+{
+	if (x <= 0) {
+		return 0;
+	}
+	double guess = x > 1 ? x : 1;
+	for (int i = 0; i < 200; i++) {
+		double next = (guess + x / guess) / 2;
+		if (next == guess) {
+			break;
+		}
+		guess = next;
+	}
+	return guess;
+}
+
+constexpr SteinhartHart SteinhartHartFromBeta(double r25Ohms, double beta)
+{
+	// 1/T = 1/T25 + ln(R/R25)/beta
+	return SteinhartHart{1 / (25 + SENSOR_KELVIN_OFFSET) - ConstexprLog(r25Ohms) / beta,
+		1 / beta, 0};
+}
+
+/**
+ * Desc: IEC 60751 coefficients of a Pt100 RTD.
+**/
+constexpr CallendarVanDusen PT100_IEC60751 = {100, 3.9083e-3, -5.775e-7, -4.183e-12};
+
+/**
+ * Desc: The comfortbot's ambient thermistor. trade_fair.py's formula reads
+ *       3000 ohms as 25 C, so it is taken to be a 3 kohm NTC; beta 3950 is
+ *       an assumption. Replace it with the part's datasheet values.
+**/
+constexpr SteinhartHart COMFORTBOT_AMBIENT_NTC = SteinhartHartFromBeta(3000, 3950);
+
+/**
+ * Desc: The comfortbot dividers from trade_fair.py.
+**/
+constexpr SensorDivider COMFORTBOT_AMBIENT_DIVIDER = {3000, 4.915};
+constexpr SensorDivider COMFORTBOT_RADIANT_DIVIDER = {100, 4.915};
+
+constexpr double SensorDividerOhms(const SensorDivider & divider, double volts)
+{
+	return divider.seriesOhms * volts / (divider.excitationVolts - volts);
+}
+
+// dR/dv of the divider
+constexpr double SensorDividerSlope(const SensorDivider & divider, double volts)
+{
+	double below = divider.excitationVolts - volts;
+	return divider.seriesOhms * divider.excitationVolts / (below * below);
+}
+
+constexpr double SteinhartHartCelsius(const SteinhartHart & model, double lnR)
+{
+	return 1 / (model.a + model.b * lnR + model.c * lnR * lnR * lnR) - SENSOR_KELVIN_OFFSET;
+}
+
+// dT/dR at R, given T at R
+constexpr double SteinhartHartSlope(const SteinhartHart & model, double ohms,
+	double lnR, double celsius)
+{
+	double kelvin = celsius + SENSOR_KELVIN_OFFSET;
+	return -kelvin * kelvin * (model.b + 3 * model.c * lnR * lnR) / ohms;
+}
+
+constexpr double CallendarVanDusenOhms(const CallendarVanDusen & model, double celsius)
+{
+	double ohms = model.r0Ohms * (1 + model.a * celsius + model.b * celsius * celsius);
+	if (celsius < 0) {
+		ohms += model.r0Ohms * model.c * (celsius - 100) * celsius * celsius * celsius;
+	}
+	return ohms;
+}
+
+// dR/dT at celsius
+constexpr double CallendarVanDusenSlope(const CallendarVanDusen & model, double celsius)
+{
+	double slope = model.r0Ohms * (model.a + 2 * model.b * celsius);
+	if (celsius < 0) {
+		slope += model.r0Ohms * model.c * (4 * celsius - 300) * celsius * celsius;
+	}
+	return slope;
+}
+
+// Inverts Callendar-Van Dusen: the quadratic is exact at and above 0 C and
+// the start of a Newton iteration below it
+constexpr double CallendarVanDusenCelsius(const CallendarVanDusen & model, double ohms)
+{
+	double discriminant = model.a * model.a - 4 * model.b * (1 - ohms / model.r0Ohms);
+	double celsius = (-model.a + ConstexprSqrt(discriminant)) / (2 * model.b);
+	for (int i = 0; i < 20 && celsius < 0; i++) {
+		double step = (CallendarVanDusenOhms(model, celsius) - ohms) /
+			CallendarVanDusenSlope(model, celsius);
+		celsius -= step;
+		if (step < 1e-12 && step > -1e-12) {
+			break;
+		}
+	}
+	return celsius;
+}
+
+constexpr double ThermistorCelsius(const SteinhartHart & model, const SensorDivider & divider,
+	double volts)
+{
+	return SteinhartHartCelsius(model, ConstexprLog(SensorDividerOhms(divider, volts)));
+}
+
+constexpr double RtdCelsius(const CallendarVanDusen & model, const SensorDivider & divider,
+	double volts)
+{
+	return CallendarVanDusenCelsius(model, SensorDividerOhms(divider, volts));
+}
+
+inline double ThermistorCelsiusExact(const SteinhartHart & model, const SensorDivider & divider,
+	double volts)
+{
+	return SteinhartHartCelsius(model, log(SensorDividerOhms(divider, volts)));
+}
+
+inline double RtdCelsiusExact(const CallendarVanDusen & model, const SensorDivider & divider,
+	double volts)
+{
+	double ohms = SensorDividerOhms(divider, volts);
+	double discriminant = model.a * model.a - 4 * model.b * (1 - ohms / model.r0Ohms);
+	double celsius = (-model.a + sqrt(discriminant)) / (2 * model.b);
+	for (int i = 0; i < 20 && celsius < 0; i++) {
+		double step = (CallendarVanDusenOhms(model, celsius) - ohms) /
+			CallendarVanDusenSlope(model, celsius);
+		celsius -= step;
+		if (fabs(step) < 1e-12) {
+			break;
+		}
+	}
+	return celsius;
+}
+
+// The AIN volts of a divider at ohms
+constexpr double SensorDividerVolts(const SensorDivider & divider, double ohms)
+{
+	return divider.excitationVolts * ohms / (divider.seriesOhms + ohms);
+}
+
+// Finds the AIN volts of a thermistor at celsius, by bisection on 1 / T,
+// which unlike T stays finite over the whole excitation range
+constexpr double ThermistorVolts(const SteinhartHart & model, const SensorDivider & divider,
+	double celsius)
+{
+	double target = 1 / (celsius + SENSOR_KELVIN_OFFSET);
+	double low = divider.excitationVolts * 1e-9;
+	double high = divider.excitationVolts * (1 - 1e-9);
+	for (int i = 0; i < 200; i++) {
+		double middle = (low + high) / 2;
+		double lnR = ConstexprLog(SensorDividerOhms(divider, middle));
+		// 1 / T rises with R
+		if (model.a + model.b * lnR + model.c * lnR * lnR * lnR < target) {
+			low = middle;
+		}
+		else {
+			high = middle;
+		}
+	}
+	return (low + high) / 2;
+}
+
+// Fills table with segments of celsius(volts) and its slope
+template <int NUM_SEGMENTS, typename Celsius, typename Slope>
+constexpr SensorTable<NUM_SEGMENTS> SensorBuildTable(Celsius celsius, Slope slope,
+	double minVolts, double maxVolts, SensorTableInterpolation interpolation)
+{
+	SensorTable<NUM_SEGMENTS> table = {};
+	if (minVolts > maxVolts) {
+		double swap = minVolts;
+		minVolts = maxVolts;
+		maxVolts = swap;
+	}
+	double step = (maxVolts - minVolts) / NUM_SEGMENTS;
+	table.minVolts = minVolts;
+	table.maxVolts = maxVolts;
+	table.segmentsPerVolt = NUM_SEGMENTS / (maxVolts - minVolts);
+
+	double v0 = minVolts;
+	double y0 = celsius(v0);
+	double m0 = slope(v0) * step;
+	for (int i = 0; i < NUM_SEGMENTS; i++) {
+		double v1 = minVolts + (i + 1) * step;
+		double y1 = celsius(v1);
+		double m1 = slope(v1) * step;
+		table.coefficients[i][0] = y0;
+		if (interpolation == SENSOR_TABLE_CUBIC) {
+			// Hermite form in f = (v - v0) / step
+			table.coefficients[i][1] = m0;
+			table.coefficients[i][2] = 3 * (y1 - y0) - 2 * m0 - m1;
+			table.coefficients[i][3] = 2 * (y0 - y1) + m0 + m1;
+		}
+		else {
+			table.coefficients[i][1] = y1 - y0;
+			table.coefficients[i][2] = 0;
+			table.coefficients[i][3] = 0;
+		}
+		v0 = v1;
+		y0 = y1;
+		m0 = m1;
+	}
+	return table;
+}
+
+template <int NUM_SEGMENTS>
+inline double SensorTable<NUM_SEGMENTS>::Convert(double volts) const
+{
+	// The comparisons compile to min/max instructions, not branches, and
+	// send NaN to 0
+	double x = (volts - minVolts) * segmentsPerVolt;
+	x = x > 0 ? x : 0;
+	x = x < NUM_SEGMENTS ? x : NUM_SEGMENTS;
+	int i = (int)x;
+	i = i < NUM_SEGMENTS - 1 ? i : NUM_SEGMENTS - 1;
+	double f = x - i;
+	const double * c = coefficients[i];
+	return ((c[3] * f + c[2]) * f + c[1]) * f + c[0];
+}
+
+template <int NUM_SEGMENTS>
+inline void SensorTable<NUM_SEGMENTS>::ConvertBlock(double * aData, int numValues,
+	int stride) const
+{
+	for (int i = 0; i < numValues; i++) {
+		aData[i * stride] = Convert(aData[i * stride]);
+	}
+}
+
+// The curves and slopes the builders tabulate, as function objects since
+// C++14 lambdas can't be constexpr
+struct ThermistorCurve
+{
+	SteinhartHart model;
+	SensorDivider divider;
+
+	constexpr double operator()(double volts) const
+	{
+		return ThermistorCelsius(model, divider, volts);
+	}
+};
+
+struct ThermistorCurveSlope
+{
+	SteinhartHart model;
+	SensorDivider divider;
+
+	constexpr double operator()(double volts) const
+	{
+		double ohms = SensorDividerOhms(divider, volts);
+		double lnR = ConstexprLog(ohms);
+		return SteinhartHartSlope(model, ohms, lnR, SteinhartHartCelsius(model, lnR)) *
+			SensorDividerSlope(divider, volts);
+	}
+};
+
+struct RtdCurve
+{
+	CallendarVanDusen model;
+	SensorDivider divider;
+
+	constexpr double operator()(double volts) const
+	{
+		return RtdCelsius(model, divider, volts);
+	}
+};
+
+struct RtdCurveSlope
+{
+	CallendarVanDusen model;
+	SensorDivider divider;
+
+	constexpr double operator()(double volts) const
+	{
+		return SensorDividerSlope(divider, volts) /
+			CallendarVanDusenSlope(model, RtdCelsius(model, divider, volts));
+	}
+};
+
+template <int NUM_SEGMENTS>
+constexpr SensorTable<NUM_SEGMENTS> MakeThermistorTable(const SteinhartHart & model,
+	const SensorDivider & divider, double minCelsius, double maxCelsius,
+	SensorTableInterpolation interpolation)
+{
+	ThermistorCurve celsius = {model, divider};
+	ThermistorCurveSlope slope = {model, divider};
+	return SensorBuildTable<NUM_SEGMENTS>(celsius, slope,
+		ThermistorVolts(model, divider, minCelsius),
+		ThermistorVolts(model, divider, maxCelsius), interpolation);
+}
+
+template <int NUM_SEGMENTS>
+constexpr SensorTable<NUM_SEGMENTS> MakeRtdTable(const CallendarVanDusen & model,
+	const SensorDivider & divider, double minCelsius, double maxCelsius,
+	SensorTableInterpolation interpolation)
+{
+	RtdCurve celsius = {model, divider};
+	RtdCurveSlope slope = {model, divider};
+	// The RTD's resistance is monotonic, so its volts at the limits are
+	// direct
+	return SensorBuildTable<NUM_SEGMENTS>(celsius, slope,
+		SensorDividerVolts(divider, CallendarVanDusenOhms(model, minCelsius)),
+		SensorDividerVolts(divider, CallendarVanDusenOhms(model, maxCelsius)),
+		interpolation);
+}
+
+inline const SensorTable<COMFORTBOT_TABLE_SEGMENTS> & ComfortbotAmbientTable()
+{
+	static constexpr SensorTable<COMFORTBOT_TABLE_SEGMENTS> table =
+		MakeThermistorTable<COMFORTBOT_TABLE_SEGMENTS>(COMFORTBOT_AMBIENT_NTC,
+			COMFORTBOT_AMBIENT_DIVIDER, -20, 80);
+	return table;
+}
+
+inline const SensorTable<COMFORTBOT_TABLE_SEGMENTS> & ComfortbotRadiantTable()
+{
+	static constexpr SensorTable<COMFORTBOT_TABLE_SEGMENTS> table =
+		MakeRtdTable<COMFORTBOT_TABLE_SEGMENTS>(PT100_IEC60751,
+			COMFORTBOT_RADIANT_DIVIDER, -50, 150);
+	return table;
+}
+
+#endif // #ifndef LJM_SENSOR_TABLES
@@ -0,0 +1,373 @@
+/**
+ * Name: LJM_ThermalComfort.h
+ * Desc: ISO 7730 predicted mean vote (PMV) and predicted percentage of
+ *       dissatisfied (PPD) from the four readings comfortbot takes: air
+ *       temperature, mean radiant temperature, air speed and relative
+ *       humidity, plus the occupants' metabolic rate and clothing.
+ *       Fanger's model solves for the clothing surface temperature by fixed
+ *       point iteration. ComfortBlock runs that iteration for
+ *       SENSOR_SIMD_LANES cells at once with the SIMD of
+ *       LJM_SensorConversion.h. Each lane stops updating once it has
+ *       converged, so it gives exactly what ComfortPmvPpd gives for each
+ *       cell.
+**/
+
+#ifndef LJM_THERMAL_COMFORT
+#define LJM_THERMAL_COMFORT
+
+#include <math.h>
+
+#include "LabJackM.h"
+
+#include "LJM_SensorConversion.h"
+
+enum {
+	// ISO 7730's limit on the clothing temperature iteration
+	COMFORT_MAX_ITERATIONS = 150
+};
+
+// ISO 7730's convergence limit, in hundreds of kelvin
+#define COMFORT_TOLERANCE 0.00015
+
+// W/m^2 per met
+#define COMFORT_WATTS_PER_MET 58.15
+
+/**
+ * Desc: What the occupants are doing and wearing.
+ *       met, the metabolic rate: 1.0 seated, 1.2 standing relaxed, 1.6
+ *           standing light activity.
+ *       clo, the clothing insulation: 0.5 summer, 1.0 winter indoor.
+ *       workMet, external work, 0 for nearly all activities.
+**/
+struct ComfortActivity
+{
+	double met;
+	double clo;
+	double workMet;
+};
+
+/**
+ * Desc: Visitors standing at a trade fair stand in light indoor clothing.
+**/
+ComfortActivity ComfortTradeFairActivity();
+
+/**
+ * Desc: PMV and PPD for one set of conditions.
+ * Para: airC and radiantC, in C. airSpeed, in m/s. humidity, in %RH.
+ * Retr: LJME_NOERROR, LJME_INVALID_PARAMETER for negative speed or
+ *       humidity outside 0 to 100, or LJME_INVALID_VALUE if the iteration
+ *       doesn't converge. pmv and ppd are NaN on error.
+**/
+int ComfortPmvPpd(double airC, double radiantC, double airSpeed, double humidity,
+	const ComfortActivity & activity, double * pmv, double * ppd);
+
+/**
+ * Desc: PMV and PPD for numCells cells, arrays of one value per cell.
+ *       Cells with invalid inputs or that don't converge get NaN.
+**/
+void ComfortBlock(int numCells, const double * aAirC, const double * aRadiantC,
+	const double * aAirSpeed, const double * aHumidity, const ComfortActivity & activity,
+	double * aPmv, double * aPpd);
+
+
+// Source
+
+inline ComfortActivity ComfortTradeFairActivity()
+{
+	ComfortActivity activity = {1.2, 0.7, 0};
+	return activity;
+}
+
+// The per-cell terms of Fanger's model that the iteration needs, and those
+// it finishes with
+struct ComfortCell
+{
+	double airK;
+	double radiant4;
+	double pa;
+	double fcl;
+	double hcf;
+	double p2;
+	double p3;
+	double p4;
+	double p5;
+	double xf;
+	double xn;
+	double hc;
+};
+
+// Sets cell up from its inputs. Returns false for invalid inputs.
+inline bool ComfortSetUp(double airC, double radiantC, double airSpeed, double humidity,
+	const ComfortActivity & activity, ComfortCell * cell)
+{
+	if (!(airSpeed >= 0) || !(humidity >= 0 && humidity <= 100) || isnan(airC) ||
+		isnan(radiantC))
+	{
+		return false;
+	}
+
+	double m = activity.met * COMFORT_WATTS_PER_MET;
+	double mw = m - activity.workMet * COMFORT_WATTS_PER_MET;
+	double icl = 0.155 * activity.clo;
+	double radiantK = radiantC + 273;
+	double radiantHundreds = radiantK / 100;
+
+	// Water vapour pressure, Pa
+	cell->pa = humidity * 10 * exp(16.6536 - 4030.183 / (airC + 235));
+	cell->fcl = icl <= 0.078 ? 1 + 1.29 * icl : 1.05 + 0.645 * icl;
+	cell->hcf = 12.1 * sqrt(airSpeed);
+	cell->airK = airC + 273;
+	cell->radiant4 = radiantHundreds * radiantHundreds * radiantHundreds * radiantHundreds;
+
+	double p1 = icl * cell->fcl;
+	cell->p2 = p1 * 3.96;
+	cell->p3 = p1 * 100;
+	cell->p4 = p1 * cell->airK;
+	cell->p5 = 308.7 - 0.028 * mw + cell->p2 * cell->radiant4;
+
+	double tcla = cell->airK + (35.5 - airC) / (3.5 * icl + 0.1);
+	cell->xn = tcla / 100;
+	cell->xf = tcla / 50;
+	cell->hc = cell->hcf;
+	return true;
+}
+
+// One step of the clothing temperature iteration, in hundreds of kelvin
+inline void ComfortStep(ComfortCell * cell)
+{
+	cell->xf = (cell->xf + cell->xn) / 2;
+	double hcn = 2.38 * sqrt(sqrt(fabs(100 * cell->xf - cell->airK)));
+	cell->hc = cell->hcf > hcn ? cell->hcf : hcn;
+	double xf2 = cell->xf * cell->xf;
+	cell->xn = (cell->p5 + cell->p4 * cell->hc - cell->p2 * (xf2 * xf2)) /
+		(100 + cell->p3 * cell->hc);
+}
+
+// The thermal sensation coefficient, which depends only on the activity
+inline double ComfortSensation(const ComfortActivity & activity)
+{
+	return 0.303 * exp(-0.036 * activity.met * COMFORT_WATTS_PER_MET) + 0.028;
+}
+
+// PMV and PPD from a converged cell, given ComfortSensation's coefficient
+inline void ComfortFinish(double airC, const ComfortActivity & activity, double ts,
+	const ComfortCell & cell, double * pmv, double * ppd)
+{
+	double m = activity.met * COMFORT_WATTS_PER_MET;
+	double mw = m - activity.workMet * COMFORT_WATTS_PER_MET;
+	double tcl = 100 * cell.xn - 273;
+	double xn2 = cell.xn * cell.xn;
+
+	// Heat losses: skin diffusion, sweating, latent and dry respiration,
+	// radiation and convection
+	double hl1 = 3.05e-3 * (5733 - 6.99 * mw - cell.pa);
+	double hl2 = mw > COMFORT_WATTS_PER_MET ? 0.42 * (mw - COMFORT_WATTS_PER_MET) : 0;
+	double hl3 = 1.7e-5 * m * (5867 - cell.pa);
+	double hl4 = 0.0014 * m * (34 - airC);
+	double hl5 = 3.96 * cell.fcl * (xn2 * xn2 - cell.radiant4);
+	double hl6 = cell.fcl * cell.hc * (tcl - airC);
+
+	*pmv = ts * (mw - hl1 - hl2 - hl3 - hl4 - hl5 - hl6);
+	double pmv2 = *pmv * *pmv;
+	*ppd = 100 - 95 * exp(-0.03353 * pmv2 * pmv2 - 0.2179 * pmv2);
+}
+
+inline int ComfortPmvPpd(double airC, double radiantC, double airSpeed, double humidity,
+	const ComfortActivity & activity, double * pmv, double * ppd)
+{
+	ComfortCell cell;
+	*pmv = NAN;
+	*ppd = NAN;
+	if (!ComfortSetUp(airC, radiantC, airSpeed, humidity, activity, &cell)) {
+		return LJME_INVALID_PARAMETER;
+	}
+
+	int iterations = 0;
+	while (fabs(cell.xn - cell.xf) > COMFORT_TOLERANCE) {
+		if (++iterations > COMFORT_MAX_ITERATIONS) {
+			return LJME_INVALID_VALUE;
+		}
+		ComfortStep(&cell);
+	}
+
+	ComfortFinish(airC, activity, ComfortSensation(activity), cell, pmv, ppd);
+	return LJME_NOERROR;
+}
+
+// Iterates SENSOR_SIMD_LANES cells, given as arrays of each ComfortCell
+// field, until each converges. Returns a bit per lane that converged.
+static inline int ComfortIterateLanes(double * xf, double * xn, double * hc,
+	const double * airK, const double * hcf, const double * p2, const double * p3,
+	const double * p4, const double * p5)
+{
+	int converged = 0;
+	int allLanes = (1 << SENSOR_SIMD_LANES) - 1;
+
+#if defined(SENSOR_SIMD_AVX)
+	__m256d vXf = _mm256_loadu_pd(xf), vXn = _mm256_loadu_pd(xn), vHc = _mm256_loadu_pd(hc);
+	__m256d vAirK = _mm256_loadu_pd(airK), vHcf = _mm256_loadu_pd(hcf);
+	__m256d vP2 = _mm256_loadu_pd(p2), vP3 = _mm256_loadu_pd(p3);
+	__m256d vP4 = _mm256_loadu_pd(p4), vP5 = _mm256_loadu_pd(p5);
+	__m256d tolerance = _mm256_set1_pd(COMFORT_TOLERANCE);
+	__m256d signBit = _mm256_set1_pd(-0.0);
+	for (int i = 0; ; i++) {
+		__m256d difference = _mm256_andnot_pd(signBit, _mm256_sub_pd(vXn, vXf));
+		// Not greater, rather than less or equal, so NaN lanes stop too
+		__m256d done = _mm256_cmp_pd(difference, tolerance, _CMP_NGT_UQ);
+		converged = _mm256_movemask_pd(done);
+		if (converged == allLanes || i == COMFORT_MAX_ITERATIONS) {
+			break;
+		}
+
+		__m256d newXf = _mm256_mul_pd(_mm256_add_pd(vXf, vXn), _mm256_set1_pd(0.5));
+		__m256d delta = _mm256_andnot_pd(signBit,
+			_mm256_sub_pd(_mm256_mul_pd(_mm256_set1_pd(100), newXf), vAirK));
+		__m256d hcn = _mm256_mul_pd(_mm256_set1_pd(2.38), _mm256_sqrt_pd(_mm256_sqrt_pd(delta)));
+		__m256d newHc = _mm256_max_pd(vHcf, hcn);
+		__m256d xf2 = _mm256_mul_pd(newXf, newXf);
+		__m256d newXn = _mm256_div_pd(
+			_mm256_sub_pd(_mm256_add_pd(vP5, _mm256_mul_pd(vP4, newHc)),
+				_mm256_mul_pd(vP2, _mm256_mul_pd(xf2, xf2))),
+			_mm256_add_pd(_mm256_set1_pd(100), _mm256_mul_pd(vP3, newHc)));
+
+		vXf = _mm256_blendv_pd(newXf, vXf, done);
+		vXn = _mm256_blendv_pd(newXn, vXn, done);
+		vHc = _mm256_blendv_pd(newHc, vHc, done);
+	}
+	_mm256_storeu_pd(xf, vXf);
+	_mm256_storeu_pd(xn, vXn);
+	_mm256_storeu_pd(hc, vHc);
+#elif defined(SENSOR_SIMD_SSE2)
+	__m128d vXf = _mm_loadu_pd(xf), vXn = _mm_loadu_pd(xn), vHc = _mm_loadu_pd(hc);
+	__m128d vAirK = _mm_loadu_pd(airK), vHcf = _mm_loadu_pd(hcf);
+	__m128d vP2 = _mm_loadu_pd(p2), vP3 = _mm_loadu_pd(p3);
+	__m128d vP4 = _mm_loadu_pd(p4), vP5 = _mm_loadu_pd(p5);
+	__m128d tolerance = _mm_set1_pd(COMFORT_TOLERANCE);
+	__m128d signBit = _mm_set1_pd(-0.0);
+	for (int i = 0; ; i++) {
+		__m128d difference = _mm_andnot_pd(signBit, _mm_sub_pd(vXn, vXf));
+		__m128d done = _mm_cmpngt_pd(difference, tolerance);
+		converged = _mm_movemask_pd(done);
+		if (converged == allLanes || i == COMFORT_MAX_ITERATIONS) {
+			break;
+		}
+
+		__m128d newXf = _mm_mul_pd(_mm_add_pd(vXf, vXn), _mm_set1_pd(0.5));
+		__m128d delta = _mm_andnot_pd(signBit,
+			_mm_sub_pd(_mm_mul_pd(_mm_set1_pd(100), newXf), vAirK));
+		__m128d hcn = _mm_mul_pd(_mm_set1_pd(2.38), _mm_sqrt_pd(_mm_sqrt_pd(delta)));
+		__m128d newHc = _mm_max_pd(vHcf, hcn);
+		__m128d xf2 = _mm_mul_pd(newXf, newXf);
+		__m128d newXn = _mm_div_pd(
+			_mm_sub_pd(_mm_add_pd(vP5, _mm_mul_pd(vP4, newHc)),
+				_mm_mul_pd(vP2, _mm_mul_pd(xf2, xf2))),
+			_mm_add_pd(_mm_set1_pd(100), _mm_mul_pd(vP3, newHc)));
+
+		// SSE2 has no blend
+		vXf = _mm_or_pd(_mm_and_pd(done, vXf), _mm_andnot_pd(done, newXf));
+		vXn = _mm_or_pd(_mm_and_pd(done, vXn), _mm_andnot_pd(done, newXn));
+		vHc = _mm_or_pd(_mm_and_pd(done, vHc), _mm_andnot_pd(done, newHc));
+	}
+	_mm_storeu_pd(xf, vXf);
+	_mm_storeu_pd(xn, vXn);
+	_mm_storeu_pd(hc, vHc);
+#elif defined(SENSOR_SIMD_NEON)
+	float64x2_t vXf = vld1q_f64(xf), vXn = vld1q_f64(xn), vHc = vld1q_f64(hc);
+	float64x2_t vAirK = vld1q_f64(airK), vHcf = vld1q_f64(hcf);
+	float64x2_t vP2 = vld1q_f64(p2), vP3 = vld1q_f64(p3);
+	float64x2_t vP4 = vld1q_f64(p4), vP5 = vld1q_f64(p5);
+	float64x2_t tolerance = vdupq_n_f64(COMFORT_TOLERANCE);
+	for (int i = 0; ; i++) {
+		// Not greater, so NaN lanes stop too
+		uint64x2_t done = vreinterpretq_u64_u32(vmvnq_u32(vreinterpretq_u32_u64(
+			vcgtq_f64(vabdq_f64(vXn, vXf), tolerance))));
+		converged = (int)(vgetq_lane_u64(done, 0) & 1) | (int)((vgetq_lane_u64(done, 1) & 1) << 1);
+		if (converged == allLanes || i == COMFORT_MAX_ITERATIONS) {
+			break;
+		}
+
+		float64x2_t newXf = vmulq_f64(vaddq_f64(vXf, vXn), vdupq_n_f64(0.5));
+		float64x2_t delta = vabsq_f64(vsubq_f64(vmulq_f64(vdupq_n_f64(100), newXf), vAirK));
+		float64x2_t hcn = vmulq_f64(vdupq_n_f64(2.38), vsqrtq_f64(vsqrtq_f64(delta)));
+		float64x2_t newHc = vmaxq_f64(vHcf, hcn);
+		float64x2_t xf2 = vmulq_f64(newXf, newXf);
+		float64x2_t newXn = vdivq_f64(
+			vsubq_f64(vaddq_f64(vP5, vmulq_f64(vP4, newHc)), vmulq_f64(vP2, vmulq_f64(xf2, xf2))),
+			vaddq_f64(vdupq_n_f64(100), vmulq_f64(vP3, newHc)));
+
+		vXf = vbslq_f64(done, vXf, newXf);
+		vXn = vbslq_f64(done, vXn, newXn);
+		vHc = vbslq_f64(done, vHc, newHc);
+	}
+	vst1q_f64(xf, vXf);
+	vst1q_f64(xn, vXn);
+	vst1q_f64(hc, vHc);
+#else
+	ComfortCell cell = {airK[0], 0, 0, 0, hcf[0], p2[0], p3[0], p4[0], p5[0], xf[0], xn[0],
+		hc[0]};
+	for (int i = 0; fabs(cell.xn - cell.xf) > COMFORT_TOLERANCE; i++) {
+		if (i == COMFORT_MAX_ITERATIONS) {
+			return 0;
+		}
+		ComfortStep(&cell);
+	}
+	xf[0] = cell.xf;
+	xn[0] = cell.xn;
+	hc[0] = cell.hc;
+	converged = allLanes;
+#endif
+
+	return converged;
+}
+
+inline void ComfortBlock(int numCells, const double * aAirC, const double * aRadiantC,
+	const double * aAirSpeed, const double * aHumidity, const ComfortActivity & activity,
+	double * aPmv, double * aPpd)
+{
+	const int LANES = SENSOR_SIMD_LANES;
+	double ts = ComfortSensation(activity);
+
+	for (int first = 0; first < numCells; first += LANES) {
+		ComfortCell cells[LANES];
+		bool valid[LANES];
+		double xf[LANES], xn[LANES], hc[LANES], airK[LANES], hcf[LANES];
+		double p2[LANES], p3[LANES], p4[LANES], p5[LANES];
+
+		// Lanes past the last cell, and invalid cells, start converged
+		for (int lane = 0; lane < LANES; lane++) {
+			int i = first + lane;
+			valid[lane] = i < numCells && ComfortSetUp(aAirC[i], aRadiantC[i], aAirSpeed[i],
+				aHumidity[i], activity, &cells[lane]);
+			if (!valid[lane]) {
+				ComfortCell idle = {};
+				cells[lane] = idle;
+			}
+			xf[lane] = cells[lane].xf;
+			xn[lane] = cells[lane].xn;
+			hc[lane] = cells[lane].hc;
+			airK[lane] = cells[lane].airK;
+			hcf[lane] = cells[lane].hcf;
+			p2[lane] = cells[lane].p2;
+			p3[lane] = cells[lane].p3;
+			p4[lane] = cells[lane].p4;
+			p5[lane] = cells[lane].p5;
+		}
+
+		int converged = ComfortIterateLanes(xf, xn, hc, airK, hcf, p2, p3, p4, p5);
+
+		for (int lane = 0; lane < LANES && first + lane < numCells; lane++) {
+			int i = first + lane;
+			if (!valid[lane] || !(converged & (1 << lane))) {
+				aPmv[i] = NAN;
+				aPpd[i] = NAN;
+				continue;
+			}
+			cells[lane].xf = xf[lane];
+			cells[lane].xn = xn[lane];
+			cells[lane].hc = hc[lane];
+			ComfortFinish(aAirC[i], activity, ts, cells[lane], &aPmv[i], &aPpd[i]);
+		}
+	}
+}
+
+#endif // #ifndef LJM_THERMAL_COMFORT
@@ -0,0 +1,516 @@
+/**
+ * Name: LJM_Thermocouple.h
+ * Desc: Converts streamed thermocouple volts to temperature a block at a
+ *       time. utilities/thermocouple_example.c calls LJM_TCVoltsToTemp once
+ *       per reading. That is fine at 1 Hz, but not for many channels
+ *       streamed at hundreds of Hz.
+ *       This header evaluates the NIST ITS-90 reference polynomials for
+ *       types E, J, K, N and T:
+ *       - the inverse polynomials run with this header's own SIMD Horner
+ *         kernel, over runs of values in the same range. It uses the
+ *         instruction set LJM_SensorConversion.h picks, whose kernel only
+ *         handles the (a*v + b) / (c*v + d) sensor form;
+ *       - the cold junction comes from a CJ channel in the same scans,
+ *         averaged over a group of scans and turned into millivolts once
+ *         per group and type.
+ *       Results are in kelvin, like LJM_TCVoltsToTemp.
+**/
+
+#ifndef LJM_THERMOCOUPLE
+#define LJM_THERMOCOUPLE
+
+#include <math.h>
+
+#include <vector>
+
+#include "LabJackM.h"
+
+#include "LJM_SensorConversion.h"
+
+enum {
+	THERMOCOUPLE_MAX_COEFFICIENTS = 15,
+	THERMOCOUPLE_MAX_RANGES = 3,
+
+	// CJ groups when SetChannels isn't given one, in scans
+	THERMOCOUPLE_DEFAULT_CJ_DECIMATION = 100
+};
+
+/**
+ * Desc: The T7's device temperature sensor on AIN14, in kelvin per volt
+ *       and kelvin. thermocouple_example.c adds a further 3 K to
+ *       approximate the screw terminals, which ThermocoupleCj's
+ *       correctionK is for.
+**/
+#define THERMOCOUPLE_T7_AIN14_SLOPE -92.6
+#define THERMOCOUPLE_T7_AIN14_OFFSET 467.6
+
+/**
+ * Desc: One NIST polynomial, c0 first, over [minimum, maximum].
+**/
+struct ThermocouplePolynomial
+{
+	double minimum;
+	double maximum;
+	int numCoefficients;
+	double coefficients[THERMOCOUPLE_MAX_COEFFICIENTS];
+};
+
+/**
+ * Desc: A thermocouple type's NIST ITS-90 reference functions.
+ *       forward: celsius to millivolts. Type K adds
+ *           exponential[0] * exp(exponential[1] * (t - exponential[2])^2)
+ *           above 0 C.
+ *       inverse: millivolts to celsius.
+**/
+struct ThermocoupleType
+{
+	long type;
+	char name;
+	int numForward;
+	ThermocouplePolynomial forward[2];
+	double exponential[3];
+	int numInverse;
+	ThermocouplePolynomial inverse[THERMOCOUPLE_MAX_RANGES];
+};
+
+/**
+ * Desc: Returns the reference functions for an LJM_tt* type, or NULL for
+ *       types this header doesn't cover (B, R, S and C).
+**/
+const ThermocoupleType * ThermocoupleTypeFor(long type);
+
+/**
+ * Desc: The thermocouple millivolts at celsius, relative to 0 C, or NaN
+ *       outside the type's range.
+**/
+double ThermocoupleMillivolts(const ThermocoupleType & type, double celsius);
+
+/**
+ * Desc: The celsius at millivolts relative to 0 C, or NaN outside the
+ *       type's range.
+**/
+double ThermocoupleCelsius(const ThermocoupleType & type, double millivolts);
+
+/**
+ * Desc: Converts numValues millivolts to celsius in place, like
+ *       ThermocoupleCelsius.
+**/
+void ThermocoupleCelsiusBlock(const ThermocoupleType & type, double * aValues,
+	int numValues);
+
+/**
+ * Desc: Scalar version of LJM_TCVoltsToTemp.
+ * Retr: LJME_NOERROR, LJME_FUNCTION_DOES_NOT_SUPPORT_THIS_TYPE,
+ *       LJME_TEMPERATURE_OUT_OF_RANGE for the cold junction or
+ *       LJME_VOLTAGE_OUT_OF_RANGE.
+**/
+int ThermocoupleVoltsToKelvin(long type, double volts, double cjKelvin, double * kelvin);
+
+/**
+ * Desc: Where the cold junction temperature comes from: the channel's volts
+ *       times slope, plus offset and correctionK, in kelvin.
+**/
+struct ThermocoupleCj
+{
+	int channel;
+	double slope;
+	double offset;
+	double correctionK;
+};
+
+/**
+ * Desc: The T7's AIN14 at position channel in the scan, with
+ *       thermocouple_example.c's 3 K correction.
+**/
+ThermocoupleCj ThermocoupleT7Cj(int channel);
+
+/**
+ * Name: ThermocoupleConverter
+ * Desc: Converts blocks of interleaved scans in place.
+ *       Thermocouple channels become kelvin, or NaN out of range. The CJ
+ *       channel becomes its kelvin, averaged over its group. Other channels
+ *       are left as they are.
+**/
+class ThermocoupleConverter
+{
+public:
+	ThermocoupleConverter();
+
+	/**
+	 * Desc: Sets the channels of a scan.
+	 * Para: types, an LJM_tt* type per channel in the scan, or 0 for a
+	 *           channel that isn't a thermocouple.
+	 *       cj, the cold junction channel. Its type must be 0.
+	 *       cjDecimation, how many scans share one CJ value.
+	 * Retr: LJME_NOERROR, LJME_INVALID_PARAMETER or
+	 *       LJME_FUNCTION_DOES_NOT_SUPPORT_THIS_TYPE.
+	**/
+	int SetChannels(const std::vector<long> & types, const ThermocoupleCj & cj,
+		int cjDecimation = THERMOCOUPLE_DEFAULT_CJ_DECIMATION);
+
+	/**
+	 * Desc: Converts numValues values, whole scans starting at the first
+	 *       channel, in place.
+	 * Retr: LJME_NOERROR, or LJME_INVALID_PARAMETER if numValues is not a
+	 *       whole number of scans.
+	**/
+	int Convert(double * aData, int numValues);
+
+	// CJ groups converted since SetChannels
+	long long NumCjGroups() const;
+
+private:
+	int numChannels;
+	ThermocoupleCj cj;
+	int cjDecimation;
+	long long numCjGroups;
+
+	// The thermocouple channels, and their types
+	std::vector<int> channels;
+	std::vector<const ThermocoupleType *> channelTypes;
+
+	// Millivolts of each thermocouple channel, channel after channel
+	std::vector<double> scratch;
+};
+
+
+// Source
+
+inline const ThermocoupleType * ThermocoupleTypeFor(long type)
+{
+	// NIST ITS-90 thermocouple database, NIST Monograph 175
+	static const ThermocoupleType TYPES[] = {
+		{LJM_ttE, 'E',
+			2, {
+				{-270, 0, 14, {0.0, 5.8665508708E-02, 4.5410977124E-05, -7.7998048686E-07,
+					-2.5800160843E-08, -5.9452583057E-10, -9.3214058667E-12,
+					-1.0287605534E-13, -8.0370123621E-16, -4.3979497391E-18,
+					-1.6414776355E-20, -3.9673619516E-23, -5.5827328721E-26,
+					-3.4657842013E-29}},
+				{0, 1000, 11, {0.0, 5.8665508710E-02, 4.5032275582E-05, 2.8908407212E-08,
+					-3.3056896652E-10, 6.5024403270E-13, -1.9197495504E-16,
+					-1.2536600497E-18, 2.1489217569E-21, -1.4388041782E-24,
+					3.5960899481E-28}}},
+			{0, 0, 0},
+			2, {
+				{-8.825, 0, 9, {0.0, 1.6977288E+01, -4.3514970E-01, -1.5859697E-01,
+					-9.2502871E-02, -2.6084314E-02, -4.1360199E-03, -3.4034030E-04,
+					-1.1564890E-05}},
+				{0, 76.373, 10, {0.0, 1.7057035E+01, -2.3301759E-01, 6.5435585E-03,
+					-7.3562749E-05, -1.7896001E-06, 8.4036165E-08, -1.3735879E-09,
+					1.0629823E-11, -3.2447087E-14}}}},
+		{LJM_ttJ, 'J',
+			2, {
+				{-210, 760, 9, {0.0, 5.0381187815E-02, 3.0475836930E-05, -8.5681065720E-08,
+					1.3228195295E-10, -1.7052958337E-13, 2.0948090697E-16,
+					-1.2538395336E-19, 1.5631725697E-23}},
+				{760, 1200, 6, {2.9645625681E+02, -1.4976127786E+00, 3.1787103924E-03,
+					-3.1847686701E-06, 1.5720819004E-09, -3.0691369056E-13}}},
+			{0, 0, 0},
+			3, {
+				{-8.095, 0, 9, {0.0, 1.9528268E+01, -1.2286185E+00, -1.0752178E+00,
+					-5.9086933E-01, -1.7256713E-01, -2.8131513E-02, -2.3963370E-03,
+					-8.3823321E-05}},
+				{0, 42.919, 8, {0.0, 1.978425E+01, -2.001204E-01, 1.036969E-02,
+					-2.549687E-04, 3.585153E-06, -5.344285E-08, 5.099890E-10}},
+				{42.919, 69.553, 6, {-3.11358187E+03, 3.00543684E+02, -9.94773230E+00,
+					1.70276630E-01, -1.43033468E-03, 4.73886084E-06}}}},
+		{LJM_ttK, 'K',
+			2, {
+				{-270, 0, 11, {0.0, 3.9450128025E-02, 2.3622373598E-05, -3.2858906784E-07,
+					-4.9904828777E-09, -6.7509059173E-11, -5.7410327428E-13,
+					-3.1088872894E-15, -1.0451609365E-17, -1.9889266878E-20,
+					-1.6322697486E-23}},
+				{0, 1372, 10, {-1.7600413686E-02, 3.8921204975E-02, 1.8558770032E-05,
+					-9.9457592874E-08, 3.1840945719E-10, -5.6072844889E-13,
+					5.6075059059E-16, -3.2020720003E-19, 9.7151147152E-23,
+					-1.2104721275E-26}}},
+			{1.185976E-01, -1.183432E-04, 1.269686E+02},
+			3, {
+				{-5.891, 0, 9, {0.0, 2.5173462E+01, -1.1662878E+00, -1.0833638E+00,
+					-8.9773540E-01, -3.7342377E-01, -8.6632643E-02, -1.0450598E-02,
+					-5.1920577E-04}},
+				{0, 20.644, 10, {0.0, 2.508355E+01, 7.860106E-02, -2.503131E-01,
+					8.315270E-02, -1.228034E-02, 9.804036E-04, -4.413030E-05,
+					1.057734E-06, -1.052755E-08}},
+				{20.644, 54.886, 7, {-1.318058E+02, 4.830222E+01, -1.646031E+00,
+					5.464731E-02, -9.650715E-04, 8.802193E-06, -3.110810E-08}}}},
+		{LJM_ttN, 'N',
+			2, {
+				{-270, 0, 9, {0.0, 2.6159105962E-02, 1.0957484228E-05, -9.3841111554E-08,
+					-4.6412039759E-11, -2.6303357716E-12, -2.2653438003E-14,
+					-7.6089300791E-17, -9.3419667835E-20}},
+				{0, 1300, 11, {0.0, 2.5929394601E-02, 1.5710141880E-05, 4.3825627237E-08,
+					-2.5261169794E-10, 6.4311819339E-13, -1.0063471519E-15,
+					9.9745338992E-19, -6.0863245607E-22, 2.0849229339E-25,
+					-3.0682196151E-29}}},
+			{0, 0, 0},
+			3, {
+				{-3.990, 0, 10, {0.0, 3.8436847E+01, 1.1010485E+00, 5.2229312E+00,
+					7.2060525E+00, 5.8488586E+00, 2.7754916E+00, 7.7075166E-01,
+					1.1582665E-01, 7.3138868E-03}},
+				{0, 20.613, 8, {0.0, 3.86896E+01, -1.08267E+00, 4.70205E-02,
+					-2.12169E-06, -1.17272E-04, 5.39280E-06, -7.98156E-08}},
+				{20.613, 47.513, 6, {1.972485E+01, 3.300943E+01, -3.915159E-01,
+					9.855391E-03, -1.274371E-04, 7.767022E-07}}}},
+		{LJM_ttT, 'T',
+			2, {
+				{-270, 0, 15, {0.0, 3.8748106364E-02, 4.4194434347E-05, 1.1844323105E-07,
+					2.0032973554E-08, 9.0138019559E-10, 2.2651156593E-11,
+					3.6071154205E-13, 3.8493939883E-15, 2.8213521925E-17,
+					1.4251594779E-19, 4.8768662286E-22, 1.0795539270E-24,
+					1.3945027062E-27, 7.9795153927E-31}},
+				{0, 400, 9, {0.0, 3.8748106364E-02, 3.3292227880E-05, 2.0618243404E-07,
+					-2.1882256846E-09, 1.0996880928E-11, -3.0815758772E-14,
+					4.5479135290E-17, -2.7512901673E-20}}},
+			{0, 0, 0},
+			2, {
+				{-5.603, 0, 8, {0.0, 2.5949192E+01, -2.1316967E-01, 7.9018692E-01,
+					4.2527777E-01, 1.3304473E-01, 2.0241446E-02, 1.2668171E-03}},
+				{0, 20.872, 7, {0.0, 2.592800E+01, -7.602961E-01, 4.637791E-02,
+					-2.165394E-03, 6.048144E-05, -7.293422E-07}}}}
+	};
+
+	for (size_t i = 0; i < sizeof(TYPES) / sizeof(TYPES[0]); i++) {
+		if (TYPES[i].type == type) {
+			return &TYPES[i];
+		}
+	}
+	return NULL;
+}
+
+// Horner's rule for one value
+inline double ThermocoupleHorner(const ThermocouplePolynomial & polynomial, double x)
+{
+	const double * c = polynomial.coefficients;
+	double y = c[polynomial.numCoefficients - 1];
+	for (int k = polynomial.numCoefficients - 2; k >= 0; k--) {
+		y = y * x + c[k];
+	}
+	return y;
+}
+
+// Returns the index of the polynomial whose range holds x, or -1
+inline int ThermocoupleRange(const ThermocouplePolynomial * aPolynomials, int numPolynomials,
+	double x)
+{
+	for (int i = 0; i < numPolynomials; i++) {
+		if (x >= aPolynomials[i].minimum && x <= aPolynomials[i].maximum) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+inline double ThermocoupleMillivolts(const ThermocoupleType & type, double celsius)
+{
+	int range = ThermocoupleRange(type.forward, type.numForward, celsius);
+	if (range < 0) {
+		return NAN;
+	}
+	double millivolts = ThermocoupleHorner(type.forward[range], celsius);
+	if (type.exponential[0] != 0 && celsius > 0) {
+		double offset = celsius - type.exponential[2];
+		millivolts += type.exponential[0] * exp(type.exponential[1] * offset * offset);
+	}
+	return millivolts;
+}
+
+inline double ThermocoupleCelsius(const ThermocoupleType & type, double millivolts)
+{
+	int range = ThermocoupleRange(type.inverse, type.numInverse, millivolts);
+	if (range < 0) {
+		return NAN;
+	}
+	return ThermocoupleHorner(type.inverse[range], millivolts);
+}
+
+// Evaluates one polynomial over count values in place with SIMD
+static inline void ThermocoupleHornerKernel(double * aValues, int count,
+	const ThermocouplePolynomial & polynomial)
+{
+	const double * c = polynomial.coefficients;
+	int last = polynomial.numCoefficients - 1;
+	int i = 0;
+
+#if defined(SENSOR_SIMD_AVX)
+	for (; i + 4 <= count; i += 4) {
+		__m256d x = _mm256_loadu_pd(aValues + i);
+		__m256d y = _mm256_set1_pd(c[last]);
+		for (int k = last - 1; k >= 0; k--) {
+			y = _mm256_add_pd(_mm256_mul_pd(y, x), _mm256_set1_pd(c[k]));
+		}
+		_mm256_storeu_pd(aValues + i, y);
+	}
+#elif defined(SENSOR_SIMD_SSE2)
+	for (; i + 2 <= count; i += 2) {
+		__m128d x = _mm_loadu_pd(aValues + i);
+		__m128d y = _mm_set1_pd(c[last]);
+		for (int k = last - 1; k >= 0; k--) {
+			y = _mm_add_pd(_mm_mul_pd(y, x), _mm_set1_pd(c[k]));
+		}
+		_mm_storeu_pd(aValues + i, y);
+	}
+#elif defined(SENSOR_SIMD_NEON)
+	for (; i + 2 <= count; i += 2) {
+		float64x2_t x = vld1q_f64(aValues + i);
+		float64x2_t y = vdupq_n_f64(c[last]);
+		for (int k = last - 1; k >= 0; k--) {
+			y = vaddq_f64(vmulq_f64(y, x), vdupq_n_f64(c[k]));
+		}
+		vst1q_f64(aValues + i, y);
+	}
+#endif
+
+	for (; i < count; i++) {
+		aValues[i] = ThermocoupleHorner(polynomial, aValues[i]);
+	}
+}
+
+inline void ThermocoupleCelsiusBlock(const ThermocoupleType & type, double * aValues,
+	int numValues)
+{
+	// A channel's readings stay in one range for long runs, so each run
+	// gets the kernel with its range's coefficients
+	int i = 0;
+	while (i < numValues) {
+		int range = ThermocoupleRange(type.inverse, type.numInverse, aValues[i]);
+		if (range < 0) {
+			aValues[i++] = NAN;
+			continue;
+		}
+		const ThermocouplePolynomial & polynomial = type.inverse[range];
+		int end = i + 1;
+		while (end < numValues && aValues[end] >= polynomial.minimum &&
+			aValues[end] <= polynomial.maximum)
+		{
+			end++;
+		}
+		ThermocoupleHornerKernel(aValues + i, end - i, polynomial);
+		i = end;
+	}
+}
+
+inline int ThermocoupleVoltsToKelvin(long type, double volts, double cjKelvin, double * kelvin)
+{
+	const ThermocoupleType * reference = ThermocoupleTypeFor(type);
+	if (!reference) {
+		return LJME_FUNCTION_DOES_NOT_SUPPORT_THIS_TYPE;
+	}
+	double cjMillivolts = ThermocoupleMillivolts(*reference, cjKelvin - 273.15);
+	if (isnan(cjMillivolts)) {
+		return LJME_TEMPERATURE_OUT_OF_RANGE;
+	}
+	double celsius = ThermocoupleCelsius(*reference, volts * 1000 + cjMillivolts);
+	if (isnan(celsius)) {
+		return LJME_VOLTAGE_OUT_OF_RANGE;
+	}
+	*kelvin = celsius + 273.15;
+	return LJME_NOERROR;
+}
+
+inline ThermocoupleCj ThermocoupleT7Cj(int channel)
+{
+	ThermocoupleCj cj = {channel, THERMOCOUPLE_T7_AIN14_SLOPE, THERMOCOUPLE_T7_AIN14_OFFSET, 3.0};
+	return cj;
+}
+
+inline ThermocoupleConverter::ThermocoupleConverter() :
+	numChannels(0), cjDecimation(THERMOCOUPLE_DEFAULT_CJ_DECIMATION), numCjGroups(0)
+{
+	cj = ThermocoupleT7Cj(0);
+}
+
+inline int ThermocoupleConverter::SetChannels(const std::vector<long> & types,
+	const ThermocoupleCj & cj, int cjDecimation)
+{
+	if (types.empty() || cj.channel < 0 || cj.channel >= (int)types.size() ||
+		types[cj.channel] != 0 || cjDecimation < 1)
+	{
+		return LJME_INVALID_PARAMETER;
+	}
+
+	std::vector<int> newChannels;
+	std::vector<const ThermocoupleType *> newTypes;
+	for (size_t i = 0; i < types.size(); i++) {
+		if (types[i] == 0) {
+			continue;
+		}
+		const ThermocoupleType * reference = ThermocoupleTypeFor(types[i]);
+		if (!reference) {
+			return LJME_FUNCTION_DOES_NOT_SUPPORT_THIS_TYPE;
+		}
+		newChannels.push_back((int)i);
+		newTypes.push_back(reference);
+	}
+
+	this->numChannels = (int)types.size();
+	this->cj = cj;
+	this->cjDecimation = cjDecimation;
+	this->numCjGroups = 0;
+	channels.swap(newChannels);
+	channelTypes.swap(newTypes);
+	return LJME_NOERROR;
+}
+
+inline int ThermocoupleConverter::Convert(double * aData, int numValues)
+{
+	if (numChannels == 0 || numValues < 0 || numValues % numChannels != 0) {
+		return LJME_INVALID_PARAMETER;
+	}
+
+	int numScans = numValues / numChannels;
+	int numThermocouples = (int)channels.size();
+	if (numScans == 0) {
+		return LJME_NOERROR;
+	}
+	scratch.resize((size_t)numScans * numThermocouples);
+
+	// CJ millivolts per thermocouple channel, recomputed once per group
+	std::vector<double> cjMillivolts(numThermocouples);
+
+	for (int first = 0; first < numScans; first += cjDecimation) {
+		int end = first + cjDecimation < numScans ? first + cjDecimation : numScans;
+
+		double cjVolts = 0;
+		for (int scan = first; scan < end; scan++) {
+			cjVolts += aData[scan * numChannels + cj.channel];
+		}
+		double cjKelvin = cjVolts / (end - first) * cj.slope + cj.offset + cj.correctionK;
+		for (int scan = first; scan < end; scan++) {
+			aData[scan * numChannels + cj.channel] = cjKelvin;
+		}
+
+		for (int t = 0; t < numThermocouples; t++) {
+			if (t > 0 && channelTypes[t] == channelTypes[t - 1]) {
+				cjMillivolts[t] = cjMillivolts[t - 1];
+			}
+			else {
+				cjMillivolts[t] = ThermocoupleMillivolts(*channelTypes[t], cjKelvin - 273.15);
+			}
+			// An out of range CJ makes the group NaN
+			double * values = &scratch[(size_t)t * numScans];
+			for (int scan = first; scan < end; scan++) {
+				values[scan] = aData[scan * numChannels + channels[t]] * 1000 +
+					cjMillivolts[t];
+			}
+		}
+		numCjGroups++;
+	}
+
+	for (int t = 0; t < numThermocouples; t++) {
+		double * values = &scratch[(size_t)t * numScans];
+		ThermocoupleCelsiusBlock(*channelTypes[t], values, numScans);
+		for (int scan = 0; scan < numScans; scan++) {
+			aData[scan * numChannels + channels[t]] = values[scan] + 273.15;
+		}
+	}
+	return LJME_NOERROR;
+}
+
+inline long long ThermocoupleConverter::NumCjGroups() const
+{
+	return numCjGroups;
+}
+
+#endif // #ifndef LJM_THERMOCOUPLE
@@ -0,0 +1,150 @@
+/**
+ * Name: comfort_benchmark.cpp
+ * Desc: Checks LJM_ThermalComfort.h against the PMV and PPD reference values
+ *       of ISO 7730 Annex D, then computes PMV and PPD for a grid of
+ *       simulated comfortbot cells one cell at a time and with ComfortBlock,
+ *       and prints the cells per second of each and the largest difference
+ *       between them. Needs no device.
+ * Usage: comfort_benchmark [cells]
+ *        cells defaults to 1000000.
+**/
+
+// For printf
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+#include "LJM_ThermalComfort.h"
+
+/**
+ * Desc: One row of ISO 7730:2005 Table D.1. The table is rounded to 0.01
+ *       PMV and 1 PPD, and its rows are matched to within one unit of each.
+ *       The row 23.5, 23.5, 0.10, 40, 1.2, 1.0 is left out: the table gives
+ *       0.50 for it, but the standard's own equations give 0.36, in line
+ *       with the rows either side of it.
+**/
+struct ComfortReference
+{
+	double airC;
+	double radiantC;
+	double airSpeed;
+	double humidity;
+	double met;
+	double clo;
+	double pmv;
+	double ppd;
+};
+
+const ComfortReference REFERENCES[] = {
+	{22.0, 22.0, 0.10, 60, 1.2, 0.5, -0.75, 17},
+	{27.0, 27.0, 0.10, 60, 1.2, 0.5, 0.77, 17},
+	{27.0, 27.0, 0.30, 60, 1.2, 0.5, 0.44, 9},
+	{23.5, 25.5, 0.10, 60, 1.2, 0.5, -0.01, 5},
+	{23.5, 25.5, 0.30, 60, 1.2, 0.5, -0.55, 11},
+	{19.0, 19.0, 0.10, 40, 1.2, 1.0, -0.60, 13},
+	{23.5, 23.5, 0.30, 40, 1.2, 1.0, 0.12, 5},
+	{23.0, 21.0, 0.10, 40, 1.2, 1.0, 0.05, 5},
+	{23.0, 21.0, 0.30, 40, 1.2, 1.0, -0.16, 6},
+	{22.0, 22.0, 0.10, 60, 1.6, 0.5, 0.05, 5},
+	{27.0, 27.0, 0.10, 60, 1.6, 0.5, 1.17, 34},
+	{27.0, 27.0, 0.30, 60, 1.6, 0.5, 0.95, 24}
+};
+const int NUM_REFERENCES = sizeof(REFERENCES) / sizeof(REFERENCES[0]);
+
+/**
+ * Desc: Prints each reference row with the computed PMV and PPD. Returns
+ *       the number of rows that don't match.
+**/
+int CheckReferences();
+
+int main(int argc, char * argv[])
+{
+	int numCells = argc > 1 ? atoi(argv[1]) : 1000000;
+	std::vector<double> airC(numCells), radiantC(numCells), airSpeed(numCells);
+	std::vector<double> humidity(numCells);
+	std::vector<double> cellPmv(numCells), cellPpd(numCells);
+	std::vector<double> blockPmv(numCells), blockPpd(numCells);
+	ComfortActivity activity = ComfortTradeFairActivity();
+
+	int failures = CheckReferences();
+
+	// Indoor conditions a comfortbot could meet
+	srand(7);
+	for (int i = 0; i < numCells; i++) {
+		airC[i] = 16 + 14 * rand() / (double)RAND_MAX;
+		radiantC[i] = airC[i] - 3 + 6 * rand() / (double)RAND_MAX;
+		airSpeed[i] = 0.02 + 1.0 * rand() / (double)RAND_MAX;
+		humidity[i] = 20 + 60 * rand() / (double)RAND_MAX;
+	}
+
+	double cellRate = 0, blockRate = 0;
+	for (int r = 0; r < 3; r++) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < numCells; i++) {
+			ComfortPmvPpd(airC[i], radiantC[i], airSpeed[i], humidity[i], activity,
+				&cellPmv[i], &cellPpd[i]);
+		}
+		double seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		cellRate = numCells / seconds > cellRate ? numCells / seconds : cellRate;
+
+		start = std::chrono::steady_clock::now();
+		ComfortBlock(numCells, &airC[0], &radiantC[0], &airSpeed[0], &humidity[0], activity,
+			&blockPmv[0], &blockPpd[0]);
+		seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		blockRate = numCells / seconds > blockRate ? numCells / seconds : blockRate;
+	}
+
+	double maxDifference = 0;
+	int numNan = 0;
+	for (int i = 0; i < numCells; i++) {
+		if (isnan(cellPmv[i]) || isnan(blockPmv[i])) {
+			numNan += isnan(cellPmv[i]) != isnan(blockPmv[i]);
+			continue;
+		}
+		double difference = fabs(blockPmv[i] - cellPmv[i]);
+		maxDifference = difference > maxDifference ? difference : maxDifference;
+		difference = fabs(blockPpd[i] - cellPpd[i]);
+		maxDifference = difference > maxDifference ? difference : maxDifference;
+	}
+
+	printf("\n%d cells, met %.1f, clo %.1f\n\n", numCells, activity.met, activity.clo);
+	printf("%-28s %14.0f cells/s\n", "ComfortPmvPpd per cell", cellRate);
+	printf("%-28s %14.0f cells/s  (%.1fx)\n", "ComfortBlock", blockRate,
+		blockRate / cellRate);
+	printf("Kernel: %s\n", SensorSimdName());
+	printf("Largest difference: %.3g, NaN mismatches: %d\n", maxDifference, numNan);
+
+	return failures == 0 ? LJME_NOERROR : LJME_INVALID_VALUE;
+}
+
+int CheckReferences()
+{
+	int failures = 0;
+
+	printf("ISO 7730 Table D.1\n");
+	printf("%6s %6s %5s %4s %4s %4s  %6s %6s  %4s %6s\n", "ta", "tr", "v", "rh", "met",
+		"clo", "PMV", "ISO", "PPD", "ISO");
+	for (int i = 0; i < NUM_REFERENCES; i++) {
+		const ComfortReference & row = REFERENCES[i];
+		ComfortActivity activity = {row.met, row.clo, 0};
+		double pmv, ppd;
+		int err = ComfortPmvPpd(row.airC, row.radiantC, row.airSpeed, row.humidity, activity,
+			&pmv, &ppd);
+		bool matches = err == LJME_NOERROR && fabs(pmv - row.pmv) <= 0.01 + 1e-9 &&
+			fabs(ppd - row.ppd) <= 1;
+		failures += !matches;
+		printf("%6.1f %6.1f %5.2f %4.0f %4.1f %4.1f  %6.2f %6.2f  %4.0f %6.0f%s\n",
+			row.airC, row.radiantC, row.airSpeed, row.humidity, row.met, row.clo, pmv, row.pmv,
+			ppd, row.ppd, matches ? "" : "  MISMATCH");
+	}
+	printf("%d of %d rows match\n", NUM_REFERENCES - failures, NUM_REFERENCES);
+	return failures;
+}
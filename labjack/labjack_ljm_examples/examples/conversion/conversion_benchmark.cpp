@@ -0,0 +1,128 @@
+/**
+ * Name: conversion_benchmark.cpp
+ * Desc: Converts a block of comfortbot stream data with the formulas as
+ *       trade_fair.py writes them, one sample at a time, and with a
+ *       SensorBlockConverter, then prints the samples per second of each and
+ *       the largest difference between them. Needs no device.
+ * Usage: conversion_benchmark [scans]
+ *        scans defaults to 1000000.
+**/
+
+// For printf
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_SensorConversion.h"
+
+// trade_fair.py's channel order: radiant, humidity, ambient, wind1, wind2
+const int NUM_CHANNELS = 5;
+
+/**
+ * Desc: Converts one scan in place with trade_fair.py's expressions.
+**/
+void ConvertScanLikeTradeFair(double * scan);
+
+/**
+ * Desc: Runs convert over a fresh copy of volts repeat times and returns the
+ *       best samples per second. converted is left with the result.
+**/
+template <typename Convert>
+double SamplesPerSecond(const std::vector<double> & volts, std::vector<double> & converted,
+	int repeat, Convert convert);
+
+int main(int argc, char * argv[])
+{
+	int err;
+	int numScans = argc > 1 ? atoi(argv[1]) : 1000000;
+	int numValues = numScans * NUM_CHANNELS;
+	std::vector<double> volts(numValues);
+	std::vector<double> perSample, block;
+	SensorBlockConverter converter;
+	std::vector<SensorDescriptor> sensors;
+
+	// Volts in the range the sensors put out
+	srand(7);
+	for (int i = 0; i < numValues; i++) {
+		volts[i] = 0.2 + 4.5 * rand() / (double)RAND_MAX;
+	}
+
+	sensors.push_back(ComfortbotRadiantSensor());
+	sensors.push_back(ComfortbotHumiditySensor());
+	sensors.push_back(ComfortbotAmbientSensor());
+	sensors.push_back(ComfortbotAnemometerSensor());
+	sensors.push_back(ComfortbotAnemometerSensor());
+	err = converter.SetChannels(sensors);
+	ErrorCheck(err, "SensorBlockConverter::SetChannels");
+
+	double perSampleRate = SamplesPerSecond(volts, perSample, 5,
+		[](double * aData, int n) {
+			for (int i = 0; i + NUM_CHANNELS <= n; i += NUM_CHANNELS) {
+				ConvertScanLikeTradeFair(aData + i);
+			}
+		});
+	double blockRate = SamplesPerSecond(volts, block, 5,
+		[&converter](double * aData, int n) { converter.Convert(aData, n); });
+
+	double maxDifference = 0;
+	for (int i = 0; i < numValues; i++) {
+		double difference = fabs(block[i] - perSample[i]) /
+			(fabs(perSample[i]) > 1 ? fabs(perSample[i]) : 1);
+		maxDifference = difference > maxDifference ? difference : maxDifference;
+	}
+
+	printf("%d scans of %d channels\n\n", numScans, NUM_CHANNELS);
+	printf("%-28s %14.0f samples/s\n", "Per sample, scalar", perSampleRate);
+	printf("%-28s %14.0f samples/s  (%.1fx)\n", "SensorBlockConverter",
+		blockRate, blockRate / perSampleRate);
+	printf("Kernel: %s\n", SensorSimdName());
+	printf("Largest relative difference: %.3g\n", maxDifference);
+
+	return LJME_NOERROR;
+}
+
+void ConvertScanLikeTradeFair(double * scan)
+{
+	const double R1 = 3000;
+	const double Vs = 4.915;
+	const double STD_TEMP = 25;
+	const double mps_conversion = 5.08;
+	const double output_range = 5;
+
+	double resistance = (100 * scan[0]) / (4.915 - scan[0]);
+	scan[0] = 100 * (resistance - 100) / 38.51;
+
+	scan[1] = (100 * scan[1]) / 4.915;
+
+	double Ro = (R1 * scan[2]) / (Vs - scan[2]);
+	scan[2] = R1 / Ro * STD_TEMP;
+
+	scan[3] = (mps_conversion * scan[3]) / output_range;
+	scan[4] = (mps_conversion * scan[4]) / output_range;
+}
+
+template <typename Convert>
+double SamplesPerSecond(const std::vector<double> & volts, std::vector<double> & converted,
+	int repeat, Convert convert)
+{
+	double best = 0;
+	for (int r = 0; r < repeat; r++) {
+		converted = volts;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		convert(&converted[0], (int)converted.size());
+		double seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		double rate = converted.size() / seconds;
+		best = rate > best ? rate : best;
+	}
+	return best;
+}
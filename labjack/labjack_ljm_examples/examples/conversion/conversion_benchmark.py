@@ -0,0 +1,98 @@
+"""
+Compares converting comfortbot stream data with the per-sample Python math of
+trade_fair.py against ljm_conversion.BlockConverter, and prints samples per
+second and the largest difference. Needs no device, only the LJMConversion
+library next to this file.
+
+Usage:
+    python conversion_benchmark.py [scans]
+
+scans defaults to 200000. The block is a numpy array when numpy is installed,
+and an array.array("d") otherwise.
+
+"""
+
+import array
+import random
+import sys
+import time
+
+import ljm_conversion
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+NUM_CHANNELS = 5
+
+
+def convert_like_trade_fair(data):
+    """take_measurements' conversions, one sample at a time. data holds
+    scans of radiant, humidity, ambient, wind1 and wind2 volts."""
+    R1 = 3000
+    Vs = 4.915
+    STD_TEMP = 25
+    mps_conversion = 5.08
+    output_range = 5
+
+    for i in range(0, len(data) - NUM_CHANNELS + 1, NUM_CHANNELS):
+        result0 = data[i]
+        resistance = float((100*result0)/(4.915 - result0))
+        data[i] = 100*(resistance - 100) / 38.51
+
+        data[i + 1] = (100*data[i + 1])/4.915
+
+        result2 = data[i + 2]
+        Ro = float((R1*result2)/(Vs - result2))
+        data[i + 2] = R1 / Ro * STD_TEMP
+
+        data[i + 3] = (mps_conversion*data[i + 3])/output_range
+        data[i + 4] = (mps_conversion*data[i + 4])/output_range
+
+
+def best_rate(volts, make_block, convert, repeat):
+    """Returns the best samples per second of convert over fresh blocks, and
+    the last converted block."""
+    best = 0
+    block = None
+    for _ in range(repeat):
+        block = make_block(volts)
+        start = time.perf_counter()
+        convert(block)
+        seconds = time.perf_counter() - start
+        best = max(best, len(volts) / seconds)
+    return best, block
+
+
+def main():
+    num_scans = int(sys.argv[1]) if len(sys.argv) > 1 else 200000
+    random.seed(7)
+    volts = [0.2 + 4.5*random.random() for _ in range(num_scans*NUM_CHANNELS)]
+
+    if numpy is not None:
+        make_block = lambda values: numpy.array(values, dtype=numpy.float64)
+        block_kind = "numpy array"
+    else:
+        make_block = lambda values: array.array("d", values)
+        block_kind = "array.array"
+
+    converter = ljm_conversion.BlockConverter(ljm_conversion.comfortbot_sensors())
+
+    python_rate, expected = best_rate(volts, list, convert_like_trade_fair, 3)
+    block_rate, converted = best_rate(volts, make_block, converter.convert, 5)
+
+    largest = 0.0
+    for want, got in zip(expected, converted):
+        largest = max(largest, abs(got - want) / max(abs(want), 1.0))
+
+    print("%d scans of %d channels, %s\n" % (num_scans, NUM_CHANNELS, block_kind))
+    print("%-28s %14.0f samples/s" % ("Per sample, Python", python_rate))
+    print("%-28s %14.0f samples/s  (%.0fx)" % ("BlockConverter", block_rate,
+                                               block_rate / python_rate))
+    print("Kernel: %s" % ljm_conversion.simd_name())
+    print("Largest relative difference: %.3g" % largest)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,142 @@
+/**
+ * Name: ljm_conversion.cpp
+ * Desc: A C interface to LJM_SensorConversion.h, the comfortbot tables of
+ *       LJM_SensorTables.h and LJM_ThermalComfort.h, built as the
+ *       LJMConversion shared library so ljm_conversion.py can call the
+ *       kernels through ctypes. Functions return LJM error codes like the
+ *       LJM library does.
+**/
+
+#include "LJM_SensorConversion.h"
+#include "LJM_SensorTables.h"
+#include "LJM_ThermalComfort.h"
+
+#if defined(_WIN32)
+	#define LJM_CONVERSION_EXPORT extern "C" __declspec(dllexport)
+#else
+	#define LJM_CONVERSION_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+// Parameters per channel in LJMConversion_Create's aParameters, in
+// SensorDescriptor order: scale, offset, seriesOhms, supplyVolts, r0Ohms,
+// alpha, referenceC
+enum { LJM_CONVERSION_NUM_PARAMETERS = 7 };
+
+// The tables LJMConversion_ConvertTable takes
+enum {
+	LJM_CONVERSION_TABLE_AMBIENT = 0,
+	LJM_CONVERSION_TABLE_RADIANT = 1
+};
+
+/**
+ * Desc: Creates a SensorBlockConverter.
+ * Para: aTypes, a SensorType per channel.
+ *       aParameters, LJM_CONVERSION_NUM_PARAMETERS values per channel.
+ *       converter, set to the new converter. Free it with
+ *           LJMConversion_Destroy.
+ * Retr: LJME_NOERROR or LJME_INVALID_PARAMETER.
+**/
+LJM_CONVERSION_EXPORT int LJMConversion_Create(int numChannels, const int * aTypes,
+	const double * aParameters, void ** converter)
+{
+	if (numChannels < 1 || !aTypes || !aParameters || !converter) {
+		return LJME_INVALID_PARAMETER;
+	}
+
+	std::vector<SensorDescriptor> sensors(numChannels);
+	for (int i = 0; i < numChannels; i++) {
+		const double * parameters = aParameters + i * LJM_CONVERSION_NUM_PARAMETERS;
+		sensors[i].type = (SensorType)aTypes[i];
+		sensors[i].scale = parameters[0];
+		sensors[i].offset = parameters[1];
+		sensors[i].seriesOhms = parameters[2];
+		sensors[i].supplyVolts = parameters[3];
+		sensors[i].r0Ohms = parameters[4];
+		sensors[i].alpha = parameters[5];
+		sensors[i].referenceC = parameters[6];
+	}
+
+	SensorBlockConverter * blockConverter = new SensorBlockConverter();
+	int err = blockConverter->SetChannels(sensors);
+	if (err != LJME_NOERROR) {
+		delete blockConverter;
+		return err;
+	}
+
+	*converter = blockConverter;
+	return LJME_NOERROR;
+}
+
+/**
+ * Desc: Converts numValues interleaved values in place, like
+ *       SensorBlockConverter::Convert.
+**/
+LJM_CONVERSION_EXPORT int LJMConversion_Convert(void * converter, double * aData,
+	int numValues)
+{
+	if (!converter || (!aData && numValues > 0) || numValues < 0) {
+		return LJME_INVALID_PARAMETER;
+	}
+	((SensorBlockConverter *)converter)->Convert(aData, numValues);
+	return LJME_NOERROR;
+}
+
+/**
+ * Desc: Converts numValues values in place with a comfortbot table, like
+ *       SensorTable::ConvertBlock.
+ * Para: table, LJM_CONVERSION_TABLE_AMBIENT or LJM_CONVERSION_TABLE_RADIANT.
+ *       stride, the distance between values.
+ * Retr: LJME_NOERROR or LJME_INVALID_PARAMETER.
+**/
+LJM_CONVERSION_EXPORT int LJMConversion_ConvertTable(int table, double * aData,
+	int numValues, int stride)
+{
+	if ((!aData && numValues > 0) || numValues < 0 || stride < 1) {
+		return LJME_INVALID_PARAMETER;
+	}
+	switch (table) {
+	case LJM_CONVERSION_TABLE_AMBIENT:
+		ComfortbotAmbientTable().ConvertBlock(aData, numValues, stride);
+		return LJME_NOERROR;
+	case LJM_CONVERSION_TABLE_RADIANT:
+		ComfortbotRadiantTable().ConvertBlock(aData, numValues, stride);
+		return LJME_NOERROR;
+	default:
+		return LJME_INVALID_PARAMETER;
+	}
+}
+
+/**
+ * Desc: ISO 7730 PMV and PPD for numCells cells, like ComfortBlock.
+ * Para: aAirC, aRadiantC, aAirSpeed and aHumidity, a value per cell.
+ *       met and clo, the occupants' activity and clothing.
+ *       aPmv and aPpd, set to a value per cell, NaN for invalid cells.
+ * Retr: LJME_NOERROR or LJME_INVALID_PARAMETER.
+**/
+LJM_CONVERSION_EXPORT int LJMConversion_ThermalComfort(int numCells, const double * aAirC,
+	const double * aRadiantC, const double * aAirSpeed, const double * aHumidity, double met,
+	double clo, double * aPmv, double * aPpd)
+{
+	if (numCells < 0 || !(met > 0) || !(clo >= 0)) {
+		return LJME_INVALID_PARAMETER;
+	}
+	if (numCells > 0 && (!aAirC || !aRadiantC || !aAirSpeed || !aHumidity || !aPmv || !aPpd)) {
+		return LJME_INVALID_PARAMETER;
+	}
+	ComfortActivity activity = {met, clo, 0};
+	ComfortBlock(numCells, aAirC, aRadiantC, aAirSpeed, aHumidity, activity, aPmv, aPpd);
+	return LJME_NOERROR;
+}
+
+LJM_CONVERSION_EXPORT void LJMConversion_Destroy(void * converter)
+{
+	delete (SensorBlockConverter *)converter;
+}
+
+/**
+ * Desc: Returns SensorSimdName().
+**/
+LJM_CONVERSION_EXPORT const char * LJMConversion_SimdName()
+{
+	return SensorSimdName();
+}
@@ -0,0 +1,288 @@
+"""
+Python bindings for the LJMConversion library built from ljm_conversion.cpp.
+
+BlockConverter converts a block of interleaved stream data in place with the
+SIMD kernels of LJM_SensorConversion.h. The block can be a numpy float64
+array or an array.array("d"); either way the library works on the caller's
+memory through the buffer protocol, and nothing is copied. numpy is not
+required.
+
+    from ljm_conversion import BlockConverter, comfortbot_sensors
+    converter = BlockConverter(comfortbot_sensors())
+    ret = ljm.eStreamRead(handle)
+    data = numpy.array(ret[0])
+    converter.convert(data)
+
+thermal_comfort computes ISO 7730 PMV and PPD from comfortbot's readings:
+
+    pmv, ppd = thermal_comfort(amb_avg, rad_avg, velocity_avg, humid_avg)
+
+"""
+
+import array
+import ctypes
+import numbers
+import os
+import sys
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+# SensorType in LJM_SensorConversion.h
+SENSOR_VOLTS = 0
+SENSOR_LINEAR = 1
+SENSOR_RTD_DIVIDER = 2
+SENSOR_THERMISTOR_DIVIDER = 3
+
+# The tables of LJMConversion_ConvertTable: the ambient thermistor and the
+# radiant Pt100 with their exact curves, from LJM_SensorTables.h
+TABLE_AMBIENT = 0
+TABLE_RADIANT = 1
+
+# LJME_INVALID_PARAMETER, returned for bad descriptors and blocks
+INVALID_PARAMETER = 1255
+
+
+class ConversionError(Exception):
+    """Raised when the library returns an error code."""
+    def __init__(self, error_code, message):
+        Exception.__init__(self, "%s (error %d)" % (message, error_code))
+        self.error_code = error_code
+
+
+class SensorDescriptor(object):
+    """The sensor on one channel. Mirrors SensorDescriptor in
+    LJM_SensorConversion.h; use the functions below to make one."""
+    def __init__(self, sensor_type, scale=1.0, offset=0.0, series_ohms=0.0,
+                 supply_volts=0.0, r0_ohms=0.0, alpha=0.0, reference_c=0.0):
+        self.sensor_type = sensor_type
+        self.scale = scale
+        self.offset = offset
+        self.series_ohms = series_ohms
+        self.supply_volts = supply_volts
+        self.r0_ohms = r0_ohms
+        self.alpha = alpha
+        self.reference_c = reference_c
+
+    def parameters(self):
+        """The values LJMConversion_Create takes per channel."""
+        return [self.scale, self.offset, self.series_ohms, self.supply_volts,
+                self.r0_ohms, self.alpha, self.reference_c]
+
+
+def volts_sensor():
+    return SensorDescriptor(SENSOR_VOLTS)
+
+
+def linear_sensor(scale, offset=0.0):
+    return SensorDescriptor(SENSOR_LINEAR, scale=scale, offset=offset)
+
+
+def rtd_divider_sensor(series_ohms, supply_volts, r0_ohms, alpha):
+    return SensorDescriptor(SENSOR_RTD_DIVIDER, series_ohms=series_ohms,
+                            supply_volts=supply_volts, r0_ohms=r0_ohms,
+                            alpha=alpha)
+
+
+def thermistor_divider_sensor(series_ohms, supply_volts, reference_c):
+    return SensorDescriptor(SENSOR_THERMISTOR_DIVIDER, series_ohms=series_ohms,
+                            supply_volts=supply_volts, reference_c=reference_c)
+
+
+def comfortbot_sensors():
+    """trade_fair.py's channels, in its order: radiant temperature (AIN12),
+    humidity (AIN1), ambient temperature (AIN13), and the two anemometers
+    (AIN2, AIN3)."""
+    anemometer = linear_sensor(5.08 / 5)
+    return [rtd_divider_sensor(100, 4.915, 100, 0.003851),
+            linear_sensor(100 / 4.915),
+            thermistor_divider_sensor(3000, 4.915, 25),
+            anemometer,
+            anemometer]
+
+
+def _load_library():
+    """Loads LJMConversion from next to this file, or from the library
+    path."""
+    if sys.platform.startswith("win32") or sys.platform.startswith("cygwin"):
+        name = "LJMConversion.dll"
+    elif sys.platform.startswith("darwin"):
+        name = "libLJMConversion.dylib"
+    else:
+        name = "libLJMConversion.so"
+    local = os.path.join(os.path.dirname(os.path.abspath(__file__)), name)
+    library = ctypes.CDLL(local if os.path.exists(local) else name)
+
+    library.LJMConversion_Create.argtypes = [
+        ctypes.c_int, ctypes.POINTER(ctypes.c_int),
+        ctypes.POINTER(ctypes.c_double), ctypes.POINTER(ctypes.c_void_p)]
+    library.LJMConversion_Create.restype = ctypes.c_int
+    library.LJMConversion_Convert.argtypes = [
+        ctypes.c_void_p, ctypes.c_void_p, ctypes.c_int]
+    library.LJMConversion_Convert.restype = ctypes.c_int
+    library.LJMConversion_ConvertTable.argtypes = [
+        ctypes.c_int, ctypes.c_void_p, ctypes.c_int, ctypes.c_int]
+    library.LJMConversion_ConvertTable.restype = ctypes.c_int
+    library.LJMConversion_ThermalComfort.argtypes = [
+        ctypes.c_int, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p,
+        ctypes.c_void_p, ctypes.c_double, ctypes.c_double, ctypes.c_void_p,
+        ctypes.c_void_p]
+    library.LJMConversion_ThermalComfort.restype = ctypes.c_int
+    library.LJMConversion_Destroy.argtypes = [ctypes.c_void_p]
+    library.LJMConversion_Destroy.restype = None
+    library.LJMConversion_SimdName.argtypes = []
+    library.LJMConversion_SimdName.restype = ctypes.c_char_p
+    return library
+
+
+_library = _load_library()
+
+
+def simd_name():
+    """The kernel the library was built with: AVX, SSE2, NEON or scalar."""
+    return _library.LJMConversion_SimdName().decode("ascii")
+
+
+def buffer_address(block, writable=True):
+    """Returns the address and length of block's float64 values without
+    copying them. block must be a C-contiguous buffer of float64, such as a
+    numpy float64 array or an array.array("d"). Other buffer types need
+    Python 3."""
+    if numpy is not None and isinstance(block, numpy.ndarray):
+        if block.dtype != numpy.float64:
+            raise TypeError("expected a buffer of float64, got dtype %s" % block.dtype)
+        if not block.flags.c_contiguous:
+            raise ValueError("the buffer must be C-contiguous; convert a copy instead")
+        if writable and not block.flags.writeable:
+            raise ValueError("the buffer is read-only")
+        if block.size == 0:
+            return None, 0
+        return block.ctypes.data, block.size
+    if isinstance(block, array.array):
+        if block.typecode != "d":
+            raise TypeError("expected a buffer of float64, got typecode %r" % block.typecode)
+        address, count = block.buffer_info()
+        return (address if count else None), count
+
+    # Python 2's memoryview has no c_contiguous or nbytes
+    view = memoryview(block)
+    if not hasattr(view, "c_contiguous"):
+        raise TypeError("expected a numpy array or array.array of float64")
+    if view.format not in ("d", "<d", "=d") or view.itemsize != 8:
+        raise TypeError("expected a buffer of float64, got format %r" % view.format)
+    if not view.c_contiguous:
+        raise ValueError("the buffer must be C-contiguous; convert a copy instead")
+    if view.readonly:
+        raise ValueError("the buffer is read-only")
+    count = view.nbytes // 8
+    if count == 0:
+        return None, 0
+    return ctypes.addressof((ctypes.c_char * view.nbytes).from_buffer(view)), count
+
+
+def convert_table(table, block, channel=0, num_channels=1):
+    """Converts one channel of block in place with TABLE_AMBIENT or
+    TABLE_RADIANT and returns block. For interleaved scans, channel is the
+    channel's index in a scan and num_channels the scan length."""
+    if num_channels < 1 or not 0 <= channel < num_channels:
+        raise ValueError("channel must be in range(num_channels)")
+    address, count = buffer_address(block)
+    count = (count - channel + num_channels - 1) // num_channels
+    if count > 0:
+        error = _library.LJMConversion_ConvertTable(table, address + channel * 8,
+                                                    count, num_channels)
+        if error:
+            raise ConversionError(error, "LJMConversion_ConvertTable failed")
+    return block
+
+
+def _double_address(values, count):
+    """Returns the address of count float64 values and an object that keeps
+    them alive. Buffers of float64 are used in place; anything else, such as
+    a list, is copied."""
+    try:
+        address, length = buffer_address(values, writable=False)
+        if length == count:
+            return address, values
+    except (TypeError, ValueError):
+        pass
+    copy = (ctypes.c_double * count)(*values)
+    return ctypes.addressof(copy), copy
+
+
+def thermal_comfort(air_c, radiant_c, air_speed, humidity, met=1.2, clo=0.7):
+    """Returns ISO 7730 (pmv, ppd) for air and mean radiant temperature in C,
+    air speed in m/s and relative humidity in %. met is the occupants'
+    metabolic rate and clo their clothing; the defaults are visitors standing
+    at a trade fair stand in light indoor clothing.
+
+    Takes single readings, which give floats, or equal-length sequences of
+    cells or time points, which give numpy arrays for numpy input and lists
+    otherwise. Invalid cells give NaN."""
+    single = isinstance(air_c, numbers.Number)
+    if single:
+        air_c, radiant_c, air_speed, humidity = [air_c], [radiant_c], [air_speed], [humidity]
+    count = len(air_c)
+    if not len(radiant_c) == len(air_speed) == len(humidity) == count:
+        raise ValueError("the readings must have the same length")
+
+    inputs = [_double_address(values, count)
+              for values in (air_c, radiant_c, air_speed, humidity)]
+    if numpy is not None and isinstance(air_c, numpy.ndarray):
+        pmv, ppd = numpy.empty(count), numpy.empty(count)
+        pmv_address, ppd_address = pmv.ctypes.data, ppd.ctypes.data
+    else:
+        pmv, ppd = (ctypes.c_double * count)(), (ctypes.c_double * count)()
+        pmv_address, ppd_address = ctypes.addressof(pmv), ctypes.addressof(ppd)
+
+    error = _library.LJMConversion_ThermalComfort(
+        count, inputs[0][0], inputs[1][0], inputs[2][0], inputs[3][0], met, clo,
+        pmv_address, ppd_address)
+    if error:
+        raise ConversionError(error, "Invalid activity")
+
+    if single:
+        return pmv[0], ppd[0]
+    if isinstance(pmv, ctypes.Array):
+        return list(pmv), list(ppd)
+    return pmv, ppd
+
+
+class BlockConverter(object):
+    """Converts blocks of interleaved scans in place. Value i of each scan is
+    converted with sensors[i]."""
+    def __init__(self, sensors):
+        count = len(sensors)
+        types = (ctypes.c_int * count)(*[sensor.sensor_type for sensor in sensors])
+        parameters = []
+        for sensor in sensors:
+            parameters.extend(sensor.parameters())
+        parameters = (ctypes.c_double * len(parameters))(*parameters)
+
+        self._converter = ctypes.c_void_p()
+        error = _library.LJMConversion_Create(count, types, parameters,
+                                              ctypes.byref(self._converter))
+        if error:
+            self._converter = None
+            raise ConversionError(error, "Invalid sensor descriptor")
+        self.num_channels = count
+
+    def convert(self, block):
+        """Converts block in place and returns it. block must start at the
+        first channel of a scan."""
+        address, count = buffer_address(block)
+        if count:
+            error = _library.LJMConversion_Convert(self._converter, address, count)
+            if error:
+                raise ConversionError(error, "LJMConversion_Convert failed")
+        return block
+
+    def close(self):
+        if self._converter:
+            _library.LJMConversion_Destroy(self._converter)
+            self._converter = None
+
+    def __del__(self):
+        self.close()
@@ -0,0 +1,154 @@
+/**
+ * Name: table_benchmark.cpp
+ * Desc: Compares the compile-time tables of LJM_SensorTables.h with the exact
+ *       Steinhart-Hart and Callendar-Van Dusen conversions they are built
+ *       from, and with trade_fair.py's linear approximations. Prints the
+ *       samples per second of each and the largest error against the exact
+ *       curve for the comfortbot's ambient thermistor and radiant Pt100.
+ *       Needs no device.
+ * Usage: table_benchmark [samples]
+ *        samples defaults to 1000000.
+**/
+
+// For printf
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+#include "LJM_SensorTables.h"
+
+// Linear tables of the same curves, for the error of skipping the cubic
+constexpr SensorTable<COMFORTBOT_TABLE_SEGMENTS> AMBIENT_LINEAR_TABLE =
+	MakeThermistorTable<COMFORTBOT_TABLE_SEGMENTS>(COMFORTBOT_AMBIENT_NTC,
+		COMFORTBOT_AMBIENT_DIVIDER, -20, 80, SENSOR_TABLE_LINEAR);
+constexpr SensorTable<COMFORTBOT_TABLE_SEGMENTS> RADIANT_LINEAR_TABLE =
+	MakeRtdTable<COMFORTBOT_TABLE_SEGMENTS>(PT100_IEC60751,
+		COMFORTBOT_RADIANT_DIVIDER, -50, 150, SENSOR_TABLE_LINEAR);
+
+// The first segment starts at the hot end of the thermistor's range
+static_assert(AMBIENT_LINEAR_TABLE.coefficients[0][0] > 79.99 &&
+	AMBIENT_LINEAR_TABLE.coefficients[0][0] < 80.01, "ambient table range");
+
+/**
+ * Desc: Runs convert over a fresh copy of volts repeat times and returns the
+ *       best samples per second. converted is left with the result.
+**/
+template <typename Convert>
+double SamplesPerSecond(const std::vector<double> & volts, std::vector<double> & converted,
+	int repeat, Convert convert);
+
+/**
+ * Desc: Returns the largest absolute difference between a and b.
+**/
+double MaxError(const std::vector<double> & a, const std::vector<double> & b);
+
+/**
+ * Desc: Benchmarks one channel and prints its rows.
+**/
+template <typename Exact, typename Approximate>
+void CompareChannel(const char * name, const SensorTable<COMFORTBOT_TABLE_SEGMENTS> & cubic,
+	const SensorTable<COMFORTBOT_TABLE_SEGMENTS> & linear, Exact exact,
+	Approximate tradeFair, int numSamples);
+
+int main(int argc, char * argv[])
+{
+	int numSamples = argc > 1 ? atoi(argv[1]) : 1000000;
+
+	CompareChannel("Ambient NTC, -20 to 80 C", ComfortbotAmbientTable(), AMBIENT_LINEAR_TABLE,
+		[](double v) {
+			return ThermistorCelsiusExact(COMFORTBOT_AMBIENT_NTC,
+				COMFORTBOT_AMBIENT_DIVIDER, v);
+		},
+		[](double v) {
+			double Ro = (3000 * v) / (4.915 - v);
+			return 3000 / Ro * 25;
+		},
+		numSamples);
+
+	CompareChannel("Radiant Pt100, -50 to 150 C", ComfortbotRadiantTable(), RADIANT_LINEAR_TABLE,
+		[](double v) {
+			return RtdCelsiusExact(PT100_IEC60751, COMFORTBOT_RADIANT_DIVIDER, v);
+		},
+		[](double v) {
+			double resistance = (100 * v) / (4.915 - v);
+			return 100 * (resistance - 100) / 38.51;
+		},
+		numSamples);
+
+	return LJME_NOERROR;
+}
+
+template <typename Exact, typename Approximate>
+void CompareChannel(const char * name, const SensorTable<COMFORTBOT_TABLE_SEGMENTS> & cubic,
+	const SensorTable<COMFORTBOT_TABLE_SEGMENTS> & linear, Exact exact,
+	Approximate tradeFair, int numSamples)
+{
+	std::vector<double> volts(numSamples);
+	std::vector<double> exactC, cubicC, linearC, tradeFairC;
+
+	// Volts across the table's range, in random order like real data
+	srand(7);
+	for (int i = 0; i < numSamples; i++) {
+		volts[i] = cubic.minVolts + (cubic.maxVolts - cubic.minVolts) * rand() /
+			(double)RAND_MAX;
+	}
+
+	double exactRate = SamplesPerSecond(volts, exactC, 5,
+		[&exact](double * aData, int n) {
+			for (int i = 0; i < n; i++) {
+				aData[i] = exact(aData[i]);
+			}
+		});
+	double cubicRate = SamplesPerSecond(volts, cubicC, 5,
+		[&cubic](double * aData, int n) { cubic.ConvertBlock(aData, n); });
+	double linearRate = SamplesPerSecond(volts, linearC, 5,
+		[&linear](double * aData, int n) { linear.ConvertBlock(aData, n); });
+	double tradeFairRate = SamplesPerSecond(volts, tradeFairC, 5,
+		[&tradeFair](double * aData, int n) {
+			for (int i = 0; i < n; i++) {
+				aData[i] = tradeFair(aData[i]);
+			}
+		});
+
+	printf("%s, %d segments, %d samples\n", name, COMFORTBOT_TABLE_SEGMENTS, numSamples);
+	printf("    %-24s %14s %14s\n", "", "samples/s", "max error C");
+	printf("    %-24s %14.0f %14s\n", "Exact", exactRate, "-");
+	printf("    %-24s %14.0f %14.2g\n", "Cubic table", cubicRate, MaxError(cubicC, exactC));
+	printf("    %-24s %14.0f %14.2g\n", "Linear table", linearRate,
+		MaxError(linearC, exactC));
+	printf("    %-24s %14.0f %14.2g\n\n", "trade_fair.py formula", tradeFairRate,
+		MaxError(tradeFairC, exactC));
+}
+
+double MaxError(const std::vector<double> & a, const std::vector<double> & b)
+{
+	double maxError = 0;
+	for (size_t i = 0; i < a.size(); i++) {
+		double error = fabs(a[i] - b[i]);
+		maxError = error > maxError ? error : maxError;
+	}
+	return maxError;
+}
+
+template <typename Convert>
+double SamplesPerSecond(const std::vector<double> & volts, std::vector<double> & converted,
+	int repeat, Convert convert)
+{
+	double best = 0;
+	for (int r = 0; r < repeat; r++) {
+		converted = volts;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		convert(&converted[0], (int)converted.size());
+		double seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		double rate = converted.size() / seconds;
+		best = rate > best ? rate : best;
+	}
+	return best;
+}
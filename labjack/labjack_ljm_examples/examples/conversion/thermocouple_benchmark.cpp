@@ -0,0 +1,156 @@
+/**
+ * Name: thermocouple_benchmark.cpp
+ * Desc: Converts a block of simulated stream data from thermocouples plus
+ *       the T7's AIN14 cold junction with LJM_TCVoltsToTemp, one sample at a
+ *       time as utilities/thermocouple_example.c does, and with a
+ *       ThermocoupleConverter. Prints the samples per second of each and the
+ *       largest difference between them. Needs no device.
+ * Usage: thermocouple_benchmark [scans [cj decimation]]
+ *        scans defaults to 200000 and cj decimation to 100.
+**/
+
+// For printf
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_Thermocouple.h"
+
+// AIN0 to AIN7 thermocouples, then AIN14
+const long TYPES[] = {LJM_ttK, LJM_ttK, LJM_ttK, LJM_ttK, LJM_ttJ, LJM_ttJ, LJM_ttT, LJM_ttE};
+const int NUM_THERMOCOUPLES = sizeof(TYPES) / sizeof(TYPES[0]);
+const int NUM_CHANNELS = NUM_THERMOCOUPLES + 1;
+const int CJ_CHANNEL = NUM_THERMOCOUPLES;
+
+/**
+ * Desc: Fills scans with each thermocouple reading a slowly drifting
+ *       temperature across its range, and a cold junction drifting around
+ *       room temperature.
+**/
+void SimulateScans(std::vector<double> & scans, int numScans);
+
+/**
+ * Desc: Converts the thermocouple channels of scans with LJM_TCVoltsToTemp,
+ *       one sample at a time. cjKelvin gives each scan's cold junction.
+ *       Returns the samples per second.
+**/
+double ConvertWithLJM(std::vector<double> & scans, const std::vector<double> & cjKelvin);
+
+int main(int argc, char * argv[])
+{
+	int err;
+	int numScans = argc > 1 ? atoi(argv[1]) : 200000;
+	int cjDecimation = argc > 2 ? atoi(argv[2]) : THERMOCOUPLE_DEFAULT_CJ_DECIMATION;
+	std::vector<double> volts, perSample, perSampleDecimated, block;
+	std::vector<double> cjKelvin(numScans), cjKelvinDecimated(numScans);
+	ThermocoupleConverter converter;
+	ThermocoupleCj cj = ThermocoupleT7Cj(CJ_CHANNEL);
+	std::vector<long> types(TYPES, TYPES + NUM_THERMOCOUPLES);
+	types.push_back(0);
+
+	err = converter.SetChannels(types, cj, cjDecimation);
+	ErrorCheck(err, "ThermocoupleConverter::SetChannels");
+
+	SimulateScans(volts, numScans);
+
+	// The block converter, best of 5
+	double blockRate = 0;
+	for (int r = 0; r < 5; r++) {
+		block = volts;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		err = converter.Convert(&block[0], (int)block.size());
+		double seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		ErrorCheck(err, "ThermocoupleConverter::Convert");
+		double rate = NUM_THERMOCOUPLES * numScans / seconds;
+		blockRate = rate > blockRate ? rate : blockRate;
+	}
+
+	// LJM with each scan's own CJ reading, and with the converter's
+	// decimated CJ, which block left in the CJ channel
+	for (int scan = 0; scan < numScans; scan++) {
+		cjKelvin[scan] = volts[scan * NUM_CHANNELS + CJ_CHANNEL] * cj.slope + cj.offset +
+			cj.correctionK;
+		cjKelvinDecimated[scan] = block[scan * NUM_CHANNELS + CJ_CHANNEL];
+	}
+	perSample = volts;
+	double ljmRate = ConvertWithLJM(perSample, cjKelvin);
+	perSampleDecimated = volts;
+	ConvertWithLJM(perSampleDecimated, cjKelvinDecimated);
+
+	double maxDifference = 0, maxDecimationDifference = 0;
+	for (int scan = 0; scan < numScans; scan++) {
+		for (int t = 0; t < NUM_THERMOCOUPLES; t++) {
+			int i = scan * NUM_CHANNELS + t;
+			double difference = fabs(block[i] - perSampleDecimated[i]);
+			maxDifference = difference > maxDifference ? difference : maxDifference;
+			difference = fabs(block[i] - perSample[i]);
+			maxDecimationDifference = difference > maxDecimationDifference ?
+				difference : maxDecimationDifference;
+		}
+	}
+
+	printf("%d scans of %d thermocouples and a CJ channel, CJ decimation %d\n\n",
+		numScans, NUM_THERMOCOUPLES, cjDecimation);
+	printf("%-28s %14.0f samples/s\n", "LJM_TCVoltsToTemp", ljmRate);
+	printf("%-28s %14.0f samples/s  (%.1fx)\n", "ThermocoupleConverter", blockRate,
+		blockRate / ljmRate);
+	printf("Kernel: %s\n", SensorSimdName());
+	printf("Largest difference, same CJ: %.3g K\n", maxDifference);
+	printf("Largest difference, per-scan CJ: %.3g K\n", maxDecimationDifference);
+
+	return LJME_NOERROR;
+}
+
+void SimulateScans(std::vector<double> & scans, int numScans)
+{
+	// Each type's span, in C
+	const double LOW = -150, HIGH[] = {1300, 1300, 1300, 1300, 1100, 1100, 380, 950};
+
+	scans.resize((size_t)numScans * NUM_CHANNELS);
+	srand(7);
+	for (int scan = 0; scan < numScans; scan++) {
+		double * values = &scans[(size_t)scan * NUM_CHANNELS];
+		double phase = (double)scan / numScans;
+
+		// AIN14 near 25 C, with a little noise
+		double cjCelsius = 25 + 2 * sin(6.283 * phase) + 0.05 * rand() / (double)RAND_MAX;
+		values[CJ_CHANNEL] = (cjCelsius + 273.15 - THERMOCOUPLE_T7_AIN14_OFFSET - 3.0) /
+			THERMOCOUPLE_T7_AIN14_SLOPE;
+
+		for (int t = 0; t < NUM_THERMOCOUPLES; t++) {
+			const ThermocoupleType * type = ThermocoupleTypeFor(TYPES[t]);
+			double celsius = LOW + (HIGH[t] - LOW) * (0.5 + 0.5 * sin(6.283 * (phase + t / 8.0)));
+			values[t] = (ThermocoupleMillivolts(*type, celsius) -
+				ThermocoupleMillivolts(*type, cjCelsius)) / 1000;
+		}
+	}
+}
+
+double ConvertWithLJM(std::vector<double> & scans, const std::vector<double> & cjKelvin)
+{
+	int numScans = (int)cjKelvin.size();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int scan = 0; scan < numScans; scan++) {
+		for (int t = 0; t < NUM_THERMOCOUPLES; t++) {
+			double * value = &scans[(size_t)scan * NUM_CHANNELS + t];
+			double kelvin = NAN;
+			if (LJM_TCVoltsToTemp(TYPES[t], *value, cjKelvin[scan], &kelvin) != LJME_NOERROR) {
+				kelvin = NAN;
+			}
+			*value = kelvin;
+		}
+	}
+	double seconds = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+	return NUM_THERMOCOUPLES * numScans / seconds;
+}
@@ -0,0 +1,628 @@
+/**
+ * Name: LJM_Coroutines.h
+ * Desc: An awaitable API over the blocking LJM calls, so that many logical
+ *       tasks (sensor polling, uploads, robot moves) can share a few threads
+ *       instead of needing one thread per device:
+ *
+ *           LJMTask<void> PollAIN0(LJMDevice & device)
+ *           {
+ *               LJMResult result = co_await device.Read("AIN0");
+ *               ...
+ *           }
+ *
+ *       Tasks run on an LJMEventLoop thread. Each LJMDevice hands its
+ *       blocking LJM calls to one worker of an LJMWorkerPool and the awaiting
+ *       task resumes on the event loop once the call returns, so tasks never
+ *       run concurrently with each other and need no locking. C++20 only.
+**/
+
+#ifndef LJM_COROUTINES
+#define LJM_COROUTINES
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "LabJackM.h"
+
+/**
+ * Desc: The result of an awaited read. err is LJME_NOERROR on success.
+**/
+struct LJMResult
+{
+	int err;
+	double value;
+};
+
+/**
+ * Desc: The result of an awaited LJM_eStreamRead.
+**/
+struct LJMStreamResult
+{
+	int err;
+	int deviceScanBacklog;
+	int ljmScanBacklog;
+};
+
+template <typename T> class LJMTask;
+
+/**
+ * Name: LJMTaskPromiseBase
+ * Desc: Shared part of the promise types of LJMTask. A task starts suspended,
+ *       and when it finishes it resumes whoever awaited it.
+**/
+class LJMTaskPromiseBase
+{
+public:
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept { return false; }
+
+		template <typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+		{
+			std::coroutine_handle<> continuation = handle.promise().continuation;
+			return continuation ? continuation : std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	std::suspend_always initial_suspend() const noexcept { return {}; }
+	FinalAwaiter final_suspend() const noexcept { return {}; }
+
+	// LJM reports errors through return codes; an escaped exception is a bug
+	void unhandled_exception() const noexcept { std::terminate(); }
+
+	std::coroutine_handle<> continuation;
+};
+
+/**
+ * Name: LJMTask
+ * Desc: A coroutine returning T. Nothing runs until the task is awaited (or
+ *       spawned with LJMEventLoop::Spawn); awaiting a task runs it and
+ *       resumes the awaiting coroutine with its result.
+**/
+template <typename T>
+class LJMTask
+{
+public:
+	struct promise_type : public LJMTaskPromiseBase
+	{
+		LJMTask get_return_object()
+		{
+			return LJMTask(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		void return_value(T newValue) { value = std::move(newValue); }
+
+		std::optional<T> value;
+	};
+
+	LJMTask(LJMTask && other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+	LJMTask(const LJMTask &) = delete;
+	LJMTask & operator=(const LJMTask &) = delete;
+	~LJMTask() { if (handle) handle.destroy(); }
+
+	bool await_ready() const noexcept { return !handle || handle.done(); }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		handle.promise().continuation = awaiting;
+		return handle;
+	}
+	T await_resume() { return std::move(*handle.promise().value); }
+
+private:
+	explicit LJMTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+template <>
+class LJMTask<void>
+{
+public:
+	struct promise_type : public LJMTaskPromiseBase
+	{
+		LJMTask get_return_object()
+		{
+			return LJMTask(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		void return_void() const noexcept {}
+	};
+
+	LJMTask(LJMTask && other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+	LJMTask(const LJMTask &) = delete;
+	LJMTask & operator=(const LJMTask &) = delete;
+	~LJMTask() { if (handle) handle.destroy(); }
+
+	bool await_ready() const noexcept { return !handle || handle.done(); }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		handle.promise().continuation = awaiting;
+		return handle;
+	}
+	void await_resume() const noexcept {}
+
+private:
+	explicit LJMTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+/**
+ * Name: LJMEventLoop
+ * Desc: Runs spawned tasks on the thread that calls Run. Coroutines are
+ *       resumed one at a time, in the order they became ready.
+**/
+class LJMEventLoop
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	LJMEventLoop();
+
+	/**
+	 * Desc: Starts task on the loop. The loop owns the task until it finishes.
+	 *       Thread-safe.
+	**/
+	void Spawn(LJMTask<void> task);
+
+	/**
+	 * Desc: Resumes spawned tasks until all of them have finished.
+	**/
+	void Run();
+
+	/**
+	 * Desc: Queues a suspended coroutine to be resumed. Thread-safe.
+	**/
+	void Post(std::coroutine_handle<> handle);
+
+	/**
+	 * Desc: Queues a suspended coroutine to be resumed at when. Thread-safe.
+	**/
+	void PostAt(Clock::time_point when, std::coroutine_handle<> handle);
+
+	/**
+	 * Desc: co_await loop.Sleep(duration) suspends the task without blocking
+	 *       the loop. co_await loop.Yield() lets other ready tasks run first.
+	**/
+	struct SleepAwaiter
+	{
+		LJMEventLoop * loop;
+		Clock::duration duration;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) const;
+		void await_resume() const noexcept {}
+	};
+	SleepAwaiter Sleep(Clock::duration duration) { return SleepAwaiter{this, duration}; }
+	SleepAwaiter Yield() { return SleepAwaiter{this, Clock::duration::zero()}; }
+
+	/**
+	 * Desc: Number of coroutine resumptions performed by Run.
+	**/
+	long long NumResumes() const { return numResumes; }
+
+private:
+	struct Timer
+	{
+		Clock::time_point when;
+		long long order;
+		std::coroutine_handle<> handle;
+
+		bool operator>(const Timer & other) const
+		{
+			return when != other.when ? when > other.when : order > other.order;
+		}
+	};
+
+	// Owns a spawned task and tells the loop when it has finished. The frame
+	// destroys itself, and the task with it, on completion.
+	struct Detached
+	{
+		struct promise_type
+		{
+			Detached get_return_object()
+			{
+				return Detached{std::coroutine_handle<promise_type>::from_promise(*this)};
+			}
+			std::suspend_always initial_suspend() const noexcept { return {}; }
+			std::suspend_never final_suspend() const noexcept { return {}; }
+			void return_void() const noexcept {}
+			void unhandled_exception() const noexcept { std::terminate(); }
+		};
+
+		std::coroutine_handle<promise_type> handle;
+	};
+
+	Detached RunDetached(LJMTask<void> task);
+
+	std::mutex mutex;
+	std::condition_variable readyCondition;
+	std::deque<std::coroutine_handle<> > ready;
+	std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer> > timers;
+	long long nextTimerOrder;
+	int numActive;
+	long long numResumes;
+};
+
+/**
+ * Name: LJMWorkerPool
+ * Desc: Threads that make blocking LJM calls. Each job is queued to a chosen
+ *       worker, and each worker runs its jobs in order.
+**/
+class LJMWorkerPool
+{
+public:
+	LJMWorkerPool(int numWorkers);
+	~LJMWorkerPool();
+
+	int NumWorkers() const { return (int)workers.size(); }
+
+	/**
+	 * Desc: Returns the worker for the next device, cycling through the
+	 *       workers. Thread-safe.
+	**/
+	int AssignWorker();
+
+	/**
+	 * Desc: Queues job on worker (modulo the number of workers). Thread-safe.
+	**/
+	void Submit(int worker, std::function<void()> job);
+
+private:
+	struct Worker
+	{
+		std::mutex mutex;
+		std::condition_variable jobCondition;
+		std::deque<std::function<void()> > jobs;
+		bool stopping;
+		std::thread thread;
+	};
+
+	static void Run(Worker * worker);
+
+	std::vector<Worker *> workers;
+	std::mutex assignMutex;
+	int nextWorker;
+};
+
+/**
+ * Name: LJMCall
+ * Desc: Awaitable that runs call on a worker and resumes the awaiting task on
+ *       the event loop with its result.
+**/
+template <typename T>
+class LJMCall
+{
+public:
+	LJMCall(LJMEventLoop & loop, LJMWorkerPool & pool, int worker, std::function<T()> call) :
+		loop(loop), pool(pool), worker(worker), call(std::move(call)) {}
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> awaiting)
+	{
+		pool.Submit(worker, [this, awaiting]() {
+			result = call();
+			loop.Post(awaiting);
+		});
+	}
+	T await_resume() { return std::move(result); }
+
+private:
+	LJMEventLoop & loop;
+	LJMWorkerPool & pool;
+	int worker;
+	std::function<T()> call;
+	T result;
+};
+
+/**
+ * Name: LJMDevice
+ * Desc: Awaitable LJM calls for one open handle. All of the device's calls go
+ *       to the same worker, in the order they are awaited. Devices spread over
+ *       the pool's workers in the order they are created.
+ * Note: A StreamRead holds the worker until its scans arrive. To keep polling
+ *       the same handle meanwhile, stream through a second LJMDevice for the
+ *       handle on another worker; LJM allows calls on one handle from several
+ *       threads.
+ * Note: Names and buffers passed to these calls must stay valid until the
+ *       co_await completes, as with the blocking calls.
+**/
+class LJMDevice
+{
+public:
+	LJMDevice(LJMEventLoop & loop, LJMWorkerPool & pool, int handle);
+
+	int GetHandle() const { return handle; }
+
+	LJMCall<LJMResult> Read(const char * name);
+	LJMCall<int> Write(const char * name, double value);
+	LJMCall<int> ReadNames(int numFrames, const char ** aNames, double * aValues,
+		int * errorAddress);
+	LJMCall<int> WriteNames(int numFrames, const char ** aNames, const double * aValues,
+		int * errorAddress);
+
+	/**
+	 * Desc: LJM_eStreamStart, LJM_eStreamRead and LJM_eStreamStop. StreamRead
+	 *       waits for scansPerRead scans on the device's worker, so other
+	 *       tasks keep running while the stream fills.
+	**/
+	LJMCall<int> StreamStart(int scansPerRead, int numAddresses, const int * aScanList,
+		double * scanRate);
+	LJMCall<LJMStreamResult> StreamRead(double * aData);
+	LJMCall<int> StreamStop();
+
+	/**
+	 * Desc: Runs any blocking call on the device's worker.
+	**/
+	template <typename T>
+	LJMCall<T> Call(std::function<T()> call) { return LJMCall<T>(loop, pool, worker, std::move(call)); }
+
+private:
+	LJMEventLoop & loop;
+	LJMWorkerPool & pool;
+	int handle;
+	int worker;
+};
+
+
+// Source
+
+inline LJMEventLoop::LJMEventLoop() :
+	nextTimerOrder(0),
+	numActive(0),
+	numResumes(0)
+{
+}
+
+inline LJMEventLoop::Detached LJMEventLoop::RunDetached(LJMTask<void> task)
+{
+	co_await task;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	--numActive;
+	if (numActive == 0) {
+		readyCondition.notify_all();
+	}
+}
+
+inline void LJMEventLoop::Spawn(LJMTask<void> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		++numActive;
+	}
+	Post(RunDetached(std::move(task)).handle);
+}
+
+inline void LJMEventLoop::Post(std::coroutine_handle<> handle)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		ready.push_back(handle);
+	}
+	readyCondition.notify_one();
+}
+
+inline void LJMEventLoop::PostAt(Clock::time_point when, std::coroutine_handle<> handle)
+{
+	Timer timer;
+	timer.when = when;
+	timer.handle = handle;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		timer.order = nextTimerOrder++;
+		timers.push(timer);
+	}
+	readyCondition.notify_one();
+}
+
+inline void LJMEventLoop::SleepAwaiter::await_suspend(std::coroutine_handle<> handle) const
+{
+	if (duration <= Clock::duration::zero()) {
+		loop->Post(handle);
+	}
+	else {
+		loop->PostAt(Clock::now() + duration, handle);
+	}
+}
+
+inline void LJMEventLoop::Run()
+{
+	std::deque<std::coroutine_handle<> > batch;
+	Clock::time_point now;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		now = Clock::now();
+		while (!timers.empty() && timers.top().when <= now) {
+			ready.push_back(timers.top().handle);
+			timers.pop();
+		}
+
+		if (ready.empty()) {
+			if (numActive == 0) {
+				return;
+			}
+			if (timers.empty()) {
+				readyCondition.wait(lock);
+			}
+			else {
+				readyCondition.wait_until(lock, timers.top().when);
+			}
+			continue;
+		}
+
+		// Resume everything that is ready without holding the lock, so workers
+		// can post completions meanwhile
+		batch.swap(ready);
+		lock.unlock();
+		while (!batch.empty()) {
+			std::coroutine_handle<> handle = batch.front();
+			batch.pop_front();
+			++numResumes;
+			handle.resume();
+		}
+		lock.lock();
+	}
+}
+
+inline LJMWorkerPool::LJMWorkerPool(int numWorkers) :
+	nextWorker(0)
+{
+	int workerI;
+	if (numWorkers < 1) {
+		numWorkers = 1;
+	}
+	for (workerI = 0; workerI < numWorkers; workerI++) {
+		Worker * worker = new Worker();
+		worker->stopping = false;
+		worker->thread = std::thread(&LJMWorkerPool::Run, worker);
+		workers.push_back(worker);
+	}
+}
+
+inline LJMWorkerPool::~LJMWorkerPool()
+{
+	size_t workerI;
+	for (workerI = 0; workerI < workers.size(); workerI++) {
+		{
+			std::lock_guard<std::mutex> lock(workers[workerI]->mutex);
+			workers[workerI]->stopping = true;
+		}
+		workers[workerI]->jobCondition.notify_one();
+	}
+	for (workerI = 0; workerI < workers.size(); workerI++) {
+		workers[workerI]->thread.join();
+		delete workers[workerI];
+	}
+}
+
+inline int LJMWorkerPool::AssignWorker()
+{
+	std::lock_guard<std::mutex> lock(assignMutex);
+	int worker = nextWorker;
+	nextWorker = (nextWorker + 1) % (int)workers.size();
+	return worker;
+}
+
+inline void LJMWorkerPool::Submit(int worker, std::function<void()> job)
+{
+	Worker * target = workers[worker % workers.size()];
+	{
+		std::lock_guard<std::mutex> lock(target->mutex);
+		target->jobs.push_back(std::move(job));
+	}
+	target->jobCondition.notify_one();
+}
+
+inline void LJMWorkerPool::Run(Worker * worker)
+{
+	std::function<void()> job;
+
+	std::unique_lock<std::mutex> lock(worker->mutex);
+	while (true) {
+		worker->jobCondition.wait(lock, [worker]() {
+			return worker->stopping || !worker->jobs.empty();
+		});
+		// Finish queued jobs before stopping, so no awaiting task is lost
+		if (worker->jobs.empty()) {
+			return;
+		}
+		job = std::move(worker->jobs.front());
+		worker->jobs.pop_front();
+
+		lock.unlock();
+		job();
+		job = nullptr;
+		lock.lock();
+	}
+}
+
+inline LJMDevice::LJMDevice(LJMEventLoop & loop, LJMWorkerPool & pool, int handle) :
+	loop(loop),
+	pool(pool),
+	handle(handle),
+	worker(pool.AssignWorker())
+{
+}
+
+inline LJMCall<LJMResult> LJMDevice::Read(const char * name)
+{
+	int deviceHandle = handle;
+	return Call<LJMResult>([deviceHandle, name]() {
+		LJMResult result;
+		result.value = 0;
+		result.err = LJM_eReadName(deviceHandle, name, &result.value);
+		return result;
+	});
+}
+
+inline LJMCall<int> LJMDevice::Write(const char * name, double value)
+{
+	int deviceHandle = handle;
+	return Call<int>([deviceHandle, name, value]() {
+		return LJM_eWriteName(deviceHandle, name, value);
+	});
+}
+
+inline LJMCall<int> LJMDevice::ReadNames(int numFrames, const char ** aNames,
+	double * aValues, int * errorAddress)
+{
+	int deviceHandle = handle;
+	return Call<int>([deviceHandle, numFrames, aNames, aValues, errorAddress]() {
+		return LJM_eReadNames(deviceHandle, numFrames, aNames, aValues, errorAddress);
+	});
+}
+
+inline LJMCall<int> LJMDevice::WriteNames(int numFrames, const char ** aNames,
+	const double * aValues, int * errorAddress)
+{
+	int deviceHandle = handle;
+	return Call<int>([deviceHandle, numFrames, aNames, aValues, errorAddress]() {
+		return LJM_eWriteNames(deviceHandle, numFrames, aNames, aValues, errorAddress);
+	});
+}
+
+inline LJMCall<int> LJMDevice::StreamStart(int scansPerRead, int numAddresses,
+	const int * aScanList, double * scanRate)
+{
+	int deviceHandle = handle;
+	return Call<int>([deviceHandle, scansPerRead, numAddresses, aScanList, scanRate]() {
+		return LJM_eStreamStart(deviceHandle, scansPerRead, numAddresses, aScanList,
+			scanRate);
+	});
+}
+
+inline LJMCall<LJMStreamResult> LJMDevice::StreamRead(double * aData)
+{
+	int deviceHandle = handle;
+	return Call<LJMStreamResult>([deviceHandle, aData]() {
+		LJMStreamResult result;
+		result.deviceScanBacklog = 0;
+		result.ljmScanBacklog = 0;
+		result.err = LJM_eStreamRead(deviceHandle, aData, &result.deviceScanBacklog,
+			&result.ljmScanBacklog);
+		return result;
+	});
+}
+
+inline LJMCall<int> LJMDevice::StreamStop()
+{
+	int deviceHandle = handle;
+	return Call<int>([deviceHandle]() {
+		return LJM_eStreamStop(deviceHandle);
+	});
+}
+
+#endif // #define LJM_COROUTINES
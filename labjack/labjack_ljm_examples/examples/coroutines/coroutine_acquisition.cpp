@@ -0,0 +1,147 @@
+/**
+ * Name: coroutine_acquisition.cpp
+ * Desc: Runs several acquisition tasks on the first found device with
+ *       LJM_Coroutines.h, using two worker threads instead of a thread per
+ *       task:
+ *           - a task streaming AIN0 and AIN1, through its own LJMDevice,
+ *           - a task polling AIN2 every 100 ms,
+ *           - a task toggling FIO0 every 250 ms,
+ *       until the stream has been read NUM_STREAM_READS times.
+**/
+
+// For printf
+#include <stdio.h>
+
+#include <chrono>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_Coroutines.h"
+
+const int NUM_STREAM_CHANNELS = 2;
+const char * STREAM_CHANNELS[NUM_STREAM_CHANNELS] = {"AIN0", "AIN1"};
+const double SCAN_RATE = 1000;
+const int SCANS_PER_READ = 500;
+const int NUM_STREAM_READS = 10;
+
+/**
+ * Desc: Streams STREAM_CHANNELS for NUM_STREAM_READS reads, printing the
+ *       first scan of each read, then sets *done.
+**/
+LJMTask<void> StreamTask(LJMDevice & device, bool * done);
+
+/**
+ * Desc: Reads AIN2 every 100 ms until *done.
+**/
+LJMTask<void> PollTask(LJMEventLoop & loop, LJMDevice & device, const bool * done);
+
+/**
+ * Desc: Toggles FIO0 every 250 ms until *done.
+**/
+LJMTask<void> ToggleTask(LJMEventLoop & loop, LJMDevice & device, const bool * done);
+
+int main()
+{
+	int err;
+	int handle;
+	bool done = false;
+
+	// Open first found LabJack
+	err = LJM_Open(LJM_dtANY, LJM_ctANY, "LJM_idANY", &handle);
+	ErrorCheck(err, "LJM_Open");
+
+	PrintDeviceInfoFromHandle(handle);
+	printf("\n");
+
+	{
+		LJMEventLoop loop;
+		LJMWorkerPool pool(2);
+
+		// The stream device gets its own worker, so its long reads don't hold
+		// up the polling and toggling
+		LJMDevice streamDevice(loop, pool, handle);
+		LJMDevice device(loop, pool, handle);
+
+		loop.Spawn(StreamTask(streamDevice, &done));
+		loop.Spawn(PollTask(loop, device, &done));
+		loop.Spawn(ToggleTask(loop, device, &done));
+		loop.Run();
+
+		printf("\n%lld task resumptions\n", loop.NumResumes());
+	}
+
+	// Close
+	err = LJM_Close(handle);
+	ErrorCheck(err, "LJM_Close");
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+LJMTask<void> StreamTask(LJMDevice & device, bool * done)
+{
+	int err, readI;
+	int aScanList[NUM_STREAM_CHANNELS];
+	int aTypes[NUM_STREAM_CHANNELS];
+	double scanRate = SCAN_RATE;
+	double aData[SCANS_PER_READ * NUM_STREAM_CHANNELS];
+
+	err = LJM_NamesToAddresses(NUM_STREAM_CHANNELS, STREAM_CHANNELS, aScanList, aTypes);
+	ErrorCheck(err, "LJM_NamesToAddresses");
+
+	err = co_await device.StreamStart(SCANS_PER_READ, NUM_STREAM_CHANNELS, aScanList,
+		&scanRate);
+	if (err != LJME_NOERROR) {
+		PrintErrorIfError(err, "LJMDevice::StreamStart");
+		*done = true;
+		co_return;
+	}
+	printf("Stream started at %.0f Hz\n", scanRate);
+
+	for (readI = 0; readI < NUM_STREAM_READS; readI++) {
+		LJMStreamResult result = co_await device.StreamRead(aData);
+		if (result.err != LJME_NOERROR) {
+			PrintErrorIfError(result.err, "LJMDevice::StreamRead");
+			break;
+		}
+		printf("Stream read %2d: %s = %f, %s = %f, device backlog %d, LJM backlog %d\n",
+			readI, STREAM_CHANNELS[0], aData[0], STREAM_CHANNELS[1], aData[1],
+			result.deviceScanBacklog, result.ljmScanBacklog);
+	}
+
+	err = co_await device.StreamStop();
+	PrintErrorIfError(err, "LJMDevice::StreamStop");
+	*done = true;
+}
+
+LJMTask<void> PollTask(LJMEventLoop & loop, LJMDevice & device, const bool * done)
+{
+	while (!*done) {
+		LJMResult result = co_await device.Read("AIN2");
+		if (result.err != LJME_NOERROR) {
+			PrintErrorIfError(result.err, "LJMDevice::Read(AIN2)");
+			break;
+		}
+		printf("    AIN2 = %f\n", result.value);
+		co_await loop.Sleep(std::chrono::milliseconds(100));
+	}
+}
+
+LJMTask<void> ToggleTask(LJMEventLoop & loop, LJMDevice & device, const bool * done)
+{
+	int state = 0;
+	while (!*done) {
+		state = !state;
+		int err = co_await device.Write("FIO0", state);
+		if (err != LJME_NOERROR) {
+			PrintErrorIfError(err, "LJMDevice::Write(FIO0)");
+			break;
+		}
+		co_await loop.Sleep(std::chrono::milliseconds(250));
+	}
+}
@@ -0,0 +1,226 @@
+/**
+ * Name: coroutine_overhead.cpp
+ * Desc: Measures what LJM_Coroutines.h costs compared with a thread per
+ *       device or per task:
+ *           - starting and finishing a task vs. creating and joining a thread,
+ *           - switching between two tasks vs. between two threads,
+ *           - N logical tasks polling one device through a one-worker pool
+ *             vs. N threads calling LJM_eReadName on the same handle.
+**/
+
+// For printf
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_Coroutines.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// Constants rather than enums: C++20 deprecates enum / double arithmetic
+const int NUM_TASKS = 100000;
+const int NUM_THREADS = 2000;
+const int NUM_SWITCHES = 100000;
+const int NUM_THREAD_SWITCHES = 20000;
+const int DURATION_MS = 1000;
+
+const int POLLER_COUNTS[] = {1, 16, 256};
+enum { NUM_POLLER_COUNTS = sizeof(POLLER_COUNTS) / sizeof(POLLER_COUNTS[0]) };
+
+/**
+ * Desc: Returns the microseconds since start.
+**/
+double ElapsedUS(Clock::time_point start);
+
+/**
+ * Desc: Prints the cost of spawning NUM_TASKS tasks that each await a child
+ *       task, and of creating and joining NUM_THREADS threads.
+**/
+void TaskOverhead();
+
+/**
+ * Desc: Prints the cost of switching between two tasks that yield to each
+ *       other, and between two threads that wake each other.
+**/
+void SwitchOverhead();
+
+/**
+ * Desc: Polls AIN0 from numPollers tasks on one worker, then from numPollers
+ *       threads, for DURATION_MS each, and prints the reads per second.
+**/
+void PollDevice(int handle, int numPollers);
+
+int main()
+{
+	int err, i;
+	int handle;
+
+	TaskOverhead();
+	SwitchOverhead();
+	printf("\n");
+
+	// Open first found LabJack
+	err = LJM_Open(LJM_dtANY, LJM_ctANY, "LJM_idANY", &handle);
+	ErrorCheck(err, "LJM_Open");
+
+	PrintDeviceInfoFromHandle(handle);
+	printf("\n");
+
+	for (i = 0; i < NUM_POLLER_COUNTS; i++) {
+		PollDevice(handle, POLLER_COUNTS[i]);
+	}
+
+	// Close
+	err = LJM_Close(handle);
+	ErrorCheck(err, "LJM_Close");
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+double ElapsedUS(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+LJMTask<int> Child(int value)
+{
+	co_return value + 1;
+}
+
+LJMTask<void> Parent(long long * sum, int value)
+{
+	*sum += co_await Child(value);
+}
+
+void TaskOverhead()
+{
+	int i;
+	long long sum = 0;
+	LJMEventLoop loop;
+	std::atomic<long long> threadSum(0);
+
+	Clock::time_point start = Clock::now();
+	for (i = 0; i < NUM_TASKS; i++) {
+		loop.Spawn(Parent(&sum, i));
+	}
+	loop.Run();
+	double taskUS = ElapsedUS(start);
+
+	start = Clock::now();
+	for (i = 0; i < NUM_THREADS; i++) {
+		std::thread([&threadSum, i]() { threadSum += i + 1; }).join();
+	}
+	double threadUS = ElapsedUS(start);
+
+	printf("Spawn and finish a task (awaiting a child): %8.3f us\n", taskUS / NUM_TASKS);
+	printf("Create and join a thread:                   %8.3f us\n", threadUS / NUM_THREADS);
+}
+
+LJMTask<void> PingPong(LJMEventLoop & loop, int numYields)
+{
+	int i;
+	for (i = 0; i < numYields; i++) {
+		co_await loop.Yield();
+	}
+}
+
+void SwitchOverhead()
+{
+	LJMEventLoop loop;
+	std::mutex mutex;
+	std::condition_variable turnCondition;
+	int turn = 0;
+
+	Clock::time_point start = Clock::now();
+	loop.Spawn(PingPong(loop, NUM_SWITCHES / 2));
+	loop.Spawn(PingPong(loop, NUM_SWITCHES / 2));
+	loop.Run();
+	double taskUS = ElapsedUS(start);
+	long long numTaskSwitches = loop.NumResumes();
+
+	// Each thread waits for its turn, then hands the turn to the other
+	auto player = [&](int me) {
+		int switchI;
+		std::unique_lock<std::mutex> lock(mutex);
+		for (switchI = 0; switchI < NUM_THREAD_SWITCHES / 2; switchI++) {
+			turnCondition.wait(lock, [&]() { return turn == me; });
+			turn = 1 - me;
+			turnCondition.notify_one();
+		}
+	};
+	start = Clock::now();
+	std::thread first(player, 0);
+	std::thread second(player, 1);
+	first.join();
+	second.join();
+	double threadUS = ElapsedUS(start);
+
+	printf("Switch between two tasks:                   %8.3f us\n",
+		taskUS / numTaskSwitches);
+	printf("Switch between two threads:                 %8.3f us\n",
+		threadUS / NUM_THREAD_SWITCHES);
+}
+
+LJMTask<void> Poller(LJMDevice & device, Clock::time_point end, long long * numReads)
+{
+	while (Clock::now() < end) {
+		LJMResult result = co_await device.Read("AIN0");
+		ErrorCheck(result.err, "LJMDevice::Read(AIN0)");
+		++*numReads;
+	}
+}
+
+void PollDevice(int handle, int numPollers)
+{
+	int pollerI;
+	long long numTaskReads = 0;
+	std::atomic<long long> numThreadReads(0);
+	std::vector<std::thread> pollers;
+
+	{
+		LJMEventLoop loop;
+		LJMWorkerPool pool(1);
+		LJMDevice device(loop, pool, handle);
+		Clock::time_point end = Clock::now() + std::chrono::milliseconds(DURATION_MS);
+		for (pollerI = 0; pollerI < numPollers; pollerI++) {
+			loop.Spawn(Poller(device, end, &numTaskReads));
+		}
+		loop.Run();
+	}
+
+	Clock::time_point end = Clock::now() + std::chrono::milliseconds(DURATION_MS);
+	for (pollerI = 0; pollerI < numPollers; pollerI++) {
+		pollers.push_back(std::thread([handle, end, &numThreadReads]() {
+			int err;
+			double value;
+			while (Clock::now() < end) {
+				err = LJM_eReadName(handle, "AIN0", &value);
+				ErrorCheck(err, "LJM_eReadName(AIN0)");
+				++numThreadReads;
+			}
+		}));
+	}
+	for (pollerI = 0; pollerI < numPollers; pollerI++) {
+		pollers[pollerI].join();
+	}
+
+	// Both are limited by the device round trip; the tasks need 2 threads
+	// however many there are
+	printf("%3d pollers: %7.0f reads/s as tasks (2 threads), "
+		"%7.0f reads/s as threads (%d threads)\n",
+		numPollers, numTaskReads * 1000.0 / DURATION_MS,
+		numThreadReads * 1000.0 / DURATION_MS, numPollers);
+}
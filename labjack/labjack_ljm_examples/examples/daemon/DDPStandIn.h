@@ -0,0 +1,477 @@
+/**
+ * Name: DDPStandIn.h
+ * Desc: A local DDP server over WebSocket that stands in for the comfortbot
+ *       Meteor server when testing or benchmarking upload code without one.
+ *       It answers DDP's connect, ping and method messages, runs methods
+ *       through a DDPMethodHandler, and can delay its answers to imitate the
+ *       network and the server's own work. C++11, POSIX only.
+**/
+
+#ifndef DDP_STAND_IN
+#define DDP_STAND_IN
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LJM_DDPClient.h"
+
+/**
+ * Desc: Runs a method call on a DDPStandIn's thread. params is the JSON text
+ *       of the call's parameters.
+ * Para: result, set to the JSON text of the result, or to the reason if the
+ *           call fails.
+ * Retr: Whether the call succeeded.
+**/
+typedef std::function<bool(const std::string & method, const std::string & params,
+	std::string * result)> DDPMethodHandler;
+
+/**
+ * Name: DDPStandIn
+ * Desc: Serves any number of WebSocket connections from one thread. Each
+ *       method is answered responseDelayUS after it arrived, with a result
+ *       message and then an updated message; answers that come due together
+ *       share one updated message, as Meteor's do. Without a handler every
+ *       method succeeds and returns a new id, like a collection insert.
+**/
+class DDPStandIn
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	DDPStandIn(unsigned int responseDelayUS = 0);
+	~DDPStandIn();
+
+	/**
+	 * Desc: Starts serving on ipAddress, 127.0.0.1 by default. A port of 0
+	 *       picks a free port; see GetPort.
+	 * Retr: LJME_NOERROR or LJME_SOCKET_LEVEL_ERROR.
+	**/
+	int Start(int port = 0, unsigned int ipAddress = INADDR_LOOPBACK);
+	void Stop();
+
+	int GetPort() const { return port; }
+	unsigned int GetIPAddress() const { return ipAddress; }
+
+	void SetResponseDelayUS(unsigned int delayUS) { responseDelayUS = delayUS; }
+
+	/**
+	 * Desc: Sets the handler methods run through. Set it before Start.
+	**/
+	void SetMethodHandler(DDPMethodHandler newHandler) { handler = newHandler; }
+
+	long long NumCalls() const { return numCalls; }
+	int NumConnections();
+
+private:
+	struct PendingResponse
+	{
+		Clock::time_point due;
+		std::string id;
+		std::string result;
+		bool succeeded;
+	};
+
+	struct Connection
+	{
+		bool upgraded;
+		std::vector<unsigned char> received;
+		std::string fragments;
+		std::deque<PendingResponse> responses;
+		std::vector<unsigned char> unsent;
+	};
+
+	void Run();
+	void Accept();
+	bool ReadConnection(int fd, Connection & connection);
+	bool Upgrade(Connection & connection);
+	void HandleMessage(Connection & connection, const std::string & message);
+	bool FlushConnection(int fd, Connection & connection);
+	void SendMessage(Connection & connection, const std::string & message);
+
+	std::atomic<unsigned int> responseDelayUS;
+	DDPMethodHandler handler;
+	int listenSock;
+	int port;
+	unsigned int ipAddress;
+	int wakePipe[2];
+	std::atomic<bool> running;
+	std::atomic<long long> numCalls;
+	long long numSessions;
+
+	std::mutex connectionMutex;
+	std::map<int, Connection> connections;
+	std::thread server;
+};
+
+
+// Source
+
+inline DDPStandIn::DDPStandIn(unsigned int responseDelayUS) :
+	responseDelayUS(responseDelayUS),
+	listenSock(-1),
+	port(0),
+	ipAddress(INADDR_LOOPBACK),
+	running(false),
+	numCalls(0),
+	numSessions(0)
+{
+	wakePipe[0] = wakePipe[1] = -1;
+}
+
+inline DDPStandIn::~DDPStandIn()
+{
+	Stop();
+}
+
+inline int DDPStandIn::Start(int newPort, unsigned int newIPAddress)
+{
+	struct sockaddr_in address;
+	socklen_t addressLen = sizeof(address);
+	int one = 1;
+
+	Stop();
+
+	ipAddress = newIPAddress;
+	listenSock = socket(AF_INET, SOCK_STREAM, 0);
+	if (listenSock < 0) {
+		return LJME_SOCKET_LEVEL_ERROR;
+	}
+	setsockopt(listenSock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	fcntl(listenSock, F_SETFL, fcntl(listenSock, F_GETFL, 0) | O_NONBLOCK);
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons((unsigned short)newPort);
+	address.sin_addr.s_addr = htonl(ipAddress);
+	if (bind(listenSock, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+		listen(listenSock, 1024) < 0 ||
+		getsockname(listenSock, (struct sockaddr *)&address, &addressLen) < 0 ||
+		pipe(wakePipe) < 0)
+	{
+		Stop();
+		return LJME_SOCKET_LEVEL_ERROR;
+	}
+	port = ntohs(address.sin_port);
+
+	running = true;
+	server = std::thread(&DDPStandIn::Run, this);
+	return LJME_NOERROR;
+}
+
+inline void DDPStandIn::Stop()
+{
+	std::map<int, Connection>::iterator it;
+
+	if (running) {
+		running = false;
+		if (write(wakePipe[1], "x", 1) < 0) {
+			// The server thread still notices running within its poll timeout
+		}
+		server.join();
+	}
+
+	for (it = connections.begin(); it != connections.end(); ++it) {
+		close(it->first);
+	}
+	connections.clear();
+
+	if (listenSock >= 0) {
+		close(listenSock);
+		listenSock = -1;
+	}
+	if (wakePipe[0] >= 0) {
+		close(wakePipe[0]);
+		close(wakePipe[1]);
+		wakePipe[0] = wakePipe[1] = -1;
+	}
+}
+
+inline int DDPStandIn::NumConnections()
+{
+	std::lock_guard<std::mutex> lock(connectionMutex);
+	return (int)connections.size();
+}
+
+inline void DDPStandIn::Accept()
+{
+	int fd, one = 1;
+	while ((fd = accept(listenSock, NULL, NULL)) >= 0) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		std::lock_guard<std::mutex> lock(connectionMutex);
+		connections[fd] = Connection();
+		connections[fd].upgraded = false;
+	}
+}
+
+inline void DDPStandIn::SendMessage(Connection & connection, const std::string & message)
+{
+	WebSocketAppendFrame(connection.unsent, WEB_SOCKET_TEXT, message.data(),
+		message.size(), 0);
+}
+
+inline bool DDPStandIn::Upgrade(Connection & connection)
+{
+	std::string text(connection.received.begin(), connection.received.end());
+	size_t headEnd = text.find("\r\n\r\n");
+	if (headEnd == std::string::npos) {
+		return connection.received.size() <= 65536;
+	}
+
+	std::string head = text.substr(0, headEnd + 2);
+	std::string key = WebSocketHeader(head, "Sec-WebSocket-Key");
+	connection.received.erase(connection.received.begin(),
+		connection.received.begin() + headEnd + 4);
+	if (head.compare(0, 4, "GET ") != 0 || key.empty()) {
+		return false;
+	}
+
+	std::string response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+		"Connection: Upgrade\r\nSec-WebSocket-Accept: " + WebSocketAccept(key) + "\r\n\r\n";
+	connection.unsent.insert(connection.unsent.end(), response.begin(), response.end());
+	connection.upgraded = true;
+	SendMessage(connection, "{\"server_id\":\"0\"}");
+	return true;
+}
+
+inline void DDPStandIn::HandleMessage(Connection & connection, const std::string & message)
+{
+	std::string type, value, method, params;
+	char session[32];
+	PendingResponse pending;
+
+	if (!DDPFindField(message, "msg", &type)) {
+		return;
+	}
+	type = DDPUnquote(type);
+
+	if (type == "connect") {
+		snprintf(session, sizeof(session), "stand-in-%lld", ++numSessions);
+		SendMessage(connection, std::string("{\"msg\":\"connected\",\"session\":\"") +
+			session + "\"}");
+	}
+	else if (type == "ping") {
+		SendMessage(connection, DDPFindField(message, "id", &value) ?
+			"{\"msg\":\"pong\",\"id\":" + value + "}" : "{\"msg\":\"pong\"}");
+	}
+	else if (type == "method") {
+		if (!DDPFindField(message, "id", &pending.id) ||
+			!DDPFindField(message, "method", &method))
+		{
+			SendMessage(connection, "{\"msg\":\"error\",\"reason\":\"Bad request\","
+				"\"offendingMessage\":" + message + "}");
+			return;
+		}
+		if (!DDPFindField(message, "params", &params)) {
+			params = "[]";
+		}
+
+		long long callNumber = ++numCalls;
+		if (handler) {
+			pending.succeeded = handler(DDPUnquote(method), params, &pending.result);
+		}
+		else {
+			char id[32];
+			snprintf(id, sizeof(id), "\"%lld\"", callNumber);
+			pending.result = id;
+			pending.succeeded = true;
+		}
+		pending.due = Clock::now() + std::chrono::microseconds(responseDelayUS.load());
+		connection.responses.push_back(pending);
+	}
+}
+
+inline bool DDPStandIn::ReadConnection(int fd, Connection & connection)
+{
+	unsigned char buffer[16384];
+	ssize_t numRead;
+	size_t consumed;
+	long long frameSize;
+	WebSocketFrame frame;
+
+	while (true) {
+		numRead = recv(fd, buffer, sizeof(buffer), 0);
+		if (numRead == 0) {
+			return false;
+		}
+		if (numRead < 0) {
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		connection.received.insert(connection.received.end(), buffer, buffer + numRead);
+
+		if (!connection.upgraded) {
+			if (!Upgrade(connection)) {
+				return false;
+			}
+			if (!connection.upgraded) {
+				continue;
+			}
+		}
+
+		consumed = 0;
+		while (connection.received.size() - consumed >= 2) {
+			frameSize = WebSocketParseFrame(&connection.received[consumed],
+				connection.received.size() - consumed, DDP_MAX_MESSAGE_SIZE, &frame);
+			if (frameSize < 0) {
+				return false;
+			}
+			if (frameSize == 0) {
+				break;
+			}
+
+			const char * payload = (const char *)&connection.received[consumed +
+				frame.headerSize];
+			if (frame.opcode == WEB_SOCKET_TEXT || frame.opcode == WEB_SOCKET_BINARY) {
+				connection.fragments.assign(payload, frame.payloadSize);
+			}
+			else if (frame.opcode == WEB_SOCKET_CONTINUATION) {
+				connection.fragments.append(payload, frame.payloadSize);
+			}
+			else if (frame.opcode == WEB_SOCKET_PING) {
+				WebSocketAppendFrame(connection.unsent, WEB_SOCKET_PONG, payload,
+					frame.payloadSize, 0);
+			}
+			else if (frame.opcode == WEB_SOCKET_CLOSE) {
+				return false;
+			}
+			if (frame.final && frame.opcode < WEB_SOCKET_CLOSE) {
+				HandleMessage(connection, connection.fragments);
+			}
+			consumed += (size_t)frameSize;
+		}
+		connection.received.erase(connection.received.begin(),
+			connection.received.begin() + consumed);
+	}
+}
+
+inline bool DDPStandIn::FlushConnection(int fd, Connection & connection)
+{
+	ssize_t sent;
+	Clock::time_point now = Clock::now();
+	std::string updated;
+
+	while (!connection.responses.empty() && connection.responses.front().due <= now) {
+		PendingResponse & response = connection.responses.front();
+		if (response.succeeded) {
+			SendMessage(connection, "{\"msg\":\"result\",\"id\":" + response.id +
+				",\"result\":" + (response.result.empty() ? "null" : response.result) + "}");
+		}
+		else {
+			SendMessage(connection, "{\"msg\":\"result\",\"id\":" + response.id +
+				",\"error\":{\"error\":500,\"reason\":" + DDPQuote(response.result) +
+				",\"errorType\":\"Meteor.Error\"}}");
+		}
+		updated += (updated.empty() ? "" : ",") + response.id;
+		connection.responses.pop_front();
+	}
+	if (!updated.empty()) {
+		SendMessage(connection, "{\"msg\":\"updated\",\"methods\":[" + updated + "]}");
+	}
+
+	if (!connection.unsent.empty()) {
+		sent = send(fd, &connection.unsent[0], connection.unsent.size(), MSG_NOSIGNAL);
+		if (sent < 0) {
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		connection.unsent.erase(connection.unsent.begin(), connection.unsent.begin() + sent);
+	}
+	return true;
+}
+
+inline void DDPStandIn::Run()
+{
+	std::vector<struct pollfd> fds;
+	std::vector<int> closed;
+	std::map<int, Connection>::iterator it;
+	struct pollfd pfd;
+	size_t fdI;
+	long long waitNS;
+	struct timespec wait;
+	Clock::time_point now, nextDue;
+
+	while (running) {
+		fds.clear();
+		pfd.revents = 0;
+		pfd.fd = wakePipe[0];
+		pfd.events = POLLIN;
+		fds.push_back(pfd);
+		pfd.fd = listenSock;
+		fds.push_back(pfd);
+
+		now = Clock::now();
+		nextDue = now + std::chrono::milliseconds(100);
+		{
+			std::lock_guard<std::mutex> lock(connectionMutex);
+			for (it = connections.begin(); it != connections.end(); ++it) {
+				pfd.fd = it->first;
+				pfd.events = POLLIN;
+				if (!it->second.unsent.empty()) {
+					pfd.events |= POLLOUT;
+				}
+				fds.push_back(pfd);
+				if (!it->second.responses.empty() &&
+					it->second.responses.front().due < nextDue)
+				{
+					nextDue = it->second.responses.front().due;
+				}
+			}
+		}
+
+		// Microsecond response delays need a finer timeout than poll's
+		waitNS = std::chrono::duration_cast<std::chrono::nanoseconds>(nextDue - now).count();
+		if (waitNS < 0) {
+			waitNS = 0;
+		}
+		wait.tv_sec = (time_t)(waitNS / 1000000000LL);
+		wait.tv_nsec = (long)(waitNS % 1000000000LL);
+		ppoll(&fds[0], fds.size(), &wait, NULL);
+
+		if (fds[1].revents & POLLIN) {
+			Accept();
+		}
+
+		std::lock_guard<std::mutex> lock(connectionMutex);
+		closed.clear();
+		for (fdI = 2; fdI < fds.size(); fdI++) {
+			it = connections.find(fds[fdI].fd);
+			if (it == connections.end()) {
+				continue;
+			}
+			if ((fds[fdI].revents & (POLLIN | POLLHUP | POLLERR)) &&
+				!ReadConnection(it->first, it->second))
+			{
+				closed.push_back(it->first);
+			}
+		}
+		for (it = connections.begin(); it != connections.end(); ++it) {
+			if (!FlushConnection(it->first, it->second)) {
+				closed.push_back(it->first);
+			}
+		}
+		for (fdI = 0; fdI < closed.size(); fdI++) {
+			if (connections.erase(closed[fdI])) {
+				close(closed[fdI]);
+			}
+		}
+	}
+}
+
+#endif // #define DDP_STAND_IN
@@ -0,0 +1,1422 @@
+/**
+ * Name: LJM_AcquisitionPipeline.h
+ * Desc: Streams the comfortbot sensors and turns them into insertData
+ *       uploads on a pipeline of threads. trade_fair.py reads five
+ *       hard-coded channels with eReadNames every 0.5 s, sleeps 5 s after
+ *       each 20-reading average and then waits for the DDP server to answer,
+ *       so nothing is measured while the server is slow. Here the channels
+ *       come from an AcquisitionConfig file, the device streams them, and
+ *       each stage runs on its own thread:
+ *           acquire  reads blocks of scans from an AcquisitionSource
+ *           convert  converts each block from volts to sensor units
+ *           average  averages windows of scans into upload records, with
+ *                    derived magnitudes and ISO 7730 PMV and PPD
+ *           upload   hands records to an UploadSink
+ *       The stages pass their work through BoundedQueues. The upload queue
+ *       never waits for room: when the sink falls behind, the oldest record
+ *       is dropped and counted, so acquisition timing never depends on the
+ *       network. C++14.
+**/
+
+#ifndef LJM_ACQUISITION_PIPELINE
+#define LJM_ACQUISITION_PIPELINE
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LabJackM.h"
+
+#include "../LJM_Utilities.h"
+
+#include "../conversion/LJM_SensorConversion.h"
+#include "../conversion/LJM_SensorTables.h"
+#include "../conversion/LJM_ThermalComfort.h"
+
+typedef std::chrono::steady_clock AcquisitionClock;
+
+/**
+ * Desc: How a channel's volts are converted.
+ *       ACQUISITION_DESCRIPTOR: with the channel's SensorDescriptor, by a
+ *           SensorBlockConverter.
+ *       ACQUISITION_AMBIENT_TABLE, ACQUISITION_RADIANT_TABLE: with
+ *           ComfortbotAmbientTable or ComfortbotRadiantTable.
+**/
+enum AcquisitionConversion {
+	ACQUISITION_DESCRIPTOR,
+	ACQUISITION_AMBIENT_TABLE,
+	ACQUISITION_RADIANT_TABLE
+};
+
+struct AcquisitionChannel
+{
+	std::string field;
+	std::string name;
+	AcquisitionConversion conversion;
+	SensorDescriptor sensor;
+
+	// What SimulatedSource reads on this channel
+	double simulateVolts;
+};
+
+/**
+ * Desc: A field computed from the averages of other fields as the square
+ *       root of the sum of their squares, like trade_fair.py's velocity from
+ *       its two anemometers.
+**/
+struct AcquisitionMagnitude
+{
+	std::string field;
+	std::vector<int> components;
+};
+
+/**
+ * Name: AcquisitionConfig
+ * Desc: What to stream and upload. Load reads it from a file of
+ *       "key = value" lines; blank lines and lines starting with # are
+ *       skipped:
+ *           room = BBW281            the room insertData is given
+ *           scan_rate = 100          scans per second
+ *           scans_per_read = 50      scans per LJM_eStreamRead
+ *           average_seconds = 10     scans averaged into each record
+ *           grid = 4 4               cells the records step through, like
+ *                                    trade_fair.py's x and y
+ *           upload_queue = 64        records waiting for the sink
+ *           block_queue = 64         blocks waiting for each stage
+ *           met = 1.2                activity for PMV and PPD
+ *           clo = 0.7
+ *           channel FIELD = NAME SENSOR [PARAMETERS]
+ *           simulate FIELD = VOLTS
+ *           magnitude FIELD = FIELD FIELD ...
+ *           comfort = AIR RADIANT SPEED HUMIDITY
+ *           upload = FIELD FIELD ...
+ *       channel lines stream NAME, in order, and convert it to FIELD with
+ *       one of these SENSORs:
+ *           volts
+ *           linear SCALE [OFFSET]
+ *           rtd_divider SERIES_OHMS SUPPLY_VOLTS R0_OHMS ALPHA
+ *           thermistor_divider SERIES_OHMS SUPPLY_VOLTS REFERENCE_C
+ *           comfortbot_radiant, comfortbot_humidity, comfortbot_ambient,
+ *               comfortbot_anemometer: trade_fair.py's conversions
+ *           ambient_table, radiant_table: the LJM_SensorTables.h curves
+ *       comfort names the fields ComfortPmvPpd takes, and adds the fields
+ *       pmv and ppd. upload lists the fields to upload; all of them by
+ *       default.
+**/
+struct AcquisitionConfig
+{
+	std::string room;
+	double scanRate;
+	int scansPerRead;
+	double averageSeconds;
+	int gridX;
+	int gridY;
+	int uploadQueueLength;
+	int blockQueueLength;
+	ComfortActivity activity;
+
+	std::vector<AcquisitionChannel> channels;
+	std::vector<AcquisitionMagnitude> magnitudes;
+
+	// Indexes into Fields() of the comfort inputs, or -1 without comfort
+	int comfort[4];
+
+	// Indexes into Fields() to upload
+	std::vector<int> upload;
+
+	AcquisitionConfig();
+
+	/**
+	 * Desc: The channels' fields, then the magnitudes', then pmv and ppd if
+	 *       comfort is set. The average stage computes them in this order.
+	**/
+	std::vector<std::string> Fields() const;
+
+	/**
+	 * Desc: Replaces this configuration with the one in the file at path.
+	 * Para: errorLine, set to the number of the line that couldn't be
+	 *           parsed, or 0 if the file as a whole is inconsistent, e.g.
+	 *           has no channels. May be NULL.
+	 * Retr: LJME_NOERROR, LJME_CONSTANTS_FILE_NOT_FOUND if path can't be
+	 *       opened, LJME_INVALID_NAME for an unknown key, sensor or field, or
+	 *       LJME_INVALID_VALUE for a bad value.
+	**/
+	int Load(const char * path, int * errorLine);
+
+	int FieldIndex(const std::string & field) const;
+
+private:
+	int ParseLine(char * line, std::vector<std::vector<std::string> > * magnitudeComponents,
+		std::vector<std::string> * comfortFields, std::vector<std::string> * uploadFields);
+};
+
+/**
+ * Name: AcquisitionSource
+ * Desc: Where the acquire stage gets its scans.
+**/
+class AcquisitionSource
+{
+public:
+	virtual ~AcquisitionSource() {}
+
+	/**
+	 * Desc: Starts acquiring config's channels.
+	 * Para: scanRate, set to the scan rate actually used.
+	**/
+	virtual int Start(const AcquisitionConfig & config, double * scanRate) = 0;
+
+	/**
+	 * Desc: Waits for the next scansPerRead scans and copies them into
+	 *       aData, interleaved like LJM_eStreamRead.
+	**/
+	virtual int Read(double * aData, int * deviceScanBacklog, int * LJMScanBacklog) = 0;
+
+	virtual int Stop() = 0;
+};
+
+/**
+ * Name: LJMStreamSource
+ * Desc: Streams the channels from a device with LJM_eStreamStart, on the
+ *       device's internal clock, with the AIN settings of
+ *       stream/stream_example.c.
+**/
+class LJMStreamSource : public AcquisitionSource
+{
+public:
+	LJMStreamSource(int handle) : handle(handle) {}
+
+	int Start(const AcquisitionConfig & config, double * scanRate);
+	int Read(double * aData, int * deviceScanBacklog, int * LJMScanBacklog);
+	int Stop();
+
+private:
+	int handle;
+};
+
+/**
+ * Name: SimulatedSource
+ * Desc: Produces each channel's simulateVolts, with a slow drift and a
+ *       little noise, at the scan rate, so the pipeline can run without a
+ *       device. Read returns when the scans would have arrived, and reports
+ *       scans that are already due as LJM backlog.
+**/
+class SimulatedSource : public AcquisitionSource
+{
+public:
+	SimulatedSource() : numChannels(0), scansPerRead(0), scanRate(0), numScans(0) {}
+
+	int Start(const AcquisitionConfig & config, double * scanRate);
+	int Read(double * aData, int * deviceScanBacklog, int * LJMScanBacklog);
+	int Stop() { return LJME_NOERROR; }
+
+private:
+	std::vector<double> volts;
+	int numChannels;
+	int scansPerRead;
+	double scanRate;
+	long long numScans;
+	AcquisitionClock::time_point start;
+};
+
+/**
+ * Name: UploadSink
+ * Desc: Receives the upload stage's DDP method calls. params is the JSON
+ *       array of the call's parameters.
+**/
+class UploadSink
+{
+public:
+	virtual ~UploadSink() {}
+
+	/**
+	 * Retr: LJME_NOERROR once the call is done, or an error, in which case
+	 *       the record is counted as failed and dropped.
+	**/
+	virtual int Send(const std::string & method, const std::string & params) = 0;
+};
+
+/**
+ * Name: LineUploadSink
+ * Desc: Writes each call as a line "method params", the command syntax
+ *       trade_fair.py's parse_command reads, to a file or stdout.
+ *       SetDelayMS makes each Send take that long first, to see how the
+ *       pipeline copes with a slow server.
+**/
+class LineUploadSink : public UploadSink
+{
+public:
+	LineUploadSink() : file(stdout), delayMS(0) {}
+	~LineUploadSink() { Close(); }
+
+	/**
+	 * Retr: LJME_NOERROR, or LJME_INVALID_PARAMETER if path can't be opened.
+	**/
+	int Open(const char * path);
+	void Close();
+	void SetDelayMS(double milliseconds) { delayMS = milliseconds; }
+	int Send(const std::string & method, const std::string & params);
+
+private:
+	FILE * file;
+	double delayMS;
+};
+
+/**
+ * Desc: The count, mean and maximum of a latency, in milliseconds.
+**/
+struct AcquisitionLatency
+{
+	long long count;
+	double totalMS;
+	double maxMS;
+
+	void Add(double milliseconds);
+	double MeanMS() const { return count > 0 ? totalMS / count : 0; }
+};
+
+/**
+ * Desc: What an AcquisitionPipeline has done since Start.
+ *       scans and blocks count what the source returned, and skippedSamples
+ *       the LJM_DUMMY_VALUE samples among them, which are averaged as
+ *       missing. scansPerSecond is scans over elapsedSeconds.
+ *       convertSamplesPerSecond is what the convert stage converts per
+ *       second of its own busy time, its headroom over the scan rate.
+ *       records counts averaged windows, uploads the records the sink took,
+ *       failedUploads the ones it returned an error for and droppedRecords
+ *       the ones dropped because the upload queue was full.
+ *       The queue depths are as of GetStats, and maxUploadQueue is the
+ *       deepest the upload queue has been.
+ *       The latencies are:
+ *           readInterval  between the source's reads, which should stay
+ *                         at scansPerRead / scanRate whatever the sink does
+ *           convert       from the read to the block being converted
+ *           average       from the read of a window's last block to its
+ *                         record
+ *           upload        from a record to the sink taking it
+ *           send          of each Send call
+ *           endToEnd      from the read of a window's last block to the
+ *                         sink taking its record
+**/
+struct AcquisitionStats
+{
+	double scanRate;
+	double elapsedSeconds;
+	long long scans;
+	long long blocks;
+	long long skippedSamples;
+	long long readErrors;
+	long long records;
+	long long uploads;
+	long long failedUploads;
+	long long droppedRecords;
+	int maxDeviceScanBacklog;
+	int maxLJMScanBacklog;
+	int convertQueue;
+	int averageQueue;
+	int uploadQueue;
+	int maxUploadQueue;
+	double scansPerSecond;
+	double convertSamplesPerSecond;
+	AcquisitionLatency readInterval;
+	AcquisitionLatency convert;
+	AcquisitionLatency average;
+	AcquisitionLatency upload;
+	AcquisitionLatency send;
+	AcquisitionLatency endToEnd;
+};
+
+/**
+ * Desc: Writes stats to path in the Prometheus text format, all names
+ *       starting with ljm_acquisition_. Writes path.tmp and renames it over
+ *       path, so a scraper never sees half a file.
+ * Retr: LJME_NOERROR, or LJME_INVALID_PARAMETER if the file can't be
+ *       written.
+**/
+int WriteAcquisitionMetrics(const AcquisitionStats & stats, const char * path);
+
+/**
+ * Name: BoundedQueue
+ * Desc: A queue of at most capacity items between threads. Close wakes the
+ *       waiting threads; Pop still returns what was queued before it.
+**/
+template <typename T>
+class BoundedQueue
+{
+public:
+	BoundedQueue(int capacity = 64) : capacity(capacity), closed(false), maxSize(0) {}
+
+	/**
+	 * Desc: Waits for room, then queues item.
+	 * Retr: false if the queue is closed.
+	**/
+	bool Push(T && item);
+
+	/**
+	 * Desc: Queues item without waiting, dropping the oldest item first if
+	 *       the queue is full.
+	 * Retr: The number of items dropped, 0 or 1.
+	**/
+	int PushDropOldest(T && item);
+
+	/**
+	 * Desc: Waits for an item and moves it into item.
+	 * Retr: false once the queue is closed and empty.
+	**/
+	bool Pop(T * item);
+
+	void Close();
+
+	/**
+	 * Desc: Empties the queue and reopens it with a new capacity.
+	**/
+	void Open(int newCapacity);
+	int Size();
+	int MaxSize();
+
+private:
+	int capacity;
+	bool closed;
+	int maxSize;
+	std::deque<T> items;
+	std::mutex mutex;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+};
+
+/**
+ * Desc: One read's scans, and when the read returned.
+**/
+struct AcquisitionBlock
+{
+	std::vector<double> data;
+	int numScans;
+	AcquisitionClock::time_point read;
+};
+
+/**
+ * Desc: One window's averages, in the order of AcquisitionConfig::upload,
+ *       NaN where a field has no valid value.
+**/
+struct AcquisitionRecord
+{
+	long long window;
+	int x;
+	int y;
+	std::vector<double> values;
+	AcquisitionClock::time_point read;
+	AcquisitionClock::time_point averaged;
+};
+
+/**
+ * Name: AcquisitionPipeline
+ * Desc: Runs the acquire, convert, average and upload stages. Each record
+ *       becomes one call
+ *           insertData ["ROOM", {"x": X, "y": Y, "FIELD": VALUE, ...}]
+ *       like trade_fair.py's, without the fields that are NaN.
+ * Note: The block queues wait for room, which only happens if converting or
+ *       averaging falls behind the scan rate; LJM then buffers the scans,
+ *       and maxLJMScanBacklog shows it.
+**/
+class AcquisitionPipeline
+{
+public:
+	AcquisitionPipeline();
+	~AcquisitionPipeline();
+
+	/**
+	 * Desc: Starts the source and the stage threads. The pipeline doesn't
+	 *       own source or sink, and they must outlive Stop.
+	 * Retr: LJME_NOERROR, LJME_INVALID_PARAMETER if config has no channels
+	 *       or a conversion can't be set up, or the error of source's Start.
+	**/
+	int Start(const AcquisitionConfig & config, AcquisitionSource * source,
+		UploadSink * sink);
+
+	/**
+	 * Desc: Stops acquiring, then lets the stages finish what they have. A
+	 *       partly filled window is discarded.
+	 * Retr: LJME_NOERROR, or the read error that stopped acquiring early.
+	**/
+	int Stop();
+
+	/**
+	 * Desc: Returns false if acquiring has stopped because of an error.
+	**/
+	bool Running() const { return !failed.load(); }
+
+	void GetStats(AcquisitionStats * stats);
+
+private:
+	void Acquire();
+	void Convert();
+	void Average();
+	void Upload();
+	void FinishWindow(AcquisitionClock::time_point read);
+	std::string Params(const AcquisitionRecord & record) const;
+
+	AcquisitionConfig config;
+	AcquisitionSource * source;
+	UploadSink * sink;
+	std::vector<std::string> fields;
+	int numChannels;
+	int windowScans;
+
+	// Convert thread only
+	SensorBlockConverter converter;
+	std::vector<int> ambientChannels;
+	std::vector<int> radiantChannels;
+
+	// Average thread only
+	std::vector<double> sums;
+	std::vector<int> counts;
+	int scansInWindow;
+	long long window;
+	int x;
+	int y;
+
+	BoundedQueue<AcquisitionBlock> convertQueue;
+	BoundedQueue<AcquisitionBlock> averageQueue;
+	BoundedQueue<AcquisitionRecord> uploadQueue;
+	std::thread acquirer;
+	std::thread converterThread;
+	std::thread averager;
+	std::thread uploader;
+
+	std::atomic<bool> stopping;
+	std::atomic<bool> failed;
+	int stopError;
+
+	std::mutex mutex;
+	AcquisitionStats stats;
+	double convertBusySeconds;
+	AcquisitionClock::time_point start;
+};
+
+
+// Source
+
+inline AcquisitionConfig::AcquisitionConfig() :
+	room("BBW281"),
+	scanRate(100),
+	scansPerRead(50),
+	averageSeconds(10),
+	gridX(4),
+	gridY(4),
+	uploadQueueLength(64),
+	blockQueueLength(64),
+	activity(ComfortTradeFairActivity())
+{
+	for (int i = 0; i < 4; i++) {
+		comfort[i] = -1;
+	}
+}
+
+inline std::vector<std::string> AcquisitionConfig::Fields() const
+{
+	std::vector<std::string> result;
+	for (size_t i = 0; i < channels.size(); i++) {
+		result.push_back(channels[i].field);
+	}
+	for (size_t i = 0; i < magnitudes.size(); i++) {
+		result.push_back(magnitudes[i].field);
+	}
+	if (comfort[0] >= 0) {
+		result.push_back("pmv");
+		result.push_back("ppd");
+	}
+	return result;
+}
+
+inline int AcquisitionConfig::FieldIndex(const std::string & field) const
+{
+	std::vector<std::string> all = Fields();
+	for (size_t i = 0; i < all.size(); i++) {
+		if (all[i] == field) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+// Splits text at spaces and tabs
+inline std::vector<std::string> AcquisitionWords(const char * text)
+{
+	std::vector<std::string> words;
+	while (*text != '\0') {
+		while (*text == ' ' || *text == '\t') {
+			text++;
+		}
+		const char * wordStart = text;
+		while (*text != '\0' && *text != ' ' && *text != '\t') {
+			text++;
+		}
+		if (text > wordStart) {
+			words.push_back(std::string(wordStart, text - wordStart));
+		}
+	}
+	return words;
+}
+
+// Parses words[first...] as numbers into numbers. Returns false unless
+// there are between minCount and maxCount of them.
+inline bool AcquisitionNumbers(const std::vector<std::string> & words, size_t first,
+	size_t minCount, size_t maxCount, std::vector<double> * numbers)
+{
+	numbers->clear();
+	for (size_t i = first; i < words.size(); i++) {
+		char * parsedEnd;
+		double number = strtod(words[i].c_str(), &parsedEnd);
+		if (*parsedEnd != '\0') {
+			return false;
+		}
+		numbers->push_back(number);
+	}
+	return numbers->size() >= minCount && numbers->size() <= maxCount;
+}
+
+inline int AcquisitionConfig::ParseLine(char * line,
+	std::vector<std::vector<std::string> > * magnitudeComponents,
+	std::vector<std::string> * comfortFields, std::vector<std::string> * uploadFields)
+{
+	char * equals = strchr(line, '=');
+	if (equals == NULL) {
+		return LJME_INVALID_NAME;
+	}
+	*equals = '\0';
+	std::vector<std::string> key = AcquisitionWords(line);
+	std::vector<std::string> value = AcquisitionWords(equals + 1);
+	std::vector<double> numbers;
+	if (key.empty() || value.empty() || key.size() > 2) {
+		return LJME_INVALID_VALUE;
+	}
+	const std::string & name = key[0];
+
+	if (key.size() == 1) {
+		if (name == "room") {
+			room = value[0];
+			return value.size() == 1 ? LJME_NOERROR : LJME_INVALID_VALUE;
+		}
+		if (name == "comfort") {
+			*comfortFields = value;
+			return value.size() == 4 ? LJME_NOERROR : LJME_INVALID_VALUE;
+		}
+		if (name == "upload") {
+			*uploadFields = value;
+			return LJME_NOERROR;
+		}
+		if (name == "grid") {
+			if (!AcquisitionNumbers(value, 0, 2, 2, &numbers) || numbers[0] < 1 ||
+				numbers[1] < 1)
+			{
+				return LJME_INVALID_VALUE;
+			}
+			gridX = (int)numbers[0];
+			gridY = (int)numbers[1];
+			return LJME_NOERROR;
+		}
+
+		if (!AcquisitionNumbers(value, 0, 1, 1, &numbers) || !(numbers[0] > 0)) {
+			return LJME_INVALID_VALUE;
+		}
+		double number = numbers[0];
+		if (name == "scan_rate") {
+			scanRate = number;
+		}
+		else if (name == "scans_per_read") {
+			scansPerRead = (int)number;
+		}
+		else if (name == "average_seconds") {
+			averageSeconds = number;
+		}
+		else if (name == "upload_queue") {
+			uploadQueueLength = (int)number;
+		}
+		else if (name == "block_queue") {
+			blockQueueLength = (int)number;
+		}
+		else if (name == "met") {
+			activity.met = number;
+		}
+		else if (name == "clo") {
+			activity.clo = number;
+		}
+		else {
+			return LJME_INVALID_NAME;
+		}
+		return LJME_NOERROR;
+	}
+
+	const std::string & field = key[1];
+	if (name == "channel") {
+		AcquisitionChannel channel;
+		channel.field = field;
+		channel.name = value[0];
+		channel.conversion = ACQUISITION_DESCRIPTOR;
+		channel.sensor = VoltsSensor();
+		channel.simulateVolts = 1;
+		if (value.size() < 2) {
+			return LJME_INVALID_VALUE;
+		}
+
+		const std::string & sensor = value[1];
+		bool valid = true;
+		if (sensor == "volts") {
+			valid = AcquisitionNumbers(value, 2, 0, 0, &numbers);
+		}
+		else if (sensor == "linear") {
+			valid = AcquisitionNumbers(value, 2, 1, 2, &numbers);
+			if (valid) {
+				channel.sensor = LinearSensor(numbers[0], numbers.size() > 1 ? numbers[1] : 0);
+			}
+		}
+		else if (sensor == "rtd_divider") {
+			valid = AcquisitionNumbers(value, 2, 4, 4, &numbers);
+			if (valid) {
+				channel.sensor = RtdDividerSensor(numbers[0], numbers[1], numbers[2],
+					numbers[3]);
+			}
+		}
+		else if (sensor == "thermistor_divider") {
+			valid = AcquisitionNumbers(value, 2, 3, 3, &numbers);
+			if (valid) {
+				channel.sensor = ThermistorDividerSensor(numbers[0], numbers[1], numbers[2]);
+			}
+		}
+		else if (sensor == "comfortbot_radiant") {
+			channel.sensor = ComfortbotRadiantSensor();
+		}
+		else if (sensor == "comfortbot_humidity") {
+			channel.sensor = ComfortbotHumiditySensor();
+		}
+		else if (sensor == "comfortbot_ambient") {
+			channel.sensor = ComfortbotAmbientSensor();
+		}
+		else if (sensor == "comfortbot_anemometer") {
+			channel.sensor = ComfortbotAnemometerSensor();
+		}
+		else if (sensor == "ambient_table") {
+			channel.conversion = ACQUISITION_AMBIENT_TABLE;
+		}
+		else if (sensor == "radiant_table") {
+			channel.conversion = ACQUISITION_RADIANT_TABLE;
+		}
+		else {
+			return LJME_INVALID_NAME;
+		}
+		if (!valid || (sensor.compare(0, 11, "comfortbot_") == 0 && value.size() != 2) ||
+			(channel.conversion != ACQUISITION_DESCRIPTOR && value.size() != 2))
+		{
+			return LJME_INVALID_VALUE;
+		}
+
+		SensorCoefficients coefficients;
+		if (SensorCoefficientsFor(channel.sensor, &coefficients) != LJME_NOERROR) {
+			return LJME_INVALID_VALUE;
+		}
+		channels.push_back(channel);
+		return LJME_NOERROR;
+	}
+	if (name == "simulate") {
+		if (!AcquisitionNumbers(value, 0, 1, 1, &numbers)) {
+			return LJME_INVALID_VALUE;
+		}
+		for (size_t i = 0; i < channels.size(); i++) {
+			if (channels[i].field == field) {
+				channels[i].simulateVolts = numbers[0];
+				return LJME_NOERROR;
+			}
+		}
+		return LJME_INVALID_NAME;
+	}
+	if (name == "magnitude") {
+		AcquisitionMagnitude magnitude;
+		magnitude.field = field;
+		magnitudes.push_back(magnitude);
+		magnitudeComponents->push_back(value);
+		return LJME_NOERROR;
+	}
+	return LJME_INVALID_NAME;
+}
+
+inline int AcquisitionConfig::Load(const char * path, int * errorLine)
+{
+	char line[1024];
+	int lineNumber = 0, err = LJME_NOERROR;
+	std::vector<std::vector<std::string> > magnitudeComponents;
+	std::vector<std::string> comfortFields, uploadFields;
+	FILE * file = fopen(path, "r");
+
+	if (file == NULL) {
+		return LJME_CONSTANTS_FILE_NOT_FOUND;
+	}
+
+	*this = AcquisitionConfig();
+	while (fgets(line, sizeof(line), file) != NULL) {
+		lineNumber++;
+		char * start = line;
+		while (*start == ' ' || *start == '\t') {
+			start++;
+		}
+		char * end = start + strcspn(start, "\r\n");
+		*end = '\0';
+		if (*start == '\0' || *start == '#') {
+			continue;
+		}
+
+		err = ParseLine(start, &magnitudeComponents, &comfortFields, &uploadFields);
+		if (err != LJME_NOERROR) {
+			break;
+		}
+	}
+	fclose(file);
+
+	if (err == LJME_NOERROR) {
+		lineNumber = 0;
+		if (channels.empty()) {
+			err = LJME_INVALID_VALUE;
+		}
+	}
+
+	// Field names resolve once every field is known
+	for (size_t i = 0; err == LJME_NOERROR && i < magnitudes.size(); i++) {
+		const std::vector<std::string> & names = magnitudeComponents[i];
+		for (size_t j = 0; j < names.size(); j++) {
+			int index = FieldIndex(names[j]);
+			if (index < 0 || index >= (int)(channels.size() + i)) {
+				err = LJME_INVALID_NAME;
+				break;
+			}
+			magnitudes[i].components.push_back(index);
+		}
+	}
+	for (size_t i = 0; err == LJME_NOERROR && i < comfortFields.size(); i++) {
+		comfort[i] = FieldIndex(comfortFields[i]);
+		if (comfort[i] < 0 || comfort[i] >= (int)(channels.size() + magnitudes.size())) {
+			err = LJME_INVALID_NAME;
+		}
+	}
+	for (size_t i = 0; err == LJME_NOERROR && i < uploadFields.size(); i++) {
+		int index = FieldIndex(uploadFields[i]);
+		if (index < 0) {
+			err = LJME_INVALID_NAME;
+		}
+		upload.push_back(index);
+	}
+	if (err == LJME_NOERROR && uploadFields.empty()) {
+		for (size_t i = 0; i < Fields().size(); i++) {
+			upload.push_back((int)i);
+		}
+	}
+
+	if (err != LJME_NOERROR && errorLine != NULL) {
+		*errorLine = lineNumber;
+	}
+	return err;
+}
+
+inline int LJMStreamSource::Start(const AcquisitionConfig & config, double * scanRate)
+{
+	int numChannels = (int)config.channels.size();
+	std::vector<const char *> names(numChannels);
+	std::vector<int> aScanList(numChannels);
+	int errorAddress = INITIAL_ERR_ADDRESS;
+
+	for (int i = 0; i < numChannels; i++) {
+		names[i] = config.channels[i].name.c_str();
+	}
+	int err = LJM_NamesToAddresses(numChannels, &names[0], &aScanList[0], NULL);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+
+	// A stream left running by a previous process would make the start
+	// fail. Stopping a stream that isn't running is an error, so the result
+	// is ignored.
+	LJM_eWriteName(handle, "STREAM_ENABLE", 0);
+
+	// The settings of stream/stream_example.c, in one round trip
+	const char * configNames[] = {"STREAM_TRIGGER_INDEX", "STREAM_CLOCK_SOURCE",
+		"STREAM_RESOLUTION_INDEX", "STREAM_SETTLING_US", "AIN_ALL_RANGE",
+		"AIN_ALL_NEGATIVE_CH"};
+	double configValues[] = {0, 0, 0, 0, 0, LJM_GND};
+	err = LJM_eWriteNames(handle, 6, configNames, configValues, &errorAddress);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+
+	*scanRate = config.scanRate;
+	return LJM_eStreamStart(handle, config.scansPerRead, numChannels, &aScanList[0],
+		scanRate);
+}
+
+inline int LJMStreamSource::Read(double * aData, int * deviceScanBacklog,
+	int * LJMScanBacklog)
+{
+	return LJM_eStreamRead(handle, aData, deviceScanBacklog, LJMScanBacklog);
+}
+
+inline int LJMStreamSource::Stop()
+{
+	return LJM_eStreamStop(handle);
+}
+
+inline int SimulatedSource::Start(const AcquisitionConfig & config, double * actualScanRate)
+{
+	numChannels = (int)config.channels.size();
+	scansPerRead = config.scansPerRead;
+	scanRate = config.scanRate;
+	volts.resize(numChannels);
+	for (int i = 0; i < numChannels; i++) {
+		volts[i] = config.channels[i].simulateVolts;
+	}
+	numScans = 0;
+	start = AcquisitionClock::now();
+	*actualScanRate = scanRate;
+	srand(7);
+	return LJME_NOERROR;
+}
+
+inline int SimulatedSource::Read(double * aData, int * deviceScanBacklog,
+	int * LJMScanBacklog)
+{
+	numScans += scansPerRead;
+	AcquisitionClock::time_point due = start + std::chrono::duration_cast<
+		AcquisitionClock::duration>(std::chrono::duration<double>(numScans / scanRate));
+	std::this_thread::sleep_until(due);
+
+	for (int scan = 0; scan < scansPerRead; scan++) {
+		// A 0.2% drift with a period of a minute
+		double drift = 1 + 0.002 * sin(6.283 * (numScans - scansPerRead + scan) /
+			(60 * scanRate));
+		for (int i = 0; i < numChannels; i++) {
+			double noise = 0.002 * (rand() / (double)RAND_MAX - 0.5);
+			aData[scan * numChannels + i] = volts[i] * drift + noise;
+		}
+	}
+
+	double behind = std::chrono::duration<double>(AcquisitionClock::now() - due).count();
+	*deviceScanBacklog = 0;
+	*LJMScanBacklog = (int)(behind * scanRate);
+	return LJME_NOERROR;
+}
+
+inline int LineUploadSink::Open(const char * path)
+{
+	Close();
+	file = fopen(path, "a");
+	if (file == NULL) {
+		file = stdout;
+		return LJME_INVALID_PARAMETER;
+	}
+	return LJME_NOERROR;
+}
+
+inline void LineUploadSink::Close()
+{
+	if (file != stdout) {
+		fclose(file);
+		file = stdout;
+	}
+}
+
+inline int LineUploadSink::Send(const std::string & method, const std::string & params)
+{
+	if (delayMS > 0) {
+		std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(delayMS));
+	}
+	if (fprintf(file, "%s %s\n", method.c_str(), params.c_str()) < 0 || fflush(file) != 0) {
+		return LJME_INVALID_PARAMETER;
+	}
+	return LJME_NOERROR;
+}
+
+inline void AcquisitionLatency::Add(double milliseconds)
+{
+	count++;
+	totalMS += milliseconds;
+	maxMS = milliseconds > maxMS ? milliseconds : maxMS;
+}
+
+inline int WriteAcquisitionMetrics(const AcquisitionStats & stats, const char * path)
+{
+	std::string temporary = std::string(path) + ".tmp";
+	FILE * file = fopen(temporary.c_str(), "w");
+	if (file == NULL) {
+		return LJME_INVALID_PARAMETER;
+	}
+
+	const char * P = "ljm_acquisition_";
+	fprintf(file, "# TYPE %sscans_total counter\n%sscans_total %lld\n", P, P, stats.scans);
+	fprintf(file, "# TYPE %sblocks_total counter\n%sblocks_total %lld\n", P, P, stats.blocks);
+	fprintf(file, "# TYPE %sskipped_samples_total counter\n%sskipped_samples_total %lld\n",
+		P, P, stats.skippedSamples);
+	fprintf(file, "# TYPE %sread_errors_total counter\n%sread_errors_total %lld\n", P, P,
+		stats.readErrors);
+	fprintf(file, "# TYPE %srecords_total counter\n%srecords_total %lld\n", P, P,
+		stats.records);
+	fprintf(file, "# TYPE %suploads_total counter\n%suploads_total %lld\n", P, P,
+		stats.uploads);
+	fprintf(file, "# TYPE %sfailed_uploads_total counter\n%sfailed_uploads_total %lld\n", P, P,
+		stats.failedUploads);
+	fprintf(file, "# TYPE %sdropped_records_total counter\n%sdropped_records_total %lld\n", P,
+		P, stats.droppedRecords);
+	fprintf(file, "# TYPE %sscan_rate gauge\n%sscan_rate %g\n", P, P, stats.scanRate);
+	fprintf(file, "# TYPE %sscans_per_second gauge\n%sscans_per_second %g\n", P, P,
+		stats.scansPerSecond);
+	fprintf(file, "# TYPE %sconvert_samples_per_second gauge\n"
+		"%sconvert_samples_per_second %g\n", P, P, stats.convertSamplesPerSecond);
+	fprintf(file, "# TYPE %smax_scan_backlog gauge\n", P);
+	fprintf(file, "%smax_scan_backlog{buffer=\"device\"} %d\n", P, stats.maxDeviceScanBacklog);
+	fprintf(file, "%smax_scan_backlog{buffer=\"ljm\"} %d\n", P, stats.maxLJMScanBacklog);
+	fprintf(file, "# TYPE %squeue_depth gauge\n", P);
+	fprintf(file, "%squeue_depth{queue=\"convert\"} %d\n", P, stats.convertQueue);
+	fprintf(file, "%squeue_depth{queue=\"average\"} %d\n", P, stats.averageQueue);
+	fprintf(file, "%squeue_depth{queue=\"upload\"} %d\n", P, stats.uploadQueue);
+	fprintf(file, "# TYPE %smax_upload_queue_depth gauge\n%smax_upload_queue_depth %d\n", P,
+		P, stats.maxUploadQueue);
+
+	const char * names[] = {"read_interval", "convert", "average", "upload", "send",
+		"end_to_end"};
+	const AcquisitionLatency * latencies[] = {&stats.readInterval, &stats.convert,
+		&stats.average, &stats.upload, &stats.send, &stats.endToEnd};
+	fprintf(file, "# TYPE %slatency_milliseconds summary\n", P);
+	for (int i = 0; i < 6; i++) {
+		fprintf(file, "%slatency_milliseconds_sum{stage=\"%s\"} %g\n", P, names[i],
+			latencies[i]->totalMS);
+		fprintf(file, "%slatency_milliseconds_count{stage=\"%s\"} %lld\n", P, names[i],
+			latencies[i]->count);
+	}
+	fprintf(file, "# TYPE %smax_latency_milliseconds gauge\n", P);
+	for (int i = 0; i < 6; i++) {
+		fprintf(file, "%smax_latency_milliseconds{stage=\"%s\"} %g\n", P, names[i],
+			latencies[i]->maxMS);
+	}
+
+	if (fclose(file) != 0 || rename(temporary.c_str(), path) != 0) {
+		remove(temporary.c_str());
+		return LJME_INVALID_PARAMETER;
+	}
+	return LJME_NOERROR;
+}
+
+template <typename T>
+inline bool BoundedQueue<T>::Push(T && item)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	notFull.wait(lock, [this] { return closed || (int)items.size() < capacity; });
+	if (closed) {
+		return false;
+	}
+	items.push_back(std::move(item));
+	maxSize = (int)items.size() > maxSize ? (int)items.size() : maxSize;
+	notEmpty.notify_one();
+	return true;
+}
+
+template <typename T>
+inline int BoundedQueue<T>::PushDropOldest(T && item)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	int dropped = 0;
+	if ((int)items.size() >= capacity) {
+		items.pop_front();
+		dropped = 1;
+	}
+	items.push_back(std::move(item));
+	maxSize = (int)items.size() > maxSize ? (int)items.size() : maxSize;
+	notEmpty.notify_one();
+	return dropped;
+}
+
+template <typename T>
+inline bool BoundedQueue<T>::Pop(T * item)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+	if (items.empty()) {
+		return false;
+	}
+	*item = std::move(items.front());
+	items.pop_front();
+	notFull.notify_one();
+	return true;
+}
+
+template <typename T>
+inline void BoundedQueue<T>::Close()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	closed = true;
+	notEmpty.notify_all();
+	notFull.notify_all();
+}
+
+template <typename T>
+inline void BoundedQueue<T>::Open(int newCapacity)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	capacity = newCapacity;
+	closed = false;
+	items.clear();
+	maxSize = 0;
+}
+
+template <typename T>
+inline int BoundedQueue<T>::Size()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return (int)items.size();
+}
+
+template <typename T>
+inline int BoundedQueue<T>::MaxSize()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return maxSize;
+}
+
+inline double AcquisitionMS(AcquisitionClock::time_point from, AcquisitionClock::time_point to)
+{
+	return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+inline AcquisitionPipeline::AcquisitionPipeline() :
+	source(NULL),
+	sink(NULL),
+	numChannels(0),
+	windowScans(1),
+	stopping(false),
+	failed(false),
+	stopError(LJME_NOERROR),
+	convertBusySeconds(0)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+inline AcquisitionPipeline::~AcquisitionPipeline()
+{
+	Stop();
+}
+
+inline int AcquisitionPipeline::Start(const AcquisitionConfig & newConfig,
+	AcquisitionSource * newSource, UploadSink * newSink)
+{
+	Stop();
+
+	config = newConfig;
+	source = newSource;
+	sink = newSink;
+	fields = config.Fields();
+	numChannels = (int)config.channels.size();
+	if (numChannels == 0 || config.scansPerRead < 1) {
+		return LJME_INVALID_PARAMETER;
+	}
+
+	std::vector<SensorDescriptor> sensors;
+	ambientChannels.clear();
+	radiantChannels.clear();
+	for (int i = 0; i < numChannels; i++) {
+		const AcquisitionChannel & channel = config.channels[i];
+		sensors.push_back(channel.sensor);
+		if (channel.conversion == ACQUISITION_AMBIENT_TABLE) {
+			ambientChannels.push_back(i);
+		}
+		else if (channel.conversion == ACQUISITION_RADIANT_TABLE) {
+			radiantChannels.push_back(i);
+		}
+	}
+	int err = converter.SetChannels(sensors);
+	if (err != LJME_NOERROR) {
+		return LJME_INVALID_PARAMETER;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	err = source->Start(config, &stats.scanRate);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+
+	// A window of at least one read, of whole scans
+	windowScans = (int)(config.averageSeconds * stats.scanRate + 0.5);
+	windowScans = windowScans < 1 ? 1 : windowScans;
+	sums.assign(fields.size(), 0);
+	counts.assign(numChannels, 0);
+	scansInWindow = 0;
+	window = 0;
+	x = 0;
+	y = 0;
+
+	convertQueue.Open(config.blockQueueLength);
+	averageQueue.Open(config.blockQueueLength);
+	uploadQueue.Open(config.uploadQueueLength);
+
+	convertBusySeconds = 0;
+	stopping = false;
+	failed = false;
+	stopError = LJME_NOERROR;
+	start = AcquisitionClock::now();
+
+	uploader = std::thread(&AcquisitionPipeline::Upload, this);
+	averager = std::thread(&AcquisitionPipeline::Average, this);
+	converterThread = std::thread(&AcquisitionPipeline::Convert, this);
+	acquirer = std::thread(&AcquisitionPipeline::Acquire, this);
+	return LJME_NOERROR;
+}
+
+inline int AcquisitionPipeline::Stop()
+{
+	if (!acquirer.joinable()) {
+		return LJME_NOERROR;
+	}
+
+	// Each stage closes the next one's queue once its own input runs out.
+	// Rates are over the time spent acquiring, not draining the queues.
+	stopping = true;
+	acquirer.join();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.elapsedSeconds = std::chrono::duration<double>(AcquisitionClock::now() -
+			start).count();
+	}
+	converterThread.join();
+	averager.join();
+	uploader.join();
+
+	return stopError;
+}
+
+inline void AcquisitionPipeline::GetStats(AcquisitionStats * result)
+{
+	int convertDepth = convertQueue.Size();
+	int averageDepth = averageQueue.Size();
+	int uploadDepth = uploadQueue.Size();
+	int maxUploadDepth = uploadQueue.MaxSize();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	*result = stats;
+	if (acquirer.joinable()) {
+		result->elapsedSeconds = std::chrono::duration<double>(AcquisitionClock::now() -
+			start).count();
+	}
+	result->convertQueue = convertDepth;
+	result->averageQueue = averageDepth;
+	result->uploadQueue = uploadDepth;
+	result->maxUploadQueue = maxUploadDepth;
+	result->scansPerSecond = result->elapsedSeconds > 0 ?
+		result->scans / result->elapsedSeconds : 0;
+	result->convertSamplesPerSecond = convertBusySeconds > 0 ?
+		result->scans * (double)numChannels / convertBusySeconds : 0;
+}
+
+inline void AcquisitionPipeline::Acquire()
+{
+	AcquisitionClock::time_point lastRead = start;
+
+	while (!stopping) {
+		AcquisitionBlock block;
+		int deviceScanBacklog = 0, LJMScanBacklog = 0;
+		block.data.resize((size_t)config.scansPerRead * numChannels);
+		block.numScans = config.scansPerRead;
+
+		int err = source->Read(&block.data[0], &deviceScanBacklog, &LJMScanBacklog);
+		block.read = AcquisitionClock::now();
+		if (err != LJME_NOERROR) {
+			std::lock_guard<std::mutex> lock(mutex);
+			stats.readErrors++;
+			stopError = err;
+			failed = true;
+			break;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stats.scans += block.numScans;
+			stats.blocks++;
+			stats.readInterval.Add(AcquisitionMS(lastRead, block.read));
+			stats.maxDeviceScanBacklog = deviceScanBacklog > stats.maxDeviceScanBacklog ?
+				deviceScanBacklog : stats.maxDeviceScanBacklog;
+			stats.maxLJMScanBacklog = LJMScanBacklog > stats.maxLJMScanBacklog ?
+				LJMScanBacklog : stats.maxLJMScanBacklog;
+		}
+		lastRead = block.read;
+		convertQueue.Push(std::move(block));
+	}
+
+	source->Stop();
+	convertQueue.Close();
+}
+
+inline void AcquisitionPipeline::Convert()
+{
+	const SensorTable<COMFORTBOT_TABLE_SEGMENTS> & ambient = ComfortbotAmbientTable();
+	const SensorTable<COMFORTBOT_TABLE_SEGMENTS> & radiant = ComfortbotRadiantTable();
+	AcquisitionBlock block;
+
+	while (convertQueue.Pop(&block)) {
+		AcquisitionClock::time_point begin = AcquisitionClock::now();
+		double * aData = &block.data[0];
+		int numValues = block.numScans * numChannels;
+
+		// Skipped scans become NaN, which averaging leaves out
+		int skipped = 0;
+		for (int i = 0; i < numValues; i++) {
+			if (aData[i] == LJM_DUMMY_VALUE) {
+				aData[i] = NAN;
+				skipped++;
+			}
+		}
+
+		// Table channels pass through the converter unchanged as volts. The
+		// tables would turn NaN into a temperature, so they skip it.
+		converter.Convert(aData, numValues);
+		for (size_t t = 0; t < ambientChannels.size() + radiantChannels.size(); t++) {
+			bool isAmbient = t < ambientChannels.size();
+			int channel = isAmbient ? ambientChannels[t] :
+				radiantChannels[t - ambientChannels.size()];
+			const SensorTable<COMFORTBOT_TABLE_SEGMENTS> & table = isAmbient ? ambient : radiant;
+			for (int i = channel; i < numValues; i += numChannels) {
+				aData[i] = isnan(aData[i]) ? aData[i] : table.Convert(aData[i]);
+			}
+		}
+
+		AcquisitionClock::time_point end = AcquisitionClock::now();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stats.skippedSamples += skipped;
+			stats.convert.Add(AcquisitionMS(block.read, end));
+			convertBusySeconds += std::chrono::duration<double>(end - begin).count();
+		}
+		averageQueue.Push(std::move(block));
+	}
+
+	averageQueue.Close();
+}
+
+inline void AcquisitionPipeline::Average()
+{
+	AcquisitionBlock block;
+
+	while (averageQueue.Pop(&block)) {
+		int scan = 0;
+		while (scan < block.numScans) {
+			int numScans = block.numScans - scan;
+			numScans = numScans < windowScans - scansInWindow ?
+				numScans : windowScans - scansInWindow;
+
+			const double * aData = &block.data[(size_t)scan * numChannels];
+			for (int i = 0; i < numScans * numChannels; i++) {
+				if (!isnan(aData[i])) {
+					sums[i % numChannels] += aData[i];
+					counts[i % numChannels]++;
+				}
+			}
+
+			scan += numScans;
+			scansInWindow += numScans;
+			if (scansInWindow == windowScans) {
+				FinishWindow(block.read);
+			}
+		}
+	}
+
+	uploadQueue.Close();
+}
+
+inline void AcquisitionPipeline::FinishWindow(AcquisitionClock::time_point read)
+{
+	std::vector<double> averages(fields.size(), NAN);
+	for (int i = 0; i < numChannels; i++) {
+		averages[i] = counts[i] > 0 ? sums[i] / counts[i] : NAN;
+	}
+	for (size_t m = 0; m < config.magnitudes.size(); m++) {
+		const std::vector<int> & components = config.magnitudes[m].components;
+		double sumOfSquares = 0;
+		for (size_t c = 0; c < components.size(); c++) {
+			sumOfSquares += averages[components[c]] * averages[components[c]];
+		}
+		averages[numChannels + m] = sqrt(sumOfSquares);
+	}
+	if (config.comfort[0] >= 0) {
+		size_t pmvIndex = numChannels + config.magnitudes.size();
+		ComfortPmvPpd(averages[config.comfort[0]], averages[config.comfort[1]],
+			averages[config.comfort[2]], averages[config.comfort[3]], config.activity,
+			&averages[pmvIndex], &averages[pmvIndex + 1]);
+	}
+
+	AcquisitionRecord record;
+	record.window = window++;
+	record.x = x;
+	record.y = y;
+	for (size_t i = 0; i < config.upload.size(); i++) {
+		record.values.push_back(averages[config.upload[i]]);
+	}
+	record.read = read;
+	record.averaged = AcquisitionClock::now();
+
+	// Step through the grid like trade_fair.py
+	if (++x >= config.gridX) {
+		x = 0;
+		y = (y + 1) % config.gridY;
+	}
+	sums.assign(sums.size(), 0);
+	counts.assign(counts.size(), 0);
+	scansInWindow = 0;
+
+	int dropped = uploadQueue.PushDropOldest(std::move(record));
+
+	std::lock_guard<std::mutex> lock(mutex);
+	stats.records++;
+	stats.droppedRecords += dropped;
+	stats.average.Add(AcquisitionMS(read, AcquisitionClock::now()));
+}
+
+inline std::string AcquisitionPipeline::Params(const AcquisitionRecord & record) const
+{
+	char number[64];
+	std::string params = "[\"" + config.room + "\", {";
+
+	snprintf(number, sizeof(number), "\"x\": %d, \"y\": %d", record.x, record.y);
+	params += number;
+	for (size_t i = 0; i < record.values.size(); i++) {
+		// NaN isn't valid JSON
+		if (isnan(record.values[i]) || isinf(record.values[i])) {
+			continue;
+		}
+		snprintf(number, sizeof(number), "%.10g", record.values[i]);
+		params += ", \"" + fields[config.upload[i]] + "\": " + number;
+	}
+	return params + "}]";
+}
+
+inline void AcquisitionPipeline::Upload()
+{
+	AcquisitionRecord record;
+
+	while (uploadQueue.Pop(&record)) {
+		AcquisitionClock::time_point begin = AcquisitionClock::now();
+		int err = sink->Send("insertData", Params(record));
+		AcquisitionClock::time_point end = AcquisitionClock::now();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.send.Add(AcquisitionMS(begin, end));
+		if (err != LJME_NOERROR) {
+			stats.failedUploads++;
+			continue;
+		}
+		stats.uploads++;
+		stats.upload.Add(AcquisitionMS(record.averaged, end));
+		stats.endToEnd.Add(AcquisitionMS(record.read, end));
+	}
+}
+
+#endif // #ifndef LJM_ACQUISITION_PIPELINE
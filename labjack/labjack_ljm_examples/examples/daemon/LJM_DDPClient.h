@@ -0,0 +1,1077 @@
+/**
+ * Name: LJM_DDPClient.h
+ * Desc: A DDP (Meteor's Distributed Data Protocol) client over WebSocket that
+ *       keeps many method calls in flight. ddp-json.py's DDPClient.send
+ *       waits for each call's result and updated messages before the next
+ *       call goes out, and its pending state holds a single id, so every
+ *       insertData costs a full round trip to the server. A DDPClient gives
+ *       each call its own id, sends up to maxInFlight calls without
+ *       waiting, matches the server's answers to them by id and completes
+ *       each one asynchronously on its I/O thread. C++11, POSIX only.
+**/
+
+#ifndef LJM_DDP_CLIENT
+#define LJM_DDP_CLIENT
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LabJackM.h"
+
+#include "LJM_WebSocket.h"
+
+enum { DDP_DEFAULT_MAX_IN_FLIGHT = 64 };
+enum { DDP_DEFAULT_TIMEOUT_MS = 10000 };
+
+// Largest message, after reassembling fragments, a DDPClient accepts
+enum { DDP_MAX_MESSAGE_SIZE = 16 * 1024 * 1024 };
+
+// The error a call completes with when the server answers it with an error
+enum { DDP_METHOD_ERROR = LJME_UNKNOWN_ERROR };
+
+/**
+ * Desc: Called once per DDPClient::Call, on the client's I/O thread. On
+ *       success, err is LJME_NOERROR and result is the JSON text of the
+ *       method's result. Otherwise err is DDP_METHOD_ERROR with the server's
+ *       reason in result, LJME_NO_RESPONSE_BYTES_RECEIVED if the call timed
+ *       out, or LJME_SOCKET_LEVEL_ERROR if the connection was lost or closed
+ *       first.
+**/
+typedef std::function<void(int err, const std::string & result)> DDPCompletion;
+
+/**
+ * Desc: Returns text as a JSON string literal.
+**/
+std::string DDPQuote(const std::string & text);
+
+/**
+ * Desc: Returns the JSON string literal quoted as text, or quoted itself if
+ *       it isn't a string literal.
+**/
+std::string DDPUnquote(const std::string & quoted);
+
+/**
+ * Desc: Finds key among the members of the JSON object message.
+ * Para: value, set to the JSON text of key's value.
+ * Retr: Whether message has key.
+**/
+bool DDPFindField(const std::string & message, const char * key, std::string * value);
+
+/**
+ * Desc: Sets elements to the JSON text of each element of the JSON array
+ *       array.
+**/
+void DDPSplitArray(const std::string & array, std::vector<std::string> * elements);
+
+/**
+ * Desc: Counters for a DDPClient. completed counts calls the server
+ *       answered with a result, failed the ones that completed with an
+ *       error, of which methodErrors the server answered with an error and
+ *       timedOut got no complete answer within the timeout.
+ *       staleMessages counts answers to calls that had already completed.
+ *       Latency is from Call until the completion, including the time the
+ *       call waited for room to be sent; round trip is from when it was sent.
+**/
+struct DDPClientStats
+{
+	long long submitted;
+	long long completed;
+	long long failed;
+	long long methodErrors;
+	long long timedOut;
+	long long staleMessages;
+	long long serverErrors;
+	int maxInFlight;
+	double totalLatencyUS;
+	double maxLatencyUS;
+	double totalRoundTripUS;
+	double maxRoundTripUS;
+};
+
+/**
+ * Name: DDPClient
+ * Desc: Calls are sent in the order they were made while fewer than
+ *       maxInFlight are unanswered; the rest wait in a queue. A call is
+ *       complete once the server has sent both its result and its updated
+ *       message, as ddp-json.py waits for, and times out timeoutMS after it
+ *       was sent. A call is never resent: a DDP method isn't known to be
+ *       safe to run twice.
+ * Note: Call, Drain and GetStats may be used from any thread. Completions
+ *       run on the I/O thread, one at a time, and shouldn't block; they may
+ *       call Call.
+**/
+class DDPClient
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	DDPClient(int maxInFlight = DDP_DEFAULT_MAX_IN_FLIGHT,
+		int timeoutMS = DDP_DEFAULT_TIMEOUT_MS);
+	~DDPClient();
+
+	/**
+	 * Desc: Opens a WebSocket to ipAddress:port at path, sends DDP's connect
+	 *       message and waits for connected, for at most timeoutMS in all.
+	 * Para: ipAddress, as returned by LJM_IPToNumber.
+	 * Retr: LJME_NOERROR or LJME_CANNOT_CONNECT.
+	**/
+	int Connect(unsigned int ipAddress, int port, const char * path = "/websocket");
+
+	/**
+	 * Desc: Closes the connection. Calls that haven't completed complete
+	 *       with LJME_SOCKET_LEVEL_ERROR.
+	**/
+	void Close();
+	bool IsConnected();
+
+	void SetMaxInFlight(int newMaxInFlight);
+	int GetMaxInFlight();
+
+	/**
+	 * Desc: Calls method with params, the JSON text of an array, and returns
+	 *       at once. completion is called when the call completes; if not
+	 *       connected, before Call returns.
+	**/
+	void Call(const std::string & method, const std::string & params,
+		DDPCompletion completion);
+
+	/**
+	 * Desc: Waits until the completion of every call has returned, for at
+	 *       most timeoutMS, or as long as it takes if timeoutMS is negative.
+	 *       Mustn't be called from a completion.
+	 * Retr: LJME_NOERROR, LJME_NO_RESPONSE_BYTES_RECEIVED on timeout, or
+	 *       LJME_SOCKET_LEVEL_ERROR if the connection was lost.
+	**/
+	int Drain(int timeoutMS = -1);
+
+	int NumQueued();
+	int NumInFlight();
+
+	void GetStats(DDPClientStats * result);
+
+private:
+	struct MethodCall
+	{
+		std::string method;
+		std::string params;
+		DDPCompletion completion;
+		Clock::time_point submitted;
+		Clock::time_point sent;
+		Clock::time_point deadline;
+		bool resulted;
+		bool updated;
+		int err;
+		std::string result;
+	};
+
+	struct Completion
+	{
+		DDPCompletion completion;
+		int err;
+		std::string result;
+	};
+
+	typedef std::map<long long, MethodCall> CallMap;
+
+	int Wait(short events, Clock::time_point deadline);
+	int Flush();
+	int FlushUntil(Clock::time_point deadline);
+	int ReceiveMessages(std::vector<std::string> * messages);
+	void AppendMessage(const std::string & message);
+	uint32_t NextMask();
+
+	void Run();
+	void RunCompletions(std::vector<Completion> & completions);
+	void SendAllowed();
+	void HandleMessage(const std::string & message, std::vector<Completion> & completions);
+	void ExpireTimedOut(std::vector<Completion> & completions);
+	void Finish(MethodCall & call, int err, std::vector<Completion> & completions);
+	void FailAll(int err, std::vector<Completion> & completions);
+
+	int sock;
+	int wakePipe[2];
+	int maxInFlight;
+	std::chrono::milliseconds timeout;
+	long long nextID;
+	uint32_t maskState;
+	bool connected;
+	bool stopping;
+	bool wakePending;
+
+	// Calls made while connected whose completion hasn't finished running
+	long long numUnfinished;
+
+	// Only the thread that owns the connection, Connect's caller and then
+	// the I/O thread, touches these
+	std::vector<unsigned char> unsent;
+	std::vector<unsigned char> received;
+	std::string fragments;
+
+	std::mutex mutex;
+	std::condition_variable idle;
+	std::deque<MethodCall> queued;
+	CallMap inFlight;
+	std::thread io;
+	DDPClientStats stats;
+};
+
+
+// Source
+
+inline std::string DDPQuote(const std::string & text)
+{
+	std::string quoted = "\"";
+	char escape[8];
+
+	for (size_t i = 0; i < text.size(); i++) {
+		unsigned char c = (unsigned char)text[i];
+		if (c == '"' || c == '\\') {
+			quoted += '\\';
+			quoted += (char)c;
+		}
+		else if (c < 0x20) {
+			snprintf(escape, sizeof(escape), "\\u%04x", c);
+			quoted += escape;
+		}
+		else {
+			quoted += (char)c;
+		}
+	}
+	return quoted + "\"";
+}
+
+static inline void DDPAppendUTF8(std::string & text, unsigned long codePoint)
+{
+	if (codePoint < 0x80) {
+		text += (char)codePoint;
+	}
+	else if (codePoint < 0x800) {
+		text += (char)(0xC0 | (codePoint >> 6));
+		text += (char)(0x80 | (codePoint & 0x3F));
+	}
+	else if (codePoint < 0x10000) {
+		text += (char)(0xE0 | (codePoint >> 12));
+		text += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+		text += (char)(0x80 | (codePoint & 0x3F));
+	}
+	else {
+		text += (char)(0xF0 | (codePoint >> 18));
+		text += (char)(0x80 | ((codePoint >> 12) & 0x3F));
+		text += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+		text += (char)(0x80 | (codePoint & 0x3F));
+	}
+}
+
+inline std::string DDPUnquote(const std::string & quoted)
+{
+	std::string text;
+
+	if (quoted.size() < 2 || quoted[0] != '"' || quoted[quoted.size() - 1] != '"') {
+		return quoted;
+	}
+	for (size_t i = 1; i + 1 < quoted.size(); i++) {
+		if (quoted[i] != '\\' || i + 2 >= quoted.size()) {
+			text += quoted[i];
+			continue;
+		}
+		char c = quoted[++i];
+		if (c == 'b') {
+			text += '\b';
+		}
+		else if (c == 'f') {
+			text += '\f';
+		}
+		else if (c == 'n') {
+			text += '\n';
+		}
+		else if (c == 'r') {
+			text += '\r';
+		}
+		else if (c == 't') {
+			text += '\t';
+		}
+		else if (c == 'u' && i + 5 < quoted.size()) {
+			unsigned long codePoint = strtoul(quoted.substr(i + 1, 4).c_str(), NULL, 16);
+			i += 4;
+			// A surrogate pair is one code point
+			if (codePoint >= 0xD800 && codePoint < 0xDC00 && i + 7 < quoted.size() &&
+				quoted[i + 1] == '\\' && quoted[i + 2] == 'u')
+			{
+				unsigned long low = strtoul(quoted.substr(i + 3, 4).c_str(), NULL, 16);
+				if (low >= 0xDC00 && low < 0xE000) {
+					codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+					i += 6;
+				}
+			}
+			DDPAppendUTF8(text, codePoint);
+		}
+		else {
+			text += c;
+		}
+	}
+	return text;
+}
+
+static inline size_t DDPSkipSpace(const std::string & json, size_t i)
+{
+	while (i < json.size() && (json[i] == ' ' || json[i] == '\t' || json[i] == '\n' ||
+		json[i] == '\r'))
+	{
+		i++;
+	}
+	return i;
+}
+
+/**
+ * Desc: Returns the index just past the JSON value that starts at i.
+**/
+static inline size_t DDPSkipValue(const std::string & json, size_t i)
+{
+	int depth = 0;
+	bool inString = false;
+
+	for (; i < json.size(); i++) {
+		char c = json[i];
+		if (inString) {
+			if (c == '\\') {
+				i++;
+			}
+			else if (c == '"') {
+				inString = false;
+				if (depth == 0) {
+					return i + 1;
+				}
+			}
+		}
+		else if (c == '"') {
+			inString = true;
+		}
+		else if (c == '{' || c == '[') {
+			depth++;
+		}
+		else if (c == '}' || c == ']') {
+			if (depth == 0) {
+				return i;
+			}
+			if (--depth == 0) {
+				return i + 1;
+			}
+		}
+		else if (depth == 0 && (c == ',' || c == ' ' || c == '\t' || c == '\n' ||
+			c == '\r'))
+		{
+			return i;
+		}
+	}
+	return i;
+}
+
+inline bool DDPFindField(const std::string & message, const char * key, std::string * value)
+{
+	size_t keyLength = strlen(key);
+	size_t i = DDPSkipSpace(message, 0);
+
+	if (i >= message.size() || message[i] != '{') {
+		return false;
+	}
+	i++;
+
+	while (true) {
+		i = DDPSkipSpace(message, i);
+		if (i >= message.size() || message[i] != '"') {
+			return false;
+		}
+		size_t keyEnd = DDPSkipValue(message, i);
+		bool match = keyEnd - i == keyLength + 2 &&
+			message.compare(i + 1, keyLength, key) == 0;
+
+		i = DDPSkipSpace(message, keyEnd);
+		if (i >= message.size() || message[i] != ':') {
+			return false;
+		}
+		i = DDPSkipSpace(message, i + 1);
+		size_t valueEnd = DDPSkipValue(message, i);
+		if (match) {
+			*value = message.substr(i, valueEnd - i);
+			return true;
+		}
+
+		i = DDPSkipSpace(message, valueEnd);
+		if (i >= message.size() || message[i] != ',') {
+			return false;
+		}
+		i++;
+	}
+}
+
+inline void DDPSplitArray(const std::string & array, std::vector<std::string> * elements)
+{
+	size_t i = DDPSkipSpace(array, 0);
+
+	elements->clear();
+	if (i >= array.size() || array[i] != '[') {
+		return;
+	}
+	i = DDPSkipSpace(array, i + 1);
+	while (i < array.size() && array[i] != ']') {
+		size_t end = DDPSkipValue(array, i);
+		if (end == i) {
+			return;
+		}
+		elements->push_back(array.substr(i, end - i));
+		i = DDPSkipSpace(array, end);
+		if (i < array.size() && array[i] == ',') {
+			i = DDPSkipSpace(array, i + 1);
+		}
+	}
+}
+
+inline DDPClient::DDPClient(int maxInFlight, int timeoutMS) :
+	sock(-1),
+	maxInFlight(maxInFlight > 0 ? maxInFlight : 1),
+	timeout(timeoutMS),
+	nextID(1),
+	maskState((uint32_t)Clock::now().time_since_epoch().count() ^
+		(uint32_t)(size_t)this),
+	connected(false),
+	stopping(false),
+	wakePending(false),
+	numUnfinished(0)
+{
+	wakePipe[0] = wakePipe[1] = -1;
+	memset(&stats, 0, sizeof(stats));
+}
+
+inline DDPClient::~DDPClient()
+{
+	Close();
+}
+
+inline uint32_t DDPClient::NextMask()
+{
+	// xorshift32; a mask of 0 would leave the frame unmasked
+	do {
+		maskState ^= maskState << 13;
+		maskState ^= maskState >> 17;
+		maskState ^= maskState << 5;
+	} while (maskState == 0);
+	return maskState;
+}
+
+inline int DDPClient::Wait(short events, Clock::time_point deadline)
+{
+	struct pollfd pfd;
+	long long remainingMS = std::chrono::duration_cast<std::chrono::milliseconds>(
+		deadline - Clock::now()).count();
+
+	if (remainingMS < 0) {
+		return 0;
+	}
+	pfd.fd = sock;
+	pfd.events = events;
+	pfd.revents = 0;
+	return poll(&pfd, 1, (int)remainingMS);
+}
+
+inline int DDPClient::Flush()
+{
+	ssize_t sent;
+
+	while (!unsent.empty()) {
+		sent = send(sock, &unsent[0], unsent.size(), MSG_NOSIGNAL);
+		if (sent < 0) {
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		unsent.erase(unsent.begin(), unsent.begin() + sent);
+	}
+	return 0;
+}
+
+inline int DDPClient::FlushUntil(Clock::time_point deadline)
+{
+	while (!unsent.empty()) {
+		if (Flush() < 0) {
+			return -1;
+		}
+		if (!unsent.empty() && Wait(POLLOUT, deadline) <= 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+inline void DDPClient::AppendMessage(const std::string & message)
+{
+	WebSocketAppendFrame(unsent, WEB_SOCKET_TEXT, message.data(), message.size(),
+		NextMask());
+}
+
+inline int DDPClient::ReceiveMessages(std::vector<std::string> * messages)
+{
+	unsigned char buffer[16384];
+	ssize_t numRead;
+	size_t consumed = 0;
+	WebSocketFrame frame;
+	long long frameSize;
+	bool lost = false;
+
+	// The server may answer and close at once, so the frames that arrived
+	// before the connection was lost are still parsed
+	while (true) {
+		numRead = recv(sock, buffer, sizeof(buffer), 0);
+		if (numRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+		if (numRead <= 0) {
+			lost = true;
+			break;
+		}
+		received.insert(received.end(), buffer, buffer + numRead);
+	}
+
+	while (received.size() - consumed >= 2) {
+		frameSize = WebSocketParseFrame(&received[consumed], received.size() - consumed,
+			DDP_MAX_MESSAGE_SIZE, &frame);
+		if (frameSize < 0) {
+			return -1;
+		}
+		if (frameSize == 0) {
+			break;
+		}
+
+		const char * payload = (const char *)&received[consumed + frame.headerSize];
+		if (frame.opcode == WEB_SOCKET_TEXT || frame.opcode == WEB_SOCKET_BINARY) {
+			fragments.assign(payload, frame.payloadSize);
+		}
+		else if (frame.opcode == WEB_SOCKET_CONTINUATION) {
+			if (fragments.size() + frame.payloadSize > DDP_MAX_MESSAGE_SIZE) {
+				return -1;
+			}
+			fragments.append(payload, frame.payloadSize);
+		}
+		else if (frame.opcode == WEB_SOCKET_PING) {
+			WebSocketAppendFrame(unsent, WEB_SOCKET_PONG, payload, frame.payloadSize,
+				NextMask());
+		}
+		else if (frame.opcode == WEB_SOCKET_CLOSE) {
+			return -1;
+		}
+
+		if (frame.final && frame.opcode < WEB_SOCKET_CLOSE) {
+			messages->push_back(std::string());
+			messages->back().swap(fragments);
+		}
+		consumed += (size_t)frameSize;
+	}
+
+	received.erase(received.begin(), received.begin() + consumed);
+	return lost ? -1 : (int)messages->size();
+}
+
+inline int DDPClient::Connect(unsigned int ipAddress, int port, const char * path)
+{
+	struct sockaddr_in address;
+	int flags, err, one = 1;
+	socklen_t errLen = sizeof(err);
+	unsigned char keyBytes[16];
+	char host[32];
+	std::string message, value;
+	std::vector<std::string> messages;
+	size_t headEnd;
+	bool answered = false;
+	int i;
+
+	Close();
+	Clock::time_point deadline = Clock::now() + timeout;
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) {
+		return LJME_CANNOT_CONNECT;
+	}
+	flags = fcntl(sock, F_GETFL, 0);
+	fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons((unsigned short)port);
+	address.sin_addr.s_addr = htonl(ipAddress);
+	if (connect(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		if (errno != EINPROGRESS || Wait(POLLOUT, deadline) != 1 ||
+			getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &errLen) < 0 || err != 0)
+		{
+			Close();
+			return LJME_CANNOT_CONNECT;
+		}
+	}
+
+	// The opening handshake
+	for (i = 0; i < 16; i += 4) {
+		uint32_t random = NextMask();
+		memcpy(keyBytes + i, &random, 4);
+	}
+	std::string key = WebSocketBase64(keyBytes, sizeof(keyBytes));
+	snprintf(host, sizeof(host), "%u.%u.%u.%u:%d", (ipAddress >> 24) & 0xFF,
+		(ipAddress >> 16) & 0xFF, (ipAddress >> 8) & 0xFF, ipAddress & 0xFF, port);
+	message = std::string("GET ") + path + " HTTP/1.1\r\nHost: " + host +
+		"\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: " + key +
+		"\r\nSec-WebSocket-Version: 13\r\n\r\n";
+	unsent.assign(message.begin(), message.end());
+	if (FlushUntil(deadline) < 0) {
+		Close();
+		return LJME_CANNOT_CONNECT;
+	}
+
+	while (true) {
+		std::string text(received.begin(), received.end());
+		headEnd = text.find("\r\n\r\n");
+		if (headEnd != std::string::npos) {
+			std::string head = text.substr(0, headEnd + 2);
+			received.erase(received.begin(), received.begin() + headEnd + 4);
+			if (head.compare(0, 12, "HTTP/1.1 101") != 0 ||
+				WebSocketHeader(head, "Sec-WebSocket-Accept") != WebSocketAccept(key))
+			{
+				Close();
+				return LJME_CANNOT_CONNECT;
+			}
+			break;
+		}
+		if (Wait(POLLIN, deadline) <= 0) {
+			Close();
+			return LJME_CANNOT_CONNECT;
+		}
+		unsigned char buffer[4096];
+		ssize_t numRead = recv(sock, buffer, sizeof(buffer), 0);
+		if (numRead <= 0 && !(numRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))) {
+			Close();
+			return LJME_CANNOT_CONNECT;
+		}
+		if (numRead > 0) {
+			received.insert(received.end(), buffer, buffer + numRead);
+		}
+	}
+
+	// DDP's connect, answered with connected or failed. Meteor sends
+	// server_id first.
+	AppendMessage("{\"msg\":\"connect\",\"version\":\"1\",\"support\":[\"1\",\"pre2\",\"pre1\"]}");
+	while (!answered) {
+		if (FlushUntil(deadline) < 0 || ReceiveMessages(&messages) < 0) {
+			Close();
+			return LJME_CANNOT_CONNECT;
+		}
+		for (size_t messageI = 0; messageI < messages.size() && !answered; messageI++) {
+			if (DDPFindField(messages[messageI], "msg", &value)) {
+				value = DDPUnquote(value);
+				answered = value == "connected" || value == "failed";
+			}
+		}
+		messages.clear();
+		if (!answered && Wait(POLLIN, deadline) <= 0) {
+			Close();
+			return LJME_CANNOT_CONNECT;
+		}
+	}
+	if (value != "connected") {
+		Close();
+		return LJME_CANNOT_CONNECT;
+	}
+
+	if (pipe(wakePipe) < 0) {
+		Close();
+		return LJME_CANNOT_CONNECT;
+	}
+	fcntl(wakePipe[0], F_SETFL, fcntl(wakePipe[0], F_GETFL, 0) | O_NONBLOCK);
+	fcntl(wakePipe[1], F_SETFL, fcntl(wakePipe[1], F_GETFL, 0) | O_NONBLOCK);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		connected = true;
+		stopping = false;
+		wakePending = false;
+	}
+	io = std::thread(&DDPClient::Run, this);
+	return LJME_NOERROR;
+}
+
+inline void DDPClient::Close()
+{
+	if (io.joinable()) {
+		{
+			// Call and SetMaxInFlight only wake the I/O thread while
+			// connected, so the pipe can be closed below
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			connected = false;
+		}
+		if (write(wakePipe[1], "x", 1) < 0) {
+			// The pipe is only full if the I/O thread is already awake
+		}
+		io.join();
+	}
+
+	if (sock >= 0) {
+		close(sock);
+		sock = -1;
+	}
+	if (wakePipe[0] >= 0) {
+		close(wakePipe[0]);
+		close(wakePipe[1]);
+		wakePipe[0] = wakePipe[1] = -1;
+	}
+	unsent.clear();
+	received.clear();
+	fragments.clear();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	connected = false;
+}
+
+inline bool DDPClient::IsConnected()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return connected;
+}
+
+inline void DDPClient::SetMaxInFlight(int newMaxInFlight)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	maxInFlight = newMaxInFlight > 0 ? newMaxInFlight : 1;
+
+	// Written under mutex, as in Call, so Close can't close the pipe first
+	bool wake = connected && !wakePending && !queued.empty();
+	wakePending = wakePending || wake;
+	if (wake && write(wakePipe[1], "x", 1) < 0) {
+		// The I/O thread is already awake
+	}
+}
+
+inline int DDPClient::GetMaxInFlight()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return maxInFlight;
+}
+
+inline void DDPClient::Call(const std::string & method, const std::string & params,
+	DDPCompletion completion)
+{
+	bool wake;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		++stats.submitted;
+		if (!connected) {
+			++stats.failed;
+		}
+		else {
+			++numUnfinished;
+			queued.push_back(MethodCall());
+			MethodCall & call = queued.back();
+			call.method = method;
+			call.params = params.empty() ? "[]" : params;
+			call.completion = completion;
+			call.submitted = Clock::now();
+			call.resulted = false;
+			call.updated = false;
+			call.err = LJME_NOERROR;
+
+			// The I/O thread sends queued calls whenever it wakes, which it
+			// does for every answer, so only wake it when there's room
+			wake = !wakePending && (int)inFlight.size() < maxInFlight;
+			wakePending = wakePending || wake;
+			if (wake && write(wakePipe[1], "x", 1) < 0) {
+				// The I/O thread is already awake
+			}
+			return;
+		}
+	}
+
+	if (completion) {
+		completion(LJME_SOCKET_LEVEL_ERROR, std::string());
+	}
+}
+
+inline int DDPClient::Drain(int timeoutMS)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (timeoutMS < 0) {
+		idle.wait(lock, [this] { return numUnfinished == 0; });
+	}
+	else if (!idle.wait_for(lock, std::chrono::milliseconds(timeoutMS),
+		[this] { return numUnfinished == 0; }))
+	{
+		return LJME_NO_RESPONSE_BYTES_RECEIVED;
+	}
+	return connected ? LJME_NOERROR : LJME_SOCKET_LEVEL_ERROR;
+}
+
+inline int DDPClient::NumQueued()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return (int)queued.size();
+}
+
+inline int DDPClient::NumInFlight()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return (int)inFlight.size();
+}
+
+inline void DDPClient::GetStats(DDPClientStats * result)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	*result = stats;
+}
+
+inline void DDPClient::SendAllowed()
+{
+	char id[24];
+	Clock::time_point now = Clock::now();
+
+	while (!queued.empty() && (int)inFlight.size() < maxInFlight) {
+		snprintf(id, sizeof(id), "%lld", nextID);
+		CallMap::iterator it = inFlight.emplace_hint(inFlight.end(), nextID++, MethodCall());
+		MethodCall & call = it->second;
+		call = std::move(queued.front());
+		queued.pop_front();
+
+		AppendMessage("{\"msg\":\"method\",\"method\":" + DDPQuote(call.method) +
+			",\"params\":" + call.params + ",\"id\":\"" + id + "\"}");
+		call.sent = now;
+		call.deadline = now + timeout;
+		std::string().swap(call.params);
+	}
+	if ((int)inFlight.size() > stats.maxInFlight) {
+		stats.maxInFlight = (int)inFlight.size();
+	}
+}
+
+inline void DDPClient::Finish(MethodCall & call, int err,
+	std::vector<Completion> & completions)
+{
+	Clock::time_point now = Clock::now();
+	double latencyUS = std::chrono::duration<double, std::micro>(now - call.submitted).count();
+	double roundTripUS = std::chrono::duration<double, std::micro>(now - call.sent).count();
+
+	if (err == LJME_NOERROR) {
+		++stats.completed;
+	}
+	else {
+		++stats.failed;
+	}
+	stats.totalLatencyUS += latencyUS;
+	if (latencyUS > stats.maxLatencyUS) {
+		stats.maxLatencyUS = latencyUS;
+	}
+	if (call.sent != Clock::time_point()) {
+		stats.totalRoundTripUS += roundTripUS;
+		if (roundTripUS > stats.maxRoundTripUS) {
+			stats.maxRoundTripUS = roundTripUS;
+		}
+	}
+
+	if (call.completion) {
+		completions.push_back(Completion());
+		completions.back().completion = std::move(call.completion);
+		completions.back().err = err;
+		completions.back().result.swap(call.result);
+	}
+	else {
+		--numUnfinished;
+	}
+}
+
+inline void DDPClient::HandleMessage(const std::string & message,
+	std::vector<Completion> & completions)
+{
+	std::string type, value, error;
+	std::vector<std::string> ids;
+	CallMap::iterator it;
+
+	if (!DDPFindField(message, "msg", &type)) {
+		return;
+	}
+	type = DDPUnquote(type);
+
+	if (type == "result") {
+		if (!DDPFindField(message, "id", &value) ||
+			(it = inFlight.find(atoll(DDPUnquote(value).c_str()))) == inFlight.end())
+		{
+			++stats.staleMessages;
+			return;
+		}
+		MethodCall & call = it->second;
+		if (DDPFindField(message, "error", &error)) {
+			++stats.methodErrors;
+			call.err = DDP_METHOD_ERROR;
+			call.result = DDPFindField(error, "reason", &value) ? DDPUnquote(value) : error;
+		}
+		else if (DDPFindField(message, "result", &value)) {
+			call.result.swap(value);
+		}
+		call.resulted = true;
+		if (call.updated) {
+			Finish(call, call.err, completions);
+			inFlight.erase(it);
+		}
+	}
+	else if (type == "updated") {
+		if (!DDPFindField(message, "methods", &value)) {
+			return;
+		}
+		DDPSplitArray(value, &ids);
+		for (size_t idI = 0; idI < ids.size(); idI++) {
+			it = inFlight.find(atoll(DDPUnquote(ids[idI]).c_str()));
+			if (it == inFlight.end()) {
+				++stats.staleMessages;
+				continue;
+			}
+			it->second.updated = true;
+			if (it->second.resulted) {
+				Finish(it->second, it->second.err, completions);
+				inFlight.erase(it);
+			}
+		}
+	}
+	else if (type == "ping") {
+		AppendMessage(DDPFindField(message, "id", &value) ?
+			"{\"msg\":\"pong\",\"id\":" + value + "}" : "{\"msg\":\"pong\"}");
+	}
+	else if (type == "error") {
+		// The server couldn't parse a message, which can't be told apart
+		++stats.serverErrors;
+	}
+}
+
+inline void DDPClient::ExpireTimedOut(std::vector<Completion> & completions)
+{
+	Clock::time_point now = Clock::now();
+
+	// Calls are sent in id order with the same timeout, so the earliest
+	// deadline is always first
+	while (!inFlight.empty() && inFlight.begin()->second.deadline <= now) {
+		++stats.timedOut;
+		Finish(inFlight.begin()->second, LJME_NO_RESPONSE_BYTES_RECEIVED, completions);
+		inFlight.erase(inFlight.begin());
+	}
+}
+
+inline void DDPClient::FailAll(int err, std::vector<Completion> & completions)
+{
+	for (CallMap::iterator it = inFlight.begin(); it != inFlight.end(); ++it) {
+		Finish(it->second, err, completions);
+	}
+	inFlight.clear();
+	for (size_t i = 0; i < queued.size(); i++) {
+		Finish(queued[i], err, completions);
+	}
+	queued.clear();
+}
+
+inline void DDPClient::RunCompletions(std::vector<Completion> & completions)
+{
+	long long numRun = (long long)completions.size();
+
+	for (size_t i = 0; i < completions.size(); i++) {
+		completions[i].completion(completions[i].err, completions[i].result);
+	}
+	completions.clear();
+
+	// Drain returns once the last completion has run, not once the last
+	// call has been answered, which is before its completion runs
+	std::lock_guard<std::mutex> lock(mutex);
+	numUnfinished -= numRun;
+	if (numUnfinished == 0) {
+		idle.notify_all();
+	}
+}
+
+inline void DDPClient::Run()
+{
+	struct pollfd fds[2];
+	std::vector<std::string> messages;
+	std::vector<Completion> completions;
+	unsigned char wakeBytes[64];
+	long long waitMS;
+	bool lost = false;
+
+	while (!lost) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (stopping) {
+				break;
+			}
+			wakePending = false;
+			SendAllowed();
+			waitMS = -1;
+			if (!inFlight.empty()) {
+				waitMS = std::chrono::duration_cast<std::chrono::milliseconds>(
+					inFlight.begin()->second.deadline - Clock::now()).count() + 1;
+				waitMS = waitMS > 0 ? waitMS : 0;
+			}
+		}
+
+		if (Flush() < 0) {
+			lost = true;
+		}
+		else {
+			fds[0].fd = wakePipe[0];
+			fds[0].events = POLLIN;
+			fds[0].revents = 0;
+			fds[1].fd = sock;
+			fds[1].events = (short)(POLLIN | (unsent.empty() ? 0 : POLLOUT));
+			fds[1].revents = 0;
+			poll(fds, 2, (int)waitMS);
+
+			if (fds[0].revents & POLLIN) {
+				while (read(wakePipe[0], wakeBytes, sizeof(wakeBytes)) > 0) {
+				}
+			}
+			if ((fds[1].revents & (POLLIN | POLLHUP | POLLERR)) &&
+				ReceiveMessages(&messages) < 0)
+			{
+				lost = true;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (size_t i = 0; i < messages.size(); i++) {
+				HandleMessage(messages[i], completions);
+			}
+			ExpireTimedOut(completions);
+			if (lost) {
+				connected = false;
+				FailAll(LJME_SOCKET_LEVEL_ERROR, completions);
+			}
+		}
+		messages.clear();
+		RunCompletions(completions);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		connected = false;
+		FailAll(LJME_SOCKET_LEVEL_ERROR, completions);
+	}
+	RunCompletions(completions);
+}
+
+#endif // #ifndef LJM_DDP_CLIENT
@@ -0,0 +1,528 @@
+/**
+ * Name: LJM_UploadBatcher.h
+ * Desc: Gathers upload points into batches sent as one DDP method call each.
+ *       fakedata.py sends one insertData call per grid location and waits
+ *       for each, so a 100-cell room costs 100 round trips. An UploadBatcher
+ *       sends its points through a DDPClient as a bulk call once enough
+ *       points, enough bytes or a point old enough is waiting, reads the
+ *       server's answer for each point and sends the points it failed again.
+ *       C++11, POSIX only.
+**/
+
+#ifndef LJM_UPLOAD_BATCHER
+#define LJM_UPLOAD_BATCHER
+
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LabJackM.h"
+
+#include "LJM_DDPClient.h"
+
+enum { UPLOAD_DEFAULT_MAX_POINTS = 100 };
+enum { UPLOAD_DEFAULT_MAX_BYTES = 64 * 1024 };
+enum { UPLOAD_DEFAULT_MAX_DELAY_MS = 1000 };
+enum { UPLOAD_DEFAULT_MAX_RETRIES = 3 };
+enum { UPLOAD_DEFAULT_RETRY_DELAY_MS = 500 };
+
+// The error a point fails with when the server's answer to its call fails
+// that point alone, as opposed to a DDPCompletion error failing the call
+enum { UPLOAD_POINT_REJECTED = LJME_INVALID_VALUE };
+
+/**
+ * Desc: Called once per point added to an UploadBatcher: with LJME_NOERROR
+ *       when the server acknowledged it, or with the last error once it has
+ *       failed more than maxRetries times and is dropped: UPLOAD_POINT_REJECTED
+ *       if the server's answer failed the point, or the DDPCompletion error
+ *       if its call failed as a whole. Runs on the DDPClient's I/O thread and
+ *       shouldn't block.
+**/
+typedef std::function<void(long long id, int err)> UploadAck;
+
+/**
+ * Desc: What an UploadBatcher has done since it was made.
+ *       Flushes are counted by what triggered them: a full batch of points
+ *       or bytes, or the oldest point waiting maxDelayMS (or a retried point
+ *       its retryDelayMS, or a Drain).
+ *       retried counts points sent again, dropped the ones given up on, and
+ *       failedBatches the calls that failed as a whole.
+ *       Latency is from Add until the point was acknowledged.
+**/
+struct UploadBatcherStats
+{
+	long long added;
+	long long acked;
+	long long retried;
+	long long dropped;
+	long long batches;
+	long long pointsSent;
+	long long failedBatches;
+	long long countFlushes;
+	long long byteFlushes;
+	long long timeFlushes;
+	int pending;
+	int outstanding;
+	double totalLatencyUS;
+	double maxLatencyUS;
+};
+
+/**
+ * Name: UploadBatcher
+ * Desc: Calls method with params [leadingParams..., [point, point, ...]],
+ *       each point the JSON text of an object. The server answers with an
+ *       array holding an entry per point, in order: null, false or an
+ *       object with an error member for a point it failed, anything else
+ *       for one it stored. A call that fails as a whole fails every point
+ *       in it. A failed point goes back to the front of the batcher, ahead
+ *       of newer points, and is sent again retryDelayMS later.
+ * Note: The server should use each point's id to ignore points it already
+ *       stored, as a batch may have been stored when its answer was lost.
+ * Note: Add, Flush, Drain and GetStats may be used from any thread.
+ *       Destroying an UploadBatcher waits for the batches it sent but
+ *       discards points not yet sent; Drain first to send them.
+**/
+class UploadBatcher
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	/**
+	 * Para: leadingParams, the JSON text of the method's parameters before
+	 *           the points, such as "\"BBW281\"", or empty.
+	**/
+	UploadBatcher(DDPClient * client, const std::string & method,
+		const std::string & leadingParams);
+	~UploadBatcher();
+
+	void SetMaxPoints(int newMaxPoints);
+	void SetMaxBytes(int newMaxBytes);
+	void SetMaxDelayMS(int newMaxDelayMS);
+	void SetMaxRetries(int newMaxRetries);
+	void SetRetryDelayMS(int newRetryDelayMS);
+	void SetAck(UploadAck newAck);
+
+	/**
+	 * Desc: Adds a point, sending a batch at once if it fills one.
+	 * Para: id, passed back to the UploadAck. point, the point's JSON
+	 *           object.
+	**/
+	void Add(long long id, const std::string & point);
+
+	/**
+	 * Desc: Sends every waiting point that isn't waiting to be retried now,
+	 *       however few.
+	**/
+	void Flush();
+
+	/**
+	 * Desc: Sends every point and waits until each has been acknowledged
+	 *       or dropped, for at most timeoutMS, or as long as it takes if
+	 *       timeoutMS is negative.
+	 * Retr: LJME_NOERROR, or LJME_NO_RESPONSE_BYTES_RECEIVED on timeout.
+	**/
+	int Drain(int timeoutMS = -1);
+
+	void GetStats(UploadBatcherStats * result);
+
+private:
+	struct Point
+	{
+		long long id;
+		std::string json;
+		Clock::time_point added;
+		Clock::time_point due;
+		int attempts;
+	};
+
+	typedef std::vector<Point> Batch;
+
+	enum FlushReason {
+		FLUSH_COUNT,
+		FLUSH_BYTES,
+		FLUSH_TIME
+	};
+
+	bool TakeBatch(bool force, Batch * batch);
+	void Send(std::shared_ptr<Batch> batch);
+	void Complete(std::shared_ptr<Batch> batch, int err, const std::string & result);
+	void Run();
+
+	DDPClient * client;
+	std::string method;
+	std::string leadingParams;
+	int maxPoints;
+	int maxBytes;
+	std::chrono::milliseconds maxDelay;
+	int maxRetries;
+	std::chrono::milliseconds retryDelay;
+	UploadAck ack;
+
+	// pendingBytes is the size of pending's points, with the separators a
+	// batch adds for each
+	std::deque<Point> pending;
+	size_t pendingBytes;
+	int outstanding;
+	bool draining;
+	bool stopping;
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::condition_variable idle;
+	std::thread flusher;
+	UploadBatcherStats stats;
+};
+
+
+// Source
+
+inline UploadBatcher::UploadBatcher(DDPClient * client, const std::string & method,
+	const std::string & leadingParams) :
+	client(client),
+	method(method),
+	leadingParams(leadingParams),
+	maxPoints(UPLOAD_DEFAULT_MAX_POINTS),
+	maxBytes(UPLOAD_DEFAULT_MAX_BYTES),
+	maxDelay(UPLOAD_DEFAULT_MAX_DELAY_MS),
+	maxRetries(UPLOAD_DEFAULT_MAX_RETRIES),
+	retryDelay(UPLOAD_DEFAULT_RETRY_DELAY_MS),
+	pendingBytes(0),
+	outstanding(0),
+	draining(false),
+	stopping(false)
+{
+	memset(&stats, 0, sizeof(stats));
+	flusher = std::thread(&UploadBatcher::Run, this);
+}
+
+inline UploadBatcher::~UploadBatcher()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	changed.notify_all();
+	flusher.join();
+
+	// Wait for outstanding batches, whose completions use this batcher
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this] { return outstanding == 0; });
+}
+
+inline void UploadBatcher::SetMaxPoints(int newMaxPoints)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	maxPoints = newMaxPoints > 0 ? newMaxPoints : 1;
+}
+
+inline void UploadBatcher::SetMaxBytes(int newMaxBytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	maxBytes = newMaxBytes > 0 ? newMaxBytes : 1;
+}
+
+inline void UploadBatcher::SetMaxDelayMS(int newMaxDelayMS)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	maxDelay = std::chrono::milliseconds(newMaxDelayMS > 0 ? newMaxDelayMS : 0);
+}
+
+inline void UploadBatcher::SetMaxRetries(int newMaxRetries)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	maxRetries = newMaxRetries > 0 ? newMaxRetries : 0;
+}
+
+inline void UploadBatcher::SetRetryDelayMS(int newRetryDelayMS)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	retryDelay = std::chrono::milliseconds(newRetryDelayMS > 0 ? newRetryDelayMS : 0);
+}
+
+inline void UploadBatcher::SetAck(UploadAck newAck)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	ack = newAck;
+}
+
+inline void UploadBatcher::Add(long long id, const std::string & point)
+{
+	std::shared_ptr<Batch> batch;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.push_back(Point());
+		Point & added = pending.back();
+		added.id = id;
+		added.json = point;
+		added.added = Clock::now();
+		added.due = added.added + maxDelay;
+		added.attempts = 0;
+		pendingBytes += point.size() + 1;
+		++stats.added;
+
+		if ((int)pending.size() < maxPoints && pendingBytes < (size_t)maxBytes) {
+			// The flusher only needs waking for the first point's deadline
+			if (pending.size() == 1) {
+				changed.notify_one();
+			}
+			return;
+		}
+		batch.reset(new Batch);
+		if (!TakeBatch(false, batch.get())) {
+			return;
+		}
+	}
+	Send(batch);
+}
+
+/**
+ * Desc: Moves the points of the next batch from pending into batch, if the
+ *       points waiting fill one, the oldest is due or force is set. Points
+ *       waiting to be retried are only taken once due, and hold back the
+ *       points behind them until then. Call with mutex held.
+**/
+inline bool UploadBatcher::TakeBatch(bool force, Batch * batch)
+{
+	Clock::time_point now = Clock::now();
+
+	if (pending.empty() || (pending.front().attempts > 0 && pending.front().due > now)) {
+		return false;
+	}
+
+	FlushReason reason;
+	if ((int)pending.size() >= maxPoints) {
+		reason = FLUSH_COUNT;
+	}
+	else if (pendingBytes >= (size_t)maxBytes) {
+		reason = FLUSH_BYTES;
+	}
+	else if (force || pending.front().due <= now) {
+		reason = FLUSH_TIME;
+	}
+	else {
+		return false;
+	}
+
+	size_t batchBytes = 0;
+	while (!pending.empty() && (int)batch->size() < maxPoints &&
+		(batch->empty() || batchBytes + pending.front().json.size() + 1 <= (size_t)maxBytes) &&
+		(pending.front().attempts == 0 || pending.front().due <= now))
+	{
+		batchBytes += pending.front().json.size() + 1;
+		pendingBytes -= pending.front().json.size() + 1;
+		batch->push_back(std::move(pending.front()));
+		pending.pop_front();
+	}
+
+	if (reason == FLUSH_COUNT) {
+		++stats.countFlushes;
+	}
+	else if (reason == FLUSH_BYTES) {
+		++stats.byteFlushes;
+	}
+	else {
+		++stats.timeFlushes;
+	}
+	++stats.batches;
+	stats.pointsSent += (long long)batch->size();
+	outstanding += (int)batch->size();
+	return true;
+}
+
+inline void UploadBatcher::Send(std::shared_ptr<Batch> batch)
+{
+	size_t numBytes = leadingParams.size() + 8;
+	for (size_t i = 0; i < batch->size(); i++) {
+		numBytes += (*batch)[i].json.size() + 1;
+	}
+
+	std::string params;
+	params.reserve(numBytes);
+	params += '[';
+	if (!leadingParams.empty()) {
+		params += leadingParams;
+		params += ", ";
+	}
+	params += '[';
+	for (size_t i = 0; i < batch->size(); i++) {
+		if (i > 0) {
+			params += ',';
+		}
+		params += (*batch)[i].json;
+	}
+	params += "]]";
+
+	client->Call(method, params, [this, batch](int err, const std::string & result) {
+		Complete(batch, err, result);
+	});
+}
+
+inline void UploadBatcher::Complete(std::shared_ptr<Batch> batch, int err,
+	const std::string & result)
+{
+	std::vector<std::string> answers;
+	std::vector<std::pair<long long, int> > acks;
+	Batch retry;
+	Clock::time_point now = Clock::now();
+	UploadAck callback;
+
+	if (err == LJME_NOERROR) {
+		DDPSplitArray(result, &answers);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (err != LJME_NOERROR) {
+			++stats.failedBatches;
+		}
+		for (size_t i = 0; i < batch->size(); i++) {
+			Point & point = (*batch)[i];
+			int pointErr = err;
+			std::string reason;
+			if (pointErr == LJME_NOERROR && (i >= answers.size() || answers[i] == "null" ||
+				answers[i] == "false" || DDPFindField(answers[i], "error", &reason)))
+			{
+				pointErr = UPLOAD_POINT_REJECTED;
+			}
+
+			if (pointErr == LJME_NOERROR) {
+				double latencyUS = std::chrono::duration<double, std::micro>(
+					now - point.added).count();
+				++stats.acked;
+				stats.totalLatencyUS += latencyUS;
+				if (latencyUS > stats.maxLatencyUS) {
+					stats.maxLatencyUS = latencyUS;
+				}
+				acks.push_back(std::make_pair(point.id, pointErr));
+			}
+			else if (point.attempts >= maxRetries) {
+				++stats.dropped;
+				acks.push_back(std::make_pair(point.id, pointErr));
+			}
+			else {
+				++stats.retried;
+				point.attempts++;
+				point.due = now + retryDelay;
+				retry.push_back(std::move(point));
+			}
+		}
+
+		// Retried points go ahead of newer ones, in their original order
+		for (size_t i = retry.size(); i > 0; i--) {
+			pendingBytes += retry[i - 1].json.size() + 1;
+			pending.push_front(std::move(retry[i - 1]));
+		}
+		if (!retry.empty()) {
+			changed.notify_one();
+		}
+		callback = ack;
+	}
+
+	if (callback) {
+		for (size_t i = 0; i < acks.size(); i++) {
+			callback(acks[i].first, acks[i].second);
+		}
+	}
+
+	// Only now may Drain return or the destructor finish
+	std::lock_guard<std::mutex> lock(mutex);
+	outstanding -= (int)batch->size();
+	if (outstanding == 0) {
+		idle.notify_all();
+	}
+}
+
+inline void UploadBatcher::Flush()
+{
+	std::vector<std::shared_ptr<Batch> > batches;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		while (true) {
+			std::shared_ptr<Batch> batch(new Batch);
+			if (!TakeBatch(true, batch.get())) {
+				break;
+			}
+			batches.push_back(batch);
+		}
+	}
+	for (size_t i = 0; i < batches.size(); i++) {
+		Send(batches[i]);
+	}
+}
+
+inline int UploadBatcher::Drain(int timeoutMS)
+{
+	Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMS);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		draining = true;
+	}
+	changed.notify_one();
+	Flush();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	auto done = [this] { return pending.empty() && outstanding == 0; };
+	bool drained = true;
+	if (timeoutMS < 0) {
+		idle.wait(lock, done);
+	}
+	else {
+		drained = idle.wait_until(lock, deadline, done);
+	}
+	draining = false;
+	return drained ? LJME_NOERROR : LJME_NO_RESPONSE_BYTES_RECEIVED;
+}
+
+inline void UploadBatcher::GetStats(UploadBatcherStats * result)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	*result = stats;
+	result->pending = (int)pending.size();
+	result->outstanding = outstanding;
+}
+
+inline void UploadBatcher::Run()
+{
+	std::vector<std::shared_ptr<Batch> > batches;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (stopping) {
+				break;
+			}
+			if (pending.empty()) {
+				changed.wait(lock);
+			}
+			else {
+				// A copy, as the point may be sent while waiting
+				Clock::time_point due = pending.front().due;
+				changed.wait_until(lock, due);
+			}
+			if (stopping) {
+				break;
+			}
+			while (true) {
+				std::shared_ptr<Batch> batch(new Batch);
+				if (!TakeBatch(draining, batch.get())) {
+					break;
+				}
+				batches.push_back(batch);
+			}
+		}
+		for (size_t i = 0; i < batches.size(); i++) {
+			Send(batches[i]);
+		}
+		batches.clear();
+	}
+}
+
+#endif // #ifndef LJM_UPLOAD_BATCHER
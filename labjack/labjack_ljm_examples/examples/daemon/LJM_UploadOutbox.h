@@ -0,0 +1,1542 @@
+/**
+ * Name: LJM_UploadOutbox.h
+ * Desc: Keeps upload records on disk until the DDP server has them. When the
+ *       Meteor server goes away, ddp-json.py's DDPClient.run interrupts the
+ *       main thread and trade_fair.py dies with every reading it hadn't sent.
+ *       Here the acquisition side appends each record to an UploadOutbox, a
+ *       log of segment files in a directory, without waiting for the disk or
+ *       the network, and an OutboxUploader sends the log through an
+ *       UploadBatcher, in order, whenever it can connect. Segments are
+ *       deleted once the server has acknowledged all their records.
+ *       C++14, POSIX only.
+**/
+
+#ifndef LJM_UPLOAD_OUTBOX
+#define LJM_UPLOAD_OUTBOX
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LabJackM.h"
+
+#include "LJM_AcquisitionPipeline.h"
+#include "LJM_DDPClient.h"
+#include "LJM_UploadBatcher.h"
+
+// A record on disk is this header, then its payload. The header holds, in
+// little-endian order, the payload's size and CRC-32 as 32-bit numbers and
+// the record's sequence number as a 64-bit one
+enum { OUTBOX_HEADER_SIZE = 16 };
+enum { OUTBOX_MAX_RECORD_SIZE = 1024 * 1024 };
+
+enum { OUTBOX_DEFAULT_SEGMENT_BYTES = 4 * 1024 * 1024 };
+enum { OUTBOX_DEFAULT_SYNC_MS = 100 };
+enum { OUTBOX_DEFAULT_MAX_BUFFERED_BYTES = 16 * 1024 * 1024 };
+
+// Bytes read from a segment at a time when reading records back
+enum { OUTBOX_READ_CHUNK = 256 * 1024 };
+
+enum { OUTBOX_DEFAULT_MAX_OUTSTANDING = 10000 };
+enum { OUTBOX_MIN_RECONNECT_MS = 250 };
+enum { OUTBOX_MAX_RECONNECT_MS = 30000 };
+
+// Times the batcher may give up on a record the server's answers reject
+// before the record is moved to the rejected file
+enum { OUTBOX_DEFAULT_MAX_REJECTIONS = 3 };
+
+/**
+ * Desc: Returns the CRC-32 of data, the same as zlib's crc32.
+**/
+uint32_t OutboxCRC32(const void * data, size_t numBytes);
+
+/**
+ * Desc: A record read back from an UploadOutbox.
+**/
+struct OutboxRecord
+{
+	long long seq;
+	std::string payload;
+};
+
+/**
+ * Desc: What an UploadOutbox has done since it was opened.
+ *       dropped counts records Append refused because the disk had fallen
+ *       maxBufferedBytes behind. corruptRecords counts records read back
+ *       with a wrong CRC, size or sequence number; the rest of their segment
+ *       is skipped and counted in lostRecords, and acknowledged, as no read
+ *       will ever return those records. truncatedBytes were cut from
+ *       the end of the log on Open, a record the writer was in the middle
+ *       of when the process stopped.
+ *       lastSeq is the last record appended, durableSeq the last one synced
+ *       to disk, ackedThrough the last of the unbroken run of acknowledged
+ *       records and readSeq the next record Read returns.
+ *       maxAppendUS is the longest an Append took, the most acquisition was
+ *       held up.
+**/
+struct UploadOutboxStats
+{
+	long long appended;
+	long long dropped;
+	long long syncs;
+	long long writeErrors;
+	long long segmentsCreated;
+	long long segmentsRemoved;
+	long long corruptRecords;
+	long long lostRecords;
+	long long truncatedBytes;
+	long long lastSeq;
+	long long durableSeq;
+	long long ackedThrough;
+	long long readSeq;
+	int numSegments;
+	long long diskBytes;
+	long long bufferedBytes;
+	long long maxBufferedBytes;
+	double totalSyncMS;
+	double maxSyncMS;
+	double maxAppendUS;
+};
+
+/**
+ * Name: UploadOutbox
+ * Desc: An append-only log of records in a directory, as segment files
+ *       named by the hexadecimal sequence number of their first record.
+ *       Records are numbered from 1, in the order they are appended, and the
+ *       numbers carry on across Close and Open. Append only copies a record
+ *       into memory; a writer thread writes what has gathered every syncMS,
+ *       or sooner once it fills a quarter of maxBufferedBytes, and syncs it
+ *       to disk with one fdatasync, and starts a new segment
+ *       once the current one holds segmentBytes. Read returns records in
+ *       order once they are on disk. Acknowledge marks a record as received
+ *       by the server; the writer records the acknowledged position in the
+ *       file acked and deletes segments with no unacknowledged records.
+ * Note: A directory's file origin holds a random name for it, so the ids
+ *       OutboxUploader gives records are unique across outboxes.
+ * Note: Append, Acknowledge and GetStats may be used from any thread; Read
+ *       and Rewind from one thread at a time.
+**/
+class UploadOutbox
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	UploadOutbox();
+	~UploadOutbox();
+
+	/**
+	 * Desc: Set before Open.
+	**/
+	void SetSegmentBytes(int newSegmentBytes);
+	void SetSyncMS(int newSyncMS);
+	void SetMaxBufferedBytes(int newMaxBufferedBytes);
+
+	/**
+	 * Desc: Opens the log in directory, which is made if it doesn't exist,
+	 *       and starts the writer thread. Cuts off a torn record at the end
+	 *       of the log. Reading starts after the acknowledged records.
+	 * Retr: LJME_NOERROR, LJME_INVALID_PARAMETER if directory can't be made
+	 *       or read, or LJME_UNKNOWN_ERROR if the log can't be repaired.
+	**/
+	int Open(const char * newDirectory);
+
+	/**
+	 * Desc: Writes and syncs the records appended and the acknowledged
+	 *       position so far and stops the writer thread. If writing fails
+	 *       meanwhile, the records not yet written are lost.
+	**/
+	void Close();
+
+	const std::string & GetOrigin() const { return origin; }
+
+	/**
+	 * Desc: Appends a record. Never waits for the disk.
+	 * Para: seq, set to the record's sequence number, if not NULL.
+	 * Retr: LJME_NOERROR, LJME_LJM_BUFFER_FULL if the writer is
+	 *       maxBufferedBytes behind and the record is dropped, or
+	 *       LJME_INVALID_PARAMETER if the payload is larger than
+	 *       OUTBOX_MAX_RECORD_SIZE or the outbox isn't open.
+	**/
+	int Append(const std::string & payload, long long * seq = NULL);
+
+	/**
+	 * Desc: Waits until every record appended so far is on disk.
+	 * Retr: LJME_NOERROR, or LJME_UNKNOWN_ERROR if the outbox closed first.
+	**/
+	int Sync();
+
+	/**
+	 * Desc: Sets records to the next records on disk, at most maxRecords,
+	 *       waiting up to timeoutMS for the first.
+	**/
+	void Read(int maxRecords, int timeoutMS, std::vector<OutboxRecord> * records);
+
+	/**
+	 * Desc: Makes Read start again after the acknowledged records, to send
+	 *       the records after them again.
+	**/
+	void Rewind();
+
+	void Acknowledge(long long seq);
+
+	/**
+	 * Desc: Takes a record the server won't accept out of the way: appends
+	 *       it to the file rejected in the directory, as a line of its
+	 *       sequence number and payload, syncs the file and acknowledges the
+	 *       record.
+	 * Retr: LJME_NOERROR, or LJME_UNKNOWN_ERROR if the file can't be written,
+	 *       in which case the record isn't acknowledged.
+	**/
+	int Reject(const OutboxRecord & record);
+
+	void GetStats(UploadOutboxStats * result);
+
+private:
+	struct Segment
+	{
+		long long firstSeq;
+		long long numBytes;
+	};
+
+	std::string SegmentPath(long long firstSeq) const;
+	int LoadOrigin();
+	int Recover();
+	int RecoverSegment(Segment & segment, long long * lastSeq);
+	int WriteBatch(const std::vector<char> & batch, long long firstSeq, size_t * numWritten);
+	int SaveAcked(long long seq);
+	void AcknowledgeRange(long long firstSeq, long long endSeq);
+	void Compact();
+	void Run();
+	const char * ReadAt(long long offset, size_t numBytes, long long segmentBytes);
+
+	std::string directory;
+	std::string origin;
+	int segmentBytes;
+	std::chrono::milliseconds syncInterval;
+	size_t maxBufferedBytes;
+	int dirFd;
+
+	// Guarded by mutex. Records wait in buffer until the writer takes them
+	// in exchange for writeBuffer, an emptied buffer of the same capacity,
+	// so Append never waits for a reallocation once the outbox is busy
+	bool isOpen;
+	bool stopping;
+	bool syncRequested;
+	std::vector<char> buffer;
+	long long bufferFirstSeq;
+	Clock::time_point bufferSince;
+	long long nextSeq;
+	long long durableSeq;
+	long long ackedThrough;
+	long long savedAcked;
+	std::set<long long> ackedAhead;
+	std::deque<Segment> segments;
+	UploadOutboxStats stats;
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::condition_variable synced;
+	std::thread writer;
+
+	// The writer thread's
+	std::vector<char> writeBuffer;
+	int writeFd;
+	long long writeBytes;
+
+	// Guarded by readMutex
+	std::mutex readMutex;
+	long long readSeq;
+	long long readSegment;
+	int readFd;
+	long long readOffset;
+	std::vector<char> chunk;
+	long long chunkOffset;
+};
+
+/**
+ * Name: OutboxUploadSink
+ * Desc: An UploadSink that appends the params of each insertData call to an
+ *       UploadOutbox, for an OutboxUploader to send. The outbox only holds
+ *       insertData params, so other calls are refused with
+ *       LJME_INVALID_PARAMETER.
+**/
+class OutboxUploadSink : public UploadSink
+{
+public:
+	OutboxUploadSink(UploadOutbox * outbox) : outbox(outbox) {}
+
+	int Send(const std::string & method, const std::string & params)
+	{
+		if (method != "insertData") {
+			return LJME_INVALID_PARAMETER;
+		}
+		return outbox->Append(params);
+	}
+
+private:
+	UploadOutbox * outbox;
+};
+
+/**
+ * Desc: What an OutboxUploader has done since it started. sent counts
+ *       records handed to its UploadBatcher, more than once if resent,
+ *       acked the ones the server acknowledged and rejected the ones moved
+ *       to the outbox's rejected file. rewinds counts the times it went back
+ *       to the first unacknowledged record, after reconnecting or after the
+ *       batcher gave up on a record.
+**/
+struct OutboxUploaderStats
+{
+	long long connects;
+	long long failedConnects;
+	long long disconnects;
+	long long rewinds;
+	long long sent;
+	long long acked;
+	long long rejected;
+	bool connected;
+};
+
+/**
+ * Name: OutboxUploader
+ * Desc: Sends an UploadOutbox's records to a DDP server on a thread of its
+ *       own. Each record holds the params of an insertData call, ["room",
+ *       {point}]; the point goes out in insertDataBatch calls through an
+ *       UploadBatcher for its room, with the room before it, and with an _id
+ *       member added of the outbox's origin and the record's sequence
+ *       number, so a record appended by an earlier run configured for
+ *       another room still goes to that room. At most
+ *       maxOutstanding records are sent and not yet acknowledged.
+ *       While the server can't be reached, the uploader tries to connect
+ *       again after 0.25 s, doubling the wait up to 30 s. On connecting, and
+ *       whenever the batcher gives up on a record, it sends everything after
+ *       the acknowledged records again. A record the server has rejected
+ *       in maxRejections of those rounds is moved to the outbox's rejected
+ *       file, so it doesn't hold back the records after it, and so is a
+ *       record without a room, at once.
+ * Note: Records can reach the server more than once, so insertDataBatch must
+ *       ignore a point whose _id it already has, as a Mongo insert with that
+ *       _id does; then each record is stored exactly once. Only points the
+ *       server's answer fails count towards maxRejections; a call that fails
+ *       as a whole, even with a method error, counts like a timeout or a lost
+ *       connection, as it says nothing against any one record.
+**/
+class OutboxUploader
+{
+public:
+	OutboxUploader(UploadOutbox * outbox);
+	~OutboxUploader();
+
+	/**
+	 * Desc: Set before Start.
+	**/
+	void SetMethod(const std::string & newMethod) { method = newMethod; }
+	void SetMaxPoints(int newMaxPoints) { maxPoints = newMaxPoints; }
+	void SetMaxDelayMS(int newMaxDelayMS) { maxDelayMS = newMaxDelayMS; }
+	void SetMaxOutstanding(int newMaxOutstanding) { maxOutstanding = newMaxOutstanding; }
+	void SetMaxRejections(int newMaxRejections) { maxRejections = newMaxRejections; }
+
+	/**
+	 * Desc: Starts sending to the DDP server at ipAddress:port. The server
+	 *       needn't be up yet.
+	**/
+	void Start(unsigned int newIPAddress, int newPort);
+
+	/**
+	 * Desc: Waits up to timeoutMS for the records sent to be acknowledged,
+	 *       then disconnects. Unacknowledged records stay in the outbox.
+	**/
+	void Stop(int timeoutMS = 2000);
+
+	void GetStats(OutboxUploaderStats * result);
+
+private:
+	std::string Point(const OutboxRecord & record, std::string * room) const;
+	UploadBatcher * Batcher(const std::string & room);
+	void DrainBatchers(int timeoutMS);
+	void Acknowledged(long long seq, int err);
+	void Run();
+
+	UploadOutbox * outbox;
+	std::string method;
+	int maxPoints;
+	int maxDelayMS;
+	int maxOutstanding;
+	int maxRejections;
+	unsigned int ipAddress;
+	int port;
+	int stopTimeoutMS;
+
+	DDPClient client;
+	std::atomic<bool> rewindNeeded;
+
+	// The uploader thread's. A batcher per room, by the room's JSON text,
+	// made as records for it are read
+	std::map<std::string, std::unique_ptr<UploadBatcher> > batchers;
+
+	// Guarded by mutex. rejections holds the times the batcher gave up on
+	// each record the server rejected, until it is acknowledged or rejected
+	int outstanding;
+	bool stopping;
+	std::map<long long, int> rejections;
+	OutboxUploaderStats stats;
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::thread uploader;
+};
+
+
+// Source
+
+static inline void OutboxPut32(unsigned char * bytes, uint32_t value)
+{
+	for (int i = 0; i < 4; i++) {
+		bytes[i] = (unsigned char)(value >> (i * 8));
+	}
+}
+
+static inline void OutboxPut64(unsigned char * bytes, uint64_t value)
+{
+	for (int i = 0; i < 8; i++) {
+		bytes[i] = (unsigned char)(value >> (i * 8));
+	}
+}
+
+static inline uint32_t OutboxGet32(const unsigned char * bytes)
+{
+	uint32_t value = 0;
+	for (int i = 3; i >= 0; i--) {
+		value = (value << 8) | bytes[i];
+	}
+	return value;
+}
+
+static inline uint64_t OutboxGet64(const unsigned char * bytes)
+{
+	uint64_t value = 0;
+	for (int i = 7; i >= 0; i--) {
+		value = (value << 8) | bytes[i];
+	}
+	return value;
+}
+
+inline uint32_t OutboxCRC32(const void * data, size_t numBytes)
+{
+	struct Table
+	{
+		uint32_t entries[256];
+		Table()
+		{
+			for (uint32_t i = 0; i < 256; i++) {
+				uint32_t crc = i;
+				for (int bit = 0; bit < 8; bit++) {
+					crc = crc & 1 ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+				}
+				entries[i] = crc;
+			}
+		}
+	};
+	static const Table TABLE;
+
+	const unsigned char * bytes = (const unsigned char *)data;
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < numBytes; i++) {
+		crc = TABLE.entries[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc ^ 0xFFFFFFFF;
+}
+
+/**
+ * Desc: Decodes the record header at bytes.
+ * Retr: Whether the payload size is possible.
+**/
+static inline bool OutboxParseHeader(const unsigned char * bytes, uint32_t * numBytes,
+	uint32_t * crc, long long * seq)
+{
+	*numBytes = OutboxGet32(bytes);
+	*crc = OutboxGet32(bytes + 4);
+	*seq = (long long)OutboxGet64(bytes + 8);
+	return *numBytes <= OUTBOX_MAX_RECORD_SIZE;
+}
+
+/**
+ * Desc: Writes all of data to fd, or returns false.
+**/
+static inline bool OutboxWriteAll(int fd, const char * data, size_t numBytes)
+{
+	while (numBytes > 0) {
+		ssize_t written = write(fd, data, numBytes);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data += written;
+		numBytes -= (size_t)written;
+	}
+	return true;
+}
+
+/**
+ * Desc: Replaces the file at path with text, synced, through a temporary
+ *       file, so a crash leaves the old text or the new.
+**/
+static inline int OutboxSaveFile(int dirFd, const std::string & path, const std::string & text)
+{
+	std::string temporary = path + ".tmp";
+	int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return LJME_UNKNOWN_ERROR;
+	}
+	bool ok = OutboxWriteAll(fd, text.data(), text.size()) && fdatasync(fd) == 0;
+	ok = close(fd) == 0 && ok;
+	if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+		unlink(temporary.c_str());
+		return LJME_UNKNOWN_ERROR;
+	}
+	fsync(dirFd);
+	return LJME_NOERROR;
+}
+
+static inline std::string OutboxLoadFile(const std::string & path)
+{
+	std::string text;
+	char chunk[256];
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return text;
+	}
+	ssize_t numRead;
+	while ((numRead = read(fd, chunk, sizeof(chunk))) > 0) {
+		text.append(chunk, (size_t)numRead);
+	}
+	close(fd);
+	return text;
+}
+
+inline UploadOutbox::UploadOutbox() :
+	segmentBytes(OUTBOX_DEFAULT_SEGMENT_BYTES),
+	syncInterval(OUTBOX_DEFAULT_SYNC_MS),
+	maxBufferedBytes(OUTBOX_DEFAULT_MAX_BUFFERED_BYTES),
+	dirFd(-1),
+	isOpen(false),
+	stopping(false),
+	syncRequested(false),
+	bufferFirstSeq(1),
+	nextSeq(1),
+	durableSeq(0),
+	ackedThrough(0),
+	savedAcked(0),
+	writeFd(-1),
+	writeBytes(0),
+	readSeq(1),
+	readSegment(-1),
+	readFd(-1),
+	readOffset(0),
+	chunkOffset(0)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+inline UploadOutbox::~UploadOutbox()
+{
+	Close();
+}
+
+inline void UploadOutbox::SetSegmentBytes(int newSegmentBytes)
+{
+	segmentBytes = newSegmentBytes > 0 ? newSegmentBytes : 1;
+}
+
+inline void UploadOutbox::SetSyncMS(int newSyncMS)
+{
+	syncInterval = std::chrono::milliseconds(newSyncMS > 0 ? newSyncMS : 0);
+}
+
+inline void UploadOutbox::SetMaxBufferedBytes(int newMaxBufferedBytes)
+{
+	maxBufferedBytes = newMaxBufferedBytes > 0 ? (size_t)newMaxBufferedBytes : 1;
+}
+
+inline std::string UploadOutbox::SegmentPath(long long firstSeq) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.log", (unsigned long long)firstSeq);
+	return directory + name;
+}
+
+inline int UploadOutbox::Open(const char * newDirectory)
+{
+	int err;
+
+	Close();
+	directory = newDirectory;
+	if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+		return LJME_INVALID_PARAMETER;
+	}
+	dirFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+	if (dirFd < 0) {
+		return LJME_INVALID_PARAMETER;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	err = LoadOrigin();
+	if (err == LJME_NOERROR) {
+		err = Recover();
+	}
+	if (err != LJME_NOERROR) {
+		if (writeFd >= 0) {
+			close(writeFd);
+			writeFd = -1;
+		}
+		close(dirFd);
+		dirFd = -1;
+		return err;
+	}
+
+	buffer.clear();
+	buffer.reserve(OUTBOX_READ_CHUNK);
+	writeBuffer.clear();
+	writeBuffer.reserve(OUTBOX_READ_CHUNK);
+	bufferFirstSeq = nextSeq;
+	durableSeq = nextSeq - 1;
+	savedAcked = ackedThrough;
+	ackedAhead.clear();
+	readSeq = ackedThrough + 1;
+	readSegment = -1;
+	stats.readSeq = readSeq;
+	stopping = false;
+	syncRequested = false;
+	isOpen = true;
+	writer = std::thread(&UploadOutbox::Run, this);
+	return LJME_NOERROR;
+}
+
+inline int UploadOutbox::LoadOrigin()
+{
+	std::string path = directory + "/origin";
+	origin = OutboxLoadFile(path);
+	while (!origin.empty() && (origin.back() == '\n' || origin.back() == '\r')) {
+		origin.pop_back();
+	}
+	if (!origin.empty()) {
+		return LJME_NOERROR;
+	}
+
+	unsigned char random[8];
+	int fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0 || read(fd, random, sizeof(random)) != (ssize_t)sizeof(random)) {
+		uint64_t fallback = (uint64_t)time(NULL) * 2654435761u ^ (uint64_t)getpid() ^
+			(uint64_t)Clock::now().time_since_epoch().count();
+		OutboxPut64(random, fallback);
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	char hex[sizeof(random) * 2 + 1];
+	for (size_t i = 0; i < sizeof(random); i++) {
+		snprintf(hex + i * 2, 3, "%02x", random[i]);
+	}
+	origin = hex;
+	return OutboxSaveFile(dirFd, path, origin + "\n");
+}
+
+/**
+ * Desc: Finds the segments and the acknowledged position, removes segments
+ *       already acknowledged and repairs the last segment. Call from Open.
+**/
+inline int UploadOutbox::Recover()
+{
+	std::vector<long long> firsts;
+	long long lastSeq = 0;
+	int err;
+
+	ackedThrough = atoll(OutboxLoadFile(directory + "/acked").c_str());
+	if (ackedThrough < 0) {
+		ackedThrough = 0;
+	}
+
+	DIR * dir = opendir(directory.c_str());
+	if (dir == NULL) {
+		return LJME_INVALID_PARAMETER;
+	}
+	struct dirent * entry;
+	while ((entry = readdir(dir)) != NULL) {
+		char * end;
+		unsigned long long firstSeq = strtoull(entry->d_name, &end, 16);
+		if (strlen(entry->d_name) == 20 && end == entry->d_name + 16 &&
+			strcmp(end, ".log") == 0 && firstSeq > 0)
+		{
+			firsts.push_back((long long)firstSeq);
+		}
+	}
+	closedir(dir);
+	std::sort(firsts.begin(), firsts.end());
+
+	segments.clear();
+	for (size_t i = 0; i < firsts.size(); i++) {
+		// Deleted by Compact once acked was saved, but maybe not yet
+		if (i + 1 < firsts.size() && firsts[i + 1] - 1 <= ackedThrough) {
+			unlink(SegmentPath(firsts[i]).c_str());
+			continue;
+		}
+		struct stat info;
+		Segment segment = {firsts[i], 0};
+		if (stat(SegmentPath(firsts[i]).c_str(), &info) == 0) {
+			segment.numBytes = info.st_size;
+		}
+		segments.push_back(segment);
+	}
+
+	if (!segments.empty()) {
+		err = RecoverSegment(segments.back(), &lastSeq);
+		if (err != LJME_NOERROR) {
+			return err;
+		}
+		if (lastSeq < segments.back().firstSeq) {
+			// Not one whole record; the next record starts a new segment
+			unlink(SegmentPath(segments.back().firstSeq).c_str());
+			lastSeq = segments.back().firstSeq - 1;
+			segments.pop_back();
+		}
+	}
+	nextSeq = std::max(lastSeq, ackedThrough) + 1;
+
+	if (!segments.empty() && segments.back().numBytes < segmentBytes) {
+		writeFd = open(SegmentPath(segments.back().firstSeq).c_str(), O_WRONLY | O_APPEND);
+		if (writeFd < 0) {
+			return LJME_UNKNOWN_ERROR;
+		}
+		writeBytes = segments.back().numBytes;
+	}
+	return LJME_NOERROR;
+}
+
+/**
+ * Desc: Cuts segment's file after its last whole, correct record.
+ * Para: lastSeq, set to the sequence number of that record.
+**/
+inline int UploadOutbox::RecoverSegment(Segment & segment, long long * lastSeq)
+{
+	std::string path = SegmentPath(segment.firstSeq);
+	std::string contents = OutboxLoadFile(path);
+	long long expected = segment.firstSeq;
+	size_t offset = 0;
+
+	while (offset + OUTBOX_HEADER_SIZE <= contents.size()) {
+		const unsigned char * header = (const unsigned char *)contents.data() + offset;
+		uint32_t numBytes, crc;
+		long long seq;
+		if (!OutboxParseHeader(header, &numBytes, &crc, &seq) || seq != expected ||
+			offset + OUTBOX_HEADER_SIZE + numBytes > contents.size() ||
+			OutboxCRC32(header + OUTBOX_HEADER_SIZE, numBytes) != crc)
+		{
+			break;
+		}
+		offset += OUTBOX_HEADER_SIZE + numBytes;
+		expected++;
+	}
+	*lastSeq = expected - 1;
+
+	if (offset < contents.size()) {
+		stats.truncatedBytes += (long long)(contents.size() - offset);
+		if (truncate(path.c_str(), (off_t)offset) != 0) {
+			return LJME_UNKNOWN_ERROR;
+		}
+	}
+	segment.numBytes = (long long)offset;
+	return LJME_NOERROR;
+}
+
+inline void UploadOutbox::Close()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!isOpen) {
+			return;
+		}
+		stopping = true;
+	}
+	changed.notify_one();
+	writer.join();
+
+	std::lock_guard<std::mutex> readLock(readMutex);
+	std::lock_guard<std::mutex> lock(mutex);
+	isOpen = false;
+	if (writeFd >= 0) {
+		close(writeFd);
+		writeFd = -1;
+	}
+	if (readFd >= 0) {
+		close(readFd);
+		readFd = -1;
+	}
+	readSegment = -1;
+	close(dirFd);
+	dirFd = -1;
+	synced.notify_all();
+}
+
+inline int UploadOutbox::Append(const std::string & payload, long long * seq)
+{
+	Clock::time_point begin = Clock::now();
+	unsigned char header[OUTBOX_HEADER_SIZE];
+	long long recordSeq;
+	bool wasEmpty;
+	bool wake;
+
+	if (payload.size() > OUTBOX_MAX_RECORD_SIZE) {
+		return LJME_INVALID_PARAMETER;
+	}
+	uint32_t crc = OutboxCRC32(payload.data(), payload.size());
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!isOpen || stopping) {
+			return LJME_INVALID_PARAMETER;
+		}
+		if (buffer.size() + OUTBOX_HEADER_SIZE + payload.size() > maxBufferedBytes) {
+			++stats.dropped;
+			return LJME_LJM_BUFFER_FULL;
+		}
+
+		recordSeq = nextSeq++;
+		OutboxPut32(header, (uint32_t)payload.size());
+		OutboxPut32(header + 4, crc);
+		OutboxPut64(header + 8, (uint64_t)recordSeq);
+
+		wasEmpty = buffer.empty();
+		if (wasEmpty) {
+			bufferFirstSeq = recordSeq;
+			bufferSince = begin;
+		}
+		size_t quarter = maxBufferedBytes / 4;
+		wake = wasEmpty || (buffer.size() < quarter &&
+			buffer.size() + OUTBOX_HEADER_SIZE + payload.size() >= quarter);
+		buffer.insert(buffer.end(), (const char *)header, (const char *)header + sizeof(header));
+		buffer.insert(buffer.end(), payload.begin(), payload.end());
+
+		++stats.appended;
+		if ((long long)buffer.size() > stats.maxBufferedBytes) {
+			stats.maxBufferedBytes = (long long)buffer.size();
+		}
+		double appendUS = std::chrono::duration<double, std::micro>(
+			Clock::now() - begin).count();
+		if (appendUS > stats.maxAppendUS) {
+			stats.maxAppendUS = appendUS;
+		}
+	}
+
+	// The writer only needs waking for the first record's deadline, or once
+	// a quarter of the buffer is used
+	if (wake) {
+		changed.notify_one();
+	}
+	if (seq) {
+		*seq = recordSeq;
+	}
+	return LJME_NOERROR;
+}
+
+inline int UploadOutbox::Sync()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	long long target = nextSeq - 1;
+	syncRequested = true;
+	changed.notify_one();
+	synced.wait(lock, [&] { return !isOpen || durableSeq >= target; });
+	return durableSeq >= target ? LJME_NOERROR : LJME_UNKNOWN_ERROR;
+}
+
+/**
+ * Desc: Writes batch, whose first record is firstSeq, to the log and syncs
+ *       it, starting a new segment whenever the current one holds
+ *       segmentBytes. Makes each part durable as it is synced. Called by the
+ *       writer thread without mutex.
+ * Para: numWritten, set to the bytes of batch on disk, also on error.
+**/
+inline int UploadOutbox::WriteBatch(const std::vector<char> & batch, long long firstSeq,
+	size_t * numWritten)
+{
+	size_t offset = 0;
+	long long seq = firstSeq;
+
+	*numWritten = 0;
+	while (offset < batch.size()) {
+		if (writeFd < 0 || writeBytes >= segmentBytes) {
+			int fd = open(SegmentPath(seq).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+				0644);
+			if (fd < 0) {
+				return LJME_UNKNOWN_ERROR;
+			}
+			fsync(dirFd);
+			if (writeFd >= 0) {
+				close(writeFd);
+			}
+			writeFd = fd;
+			writeBytes = 0;
+
+			// A segment made for records that failed to write is reused
+			std::lock_guard<std::mutex> lock(mutex);
+			if (segments.empty() || segments.back().firstSeq != seq) {
+				Segment segment = {seq, 0};
+				segments.push_back(segment);
+				++stats.segmentsCreated;
+			}
+		}
+
+		// The whole records that fit in the segment, and at least one
+		size_t end = offset;
+		while (end < batch.size() &&
+			(end == offset || writeBytes + (long long)(end - offset) < segmentBytes))
+		{
+			end += OUTBOX_HEADER_SIZE + OutboxGet32((const unsigned char *)&batch[end]);
+			seq++;
+		}
+
+		if (!OutboxWriteAll(writeFd, &batch[offset], end - offset) || fdatasync(writeFd) != 0) {
+			// Leave the segment as it was, for the records to be written again
+			if (ftruncate(writeFd, (off_t)writeBytes) != 0) {
+				close(writeFd);
+				writeFd = -1;
+			}
+			return LJME_UNKNOWN_ERROR;
+		}
+		writeBytes += (long long)(end - offset);
+		offset = end;
+		*numWritten = offset;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		segments.back().numBytes = writeBytes;
+		durableSeq = seq - 1;
+		synced.notify_all();
+	}
+	return LJME_NOERROR;
+}
+
+inline int UploadOutbox::SaveAcked(long long seq)
+{
+	char text[32];
+	snprintf(text, sizeof(text), "%lld\n", seq);
+	return OutboxSaveFile(dirFd, directory + "/acked", text);
+}
+
+/**
+ * Desc: Deletes the segments whose records are all acknowledged in the saved
+ *       acked file. Never deletes the last segment. Called by the writer
+ *       thread without mutex.
+**/
+inline void UploadOutbox::Compact()
+{
+	std::vector<long long> removed;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		while (segments.size() > 1 && segments[1].firstSeq - 1 <= savedAcked) {
+			removed.push_back(segments.front().firstSeq);
+			segments.pop_front();
+			++stats.segmentsRemoved;
+		}
+	}
+	for (size_t i = 0; i < removed.size(); i++) {
+		unlink(SegmentPath(removed[i]).c_str());
+	}
+}
+
+inline void UploadOutbox::Run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		changed.wait(lock, [this] {
+			return stopping || syncRequested || !buffer.empty() || savedAcked != ackedThrough;
+		});
+		Clock::time_point due = (buffer.empty() ? Clock::now() : bufferSince) + syncInterval;
+		changed.wait_until(lock, due, [this] {
+			return stopping || syncRequested || buffer.size() >= maxBufferedBytes / 4;
+		});
+		syncRequested = false;
+
+		long long firstSeq = bufferFirstSeq;
+		long long acked = ackedThrough;
+		writeBuffer.clear();
+		writeBuffer.swap(buffer);
+		lock.unlock();
+
+		int err = LJME_NOERROR;
+		size_t numWritten = 0;
+		double syncMS = 0;
+		if (!writeBuffer.empty()) {
+			Clock::time_point begin = Clock::now();
+			err = WriteBatch(writeBuffer, firstSeq, &numWritten);
+			syncMS = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+		}
+		int ackErr = acked != savedAcked ? SaveAcked(acked) : LJME_NOERROR;
+
+		lock.lock();
+		if (err != LJME_NOERROR) {
+			// Put the rest of the batch back in front of the records appended
+			// since
+			++stats.writeErrors;
+			writeBuffer.erase(writeBuffer.begin(), writeBuffer.begin() + numWritten);
+			writeBuffer.insert(writeBuffer.end(), buffer.begin(), buffer.end());
+			buffer.swap(writeBuffer);
+			bufferFirstSeq = durableSeq + 1;
+			bufferSince = Clock::now();
+		}
+		else if (!writeBuffer.empty()) {
+			++stats.syncs;
+			stats.totalSyncMS += syncMS;
+			if (syncMS > stats.maxSyncMS) {
+				stats.maxSyncMS = syncMS;
+			}
+		}
+		if (ackErr != LJME_NOERROR) {
+			++stats.writeErrors;
+		}
+		else {
+			savedAcked = acked;
+		}
+		synced.notify_all();
+
+		if (stopping) {
+			// Records appended and acknowledgements made while this batch was
+			// written are still to be saved, unless the disk is failing
+			if ((buffer.empty() && savedAcked == ackedThrough) ||
+				err != LJME_NOERROR || ackErr != LJME_NOERROR)
+			{
+				break;
+			}
+			continue;
+		}
+		if (ackErr == LJME_NOERROR && savedAcked > 0) {
+			lock.unlock();
+			Compact();
+			lock.lock();
+		}
+		if (err != LJME_NOERROR || ackErr != LJME_NOERROR) {
+			// Try again after a sync interval rather than at once
+			changed.wait_for(lock, syncInterval, [this] { return stopping; });
+		}
+	}
+}
+
+/**
+ * Desc: Returns the numBytes bytes at offset in the segment being read,
+ *       reading them into chunk first if need be, or NULL if they aren't
+ *       within its first segmentBytes. Call with readMutex held.
+**/
+inline const char * UploadOutbox::ReadAt(long long offset, size_t numBytes,
+	long long segmentBytes)
+{
+	if (offset + (long long)numBytes > segmentBytes) {
+		return NULL;
+	}
+	if (offset < chunkOffset || offset + (long long)numBytes > chunkOffset + (long long)chunk.size()) {
+		size_t chunkSize = std::min((long long)std::max(numBytes, (size_t)OUTBOX_READ_CHUNK),
+			segmentBytes - offset);
+		chunk.resize(chunkSize);
+		size_t numRead = 0;
+		while (numRead < chunkSize) {
+			ssize_t result = pread(readFd, &chunk[numRead], chunkSize - numRead,
+				(off_t)(offset + (long long)numRead));
+			if (result < 0 && errno == EINTR) {
+				continue;
+			}
+			if (result <= 0) {
+				break;
+			}
+			numRead += (size_t)result;
+		}
+		chunk.resize(numRead);
+		chunkOffset = offset;
+		if (numRead < numBytes) {
+			return NULL;
+		}
+	}
+	return &chunk[(size_t)(offset - chunkOffset)];
+}
+
+inline void UploadOutbox::Read(int maxRecords, int timeoutMS,
+	std::vector<OutboxRecord> * records)
+{
+	std::lock_guard<std::mutex> readLock(readMutex);
+	long long durable;
+	long long numCorrupt = 0;
+	long long numLost = 0;
+	std::vector<std::pair<long long, long long> > lost;
+
+	records->clear();
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (timeoutMS > 0) {
+			synced.wait_for(lock, std::chrono::milliseconds(timeoutMS),
+				[this] { return !isOpen || stopping || durableSeq >= readSeq; });
+		}
+		if (!isOpen) {
+			return;
+		}
+		durable = durableSeq;
+	}
+
+	long long firstSeq = 0, numBytes = 0, nextFirstSeq = 0;
+	bool last = false;
+	bool located = false;
+	while ((int)records->size() < maxRecords && readSeq <= durable) {
+		// Find the segment holding readSeq, and where the next one starts.
+		// Only at a segment's end, to keep mutex free for Append
+		if (!located || readOffset >= numBytes || readSeq >= nextFirstSeq) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (segments.empty()) {
+				break;
+			}
+			size_t i = 0;
+			while (i + 1 < segments.size() && segments[i + 1].firstSeq <= readSeq) {
+				i++;
+			}
+			firstSeq = segments[i].firstSeq;
+			numBytes = segments[i].numBytes;
+			last = i + 1 == segments.size();
+			nextFirstSeq = last ? durable + 1 : segments[i + 1].firstSeq;
+			located = true;
+		}
+		if (readSeq < firstSeq) {
+			readSeq = firstSeq;
+		}
+
+		if (readSegment != firstSeq) {
+			if (readFd >= 0) {
+				close(readFd);
+			}
+			readFd = open(SegmentPath(firstSeq).c_str(), O_RDONLY);
+			readSegment = firstSeq;
+			readOffset = 0;
+			chunk.clear();
+			chunkOffset = 0;
+		}
+
+		if (readOffset >= numBytes) {
+			if (last) {
+				break;
+			}
+			numLost += nextFirstSeq - readSeq;
+			lost.push_back(std::make_pair(readSeq, nextFirstSeq));
+			readSeq = nextFirstSeq;
+			continue;
+		}
+
+		const unsigned char * header = NULL;
+		const char * payload = NULL;
+		uint32_t payloadBytes = 0, crc = 0;
+		long long seq = 0;
+		if (readFd >= 0) {
+			header = (const unsigned char *)ReadAt(readOffset, OUTBOX_HEADER_SIZE, numBytes);
+		}
+		if (header && OutboxParseHeader(header, &payloadBytes, &crc, &seq)) {
+			payload = ReadAt(readOffset + OUTBOX_HEADER_SIZE, payloadBytes, numBytes);
+		}
+		if (payload == NULL || seq > readSeq || OutboxCRC32(payload, payloadBytes) != crc) {
+			// Nothing after a bad record in its segment can be trusted
+			numCorrupt++;
+			numLost += nextFirstSeq - readSeq;
+			lost.push_back(std::make_pair(readSeq, nextFirstSeq));
+			readSeq = nextFirstSeq;
+			readOffset = numBytes;
+			continue;
+		}
+
+		readOffset += OUTBOX_HEADER_SIZE + payloadBytes;
+		if (seq < readSeq) {
+			// Rewound to a record further into the segment
+			continue;
+		}
+		OutboxRecord record;
+		record.seq = seq;
+		record.payload.assign(payload, payloadBytes);
+		records->push_back(std::move(record));
+		readSeq++;
+	}
+
+	{
+		// Lost records count as acknowledged, or they would hold back
+		// ackedThrough, and with it Compact and Rewind, for good
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < lost.size(); i++) {
+			AcknowledgeRange(lost[i].first, lost[i].second);
+		}
+		stats.corruptRecords += numCorrupt;
+		stats.lostRecords += numLost;
+		stats.readSeq = readSeq;
+	}
+	if (!lost.empty()) {
+		changed.notify_one();
+	}
+}
+
+inline void UploadOutbox::Rewind()
+{
+	std::lock_guard<std::mutex> readLock(readMutex);
+	std::lock_guard<std::mutex> lock(mutex);
+	readSeq = ackedThrough + 1;
+	readSegment = -1;
+	stats.readSeq = readSeq;
+}
+
+inline void UploadOutbox::Acknowledge(long long seq)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		long long before = ackedThrough;
+		AcknowledgeRange(seq, seq + 1);
+		if (ackedThrough == before) {
+			return;
+		}
+	}
+	changed.notify_one();
+}
+
+/**
+ * Desc: Acknowledges the records from firstSeq up to endSeq, not including
+ *       it. Call with mutex held.
+**/
+inline void UploadOutbox::AcknowledgeRange(long long firstSeq, long long endSeq)
+{
+	firstSeq = std::max(firstSeq, ackedThrough + 1);
+	if (firstSeq > ackedThrough + 1) {
+		for (long long seq = firstSeq; seq < endSeq; seq++) {
+			ackedAhead.insert(seq);
+		}
+		return;
+	}
+	ackedThrough = std::max(ackedThrough, endSeq - 1);
+	while (!ackedAhead.empty() && *ackedAhead.begin() <= ackedThrough + 1) {
+		ackedThrough = std::max(ackedThrough, *ackedAhead.begin());
+		ackedAhead.erase(ackedAhead.begin());
+	}
+}
+
+inline int UploadOutbox::Reject(const OutboxRecord & record)
+{
+	char seq[32];
+	snprintf(seq, sizeof(seq), "%lld ", record.seq);
+	std::string line = seq + record.payload + "\n";
+
+	int fd = open((directory + "/rejected").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0) {
+		return LJME_UNKNOWN_ERROR;
+	}
+	bool ok = OutboxWriteAll(fd, line.data(), line.size()) && fdatasync(fd) == 0;
+	ok = close(fd) == 0 && ok;
+	if (!ok) {
+		return LJME_UNKNOWN_ERROR;
+	}
+	Acknowledge(record.seq);
+	return LJME_NOERROR;
+}
+
+inline void UploadOutbox::GetStats(UploadOutboxStats * result)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	*result = stats;
+	result->lastSeq = nextSeq - 1;
+	result->durableSeq = durableSeq;
+	result->ackedThrough = ackedThrough;
+	result->numSegments = (int)segments.size();
+	result->diskBytes = 0;
+	for (size_t i = 0; i < segments.size(); i++) {
+		result->diskBytes += segments[i].numBytes;
+	}
+	result->bufferedBytes = (long long)buffer.size();
+}
+
+inline OutboxUploader::OutboxUploader(UploadOutbox * outbox) :
+	outbox(outbox),
+	method("insertDataBatch"),
+	maxPoints(UPLOAD_DEFAULT_MAX_POINTS),
+	maxDelayMS(UPLOAD_DEFAULT_MAX_DELAY_MS),
+	maxOutstanding(OUTBOX_DEFAULT_MAX_OUTSTANDING),
+	maxRejections(OUTBOX_DEFAULT_MAX_REJECTIONS),
+	ipAddress(0),
+	port(0),
+	stopTimeoutMS(0),
+	rewindNeeded(false),
+	outstanding(0),
+	stopping(false)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+inline OutboxUploader::~OutboxUploader()
+{
+	Stop();
+}
+
+inline void OutboxUploader::Start(unsigned int newIPAddress, int newPort)
+{
+	Stop();
+	ipAddress = newIPAddress;
+	port = newPort;
+	stopping = false;
+	uploader = std::thread(&OutboxUploader::Run, this);
+}
+
+inline void OutboxUploader::Stop(int timeoutMS)
+{
+	if (!uploader.joinable()) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		stopTimeoutMS = timeoutMS;
+	}
+	changed.notify_all();
+	uploader.join();
+}
+
+inline void OutboxUploader::GetStats(OutboxUploaderStats * result)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	*result = stats;
+	result->connected = client.IsConnected();
+}
+
+/**
+ * Desc: Returns the point of record's insertData params with an _id.
+ * Para: room, set to the params' room, or empty if they have none.
+**/
+inline std::string OutboxUploader::Point(const OutboxRecord & record,
+	std::string * room) const
+{
+	std::vector<std::string> elements;
+	char id[64];
+
+	DDPSplitArray(record.payload, &elements);
+	room->clear();
+	if (elements.size() > 1) {
+		*room = elements[0];
+	}
+	std::string object = elements.size() > 1 ? elements[1] : "{}";
+	size_t brace = object.find('{');
+	if (brace == std::string::npos) {
+		object = "{}";
+		brace = 0;
+	}
+
+	snprintf(id, sizeof(id), "%s-%lld", outbox->GetOrigin().c_str(), record.seq);
+	std::string point = "{\"_id\": " + DDPQuote(id);
+	size_t rest = object.find_first_not_of(" \t\r\n", brace + 1);
+	if (rest != std::string::npos && object[rest] != '}') {
+		point += ", ";
+	}
+	point.append(object, brace + 1, std::string::npos);
+	return point;
+}
+
+/**
+ * Desc: Returns the batcher for room's points, making it if need be.
+**/
+inline UploadBatcher * OutboxUploader::Batcher(const std::string & room)
+{
+	std::unique_ptr<UploadBatcher> & batcher = batchers[room];
+	if (!batcher) {
+		batcher.reset(new UploadBatcher(&client, method, room));
+		batcher->SetMaxPoints(maxPoints);
+		batcher->SetMaxDelayMS(maxDelayMS);
+		batcher->SetAck([this](long long seq, int err) { Acknowledged(seq, err); });
+	}
+	return batcher.get();
+}
+
+/**
+ * Desc: Drains every batcher, for at most timeoutMS in all, or as long as
+ *       it takes if timeoutMS is negative.
+**/
+inline void OutboxUploader::DrainBatchers(int timeoutMS)
+{
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+		std::chrono::milliseconds(std::max(timeoutMS, 0));
+	std::map<std::string, std::unique_ptr<UploadBatcher> >::iterator it;
+	for (it = batchers.begin(); it != batchers.end(); ++it) {
+		int remainingMS = -1;
+		if (timeoutMS >= 0) {
+			remainingMS = (int)std::max((long long)0,
+				(long long)std::chrono::duration_cast<std::chrono::milliseconds>(
+					deadline - std::chrono::steady_clock::now()).count());
+		}
+		it->second->Drain(remainingMS);
+	}
+}
+
+/**
+ * Desc: The UploadBatcher's ack, on the DDPClient's I/O thread.
+**/
+inline void OutboxUploader::Acknowledged(long long seq, int err)
+{
+	if (err == LJME_NOERROR) {
+		outbox->Acknowledge(seq);
+	}
+	else {
+		rewindNeeded = true;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (err == LJME_NOERROR) {
+		++stats.acked;
+		if (!rejections.empty()) {
+			rejections.erase(seq);
+		}
+	}
+	else if (err == UPLOAD_POINT_REJECTED) {
+		++rejections[seq];
+	}
+	if (--outstanding < maxOutstanding) {
+		changed.notify_all();
+	}
+}
+
+inline void OutboxUploader::Run()
+{
+	std::vector<OutboxRecord> records;
+	std::vector<OutboxRecord> rejected;
+	std::vector<std::string> points;
+	std::vector<std::string> rooms;
+	bool connected = false;
+	int reconnectMS = OUTBOX_MIN_RECONNECT_MS;
+
+	while (true) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (stopping) {
+				break;
+			}
+		}
+
+		if (!client.IsConnected()) {
+			if (connected) {
+				// The batchers give up on what they hold once their retries fail
+				DrainBatchers(-1);
+				batchers.clear();
+				connected = false;
+				std::lock_guard<std::mutex> lock(mutex);
+				++stats.disconnects;
+			}
+			if (client.Connect(ipAddress, port) != LJME_NOERROR) {
+				std::unique_lock<std::mutex> lock(mutex);
+				++stats.failedConnects;
+				changed.wait_for(lock, std::chrono::milliseconds(reconnectMS),
+					[this] { return stopping; });
+				reconnectMS = std::min(reconnectMS * 2, (int)OUTBOX_MAX_RECONNECT_MS);
+				continue;
+			}
+			reconnectMS = OUTBOX_MIN_RECONNECT_MS;
+			connected = true;
+			rewindNeeded = true;
+
+			std::lock_guard<std::mutex> lock(mutex);
+			++stats.connects;
+		}
+
+		if (rewindNeeded) {
+			DrainBatchers(-1);
+			rewindNeeded = false;
+			outbox->Rewind();
+			std::lock_guard<std::mutex> lock(mutex);
+			++stats.rewinds;
+		}
+
+		int room;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait_for(lock, std::chrono::milliseconds(100),
+				[this] { return stopping || outstanding < maxOutstanding; });
+			room = maxOutstanding - outstanding;
+		}
+		if (room <= 0) {
+			continue;
+		}
+
+		outbox->Read(room, 100, &records);
+		if (records.empty()) {
+			continue;
+		}
+		points.resize(records.size());
+		rooms.resize(records.size());
+		for (size_t i = 0; i < records.size(); i++) {
+			points[i] = Point(records[i], &rooms[i]);
+		}
+		{
+			// Records rejected often enough, and records without a room, are
+			// set aside instead of sent
+			std::lock_guard<std::mutex> lock(mutex);
+			size_t numKept = 0;
+			for (size_t i = 0; i < records.size(); i++) {
+				bool setAside = rooms[i].empty();
+				if (!setAside && !rejections.empty()) {
+					std::map<long long, int>::iterator it = rejections.find(records[i].seq);
+					if (it != rejections.end() && it->second >= maxRejections) {
+						rejections.erase(it);
+						setAside = true;
+					}
+				}
+				if (setAside) {
+					rejected.push_back(std::move(records[i]));
+				}
+				else if (numKept++ != i) {
+					records[numKept - 1] = std::move(records[i]);
+					points[numKept - 1].swap(points[i]);
+					rooms[numKept - 1].swap(rooms[i]);
+				}
+			}
+			records.resize(numKept);
+			outstanding += (int)records.size();
+			stats.sent += (long long)records.size();
+		}
+		for (size_t i = 0; i < records.size(); i++) {
+			Batcher(rooms[i])->Add(records[i].seq, points[i]);
+		}
+
+		for (size_t i = 0; i < rejected.size(); i++) {
+			int err = outbox->Reject(rejected[i]);
+			std::lock_guard<std::mutex> lock(mutex);
+			if (err == LJME_NOERROR) {
+				++stats.rejected;
+			}
+			else {
+				// Tried again after the next rewind
+				rejections[rejected[i].seq] = maxRejections;
+				rewindNeeded = true;
+			}
+		}
+		rejected.clear();
+	}
+
+	DrainBatchers(stopTimeoutMS);
+	client.Close();
+	batchers.clear();
+}
+
+#endif // #ifndef LJM_UPLOAD_OUTBOX
@@ -0,0 +1,308 @@
+/**
+ * Name: LJM_WebSocket.h
+ * Desc: The parts of the WebSocket protocol (RFC 6455) a DDP client and its
+ *       stand-in server need: the opening handshake's key and accept
+ *       values, and encoding and decoding frames. No sockets; the caller
+ *       sends and receives the bytes. C++11.
+**/
+
+#ifndef LJM_WEB_SOCKET
+#define LJM_WEB_SOCKET
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include <string>
+#include <vector>
+
+enum WebSocketOpcode {
+	WEB_SOCKET_CONTINUATION = 0x0,
+	WEB_SOCKET_TEXT = 0x1,
+	WEB_SOCKET_BINARY = 0x2,
+	WEB_SOCKET_CLOSE = 0x8,
+	WEB_SOCKET_PING = 0x9,
+	WEB_SOCKET_PONG = 0xA
+};
+
+// Largest frame header: 2 bytes, a 64-bit length and a 4-byte mask
+enum { WEB_SOCKET_MAX_HEADER_SIZE = 14 };
+
+// Bytes in a SHA-1 digest
+enum { WEB_SOCKET_SHA1_SIZE = 20 };
+
+/**
+ * Desc: Computes the SHA-1 digest of data, for the handshake's accept value.
+**/
+void WebSocketSHA1(const unsigned char * data, size_t numBytes,
+	unsigned char digest[WEB_SOCKET_SHA1_SIZE]);
+
+std::string WebSocketBase64(const unsigned char * data, size_t numBytes);
+
+/**
+ * Desc: Returns the Sec-WebSocket-Accept value a server answers key with.
+**/
+std::string WebSocketAccept(const std::string & key);
+
+/**
+ * Desc: Returns the value of header name in an HTTP request or response, or
+ *       an empty string. name is matched without regard to case.
+**/
+std::string WebSocketHeader(const std::string & head, const char * name);
+
+/**
+ * Desc: Appends a frame of opcode with the payload to frames. Clients mask
+ *       their frames with mask; servers pass 0 and don't.
+**/
+void WebSocketAppendFrame(std::vector<unsigned char> & frames, int opcode,
+	const char * payload, size_t numBytes, uint32_t mask);
+
+/**
+ * Desc: A frame decoded by WebSocketParseFrame.
+**/
+struct WebSocketFrame
+{
+	int opcode;
+	bool final;
+	size_t headerSize;
+	size_t payloadSize;
+};
+
+/**
+ * Desc: Decodes the frame at the start of data and unmasks its payload in
+ *       place, which then starts at data + frame->headerSize.
+ * Retr: The frame's size, 0 if data doesn't hold all of it yet, or -1 if
+ *       it is larger than maxPayload.
+**/
+long long WebSocketParseFrame(unsigned char * data, size_t numBytes, size_t maxPayload,
+	WebSocketFrame * frame);
+
+
+// Source
+
+static inline uint32_t WebSocketRotate(uint32_t value, int bits)
+{
+	return (value << bits) | (value >> (32 - bits));
+}
+
+inline void WebSocketSHA1(const unsigned char * data, size_t numBytes,
+	unsigned char digest[WEB_SOCKET_SHA1_SIZE])
+{
+	uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+	std::vector<unsigned char> message(data, data + numBytes);
+	uint64_t numBits = (uint64_t)numBytes * 8;
+	uint32_t w[80];
+	int i;
+
+	message.push_back(0x80);
+	while (message.size() % 64 != 56) {
+		message.push_back(0);
+	}
+	for (i = 7; i >= 0; i--) {
+		message.push_back((unsigned char)(numBits >> (i * 8)));
+	}
+
+	for (size_t block = 0; block < message.size(); block += 64) {
+		for (i = 0; i < 16; i++) {
+			w[i] = ((uint32_t)message[block + i * 4] << 24) |
+				((uint32_t)message[block + i * 4 + 1] << 16) |
+				((uint32_t)message[block + i * 4 + 2] << 8) |
+				(uint32_t)message[block + i * 4 + 3];
+		}
+		for (i = 16; i < 80; i++) {
+			w[i] = WebSocketRotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+		}
+
+		uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+		for (i = 0; i < 80; i++) {
+			uint32_t f, k;
+			if (i < 20) {
+				f = (b & c) | (~b & d);
+				k = 0x5A827999;
+			}
+			else if (i < 40) {
+				f = b ^ c ^ d;
+				k = 0x6ED9EBA1;
+			}
+			else if (i < 60) {
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8F1BBCDC;
+			}
+			else {
+				f = b ^ c ^ d;
+				k = 0xCA62C1D6;
+			}
+			uint32_t temp = WebSocketRotate(a, 5) + f + e + k + w[i];
+			e = d;
+			d = c;
+			c = WebSocketRotate(b, 30);
+			b = a;
+			a = temp;
+		}
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+	}
+
+	for (i = 0; i < WEB_SOCKET_SHA1_SIZE; i++) {
+		digest[i] = (unsigned char)(h[i / 4] >> (24 - (i % 4) * 8));
+	}
+}
+
+inline std::string WebSocketBase64(const unsigned char * data, size_t numBytes)
+{
+	static const char DIGITS[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string encoded;
+
+	for (size_t i = 0; i < numBytes; i += 3) {
+		uint32_t group = (uint32_t)data[i] << 16;
+		if (i + 1 < numBytes) {
+			group |= (uint32_t)data[i + 1] << 8;
+		}
+		if (i + 2 < numBytes) {
+			group |= data[i + 2];
+		}
+		encoded += DIGITS[(group >> 18) & 0x3F];
+		encoded += DIGITS[(group >> 12) & 0x3F];
+		encoded += i + 1 < numBytes ? DIGITS[(group >> 6) & 0x3F] : '=';
+		encoded += i + 2 < numBytes ? DIGITS[group & 0x3F] : '=';
+	}
+	return encoded;
+}
+
+inline std::string WebSocketAccept(const std::string & key)
+{
+	std::string text = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+	unsigned char digest[WEB_SOCKET_SHA1_SIZE];
+	WebSocketSHA1((const unsigned char *)text.data(), text.size(), digest);
+	return WebSocketBase64(digest, sizeof(digest));
+}
+
+inline std::string WebSocketHeader(const std::string & head, const char * name)
+{
+	size_t nameLength = strlen(name);
+	size_t line = head.find("\r\n");
+
+	while (line != std::string::npos) {
+		line += 2;
+		size_t end = head.find("\r\n", line);
+		if (end == std::string::npos) {
+			end = head.size();
+		}
+		if (end - line > nameLength && head[line + nameLength] == ':' &&
+			strncasecmp(head.c_str() + line, name, nameLength) == 0)
+		{
+			size_t value = line + nameLength + 1;
+			while (value < end && head[value] == ' ') {
+				value++;
+			}
+			size_t valueEnd = end;
+			while (valueEnd > value && head[valueEnd - 1] == ' ') {
+				valueEnd--;
+			}
+			return head.substr(value, valueEnd - value);
+		}
+		line = end < head.size() ? end : std::string::npos;
+	}
+	return std::string();
+}
+
+inline void WebSocketAppendFrame(std::vector<unsigned char> & frames, int opcode,
+	const char * payload, size_t numBytes, uint32_t mask)
+{
+	unsigned char maskBit = mask ? 0x80 : 0;
+	int i;
+
+	frames.push_back((unsigned char)(0x80 | opcode));
+	if (numBytes < 126) {
+		frames.push_back((unsigned char)(maskBit | numBytes));
+	}
+	else if (numBytes <= 0xFFFF) {
+		frames.push_back((unsigned char)(maskBit | 126));
+		frames.push_back((unsigned char)(numBytes >> 8));
+		frames.push_back((unsigned char)numBytes);
+	}
+	else {
+		frames.push_back((unsigned char)(maskBit | 127));
+		for (i = 7; i >= 0; i--) {
+			frames.push_back((unsigned char)((uint64_t)numBytes >> (i * 8)));
+		}
+	}
+
+	if (!mask) {
+		frames.insert(frames.end(), payload, payload + numBytes);
+		return;
+	}
+
+	unsigned char key[4] = {(unsigned char)(mask >> 24), (unsigned char)(mask >> 16),
+		(unsigned char)(mask >> 8), (unsigned char)mask};
+	frames.insert(frames.end(), key, key + 4);
+	size_t start = frames.size();
+	frames.resize(start + numBytes);
+	for (size_t byteI = 0; byteI < numBytes; byteI++) {
+		frames[start + byteI] = (unsigned char)(payload[byteI] ^ key[byteI & 3]);
+	}
+}
+
+inline long long WebSocketParseFrame(unsigned char * data, size_t numBytes,
+	size_t maxPayload, WebSocketFrame * frame)
+{
+	size_t headerSize = 2;
+	uint64_t payloadSize;
+	int i;
+
+	if (numBytes < 2) {
+		return 0;
+	}
+	frame->opcode = data[0] & 0x0F;
+	frame->final = (data[0] & 0x80) != 0;
+	bool masked = (data[1] & 0x80) != 0;
+	payloadSize = data[1] & 0x7F;
+
+	if (payloadSize == 126) {
+		headerSize += 2;
+		if (numBytes < headerSize) {
+			return 0;
+		}
+		payloadSize = ((uint64_t)data[2] << 8) | data[3];
+	}
+	else if (payloadSize == 127) {
+		headerSize += 8;
+		if (numBytes < headerSize) {
+			return 0;
+		}
+		payloadSize = 0;
+		for (i = 0; i < 8; i++) {
+			payloadSize = (payloadSize << 8) | data[2 + i];
+		}
+	}
+	if (payloadSize > maxPayload) {
+		return -1;
+	}
+
+	unsigned char key[4] = {0, 0, 0, 0};
+	if (masked) {
+		if (numBytes < headerSize + 4) {
+			return 0;
+		}
+		memcpy(key, data + headerSize, 4);
+		headerSize += 4;
+	}
+	if (numBytes < headerSize + payloadSize) {
+		return 0;
+	}
+
+	if (masked) {
+		for (size_t byteI = 0; byteI < payloadSize; byteI++) {
+			data[headerSize + byteI] ^= key[byteI & 3];
+		}
+	}
+	frame->headerSize = headerSize;
+	frame->payloadSize = (size_t)payloadSize;
+	return (long long)(headerSize + payloadSize);
+}
+
+#endif // #ifndef LJM_WEB_SOCKET
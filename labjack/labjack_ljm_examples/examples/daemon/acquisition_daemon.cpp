@@ -0,0 +1,236 @@
+/**
+ * Name: acquisition_daemon.cpp
+ * Desc: Streams the channels of a configuration file like comfortbot.conf,
+ *       converts and averages them and writes each record as an insertData
+ *       command, the native counterpart of trade_fair.py's measurement loop.
+ *       Prints the pipeline's throughput and latencies every few seconds
+ *       and, with -m, keeps them in a Prometheus text file. Runs until
+ *       Ctrl+C or for the given number of seconds.
+ * Usage: acquisition_daemon [-s] [-o output] [-m metrics file]
+ *            [-d upload delay ms] [-q outbox [-u IP address[:port]]]
+ *            config [seconds]
+ *        -s uses a SimulatedSource instead of a device.
+ *        -o appends the commands to output instead of printing them.
+ *        -d makes each upload take that long, like a slow server.
+ *        -q appends the records to the UploadOutbox in the directory outbox
+ *           instead, where they outlast server outages and restarts.
+ *        -u sends the outbox's records to the DDP server at that address,
+ *           port 3000 by default, with insertDataBatch calls.
+**/
+
+// For printf
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_AcquisitionPipeline.h"
+#include "LJM_UploadOutbox.h"
+
+// How often stats are printed and the metrics file is written
+const int STATS_SECONDS = 5;
+
+const int METEOR_PORT = 3000;
+
+std::atomic<bool> stopRequested(false);
+
+void RequestStop(int)
+{
+	stopRequested = true;
+}
+
+void PrintStats(const AcquisitionStats & stats);
+void PrintOutboxStats(UploadOutbox & outbox, OutboxUploader * uploader);
+
+int main(int argc, char * argv[])
+{
+	int err, errorLine = 0;
+	int handle = -1;
+	int argi = 1;
+	bool simulate = false;
+	const char * outputPath = NULL;
+	const char * metricsPath = NULL;
+	const char * outboxPath = NULL;
+	const char * serverAddress = NULL;
+	double uploadDelayMS = 0;
+	int seconds = 0;
+	AcquisitionConfig config;
+	LJMStreamSource * stream = NULL;
+	SimulatedSource simulated;
+	AcquisitionSource * source = &simulated;
+	LineUploadSink sink;
+	UploadOutbox outbox;
+	OutboxUploadSink outboxSink(&outbox);
+	UploadSink * uploadSink = &sink;
+	OutboxUploader * uploader = NULL;
+	AcquisitionPipeline pipeline;
+	AcquisitionStats stats;
+
+	for (; argi < argc && argv[argi][0] == '-'; argi++) {
+		if (strcmp(argv[argi], "-s") == 0) {
+			simulate = true;
+		}
+		else if (strcmp(argv[argi], "-o") == 0 && argi + 1 < argc) {
+			outputPath = argv[++argi];
+		}
+		else if (strcmp(argv[argi], "-m") == 0 && argi + 1 < argc) {
+			metricsPath = argv[++argi];
+		}
+		else if (strcmp(argv[argi], "-d") == 0 && argi + 1 < argc) {
+			uploadDelayMS = atof(argv[++argi]);
+		}
+		else if (strcmp(argv[argi], "-q") == 0 && argi + 1 < argc) {
+			outboxPath = argv[++argi];
+		}
+		else if (strcmp(argv[argi], "-u") == 0 && argi + 1 < argc) {
+			serverAddress = argv[++argi];
+		}
+		else {
+			break;
+		}
+	}
+	if (argi >= argc || (serverAddress && !outboxPath)) {
+		fprintf(stderr, "Usage: %s [-s] [-o output] [-m metrics file] "
+			"[-d upload delay ms] [-q outbox [-u IP address[:port]]] config [seconds]\n",
+			argv[0]);
+		return LJME_INVALID_PARAMETER;
+	}
+
+	err = config.Load(argv[argi], &errorLine);
+	ErrorCheck(err, "Loading %s, line %d", argv[argi], errorLine);
+	if (argi + 1 < argc) {
+		seconds = atoi(argv[argi + 1]);
+	}
+
+	if (outputPath) {
+		err = sink.Open(outputPath);
+		ErrorCheck(err, "Opening %s", outputPath);
+	}
+	sink.SetDelayMS(uploadDelayMS);
+
+	if (outboxPath) {
+		err = outbox.Open(outboxPath);
+		ErrorCheck(err, "Opening the outbox %s", outboxPath);
+		uploadSink = &outboxSink;
+	}
+	if (serverAddress) {
+		std::string ip = serverAddress;
+		int port = METEOR_PORT;
+		size_t colon = ip.find(':');
+		if (colon != std::string::npos) {
+			port = atoi(ip.c_str() + colon + 1);
+			ip.erase(colon);
+		}
+		uploader = new OutboxUploader(&outbox);
+		uploader->Start(IPToNumber(ip.c_str()), port);
+	}
+
+	if (!simulate) {
+		handle = OpenOrDie(LJM_dtANY, LJM_ctANY, "LJM_idANY");
+		PrintDeviceInfoFromHandle(handle);
+		stream = new LJMStreamSource(handle);
+		source = stream;
+	}
+
+	// After LJM_Open, which installs its own Ctrl+C handler
+	signal(SIGINT, RequestStop);
+	signal(SIGTERM, RequestStop);
+
+	err = pipeline.Start(config, source, uploadSink);
+	ErrorCheck(err, "AcquisitionPipeline::Start");
+	pipeline.GetStats(&stats);
+	fprintf(stderr, "%d channels at %.1f scans/s, %s source, records every %g s\n",
+		(int)config.channels.size(), stats.scanRate, simulate ? "simulated" : "stream",
+		config.averageSeconds);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point nextStats = start +
+		std::chrono::seconds(STATS_SECONDS);
+	while (!stopRequested && pipeline.Running() &&
+		(seconds <= 0 || std::chrono::steady_clock::now() - start < std::chrono::seconds(seconds)))
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		if (std::chrono::steady_clock::now() >= nextStats) {
+			nextStats += std::chrono::seconds(STATS_SECONDS);
+			pipeline.GetStats(&stats);
+			PrintStats(stats);
+			if (outboxPath) {
+				PrintOutboxStats(outbox, uploader);
+			}
+			if (metricsPath) {
+				WriteAcquisitionMetrics(stats, metricsPath);
+			}
+		}
+	}
+
+	err = pipeline.Stop();
+	pipeline.GetStats(&stats);
+	fprintf(stderr, "\nTotal: ");
+	PrintStats(stats);
+	if (uploader) {
+		uploader->Stop();
+	}
+	if (outboxPath) {
+		outbox.Sync();
+		PrintOutboxStats(outbox, uploader);
+		outbox.Close();
+	}
+	delete uploader;
+	if (metricsPath) {
+		WriteAcquisitionMetrics(stats, metricsPath);
+	}
+	ErrorCheck(err, "AcquisitionPipeline");
+
+	if (stream) {
+		delete stream;
+		CloseOrDie(handle);
+	}
+
+	return LJME_NOERROR;
+}
+
+void PrintStats(const AcquisitionStats & stats)
+{
+	fprintf(stderr, "%.1f s: %lld scans (%.1f/s), %lld skipped samples, backlog %d/%d, "
+		"converting %.0f samples/s\n", stats.elapsedSeconds, stats.scans,
+		stats.scansPerSecond, stats.skippedSamples, stats.maxDeviceScanBacklog,
+		stats.maxLJMScanBacklog, stats.convertSamplesPerSecond);
+	fprintf(stderr, "    %lld records, %lld uploaded, %lld failed, %lld dropped, "
+		"upload queue %d (max %d)\n", stats.records, stats.uploads, stats.failedUploads,
+		stats.droppedRecords, stats.uploadQueue, stats.maxUploadQueue);
+	fprintf(stderr, "    ms mean/max: read interval %.1f/%.1f, convert %.2f/%.2f, "
+		"average %.2f/%.2f, upload %.1f/%.1f, end to end %.1f/%.1f\n",
+		stats.readInterval.MeanMS(), stats.readInterval.maxMS, stats.convert.MeanMS(),
+		stats.convert.maxMS, stats.average.MeanMS(), stats.average.maxMS,
+		stats.upload.MeanMS(), stats.upload.maxMS, stats.endToEnd.MeanMS(),
+		stats.endToEnd.maxMS);
+}
+
+void PrintOutboxStats(UploadOutbox & outbox, OutboxUploader * uploader)
+{
+	UploadOutboxStats stats;
+	OutboxUploaderStats uploaderStats;
+
+	outbox.GetStats(&stats);
+	fprintf(stderr, "    outbox: %lld appended, %lld dropped, %lld acknowledged of %lld, "
+		"%d segments (%.1f kB), append max %.1f us\n", stats.appended, stats.dropped,
+		stats.ackedThrough, stats.lastSeq, stats.numSegments, stats.diskBytes / 1000.0,
+		stats.maxAppendUS);
+	if (uploader) {
+		uploader->GetStats(&uploaderStats);
+		fprintf(stderr, "    uploader: %s, %lld connects, %lld failed, %lld sent, "
+			"%lld acknowledged\n", uploaderStats.connected ? "connected" : "disconnected",
+			uploaderStats.connects, uploaderStats.failedConnects, uploaderStats.sent,
+			uploaderStats.acked);
+	}
+}
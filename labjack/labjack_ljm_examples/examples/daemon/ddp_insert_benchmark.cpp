@@ -0,0 +1,129 @@
+/**
+ * Name: ddp_insert_benchmark.cpp
+ * Desc: Measures insertData calls per second through a DDPClient with 1 to
+ *       256 calls in flight, against waiting for each call before making
+ *       the next, as ddp-json.py's DDPClient.send does.
+ * Usage: ddp_insert_benchmark [IP address [port]]
+ *        With an IP address, calls the DDP server at that address, port 3000
+ *        by default, which must have an insertData method. Without one, calls
+ *        a local DDPStandIn with a simulated round trip.
+**/
+
+// For printf
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "DDPStandIn.h"
+#include "LJM_DDPClient.h"
+
+enum { NUM_INSERTS = 2000 };
+enum { METEOR_PORT = 3000 };
+
+// Simulated time from a call arriving at the stand-in to its answer, in
+// microseconds: a LAN round trip and a Mongo insert
+enum { STAND_IN_DELAY_US = 2000 };
+
+const int MAX_IN_FLIGHT[] = {1, 4, 16, 64, 256};
+enum { NUM_MAX_IN_FLIGHT = sizeof(MAX_IN_FLIGHT) / sizeof(MAX_IN_FLIGHT[0]) };
+
+/**
+ * Desc: Returns the params of the insertData call for grid cell i, like the
+ *       acquisition daemon's records.
+**/
+std::string InsertParams(int i);
+
+/**
+ * Desc: Makes NUM_INSERTS insertData calls with at most maxInFlight in flight,
+ *       or one at a time waiting for each if waitForEach, then prints the
+ *       results.
+**/
+void InsertSpeedTest(unsigned int ipAddress, int port, int maxInFlight, bool waitForEach);
+
+int main(int argc, char * argv[])
+{
+	int i;
+	unsigned int ipAddress;
+	int port = argc > 2 ? atoi(argv[2]) : METEOR_PORT;
+	DDPStandIn standIn(STAND_IN_DELAY_US);
+
+	if (argc > 1) {
+		ipAddress = IPToNumber(argv[1]);
+	}
+	else {
+		ErrorCheck(standIn.Start(), "DDPStandIn::Start");
+		ipAddress = standIn.GetIPAddress();
+		port = standIn.GetPort();
+		printf("Calling a local DDP stand-in that answers after %d us\n\n",
+			STAND_IN_DELAY_US);
+	}
+
+	InsertSpeedTest(ipAddress, port, 1, true);
+	for (i = 0; i < NUM_MAX_IN_FLIGHT; i++) {
+		InsertSpeedTest(ipAddress, port, MAX_IN_FLIGHT[i], false);
+	}
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+std::string InsertParams(int i)
+{
+	char params[256];
+	snprintf(params, sizeof(params), "[\"BBW281\", {\"x\": %d, \"y\": %d, "
+		"\"temp\": %.3f, \"radtemp\": %.3f, \"humid\": %.2f, \"velocity\": %.4f, "
+		"\"pmv\": %.4f, \"ppd\": %.3f}]", i % 10, i / 10 % 10, 22.5 + (i % 7) * 0.01,
+		23.1 - (i % 5) * 0.01, 41.25, 0.0725, -0.1375, 5.39);
+	return params;
+}
+
+void InsertSpeedTest(unsigned int ipAddress, int port, int maxInFlight, bool waitForEach)
+{
+	int i, err;
+	std::atomic<int> numErrors(0);
+	DDPClient client(maxInFlight);
+	DDPClientStats stats;
+
+	err = client.Connect(ipAddress, port);
+	ErrorCheck(err, "DDPClient::Connect(port %d)", port);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (i = 0; i < NUM_INSERTS; i++) {
+		client.Call("insertData", InsertParams(i),
+			[&](int err, const std::string &) {
+				if (err != LJME_NOERROR) {
+					++numErrors;
+				}
+			});
+		if (waitForEach) {
+			client.Drain();
+		}
+	}
+	err = client.Drain();
+	double totalMS = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+	ErrorCheck(err, "DDPClient::Drain");
+
+	client.GetStats(&stats);
+	if (waitForEach) {
+		printf("One call at a time, waiting for each:\n");
+	}
+	else {
+		printf("Up to %d calls in flight (%d reached):\n", maxInFlight, stats.maxInFlight);
+	}
+	printf("    %lld calls in %.1f ms, %d errors, %lld timed out\n",
+		stats.completed + stats.failed, totalMS, numErrors.load(), stats.timedOut);
+	printf("    Throughput: %.0f inserts/s, round trip average %.3f ms, max %.3f ms\n\n",
+		NUM_INSERTS / (totalMS / 1000.0), stats.totalRoundTripUS / 1000.0 / NUM_INSERTS,
+		stats.maxRoundTripUS / 1000.0);
+}
@@ -0,0 +1,459 @@
+/**
+ * Name: outbox_benchmark.cpp
+ * Desc: Measures an UploadOutbox: how fast records can be appended, how fast
+ *       an OutboxUploader replays the records of a 24 hour outage once the
+ *       server is back, and how long an Append holds up acquisition, flat
+ *       out and while the replay runs. First checks that Close keeps every
+ *       record appended and acknowledged before it, and that a corrupt
+ *       record doesn't keep its segment, or the records after it, from
+ *       being acknowledged.
+ * Usage: outbox_benchmark [directory]
+ *        Keeps the outbox in directory, outbox_benchmark.d by default, which
+ *        is emptied before and after. Uploads to a local DDPStandIn that
+ *        stores each _id once.
+**/
+
+// For printf
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "DDPStandIn.h"
+#include "LJM_UploadOutbox.h"
+
+enum { NUM_APPENDS = 500000 };
+
+// A day of comfortbot.conf's records, one every 10 s
+enum { OUTAGE_RECORDS = 24 * 3600 / 10 };
+
+// Outboxes opened and closed while records are appended and acknowledged,
+// each with CLOSE_RECORDS records. Each record is acknowledged once
+// CLOSE_UNACKED more have been appended
+enum { CLOSE_ROUNDS = 200 };
+enum { CLOSE_RECORDS = 50 };
+enum { CLOSE_UNACKED = 10 };
+
+// Records in the outbox with a corrupt record, and its segment size, small
+// enough for them to span several segments
+enum { CORRUPT_RECORDS = 200 };
+enum { CORRUPT_SEGMENT_BYTES = 4 * 1024 };
+
+// Small enough segments for a day to span several, to see them compacted
+enum { REPLAY_SEGMENT_BYTES = 256 * 1024 };
+
+// Records per second appended while the outage is replayed, the acquisition
+// daemon's rate sped up 10000 times
+enum { LIVE_RATE = 1000 };
+
+// Simulated time from a call arriving at the stand-in to its answer, in
+// microseconds
+enum { STAND_IN_DELAY_US = 2000 };
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * Desc: Returns record i as the acquisition daemon's insertData params.
+**/
+std::string Record(long long i);
+
+/**
+ * Desc: Deletes the files in directory, then directory.
+**/
+void RemoveDirectory(const char * directory);
+
+/**
+ * Desc: Prints the median, 99th and 99.99th percentile and maximum of
+ *       appendUS, which is sorted.
+**/
+void PrintStalls(std::vector<double> & appendUS);
+
+/**
+ * Desc: Appends and acknowledges records right up to Close, then opens the
+ *       outbox again and checks that they and the acknowledged position are
+ *       on disk.
+ * Retr: Whether every round kept them.
+**/
+bool CloseTest(const char * directory);
+
+/**
+ * Desc: Corrupts the second record of the second segment, reads the outbox
+ *       back and acknowledges what it reads, then opens it again and checks
+ *       that everything counts as acknowledged, only the last segment is
+ *       left and nothing is read again.
+ * Retr: Whether it did.
+**/
+bool CorruptTest(const char * directory);
+
+void AppendTest(const char * directory);
+void ReplayTest(const char * directory);
+
+int main(int argc, char * argv[])
+{
+	const char * directory = argc > 1 ? argv[1] : "outbox_benchmark.d";
+
+	RemoveDirectory(directory);
+	bool intact = CloseTest(directory);
+	RemoveDirectory(directory);
+	intact = intact && CorruptTest(directory);
+	RemoveDirectory(directory);
+	if (!intact) {
+		return LJME_UNKNOWN_ERROR;
+	}
+	AppendTest(directory);
+	RemoveDirectory(directory);
+	ReplayTest(directory);
+	RemoveDirectory(directory);
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+std::string Record(long long i)
+{
+	char params[256];
+	snprintf(params, sizeof(params), "[\"BBW281\", {\"x\": %lld, \"y\": %lld, "
+		"\"temp\": %.3f, \"radtemp\": %.3f, \"humid\": %.2f, \"velocity\": %.4f, "
+		"\"pmv\": %.4f, \"ppd\": %.3f}]", i % 4, i / 4 % 4, 22.5 + (i % 7) * 0.01,
+		23.1 - (i % 5) * 0.01, 41.25, 0.0725, -0.1375, 5.39);
+	return params;
+}
+
+void RemoveDirectory(const char * directory)
+{
+	DIR * dir = opendir(directory);
+	if (dir == NULL) {
+		return;
+	}
+	struct dirent * entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] != '.') {
+			unlink((std::string(directory) + "/" + entry->d_name).c_str());
+		}
+	}
+	closedir(dir);
+	rmdir(directory);
+}
+
+void PrintStalls(std::vector<double> & appendUS)
+{
+	std::sort(appendUS.begin(), appendUS.end());
+	size_t n = appendUS.size();
+	printf("    Append us: median %.2f, 99%% %.2f, 99.99%% %.2f, max %.1f\n",
+		appendUS[n / 2], appendUS[n * 99 / 100], appendUS[n * 9999 / 10000], appendUS[n - 1]);
+}
+
+bool CloseTest(const char * directory)
+{
+	UploadOutboxStats stats;
+	std::vector<OutboxRecord> records;
+	long long lastSeq = 0, ackedThrough = 0, seq;
+	int round, i, err;
+
+	for (round = 0; round < CLOSE_ROUNDS; round++) {
+		{
+			UploadOutbox outbox;
+			outbox.SetSyncMS(1);
+			err = outbox.Open(directory);
+			ErrorCheck(err, "UploadOutbox::Open(%s)", directory);
+			for (i = 0; i < CLOSE_RECORDS; i++) {
+				err = outbox.Append(Record(lastSeq + 1), &seq);
+				ErrorCheck(err, "UploadOutbox::Append");
+				lastSeq = seq;
+				if (seq - CLOSE_UNACKED > ackedThrough) {
+					ackedThrough = seq - CLOSE_UNACKED;
+					outbox.Acknowledge(ackedThrough);
+				}
+
+				// Let the writer start a batch now and then, so Close can
+				// come while it is busy
+				if (i % 10 == 9) {
+					std::this_thread::sleep_for(std::chrono::microseconds(500));
+				}
+			}
+			outbox.Close();
+		}
+
+		UploadOutbox outbox;
+		err = outbox.Open(directory);
+		ErrorCheck(err, "UploadOutbox::Open(%s)", directory);
+		outbox.GetStats(&stats);
+		long long numRead = 0;
+		bool intact = true;
+		do {
+			outbox.Read(CLOSE_RECORDS, 0, &records);
+			for (i = 0; i < (int)records.size(); i++) {
+				intact = intact && records[i].seq == ackedThrough + 1 + numRead &&
+					records[i].payload == Record(records[i].seq);
+				numRead++;
+			}
+		} while (!records.empty());
+
+		if (stats.lastSeq != lastSeq || stats.ackedThrough != ackedThrough ||
+			numRead != lastSeq - ackedThrough || !intact)
+		{
+			printf("Close lost records in round %d: %lld appended and %lld on disk, "
+				"%lld acknowledged and %lld saved, %lld of %lld unacknowledged read back%s\n",
+				round + 1, lastSeq, stats.lastSeq, ackedThrough, stats.ackedThrough, numRead,
+				lastSeq - ackedThrough, intact ? "" : ", some wrong");
+			return false;
+		}
+	}
+
+	printf("Close kept every record and acknowledgement in %d rounds of %d records\n\n",
+		CLOSE_ROUNDS, CLOSE_RECORDS);
+	return true;
+}
+
+bool CorruptTest(const char * directory)
+{
+	UploadOutboxStats stats;
+	std::vector<OutboxRecord> records;
+	std::vector<std::string> names;
+	long long seq, numRead = 0;
+	int i, err;
+
+	{
+		UploadOutbox outbox;
+		outbox.SetSegmentBytes(CORRUPT_SEGMENT_BYTES);
+		err = outbox.Open(directory);
+		ErrorCheck(err, "UploadOutbox::Open(%s)", directory);
+		for (i = 0; i < CORRUPT_RECORDS; i++) {
+			err = outbox.Append(Record(i + 1), &seq);
+			ErrorCheck(err, "UploadOutbox::Append");
+		}
+		outbox.Close();
+	}
+
+	DIR * dir = opendir(directory);
+	struct dirent * entry;
+	while (dir != NULL && (entry = readdir(dir)) != NULL) {
+		if (strstr(entry->d_name, ".log") != NULL) {
+			names.push_back(entry->d_name);
+		}
+	}
+	if (dir != NULL) {
+		closedir(dir);
+	}
+	std::sort(names.begin(), names.end());
+	if (names.size() < 3) {
+		printf("The corruption check needs 3 segments, not %d\n", (int)names.size());
+		return false;
+	}
+
+	// Flip a payload byte of the segment's second record
+	unsigned char header[OUTBOX_HEADER_SIZE];
+	std::string path = std::string(directory) + "/" + names[1];
+	FILE * file = fopen(path.c_str(), "r+b");
+	bool corrupted = file != NULL && fread(header, 1, sizeof(header), file) == sizeof(header);
+	if (corrupted) {
+		long offset = (long)(OUTBOX_HEADER_SIZE * 2 + OutboxGet32(header) + 1);
+		int byte;
+		corrupted = fseek(file, offset, SEEK_SET) == 0 && (byte = fgetc(file)) != EOF &&
+			fseek(file, offset, SEEK_SET) == 0 && fputc(byte ^ 0xFF, file) != EOF;
+	}
+	if (file != NULL) {
+		fclose(file);
+	}
+	if (!corrupted) {
+		printf("Couldn't corrupt %s\n", path.c_str());
+		return false;
+	}
+
+	{
+		UploadOutbox outbox;
+		outbox.SetSyncMS(1);
+		err = outbox.Open(directory);
+		ErrorCheck(err, "UploadOutbox::Open(%s)", directory);
+		do {
+			outbox.Read(CORRUPT_RECORDS, 0, &records);
+			for (i = 0; i < (int)records.size(); i++) {
+				outbox.Acknowledge(records[i].seq);
+			}
+			numRead += (long long)records.size();
+		} while (!records.empty());
+		outbox.GetStats(&stats);
+		outbox.Close();
+	}
+	long long numCorrupt = stats.corruptRecords;
+	long long numLost = stats.lostRecords;
+
+	UploadOutbox outbox;
+	err = outbox.Open(directory);
+	ErrorCheck(err, "UploadOutbox::Open(%s)", directory);
+	outbox.GetStats(&stats);
+	outbox.Read(CORRUPT_RECORDS, 0, &records);
+	if (numCorrupt != 1 || numRead + numLost != CORRUPT_RECORDS ||
+		stats.ackedThrough != CORRUPT_RECORDS || stats.numSegments != 1 || !records.empty())
+	{
+		printf("A corrupt record held the outbox back: %lld corrupt, %lld read and %lld "
+			"lost of %d, %lld acknowledged, %d segments left, %d read again\n", numCorrupt,
+			numRead, numLost, (int)CORRUPT_RECORDS, stats.ackedThrough, stats.numSegments,
+			(int)records.size());
+		return false;
+	}
+
+	printf("A corrupt record lost %lld records and held back none of the other %lld\n\n",
+		numLost, numRead);
+	return true;
+}
+
+void AppendTest(const char * directory)
+{
+	UploadOutbox outbox;
+	UploadOutboxStats stats;
+	std::vector<double> appendUS(NUM_APPENDS);
+	std::vector<std::string> records(NUM_APPENDS);
+	size_t numBytes = 0;
+	int numDropped = 0;
+	int i, err;
+
+	for (i = 0; i < NUM_APPENDS; i++) {
+		records[i] = Record(i);
+		numBytes += records[i].size() + OUTBOX_HEADER_SIZE;
+	}
+
+	err = outbox.Open(directory);
+	ErrorCheck(err, "UploadOutbox::Open(%s)", directory);
+
+	Clock::time_point start = Clock::now();
+	for (i = 0; i < NUM_APPENDS; i++) {
+		Clock::time_point begin = Clock::now();
+		err = outbox.Append(records[i]);
+		appendUS[i] = std::chrono::duration<double, std::micro>(Clock::now() - begin).count();
+		if (err == LJME_LJM_BUFFER_FULL) {
+			numDropped++;
+			continue;
+		}
+		ErrorCheck(err, "UploadOutbox::Append");
+	}
+	double appendMS = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	err = outbox.Sync();
+	double syncedMS = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	ErrorCheck(err, "UploadOutbox::Sync");
+	outbox.GetStats(&stats);
+
+	printf("Appending %d records of %.0f bytes flat out:\n", NUM_APPENDS,
+		(double)numBytes / NUM_APPENDS);
+	printf("    Appended in %.1f ms, %.0f records/s, %d dropped with the disk behind; "
+		"on disk after %.1f ms, %.1f MB/s\n", appendMS, NUM_APPENDS / (appendMS / 1000.0),
+		numDropped, syncedMS, numBytes / (syncedMS / 1000.0) / 1e6);
+	printf("    %lld syncs, %.2f ms mean, %.2f ms max; %lld segments; at most %.1f MB buffered\n",
+		stats.syncs, stats.totalSyncMS / (stats.syncs ? stats.syncs : 1), stats.maxSyncMS,
+		stats.segmentsCreated, stats.maxBufferedBytes / 1e6);
+	PrintStalls(appendUS);
+	printf("\n");
+}
+
+void ReplayTest(const char * directory)
+{
+	UploadOutbox outbox;
+	UploadOutboxStats stats;
+	OutboxUploaderStats uploaderStats;
+	DDPStandIn standIn(STAND_IN_DELAY_US);
+	std::vector<double> appendUS;
+	std::atomic<bool> replaying(true);
+	long long i, duplicates = 0;
+	int err;
+
+	// Only used on the stand-in's thread
+	std::set<std::string> stored;
+	standIn.SetMethodHandler([&](const std::string &, const std::string & params,
+		std::string * result)
+	{
+		std::vector<std::string> elements;
+		std::vector<std::string> points;
+		std::string id;
+		DDPSplitArray(params, &elements);
+		DDPSplitArray(elements.size() > 1 ? elements[1] : "[]", &points);
+		*result = "[";
+		for (size_t pointI = 0; pointI < points.size(); pointI++) {
+			DDPFindField(points[pointI], "_id", &id);
+			if (!stored.insert(id).second) {
+				duplicates++;
+			}
+			*result += pointI > 0 ? "," + id : id;
+		}
+		*result += "]";
+		return true;
+	});
+
+	outbox.SetSegmentBytes(REPLAY_SEGMENT_BYTES);
+	err = outbox.Open(directory);
+	ErrorCheck(err, "UploadOutbox::Open(%s)", directory);
+
+	// The outage: the records pile up with no server to take them
+	for (i = 0; i < OUTAGE_RECORDS; i++) {
+		err = outbox.Append(Record(i));
+		ErrorCheck(err, "UploadOutbox::Append");
+	}
+	err = outbox.Sync();
+	ErrorCheck(err, "UploadOutbox::Sync");
+	outbox.GetStats(&stats);
+	printf("Replaying a 24 h outage, %d records in %d segments, %.1f MB, with %d more "
+		"records/s appended:\n", OUTAGE_RECORDS, stats.numSegments, stats.diskBytes / 1e6,
+		LIVE_RATE);
+
+	err = standIn.Start();
+	ErrorCheck(err, "DDPStandIn::Start");
+	OutboxUploader uploader(&outbox);
+	uploader.SetMaxDelayMS(50);
+
+	std::thread live([&] {
+		Clock::time_point start = Clock::now();
+		for (long long liveI = 0; replaying; liveI++) {
+			std::this_thread::sleep_until(start + std::chrono::microseconds(
+				liveI * 1000000 / LIVE_RATE));
+			Clock::time_point begin = Clock::now();
+			outbox.Append(Record(OUTAGE_RECORDS + liveI));
+			appendUS.push_back(std::chrono::duration<double, std::micro>(
+				Clock::now() - begin).count());
+		}
+	});
+
+	Clock::time_point start = Clock::now();
+	uploader.Start(standIn.GetIPAddress(), standIn.GetPort());
+	do {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		outbox.GetStats(&stats);
+	} while (stats.ackedThrough < OUTAGE_RECORDS);
+	double replayMS = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+	replaying = false;
+	live.join();
+	outbox.Sync();
+	do {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		outbox.GetStats(&stats);
+	} while (stats.ackedThrough < stats.lastSeq);
+	uploader.Stop();
+	uploader.GetStats(&uploaderStats);
+
+	// Give the writer a sync interval to save acked and compact
+	std::this_thread::sleep_for(std::chrono::milliseconds(2 * OUTBOX_DEFAULT_SYNC_MS));
+	outbox.GetStats(&stats);
+	standIn.Stop();
+
+	printf("    Caught up in %.1f ms, %.0f records/s\n", replayMS,
+		OUTAGE_RECORDS / (replayMS / 1000.0));
+	printf("    %lld records stored once each, %lld sent again; %lld segments removed, "
+		"%d left with %.1f kB\n", (long long)stored.size(), duplicates,
+		stats.segmentsRemoved, stats.numSegments, stats.diskBytes / 1e3);
+	PrintStalls(appendUS);
+}
@@ -0,0 +1,265 @@
+/**
+ * Name: upload_batch_benchmark.cpp
+ * Desc: Measures points per second and the latency from adding a point to
+ *       its acknowledgement through an UploadBatcher with batches of 1 to
+ *       500 points, against one insertData call per point waiting for each,
+ *       as fakedata.py does. Runs each batch size flat out, then with points
+ *       arriving at ACQUISITION_RATE per second as the acquisition daemon
+ *       makes them.
+ * Usage: upload_batch_benchmark [IP address [port]]
+ *        With an IP address, calls the DDP server at that address, port 3000
+ *        by default, which must have insertData and insertDataBatch methods.
+ *        Without one, calls a local DDPStandIn with a simulated round trip
+ *        and insert cost that fails some points the first time.
+**/
+
+// For printf
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "DDPStandIn.h"
+#include "LJM_DDPClient.h"
+#include "LJM_UploadBatcher.h"
+
+enum { NUM_POINTS = 2000 };
+enum { NUM_PACED_POINTS = 500 };
+enum { METEOR_PORT = 3000 };
+
+// Points per second in the paced runs: 100 grid cells at 10 Hz
+enum { ACQUISITION_RATE = 1000 };
+
+// Flush policy of the batched runs, apart from the batch size
+enum { MAX_DELAY_MS = 100 };
+enum { RETRY_DELAY_MS = 20 };
+
+// Calls in flight at once in the batched runs
+enum { MAX_IN_FLIGHT = 4 };
+
+// Simulated time from a call arriving at the stand-in to its answer, and the
+// stand-in's time to store each point, in microseconds
+enum { STAND_IN_DELAY_US = 2000 };
+enum { STAND_IN_POINT_US = 5 };
+
+// The stand-in fails one point in STAND_IN_FAIL_EVERY the first time it's sent
+enum { STAND_IN_FAIL_EVERY = 100 };
+
+const int BATCH_SIZES[] = {1, 10, 50, 100, 500};
+enum { NUM_BATCH_SIZES = sizeof(BATCH_SIZES) / sizeof(BATCH_SIZES[0]) };
+
+/**
+ * Desc: Returns point i of the benchmark as a JSON object, like the
+ *       acquisition daemon's records, with an _id the server can use to
+ *       ignore points it already stored.
+**/
+std::string Point(int i);
+
+/**
+ * Desc: Answers insertDataBatch calls for the stand-in, storing each point
+ *       for STAND_IN_POINT_US and failing some.
+**/
+bool InsertDataBatch(const std::string & params, std::set<std::string> & failed,
+	std::string * result);
+
+/**
+ * Desc: Makes one insertData call per point, waiting for each, and prints the
+ *       results.
+**/
+void OneAtATimeTest(unsigned int ipAddress, int port);
+
+/**
+ * Desc: Uploads numPoints points through an UploadBatcher with batches of up
+ *       to batchSize points, added every 1 / pointsPerSecond seconds or all
+ *       at once if pointsPerSecond is 0, then prints the results.
+**/
+void BatchTest(unsigned int ipAddress, int port, int batchSize, int numPoints,
+	int pointsPerSecond);
+
+int main(int argc, char * argv[])
+{
+	int i;
+	unsigned int ipAddress;
+	int port = argc > 2 ? atoi(argv[2]) : METEOR_PORT;
+	DDPStandIn standIn(STAND_IN_DELAY_US);
+
+	// Only used on the stand-in's thread
+	std::set<std::string> failed;
+
+	if (argc > 1) {
+		ipAddress = IPToNumber(argv[1]);
+	}
+	else {
+		standIn.SetMethodHandler([&failed](const std::string & method,
+			const std::string & params, std::string * result)
+		{
+			if (method == "insertDataBatch") {
+				return InsertDataBatch(params, failed, result);
+			}
+			*result = "\"inserted\"";
+			return true;
+		});
+		ErrorCheck(standIn.Start(), "DDPStandIn::Start");
+		ipAddress = standIn.GetIPAddress();
+		port = standIn.GetPort();
+		printf("Calling a local DDP stand-in that answers after %d us, stores a point in "
+			"%d us\nand fails 1 point in %d the first time\n\n", STAND_IN_DELAY_US,
+			STAND_IN_POINT_US, STAND_IN_FAIL_EVERY);
+	}
+
+	printf("Flat out, %d points:\n\n", NUM_POINTS);
+	OneAtATimeTest(ipAddress, port);
+	for (i = 0; i < NUM_BATCH_SIZES; i++) {
+		BatchTest(ipAddress, port, BATCH_SIZES[i], NUM_POINTS, 0);
+	}
+
+	printf("%d points arriving at %d/s, sent at least every %d ms:\n\n", NUM_PACED_POINTS,
+		ACQUISITION_RATE, MAX_DELAY_MS);
+	for (i = 0; i < NUM_BATCH_SIZES; i++) {
+		BatchTest(ipAddress, port, BATCH_SIZES[i], NUM_PACED_POINTS, ACQUISITION_RATE);
+	}
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+std::string Point(int i)
+{
+	char point[256];
+	snprintf(point, sizeof(point), "{\"_id\": \"p%d\", \"x\": %d, \"y\": %d, "
+		"\"temp\": %.3f, \"radtemp\": %.3f, \"humid\": %.2f, \"velocity\": %.4f, "
+		"\"pmv\": %.4f, \"ppd\": %.3f}", i, i % 10, i / 10 % 10, 22.5 + (i % 7) * 0.01,
+		23.1 - (i % 5) * 0.01, 41.25, 0.0725, -0.1375, 5.39);
+	return point;
+}
+
+bool InsertDataBatch(const std::string & params, std::set<std::string> & failed,
+	std::string * result)
+{
+	std::vector<std::string> elements;
+	std::vector<std::string> points;
+	std::string id;
+
+	DDPSplitArray(params, &elements);
+	if (elements.size() != 2) {
+		*result = "\"insertDataBatch takes a room and an array of points\"";
+		return false;
+	}
+	DDPSplitArray(elements[1], &points);
+
+	*result = "[";
+	for (size_t i = 0; i < points.size(); i++) {
+		std::chrono::steady_clock::time_point stored = std::chrono::steady_clock::now() +
+			std::chrono::microseconds(STAND_IN_POINT_US);
+		while (std::chrono::steady_clock::now() < stored) {
+		}
+
+		if (i > 0) {
+			*result += ',';
+		}
+		DDPFindField(points[i], "_id", &id);
+		if (atoi(DDPUnquote(id).c_str() + 1) % STAND_IN_FAIL_EVERY == 0 &&
+			failed.insert(id).second)
+		{
+			*result += "{\"error\": \"write conflict\"}";
+		}
+		else {
+			*result += id;
+		}
+	}
+	*result += "]";
+	return true;
+}
+
+void OneAtATimeTest(unsigned int ipAddress, int port)
+{
+	int i, err;
+	std::atomic<int> numErrors(0);
+	DDPClient client(1);
+	DDPClientStats stats;
+
+	err = client.Connect(ipAddress, port);
+	ErrorCheck(err, "DDPClient::Connect(port %d)", port);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (i = 0; i < NUM_POINTS; i++) {
+		client.Call("insertData", "[\"BBW281\", " + Point(i) + "]",
+			[&](int err, const std::string &) {
+				if (err != LJME_NOERROR) {
+					++numErrors;
+				}
+			});
+		client.Drain();
+	}
+	double totalMS = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+
+	client.GetStats(&stats);
+	printf("One insertData call per point, waiting for each:\n");
+	printf("    %d points in %.1f ms, %d errors\n", NUM_POINTS, totalMS, numErrors.load());
+	printf("    Throughput: %.0f points/s, latency average %.3f ms, max %.3f ms\n\n",
+		NUM_POINTS / (totalMS / 1000.0), stats.totalLatencyUS / 1000.0 / NUM_POINTS,
+		stats.maxLatencyUS / 1000.0);
+}
+
+void BatchTest(unsigned int ipAddress, int port, int batchSize, int numPoints,
+	int pointsPerSecond)
+{
+	// Each run uploads new points, so the stand-in fails some in each
+	static int firstPoint = 0;
+	int i, err;
+	std::atomic<int> numDropped(0);
+	DDPClient client(MAX_IN_FLIGHT);
+	UploadBatcherStats stats;
+
+	err = client.Connect(ipAddress, port);
+	ErrorCheck(err, "DDPClient::Connect(port %d)", port);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	{
+		UploadBatcher batcher(&client, "insertDataBatch", "\"BBW281\"");
+		batcher.SetMaxPoints(batchSize);
+		batcher.SetMaxDelayMS(MAX_DELAY_MS);
+		batcher.SetRetryDelayMS(RETRY_DELAY_MS);
+		batcher.SetAck([&](long long, int err) {
+			if (err != LJME_NOERROR) {
+				++numDropped;
+			}
+		});
+
+		for (i = 0; i < numPoints; i++) {
+			if (pointsPerSecond > 0) {
+				std::this_thread::sleep_until(start + std::chrono::microseconds(
+					(long long)i * 1000000 / pointsPerSecond));
+			}
+			batcher.Add(firstPoint + i, Point(firstPoint + i));
+		}
+		err = batcher.Drain();
+		ErrorCheck(err, "UploadBatcher::Drain");
+		batcher.GetStats(&stats);
+	}
+	double totalMS = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+	firstPoint += numPoints;
+
+	printf("Batches of up to %d points:\n", batchSize);
+	printf("    %lld points in %.1f ms in %lld batches (%lld full, %lld on time), "
+		"%lld retried, %d dropped\n", stats.acked, totalMS, stats.batches,
+		stats.countFlushes + stats.byteFlushes, stats.timeFlushes, stats.retried,
+		numDropped.load());
+	printf("    Throughput: %.0f points/s, latency average %.3f ms, max %.3f ms\n\n",
+		numPoints / (totalMS / 1000.0), stats.totalLatencyUS / 1000.0 / stats.acked,
+		stats.maxLatencyUS / 1000.0);
+}
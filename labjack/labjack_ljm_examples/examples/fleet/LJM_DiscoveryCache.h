@@ -0,0 +1,597 @@
+/**
+ * Name: LJM_DiscoveryCache.h
+ * Desc: Finds and opens devices at startup without waiting on a full
+ *       LJM_ListAll/LJM_ListAllExtended search. The devices found last time
+ *       are kept in a small file; at startup they are all opened directly, in
+ *       parallel, by IP address or serial number, and a search only happens
+ *       when some of them don't answer. A background refresh can keep the file
+ *       current, one connection type at a time. C++11 only.
+**/
+
+#ifndef LJM_DISCOVERY_CACHE
+#define LJM_DISCOVERY_CACHE
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LabJackM.h"
+
+#include "../LJM_Utilities.h"
+
+// Read after opening a cached entry to check it is still the same device
+enum { DISCOVERY_SERIAL_NUMBER_ADDRESS = 60028 };
+
+// Discover runs in a row a cached device may fail to open before its entry
+// is dropped
+enum { DISCOVERY_DEFAULT_MAX_MISSED_RUNS = 3 };
+
+/**
+ * Desc: A device as last seen. ipAddress is LJM_NO_IP_ADDRESS for USB.
+ *       lastSeen is in seconds since the epoch. missedRuns counts the
+ *       Discover runs in a row that couldn't open it since it was last
+ *       seen. handle is set by Discover for devices it opened, and -1
+ *       otherwise.
+**/
+struct DiscoveredDevice
+{
+	int deviceType;
+	int connectionType;
+	int serialNumber;
+	int ipAddress;
+	long long lastSeen;
+	int missedRuns;
+	int handle;
+};
+
+/**
+ * Desc: What Discover did. searched tells whether it fell back to
+ *       LJM_ListAll.
+**/
+struct DiscoveryReport
+{
+	int numCached;
+	int numOpenedFromCache;
+	int numOpenedFromSearch;
+	bool searched;
+	double cacheMS;
+	double searchMS;
+};
+
+/**
+ * Name: DiscoveryCache
+ * Desc: Keeps one entry per serial number, for the connection it was last
+ *       opened or found over. An entry is dropped once Discover has failed
+ *       to open its device maxMissedRuns times in a row, so a device that
+ *       left the network stops being looked for.
+ * Note: Discover and the background refresh may run at the same time; the
+ *       cache file is only written by one of them at a time.
+**/
+class DiscoveryCache
+{
+public:
+	/**
+	 * Para: path, the cache file. It is created by Save if it doesn't exist.
+	 *       deviceType, the device type to find and open, e.g. LJM_dtANY.
+	**/
+	DiscoveryCache(const char * path, int deviceType = LJM_dtANY);
+	~DiscoveryCache();
+
+	/**
+	 * Desc: Reads the cache file. A missing file leaves the cache empty.
+	 * Retr: The number of entries read.
+	**/
+	int Load();
+
+	/**
+	 * Desc: Writes the cache file, replacing it only once the new file is
+	 *       complete.
+	 * Retr: LJME_NOERROR, or LJME_UNKNOWN_ERROR if the file can't be written.
+	**/
+	int Save();
+
+	/**
+	 * Desc: Set before Discover. Default DISCOVERY_DEFAULT_MAX_MISSED_RUNS.
+	**/
+	void SetMaxMissedRuns(int newMaxMissedRuns) { maxMissedRuns = newMaxMissedRuns; }
+
+	/**
+	 * Desc: Opens the cached devices in parallel. If fewer than
+	 *       expectedDevices open, searches with LJM_ListAll for
+	 *       connectionType and opens what it finds that isn't open yet, over
+	 *       the fastest connection it is listed on. When expectedDevices is
+	 *       negative, every cached device the last run opened or a search
+	 *       has found since is expected; one that has already been missed
+	 *       doesn't cause another search. Saves the cache afterwards.
+	 * Para: devices, set to the devices that were opened. The caller owns and
+	 *           closes their handles.
+	 *       report, may be NULL.
+	 * Retr: LJME_NOERROR, or the LJM_ListAll error if the search failed.
+	**/
+	int Discover(int connectionType, int expectedDevices,
+		std::vector<DiscoveredDevice> & devices, DiscoveryReport * report);
+
+	/**
+	 * Desc: Starts a thread that updates the cache every intervalMS with an
+	 *       LJM_ListAll of one connection type in turn (USB, Ethernet, WiFi),
+	 *       saving the cache when something changed.
+	**/
+	void StartRefresh(unsigned int intervalMS);
+	void StopRefresh();
+
+	std::vector<DiscoveredDevice> Entries();
+	int NumEntries();
+
+private:
+	void Store(const DiscoveredDevice & device, bool replaceFaster);
+	void Missed(const DiscoveredDevice & device);
+	void Prune();
+	int Search(int connectionType, std::vector<DiscoveredDevice> & found);
+	void RunRefresh(unsigned int intervalMS);
+
+	std::string path;
+	int deviceType;
+	int maxMissedRuns;
+
+	std::mutex mutex;
+	std::map<int, DiscoveredDevice> entries;
+	bool changed;
+
+	std::mutex saveMutex;
+
+	std::mutex refreshMutex;
+	std::condition_variable refreshCondition;
+	bool refreshing;
+	std::thread refresher;
+};
+
+/**
+ * Desc: Opens device directly: by IP address over network connection types,
+ *       by serial number over USB. Checks the serial number before returning.
+ * Para: handle, output.
+ * Retr: LJME_NOERROR, the LJM error, or LJME_DEVICE_NOT_FOUND if the address
+ *       now belongs to another device.
+**/
+int OpenDiscoveredDevice(const DiscoveredDevice & device, int * handle);
+
+
+// Source
+
+inline long long DiscoveryNow()
+{
+	return (long long)time(NULL);
+}
+
+inline double DiscoveryMSSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+inline int OpenDiscoveredDevice(const DiscoveredDevice & device, int * handle)
+{
+	int err;
+	double serialNumber = 0;
+	char identifier[LJM_STRING_ALLOCATION_SIZE];
+
+	if (device.connectionType != LJM_ctUSB && device.ipAddress != LJM_NO_IP_ADDRESS) {
+		err = LJM_NumberToIP(device.ipAddress, identifier);
+		if (err != LJME_NOERROR) {
+			return err;
+		}
+	}
+	else {
+		sprintf(identifier, "%d", device.serialNumber);
+	}
+
+	err = LJM_Open(device.deviceType, device.connectionType, identifier, handle);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+
+	err = LJM_eReadAddress(*handle, DISCOVERY_SERIAL_NUMBER_ADDRESS, LJM_UINT32,
+		&serialNumber);
+	if (err == LJME_NOERROR && (int)serialNumber != device.serialNumber) {
+		err = LJME_DEVICE_NOT_FOUND;
+	}
+	if (err != LJME_NOERROR) {
+		LJM_Close(*handle);
+	}
+	return err;
+}
+
+inline DiscoveryCache::DiscoveryCache(const char * path, int deviceType) :
+	path(path),
+	deviceType(deviceType),
+	maxMissedRuns(DISCOVERY_DEFAULT_MAX_MISSED_RUNS),
+	changed(false),
+	refreshing(false)
+{
+}
+
+inline DiscoveryCache::~DiscoveryCache()
+{
+	StopRefresh();
+}
+
+inline int DiscoveryCache::Load()
+{
+	DiscoveredDevice device;
+	char ipString[LJM_IPv4_STRING_SIZE + 1];
+	char line[128];
+	int numRead = 0;
+	FILE * file = fopen(path.c_str(), "r");
+	if (file == NULL) {
+		return 0;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	// Each line: serial number, device type, connection type, IP, last seen,
+	// missed runs, which files written before it was kept don't have
+	while (fgets(line, sizeof(line), file) != NULL) {
+		device.missedRuns = 0;
+		if (sscanf(line, "%d %d %d %15s %lld %d", &device.serialNumber, &device.deviceType,
+			&device.connectionType, ipString, &device.lastSeen, &device.missedRuns) < 5)
+		{
+			break;
+		}
+		if (strcmp(ipString, "-") == 0 ||
+			LJM_IPToNumber(ipString, (unsigned int *)&device.ipAddress) != LJME_NOERROR)
+		{
+			device.ipAddress = LJM_NO_IP_ADDRESS;
+		}
+		device.handle = -1;
+		entries[device.serialNumber] = device;
+		++numRead;
+	}
+	fclose(file);
+	return numRead;
+}
+
+inline int DiscoveryCache::Save()
+{
+	std::vector<DiscoveredDevice> devices;
+	char ipString[LJM_IPv4_STRING_SIZE];
+	std::string tempPath = path + ".tmp";
+	size_t i;
+	bool ok;
+
+	std::lock_guard<std::mutex> saveLock(saveMutex);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::map<int, DiscoveredDevice>::const_iterator it;
+		for (it = entries.begin(); it != entries.end(); ++it) {
+			devices.push_back(it->second);
+		}
+		changed = false;
+	}
+
+	FILE * file = fopen(tempPath.c_str(), "w");
+	if (file == NULL) {
+		return LJME_UNKNOWN_ERROR;
+	}
+	for (i = 0; i < devices.size(); i++) {
+		if (devices[i].ipAddress == LJM_NO_IP_ADDRESS ||
+			LJM_NumberToIP(devices[i].ipAddress, ipString) != LJME_NOERROR)
+		{
+			strcpy(ipString, "-");
+		}
+		fprintf(file, "%d %d %d %s %lld %d\n", devices[i].serialNumber,
+			devices[i].deviceType, devices[i].connectionType, ipString, devices[i].lastSeen,
+			devices[i].missedRuns);
+	}
+	ok = fflush(file) == 0;
+	ok = fclose(file) == 0 && ok;
+	if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+		remove(tempPath.c_str());
+		return LJME_UNKNOWN_ERROR;
+	}
+	return LJME_NOERROR;
+}
+
+// USB, then Ethernet, then WiFi
+inline int DiscoveryConnectionRank(int connectionType)
+{
+	switch (connectionType) {
+	case LJM_ctUSB:
+		return 0;
+	case LJM_ctETHERNET:
+		return 1;
+	case LJM_ctWIFI:
+		return 3;
+	default:
+		return 2;
+	}
+}
+
+inline void DiscoveryCache::Store(const DiscoveredDevice & device, bool replaceFaster)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<int, DiscoveredDevice>::iterator found = entries.find(device.serialNumber);
+
+	// A search lists a device once per connection type; remember the fastest
+	// that still works
+	if (!replaceFaster && found != entries.end() && found->second.missedRuns == 0 &&
+		DiscoveryConnectionRank(device.connectionType) >
+			DiscoveryConnectionRank(found->second.connectionType))
+	{
+		return;
+	}
+
+	if (found == entries.end() || found->second.connectionType != device.connectionType ||
+		found->second.ipAddress != device.ipAddress ||
+		found->second.deviceType != device.deviceType)
+	{
+		changed = true;
+	}
+	if (found != entries.end() && found->second.missedRuns != 0) {
+		changed = true;
+	}
+	DiscoveredDevice & entry = entries[device.serialNumber];
+	entry = device;
+	entry.missedRuns = 0;
+	entry.handle = -1;
+}
+
+/**
+ * Desc: Counts a run that couldn't open device's entry.
+**/
+inline void DiscoveryCache::Missed(const DiscoveredDevice & device)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<int, DiscoveredDevice>::iterator found = entries.find(device.serialNumber);
+	if (found != entries.end() && found->second.connectionType == device.connectionType) {
+		++found->second.missedRuns;
+		changed = true;
+	}
+}
+
+/**
+ * Desc: Drops the entries missed maxMissedRuns times in a row.
+**/
+inline void DiscoveryCache::Prune()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<int, DiscoveredDevice>::iterator it = entries.begin();
+	while (it != entries.end()) {
+		if (it->second.missedRuns >= maxMissedRuns) {
+			entries.erase(it++);
+			changed = true;
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+inline std::vector<DiscoveredDevice> DiscoveryCache::Entries()
+{
+	std::vector<DiscoveredDevice> devices;
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<int, DiscoveredDevice>::const_iterator it;
+	for (it = entries.begin(); it != entries.end(); ++it) {
+		devices.push_back(it->second);
+	}
+	return devices;
+}
+
+inline int DiscoveryCache::NumEntries()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return (int)entries.size();
+}
+
+inline int DiscoveryCache::Search(int connectionType, std::vector<DiscoveredDevice> & found)
+{
+	int aDeviceTypes[LJM_LIST_ALL_SIZE];
+	int aConnectionTypes[LJM_LIST_ALL_SIZE];
+	int aSerialNumbers[LJM_LIST_ALL_SIZE];
+	int aIPAddresses[LJM_LIST_ALL_SIZE];
+	int numFound = 0;
+	int i;
+	long long now = DiscoveryNow();
+
+	int err = LJM_ListAll(deviceType, connectionType, &numFound, aDeviceTypes,
+		aConnectionTypes, aSerialNumbers, aIPAddresses);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+
+	for (i = 0; i < numFound; i++) {
+		DiscoveredDevice device;
+		device.deviceType = aDeviceTypes[i];
+		device.connectionType = aConnectionTypes[i];
+		device.serialNumber = aSerialNumbers[i];
+		device.ipAddress = aIPAddresses[i];
+		device.lastSeen = now;
+		device.missedRuns = 0;
+		device.handle = -1;
+		found.push_back(device);
+	}
+	return LJME_NOERROR;
+}
+
+inline int DiscoveryCache::Discover(int connectionType, int expectedDevices,
+	std::vector<DiscoveredDevice> & devices, DiscoveryReport * report)
+{
+	int err = LJME_NOERROR;
+	size_t i, j;
+	int numExpected = 0;
+	std::vector<DiscoveredDevice> candidates;
+	std::vector<std::thread> openers;
+	std::vector<int> openErrors;
+	std::map<int, bool> opened;
+	DiscoveryReport localReport;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if (report == NULL) {
+		report = &localReport;
+	}
+	report->numOpenedFromCache = 0;
+	report->numOpenedFromSearch = 0;
+	report->searched = false;
+	report->searchMS = 0;
+	devices.clear();
+
+	// Open every cached device at once; each LJM_Open waits on its own device
+	{
+		std::vector<DiscoveredDevice> cached = Entries();
+		for (i = 0; i < cached.size(); i++) {
+			if (connectionType == LJM_ctANY || cached[i].connectionType == connectionType) {
+				candidates.push_back(cached[i]);
+				if (cached[i].missedRuns == 0) {
+					++numExpected;
+				}
+			}
+		}
+	}
+	report->numCached = (int)candidates.size();
+	openErrors.resize(candidates.size());
+	for (i = 0; i < candidates.size(); i++) {
+		openers.push_back(std::thread([&candidates, &openErrors, i]() {
+			openErrors[i] = OpenDiscoveredDevice(candidates[i], &candidates[i].handle);
+		}));
+	}
+	for (i = 0; i < openers.size(); i++) {
+		openers[i].join();
+	}
+	for (i = 0; i < candidates.size(); i++) {
+		if (openErrors[i] == LJME_NOERROR) {
+			candidates[i].lastSeen = DiscoveryNow();
+			Store(candidates[i], true);
+			devices.push_back(candidates[i]);
+			opened[candidates[i].serialNumber] = true;
+			++report->numOpenedFromCache;
+		}
+		else {
+			Missed(candidates[i]);
+		}
+	}
+	report->cacheMS = DiscoveryMSSince(start);
+
+	if (expectedDevices < 0) {
+		expectedDevices = numExpected;
+	}
+	if (report->numCached == 0 || (int)devices.size() < expectedDevices) {
+		std::vector<DiscoveredDevice> found;
+		std::chrono::steady_clock::time_point searchStart = std::chrono::steady_clock::now();
+
+		report->searched = true;
+		err = Search(connectionType, found);
+
+		// A device can be listed once per connection type; open it once,
+		// over the fastest
+		candidates.clear();
+		for (i = 0; i < found.size(); i++) {
+			if (opened.count(found[i].serialNumber) > 0) {
+				continue;
+			}
+			for (j = 0; j < candidates.size(); j++) {
+				if (candidates[j].serialNumber == found[i].serialNumber) {
+					break;
+				}
+			}
+			if (j == candidates.size()) {
+				candidates.push_back(found[i]);
+			}
+			else if (DiscoveryConnectionRank(found[i].connectionType) <
+				DiscoveryConnectionRank(candidates[j].connectionType))
+			{
+				candidates[j] = found[i];
+			}
+		}
+
+		openers.clear();
+		openErrors.assign(candidates.size(), LJME_NOERROR);
+		for (i = 0; i < candidates.size(); i++) {
+			openers.push_back(std::thread([&candidates, &openErrors, i]() {
+				openErrors[i] = OpenDiscoveredDevice(candidates[i], &candidates[i].handle);
+			}));
+		}
+		for (i = 0; i < openers.size(); i++) {
+			openers[i].join();
+		}
+		for (i = 0; i < candidates.size(); i++) {
+			if (openErrors[i] == LJME_NOERROR) {
+				Store(candidates[i], true);
+				devices.push_back(candidates[i]);
+				++report->numOpenedFromSearch;
+			}
+		}
+		report->searchMS = DiscoveryMSSince(searchStart);
+	}
+
+	Prune();
+	Save();
+	return err;
+}
+
+inline void DiscoveryCache::StartRefresh(unsigned int intervalMS)
+{
+	std::lock_guard<std::mutex> lock(refreshMutex);
+	if (refreshing) {
+		return;
+	}
+	refreshing = true;
+	refresher = std::thread(&DiscoveryCache::RunRefresh, this, intervalMS);
+}
+
+inline void DiscoveryCache::StopRefresh()
+{
+	{
+		std::lock_guard<std::mutex> lock(refreshMutex);
+		if (!refreshing) {
+			return;
+		}
+		refreshing = false;
+	}
+	refreshCondition.notify_all();
+	refresher.join();
+}
+
+inline void DiscoveryCache::RunRefresh(unsigned int intervalMS)
+{
+	static const int REFRESH_CONNECTION_TYPES[] = {LJM_ctUSB, LJM_ctETHERNET, LJM_ctWIFI};
+	enum { NUM_REFRESH_CONNECTION_TYPES = 3 };
+	int tick = 0;
+	size_t i;
+	bool save;
+
+	std::unique_lock<std::mutex> lock(refreshMutex);
+	while (refreshing) {
+		lock.unlock();
+
+		// One connection type per tick keeps each refresh short
+		std::vector<DiscoveredDevice> found;
+		if (Search(REFRESH_CONNECTION_TYPES[tick % NUM_REFRESH_CONNECTION_TYPES], found) ==
+			LJME_NOERROR)
+		{
+			for (i = 0; i < found.size(); i++) {
+				Store(found[i], false);
+			}
+		}
+		++tick;
+
+		{
+			std::lock_guard<std::mutex> entriesLock(mutex);
+			save = changed;
+		}
+		if (save) {
+			Save();
+		}
+
+		lock.lock();
+		refreshCondition.wait_for(lock, std::chrono::milliseconds(intervalMS),
+			[this]() { return !refreshing; });
+	}
+}
+
+#endif // #define LJM_DISCOVERY_CACHE
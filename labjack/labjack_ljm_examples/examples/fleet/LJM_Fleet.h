@@ -0,0 +1,447 @@
+/**
+ * Name: LJM_Fleet.h
+ * Desc: Runs one operation, such as a FramePlan or a ConfigTransaction,
+ *       against many open devices at once on a work-stealing thread pool, and
+ *       collects each device's result and latency. Since the devices answer
+ *       in parallel, a fleet-wide read takes about as long as the slowest
+ *       single round trip instead of the sum of them. C++11 only.
+**/
+
+#ifndef LJM_FLEET
+#define LJM_FLEET
+
+#include <stdio.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../LJM_FramePlan.h"
+#include "../batching/LJM_ConfigTransaction.h"
+
+// LJM calls block for a whole round trip, so workers mostly wait on the
+// network; more of them than CPUs is normal
+enum { FLEET_MAX_WORKERS = 64 };
+
+/**
+ * Desc: One device of a Fleet. cache holds the device's configuration as
+ *       written by FleetConfigOperation.
+**/
+struct FleetDevice
+{
+	int handle;
+	int deviceType;
+	int connectionType;
+	int serialNumber;
+	int maxBytesPerMB;
+	ConfigCache cache;
+};
+
+/**
+ * Desc: The outcome of an operation on one device. values holds what the
+ *       operation read, if anything. latencyUS is the time the operation took
+ *       on its worker, not counting time spent queued.
+**/
+struct FleetResult
+{
+	int handle;
+	int serialNumber;
+	int err;
+	int errorAddress;
+	int worker;
+	double latencyUS;
+	std::vector<double> values;
+};
+
+/**
+ * Desc: Counters for a Fleet. steals counts operations run by a worker other
+ *       than the device's home worker.
+**/
+struct FleetStats
+{
+	long long runs;
+	long long operations;
+	long long errors;
+	long long steals;
+};
+
+/**
+ * Desc: Runs against one device, filling in result.err, result.errorAddress
+ *       and result.values. Returns result.err.
+**/
+typedef std::function<int(FleetDevice & device, FleetResult & result)> FleetOperation;
+
+/**
+ * Desc: Returns an operation that executes a copy of plan on each device and
+ *       returns plan.Values(). plan is copied into the operation.
+**/
+FleetOperation FleetPlanOperation(const FramePlan & plan);
+
+/**
+ * Desc: Returns an operation that calls queueWrites with a ConfigTransaction
+ *       for each device's cache, then commits it. queueWrites returns
+ *       LJME_NOERROR, or an error to discard the transaction.
+ * Note: queueWrites runs on several workers at once.
+**/
+FleetOperation FleetConfigOperation(std::function<int(ConfigTransaction &)> queueWrites);
+
+/**
+ * Desc: Opens every device LJM_ListAll finds for deviceType and
+ *       connectionType, once per serial number, appending the handles to
+ *       handles.
+ * Retr: The number of devices opened, or a negative LJM error code if
+ *       LJM_ListAll failed. Devices that fail to open are reported and
+ *       skipped.
+**/
+int FleetOpenAll(int deviceType, int connectionType, std::vector<int> & handles);
+
+/**
+ * Name: Fleet
+ * Desc: Each device has a home worker. Run queues every device on its home
+ *       worker; a worker with nothing left takes devices from the back of
+ *       other workers' queues. A device is queued once per Run, and Runs
+ *       don't overlap, so each handle is only used by one worker at a time.
+**/
+class Fleet
+{
+public:
+	/**
+	 * Para: numWorkers, the number of worker threads, started on the first
+	 *           Run. 0 means one per device, up to FLEET_MAX_WORKERS.
+	**/
+	Fleet(int numWorkers = 0);
+	~Fleet();
+
+	/**
+	 * Desc: Adds an open device. Must not be called during Run.
+	 * Retr: The device's index, or -1 if LJM_GetHandleInfo failed.
+	**/
+	int AddDevice(int handle);
+
+	int NumDevices() const { return (int)devices.size(); }
+	FleetDevice & Device(int index) { return *devices[index]; }
+
+	/**
+	 * Desc: Runs operation on every device and waits for all of them.
+	 * Para: results, resized to NumDevices() and filled in device order.
+	 * Retr: LJME_NOERROR, or the error of the first failed device.
+	**/
+	int Run(const FleetOperation & operation, std::vector<FleetResult> & results);
+
+	/**
+	 * Desc: The wall-clock time of the last Run.
+	**/
+	double LastRunUS() const { return lastRunUS; }
+
+	FleetStats GetStats();
+
+private:
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<int> queue;
+		std::thread thread;
+	};
+
+	void StartWorkers();
+	void RunWorker(int workerIndex);
+	bool Next(int workerIndex, int * deviceIndex);
+
+	int numWorkers;
+	std::vector<FleetDevice *> devices;
+	std::vector<Worker *> workers;
+
+	std::mutex runMutex;
+
+	std::mutex mutex;
+	std::condition_variable startCondition;
+	std::condition_variable doneCondition;
+	long long generation;
+	int remaining;
+	bool stopping;
+	const FleetOperation * operation;
+	std::vector<FleetResult> * results;
+
+	double lastRunUS;
+	FleetStats stats;
+};
+
+
+// Source
+
+inline FleetOperation FleetPlanOperation(const FramePlan & plan)
+{
+	return [plan](FleetDevice & device, FleetResult & result) {
+		FramePlan devicePlan(plan);
+		devicePlan.SetMaxBytesPerMB(device.maxBytesPerMB);
+		result.err = devicePlan.Execute(device.handle, &result.errorAddress);
+		result.values.assign(devicePlan.Values(),
+			devicePlan.Values() + devicePlan.NumValues());
+		return result.err;
+	};
+}
+
+inline FleetOperation FleetConfigOperation(
+	std::function<int(ConfigTransaction &)> queueWrites)
+{
+	return [queueWrites](FleetDevice & device, FleetResult & result) {
+		ConfigTransaction transaction(device.handle, &device.cache);
+		result.err = queueWrites(transaction);
+		if (result.err == LJME_NOERROR) {
+			result.err = transaction.Commit(&result.errorAddress);
+		}
+		return result.err;
+	};
+}
+
+inline int FleetOpenAll(int deviceType, int connectionType, std::vector<int> & handles)
+{
+	int aDeviceTypes[LJM_LIST_ALL_SIZE];
+	int aConnectionTypes[LJM_LIST_ALL_SIZE];
+	int aSerialNumbers[LJM_LIST_ALL_SIZE];
+	int aIPAddresses[LJM_LIST_ALL_SIZE];
+	int numFound = 0;
+	int i, j, err, handle, numOpened = 0;
+	char identifier[LJM_STRING_ALLOCATION_SIZE];
+	bool seen;
+
+	err = LJM_ListAll(deviceType, connectionType, &numFound, aDeviceTypes,
+		aConnectionTypes, aSerialNumbers, aIPAddresses);
+	if (err != LJME_NOERROR) {
+		PrintErrorIfError(err, "FleetOpenAll: LJM_ListAll");
+		return -err;
+	}
+
+	for (i = 0; i < numFound; i++) {
+		// A device found over several connection types is listed once per type
+		seen = false;
+		for (j = 0; j < i && !seen; j++) {
+			seen = aSerialNumbers[j] == aSerialNumbers[i];
+		}
+		if (seen) {
+			continue;
+		}
+
+		sprintf(identifier, "%d", aSerialNumbers[i]);
+		err = LJM_Open(aDeviceTypes[i], aConnectionTypes[i], identifier, &handle);
+		if (err != LJME_NOERROR) {
+			PrintErrorIfError(err, "FleetOpenAll: LJM_Open(%s)", identifier);
+			continue;
+		}
+		handles.push_back(handle);
+		++numOpened;
+	}
+	return numOpened;
+}
+
+inline Fleet::Fleet(int numWorkers) :
+	numWorkers(numWorkers),
+	generation(0),
+	remaining(0),
+	stopping(false),
+	operation(NULL),
+	results(NULL),
+	lastRunUS(0)
+{
+	stats.runs = 0;
+	stats.operations = 0;
+	stats.errors = 0;
+	stats.steals = 0;
+}
+
+inline Fleet::~Fleet()
+{
+	size_t i;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	startCondition.notify_all();
+	for (i = 0; i < workers.size(); i++) {
+		workers[i]->thread.join();
+		delete workers[i];
+	}
+	for (i = 0; i < devices.size(); i++) {
+		delete devices[i];
+	}
+}
+
+inline int Fleet::AddDevice(int handle)
+{
+	int ipAddress, port;
+	FleetDevice * device = new FleetDevice();
+	int err = LJM_GetHandleInfo(handle, &device->deviceType, &device->connectionType,
+		&device->serialNumber, &ipAddress, &port, &device->maxBytesPerMB);
+	if (err != LJME_NOERROR) {
+		PrintErrorIfError(err, "Fleet::AddDevice: LJM_GetHandleInfo(%d, ...)", handle);
+		delete device;
+		return -1;
+	}
+	device->handle = handle;
+	devices.push_back(device);
+	return (int)devices.size() - 1;
+}
+
+inline void Fleet::StartWorkers()
+{
+	int workerI;
+	if (numWorkers <= 0) {
+		numWorkers = (int)devices.size();
+		if (numWorkers > FLEET_MAX_WORKERS) {
+			numWorkers = FLEET_MAX_WORKERS;
+		}
+		if (numWorkers < 1) {
+			numWorkers = 1;
+		}
+	}
+	for (workerI = 0; workerI < numWorkers; workerI++) {
+		workers.push_back(new Worker());
+	}
+	for (workerI = 0; workerI < numWorkers; workerI++) {
+		workers[workerI]->thread = std::thread(&Fleet::RunWorker, this, workerI);
+	}
+}
+
+inline int Fleet::Run(const FleetOperation & newOperation, std::vector<FleetResult> & newResults)
+{
+	int deviceI;
+	int err = LJME_NOERROR;
+	std::lock_guard<std::mutex> runLock(runMutex);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if (workers.empty()) {
+		StartWorkers();
+	}
+
+	newResults.resize(devices.size());
+	for (deviceI = 0; deviceI < (int)devices.size(); deviceI++) {
+		newResults[deviceI].handle = devices[deviceI]->handle;
+		newResults[deviceI].serialNumber = devices[deviceI]->serialNumber;
+		newResults[deviceI].err = LJME_NOERROR;
+		newResults[deviceI].errorAddress = INITIAL_ERR_ADDRESS;
+		newResults[deviceI].worker = -1;
+		newResults[deviceI].latencyUS = 0;
+		newResults[deviceI].values.clear();
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		operation = &newOperation;
+		results = &newResults;
+		remaining = (int)devices.size();
+		++generation;
+
+		// Queue while holding mutex so no worker finishes before all are queued
+		for (deviceI = 0; deviceI < (int)devices.size(); deviceI++) {
+			Worker * home = workers[deviceI % workers.size()];
+			std::lock_guard<std::mutex> queueLock(home->mutex);
+			home->queue.push_back(deviceI);
+		}
+		startCondition.notify_all();
+
+		doneCondition.wait(lock, [this]() { return remaining == 0; });
+		operation = NULL;
+		results = NULL;
+		++stats.runs;
+	}
+
+	for (deviceI = 0; deviceI < (int)devices.size(); deviceI++) {
+		if (newResults[deviceI].err != LJME_NOERROR) {
+			err = newResults[deviceI].err;
+			break;
+		}
+	}
+
+	lastRunUS = std::chrono::duration<double, std::micro>(
+		std::chrono::steady_clock::now() - start).count();
+	return err;
+}
+
+inline bool Fleet::Next(int workerIndex, int * deviceIndex)
+{
+	int numWorkersRunning = (int)workers.size();
+	int offset;
+
+	{
+		Worker * own = workers[workerIndex];
+		std::lock_guard<std::mutex> lock(own->mutex);
+		if (!own->queue.empty()) {
+			*deviceIndex = own->queue.front();
+			own->queue.pop_front();
+			return true;
+		}
+	}
+
+	for (offset = 1; offset < numWorkersRunning; offset++) {
+		Worker * victim = workers[(workerIndex + offset) % numWorkersRunning];
+		std::lock_guard<std::mutex> lock(victim->mutex);
+		if (!victim->queue.empty()) {
+			*deviceIndex = victim->queue.back();
+			victim->queue.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+inline void Fleet::RunWorker(int workerIndex)
+{
+	int deviceIndex;
+	long long seen = 0;
+	const FleetOperation * currentOperation;
+	std::vector<FleetResult> * currentResults;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		startCondition.wait(lock, [this, seen]() { return stopping || generation != seen; });
+		if (stopping) {
+			return;
+		}
+		seen = generation;
+		lock.unlock();
+
+		while (Next(workerIndex, &deviceIndex)) {
+			// A worker still looping from an earlier Run may take devices of
+			// the next one, so read the operation of the Run it belongs to
+			lock.lock();
+			currentOperation = operation;
+			currentResults = results;
+			lock.unlock();
+
+			FleetResult & result = (*currentResults)[deviceIndex];
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			(*currentOperation)(*devices[deviceIndex], result);
+			result.latencyUS = std::chrono::duration<double, std::micro>(
+				std::chrono::steady_clock::now() - start).count();
+			result.worker = workerIndex;
+
+			lock.lock();
+			++stats.operations;
+			if (result.err != LJME_NOERROR) {
+				++stats.errors;
+			}
+			if (deviceIndex % (int)workers.size() != workerIndex) {
+				++stats.steals;
+			}
+			--remaining;
+			if (remaining == 0) {
+				doneCondition.notify_all();
+			}
+			lock.unlock();
+		}
+
+		lock.lock();
+	}
+}
+
+inline FleetStats Fleet::GetStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+#endif // #define LJM_FLEET
@@ -0,0 +1,583 @@
+/**
+ * Name: LJM_HandlePool.h
+ * Desc: Keeps devices open by serial number. Each device is opened once in
+ *       the background and then watched: probes and callers' reports feed a
+ *       latency average and error counts, and a device that stops answering is
+ *       closed and reopened with exponential backoff, over the fastest
+ *       connection type that works. Acquire never opens anything, so it
+ *       returns a handle or LJME_DEVICE_NOT_OPEN in microseconds instead of
+ *       blocking in LJM_Open. C++11 only.
+**/
+
+#ifndef LJM_HANDLE_POOL
+#define LJM_HANDLE_POOL
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LabJackM.h"
+
+#include "../LJM_Utilities.h"
+
+// Read to check that a handle still reaches the device it was opened for
+enum { HANDLE_POOL_SERIAL_NUMBER_ADDRESS = 60028 };
+
+/**
+ * Desc: The health of one pooled device.
+ *       latencyUS is an exponentially weighted average of round-trip times
+ *       from probes and Report. consecutiveErrors resets on any success.
+ *       reconnects counts opens after the first one.
+**/
+struct HandlePoolHealth
+{
+	int serialNumber;
+	bool available;
+	int handle;
+	int connectionType;
+	double latencyUS;
+	long long successes;
+	long long errors;
+	int consecutiveErrors;
+	int lastError;
+	long long reconnects;
+	double nextAttemptMS;
+};
+
+/**
+ * Desc: Returns true if err means the connection to the device is gone, as
+ *       opposed to the device rejecting a request.
+**/
+bool IsConnectionError(int err);
+
+/**
+ * Name: HandlePool
+ * Desc: AddDevice starts a keeper thread for the device, which opens it,
+ *       probes it every probe interval, and reopens it when it is lost. A
+ *       device is lost when a probe or Report shows a connection error, or
+ *       after errorThreshold errors in a row.
+ *
+ *       Connection types are tried in the order of SetConnectionTypes,
+ *       fastest first (USB, Ethernet, WiFi by default). While a device is
+ *       open over a slower type, the keeper tries the faster ones every
+ *       upgrade interval and switches if the new connection is faster.
+ *
+ * Note: Acquire doesn't lend the handle exclusively; LJM handles can be used
+ *       from several threads. When the pool replaces a handle, the old one
+ *       is closed a probe interval later, so calls already using it can
+ *       finish.
+**/
+class HandlePool
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	HandlePool(int deviceType = LJM_dtANY);
+	~HandlePool();
+
+	/**
+	 * Desc: Settings. Call before AddDevice.
+	**/
+	void SetConnectionTypes(const std::vector<int> & newConnectionTypes);
+	void SetProbeIntervalMS(unsigned int intervalMS) { probeInterval = std::chrono::milliseconds(intervalMS); }
+	void SetUpgradeIntervalMS(unsigned int intervalMS) { upgradeInterval = std::chrono::milliseconds(intervalMS); }
+	void SetBackoffMS(unsigned int initialMS, unsigned int maxMS);
+	void SetErrorThreshold(int threshold) { errorThreshold = threshold; }
+
+	/**
+	 * Desc: Adds a device and starts opening it in the background.
+	 * Para: serialNumber, the device's serial number. USB opens use it.
+	 *       networkIdentifier, an IP address or name to open network connection
+	 *           types with, or NULL to use the serial number. An IP address
+	 *           skips the network search LJM does to find a serial number.
+	 * Retr: LJME_NOERROR, or LJME_DEVICE_ALREADY_OPEN if serialNumber was
+	 *       already added.
+	**/
+	int AddDevice(int serialNumber, const char * networkIdentifier = NULL);
+
+	/**
+	 * Desc: Gets the device's current handle without blocking on the device.
+	 * Retr: LJME_NOERROR, LJME_DEVICE_NOT_OPEN if the device is not connected
+	 *       right now, or LJME_DEVICE_NOT_FOUND if it was never added.
+	**/
+	int Acquire(int serialNumber, int * handle);
+
+	/**
+	 * Desc: Waits up to timeoutMS for the device to become available, e.g. at
+	 *       startup. Returns like Acquire.
+	**/
+	int WaitUntilAvailable(int serialNumber, unsigned int timeoutMS, int * handle);
+
+	/**
+	 * Desc: Tells the pool how a call on handle went. Reports about a handle
+	 *       the pool has since replaced are ignored.
+	 * Para: latencyUS, the call's duration, or a negative value to only count
+	 *           the result.
+	**/
+	void Report(int serialNumber, int handle, int err, double latencyUS);
+
+	bool GetHealth(int serialNumber, HandlePoolHealth * health);
+	std::vector<HandlePoolHealth> GetAllHealth();
+
+private:
+	struct Retired
+	{
+		int handle;
+		Clock::time_point closeAt;
+	};
+
+	struct PooledDevice
+	{
+		int serialNumber;
+		std::string networkIdentifier;
+
+		std::mutex mutex;
+		std::condition_variable wake;
+		HandlePoolHealth health;
+		int connectionIndex;
+		Clock::duration backoff;
+		Clock::time_point nextAttempt;
+		Clock::time_point nextProbe;
+		Clock::time_point nextUpgrade;
+		std::vector<Retired> retired;
+		bool opened;
+		bool stopping;
+		std::thread keeper;
+	};
+
+	void Keep(PooledDevice * device);
+	int Open(PooledDevice * device, int connectionIndex, int * handle, double * latencyUS);
+	int Probe(int handle, int serialNumber, double * latencyUS);
+	void Record(PooledDevice * device, int err, double latencyUS);
+	void Lose(PooledDevice * device, Clock::time_point now);
+	void Retire(PooledDevice * device, int handle, Clock::time_point now);
+	PooledDevice * Find(int serialNumber);
+
+	int deviceType;
+	std::vector<int> connectionTypes;
+	Clock::duration probeInterval;
+	Clock::duration upgradeInterval;
+	Clock::duration initialBackoff;
+	Clock::duration maxBackoff;
+	int errorThreshold;
+
+	std::mutex mutex;
+	std::map<int, std::unique_ptr<PooledDevice> > devices;
+};
+
+
+// Source
+
+// Weight of the newest sample in the latency average
+static const double HANDLE_POOL_LATENCY_WEIGHT = 0.2;
+
+inline bool IsConnectionError(int err)
+{
+	switch (err) {
+	case LJME_INVALID_HANDLE:
+	case LJME_DEVICE_NOT_OPEN:
+	case LJME_DEVICE_DISCONNECTED:
+	case LJME_CANNOT_CONNECT:
+	case LJME_SOCKET_LEVEL_ERROR:
+	case LJME_RECONNECT_FAILED:
+	case LJME_NO_RESPONSE_BYTES_RECEIVED:
+	case LJME_INCORRECT_NUM_RESPONSE_BYTES_RECEIVED:
+		return true;
+	default:
+		return false;
+	}
+}
+
+inline HandlePool::HandlePool(int deviceType) :
+	deviceType(deviceType),
+	probeInterval(std::chrono::seconds(1)),
+	upgradeInterval(std::chrono::seconds(60)),
+	initialBackoff(std::chrono::milliseconds(100)),
+	maxBackoff(std::chrono::seconds(30)),
+	errorThreshold(3)
+{
+	connectionTypes.push_back(LJM_ctUSB);
+	connectionTypes.push_back(LJM_ctETHERNET);
+	connectionTypes.push_back(LJM_ctWIFI);
+}
+
+inline HandlePool::~HandlePool()
+{
+	std::map<int, std::unique_ptr<PooledDevice> >::iterator it;
+	size_t i;
+
+	for (it = devices.begin(); it != devices.end(); ++it) {
+		{
+			std::lock_guard<std::mutex> lock(it->second->mutex);
+			it->second->stopping = true;
+		}
+		it->second->wake.notify_all();
+	}
+	for (it = devices.begin(); it != devices.end(); ++it) {
+		PooledDevice * device = it->second.get();
+		device->keeper.join();
+		for (i = 0; i < device->retired.size(); i++) {
+			LJM_Close(device->retired[i].handle);
+		}
+		if (device->health.available) {
+			LJM_Close(device->health.handle);
+		}
+	}
+}
+
+inline void HandlePool::SetConnectionTypes(const std::vector<int> & newConnectionTypes)
+{
+	if (!newConnectionTypes.empty()) {
+		connectionTypes = newConnectionTypes;
+	}
+}
+
+inline void HandlePool::SetBackoffMS(unsigned int initialMS, unsigned int maxMS)
+{
+	initialBackoff = std::chrono::milliseconds(initialMS);
+	maxBackoff = std::chrono::milliseconds(std::max(initialMS, maxMS));
+}
+
+inline int HandlePool::AddDevice(int serialNumber, const char * networkIdentifier)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (devices.count(serialNumber) > 0) {
+		return LJME_DEVICE_ALREADY_OPEN;
+	}
+
+	PooledDevice * device = new PooledDevice();
+	device->serialNumber = serialNumber;
+	if (networkIdentifier != NULL) {
+		device->networkIdentifier = networkIdentifier;
+	}
+	memset(&device->health, 0, sizeof(device->health));
+	device->health.serialNumber = serialNumber;
+	device->health.available = false;
+	device->health.handle = -1;
+	device->health.connectionType = LJM_ctANY;
+	device->health.lastError = LJME_NOERROR;
+	device->connectionIndex = -1;
+	device->backoff = initialBackoff;
+	device->nextAttempt = Clock::now();
+	device->opened = false;
+	device->stopping = false;
+
+	devices[serialNumber].reset(device);
+	device->keeper = std::thread(&HandlePool::Keep, this, device);
+	return LJME_NOERROR;
+}
+
+inline HandlePool::PooledDevice * HandlePool::Find(int serialNumber)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<int, std::unique_ptr<PooledDevice> >::iterator found = devices.find(serialNumber);
+	return found == devices.end() ? NULL : found->second.get();
+}
+
+inline int HandlePool::Acquire(int serialNumber, int * handle)
+{
+	PooledDevice * device = Find(serialNumber);
+	if (device == NULL) {
+		return LJME_DEVICE_NOT_FOUND;
+	}
+
+	std::lock_guard<std::mutex> lock(device->mutex);
+	if (!device->health.available) {
+		return LJME_DEVICE_NOT_OPEN;
+	}
+	*handle = device->health.handle;
+	return LJME_NOERROR;
+}
+
+inline int HandlePool::WaitUntilAvailable(int serialNumber, unsigned int timeoutMS,
+	int * handle)
+{
+	PooledDevice * device = Find(serialNumber);
+	if (device == NULL) {
+		return LJME_DEVICE_NOT_FOUND;
+	}
+
+	std::unique_lock<std::mutex> lock(device->mutex);
+	if (!device->wake.wait_for(lock, std::chrono::milliseconds(timeoutMS),
+		[device]() { return device->health.available; }))
+	{
+		return LJME_DEVICE_NOT_OPEN;
+	}
+	*handle = device->health.handle;
+	return LJME_NOERROR;
+}
+
+inline void HandlePool::Report(int serialNumber, int handle, int err, double latencyUS)
+{
+	PooledDevice * device = Find(serialNumber);
+	if (device == NULL) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(device->mutex);
+	if (!device->health.available || device->health.handle != handle) {
+		return;
+	}
+	Record(device, err, latencyUS);
+	if (!device->health.available) {
+		device->wake.notify_all();
+	}
+}
+
+inline bool HandlePool::GetHealth(int serialNumber, HandlePoolHealth * health)
+{
+	PooledDevice * device = Find(serialNumber);
+	if (device == NULL) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(device->mutex);
+	*health = device->health;
+	health->nextAttemptMS = health->available ? 0 :
+		std::max(0.0, std::chrono::duration<double, std::milli>(
+			device->nextAttempt - Clock::now()).count());
+	return true;
+}
+
+inline std::vector<HandlePoolHealth> HandlePool::GetAllHealth()
+{
+	std::vector<int> serialNumbers;
+	std::vector<HandlePoolHealth> all;
+	HandlePoolHealth health;
+	size_t i;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::map<int, std::unique_ptr<PooledDevice> >::iterator it;
+		for (it = devices.begin(); it != devices.end(); ++it) {
+			serialNumbers.push_back(it->first);
+		}
+	}
+	for (i = 0; i < serialNumbers.size(); i++) {
+		if (GetHealth(serialNumbers[i], &health)) {
+			all.push_back(health);
+		}
+	}
+	return all;
+}
+
+// Called with device->mutex held
+inline void HandlePool::Record(PooledDevice * device, int err, double latencyUS)
+{
+	HandlePoolHealth & health = device->health;
+	if (err == LJME_NOERROR) {
+		++health.successes;
+		health.consecutiveErrors = 0;
+		if (latencyUS >= 0) {
+			health.latencyUS = health.latencyUS <= 0 ? latencyUS :
+				health.latencyUS + HANDLE_POOL_LATENCY_WEIGHT * (latencyUS - health.latencyUS);
+		}
+		return;
+	}
+
+	++health.errors;
+	++health.consecutiveErrors;
+	health.lastError = err;
+	if (IsConnectionError(err) || health.consecutiveErrors >= errorThreshold) {
+		Lose(device, Clock::now());
+	}
+}
+
+// Called with device->mutex held
+inline void HandlePool::Lose(PooledDevice * device, Clock::time_point now)
+{
+	Retire(device, device->health.handle, now);
+	device->health.available = false;
+	device->health.handle = -1;
+	device->connectionIndex = -1;
+	device->backoff = initialBackoff;
+	device->nextAttempt = now;
+}
+
+// Called with device->mutex held
+inline void HandlePool::Retire(PooledDevice * device, int handle, Clock::time_point now)
+{
+	Retired retired;
+	retired.handle = handle;
+	retired.closeAt = now + probeInterval;
+	device->retired.push_back(retired);
+}
+
+inline int HandlePool::Probe(int handle, int serialNumber, double * latencyUS)
+{
+	double value = 0;
+	int type = LJM_UINT32;
+	Clock::time_point start = Clock::now();
+	int err = LJM_eReadAddress(handle, HANDLE_POOL_SERIAL_NUMBER_ADDRESS, type, &value);
+	*latencyUS = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+	if (err == LJME_NOERROR && (int)value != serialNumber) {
+		// The address now belongs to some other device
+		return LJME_DEVICE_NOT_FOUND;
+	}
+	return err;
+}
+
+inline int HandlePool::Open(PooledDevice * device, int connectionIndex, int * handle,
+	double * latencyUS)
+{
+	int err;
+	int connectionType = connectionTypes[connectionIndex];
+	char serialString[LJM_MAX_NAME_SIZE];
+	const char * identifier = serialString;
+
+	sprintf(serialString, "%d", device->serialNumber);
+	if (connectionType != LJM_ctUSB && !device->networkIdentifier.empty()) {
+		identifier = device->networkIdentifier.c_str();
+	}
+
+	err = LJM_Open(deviceType, connectionType, identifier, handle);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+	err = Probe(*handle, device->serialNumber, latencyUS);
+	if (err != LJME_NOERROR) {
+		LJM_Close(*handle);
+	}
+	return err;
+}
+
+inline void HandlePool::Keep(PooledDevice * device)
+{
+	int err, handle, connectionI, lastErr;
+	double latencyUS = 0;
+	size_t retiredI;
+	Clock::time_point now, wakeAt;
+	std::vector<int> toClose;
+
+	std::unique_lock<std::mutex> lock(device->mutex);
+	while (!device->stopping) {
+		now = Clock::now();
+
+		// Close replaced handles once calls already using them have had time
+		toClose.clear();
+		for (retiredI = 0; retiredI < device->retired.size(); ) {
+			if (device->retired[retiredI].closeAt <= now) {
+				toClose.push_back(device->retired[retiredI].handle);
+				device->retired.erase(device->retired.begin() + retiredI);
+			}
+			else {
+				retiredI++;
+			}
+		}
+		if (!toClose.empty()) {
+			lock.unlock();
+			for (retiredI = 0; retiredI < toClose.size(); retiredI++) {
+				LJM_Close(toClose[retiredI]);
+			}
+			lock.lock();
+			continue;
+		}
+
+		if (!device->health.available && now >= device->nextAttempt) {
+			// Opens can take seconds; don't hold the lock Acquire needs
+			lock.unlock();
+			lastErr = LJME_DEVICE_NOT_FOUND;
+			for (connectionI = 0; connectionI < (int)connectionTypes.size(); connectionI++) {
+				err = Open(device, connectionI, &handle, &latencyUS);
+				if (err == LJME_NOERROR) {
+					break;
+				}
+				lastErr = err;
+			}
+			lock.lock();
+
+			now = Clock::now();
+			if (connectionI < (int)connectionTypes.size()) {
+				if (device->opened) {
+					++device->health.reconnects;
+				}
+				device->opened = true;
+				device->health.available = true;
+				device->health.handle = handle;
+				device->health.connectionType = connectionTypes[connectionI];
+				device->health.latencyUS = latencyUS;
+				device->health.consecutiveErrors = 0;
+				++device->health.successes;
+				device->connectionIndex = connectionI;
+				device->backoff = initialBackoff;
+				device->nextProbe = now + probeInterval;
+				device->nextUpgrade = now + upgradeInterval;
+				device->wake.notify_all();
+			}
+			else {
+				++device->health.errors;
+				device->health.lastError = lastErr;
+				device->nextAttempt = now + device->backoff;
+				device->backoff = std::min(device->backoff * 2, maxBackoff);
+			}
+			continue;
+		}
+
+		if (device->health.available && now >= device->nextProbe) {
+			handle = device->health.handle;
+			lock.unlock();
+			err = Probe(handle, device->serialNumber, &latencyUS);
+			lock.lock();
+
+			device->nextProbe = Clock::now() + probeInterval;
+			if (device->health.available && device->health.handle == handle) {
+				Record(device, err, latencyUS);
+			}
+			continue;
+		}
+
+		if (device->health.available && device->connectionIndex > 0 &&
+			now >= device->nextUpgrade)
+		{
+			int currentIndex = device->connectionIndex;
+			double currentLatencyUS = device->health.latencyUS;
+			lock.unlock();
+			for (connectionI = 0; connectionI < currentIndex; connectionI++) {
+				if (Open(device, connectionI, &handle, &latencyUS) == LJME_NOERROR) {
+					break;
+				}
+			}
+			if (connectionI < currentIndex && latencyUS >= currentLatencyUS) {
+				LJM_Close(handle);
+				connectionI = currentIndex;
+			}
+			lock.lock();
+
+			now = Clock::now();
+			device->nextUpgrade = now + upgradeInterval;
+			if (connectionI < currentIndex) {
+				if (device->health.available) {
+					Retire(device, device->health.handle, now);
+				}
+				device->health.available = true;
+				device->health.handle = handle;
+				device->health.connectionType = connectionTypes[connectionI];
+				device->health.latencyUS = latencyUS;
+				device->health.consecutiveErrors = 0;
+				device->connectionIndex = connectionI;
+				device->nextProbe = now + probeInterval;
+				device->wake.notify_all();
+			}
+			continue;
+		}
+
+		wakeAt = device->health.available ? device->nextProbe : device->nextAttempt;
+		if (device->health.available && device->connectionIndex > 0) {
+			wakeAt = std::min(wakeAt, device->nextUpgrade);
+		}
+		for (retiredI = 0; retiredI < device->retired.size(); retiredI++) {
+			wakeAt = std::min(wakeAt, device->retired[retiredI].closeAt);
+		}
+		device->wake.wait_until(lock, wakeAt);
+	}
+}
+
+#endif // #define LJM_HANDLE_POOL
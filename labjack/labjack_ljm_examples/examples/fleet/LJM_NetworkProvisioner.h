@@ -0,0 +1,601 @@
+/**
+ * Name: LJM_NetworkProvisioner.h
+ * Desc: Configures the Ethernet or WiFi network settings of many devices at
+ *       once, the way utilities/t7_tcp_configure.c does for one device:
+ *       writes the *_DEFAULT settings, restarts the interface, waits until
+ *       the device reports an IP address and then checks the device answers
+ *       over TCP at that address. Every device moves through those steps on
+ *       its own schedule, and one Fleet run per tick advances all of them,
+ *       so the seconds spent waiting on Ethernet restarts and WiFi
+ *       association overlap instead of adding up. Each step is one Feedback
+ *       packet per device. C++11 only.
+**/
+
+#ifndef LJM_NETWORK_PROVISIONER
+#define LJM_NETWORK_PROVISIONER
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LabJackM.h"
+
+#include "../LJM_Utilities.h"
+#include "../LJM_FramePlan.h"
+
+#include "LJM_Fleet.h"
+
+enum {
+	NETWORK_POWER_ETHERNET_ADDRESS = 48003,
+	NETWORK_POWER_WIFI_ADDRESS = 48004,
+	NETWORK_ETHERNET_IP_ADDRESS = 49100,
+	NETWORK_ETHERNET_IP_DEFAULT_ADDRESS = 49150,
+	NETWORK_ETHERNET_SUBNET_DEFAULT_ADDRESS = 49152,
+	NETWORK_ETHERNET_GATEWAY_DEFAULT_ADDRESS = 49154,
+	NETWORK_ETHERNET_DNS_DEFAULT_ADDRESS = 49156,
+	NETWORK_ETHERNET_ALTDNS_DEFAULT_ADDRESS = 49158,
+	NETWORK_ETHERNET_DHCP_ENABLE_DEFAULT_ADDRESS = 49160,
+	NETWORK_WIFI_IP_ADDRESS = 49200,
+	NETWORK_WIFI_IP_DEFAULT_ADDRESS = 49250,
+	NETWORK_WIFI_SUBNET_DEFAULT_ADDRESS = 49252,
+	NETWORK_WIFI_GATEWAY_DEFAULT_ADDRESS = 49254,
+	NETWORK_WIFI_DHCP_ENABLE_DEFAULT_ADDRESS = 49260,
+	NETWORK_WIFI_SSID_DEFAULT_ADDRESS = 49325,
+	NETWORK_WIFI_PASSWORD_DEFAULT_ADDRESS = 49350,
+	NETWORK_WIFI_APPLY_SETTINGS_ADDRESS = 49400,
+	NETWORK_WIFI_STATUS_ADDRESS = 49450,
+	NETWORK_SERIAL_NUMBER_ADDRESS = 60028
+};
+
+// Additional Ethernet config registers; Modbus TCP needs 2 connections on
+// port 502
+enum {
+	NETWORK_MA_ETH_NUM502_ADDRESS = 49111,
+	NETWORK_MA_ETH_DEF_NUM502_ADDRESS = 49161,
+	NETWORK_DESIRED_NUM502 = 2
+};
+
+// WIFI_STATUS values
+enum {
+	NETWORK_WIFI_ASSOCIATED = 2900,
+	NETWORK_WIFI_ASSOCIATION_FAILED = 2902,
+	NETWORK_WIFI_START_FAILED = 2905
+};
+
+// How long an interface needs after being powered before it is restarted or
+// given settings, as in t7_tcp_configure.c
+enum {
+	NETWORK_ETHERNET_OFF_MS = 200,
+	NETWORK_WIFI_POWER_UP_MS = 100
+};
+
+const double NETWORK_GOOGLE_DNS = 0x08080808;
+const double NETWORK_GOOGLE_ALTDNS = 0x08080404;
+
+enum NetworkInterface {
+	NETWORK_ETHERNET,
+	NETWORK_WIFI
+};
+
+/**
+ * Desc: The settings for one device. ipAddress is in LJM_IPToNumber form, or
+ *       0 for DHCP. A gateway of 0 is guessed from ipAddress. ssid and
+ *       password are only used for NETWORK_WIFI; an empty password is not
+ *       written, for open networks.
+**/
+struct NetworkPlan
+{
+	NetworkInterface networkInterface;
+	unsigned int ipAddress;
+	unsigned int subnet;
+	unsigned int gateway;
+	std::string ssid;
+	std::string password;
+};
+
+NetworkPlan EthernetPlan(unsigned int ipAddress);
+NetworkPlan WiFiPlan(unsigned int ipAddress, const std::string & ssid,
+	const std::string & password);
+
+/**
+ * Desc: Returns the .1 address of ipAddress's /24 subnet, the same guess
+ *       t7_tcp_configure.c makes.
+**/
+unsigned int GuessNetworkGateway(unsigned int ipAddress);
+
+/**
+ * Desc: The steps a device goes through. NETWORK_STEP_START powers Ethernet
+ *       back on, or gives WiFi its network name and password and applies
+ *       them. NETWORK_STEP_CONNECT polls until the interface has its address.
+**/
+enum NetworkStep {
+	NETWORK_STEP_CONFIGURE,
+	NETWORK_STEP_START,
+	NETWORK_STEP_CONNECT,
+	NETWORK_STEP_VERIFY,
+	NETWORK_STEP_DONE
+};
+
+const char * NetworkStepName(int step);
+
+/**
+ * Desc: The outcome for one device. If err is not LJME_NOERROR, step is the
+ *       step that failed: LJME_CANNOT_CONNECT for a WiFi association failure
+ *       or a timeout, LJME_DEVICE_NOT_FOUND if another device answered at
+ *       ipAddress, or the error of the failed LJM call. ipAddress is the
+ *       address the device reported. num502Pending means MA_ETH_NUM502 still
+ *       wasn't NETWORK_DESIRED_NUM502 after the restart, so the device needs
+ *       a power cycle before Modbus TCP works reliably.
+ *       configureMS, connectMS and verifyMS are how long each step took,
+ *       including waits; totalMS is from the start of Run until the device
+ *       finished.
+**/
+struct NetworkReport
+{
+	int handle;
+	int serialNumber;
+	NetworkInterface networkInterface;
+	int step;
+	int err;
+	int errorAddress;
+	unsigned int ipAddress;
+	int wifiStatus;
+	bool num502Pending;
+	int numPolls;
+	int numVerifyAttempts;
+	double configureMS;
+	double connectMS;
+	double verifyMS;
+	double totalMS;
+};
+
+/**
+ * Name: NetworkProvisioner
+ * Desc: Add each device with its plan, then Run. Devices are usually open
+ *       over USB, since their network interfaces restart.
+ *       Each tick, every device whose next action is due gets one packet:
+ *       its configuration, the start of its interface, a read of its status
+ *       and address, or one attempt to open it over TCP and read its serial
+ *       number. The tick then sleeps until the next action is due. A tick
+ *       is one Fleet::Run and ends with its slowest step, so a device's
+ *       next action can wait on another device's step, most of all on a
+ *       Verify's blocking LJM_Open.
+**/
+class NetworkProvisioner
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	/**
+	 * Para: numWorkers, see Fleet. Each device's TCP verification blocks a
+	 *           worker for up to LJM_OPEN_TCP_DEVICE_TIMEOUT_MS, so the
+	 *           default of one worker per device suits this best.
+	**/
+	NetworkProvisioner(int numWorkers = 0);
+
+	/**
+	 * Desc: Adds an open device. Must not be called during Run.
+	 * Retr: The device's index, or -1 if LJM_GetHandleInfo failed.
+	**/
+	int AddDevice(int handle, const NetworkPlan & plan);
+
+	int NumDevices() const { return (int)devices.size(); }
+
+	/**
+	 * Desc: The time between status reads of a device that is connecting,
+	 *       and between its TCP open attempts. Default 250 ms;
+	 *       t7_tcp_configure.c polls once a second.
+	**/
+	void SetPollIntervalMS(unsigned int intervalMS) { pollIntervalMS = intervalMS; }
+
+	/**
+	 * Desc: How long a device may take from the end of its configuration
+	 *       until it reports its address. Default 60 s.
+	**/
+	void SetConnectTimeoutMS(unsigned int timeoutMS) { connectTimeoutMS = timeoutMS; }
+
+	/**
+	 * Desc: How long a device may take to answer over TCP once it reported
+	 *       its address. Default 15 s.
+	**/
+	void SetVerifyTimeoutMS(unsigned int timeoutMS) { verifyTimeoutMS = timeoutMS; }
+
+	/**
+	 * Desc: Provisions every device and waits for all of them to finish.
+	 * Para: reports, resized to NumDevices() and filled in device order.
+	 * Retr: LJME_NOERROR, or the error of the first failed device.
+	**/
+	int Run(std::vector<NetworkReport> & reports);
+
+	double LastRunMS() const { return lastRunMS; }
+	int LastRunTicks() const { return lastRunTicks; }
+
+private:
+	struct ProvisionedDevice
+	{
+		NetworkPlan plan;
+		NetworkReport report;
+		Clock::time_point due;
+		Clock::time_point stepStart;
+		bool finished;
+	};
+
+	int Step(FleetDevice & fleetDevice, FleetResult & result);
+	int Configure(FleetDevice & fleetDevice, ProvisionedDevice & device);
+	int Start(FleetDevice & fleetDevice, ProvisionedDevice & device);
+	int Poll(FleetDevice & fleetDevice, ProvisionedDevice & device);
+	int Verify(FleetDevice & fleetDevice, ProvisionedDevice & device);
+	void NextStep(ProvisionedDevice & device, int step, unsigned int delayMS);
+	void Finish(ProvisionedDevice & device, int err);
+
+	Fleet fleet;
+	std::vector<ProvisionedDevice> devices;
+	std::map<int, int> indexByHandle;
+
+	unsigned int pollIntervalMS;
+	unsigned int connectTimeoutMS;
+	unsigned int verifyTimeoutMS;
+
+	Clock::time_point runStart;
+	double lastRunMS;
+	int lastRunTicks;
+};
+
+
+// Source
+
+static inline double NetworkMSSince(NetworkProvisioner::Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(
+		NetworkProvisioner::Clock::now() - start).count();
+}
+
+// Appends a write of text to a STRING register as LJM_BYTE values
+static inline void NetworkAddStringWrite(FramePlan & plan, int address,
+	const std::string & text)
+{
+	double bytes[LJM_STRING_ALLOCATION_SIZE] = {0};
+	size_t i;
+	for (i = 0; i < text.size() && i < LJM_STRING_ALLOCATION_SIZE - 1; i++) {
+		bytes[i] = (unsigned char)text[i];
+	}
+	plan.AddWrite(address, LJM_BYTE, bytes, LJM_STRING_ALLOCATION_SIZE);
+}
+
+inline NetworkPlan EthernetPlan(unsigned int ipAddress)
+{
+	NetworkPlan plan;
+	plan.networkInterface = NETWORK_ETHERNET;
+	plan.ipAddress = ipAddress;
+	plan.subnet = 0xFFFFFF00;
+	plan.gateway = 0;
+	return plan;
+}
+
+inline NetworkPlan WiFiPlan(unsigned int ipAddress, const std::string & ssid,
+	const std::string & password)
+{
+	NetworkPlan plan = EthernetPlan(ipAddress);
+	plan.networkInterface = NETWORK_WIFI;
+	plan.ssid = ssid;
+	plan.password = password;
+	return plan;
+}
+
+inline unsigned int GuessNetworkGateway(unsigned int ipAddress)
+{
+	return (ipAddress & 0xFFFFFF00) + 1;
+}
+
+inline const char * NetworkStepName(int step)
+{
+	switch (step) {
+	case NETWORK_STEP_CONFIGURE: return "configure";
+	case NETWORK_STEP_START: return "start";
+	case NETWORK_STEP_CONNECT: return "connect";
+	case NETWORK_STEP_VERIFY: return "verify";
+	case NETWORK_STEP_DONE: return "done";
+	}
+	return "unknown";
+}
+
+inline NetworkProvisioner::NetworkProvisioner(int numWorkers) :
+	fleet(numWorkers),
+	pollIntervalMS(250),
+	connectTimeoutMS(60000),
+	verifyTimeoutMS(15000),
+	lastRunMS(0),
+	lastRunTicks(0)
+{
+}
+
+inline int NetworkProvisioner::AddDevice(int handle, const NetworkPlan & plan)
+{
+	ProvisionedDevice device;
+	int index = fleet.AddDevice(handle);
+	if (index < 0) {
+		return -1;
+	}
+
+	device.plan = plan;
+	if (device.plan.ipAddress != 0 && device.plan.gateway == 0) {
+		device.plan.gateway = GuessNetworkGateway(device.plan.ipAddress);
+	}
+	devices.push_back(device);
+	indexByHandle[handle] = index;
+	return index;
+}
+
+inline int NetworkProvisioner::Run(std::vector<NetworkReport> & reports)
+{
+	size_t i;
+	int numFinished, err = LJME_NOERROR;
+	Clock::time_point nextDue;
+	std::vector<FleetResult> results;
+	FleetOperation step = [this](FleetDevice & fleetDevice, FleetResult & result) {
+		return Step(fleetDevice, result);
+	};
+
+	runStart = Clock::now();
+	for (i = 0; i < devices.size(); i++) {
+		NetworkReport & report = devices[i].report;
+		report.handle = fleet.Device((int)i).handle;
+		report.serialNumber = fleet.Device((int)i).serialNumber;
+		report.networkInterface = devices[i].plan.networkInterface;
+		report.step = NETWORK_STEP_CONFIGURE;
+		report.err = LJME_NOERROR;
+		report.errorAddress = INITIAL_ERR_ADDRESS;
+		report.ipAddress = 0;
+		report.wifiStatus = 0;
+		report.num502Pending = false;
+		report.numPolls = 0;
+		report.numVerifyAttempts = 0;
+		report.configureMS = report.connectMS = report.verifyMS = report.totalMS = 0;
+		devices[i].due = devices[i].stepStart = runStart;
+		devices[i].finished = false;
+	}
+
+	lastRunTicks = 0;
+	numFinished = 0;
+	while (numFinished < (int)devices.size()) {
+		fleet.Run(step, results);
+		++lastRunTicks;
+
+		numFinished = 0;
+		nextDue = Clock::time_point::max();
+		for (i = 0; i < devices.size(); i++) {
+			if (devices[i].finished) {
+				++numFinished;
+			}
+			else if (devices[i].due < nextDue) {
+				nextDue = devices[i].due;
+			}
+		}
+		if (numFinished < (int)devices.size()) {
+			std::this_thread::sleep_until(nextDue);
+		}
+	}
+	lastRunMS = NetworkMSSince(runStart);
+
+	reports.resize(devices.size());
+	for (i = 0; i < devices.size(); i++) {
+		reports[i] = devices[i].report;
+		if (err == LJME_NOERROR) {
+			err = reports[i].err;
+		}
+	}
+	return err;
+}
+
+inline int NetworkProvisioner::Step(FleetDevice & fleetDevice, FleetResult & result)
+{
+	// Only read during Run, so workers can share it
+	ProvisionedDevice & device = devices[indexByHandle.find(fleetDevice.handle)->second];
+	int err = LJME_NOERROR;
+
+	result.err = LJME_NOERROR;
+	if (device.finished || Clock::now() < device.due) {
+		return LJME_NOERROR;
+	}
+
+	switch (device.report.step) {
+	case NETWORK_STEP_CONFIGURE: err = Configure(fleetDevice, device); break;
+	case NETWORK_STEP_START: err = Start(fleetDevice, device); break;
+	case NETWORK_STEP_CONNECT: err = Poll(fleetDevice, device); break;
+	case NETWORK_STEP_VERIFY: err = Verify(fleetDevice, device); break;
+	}
+
+	if (err != LJME_NOERROR) {
+		Finish(device, err);
+	}
+	result.err = device.report.err;
+	result.errorAddress = device.report.errorAddress;
+	return result.err;
+}
+
+inline int NetworkProvisioner::Configure(FleetDevice & fleetDevice,
+	ProvisionedDevice & device)
+{
+	const NetworkPlan & plan = device.plan;
+	bool dhcp = plan.ipAddress == 0;
+	FramePlan frames(fleetDevice.maxBytesPerMB);
+
+	if (plan.networkInterface == NETWORK_ETHERNET) {
+		if (!dhcp) {
+			frames.AddWrite(NETWORK_ETHERNET_IP_DEFAULT_ADDRESS, LJM_UINT32, plan.ipAddress);
+			frames.AddWrite(NETWORK_ETHERNET_SUBNET_DEFAULT_ADDRESS, LJM_UINT32, plan.subnet);
+			frames.AddWrite(NETWORK_ETHERNET_GATEWAY_DEFAULT_ADDRESS, LJM_UINT32, plan.gateway);
+		}
+		frames.AddWrite(NETWORK_ETHERNET_DNS_DEFAULT_ADDRESS, LJM_UINT32, NETWORK_GOOGLE_DNS);
+		frames.AddWrite(NETWORK_ETHERNET_ALTDNS_DEFAULT_ADDRESS, LJM_UINT32,
+			NETWORK_GOOGLE_ALTDNS);
+		frames.AddWrite(NETWORK_ETHERNET_DHCP_ENABLE_DEFAULT_ADDRESS, LJM_UINT16, dhcp);
+		frames.AddWrite(NETWORK_MA_ETH_DEF_NUM502_ADDRESS, LJM_UINT16, NETWORK_DESIRED_NUM502);
+
+		// Restarting Ethernet applies the new defaults
+		frames.AddWrite(NETWORK_POWER_ETHERNET_ADDRESS, LJM_UINT16, 0.0);
+	}
+	else {
+		if (!dhcp) {
+			frames.AddWrite(NETWORK_WIFI_IP_DEFAULT_ADDRESS, LJM_UINT32, plan.ipAddress);
+			frames.AddWrite(NETWORK_WIFI_SUBNET_DEFAULT_ADDRESS, LJM_UINT32, plan.subnet);
+			frames.AddWrite(NETWORK_WIFI_GATEWAY_DEFAULT_ADDRESS, LJM_UINT32, plan.gateway);
+		}
+		frames.AddWrite(NETWORK_WIFI_DHCP_ENABLE_DEFAULT_ADDRESS, LJM_UINT16, dhcp);
+		frames.AddWrite(NETWORK_POWER_WIFI_ADDRESS, LJM_UINT16, 1.0);
+	}
+
+	int err = frames.Execute(fleetDevice.handle, &device.report.errorAddress);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+
+	device.report.configureMS = NetworkMSSince(device.stepStart);
+	NextStep(device, NETWORK_STEP_START, plan.networkInterface == NETWORK_ETHERNET ?
+		NETWORK_ETHERNET_OFF_MS : NETWORK_WIFI_POWER_UP_MS);
+	return LJME_NOERROR;
+}
+
+inline int NetworkProvisioner::Start(FleetDevice & fleetDevice, ProvisionedDevice & device)
+{
+	const NetworkPlan & plan = device.plan;
+	FramePlan frames(fleetDevice.maxBytesPerMB);
+
+	if (plan.networkInterface == NETWORK_ETHERNET) {
+		frames.AddWrite(NETWORK_POWER_ETHERNET_ADDRESS, LJM_UINT16, 1.0);
+	}
+	else {
+		NetworkAddStringWrite(frames, NETWORK_WIFI_SSID_DEFAULT_ADDRESS, plan.ssid);
+		if (!plan.password.empty()) {
+			NetworkAddStringWrite(frames, NETWORK_WIFI_PASSWORD_DEFAULT_ADDRESS, plan.password);
+		}
+		frames.AddWrite(NETWORK_WIFI_APPLY_SETTINGS_ADDRESS, LJM_UINT32, 1);
+	}
+
+	int err = frames.Execute(fleetDevice.handle, &device.report.errorAddress);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+
+	device.report.step = NETWORK_STEP_CONNECT;
+	device.due = Clock::now() + std::chrono::milliseconds(pollIntervalMS);
+	return LJME_NOERROR;
+}
+
+inline int NetworkProvisioner::Poll(FleetDevice & fleetDevice, ProvisionedDevice & device)
+{
+	NetworkReport & report = device.report;
+	bool wifi = device.plan.networkInterface == NETWORK_WIFI;
+	bool connected;
+	FramePlan frames(fleetDevice.maxBytesPerMB);
+	int ipOffset, statusOffset;
+
+	if (wifi) {
+		ipOffset = frames.AddRead(NETWORK_WIFI_IP_ADDRESS, LJM_UINT32);
+		statusOffset = frames.AddRead(NETWORK_WIFI_STATUS_ADDRESS, LJM_UINT32);
+	}
+	else {
+		ipOffset = frames.AddRead(NETWORK_ETHERNET_IP_ADDRESS, LJM_UINT32);
+		statusOffset = frames.AddRead(NETWORK_MA_ETH_NUM502_ADDRESS, LJM_UINT16);
+	}
+
+	int err = frames.Execute(fleetDevice.handle, &report.errorAddress);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+	++report.numPolls;
+
+	report.ipAddress = (unsigned int)frames.Values()[ipOffset];
+	connected = report.ipAddress != 0 &&
+		(device.plan.ipAddress == 0 || report.ipAddress == device.plan.ipAddress);
+	if (wifi) {
+		report.wifiStatus = (int)frames.Values()[statusOffset];
+		if (report.wifiStatus == NETWORK_WIFI_ASSOCIATION_FAILED ||
+			report.wifiStatus == NETWORK_WIFI_START_FAILED)
+		{
+			return LJME_CANNOT_CONNECT;
+		}
+		connected = connected && report.wifiStatus == NETWORK_WIFI_ASSOCIATED;
+	}
+	else {
+		report.num502Pending = (int)frames.Values()[statusOffset] != NETWORK_DESIRED_NUM502;
+	}
+
+	if (connected) {
+		report.connectMS = NetworkMSSince(device.stepStart);
+		NextStep(device, NETWORK_STEP_VERIFY, 0);
+	}
+	else if (NetworkMSSince(device.stepStart) >= connectTimeoutMS) {
+		return LJME_CANNOT_CONNECT;
+	}
+	else {
+		device.due = Clock::now() + std::chrono::milliseconds(pollIntervalMS);
+	}
+	return LJME_NOERROR;
+}
+
+inline int NetworkProvisioner::Verify(FleetDevice & fleetDevice, ProvisionedDevice & device)
+{
+	NetworkReport & report = device.report;
+	char ipString[LJM_IPv4_STRING_SIZE];
+	double serialNumber = 0;
+	int handle;
+
+	++report.numVerifyAttempts;
+	LJM_NumberToIP(report.ipAddress, ipString);
+	int err = LJM_Open(fleetDevice.deviceType, LJM_ctTCP, ipString, &handle);
+	if (err == LJME_NOERROR) {
+		err = LJM_eReadAddress(handle, NETWORK_SERIAL_NUMBER_ADDRESS, LJM_UINT32,
+			&serialNumber);
+
+		// LJM returns the handle already open if the device is reached the
+		// same way it was added
+		if (handle != fleetDevice.handle) {
+			LJM_Close(handle);
+		}
+	}
+
+	if (err == LJME_NOERROR) {
+		if ((int)serialNumber != fleetDevice.serialNumber) {
+			return LJME_DEVICE_NOT_FOUND;
+		}
+		Finish(device, LJME_NOERROR);
+	}
+	else if (NetworkMSSince(device.stepStart) >= verifyTimeoutMS) {
+		return err;
+	}
+	else {
+		device.due = Clock::now() + std::chrono::milliseconds(pollIntervalMS);
+	}
+	return LJME_NOERROR;
+}
+
+inline void NetworkProvisioner::NextStep(ProvisionedDevice & device, int step,
+	unsigned int delayMS)
+{
+	device.report.step = step;
+	device.stepStart = Clock::now();
+	device.due = device.stepStart + std::chrono::milliseconds(delayMS);
+}
+
+inline void NetworkProvisioner::Finish(ProvisionedDevice & device, int err)
+{
+	// A failed step still reports how long it took
+	double stepMS = NetworkMSSince(device.stepStart);
+	switch (device.report.step) {
+	case NETWORK_STEP_CONFIGURE: device.report.configureMS = stepMS; break;
+	case NETWORK_STEP_START:
+	case NETWORK_STEP_CONNECT: device.report.connectMS = stepMS; break;
+	case NETWORK_STEP_VERIFY: device.report.verifyMS = stepMS; break;
+	}
+	if (err == LJME_NOERROR) {
+		device.report.step = NETWORK_STEP_DONE;
+	}
+	device.report.err = err;
+	device.report.totalMS = NetworkMSSince(runStart);
+	device.finished = true;
+}
+
+#endif // #define LJM_NETWORK_PROVISIONER
@@ -0,0 +1,185 @@
+/**
+ * Name: fast_discovery.cpp
+ * Desc: Measures the time from startup to the first AIN0 reading:
+ *           - with a full LJM_ListAllExtended search, as
+ *             list_all/list_all_extended.c does, then an LJM_Open,
+ *           - with a DiscoveryCache that has no cache file yet,
+ *           - with a DiscoveryCache whose file the previous run wrote.
+ *       Then keeps reading for a few seconds while the cache refreshes in the
+ *       background.
+**/
+
+// For printf
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_DiscoveryCache.h"
+
+const char * CACHE_PATH = "ljm_discovery_cache.txt";
+const int NUM_REFRESH_SECONDS = 5;
+const unsigned int REFRESH_INTERVAL_MS = 1000;
+
+/**
+ * Desc: Returns the milliseconds to find every device with
+ *       LJM_ListAllExtended, open the first and read its AIN0.
+**/
+double FirstReadingWithSearch();
+
+/**
+ * Desc: Loads the cache, discovers the devices, reads the first one's AIN0 and
+ *       prints the time that took under description. Closes the opened
+ *       devices unless handles is not NULL, in which case it receives them.
+**/
+void FirstReadingWithCache(DiscoveryCache & cache, const char * description,
+	std::vector<DiscoveredDevice> * handles);
+
+/**
+ * Desc: Reads AIN0 from handle and returns the error.
+**/
+int ReadAIN0(int handle, double * value);
+
+int main()
+{
+	int err, second;
+	size_t i;
+	double value;
+	std::vector<DiscoveredDevice> devices;
+
+	remove(CACHE_PATH);
+
+	printf("Full search, then open:    %8.1f ms\n", FirstReadingWithSearch());
+	{
+		DiscoveryCache cache(CACHE_PATH);
+		FirstReadingWithCache(cache, "DiscoveryCache, no file:  ", NULL);
+	}
+	{
+		DiscoveryCache cache(CACHE_PATH);
+		FirstReadingWithCache(cache, "DiscoveryCache, warm file:", &devices);
+
+		printf("\nReading while the cache refreshes every %u ms\n", REFRESH_INTERVAL_MS);
+		cache.StartRefresh(REFRESH_INTERVAL_MS);
+		for (second = 0; second < NUM_REFRESH_SECONDS && !devices.empty(); second++) {
+			err = ReadAIN0(devices[0].handle, &value);
+			PrintErrorIfError(err, "LJM_eReadName(AIN0)");
+			printf("%d s: AIN0 = %f, %d cached devices\n", second, value, cache.NumEntries());
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+		}
+		cache.StopRefresh();
+	}
+
+	for (i = 0; i < devices.size(); i++) {
+		err = LJM_Close(devices[i].handle);
+		ErrorCheck(err, "LJM_Close");
+	}
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+int ReadAIN0(int handle, double * value)
+{
+	return LJM_eReadName(handle, "AIN0", value);
+}
+
+double FirstReadingWithSearch()
+{
+	enum { NUM_ADDRESSES = 2 };
+	const char * aNames[NUM_ADDRESSES] = {"DEVICE_NAME_DEFAULT", "FIRMWARE_VERSION"};
+	int aAddresses[NUM_ADDRESSES];
+	int aTypes[NUM_ADDRESSES];
+	// DEVICE_NAME_DEFAULT is a 50-byte string, FIRMWARE_VERSION a FLOAT32
+	int aNumRegs[NUM_ADDRESSES] = {25, 2};
+	int aDeviceTypes[LJM_LIST_ALL_SIZE];
+	int aConnectionTypes[LJM_LIST_ALL_SIZE];
+	int aSerialNumbers[LJM_LIST_ALL_SIZE];
+	int aIPAddresses[LJM_LIST_ALL_SIZE];
+	int numFound = 0;
+	int err, handle;
+	double value;
+	char identifier[LJM_STRING_ALLOCATION_SIZE];
+	std::vector<unsigned char> aBytes(LJM_LIST_ALL_SIZE * (25 + 2) * LJM_BYTES_PER_REGISTER);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	err = LJM_NamesToAddresses(NUM_ADDRESSES, aNames, aAddresses, aTypes);
+	ErrorCheck(err, "LJM_NamesToAddresses");
+
+	err = LJM_ListAllExtended(LJM_dtANY, LJM_ctANY, NUM_ADDRESSES, aAddresses, aNumRegs,
+		LJM_LIST_ALL_SIZE, &numFound, aDeviceTypes, aConnectionTypes, aSerialNumbers,
+		aIPAddresses, &aBytes[0]);
+	ErrorCheck(err, "LJM_ListAllExtended");
+	if (numFound == 0) {
+		printf("No devices found\n");
+		WaitForUserIfWindows();
+		exit(LJME_DEVICE_NOT_FOUND);
+	}
+
+	// Open by IP address if the search found one, so LJM doesn't search again
+	if (aIPAddresses[0] == LJM_NO_IP_ADDRESS ||
+		LJM_NumberToIP(aIPAddresses[0], identifier) != LJME_NOERROR)
+	{
+		sprintf(identifier, "%d", aSerialNumbers[0]);
+	}
+	err = LJM_Open(aDeviceTypes[0], aConnectionTypes[0], identifier, &handle);
+	ErrorCheck(err, "LJM_Open");
+	err = ReadAIN0(handle, &value);
+	ErrorCheck(err, "LJM_eReadName(AIN0)");
+	double ms = DiscoveryMSSince(start);
+
+	err = LJM_Close(handle);
+	ErrorCheck(err, "LJM_Close");
+	return ms;
+}
+
+void FirstReadingWithCache(DiscoveryCache & cache, const char * description,
+	std::vector<DiscoveredDevice> * handles)
+{
+	int err;
+	size_t i;
+	double value;
+	std::vector<DiscoveredDevice> devices;
+	DiscoveryReport report;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	cache.Load();
+	err = cache.Discover(LJM_ctANY, -1, devices, &report);
+	ErrorCheck(err, "DiscoveryCache::Discover");
+	if (devices.empty()) {
+		printf("No devices found\n");
+		WaitForUserIfWindows();
+		exit(LJME_DEVICE_NOT_FOUND);
+	}
+	err = ReadAIN0(devices[0].handle, &value);
+	ErrorCheck(err, "LJM_eReadName(AIN0)");
+	double ms = DiscoveryMSSince(start);
+
+	printf("%s %8.1f ms (%d cached, %d opened from the cache in %.1f ms, ", description,
+		ms, report.numCached, report.numOpenedFromCache, report.cacheMS);
+	if (report.searched) {
+		printf("%d opened after a %.1f ms search)\n", report.numOpenedFromSearch,
+			report.searchMS);
+	}
+	else {
+		printf("no search)\n");
+	}
+
+	if (handles != NULL) {
+		*handles = devices;
+	}
+	else {
+		for (i = 0; i < devices.size(); i++) {
+			err = LJM_Close(devices[i].handle);
+			ErrorCheck(err, "LJM_Close");
+		}
+	}
+}
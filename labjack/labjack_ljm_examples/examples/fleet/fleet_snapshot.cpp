@@ -0,0 +1,151 @@
+/**
+ * Name: fleet_snapshot.cpp
+ * Desc: Opens every device LJM_ListAll finds, then takes a snapshot of the
+ *       same registers from all of them, first one device after another and
+ *       then with a Fleet, and prints the time each takes in round trips.
+ *       Finally sets the AIN range of the whole fleet with one
+ *       ConfigTransaction per device.
+**/
+
+// For printf
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_Fleet.h"
+
+enum { NUM_NAMES = 6 };
+const char * NAMES[NUM_NAMES] = {"AIN0", "AIN1", "AIN2", "AIN3", "FIO_STATE",
+	"SERIAL_NUMBER"};
+
+enum { NUM_SNAPSHOTS = 20 };
+
+/**
+ * Desc: Builds a FramePlan that reads NAMES.
+**/
+void BuildSnapshotPlan(FramePlan & plan);
+
+/**
+ * Desc: Returns the median of the latencies in results.
+**/
+double MedianLatencyUS(const std::vector<FleetResult> & results);
+
+int main()
+{
+	int err, i, snapshotI, valueI;
+	double sequentialUS = 0, fleetUS = 0, medianUS = 0;
+	std::vector<int> handles;
+	std::vector<FleetResult> results;
+	FramePlan plan;
+	Fleet fleet;
+
+	err = FleetOpenAll(LJM_dtANY, LJM_ctANY, handles);
+	if (err <= 0) {
+		printf("No devices opened\n");
+		WaitForUserIfWindows();
+		return LJME_DEVICE_NOT_FOUND;
+	}
+	for (i = 0; i < (int)handles.size(); i++) {
+		fleet.AddDevice(handles[i]);
+	}
+	printf("Opened %d devices\n\n", fleet.NumDevices());
+
+	BuildSnapshotPlan(plan);
+	FleetOperation snapshot = FleetPlanOperation(plan);
+
+	// One device after another, as a loop over the handles would do
+	for (snapshotI = 0; snapshotI < NUM_SNAPSHOTS; snapshotI++) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (i = 0; i < fleet.NumDevices(); i++) {
+			FleetResult result;
+			result.errorAddress = INITIAL_ERR_ADDRESS;
+			err = snapshot(fleet.Device(i), result);
+			ErrorCheckWithAddress(err, result.errorAddress, "Snapshot of handle %d",
+				fleet.Device(i).handle);
+		}
+		sequentialUS += std::chrono::duration<double, std::micro>(
+			std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Every device at once
+	for (snapshotI = 0; snapshotI < NUM_SNAPSHOTS; snapshotI++) {
+		err = fleet.Run(snapshot, results);
+		PrintErrorIfError(err, "Fleet::Run");
+		fleetUS += fleet.LastRunUS();
+		medianUS += MedianLatencyUS(results);
+	}
+	sequentialUS /= NUM_SNAPSHOTS;
+	fleetUS /= NUM_SNAPSHOTS;
+	medianUS /= NUM_SNAPSHOTS;
+
+	printf("%10s %6s %8s %12s", "Serial", "Worker", "Latency", "Error");
+	for (i = 0; i < NUM_NAMES - 1; i++) {
+		printf(" %10s", NAMES[i]);
+	}
+	printf("\n");
+	for (i = 0; i < (int)results.size(); i++) {
+		printf("%10d %6d %5.0f us %12d", results[i].serialNumber, results[i].worker,
+			results[i].latencyUS, results[i].err);
+		for (valueI = 0; valueI < (int)results[i].values.size() - 1; valueI++) {
+			printf(" %10.4f", results[i].values[valueI]);
+		}
+		printf("\n");
+	}
+
+	FleetStats stats = fleet.GetStats();
+	printf("\nMedian round trip: %.0f us\n", medianUS);
+	printf("Snapshot of %d devices, one after another: %8.0f us (%.1f round trips)\n",
+		fleet.NumDevices(), sequentialUS, sequentialUS / medianUS);
+	printf("Snapshot of %d devices, with a Fleet:      %8.0f us (%.1f round trips)\n",
+		fleet.NumDevices(), fleetUS, fleetUS / medianUS);
+	printf("%lld operations, %lld stolen from another worker\n\n", stats.operations,
+		stats.steals);
+
+	err = fleet.Run(FleetConfigOperation([](ConfigTransaction & transaction) {
+		return transaction.Write("AIN_ALL_RANGE", 10.0);
+	}), results);
+	PrintErrorIfError(err, "Fleet::Run(AIN_ALL_RANGE)");
+	printf("Set AIN_ALL_RANGE on %d devices in %.0f us\n", fleet.NumDevices(),
+		fleet.LastRunUS());
+
+	for (i = 0; i < (int)handles.size(); i++) {
+		err = LJM_Close(handles[i]);
+		ErrorCheck(err, "LJM_Close");
+	}
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+void BuildSnapshotPlan(FramePlan & plan)
+{
+	int i, address, type;
+	for (i = 0; i < NUM_NAMES; i++) {
+		int err = LJM_NameToAddress(NAMES[i], &address, &type);
+		ErrorCheck(err, "LJM_NameToAddress(%s)", NAMES[i]);
+		plan.AddRead(address, type);
+	}
+}
+
+double MedianLatencyUS(const std::vector<FleetResult> & results)
+{
+	size_t i;
+	std::vector<double> latencies;
+	for (i = 0; i < results.size(); i++) {
+		latencies.push_back(results[i].latencyUS);
+	}
+	if (latencies.empty()) {
+		return 0;
+	}
+	std::sort(latencies.begin(), latencies.end());
+	return latencies[latencies.size() / 2];
+}
@@ -0,0 +1,162 @@
+/**
+ * Name: handle_pool.cpp
+ * Desc: Puts every device LJM_ListAll finds into a HandlePool, then reads
+ *       AIN0 from each of them twice a second for NUM_SECONDS, printing which
+ *       devices are available. Unplug and replug devices while it runs to
+ *       see them reported unavailable, reopened in the background and, if
+ *       possible, moved back to their fastest connection type.
+ *       testing/auto_reconnect_test.c shows LJM's own reconnection instead.
+**/
+
+// For printf
+#include <stdio.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_HandlePool.h"
+
+const int NUM_SECONDS = 30;
+const int READS_PER_SECOND = 2;
+const unsigned int STARTUP_TIMEOUT_MS = 5000;
+
+/**
+ * Desc: Adds each device LJM_ListAll finds to pool, once per serial number,
+ *       with its IP address if it was found over a network. Returns the
+ *       serial numbers added.
+**/
+std::vector<int> AddFoundDevices(HandlePool & pool);
+
+/**
+ * Desc: Prints the health of every pooled device.
+**/
+void PrintHealth(HandlePool & pool);
+
+int main()
+{
+	int err, handle, second, readI;
+	size_t deviceI;
+	double value;
+	HandlePool pool;
+
+	GetAndPrintConfigValue(LJM_LIBRARY_VERSION);
+
+	// Probes and reopen attempts shouldn't block for long on a lost device
+	SetConfigValue(LJM_OPEN_TCP_DEVICE_TIMEOUT_MS, 500);
+	SetConfigValue(LJM_SEND_RECEIVE_TIMEOUT_MS, 500);
+
+	pool.SetProbeIntervalMS(500);
+	std::vector<int> serialNumbers = AddFoundDevices(pool);
+	if (serialNumbers.empty()) {
+		printf("No devices found\n");
+		WaitForUserIfWindows();
+		return LJME_DEVICE_NOT_FOUND;
+	}
+
+	for (deviceI = 0; deviceI < serialNumbers.size(); deviceI++) {
+		err = pool.WaitUntilAvailable(serialNumbers[deviceI], STARTUP_TIMEOUT_MS, &handle);
+		PrintErrorIfError(err, "HandlePool::WaitUntilAvailable(%d)", serialNumbers[deviceI]);
+	}
+	PrintHealth(pool);
+
+	// Acquire doesn't touch the device, so it costs microseconds
+	{
+		enum { NUM_ACQUIRES = 100000 };
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (readI = 0; readI < NUM_ACQUIRES; readI++) {
+			pool.Acquire(serialNumbers[0], &handle);
+		}
+		printf("\nHandlePool::Acquire: %.3f us\n\n", std::chrono::duration<double,
+			std::micro>(std::chrono::steady_clock::now() - start).count() / NUM_ACQUIRES);
+	}
+
+	for (second = 0; second < NUM_SECONDS; second++) {
+		for (readI = 0; readI < READS_PER_SECOND; readI++) {
+			printf("%2d.%d s:", second, readI * 10 / READS_PER_SECOND);
+			for (deviceI = 0; deviceI < serialNumbers.size(); deviceI++) {
+				err = pool.Acquire(serialNumbers[deviceI], &handle);
+				if (err != LJME_NOERROR) {
+					printf("  %d unavailable", serialNumbers[deviceI]);
+					continue;
+				}
+
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				err = LJM_eReadName(handle, "AIN0", &value);
+				pool.Report(serialNumbers[deviceI], handle, err, std::chrono::duration<double,
+					std::micro>(std::chrono::steady_clock::now() - start).count());
+				if (err == LJME_NOERROR) {
+					printf("  %d AIN0 = %f", serialNumbers[deviceI], value);
+				}
+				else {
+					printf("  %d error %d", serialNumbers[deviceI], err);
+				}
+			}
+			printf("\n");
+			std::this_thread::sleep_for(std::chrono::milliseconds(1000 / READS_PER_SECOND));
+		}
+	}
+
+	printf("\n");
+	PrintHealth(pool);
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+std::vector<int> AddFoundDevices(HandlePool & pool)
+{
+	int aDeviceTypes[LJM_LIST_ALL_SIZE];
+	int aConnectionTypes[LJM_LIST_ALL_SIZE];
+	int aSerialNumbers[LJM_LIST_ALL_SIZE];
+	int aIPAddresses[LJM_LIST_ALL_SIZE];
+	int numFound = 0;
+	int i, j, err;
+	char IPv4String[LJM_IPv4_STRING_SIZE];
+	std::vector<int> serialNumbers;
+
+	err = LJM_ListAll(LJM_dtANY, LJM_ctANY, &numFound, aDeviceTypes, aConnectionTypes,
+		aSerialNumbers, aIPAddresses);
+	ErrorCheck(err, "LJM_ListAll");
+
+	for (i = 0; i < numFound; i++) {
+		const char * networkIdentifier = NULL;
+
+		// Use the IP address of the device's first network listing, if any
+		for (j = 0; j < numFound && networkIdentifier == NULL; j++) {
+			if (aSerialNumbers[j] == aSerialNumbers[i] && aConnectionTypes[j] != LJM_ctUSB &&
+				LJM_NumberToIP(aIPAddresses[j], IPv4String) == LJME_NOERROR)
+			{
+				networkIdentifier = IPv4String;
+			}
+		}
+
+		if (pool.AddDevice(aSerialNumbers[i], networkIdentifier) == LJME_NOERROR) {
+			serialNumbers.push_back(aSerialNumbers[i]);
+		}
+	}
+	return serialNumbers;
+}
+
+void PrintHealth(HandlePool & pool)
+{
+	size_t i;
+	std::vector<HandlePoolHealth> all = pool.GetAllHealth();
+
+	printf("%10s %9s %16s %10s %8s %6s %10s %10s\n", "Serial", "Available",
+		"Connection", "Latency", "Reads", "Errors", "Reconnects", "Retry in");
+	for (i = 0; i < all.size(); i++) {
+		printf("%10d %9s %16s %7.0f us %8lld %6lld %10lld %7.0f ms\n",
+			all[i].serialNumber, all[i].available ? "yes" : "no",
+			all[i].available ? NumberToConnectionType(all[i].connectionType) : "-",
+			all[i].latencyUS, all[i].successes, all[i].errors, all[i].reconnects,
+			all[i].nextAttemptMS);
+	}
+}
@@ -0,0 +1,361 @@
+/**
+ * Name: network_provisioning.cpp
+ * Desc: Sets up the Ethernet or WiFi of every T7 connected over USB at once
+ *       with a NetworkProvisioner, giving them consecutive static IP
+ *       addresses or DHCP, and prints how long each step took for each
+ *       device. utilities/t7_tcp_configure.c does the same for one device.
+ *       With --stand-in, provisions simulated devices on local Modbus
+ *       stand-ins instead, half of them over WiFi and half over Ethernet.
+ * Usage: network_provisioning ethernet <first IP address | DHCP>
+ *        network_provisioning wifi <first IP address | DHCP> <SSID> [password]
+ *        network_provisioning --stand-in [number of devices]
+ *        The stand-ins listen on 127.0.0.2 and up, port 502, so they need
+ *        Linux and permission to use port 502.
+**/
+
+// For printf
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "../modbus/ModbusStandIn.h"
+#include "LJM_NetworkProvisioner.h"
+
+const int DEFAULT_NUM_STAND_INS = 8;
+const int MAX_NUM_STAND_INS = 200;
+const int STAND_IN_FIRST_SERIAL_NUMBER = 470900000;
+
+// Simulated WiFi association and Ethernet start-up times of the stand-ins
+const unsigned int STAND_IN_ASSOCIATE_MS = 2000;
+const unsigned int STAND_IN_ETHERNET_START_MS = 1500;
+const unsigned int STAND_IN_STAGGER_MS = 300;
+
+/**
+ * Name: SimulatedT7
+ * Desc: A ModbusStandIn that LJM_Open accepts as a T7, with a thread that
+ *       reacts to the network registers roughly like a device: WIFI_STATUS
+ *       goes to ASSOCIATED and WIFI_IP is set associateMS after
+ *       WIFI_APPLY_SETTINGS is written, and ETHERNET_IP is cleared while
+ *       POWER_ETHERNET is 0 and set ethernetStartMS after it is turned back
+ *       on. The address the simulated interfaces get is the stand-in's own,
+ *       so provisioning can verify them over TCP.
+**/
+class SimulatedT7
+{
+public:
+	SimulatedT7(unsigned int ipAddress, int serialNumber, unsigned int associateMS,
+		unsigned int ethernetStartMS);
+	~SimulatedT7();
+
+	int Start();
+	unsigned int IPAddress() const { return ipAddress; }
+
+private:
+	void Run();
+
+	ModbusStandIn server;
+	unsigned int ipAddress;
+	unsigned int associateMS;
+	unsigned int ethernetStartMS;
+	std::atomic<bool> running;
+	std::thread thread;
+};
+
+/**
+ * Desc: Opens every T7 connected over USB and adds them to provisioner in
+ *       order of serial number, with consecutive IP addresses from
+ *       firstIPAddress, or DHCP if it is 0.
+**/
+void AddUSBDevices(NetworkProvisioner & provisioner, NetworkInterface networkInterface,
+	unsigned int firstIPAddress, const char * ssid, const char * password);
+
+/**
+ * Desc: Starts numDevices SimulatedT7s, opens them over TCP and adds them to
+ *       provisioner.
+**/
+void AddStandIns(NetworkProvisioner & provisioner, int numDevices,
+	std::vector<std::unique_ptr<SimulatedT7> > & standIns);
+
+void PrintReports(const NetworkProvisioner & provisioner,
+	const std::vector<NetworkReport> & reports);
+
+void Usage(const char * programName);
+
+int main(int argc, char * argv[])
+{
+	int err;
+	unsigned int firstIPAddress = 0;
+	NetworkProvisioner provisioner;
+	std::vector<std::unique_ptr<SimulatedT7> > standIns;
+	std::vector<NetworkReport> reports;
+
+	if (argc >= 2 && strcmp(argv[1], "--stand-in") == 0) {
+		AddStandIns(provisioner, argc > 2 ? atoi(argv[2]) : DEFAULT_NUM_STAND_INS,
+			standIns);
+	}
+	else if (argc >= 3 && (strcmp(argv[1], "ethernet") == 0 ||
+		(strcmp(argv[1], "wifi") == 0 && argc >= 4)))
+	{
+		if (strcmp(argv[2], "DHCP") != 0) {
+			err = LJM_IPToNumber(argv[2], &firstIPAddress);
+			ErrorCheck(err, "LJM_IPToNumber(%s)", argv[2]);
+		}
+		if (argv[1][0] == 'e') {
+			AddUSBDevices(provisioner, NETWORK_ETHERNET, firstIPAddress, NULL, NULL);
+		}
+		else {
+			AddUSBDevices(provisioner, NETWORK_WIFI, firstIPAddress, argv[3],
+				argc > 4 ? argv[4] : "");
+		}
+	}
+	else {
+		Usage(argv[0]);
+	}
+
+	if (provisioner.NumDevices() == 0) {
+		printf("No devices found\n");
+		WaitForUserIfWindows();
+		return LJME_DEVICE_NOT_FOUND;
+	}
+
+	// A device that isn't reachable yet shouldn't hold up a tick for long
+	SetConfigValue(LJM_OPEN_TCP_DEVICE_TIMEOUT_MS, 1000);
+
+	printf("Provisioning %d devices...\n\n", provisioner.NumDevices());
+	err = provisioner.Run(reports);
+	PrintReports(provisioner, reports);
+
+	LJM_CloseAll();
+	standIns.clear();
+
+	WaitForUserIfWindows();
+
+	return err;
+}
+
+SimulatedT7::SimulatedT7(unsigned int ipAddress, int serialNumber,
+	unsigned int associateMS, unsigned int ethernetStartMS) :
+	ipAddress(ipAddress),
+	associateMS(associateMS),
+	ethernetStartMS(ethernetStartMS),
+	running(false)
+{
+	// What LJM reads when it opens a T7 over TCP; the first three aren't in
+	// ljm_constants.json
+	server.SetRegister(65000, 7);
+	server.SetValue(49600, LJM_UINT32, 11);
+	server.SetRegister(49910, 1040);
+	server.SetValue(60000, LJM_FLOAT32, 7); // PRODUCT_ID
+	server.SetValue(60004, LJM_FLOAT32, 1.0225); // FIRMWARE_VERSION
+	server.SetValue(NETWORK_SERIAL_NUMBER_ADDRESS, LJM_UINT32, serialNumber);
+
+	server.SetValue(NETWORK_POWER_ETHERNET_ADDRESS, LJM_UINT16, 1);
+	server.SetValue(NETWORK_ETHERNET_IP_ADDRESS, LJM_UINT32, ipAddress);
+	server.SetValue(NETWORK_MA_ETH_NUM502_ADDRESS, LJM_UINT16, NETWORK_DESIRED_NUM502);
+	server.SetValue(NETWORK_WIFI_STATUS_ADDRESS, LJM_UINT32, 2903); // UNPOWERED
+}
+
+SimulatedT7::~SimulatedT7()
+{
+	if (running) {
+		running = false;
+		thread.join();
+	}
+	server.Stop();
+}
+
+int SimulatedT7::Start()
+{
+	int err = server.Start(502, -1, ipAddress);
+	if (err == LJME_NOERROR) {
+		running = true;
+		thread = std::thread(&SimulatedT7::Run, this);
+	}
+	return err;
+}
+
+void SimulatedT7::Run()
+{
+	typedef std::chrono::steady_clock Clock;
+	bool associating = false, ethernetOff = false, ethernetStarting = false;
+	Clock::time_point associateDone, ethernetDone;
+
+	while (running) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		Clock::time_point now = Clock::now();
+
+		if (server.GetValue(NETWORK_WIFI_APPLY_SETTINGS_ADDRESS, LJM_UINT32) != 0) {
+			server.SetValue(NETWORK_WIFI_APPLY_SETTINGS_ADDRESS, LJM_UINT32, 0);
+			server.SetValue(NETWORK_WIFI_IP_ADDRESS, LJM_UINT32, 0);
+			server.SetValue(NETWORK_WIFI_STATUS_ADDRESS, LJM_UINT32, 2901); // ASSOCIATING
+			associating = true;
+			associateDone = now + std::chrono::milliseconds(associateMS);
+		}
+		if (associating && now >= associateDone) {
+			associating = false;
+			if (server.GetValue(NETWORK_POWER_WIFI_ADDRESS, LJM_UINT16) == 0) {
+				server.SetValue(NETWORK_WIFI_STATUS_ADDRESS, LJM_UINT32,
+					NETWORK_WIFI_START_FAILED);
+			}
+			else {
+				server.SetValue(NETWORK_WIFI_IP_ADDRESS, LJM_UINT32, ipAddress);
+				server.SetValue(NETWORK_WIFI_STATUS_ADDRESS, LJM_UINT32,
+					NETWORK_WIFI_ASSOCIATED);
+			}
+		}
+
+		if (server.GetValue(NETWORK_POWER_ETHERNET_ADDRESS, LJM_UINT16) == 0) {
+			server.SetValue(NETWORK_ETHERNET_IP_ADDRESS, LJM_UINT32, 0);
+			ethernetOff = true;
+			ethernetStarting = false;
+		}
+		else if (ethernetOff) {
+			ethernetOff = false;
+			ethernetStarting = true;
+			ethernetDone = now + std::chrono::milliseconds(ethernetStartMS);
+		}
+		if (ethernetStarting && now >= ethernetDone) {
+			ethernetStarting = false;
+			server.SetValue(NETWORK_ETHERNET_IP_ADDRESS, LJM_UINT32, ipAddress);
+			server.SetValue(NETWORK_MA_ETH_NUM502_ADDRESS, LJM_UINT16,
+				server.GetValue(NETWORK_MA_ETH_DEF_NUM502_ADDRESS, LJM_UINT16));
+		}
+	}
+}
+
+void AddUSBDevices(NetworkProvisioner & provisioner, NetworkInterface networkInterface,
+	unsigned int firstIPAddress, const char * ssid, const char * password)
+{
+	int err, deviceType, connectionType, ipAddress, port, maxBytesPerMB;
+	size_t i;
+	std::vector<int> handles;
+	std::vector<std::pair<int, int> > serialsAndHandles;
+
+	if (FleetOpenAll(LJM_dtT7, LJM_ctUSB, handles) < 0) {
+		return;
+	}
+	for (i = 0; i < handles.size(); i++) {
+		serialsAndHandles.push_back(std::make_pair(0, handles[i]));
+		err = LJM_GetHandleInfo(handles[i], &deviceType, &connectionType,
+			&serialsAndHandles.back().first, &ipAddress, &port, &maxBytesPerMB);
+		ErrorCheck(err, "LJM_GetHandleInfo");
+	}
+	std::sort(serialsAndHandles.begin(), serialsAndHandles.end());
+
+	for (i = 0; i < serialsAndHandles.size(); i++) {
+		unsigned int deviceIPAddress = firstIPAddress ? firstIPAddress + (unsigned int)i : 0;
+		if (networkInterface == NETWORK_ETHERNET) {
+			provisioner.AddDevice(serialsAndHandles[i].second, EthernetPlan(deviceIPAddress));
+		}
+		else {
+			provisioner.AddDevice(serialsAndHandles[i].second,
+				WiFiPlan(deviceIPAddress, ssid, password));
+		}
+	}
+}
+
+void AddStandIns(NetworkProvisioner & provisioner, int numDevices,
+	std::vector<std::unique_ptr<SimulatedT7> > & standIns)
+{
+	int deviceI, err, handle;
+	char ipString[LJM_IPv4_STRING_SIZE];
+	unsigned int ipAddress, stagger;
+
+	if (numDevices < 1 || numDevices > MAX_NUM_STAND_INS) {
+		printf("The number of stand-ins must be 1 to %d\n", MAX_NUM_STAND_INS);
+		WaitForUserIfWindows();
+		exit(1);
+	}
+
+	printf("Provisioning simulated devices on local Modbus stand-ins\n");
+	for (deviceI = 0; deviceI < numDevices; deviceI++) {
+		ipAddress = 0x7F000002 + (unsigned int)deviceI; // 127.0.0.2 and up
+		stagger = STAND_IN_STAGGER_MS * (unsigned int)(deviceI % 5);
+		standIns.push_back(std::unique_ptr<SimulatedT7>(new SimulatedT7(ipAddress,
+			STAND_IN_FIRST_SERIAL_NUMBER + deviceI, STAND_IN_ASSOCIATE_MS + stagger,
+			STAND_IN_ETHERNET_START_MS + stagger)));
+
+		LJM_NumberToIP(ipAddress, ipString);
+		err = standIns.back()->Start();
+		ErrorCheck(err, "Starting a stand-in on %s:502", ipString);
+
+		err = LJM_Open(LJM_dtT7, LJM_ctTCP, ipString, &handle);
+		ErrorCheck(err, "LJM_Open(%s)", ipString);
+
+		if (deviceI % 2 == 0) {
+			provisioner.AddDevice(handle, WiFiPlan(ipAddress, "StandInNetwork", "password"));
+		}
+		else {
+			provisioner.AddDevice(handle, EthernetPlan(ipAddress));
+		}
+	}
+	printf("\n");
+}
+
+void PrintReports(const NetworkProvisioner & provisioner,
+	const std::vector<NetworkReport> & reports)
+{
+	size_t i;
+	double oneAtATimeMS = 0;
+	char ipString[LJM_IPv4_STRING_SIZE];
+	char errorString[LJM_MAX_NAME_SIZE];
+
+	printf("%-10s %-9s %-16s %10s %10s %10s %10s %6s  %s\n", "Serial", "Interface",
+		"IP address", "Configure", "Connect", "Verify", "Total", "Polls", "Result");
+	for (i = 0; i < reports.size(); i++) {
+		const NetworkReport & report = reports[i];
+		LJM_NumberToIP(report.ipAddress, ipString);
+		printf("%-10d %-9s %-16s %7.0f ms %7.0f ms %7.0f ms %7.0f ms %6d  ",
+			report.serialNumber,
+			report.networkInterface == NETWORK_ETHERNET ? "Ethernet" : "WiFi",
+			ipString, report.configureMS, report.connectMS, report.verifyMS,
+			report.totalMS, report.numPolls);
+
+		if (report.err == LJME_NOERROR) {
+			printf("OK\n");
+		}
+		else {
+			LJM_ErrorToString(report.err, errorString);
+			printf("%s failed: %s", NetworkStepName(report.step), errorString);
+			if (report.wifiStatus == NETWORK_WIFI_ASSOCIATION_FAILED) {
+				printf(" (WiFi association failed; check the SSID and password)");
+			}
+			else if (report.wifiStatus == NETWORK_WIFI_START_FAILED) {
+				printf(" (the WiFi module failed to start; is this a T7-Pro?)");
+			}
+			printf("\n");
+		}
+		if (report.num502Pending) {
+			printf("%10s MA_ETH_NUM502 isn't %d yet; power cycle this device before using"
+				" Ethernet\n", "", NETWORK_DESIRED_NUM502);
+		}
+		oneAtATimeMS += report.configureMS + report.connectMS + report.verifyMS;
+	}
+
+	printf("\nProvisioned %d devices in %.0f ms, %d ticks. One at a time, the same steps"
+		" would take about %.0f ms,\nestimated as the sum of each device's step times rather"
+		" than measured.\n", provisioner.NumDevices(), provisioner.LastRunMS(),
+		provisioner.LastRunTicks(), oneAtATimeMS);
+}
+
+void Usage(const char * programName)
+{
+	printf("Usage: %s ethernet <first IP address | DHCP>\n", programName);
+	printf("       %s wifi <first IP address | DHCP> <SSID> [password]\n", programName);
+	printf("       %s --stand-in [number of devices]\n", programName);
+	WaitForUserIfWindows();
+	exit(1);
+}
@@ -0,0 +1,691 @@
+/**
+ * Name: LJM_LuaDebugStream.h
+ * Desc: Streams the output of a Lua script's print calls from a T7 without
+ *       losing it. utilities/lua_script_basic.c reads LUA_DEBUG_NUM_BYTES
+ *       once a second and then LUA_DEBUG_DATA into a newly allocated buffer,
+ *       so a script that prints more than the device's debug buffer holds in
+ *       a second loses output. LuaDebugStreamer polls as often as the
+ *       script's output rate needs, reads the data and the next byte count
+ *       in the same packets, and hands complete lines to sinks on another
+ *       thread through a lock-free queue, so slow sinks don't delay polls.
+ *       C++11 only.
+**/
+
+#ifndef LJM_LUA_DEBUG_STREAM
+#define LJM_LUA_DEBUG_STREAM
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LabJackM.h"
+
+#include "../LJM_Utilities.h"
+#include "../LJM_FramePlan.h"
+
+enum {
+	LUA_DEBUG_NUM_BYTES_ADDRESS = 6022,
+	LUA_DEBUG_DATA_ADDRESS = 6024
+};
+
+// Assumed size of the device's debug buffer until it reports more bytes waiting
+enum { LUA_DEBUG_DEFAULT_BUFFER_SIZE = 1024 };
+
+// Time over which the output rate is averaged
+enum { LUA_DEBUG_RATE_WINDOW_MS = 100 };
+
+/**
+ * Name: LuaLineQueue
+ * Desc: A fixed-size ring of length-prefixed lines for exactly one producer
+ *       thread and one consumer thread. Push and Pop never lock or allocate;
+ *       each side only writes its own index, and the other side reads it
+ *       with acquire ordering.
+**/
+class LuaLineQueue
+{
+public:
+	// The longest line one Push takes
+	enum { MAX_LINE_LENGTH = 0xFFFF };
+
+	LuaLineQueue(int capacityBytes = 1 << 16);
+
+	/**
+	 * Desc: Producer side. Copies the line into the ring.
+	 * Retr: false if there isn't room, in which case nothing is copied.
+	**/
+	bool Push(const char * line, int length);
+
+	/**
+	 * Desc: Consumer side. Copies the oldest line into line, which is resized
+	 *       but keeps its capacity between calls.
+	 * Retr: false if the queue is empty.
+	**/
+	bool Pop(std::string & line);
+
+	bool Empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+
+private:
+	void CopyIn(size_t position, const char * bytes, size_t length);
+	void CopyOut(size_t position, char * bytes, size_t length) const;
+
+	std::vector<char> ring;
+
+	// Total bytes ever pushed and popped; their difference is the fill level
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+};
+
+/**
+ * Name: LuaDebugSink
+ * Desc: Receives the lines of a LuaDebugStreamer, without the line break, on
+ *       the streamer's sink thread.
+**/
+class LuaDebugSink
+{
+public:
+	virtual ~LuaDebugSink() {}
+	virtual void Write(const char * line, int length) = 0;
+
+	/**
+	 * Desc: Called when the queue runs empty, so buffered output shows up.
+	**/
+	virtual void Flush() {}
+};
+
+/**
+ * Name: LuaConsoleSink
+ * Desc: Prints each line to stdout after prefix.
+**/
+class LuaConsoleSink : public LuaDebugSink
+{
+public:
+	LuaConsoleSink(const char * prefix = "") : prefix(prefix) {}
+	void Write(const char * line, int length);
+	void Flush() { fflush(stdout); }
+
+private:
+	std::string prefix;
+};
+
+/**
+ * Name: LuaFileSink
+ * Desc: Appends each line to a file.
+**/
+class LuaFileSink : public LuaDebugSink
+{
+public:
+	LuaFileSink() : file(NULL) {}
+	~LuaFileSink() { Close(); }
+
+	/**
+	 * Retr: LJME_NOERROR, or LJME_INVALID_PARAMETER if path can't be opened.
+	**/
+	int Open(const char * path);
+	void Close();
+	void Write(const char * line, int length);
+	void Flush();
+
+private:
+	FILE * file;
+};
+
+/**
+ * Desc: What a LuaDebugStreamer has done since Start.
+ *       bytesRead counts bytes read from LUA_DEBUG_DATA, and bytesPerSecond
+ *       is bytesRead over elapsedMS.
+ *       fullPolls counts polls that found the device's debug buffer too
+ *       full for another line as long as the longest one so far; the
+ *       script may have lost output then. maxBufferBytes is the most the
+ *       buffer held at a poll. droppedLines and
+ *       droppedBytes count lines that didn't fit in the queue because the
+ *       sinks fell behind.
+ *       pollIntervalMS is the current interval.
+**/
+struct LuaDebugStats
+{
+	long long polls;
+	long long packets;
+	long long bytesRead;
+	long long lines;
+	long long fullPolls;
+	long long droppedLines;
+	long long droppedBytes;
+	int maxBufferBytes;
+	double pollIntervalMS;
+	double elapsedMS;
+	double bytesPerSecond;
+};
+
+/**
+ * Name: LuaDebugStreamer
+ * Desc: Start starts a poll thread and a sink thread. Each poll is one
+ *       FramePlan: it reads the bytes the previous poll found waiting from
+ *       LUA_DEBUG_DATA, then LUA_DEBUG_NUM_BYTES, so the count and the data
+ *       never take separate round trips. Since the device only appends to
+ *       its buffer between polls, the bytes counted last time are always
+ *       there to read. The plan and its values are reused between polls.
+ *
+ *       The count is also how much output arrived since the last poll.
+ *       From it the streamer estimates the script's output rate and sets
+ *       the next interval so the buffer is about targetFill full when it is
+ *       read, within the interval limits.
+ * Note: Nothing else may read LUA_DEBUG_DATA while the streamer runs, or the
+ *       streamer would read more bytes than are waiting.
+**/
+class LuaDebugStreamer
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	LuaDebugStreamer();
+	~LuaDebugStreamer();
+
+	/**
+	 * Desc: Settings. Call before Start.
+	 *       SetPollIntervalMS sets the limits of the adaptive interval.
+	 *       Default 2 to 1000 ms. Equal limits give a fixed interval.
+	 *       The interval starts at the lower limit and at most doubles
+	 *       from one poll to the next.
+	 *       SetTargetFill sets the fraction of the debug buffer to let fill
+	 *       up between polls. Default 0.5.
+	 *       SetBufferSize sets the size of the device's debug buffer. Default
+	 *       LUA_DEBUG_DEFAULT_BUFFER_SIZE; a fuller buffer seen at a poll
+	 *       raises it.
+	 *       SetQueueBytes sets the size of the line queue. Default 64 KiB.
+	**/
+	void SetPollIntervalMS(double minMS, double maxMS);
+	void SetTargetFill(double fraction) { targetFill = fraction; }
+	void SetBufferSize(int bytes) { bufferSize = bytes; }
+	void SetQueueBytes(int bytes) { queueBytes = bytes; }
+
+	/**
+	 * Desc: Adds a sink. The streamer doesn't own it, and it must outlive
+	 *       Stop.
+	**/
+	void AddSink(LuaDebugSink * sink) { sinks.push_back(sink); }
+
+	/**
+	 * Desc: Starts streaming from handle. Debug output must already be
+	 *       enabled with LUA_DEBUG_ENABLE.
+	 * Retr: LJME_NOERROR, or the error of LJM_GetHandleInfo.
+	**/
+	int Start(int handle);
+
+	/**
+	 * Desc: Stops polling after one more poll, which reads the output the
+	 *       last one counted, hands the lines read to the sinks and waits for
+	 *       them.
+	 * Para: errorAddress, updated with the device-reported address of the
+	 *           error that stopped polling, if any. May be NULL.
+	 * Retr: LJME_NOERROR, or the error that stopped polling early.
+	**/
+	int Stop(int * errorAddress = NULL);
+
+	/**
+	 * Desc: Returns false if polling has stopped because of an error.
+	**/
+	bool Running() const { return !failed.load(); }
+
+	void GetStats(LuaDebugStats * stats);
+
+private:
+	void Poll();
+	void Deliver();
+	int ReadOnce(int * numBytesWaiting, int * errorAddress);
+	void Split(const char * bytes, int numBytes);
+	void Queue(const char * line, int length);
+	double NextIntervalMS(int numBytesWaiting, double sincePollMS);
+
+	int handle;
+	double minIntervalMS;
+	double maxIntervalMS;
+	double targetFill;
+	int bufferSize;
+	int queueBytes;
+	std::vector<LuaDebugSink *> sinks;
+
+	// Poll thread only
+	FramePlan plan;
+	std::string bytes;
+	std::string partial;
+	int pending;
+	int longestLine;
+	double bytesPerMS;
+	double lastIntervalMS;
+
+	std::unique_ptr<LuaLineQueue> queue;
+	std::thread poller;
+	std::thread deliverer;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping;
+	std::atomic<bool> failed;
+	std::atomic<bool> delivering;
+	int stopError;
+	int stopErrorAddress;
+	LuaDebugStats stats;
+	Clock::time_point start;
+};
+
+
+// Source
+
+inline LuaLineQueue::LuaLineQueue(int capacityBytes) :
+	ring(capacityBytes),
+	head(0),
+	tail(0)
+{
+}
+
+inline void LuaLineQueue::CopyIn(size_t position, const char * bytes, size_t length)
+{
+	size_t at = position % ring.size();
+	size_t first = ring.size() - at < length ? ring.size() - at : length;
+	memcpy(&ring[at], bytes, first);
+	memcpy(&ring[0], bytes + first, length - first);
+}
+
+inline void LuaLineQueue::CopyOut(size_t position, char * bytes, size_t length) const
+{
+	size_t at = position % ring.size();
+	size_t first = ring.size() - at < length ? ring.size() - at : length;
+	memcpy(bytes, &ring[at], first);
+	memcpy(bytes + first, &ring[0], length - first);
+}
+
+inline bool LuaLineQueue::Push(const char * line, int length)
+{
+	unsigned char prefix[2] = {(unsigned char)(length >> 8), (unsigned char)(length & 0xFF)};
+	size_t position = head.load(std::memory_order_relaxed);
+
+	if (length < 0 || length > MAX_LINE_LENGTH ||
+		position + 2 + length - tail.load(std::memory_order_acquire) > ring.size())
+	{
+		return false;
+	}
+
+	CopyIn(position, (const char *)prefix, 2);
+	CopyIn(position + 2, line, length);
+	head.store(position + 2 + length, std::memory_order_release);
+	return true;
+}
+
+inline bool LuaLineQueue::Pop(std::string & line)
+{
+	unsigned char prefix[2];
+	size_t position = tail.load(std::memory_order_relaxed);
+
+	if (position == head.load(std::memory_order_acquire)) {
+		return false;
+	}
+
+	CopyOut(position, (char *)prefix, 2);
+	line.resize(prefix[0] << 8 | prefix[1]);
+	if (!line.empty()) {
+		CopyOut(position + 2, &line[0], line.size());
+	}
+	tail.store(position + 2 + line.size(), std::memory_order_release);
+	return true;
+}
+
+inline void LuaConsoleSink::Write(const char * line, int length)
+{
+	printf("%s%.*s\n", prefix.c_str(), length, line);
+}
+
+inline int LuaFileSink::Open(const char * path)
+{
+	Close();
+	file = fopen(path, "a");
+	return file ? LJME_NOERROR : LJME_INVALID_PARAMETER;
+}
+
+inline void LuaFileSink::Close()
+{
+	if (file) {
+		fclose(file);
+		file = NULL;
+	}
+}
+
+inline void LuaFileSink::Write(const char * line, int length)
+{
+	if (file) {
+		fwrite(line, 1, length, file);
+		fputc('\n', file);
+	}
+}
+
+inline void LuaFileSink::Flush()
+{
+	if (file) {
+		fflush(file);
+	}
+}
+
+inline LuaDebugStreamer::LuaDebugStreamer() :
+	handle(0),
+	minIntervalMS(2),
+	maxIntervalMS(1000),
+	targetFill(0.5),
+	bufferSize(LUA_DEBUG_DEFAULT_BUFFER_SIZE),
+	queueBytes(1 << 16),
+	pending(0),
+	longestLine(1),
+	bytesPerMS(0),
+	lastIntervalMS(0),
+	stopping(false),
+	failed(false),
+	delivering(false),
+	stopError(LJME_NOERROR),
+	stopErrorAddress(INITIAL_ERR_ADDRESS)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+inline LuaDebugStreamer::~LuaDebugStreamer()
+{
+	Stop();
+}
+
+inline void LuaDebugStreamer::SetPollIntervalMS(double minMS, double maxMS)
+{
+	minIntervalMS = minMS;
+	maxIntervalMS = maxMS < minMS ? minMS : maxMS;
+}
+
+inline int LuaDebugStreamer::Start(int newHandle)
+{
+	int deviceType, connectionType, serialNumber, ipAddress, port, maxBytesPerMB;
+	int err = LJM_GetHandleInfo(newHandle, &deviceType, &connectionType,
+		&serialNumber, &ipAddress, &port, &maxBytesPerMB);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+
+	Stop();
+
+	handle = newHandle;
+	plan.SetMaxBytesPerMB(maxBytesPerMB);
+	bytes.reserve(bufferSize);
+	partial.clear();
+	pending = 0;
+	longestLine = 1;
+	bytesPerMS = 0;
+	lastIntervalMS = minIntervalMS;
+
+	queue.reset(new LuaLineQueue(queueBytes));
+
+	memset(&stats, 0, sizeof(stats));
+	stats.pollIntervalMS = minIntervalMS;
+	stopping = false;
+	failed = false;
+	delivering = true;
+	stopError = LJME_NOERROR;
+	stopErrorAddress = INITIAL_ERR_ADDRESS;
+	start = Clock::now();
+
+	deliverer = std::thread(&LuaDebugStreamer::Deliver, this);
+	poller = std::thread(&LuaDebugStreamer::Poll, this);
+	return LJME_NOERROR;
+}
+
+inline int LuaDebugStreamer::Stop(int * errorAddress)
+{
+	if (poller.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		poller.join();
+
+		if (!partial.empty()) {
+			Queue(partial.data(), (int)partial.size());
+			partial.clear();
+		}
+
+		delivering = false;
+		deliverer.join();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.elapsedMS = std::chrono::duration<double, std::milli>(
+			Clock::now() - start).count();
+	}
+
+	if (errorAddress) {
+		*errorAddress = stopErrorAddress;
+	}
+	return stopError;
+}
+
+inline void LuaDebugStreamer::GetStats(LuaDebugStats * result)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	*result = stats;
+	if (poller.joinable()) {
+		result->elapsedMS = std::chrono::duration<double, std::milli>(
+			Clock::now() - start).count();
+	}
+	result->bytesPerSecond = result->elapsedMS > 0 ?
+		result->bytesRead * 1000.0 / result->elapsedMS : 0;
+}
+
+inline int LuaDebugStreamer::ReadOnce(int * numBytesWaiting, int * errorAddress)
+{
+	int dataOffset = 0;
+	int countOffset;
+
+	// Reads are of whole registers: the device takes two bytes from its
+	// buffer for each, and LJM_UpdateValues would only consume an odd count
+	// and misread the frames after it. An odd count is padded, so a script's
+	// last line goes out even if it prints nothing more. The device pads
+	// with 0 if the byte isn't there yet; Lua output has no NULs, so a
+	// nonzero pad byte arrived since the count and is kept
+	int numBytes = pending + pending % 2;
+
+	plan.Clear();
+	if (numBytes > 0) {
+		dataOffset = plan.AddBufferRead(LUA_DEBUG_DATA_ADDRESS, LJM_BYTE, numBytes);
+	}
+	countOffset = plan.AddRead(LUA_DEBUG_NUM_BYTES_ADDRESS, LJM_UINT32);
+
+	int err = plan.Execute(handle, errorAddress);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+
+	bytes.resize(numBytes);
+	for (int i = 0; i < numBytes; i++) {
+		bytes[i] = (char)plan.Values()[dataOffset + i];
+	}
+	if (numBytes > pending && bytes[pending] == '\0') {
+		bytes.resize(pending);
+	}
+	*numBytesWaiting = (int)plan.Values()[countOffset];
+	return LJME_NOERROR;
+}
+
+inline void LuaDebugStreamer::Split(const char * data, int numBytes)
+{
+	int lineStart = 0;
+	for (int i = 0; i < numBytes; i++) {
+		if (data[i] != '\n') {
+			continue;
+		}
+		int end = i;
+		if (end > lineStart && data[end - 1] == '\r') {
+			--end;
+		}
+		if (partial.empty()) {
+			Queue(data + lineStart, end - lineStart);
+		}
+		else {
+			partial.append(data + lineStart, end - lineStart);
+			Queue(partial.data(), (int)partial.size());
+			partial.clear();
+		}
+		lineStart = i + 1;
+	}
+	partial.append(data + lineStart, numBytes - lineStart);
+
+	// A line that outgrows the queue's limit goes out in pieces
+	while ((int)partial.size() >= LuaLineQueue::MAX_LINE_LENGTH) {
+		Queue(partial.data(), LuaLineQueue::MAX_LINE_LENGTH);
+		partial.erase(0, LuaLineQueue::MAX_LINE_LENGTH);
+	}
+}
+
+inline void LuaDebugStreamer::Queue(const char * line, int length)
+{
+	if (length + 1 > longestLine) {
+		longestLine = length + 1;
+	}
+	bool queued = queue->Push(line, length);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (queued) {
+		++stats.lines;
+	}
+	else {
+		++stats.droppedLines;
+		stats.droppedBytes += length + 1;
+	}
+}
+
+inline double LuaDebugStreamer::NextIntervalMS(int numBytesWaiting, double sincePollMS)
+{
+	// Output that arrived since the last poll, as a rate, weighted by the
+	// time the poll covered: a poll shorter than the time between prints
+	// often finds nothing. A full buffer only shows the rate is at least
+	// that, so the estimate is doubled until the buffer no longer fills
+	if (sincePollMS > 0) {
+		double rate = numBytesWaiting / sincePollMS;
+		double weight = std::min(1.0, sincePollMS / LUA_DEBUG_RATE_WINDOW_MS);
+		bytesPerMS += (rate - bytesPerMS) * weight;
+		if (numBytesWaiting + longestLine > bufferSize) {
+			bytesPerMS = 2 * std::max(bytesPerMS, rate);
+		}
+	}
+
+	// The bytes still waiting are read next poll, so they count against the
+	// room the new output has before the buffer fills
+	double room = targetFill * bufferSize - numBytesWaiting;
+	double intervalMS = maxIntervalMS;
+	if (room <= 0) {
+		intervalMS = minIntervalMS;
+	}
+	else if (bytesPerMS > 0) {
+		intervalMS = room / bytesPerMS;
+	}
+
+	// Lengthen the interval gradually, so output that starts while the
+	// script was quiet is seen before it fills the buffer
+	if (intervalMS > 2 * lastIntervalMS) {
+		intervalMS = 2 * lastIntervalMS;
+	}
+	if (intervalMS < minIntervalMS) {
+		intervalMS = minIntervalMS;
+	}
+	if (intervalMS > maxIntervalMS) {
+		intervalMS = maxIntervalMS;
+	}
+	lastIntervalMS = intervalMS;
+	return intervalMS;
+}
+
+inline void LuaDebugStreamer::Poll()
+{
+	int numBytesWaiting;
+	int errorAddress = INITIAL_ERR_ADDRESS;
+	Clock::time_point lastPoll = Clock::now();
+	bool finalPoll = false;
+
+	while (true) {
+		Clock::time_point pollTime = Clock::now();
+		long long packetsBefore = plan.RoundTrips();
+
+		int err = ReadOnce(&numBytesWaiting, &errorAddress);
+		if (err != LJME_NOERROR) {
+			std::lock_guard<std::mutex> lock(mutex);
+			stopError = err;
+			stopErrorAddress = errorAddress;
+			failed = true;
+			return;
+		}
+
+		Split(bytes.data(), (int)bytes.size());
+
+		// What the buffer held when the poll started
+		int bufferBytes = (int)bytes.size() + numBytesWaiting;
+		if (bufferBytes > bufferSize) {
+			bufferSize = bufferBytes;
+		}
+		double intervalMS = NextIntervalMS(numBytesWaiting,
+			std::chrono::duration<double, std::milli>(pollTime - lastPoll).count());
+		lastPoll = pollTime;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			++stats.polls;
+			stats.packets += plan.RoundTrips() - packetsBefore;
+			stats.bytesRead += (long long)bytes.size();
+			if (bufferBytes + longestLine > bufferSize) {
+				++stats.fullPolls;
+			}
+			if (bufferBytes > stats.maxBufferBytes) {
+				stats.maxBufferBytes = bufferBytes;
+			}
+			stats.pollIntervalMS = intervalMS;
+
+			pending = numBytesWaiting;
+			if (finalPoll) {
+				return;
+			}
+
+			// Once stopping, poll once more for the bytes this poll counted
+			finalPoll = wake.wait_until(lock, pollTime + std::chrono::microseconds(
+				(long long)(intervalMS * 1000)), [this] { return stopping; });
+		}
+	}
+}
+
+inline void LuaDebugStreamer::Deliver()
+{
+	std::string line;
+	bool unflushed = false;
+
+	while (true) {
+		// Read the flag before draining, so lines queued before Stop cleared
+		// it are all delivered
+		bool more = delivering.load();
+		while (queue->Pop(line)) {
+			for (size_t i = 0; i < sinks.size(); i++) {
+				sinks[i]->Write(line.data(), (int)line.size());
+			}
+			unflushed = true;
+		}
+		if (unflushed) {
+			for (size_t i = 0; i < sinks.size(); i++) {
+				sinks[i]->Flush();
+			}
+			unflushed = false;
+		}
+		if (!more) {
+			return;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+#endif // #ifndef LJM_LUA_DEBUG_STREAM
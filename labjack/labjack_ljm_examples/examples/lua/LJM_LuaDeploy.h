@@ -0,0 +1,501 @@
+/**
+ * Name: LJM_LuaDeploy.h
+ * Desc: Deploys a Lua script to a T7 faster than utilities/lua_script_basic.c
+ *       does: the source is minified, a hash of it is kept on the device so
+ *       an unchanged script that is already running isn't uploaded again,
+ *       LUA_RUN is polled until the old script has unloaded instead of
+ *       sleeping 600 ms, and the source goes out in as many
+ *       MaxBytesPerMB-sized Feedback packets as it needs instead of one
+ *       LJM_eWriteNameByteArray call, which fails for large scripts. Over TCP
+ *       the packets are pipelined on a second connection. C++11 only.
+**/
+
+#ifndef LJM_LUA_DEPLOY
+#define LJM_LUA_DEPLOY
+
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LabJackM.h"
+
+#include "../LJM_Utilities.h"
+#include "../LJM_FramePlan.h"
+
+#ifndef _WIN32
+	#include "../modbus/LJM_ModbusPipeline.h"
+#endif
+
+enum {
+	LUA_RUN_ADDRESS = 6000,
+	LUA_SOURCE_SIZE_ADDRESS = 6012,
+	LUA_SOURCE_WRITE_ADDRESS = 6014,
+	LUA_DEBUG_ENABLE_ADDRESS = 6020,
+	LUA_DEBUG_ENABLE_DEFAULT_ADDRESS = 6120
+};
+
+// USER_RAM39_U32, the last of the UINT32 USER_RAM registers
+enum { LUA_DEFAULT_HASH_ADDRESS = 46178 };
+
+/**
+ * Desc: Removes comments, indentation, blank lines and the spaces between
+ *       tokens that don't need them. Strings and long strings are copied
+ *       unchanged. One line break is kept wherever the source had any
+ *       between two tokens, so statements that end at a line break, such as
+ *       one followed by a line starting with "(", stay separate.
+ * Retr: LJME_NOERROR, or LJME_INVALID_PARAMETER if a string or long comment
+ *       isn't terminated. minified is then incomplete.
+**/
+int MinifyLuaSource(const std::string & source, std::string & minified);
+
+/**
+ * Desc: Returns the 32-bit FNV-1a hash of source, never 0, so a cleared
+ *       USER_RAM register never matches.
+**/
+unsigned int LuaSourceHash(const std::string & source);
+
+/**
+ * Desc: What a LuaDeployer::Deploy did. sourceBytes is the size before
+ *       minifying and uploadBytes the size sent, including the terminating
+ *       0. skipped means the device was already running the same script.
+ *       numStopPolls counts the LUA_RUN reads while the old script unloaded.
+ *       pipelined means the upload went through a ModbusPipeline.
+ *       roundTrips counts Feedback packets, not counting stop polls.
+**/
+struct LuaDeployReport
+{
+	bool skipped;
+	bool pipelined;
+	int sourceBytes;
+	int uploadBytes;
+	unsigned int hash;
+	int numStopPolls;
+	int numPackets;
+	long long roundTrips;
+	double checkMS;
+	double stopMS;
+	double uploadMS;
+	double totalMS;
+};
+
+/**
+ * Name: LuaDeployer
+ * Desc: Deploy reads LUA_RUN and the hash register in one packet. If the
+ *       script isn't already running, it stops the old script, then sends
+ *       LUA_SOURCE_SIZE and the source. Finally it enables debug output,
+ *       stores the hash and starts the script in one more packet. The hash
+ *       is stored only after the whole source was written. If the script
+ *       fails to compile, LUA_RUN reads 0, so the next Deploy uploads it
+ *       again.
+**/
+class LuaDeployer
+{
+public:
+	LuaDeployer();
+
+	/**
+	 * Desc: Whether to minify the source before uploading. Default true.
+	**/
+	void SetMinify(bool newMinify) { minify = newMinify; }
+
+	/**
+	 * Desc: Uploads even if the device reports the same hash. Default false.
+	**/
+	void SetForce(bool newForce) { force = newForce; }
+
+	/**
+	 * Desc: The UINT32 register that holds the hash of the running script.
+	 *       Default LUA_DEFAULT_HASH_ADDRESS; pick another if the script uses
+	 *       USER_RAM39_U32.
+	**/
+	void SetHashAddress(int address) { hashAddress = address; }
+
+	/**
+	 * Desc: How long the old script may take to unload. Default 2000 ms.
+	**/
+	void SetStopTimeoutMS(unsigned int timeoutMS) { stopTimeoutMS = timeoutMS; }
+
+	/**
+	 * Desc: The number of source packets in flight over TCP. 1 sends them
+	 *       through LJM one at a time. Default 4. Ignored on Windows and
+	 *       for USB.
+	**/
+	void SetPipelineWindow(int window) { pipelineWindow = window; }
+
+	/**
+	 * Desc: Deploys source to handle and starts it.
+	 * Para: report, filled in. May be NULL.
+	 *       errorAddress, updated with the device-reported address of an error
+	 *           if one occurs. May be NULL.
+	 * Retr: LJME_NOERROR, LJME_INVALID_PARAMETER if source can't be minified,
+	 *       LJME_SYNCHRONIZATION_TIMEOUT if the old script didn't unload in
+	 *       time, or the error of the failed packet.
+	**/
+	int Deploy(int handle, const std::string & source, LuaDeployReport * report,
+		int * errorAddress);
+
+	/**
+	 * Desc: Stops the running script, if any, and waits until it unloads.
+	 * Para: numPolls, the number of LUA_RUN reads. May be NULL.
+	**/
+	int Stop(int handle, int * numPolls);
+
+private:
+#ifndef _WIN32
+	int Upload(int handle, FramePlan & plan, LuaDeployReport & report,
+		int * errorAddress);
+#endif
+
+	bool minify;
+	bool force;
+	int hashAddress;
+	unsigned int stopTimeoutMS;
+	int pipelineWindow;
+};
+
+
+// Source
+
+static inline bool LuaIsWordChar(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+		c == '_';
+}
+
+static inline bool LuaIsSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+}
+
+// Returns the level of the long bracket opening at source[i] ("[[" is 0,
+// "[==[" is 2), or -1 if there isn't one
+static inline int LuaLongBracketLevel(const std::string & source, size_t i)
+{
+	size_t j = i + 1;
+	if (i >= source.size() || source[i] != '[') {
+		return -1;
+	}
+	while (j < source.size() && source[j] == '=') {
+		++j;
+	}
+	return j < source.size() && source[j] == '[' ? (int)(j - i - 1) : -1;
+}
+
+// Returns the index just past the long bracket of level closing at or after
+// start, or std::string::npos
+static inline size_t LuaLongBracketEnd(const std::string & source, size_t start, int level)
+{
+	std::string close = "]" + std::string(level, '=') + "]";
+	size_t found = source.find(close, start);
+	return found == std::string::npos ? found : found + close.size();
+}
+
+// Whether dropping the space between a and b would change the tokens
+static inline bool LuaNeedsSpace(char a, char b)
+{
+	return (LuaIsWordChar(a) && LuaIsWordChar(b)) ||
+		(a == '-' && b == '-') || (a == '[' && (b == '[' || b == '=')) ||
+		(a == '.' && (b == '.' || (b >= '0' && b <= '9'))) ||
+		(LuaIsWordChar(a) && b == '.');
+}
+
+inline int MinifyLuaSource(const std::string & source, std::string & minified)
+{
+	size_t i = 0, end;
+	int level;
+	bool pendingSpace = false, pendingNewline = false;
+	char quote;
+
+	minified.clear();
+	minified.reserve(source.size());
+
+	while (i < source.size()) {
+		char c = source[i];
+
+		if (LuaIsSpace(c)) {
+			if (c == '\n') {
+				pendingNewline = true;
+			}
+			pendingSpace = true;
+			++i;
+			continue;
+		}
+
+		if (c == '-' && i + 1 < source.size() && source[i + 1] == '-') {
+			level = LuaLongBracketLevel(source, i + 2);
+			if (level >= 0) {
+				end = LuaLongBracketEnd(source, i + 2, level);
+				if (end == std::string::npos) {
+					return LJME_INVALID_PARAMETER;
+				}
+				if (source.find('\n', i) < end) {
+					pendingNewline = true;
+				}
+				i = end;
+			}
+			else {
+				end = source.find('\n', i);
+				i = end == std::string::npos ? source.size() : end;
+			}
+			pendingSpace = true;
+			continue;
+		}
+
+		if (!minified.empty()) {
+			if (pendingNewline) {
+				minified += '\n';
+			}
+			else if (pendingSpace && LuaNeedsSpace(minified[minified.size() - 1], c)) {
+				minified += ' ';
+			}
+		}
+		pendingSpace = pendingNewline = false;
+
+		level = LuaLongBracketLevel(source, i);
+		if (level >= 0) {
+			end = LuaLongBracketEnd(source, i, level);
+			if (end == std::string::npos) {
+				return LJME_INVALID_PARAMETER;
+			}
+			minified.append(source, i, end - i);
+			i = end;
+		}
+		else if (c == '"' || c == '\'') {
+			quote = c;
+			end = i + 1;
+			while (end < source.size() && source[end] != quote) {
+				if (source[end] == '\n') {
+					return LJME_INVALID_PARAMETER;
+				}
+				end += source[end] == '\\' ? 2 : 1;
+			}
+			if (end >= source.size()) {
+				return LJME_INVALID_PARAMETER;
+			}
+			minified.append(source, i, end + 1 - i);
+			i = end + 1;
+		}
+		else {
+			minified += c;
+			++i;
+		}
+	}
+
+	return LJME_NOERROR;
+}
+
+inline unsigned int LuaSourceHash(const std::string & source)
+{
+	unsigned int hash = 2166136261u;
+	size_t i;
+	for (i = 0; i < source.size(); i++) {
+		hash ^= (unsigned char)source[i];
+		hash *= 16777619u;
+	}
+	return hash == 0 ? 1 : hash;
+}
+
+static inline double LuaMSSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+inline LuaDeployer::LuaDeployer() :
+	minify(true),
+	force(false),
+	hashAddress(LUA_DEFAULT_HASH_ADDRESS),
+	stopTimeoutMS(2000),
+	pipelineWindow(4)
+{
+}
+
+inline int LuaDeployer::Stop(int handle, int * numPolls)
+{
+	double running = 1;
+	int err, polls = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// LUA_RUN reads 1 until the VM has unloaded and garbage collection is done
+	err = LJM_eWriteAddress(handle, LUA_RUN_ADDRESS, LJM_UINT32, 0);
+	while (err == LJME_NOERROR) {
+		err = LJM_eReadAddress(handle, LUA_RUN_ADDRESS, LJM_UINT32, &running);
+		++polls;
+		if (err != LJME_NOERROR || running == 0) {
+			break;
+		}
+		if (LuaMSSince(start) >= stopTimeoutMS) {
+			err = LJME_SYNCHRONIZATION_TIMEOUT;
+			break;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+
+	if (numPolls != NULL) {
+		*numPolls = polls;
+	}
+	return err;
+}
+
+inline int LuaDeployer::Deploy(int handle, const std::string & source,
+	LuaDeployReport * report, int * errorAddress)
+{
+	int err, deviceType, connectionType, serialNumber, ipAddress, port, maxBytesPerMB;
+	int localErrorAddress = INITIAL_ERR_ADDRESS;
+	std::string script;
+	LuaDeployReport localReport;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point stepStart;
+
+	if (report == NULL) {
+		report = &localReport;
+	}
+	if (errorAddress == NULL) {
+		errorAddress = &localErrorAddress;
+	}
+	memset(report, 0, sizeof(*report));
+
+	if (minify) {
+		err = MinifyLuaSource(source, script);
+		if (err != LJME_NOERROR) {
+			return err;
+		}
+	}
+	else {
+		script = source;
+	}
+	report->sourceBytes = (int)source.size();
+	report->uploadBytes = (int)script.size() + 1;
+	report->hash = LuaSourceHash(script);
+
+	err = LJM_GetHandleInfo(handle, &deviceType, &connectionType, &serialNumber,
+		&ipAddress, &port, &maxBytesPerMB);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+
+	// Is the same script already running?
+	stepStart = std::chrono::steady_clock::now();
+	FramePlan check(maxBytesPerMB);
+	int runOffset = check.AddRead(LUA_RUN_ADDRESS, LJM_UINT32);
+	int hashOffset = check.AddRead(hashAddress, LJM_UINT32);
+	err = check.Execute(handle, errorAddress);
+	report->roundTrips += check.RoundTrips();
+	report->checkMS = LuaMSSince(stepStart);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+	bool running = check.Values()[runOffset] != 0;
+	if (running && !force && (unsigned int)check.Values()[hashOffset] == report->hash) {
+		report->skipped = true;
+		report->totalMS = LuaMSSince(start);
+		return LJME_NOERROR;
+	}
+
+	if (running) {
+		stepStart = std::chrono::steady_clock::now();
+		err = Stop(handle, &report->numStopPolls);
+		report->stopMS = LuaMSSince(stepStart);
+		if (err != LJME_NOERROR) {
+			return err;
+		}
+	}
+
+	stepStart = std::chrono::steady_clock::now();
+	std::vector<double> bytes(script.size() + 1, 0.0);
+	for (size_t i = 0; i < script.size(); i++) {
+		bytes[i] = (unsigned char)script[i];
+	}
+
+	// The second write of 0 lua_script_basic.c makes after its sleep
+	FramePlan upload(maxBytesPerMB);
+	upload.AddWrite(LUA_RUN_ADDRESS, LJM_UINT32, 0.0);
+	upload.AddWrite(LUA_SOURCE_SIZE_ADDRESS, LJM_UINT32, (double)bytes.size());
+	upload.AddBufferWrite(LUA_SOURCE_WRITE_ADDRESS, LJM_BYTE, &bytes[0], (int)bytes.size());
+
+#ifndef _WIN32
+	if (pipelineWindow > 1 && (connectionType == LJM_ctTCP ||
+		connectionType == LJM_ctETHERNET || connectionType == LJM_ctWIFI))
+	{
+		err = Upload(handle, upload, *report, errorAddress);
+	}
+	else
+#endif
+	{
+		err = upload.Execute(handle, errorAddress);
+		report->numPackets = upload.NumPackets();
+		report->roundTrips += upload.RoundTrips();
+	}
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+
+	FramePlan run(maxBytesPerMB);
+	run.AddWrite(LUA_DEBUG_ENABLE_ADDRESS, LJM_UINT32, 1.0);
+	run.AddWrite(LUA_DEBUG_ENABLE_DEFAULT_ADDRESS, LJM_UINT32, 1.0);
+	run.AddWrite(hashAddress, LJM_UINT32, (double)report->hash);
+	run.AddWrite(LUA_RUN_ADDRESS, LJM_UINT32, 1.0);
+	err = run.Execute(handle, errorAddress);
+	report->numPackets += run.NumPackets();
+	report->roundTrips += run.RoundTrips();
+	report->uploadMS = LuaMSSince(stepStart);
+	report->totalMS = LuaMSSince(start);
+	return err;
+}
+
+#ifndef _WIN32
+inline int LuaDeployer::Upload(int handle, FramePlan & plan, LuaDeployReport & report,
+	int * errorAddress)
+{
+	int deviceType, connectionType, serialNumber, ipAddress, port, maxBytesPerMB;
+	size_t packetI;
+	int firstErr = LJME_NOERROR;
+	// A resent packet would append its bytes to the source twice
+	ModbusPipeline pipeline(pipelineWindow, LJM_DEFAULT_ETHERNET_SEND_RECEIVE_TIMEOUT_MS, 0);
+	std::vector<unsigned char> command;
+
+	int err = LJM_GetHandleInfo(handle, &deviceType, &connectionType, &serialNumber,
+		&ipAddress, &port, &maxBytesPerMB);
+	if (err == LJME_NOERROR) {
+		err = pipeline.Connect((unsigned int)ipAddress, port, MODBUS_TRANSPORT_TCP);
+	}
+	if (err != LJME_NOERROR) {
+		// The device may only accept one connection; send through LJM instead
+		err = plan.Execute(handle, errorAddress);
+		report.numPackets = plan.NumPackets();
+		report.roundTrips += plan.RoundTrips();
+		return err;
+	}
+
+	const std::vector<PlanPacket> & packets = plan.Packets();
+	for (packetI = 0; packetI < packets.size(); packetI++) {
+		const PlanPacket & packet = packets[packetI];
+		err = EncodeFeedbackCommand(packet, plan.Values(), LJM_DEFAULT_UNIT_ID, 0, command);
+		if (err != LJME_NOERROR) {
+			return err;
+		}
+		pipeline.Submit(command, [&, packetI](int packetErr, const unsigned char * response,
+			int numBytes)
+		{
+			if (packetErr == LJME_NOERROR) {
+				packetErr = DecodeFeedbackResponse(response, numBytes, packets[packetI],
+					plan.Values(), errorAddress);
+			}
+			if (packetErr != LJME_NOERROR && firstErr == LJME_NOERROR) {
+				firstErr = packetErr;
+			}
+		});
+	}
+
+	err = pipeline.Drain();
+	report.pipelined = true;
+	report.numPackets = (int)packets.size();
+	report.roundTrips += (long long)packets.size();
+	return firstErr != LJME_NOERROR ? firstErr : err;
+}
+#endif
+
+#endif // #define LJM_LUA_DEPLOY
@@ -0,0 +1,446 @@
+/**
+ * Name: LJM_LuaPreprocess.h
+ * Desc: Moves sensor averaging onto a T7. trade_fair.py reads five AIN
+ *       channels 20 times, 0.5 s apart, converts each reading and averages
+ *       them on the host, so every window costs 20 round trips for five
+ *       numbers. GenerateLuaPreprocessScript writes a Lua script that does
+ *       the sampling, conversion, averaging, minimum and maximum on the
+ *       device and publishes each window as one block of USER_RAM
+ *       registers, which a LuaWindowReader fetches in a single read.
+ *       C++11 only.
+**/
+
+#ifndef LJM_LUA_PREPROCESS
+#define LJM_LUA_PREPROCESS
+
+#include <math.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "LabJackM.h"
+
+#include "../LJM_Utilities.h"
+#include "../LJM_FramePlan.h"
+
+// USER_RAM0_F32, the start of the block a generated script publishes
+enum { LUA_PREPROCESS_BLOCK_ADDRESS = 46000 };
+
+// USER_RAM#(0:39)_F32 holds the block: two sequence numbers, the sample
+// count and three values per channel
+enum { LUA_PREPROCESS_MAX_CHANNELS = 12 };
+
+// The T7's Lua numbers are single precision, so the sequence wraps here
+enum { LUA_PREPROCESS_SEQUENCE_LIMIT = 1 << 24 };
+
+/**
+ * Desc: How a channel's volts become a reading.
+ *       LUA_CONVERSION_LINEAR: volts * scale + offset, as humidity.py and
+ *           anemometer.py do.
+ *       LUA_CONVERSION_RTD: an RTD in a divider under a series resistor,
+ *           R = seriesOhms * v / (supplyVolts - v) and
+ *           T = (R - r0Ohms) / (r0Ohms * alpha), as radiant_temperature.py
+ *           does.
+ *       LUA_CONVERSION_THERMISTOR: a thermistor in the same divider,
+ *           R = seriesOhms * v / (supplyVolts - v) and
+ *           T = referenceC * seriesOhms / R, as ambient_temperature.py does.
+**/
+enum LuaConversionType {
+	LUA_CONVERSION_LINEAR,
+	LUA_CONVERSION_RTD,
+	LUA_CONVERSION_THERMISTOR
+};
+
+/**
+ * Desc: One channel to sample. Use LinearChannel, RtdChannel or
+ *       ThermistorChannel to fill it in.
+**/
+struct LuaChannel
+{
+	std::string name;
+	int ain;
+	LuaConversionType conversion;
+
+	// LUA_CONVERSION_LINEAR
+	double scale;
+	double offset;
+
+	// LUA_CONVERSION_RTD and LUA_CONVERSION_THERMISTOR
+	double seriesOhms;
+	double supplyVolts;
+	double r0Ohms;
+	double alpha;
+	double referenceC;
+};
+
+LuaChannel LinearChannel(const std::string & name, int ain, double scale,
+	double offset = 0);
+LuaChannel RtdChannel(const std::string & name, int ain, double seriesOhms,
+	double supplyVolts, double r0Ohms, double alpha);
+LuaChannel ThermistorChannel(const std::string & name, int ain, double seriesOhms,
+	double supplyVolts, double referenceC);
+
+/**
+ * Desc: Returns the five channels of trade_fair.py with its constants:
+ *       radiant temperature on AIN12, humidity on AIN1, ambient temperature
+ *       on AIN13, and the two anemometers on AIN2 and AIN3.
+**/
+std::vector<LuaChannel> TradeFairChannels();
+
+/**
+ * Desc: Converts volts the way channel says. The generated script computes
+ *       the same formula in single precision.
+**/
+double ConvertChannelVolts(const LuaChannel & channel, double volts);
+
+/**
+ * Desc: The number of FLOAT32 values in the block for numChannels channels:
+ *       sequence, sample count, then average, minimum and maximum of each
+ *       channel, then the sequence again.
+**/
+int LuaPreprocessBlockSize(int numChannels);
+
+/**
+ * Desc: Writes a Lua script that reads channels every sampleMS, converts the
+ *       readings and publishes a block at LUA_PREPROCESS_BLOCK_ADDRESS after
+ *       every samplesPerWindow samples.
+ *
+ *       The script writes the block's last sequence number first, then the
+ *       values, then its first sequence number. A reader that reads the
+ *       block in address order and gets equal sequence numbers therefore
+ *       read one window's values, even if the read spans several packets.
+ * Retr: LJME_NOERROR, or LJME_INVALID_PARAMETER if there are no channels,
+ *       more than LUA_PREPROCESS_MAX_CHANNELS, or sampleMS or
+ *       samplesPerWindow isn't positive.
+**/
+int GenerateLuaPreprocessScript(const std::vector<LuaChannel> & channels,
+	int sampleMS, int samplesPerWindow, std::string & script);
+
+/**
+ * Desc: One window's results. average, minimum and maximum have a value per
+ *       channel.
+**/
+struct LuaWindow
+{
+	unsigned int sequence;
+	int numSamples;
+	std::vector<double> average;
+	std::vector<double> minimum;
+	std::vector<double> maximum;
+};
+
+/**
+ * Name: LuaWindowReader
+ * Desc: Reads the block of a generated script with one FramePlan, in as few
+ *       packets as MaxBytesPerMB allows: one over Ethernet or WiFi for up
+ *       to 12 channels, two over USB for five. A read that caught the
+ *       script between writes is read again.
+**/
+class LuaWindowReader
+{
+public:
+	LuaWindowReader(int numChannels);
+
+	/**
+	 * Desc: Sets the packet size limit, usually from LJM_GetHandleInfo.
+	**/
+	void SetMaxBytesPerMB(int maxBytesPerMB) { plan.SetMaxBytesPerMB(maxBytesPerMB); }
+
+	/**
+	 * Desc: Reads the latest window.
+	 * Para: isNew, set to true if its sequence differs from the last Read's.
+	 *           May be NULL.
+	 *       errorAddress, updated with the device-reported address of an error
+	 *           if one occurs. May be NULL.
+	 * Retr: LJME_NOERROR, the error of the read, or
+	 *       LJME_SYNCHRONIZATION_TIMEOUT if every read caught the script
+	 *       writing, or no window was published yet.
+	**/
+	int Read(int handle, LuaWindow * window, bool * isNew, int * errorAddress);
+
+	int NumPackets() { return plan.NumPackets(); }
+	const std::vector<PlanPacket> & Packets() { return plan.Packets(); }
+
+	/**
+	 * Desc: Totals since construction. Retries are reads repeated because
+	 *       the script was writing.
+	**/
+	long long RoundTrips() const { return plan.RoundTrips(); }
+	long long Retries() const { return retries; }
+
+private:
+	int numChannels;
+	FramePlan plan;
+	bool haveSequence;
+	unsigned int lastSequence;
+	long long retries;
+};
+
+
+// Source
+
+// Reads of a block that keep catching the script writing before Read gives up
+static const int LUA_PREPROCESS_READ_ATTEMPTS = 3;
+
+static inline LuaChannel LuaBlankChannel(const std::string & name, int ain,
+	LuaConversionType conversion)
+{
+	LuaChannel channel;
+	channel.name = name;
+	channel.ain = ain;
+	channel.conversion = conversion;
+	channel.scale = 1;
+	channel.offset = 0;
+	channel.seriesOhms = 0;
+	channel.supplyVolts = 0;
+	channel.r0Ohms = 0;
+	channel.alpha = 0;
+	channel.referenceC = 0;
+	return channel;
+}
+
+inline LuaChannel LinearChannel(const std::string & name, int ain, double scale,
+	double offset)
+{
+	LuaChannel channel = LuaBlankChannel(name, ain, LUA_CONVERSION_LINEAR);
+	channel.scale = scale;
+	channel.offset = offset;
+	return channel;
+}
+
+inline LuaChannel RtdChannel(const std::string & name, int ain, double seriesOhms,
+	double supplyVolts, double r0Ohms, double alpha)
+{
+	LuaChannel channel = LuaBlankChannel(name, ain, LUA_CONVERSION_RTD);
+	channel.seriesOhms = seriesOhms;
+	channel.supplyVolts = supplyVolts;
+	channel.r0Ohms = r0Ohms;
+	channel.alpha = alpha;
+	return channel;
+}
+
+inline LuaChannel ThermistorChannel(const std::string & name, int ain, double seriesOhms,
+	double supplyVolts, double referenceC)
+{
+	LuaChannel channel = LuaBlankChannel(name, ain, LUA_CONVERSION_THERMISTOR);
+	channel.seriesOhms = seriesOhms;
+	channel.supplyVolts = supplyVolts;
+	channel.referenceC = referenceC;
+	return channel;
+}
+
+inline std::vector<LuaChannel> TradeFairChannels()
+{
+	// The sensors' supply, and the anemometers' full scale of 5.08 m/s at 5 V
+	const double supplyVolts = 4.915;
+	const double metersPerSecondPerVolt = 5.08 / 5;
+
+	std::vector<LuaChannel> channels;
+	channels.push_back(RtdChannel("radiant", 12, 100, supplyVolts, 100, 0.003851));
+	channels.push_back(LinearChannel("humidity", 1, 100 / supplyVolts));
+	channels.push_back(ThermistorChannel("ambient", 13, 3000, supplyVolts, 25));
+	channels.push_back(LinearChannel("wind1", 2, metersPerSecondPerVolt));
+	channels.push_back(LinearChannel("wind2", 3, metersPerSecondPerVolt));
+	return channels;
+}
+
+inline double ConvertChannelVolts(const LuaChannel & channel, double volts)
+{
+	double ohms;
+
+	switch (channel.conversion) {
+	case LUA_CONVERSION_RTD:
+		ohms = channel.seriesOhms * volts / (channel.supplyVolts - volts);
+		return (ohms - channel.r0Ohms) / (channel.r0Ohms * channel.alpha);
+	case LUA_CONVERSION_THERMISTOR:
+		ohms = channel.seriesOhms * volts / (channel.supplyVolts - volts);
+		return channel.referenceC * channel.seriesOhms / ohms;
+	case LUA_CONVERSION_LINEAR:
+	default:
+		return volts * channel.scale + channel.offset;
+	}
+}
+
+inline int LuaPreprocessBlockSize(int numChannels)
+{
+	return 3 + numChannels * 3;
+}
+
+// Formats a constant for the generated script
+static inline std::string LuaNumber(double value)
+{
+	char text[32];
+	snprintf(text, sizeof(text), "%.9g", value);
+	return text;
+}
+
+// Returns the Lua expression that converts the volts in v for channel
+static inline std::string LuaConversion(const LuaChannel & channel)
+{
+	std::string ohms = "(" + LuaNumber(channel.seriesOhms) + " * v / (" +
+		LuaNumber(channel.supplyVolts) + " - v))";
+
+	switch (channel.conversion) {
+	case LUA_CONVERSION_RTD:
+		return "(" + ohms + " - " + LuaNumber(channel.r0Ohms) + ") / " +
+			LuaNumber(channel.r0Ohms * channel.alpha);
+	case LUA_CONVERSION_THERMISTOR:
+		return LuaNumber(channel.referenceC * channel.seriesOhms) + " / " + ohms;
+	case LUA_CONVERSION_LINEAR:
+	default:
+		return "v * " + LuaNumber(channel.scale) + " + " + LuaNumber(channel.offset);
+	}
+}
+
+inline int GenerateLuaPreprocessScript(const std::vector<LuaChannel> & channels,
+	int sampleMS, int samplesPerWindow, std::string & script)
+{
+	int numChannels = (int)channels.size();
+	int lastAddress = LUA_PREPROCESS_BLOCK_ADDRESS +
+		(LuaPreprocessBlockSize(numChannels) - 1) * 2;
+	char line[160];
+
+	if (numChannels < 1 || numChannels > LUA_PREPROCESS_MAX_CHANNELS ||
+		sampleMS < 1 || samplesPerWindow < 1)
+	{
+		return LJME_INVALID_PARAMETER;
+	}
+
+	script.clear();
+	snprintf(line, sizeof(line),
+		"-- Averages %d channels over %d samples, %d ms apart, into USER_RAM\n",
+		numChannels, samplesPerWindow, sampleMS);
+	script += line;
+	script += "-- Generated by GenerateLuaPreprocessScript in LJM_LuaPreprocess.h\n";
+	script += "local R = MB.R\n";
+	script += "local W = MB.W\n";
+	script += "local huge = math.huge\n";
+	script += "local n = 0\n";
+	script += "local sequence = 0\n";
+	script += "local v, x\n";
+	for (int c = 1; c <= numChannels; c++) {
+		snprintf(line, sizeof(line),
+			"local sum%d, min%d, max%d = 0, huge, -huge\n", c, c, c);
+		script += line;
+	}
+
+	// Publishes sequence 0 with no samples, so a reader can tell the script
+	// is running before the first window ends
+	snprintf(line, sizeof(line), "W(%d, 3, 0)\n", lastAddress);
+	script += line;
+	snprintf(line, sizeof(line), "W(%d, 3, 0)\n", LUA_PREPROCESS_BLOCK_ADDRESS + 2);
+	script += line;
+	snprintf(line, sizeof(line), "W(%d, 3, 0)\n", LUA_PREPROCESS_BLOCK_ADDRESS);
+	script += line;
+
+	snprintf(line, sizeof(line), "LJ.IntervalConfig(0, %d)\n", sampleMS);
+	script += line;
+	script += "while true do\n";
+	script += "  if LJ.CheckInterval(0) then\n";
+	for (int c = 1; c <= numChannels; c++) {
+		const LuaChannel & channel = channels[c - 1];
+		snprintf(line, sizeof(line), "    -- %s\n", channel.name.c_str());
+		script += line;
+		snprintf(line, sizeof(line), "    v = R(%d, 3)\n", channel.ain * 2);
+		script += line;
+		script += "    x = " + LuaConversion(channel) + "\n";
+		snprintf(line, sizeof(line), "    sum%d = sum%d + x\n", c, c);
+		script += line;
+		snprintf(line, sizeof(line), "    if x < min%d then min%d = x end\n", c, c);
+		script += line;
+		snprintf(line, sizeof(line), "    if x > max%d then max%d = x end\n", c, c);
+		script += line;
+	}
+	script += "    n = n + 1\n";
+	snprintf(line, sizeof(line), "    if n >= %d then\n", samplesPerWindow);
+	script += line;
+	snprintf(line, sizeof(line), "      sequence = (sequence + 1) %% %d\n",
+		(int)LUA_PREPROCESS_SEQUENCE_LIMIT);
+	script += line;
+	snprintf(line, sizeof(line), "      W(%d, 3, sequence)\n", lastAddress);
+	script += line;
+	snprintf(line, sizeof(line), "      W(%d, 3, n)\n", LUA_PREPROCESS_BLOCK_ADDRESS + 2);
+	script += line;
+	for (int c = 1; c <= numChannels; c++) {
+		int address = LUA_PREPROCESS_BLOCK_ADDRESS + 4 + (c - 1) * 6;
+		snprintf(line, sizeof(line),
+			"      W(%d, 3, sum%d / n)\n"
+			"      W(%d, 3, min%d)\n"
+			"      W(%d, 3, max%d)\n",
+			address, c, address + 2, c, address + 4, c);
+		script += line;
+	}
+	snprintf(line, sizeof(line), "      W(%d, 3, sequence)\n", LUA_PREPROCESS_BLOCK_ADDRESS);
+	script += line;
+	script += "      n = 0\n";
+	for (int c = 1; c <= numChannels; c++) {
+		snprintf(line, sizeof(line), "      sum%d, min%d, max%d = 0, huge, -huge\n",
+			c, c, c);
+		script += line;
+	}
+	script += "    end\n";
+	script += "  end\n";
+	script += "end\n";
+
+	return LJME_NOERROR;
+}
+
+inline LuaWindowReader::LuaWindowReader(int numChannels) :
+	numChannels(numChannels),
+	haveSequence(false),
+	lastSequence(0),
+	retries(0)
+{
+	plan.AddRead(LUA_PREPROCESS_BLOCK_ADDRESS, LJM_FLOAT32,
+		LuaPreprocessBlockSize(numChannels));
+}
+
+inline int LuaWindowReader::Read(int handle, LuaWindow * window, bool * isNew,
+	int * errorAddress)
+{
+	int blockSize = LuaPreprocessBlockSize(numChannels);
+
+	for (int attempt = 0; attempt < LUA_PREPROCESS_READ_ATTEMPTS; attempt++) {
+		if (attempt > 0) {
+			++retries;
+		}
+
+		int err = plan.Execute(handle, errorAddress);
+		if (err != LJME_NOERROR) {
+			return err;
+		}
+
+		const double * values = plan.Values();
+		if (values[0] != values[blockSize - 1]) {
+			continue;
+		}
+
+		// Sequence 0 with no samples is the script's start marker
+		if (values[0] == 0 && values[1] == 0) {
+			return LJME_SYNCHRONIZATION_TIMEOUT;
+		}
+
+		window->sequence = (unsigned int)values[0];
+		window->numSamples = (int)values[1];
+		window->average.resize(numChannels);
+		window->minimum.resize(numChannels);
+		window->maximum.resize(numChannels);
+		for (int c = 0; c < numChannels; c++) {
+			window->average[c] = values[2 + c * 3];
+			window->minimum[c] = values[3 + c * 3];
+			window->maximum[c] = values[4 + c * 3];
+		}
+
+		if (isNew) {
+			*isNew = !haveSequence || window->sequence != lastSequence;
+		}
+		haveSequence = true;
+		lastSequence = window->sequence;
+		return LJME_NOERROR;
+	}
+
+	return LJME_SYNCHRONIZATION_TIMEOUT;
+}
+
+#endif // #ifndef LJM_LUA_PREPROCESS
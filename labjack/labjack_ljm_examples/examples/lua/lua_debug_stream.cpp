@@ -0,0 +1,203 @@
+/**
+ * Name: lua_debug_stream.cpp
+ * Desc: Streams the print output of the Lua script running on a T7 to the
+ *       console and, optionally, a log file, and prints the streamer's
+ *       statistics once a second.
+ * Usage: lua_debug_stream [-t | -s] [-f] [seconds [log file]]
+ *        -t first deploys a test script that prints a line every 5 ms, more
+ *        than lua_script_basic.c's once-a-second reads keep up with.
+ *        -s streams instead from a local ModbusStandIn playing a T7 with a
+ *        1024 byte debug buffer that gets the test script's output, and
+ *        prints how much of it didn't fit. Needs permission to listen on
+ *        port 502.
+ *        -f polls once a second, as lua_script_basic.c does, rather than
+ *        adaptively.
+ *        seconds defaults to 10.
+**/
+
+// For printf
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_LuaDebugStream.h"
+#include "LJM_LuaDeploy.h"
+#include "../modbus/ModbusStandIn.h"
+
+// The stand-in plays a T7 at this address, port 502
+const char * STAND_IN_IP = "127.0.0.2";
+enum { STAND_IN_DEBUG_BUFFER_SIZE = 1024 };
+enum { TEST_SCRIPT_INTERVAL_MS = 5 };
+
+const char * TEST_SCRIPT =
+	"LJ.IntervalConfig(0, 5)\n"
+	"local count = 0\n"
+	"while true do\n"
+	"  if LJ.CheckInterval(0) then\n"
+	"    count = count + 1\n"
+	"    print(\"line \" .. count .. \" tick \" .. LJ.Tick())\n"
+	"  end\n"
+	"end\n";
+
+void PrintStats(const LuaDebugStats & stats);
+
+/**
+ * Desc: Starts standIn on STAND_IN_IP with the registers LJM_Open reads from
+ *       a T7 and a debug buffer, and a thread in printer that prints to it
+ *       like TEST_SCRIPT until printing is cleared.
+**/
+void StartStandIn(ModbusStandIn & standIn, std::thread & printer,
+	std::atomic<bool> & printing);
+
+int main(int argc, char * argv[])
+{
+	int err, handle;
+	int errorAddress = INITIAL_ERR_ADDRESS;
+	int argi = 1;
+	bool loadTestScript = false;
+	bool useStandIn = false;
+	bool fixedPolling = false;
+	int seconds = 10;
+	const char * logPath = NULL;
+	LuaConsoleSink console("LUA: ");
+	LuaFileSink logFile;
+	LuaDebugStreamer streamer;
+	LuaDebugStats stats;
+	ModbusStandIn standIn;
+	std::thread printer;
+	std::atomic<bool> printing(false);
+
+	if (argi < argc && strcmp(argv[argi], "-t") == 0) {
+		loadTestScript = true;
+		++argi;
+	}
+	else if (argi < argc && strcmp(argv[argi], "-s") == 0) {
+		useStandIn = true;
+		++argi;
+	}
+	if (argi < argc && strcmp(argv[argi], "-f") == 0) {
+		fixedPolling = true;
+		++argi;
+	}
+	if (argi < argc) {
+		seconds = atoi(argv[argi++]);
+	}
+	if (argi < argc) {
+		logPath = argv[argi++];
+	}
+
+	if (useStandIn) {
+		StartStandIn(standIn, printer, printing);
+		handle = OpenOrDie(LJM_dtT7, LJM_ctTCP, STAND_IN_IP);
+	}
+	else {
+		handle = OpenOrDie(LJM_dtT7, LJM_ctANY, "LJM_idANY");
+	}
+
+	PrintDeviceInfoFromHandle(handle);
+	printf("\n");
+
+	if (loadTestScript) {
+		LuaDeployer deployer;
+		err = deployer.Deploy(handle, TEST_SCRIPT, NULL, &errorAddress);
+		ErrorCheckWithAddress(err, errorAddress, "LuaDeployer::Deploy");
+	}
+	else if (!useStandIn) {
+		WriteNameOrDie(handle, "LUA_DEBUG_ENABLE", 1);
+	}
+
+	streamer.AddSink(&console);
+	if (logPath) {
+		err = logFile.Open(logPath);
+		ErrorCheck(err, "Opening %s", logPath);
+		streamer.AddSink(&logFile);
+	}
+
+	if (fixedPolling) {
+		streamer.SetPollIntervalMS(1000, 1000);
+	}
+	err = streamer.Start(handle);
+	ErrorCheck(err, "LuaDebugStreamer::Start");
+
+	for (int second = 0; second < seconds && streamer.Running(); second++) {
+		MillisecondSleep(1000);
+		streamer.GetStats(&stats);
+		PrintStats(stats);
+	}
+
+	err = streamer.Stop(&errorAddress);
+	ErrorCheckWithAddress(err, errorAddress, "LuaDebugStreamer");
+
+	streamer.GetStats(&stats);
+	printf("\nTotal: ");
+	PrintStats(stats);
+	printf("Polls: %lld in %lld packets, at most %d bytes in the debug buffer\n",
+		stats.polls, stats.packets, stats.maxBufferBytes);
+
+	if (useStandIn) {
+		printing = false;
+		printer.join();
+		printf("Output that didn't fit in the debug buffer: %lld bytes\n",
+			standIn.LuaDebugBytesDropped());
+	}
+
+	CloseOrDie(handle);
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+void PrintStats(const LuaDebugStats & stats)
+{
+	printf("%.0f bytes/s, %lld lines, poll interval %.1f ms, "
+		"%lld full buffer polls, %lld lines dropped (%lld bytes)\n",
+		stats.bytesPerSecond, stats.lines, stats.pollIntervalMS,
+		stats.fullPolls, stats.droppedLines, stats.droppedBytes);
+}
+
+void StartStandIn(ModbusStandIn & standIn, std::thread & printer,
+	std::atomic<bool> & printing)
+{
+	unsigned int ipAddress;
+	int err = LJM_IPToNumber(STAND_IN_IP, &ipAddress);
+	ErrorCheck(err, "LJM_IPToNumber(%s)", STAND_IN_IP);
+
+	// What LJM reads when it opens a T7 over TCP; the first three aren't in
+	// ljm_constants.json
+	standIn.SetRegister(65000, 7);
+	standIn.SetValue(49600, LJM_UINT32, 11);
+	standIn.SetRegister(49910, 1040);
+	standIn.SetValue(60000, LJM_FLOAT32, 7); // PRODUCT_ID
+	standIn.SetValue(60004, LJM_FLOAT32, 1.0225); // FIRMWARE_VERSION
+	standIn.SetValue(60028, LJM_UINT32, 470010000); // SERIAL_NUMBER
+	standIn.SetLuaDebugBufferSize(STAND_IN_DEBUG_BUFFER_SIZE);
+
+	err = standIn.Start(502, -1, ipAddress);
+	ErrorCheck(err, "Starting a stand-in on %s:502", STAND_IN_IP);
+
+	printf("Streaming from a stand-in T7 on %s printing a line every %d ms\n",
+		STAND_IN_IP, TEST_SCRIPT_INTERVAL_MS);
+
+	printing = true;
+	printer = std::thread([&standIn, &printing] {
+		char line[64];
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (long long count = 1; printing; count++) {
+			std::this_thread::sleep_until(start +
+				std::chrono::milliseconds(count * TEST_SCRIPT_INTERVAL_MS));
+			snprintf(line, sizeof(line), "line %lld tick %lld\n", count,
+				count * TEST_SCRIPT_INTERVAL_MS * 40000);
+			standIn.LuaPrint(line);
+		}
+	});
+}
@@ -0,0 +1,146 @@
+/**
+ * Name: lua_deploy.cpp
+ * Desc: Loads a Lua script on a T7 the way utilities/lua_script_basic.c does,
+ *       then with a LuaDeployer, and prints how long each took. Deploys the
+ *       same script again, which is skipped since the device reports the
+ *       same hash, and once more with SetForce.
+ * Usage: lua_deploy [script.lua]
+ *        Without a file, deploys the script from lua_script_basic.c, with
+ *        comments.
+**/
+
+// For printf
+#include <stdio.h>
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_LuaDeploy.h"
+
+const char * EXAMPLE_SCRIPT =
+	"-- Prints the core timer once a second\n"
+	"LJ.IntervalConfig(0, 1000)\n"
+	"\n"
+	"while true do\n"
+	"    -- CheckInterval is true once per interval\n"
+	"    if LJ.CheckInterval(0) then\n"
+	"        print(LJ.Tick())\n"
+	"    end\n"
+	"end\n";
+
+/**
+ * Desc: Loads luaScript like LoadLuaScript in lua_script_basic.c and returns
+ *       the milliseconds that took, or a negative value if it failed.
+**/
+double LoadLuaScriptBasic(int handle, const std::string & luaScript);
+
+/**
+ * Desc: Deploys source with deployer and prints a result row.
+**/
+void Deploy(int handle, LuaDeployer & deployer, const std::string & source,
+	const char * description);
+
+int main(int argc, char * argv[])
+{
+	int err, handle;
+	std::string source = EXAMPLE_SCRIPT;
+	std::string minified;
+	LuaDeployer deployer;
+
+	if (argc > 1) {
+		std::ifstream file(argv[1], std::ios::binary);
+		if (!file) {
+			printf("Could not open %s\n", argv[1]);
+			WaitForUserIfWindows();
+			return LJME_INVALID_PARAMETER;
+		}
+		std::stringstream contents;
+		contents << file.rdbuf();
+		source = contents.str();
+	}
+
+	err = MinifyLuaSource(source, minified);
+	ErrorCheck(err, "MinifyLuaSource");
+	printf("Script: %d bytes, %d minified\n\n", (int)source.size(), (int)minified.size());
+
+	handle = OpenOrDie(LJM_dtT7, LJM_ctANY, "LJM_idANY");
+
+	PrintDeviceInfoFromHandle(handle);
+	GetAndPrint(handle, "FIRMWARE_VERSION");
+	printf("\n");
+
+	double basicMS = LoadLuaScriptBasic(handle, source);
+	if (basicMS >= 0) {
+		printf("As lua_script_basic.c does it: %.1f ms\n\n", basicMS);
+	}
+
+	printf("%-20s %7s %7s %11s %10s %9s\n", "LuaDeployer", "Bytes", "Packets",
+		"Stop polls", "Pipelined", "Time");
+	Deploy(handle, deployer, source, "Deploy");
+	Deploy(handle, deployer, source, "Deploy again");
+	deployer.SetForce(true);
+	Deploy(handle, deployer, source, "Deploy with SetForce");
+
+	err = LJM_Close(handle);
+	ErrorCheck(err, "LJM_Close");
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+double LoadLuaScriptBasic(int handle, const std::string & luaScript)
+{
+	int err;
+	int errorAddress = INITIAL_ERR_ADDRESS;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	WriteNameOrDie(handle, "LUA_RUN", 0);
+	MillisecondSleep(600);
+	WriteNameOrDie(handle, "LUA_RUN", 0);
+
+	WriteNameOrDie(handle, "LUA_SOURCE_SIZE", luaScript.size() + 1);
+	err = LJM_eWriteNameByteArray(handle, "LUA_SOURCE_WRITE", (int)luaScript.size() + 1,
+		luaScript.c_str(), &errorAddress);
+	if (err != LJME_NOERROR) {
+		PrintErrorIfError(err,
+			"As lua_script_basic.c does it: LJM_eWriteNameByteArray(LUA_SOURCE_WRITE, %d),"
+			" error address %d", (int)luaScript.size() + 1, errorAddress);
+		printf("\n");
+		return -1;
+	}
+	WriteNameOrDie(handle, "LUA_DEBUG_ENABLE", 1);
+	WriteNameOrDie(handle, "LUA_DEBUG_ENABLE_DEFAULT", 1);
+	WriteNameOrDie(handle, "LUA_RUN", 1);
+
+	return std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+void Deploy(int handle, LuaDeployer & deployer, const std::string & source,
+	const char * description)
+{
+	int errorAddress = INITIAL_ERR_ADDRESS;
+	LuaDeployReport report;
+
+	int err = deployer.Deploy(handle, source, &report, &errorAddress);
+	ErrorCheckWithAddress(err, errorAddress, "LuaDeployer::Deploy");
+
+	if (report.skipped) {
+		printf("%-20s %7s %7lld %11s %10s %6.1f ms  (already running, hash %08x)\n",
+			description, "-", report.roundTrips, "-", "-", report.totalMS, report.hash);
+	}
+	else {
+		printf("%-20s %7d %7d %11d %10s %6.1f ms\n", description, report.uploadBytes,
+			report.numPackets, report.numStopPolls, report.pipelined ? "yes" : "no",
+			report.totalMS);
+	}
+}
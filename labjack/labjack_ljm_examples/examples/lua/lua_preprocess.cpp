@@ -0,0 +1,250 @@
+/**
+ * Name: lua_preprocess.cpp
+ * Desc: Averages the trade_fair.py channels over a window of samples twice:
+ *       on the host, reading every sample as trade_fair.py does, and on the
+ *       T7, with a generated Lua script and one block read per window. Prints
+ *       the results of both and the packets, bytes and host CPU time each
+ *       used per window.
+ * Usage: lua_preprocess [--print] [windows [sampleMS]]
+ *        --print only prints the generated script.
+ *        windows defaults to 1 and sampleMS to 500; a window is 20 samples.
+**/
+
+// For printf
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_LuaDeploy.h"
+#include "LJM_LuaPreprocess.h"
+
+const int SAMPLES_PER_WINDOW = 20;
+
+/**
+ * Desc: What one method cost over all windows.
+**/
+struct MethodCost
+{
+	long long packets;
+	long long bytes;
+	double cpuMS;
+};
+
+/**
+ * Desc: Samples, converts and averages channels on the host, like
+ *       take_measurements in trade_fair.py, and prints each window.
+**/
+MethodCost AverageOnHost(int handle, int maxBytesPerMB,
+	const std::vector<LuaChannel> & channels, int windows, int sampleMS);
+
+/**
+ * Desc: Deploys the generated script and prints each window it publishes.
+**/
+MethodCost AverageOnDevice(int handle, int maxBytesPerMB,
+	const std::vector<LuaChannel> & channels, int windows, int sampleMS);
+
+void PrintWindow(const std::vector<LuaChannel> & channels, const LuaWindow & window);
+
+// Sums the bytes packets send and receive
+long long PacketBytes(const std::vector<PlanPacket> & packets);
+
+double CPUMSSince(clock_t start);
+
+int main(int argc, char * argv[])
+{
+	int err, handle;
+	int argi = 1;
+	int windows = 1;
+	int sampleMS = 500;
+	std::vector<LuaChannel> channels = TradeFairChannels();
+
+	if (argi < argc && strcmp(argv[argi], "--print") == 0) {
+		std::string script;
+		err = GenerateLuaPreprocessScript(channels, sampleMS, SAMPLES_PER_WINDOW, script);
+		ErrorCheck(err, "GenerateLuaPreprocessScript");
+		printf("%s", script.c_str());
+		return LJME_NOERROR;
+	}
+	if (argi < argc) {
+		windows = atoi(argv[argi++]);
+	}
+	if (argi < argc) {
+		sampleMS = atoi(argv[argi++]);
+	}
+
+	handle = OpenOrDie(LJM_dtT7, LJM_ctANY, "LJM_idANY");
+
+	PrintDeviceInfoFromHandle(handle);
+	printf("\n");
+
+	int deviceType, connectionType, serialNumber, ipAddress, port, maxBytesPerMB;
+	err = LJM_GetHandleInfo(handle, &deviceType, &connectionType, &serialNumber,
+		&ipAddress, &port, &maxBytesPerMB);
+	ErrorCheck(err, "LJM_GetHandleInfo");
+
+	printf("Averaging on the host:\n");
+	MethodCost host = AverageOnHost(handle, maxBytesPerMB, channels, windows, sampleMS);
+
+	printf("\nAveraging on the device:\n");
+	MethodCost device = AverageOnDevice(handle, maxBytesPerMB, channels, windows, sampleMS);
+
+	printf("\n%-10s %16s %16s %18s\n", "Per window", "Packets", "Bytes", "Host CPU");
+	printf("%-10s %16.1f %16.1f %15.2f ms\n", "Host", (double)host.packets / windows,
+		(double)host.bytes / windows, host.cpuMS / windows);
+	printf("%-10s %16.1f %16.1f %15.2f ms\n", "Device", (double)device.packets / windows,
+		(double)device.bytes / windows, device.cpuMS / windows);
+
+	CloseOrDie(handle);
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+MethodCost AverageOnHost(int handle, int maxBytesPerMB,
+	const std::vector<LuaChannel> & channels, int windows, int sampleMS)
+{
+	int errorAddress = INITIAL_ERR_ADDRESS;
+	int numChannels = (int)channels.size();
+	MethodCost cost = {0, 0, 0};
+	FramePlan plan(maxBytesPerMB);
+	LuaWindow window;
+
+	// All channels in one packet, like trade_fair.py's eReadNames call
+	for (int c = 0; c < numChannels; c++) {
+		plan.AddRead(channels[c].ain * 2, LJM_FLOAT32);
+	}
+	long long bytesPerSample = PacketBytes(plan.Packets());
+
+	for (int w = 0; w < windows; w++) {
+		window.sequence = w + 1;
+		window.numSamples = 0;
+		window.average.assign(numChannels, 0);
+		window.minimum.assign(numChannels, HUGE_VAL);
+		window.maximum.assign(numChannels, -HUGE_VAL);
+
+		for (int s = 0; s < SAMPLES_PER_WINDOW; s++) {
+			clock_t start = clock();
+			int err = plan.Execute(handle, &errorAddress);
+			ErrorCheckWithAddress(err, errorAddress, "FramePlan::Execute");
+
+			for (int c = 0; c < numChannels; c++) {
+				double value = ConvertChannelVolts(channels[c], plan.Values()[c]);
+				window.average[c] += value;
+				window.minimum[c] = value < window.minimum[c] ? value : window.minimum[c];
+				window.maximum[c] = value > window.maximum[c] ? value : window.maximum[c];
+			}
+			++window.numSamples;
+			cost.cpuMS += CPUMSSince(start);
+			cost.bytes += bytesPerSample;
+
+			MillisecondSleep(sampleMS);
+		}
+
+		for (int c = 0; c < numChannels; c++) {
+			window.average[c] /= window.numSamples;
+		}
+		PrintWindow(channels, window);
+	}
+
+	cost.packets = plan.RoundTrips();
+	return cost;
+}
+
+MethodCost AverageOnDevice(int handle, int maxBytesPerMB,
+	const std::vector<LuaChannel> & channels, int windows, int sampleMS)
+{
+	int err;
+	int errorAddress = INITIAL_ERR_ADDRESS;
+	MethodCost cost = {0, 0, 0};
+	std::string script;
+	LuaDeployer deployer;
+	LuaDeployReport report;
+	LuaWindowReader reader((int)channels.size());
+	LuaWindow window;
+	bool isNew = false;
+
+	err = GenerateLuaPreprocessScript(channels, sampleMS, SAMPLES_PER_WINDOW, script);
+	ErrorCheck(err, "GenerateLuaPreprocessScript");
+
+	// The script restarts so the first window starts now
+	deployer.SetForce(true);
+	err = deployer.Deploy(handle, script, &report, &errorAddress);
+	ErrorCheckWithAddress(err, errorAddress, "LuaDeployer::Deploy");
+	printf("Deployed %d bytes in %.1f ms\n", report.uploadBytes, report.totalMS);
+
+	reader.SetMaxBytesPerMB(maxBytesPerMB);
+	long long bytesPerRead = PacketBytes(reader.Packets());
+
+	for (int w = 0; w < windows; w++) {
+		// Read once the window should be done, then every tenth of a sample
+		// until it is, for up to another window
+		MillisecondSleep(sampleMS * SAMPLES_PER_WINDOW);
+		for (int wait = 0; ; wait++) {
+			clock_t start = clock();
+			err = reader.Read(handle, &window, &isNew, &errorAddress);
+			cost.cpuMS += CPUMSSince(start);
+			if (err == LJME_NOERROR && isNew) {
+				break;
+			}
+			if (err == LJME_NOERROR || err == LJME_SYNCHRONIZATION_TIMEOUT) {
+				err = wait < SAMPLES_PER_WINDOW * 10 ? LJME_NOERROR : LJME_SYNCHRONIZATION_TIMEOUT;
+			}
+			ErrorCheckWithAddress(err, errorAddress,
+				"LuaWindowReader::Read (is the script running?)");
+			MillisecondSleep(sampleMS / 10 + 1);
+		}
+		PrintWindow(channels, window);
+	}
+
+	// Every read sends all of the reader's packets
+	cost.packets = reader.RoundTrips();
+	cost.bytes = bytesPerRead * reader.RoundTrips() / reader.NumPackets();
+
+	err = deployer.Stop(handle, NULL);
+	ErrorCheck(err, "LuaDeployer::Stop");
+
+	return cost;
+}
+
+void PrintWindow(const std::vector<LuaChannel> & channels, const LuaWindow & window)
+{
+	printf("  Window %u, %d samples\n", window.sequence, window.numSamples);
+	for (size_t c = 0; c < channels.size(); c++) {
+		printf("    %-10s AIN%-3d average %10.4f  min %10.4f  max %10.4f\n",
+			channels[c].name.c_str(), channels[c].ain, window.average[c],
+			window.minimum[c], window.maximum[c]);
+	}
+
+	// trade_fair.py's wind velocity, from the two anemometer averages
+	if (channels.size() == 5) {
+		printf("    %-10s        average %10.4f\n", "velocity",
+			sqrt(window.average[3] * window.average[3] +
+			window.average[4] * window.average[4]));
+	}
+}
+
+long long PacketBytes(const std::vector<PlanPacket> & packets)
+{
+	long long bytes = 0;
+	for (size_t p = 0; p < packets.size(); p++) {
+		bytes += packets[p].commandBytes + packets[p].responseBytes;
+	}
+	return bytes;
+}
+
+double CPUMSSince(clock_t start)
+{
+	return (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
@@ -29,7 +29,7 @@ dir_make () {
 	cd $DIR
 }
 
-example_dirs=( . ain asynch config dio ethernet i2c list_all stream testing utilities watchdog wifi )
+example_dirs=( . ain asynch batching config constants conversion coroutines daemon dio ethernet fleet i2c list_all lua modbus python stream testing utilities watchdog wifi )
 for i in "${example_dirs[@]}"; do
 	dir_make $i
 done
@@ -0,0 +1,680 @@
+/**
+ * Name: LJM_ModbusEngine.h
+ * Desc: An event-driven Modbus TCP client that services many device
+ *       connections from one thread using epoll. Each device has its own
+ *       request queue; connects are non-blocking, responses are matched by
+ *       transaction ID and requests time out individually. Commands built
+ *       with EncodeFeedbackCommand (LJM_ModbusTCP.h) are the same bytes
+ *       LJM_AddressesToMBFB produces. C++11, Linux only.
+**/
+
+#ifndef LJM_MODBUS_ENGINE
+#define LJM_MODBUS_ENGINE
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <queue>
+#include <vector>
+
+#include "LJM_ModbusTCP.h"
+
+/**
+ * Desc: Counters for a ModbusEngine, summed over all devices. Latency is
+ *       measured from when a request is first sent until it completes.
+**/
+struct ModbusEngineStats
+{
+	long long submitted;
+	long long completed;
+	long long failed;
+	long long retries;
+	long long staleResponses;
+	long long connectFailures;
+	double totalLatencyUS;
+	double maxLatencyUS;
+};
+
+/**
+ * Name: ModbusEngine
+ * Desc: Devices are added with AddDevice and addressed by the returned device
+ *       ID. Requests submitted to a device are sent in order, at most window
+ *       at a time (a T7 answers one request at a time per connection, so the
+ *       default is 1). A request not answered within timeoutMS is resent up
+ *       to maxRetries times, then completed with LJME_NO_RESPONSE_BYTES_RECEIVED.
+ *       If a connection fails, the device's outstanding requests complete with
+ *       the error and the device stays disconnected until Reconnect.
+ * Note: Not thread-safe; Submit and Poll must be called from the thread that
+ *       services the engine. Completions run inside Poll/Drain and may call
+ *       Submit, but not RemoveDevice.
+**/
+class ModbusEngine
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	ModbusEngine(int window = 1, int timeoutMS = LJM_DEFAULT_ETHERNET_SEND_RECEIVE_TIMEOUT_MS,
+		int maxRetries = 1);
+	~ModbusEngine();
+
+	/**
+	 * Desc: Starts a non-blocking connect to ipAddress:port. Requests may be
+	 *       submitted to the device straight away; they are sent once the
+	 *       connection is up.
+	 * Para: ipAddress, as returned by LJM_IPToNumber / LJM_GetHandleInfo.
+	 *       deviceID, output. Identifies the device in the other calls.
+	 * Retr: LJME_NOERROR or LJME_CANNOT_CONNECT.
+	**/
+	int AddDevice(unsigned int ipAddress, int port, int * deviceID);
+
+	/**
+	 * Desc: Closes the device's connection. Its outstanding requests complete
+	 *       with LJME_DEVICE_DISCONNECTED.
+	**/
+	void RemoveDevice(int deviceID);
+
+	/**
+	 * Desc: Reconnects a device whose connection failed.
+	 * Retr: LJME_NOERROR, LJME_INVALID_HANDLE or LJME_CANNOT_CONNECT.
+	**/
+	int Reconnect(int deviceID);
+
+	bool IsConnected(int deviceID) const;
+
+	/**
+	 * Desc: Queues a request ADU for a device. Its transaction ID is replaced
+	 *       when sent.
+	 * Retr: LJME_NOERROR, LJME_INVALID_HANDLE for an unknown device, or
+	 *       LJME_DEVICE_DISCONNECTED if the device's connection has failed.
+	 *       completion is only called when LJME_NOERROR is returned.
+	**/
+	int Submit(int deviceID, const std::vector<unsigned char> & adu,
+		ModbusCompletion completion);
+
+	/**
+	 * Desc: Sends what each device's window allows, then waits up to timeoutMS
+	 *       for connections, responses and timeouts.
+	 * Retr: The number of requests completed.
+	**/
+	int Poll(int timeoutMS);
+
+	/**
+	 * Desc: Polls until every submitted request has completed.
+	**/
+	void Drain();
+
+	int NumDevices() const { return (int)devices.size(); }
+	long long NumOutstanding() const { return outstanding; }
+
+	ModbusEngineStats GetStats() const { return stats; }
+
+private:
+	enum DeviceState {
+		DEVICE_CONNECTING,
+		DEVICE_CONNECTED,
+		DEVICE_DISCONNECTED
+	};
+
+	struct Request
+	{
+		std::vector<unsigned char> adu;
+		ModbusCompletion completion;
+		Clock::time_point firstSent;
+		Clock::time_point deadline;
+		int attempts;
+	};
+
+	struct Device
+	{
+		int sock;
+		DeviceState state;
+		unsigned int ipAddress;
+		int port;
+		Clock::time_point connectDeadline;
+		unsigned short nextTransactionID;
+		bool flushPending;
+		bool wantWrite;
+
+		std::deque<Request> queued;
+		std::map<unsigned short, Request> inFlight;
+		std::vector<unsigned char> receiveBuffer;
+		std::vector<unsigned char> sendBuffer;
+		size_t sendOffset;
+	};
+
+	// Deadlines are kept in a min-heap and checked lazily: an entry whose
+	// request has since completed or been resent is ignored when it expires
+	struct Deadline
+	{
+		Clock::time_point when;
+		int deviceID;
+		int transactionID; // -1 for a connect deadline
+
+		bool operator>(const Deadline & other) const { return when > other.when; }
+	};
+
+	int Connect(int deviceID, Device & device);
+	void FinishConnect(int deviceID, Device & device);
+	void ScheduleFlush(int deviceID, Device & device);
+	void FlushScheduled();
+	bool Flush(int deviceID, Device & device);
+	bool SendBuffered(int deviceID, Device & device);
+	bool ReceiveAvailable(Device & device);
+	void HandleResponse(Device & device, const unsigned char * response, int numBytes);
+	void ExpireDeadlines();
+	void FailDevice(Device & device, int err, DeviceState newState);
+	void CloseSocket(Device & device);
+	void Complete(Request & request, int err, const unsigned char * response, int numBytes);
+
+	int epollFD;
+	int window;
+	std::chrono::milliseconds timeout;
+	int maxRetries;
+	int nextDeviceID;
+	long long outstanding;
+
+	std::map<int, Device> devices;
+	std::vector<int> flushScheduled;
+	std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline> > deadlines;
+	ModbusEngineStats stats;
+};
+
+
+// Source
+
+inline ModbusEngine::ModbusEngine(int window, int timeoutMS, int maxRetries) :
+	epollFD(epoll_create1(0)),
+	window(window > 0 ? window : 1),
+	timeout(timeoutMS),
+	maxRetries(maxRetries),
+	nextDeviceID(0),
+	outstanding(0)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+inline ModbusEngine::~ModbusEngine()
+{
+	std::map<int, Device>::iterator it;
+	for (it = devices.begin(); it != devices.end(); ++it) {
+		CloseSocket(it->second);
+	}
+	if (epollFD >= 0) {
+		close(epollFD);
+	}
+}
+
+inline int ModbusEngine::AddDevice(unsigned int ipAddress, int port, int * deviceID)
+{
+	int err;
+	int newID = nextDeviceID++;
+	Device & device = devices[newID];
+
+	device.sock = -1;
+	device.state = DEVICE_DISCONNECTED;
+	device.ipAddress = ipAddress;
+	device.port = port;
+	device.nextTransactionID = 1;
+	device.flushPending = false;
+	device.wantWrite = false;
+	device.sendOffset = 0;
+
+	err = Connect(newID, device);
+	if (err != LJME_NOERROR) {
+		devices.erase(newID);
+		return err;
+	}
+
+	*deviceID = newID;
+	return LJME_NOERROR;
+}
+
+inline void ModbusEngine::RemoveDevice(int deviceID)
+{
+	std::map<int, Device>::iterator found = devices.find(deviceID);
+	if (found == devices.end()) {
+		return;
+	}
+
+	// Take the device out first so completions can't reach it
+	Device device;
+	device.sock = found->second.sock;
+	device.queued.swap(found->second.queued);
+	device.inFlight.swap(found->second.inFlight);
+	devices.erase(found);
+
+	FailDevice(device, LJME_DEVICE_DISCONNECTED, DEVICE_DISCONNECTED);
+}
+
+inline int ModbusEngine::Reconnect(int deviceID)
+{
+	std::map<int, Device>::iterator found = devices.find(deviceID);
+	if (found == devices.end()) {
+		return LJME_INVALID_HANDLE;
+	}
+	if (found->second.state != DEVICE_DISCONNECTED) {
+		return LJME_NOERROR;
+	}
+	return Connect(deviceID, found->second);
+}
+
+inline bool ModbusEngine::IsConnected(int deviceID) const
+{
+	std::map<int, Device>::const_iterator found = devices.find(deviceID);
+	return found != devices.end() && found->second.state == DEVICE_CONNECTED;
+}
+
+inline int ModbusEngine::Connect(int deviceID, Device & device)
+{
+	struct sockaddr_in address;
+	struct epoll_event event;
+	int one = 1;
+	Deadline deadline;
+
+	if (epollFD < 0) {
+		return LJME_CANNOT_CONNECT;
+	}
+
+	device.sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (device.sock < 0) {
+		return LJME_CANNOT_CONNECT;
+	}
+	setsockopt(device.sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons((unsigned short)device.port);
+	address.sin_addr.s_addr = htonl(device.ipAddress);
+
+	if (connect(device.sock, (struct sockaddr *)&address, sizeof(address)) < 0 &&
+		errno != EINPROGRESS)
+	{
+		CloseSocket(device);
+		return LJME_CANNOT_CONNECT;
+	}
+
+	// Writable means the connect finished, successfully or not
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | EPOLLOUT;
+	event.data.u32 = (unsigned int)deviceID;
+	if (epoll_ctl(epollFD, EPOLL_CTL_ADD, device.sock, &event) < 0) {
+		CloseSocket(device);
+		return LJME_CANNOT_CONNECT;
+	}
+
+	device.state = DEVICE_CONNECTING;
+	device.wantWrite = true;
+	device.connectDeadline = Clock::now() + timeout;
+	device.receiveBuffer.clear();
+	device.sendBuffer.clear();
+	device.sendOffset = 0;
+
+	deadline.when = device.connectDeadline;
+	deadline.deviceID = deviceID;
+	deadline.transactionID = -1;
+	deadlines.push(deadline);
+
+	return LJME_NOERROR;
+}
+
+inline void ModbusEngine::FinishConnect(int deviceID, Device & device)
+{
+	int err = 0;
+	socklen_t errLen = sizeof(err);
+
+	if (getsockopt(device.sock, SOL_SOCKET, SO_ERROR, &err, &errLen) < 0 || err != 0) {
+		++stats.connectFailures;
+		FailDevice(device, LJME_CANNOT_CONNECT, DEVICE_DISCONNECTED);
+		return;
+	}
+
+	device.state = DEVICE_CONNECTED;
+	ScheduleFlush(deviceID, device);
+}
+
+inline int ModbusEngine::Submit(int deviceID, const std::vector<unsigned char> & adu,
+	ModbusCompletion completion)
+{
+	std::map<int, Device>::iterator found = devices.find(deviceID);
+	if (found == devices.end()) {
+		return LJME_INVALID_HANDLE;
+	}
+	if (found->second.state == DEVICE_DISCONNECTED) {
+		return LJME_DEVICE_DISCONNECTED;
+	}
+
+	Request request;
+	request.adu = adu;
+	request.completion = completion;
+	request.attempts = 0;
+	found->second.queued.push_back(request);
+	++stats.submitted;
+	++outstanding;
+
+	// Sending is deferred to Poll so that Submit is safe inside completions
+	ScheduleFlush(deviceID, found->second);
+	return LJME_NOERROR;
+}
+
+inline void ModbusEngine::ScheduleFlush(int deviceID, Device & device)
+{
+	if (!device.flushPending) {
+		device.flushPending = true;
+		flushScheduled.push_back(deviceID);
+	}
+}
+
+inline void ModbusEngine::FlushScheduled()
+{
+	std::vector<int> scheduled;
+	std::map<int, Device>::iterator found;
+	size_t i;
+
+	scheduled.swap(flushScheduled);
+	for (i = 0; i < scheduled.size(); i++) {
+		found = devices.find(scheduled[i]);
+		if (found == devices.end()) {
+			continue;
+		}
+		found->second.flushPending = false;
+		if (!Flush(found->first, found->second)) {
+			FailDevice(found->second, LJME_SOCKET_LEVEL_ERROR, DEVICE_DISCONNECTED);
+		}
+	}
+}
+
+inline bool ModbusEngine::Flush(int deviceID, Device & device)
+{
+	unsigned short transactionID;
+	Deadline deadline;
+
+	if (device.state != DEVICE_CONNECTED) {
+		return true;
+	}
+
+	while (!device.queued.empty() && (int)device.inFlight.size() < window) {
+		while (device.inFlight.count(device.nextTransactionID)) {
+			++device.nextTransactionID;
+		}
+		transactionID = device.nextTransactionID++;
+
+		Request & request = device.inFlight[transactionID];
+		request = device.queued.front();
+		device.queued.pop_front();
+
+		SetTransactionID(&request.adu[0], transactionID);
+		if (request.attempts == 0) {
+			request.firstSent = Clock::now();
+		}
+		request.deadline = Clock::now() + timeout;
+		++request.attempts;
+		device.sendBuffer.insert(device.sendBuffer.end(), request.adu.begin(), request.adu.end());
+
+		deadline.when = request.deadline;
+		deadline.deviceID = deviceID;
+		deadline.transactionID = transactionID;
+		deadlines.push(deadline);
+	}
+
+	return SendBuffered(deviceID, device);
+}
+
+inline bool ModbusEngine::SendBuffered(int deviceID, Device & device)
+{
+	ssize_t sent;
+	struct epoll_event event;
+	bool wantWrite;
+
+	while (device.sendOffset < device.sendBuffer.size()) {
+		sent = send(device.sock, &device.sendBuffer[device.sendOffset],
+			device.sendBuffer.size() - device.sendOffset, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			return false;
+		}
+		device.sendOffset += (size_t)sent;
+	}
+	if (device.sendOffset == device.sendBuffer.size()) {
+		device.sendBuffer.clear();
+		device.sendOffset = 0;
+	}
+
+	// Only ask for EPOLLOUT while there is something left to send
+	wantWrite = !device.sendBuffer.empty();
+	if (wantWrite != device.wantWrite) {
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN | (wantWrite ? (unsigned int)EPOLLOUT : 0u);
+		event.data.u32 = (unsigned int)deviceID;
+		if (epoll_ctl(epollFD, EPOLL_CTL_MOD, device.sock, &event) < 0) {
+			return false;
+		}
+		device.wantWrite = wantWrite;
+	}
+	return true;
+}
+
+inline bool ModbusEngine::ReceiveAvailable(Device & device)
+{
+	unsigned char buffer[MODBUS_MAX_ADU_SIZE * 4];
+	ssize_t numRead;
+	size_t consumed;
+	int aduSize;
+
+	while (true) {
+		numRead = recv(device.sock, buffer, sizeof(buffer), 0);
+		if (numRead < 0) {
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		if (numRead == 0) {
+			return false;
+		}
+
+		device.receiveBuffer.insert(device.receiveBuffer.end(), buffer, buffer + numRead);
+		consumed = 0;
+		while (device.receiveBuffer.size() - consumed >= MODBUS_LENGTH_PREFIX_SIZE) {
+			aduSize = GetADUSize(&device.receiveBuffer[consumed]);
+			if (aduSize < 0) {
+				return false;
+			}
+			if (device.receiveBuffer.size() - consumed < (size_t)aduSize) {
+				break;
+			}
+			HandleResponse(device, &device.receiveBuffer[consumed], aduSize);
+			consumed += (size_t)aduSize;
+		}
+		device.receiveBuffer.erase(device.receiveBuffer.begin(),
+			device.receiveBuffer.begin() + consumed);
+	}
+}
+
+inline void ModbusEngine::HandleResponse(Device & device, const unsigned char * response,
+	int numBytes)
+{
+	std::map<unsigned short, Request>::iterator found =
+		device.inFlight.find(GetTransactionID(response));
+	if (found == device.inFlight.end()) {
+		++stats.staleResponses;
+		return;
+	}
+
+	Request request;
+	std::swap(request, found->second);
+	device.inFlight.erase(found);
+	Complete(request, LJME_NOERROR, response, numBytes);
+}
+
+inline void ModbusEngine::ExpireDeadlines()
+{
+	Clock::time_point now = Clock::now();
+	std::map<int, Device>::iterator deviceIt;
+	std::map<unsigned short, Request>::iterator requestIt;
+	Deadline deadline;
+
+	while (!deadlines.empty() && deadlines.top().when <= now) {
+		deadline = deadlines.top();
+		deadlines.pop();
+
+		deviceIt = devices.find(deadline.deviceID);
+		if (deviceIt == devices.end()) {
+			continue;
+		}
+		Device & device = deviceIt->second;
+
+		if (deadline.transactionID < 0) {
+			if (device.state == DEVICE_CONNECTING && device.connectDeadline == deadline.when) {
+				++stats.connectFailures;
+				FailDevice(device, LJME_CANNOT_CONNECT, DEVICE_DISCONNECTED);
+			}
+			continue;
+		}
+
+		requestIt = device.inFlight.find((unsigned short)deadline.transactionID);
+		if (requestIt == device.inFlight.end() || requestIt->second.deadline != deadline.when) {
+			continue;
+		}
+
+		Request request;
+		std::swap(request, requestIt->second);
+		device.inFlight.erase(requestIt);
+		if (request.attempts <= maxRetries) {
+			++stats.retries;
+			device.queued.push_front(request);
+			ScheduleFlush(deadline.deviceID, device);
+		}
+		else {
+			Complete(request, LJME_NO_RESPONSE_BYTES_RECEIVED, NULL, 0);
+		}
+	}
+}
+
+inline int ModbusEngine::Poll(int timeoutMS)
+{
+	enum { MAX_EVENTS = 256 };
+	struct epoll_event events[MAX_EVENTS];
+	long long completedBefore = stats.completed + stats.failed;
+	long long untilDeadline;
+	int numEvents, eventI;
+	std::map<int, Device>::iterator found;
+
+	FlushScheduled();
+
+	// Don't sleep past the earliest deadline
+	if (!deadlines.empty()) {
+		untilDeadline = std::chrono::duration_cast<std::chrono::milliseconds>(
+			deadlines.top().when - Clock::now()).count() + 1;
+		if (untilDeadline < timeoutMS) {
+			timeoutMS = untilDeadline > 0 ? (int)untilDeadline : 0;
+		}
+	}
+
+	numEvents = epoll_wait(epollFD, events, MAX_EVENTS, timeoutMS);
+	for (eventI = 0; eventI < numEvents; eventI++) {
+		found = devices.find((int)events[eventI].data.u32);
+		if (found == devices.end() || found->second.sock < 0) {
+			continue;
+		}
+		Device & device = found->second;
+
+		if (device.state == DEVICE_CONNECTING) {
+			FinishConnect(found->first, device);
+			continue;
+		}
+		if ((events[eventI].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+			!ReceiveAvailable(device))
+		{
+			FailDevice(device, LJME_SOCKET_LEVEL_ERROR, DEVICE_DISCONNECTED);
+			continue;
+		}
+		if (device.state == DEVICE_CONNECTED && (events[eventI].events & EPOLLOUT) &&
+			!SendBuffered(found->first, device))
+		{
+			FailDevice(device, LJME_SOCKET_LEVEL_ERROR, DEVICE_DISCONNECTED);
+			continue;
+		}
+		// Answered requests make room in the window
+		if (device.state == DEVICE_CONNECTED && !device.queued.empty()) {
+			ScheduleFlush(found->first, device);
+		}
+	}
+
+	ExpireDeadlines();
+	FlushScheduled();
+
+	return (int)(stats.completed + stats.failed - completedBefore);
+}
+
+inline void ModbusEngine::Drain()
+{
+	while (outstanding > 0) {
+		Poll((int)timeout.count());
+	}
+}
+
+inline void ModbusEngine::CloseSocket(Device & device)
+{
+	if (device.sock >= 0) {
+		close(device.sock);
+		device.sock = -1;
+	}
+}
+
+inline void ModbusEngine::FailDevice(Device & device, int err, DeviceState newState)
+{
+	std::vector<Request> failed;
+	std::map<unsigned short, Request>::iterator it;
+	size_t i;
+
+	CloseSocket(device);
+	device.state = newState;
+	device.wantWrite = false;
+	device.receiveBuffer.clear();
+	device.sendBuffer.clear();
+	device.sendOffset = 0;
+
+	// Collect first: completions may submit to other devices
+	for (it = device.inFlight.begin(); it != device.inFlight.end(); ++it) {
+		failed.push_back(it->second);
+	}
+	failed.insert(failed.end(), device.queued.begin(), device.queued.end());
+	device.inFlight.clear();
+	device.queued.clear();
+
+	for (i = 0; i < failed.size(); i++) {
+		Complete(failed[i], err, NULL, 0);
+	}
+}
+
+inline void ModbusEngine::Complete(Request & request, int err,
+	const unsigned char * response, int numBytes)
+{
+	double latencyUS = request.attempts == 0 ? 0.0 :
+		std::chrono::duration<double, std::micro>(Clock::now() - request.firstSent).count();
+
+	if (err == LJME_NOERROR) {
+		++stats.completed;
+	}
+	else {
+		++stats.failed;
+	}
+	--outstanding;
+	stats.totalLatencyUS += latencyUS;
+	if (latencyUS > stats.maxLatencyUS) {
+		stats.maxLatencyUS = latencyUS;
+	}
+
+	if (request.completion) {
+		request.completion(err, response, numBytes);
+	}
+}
+
+#endif // #define LJM_MODBUS_ENGINE
@@ -0,0 +1,497 @@
+/**
+ * Name: LJM_ModbusPipeline.h
+ * Desc: A Modbus TCP client that keeps several transactions in flight on one
+ *       connection and matches responses by transaction ID, instead of LJM's
+ *       strict one command, one response. Works over TCP or over UDP
+ *       (LJM_ctETHERNET_UDP uses LJM_ETHERNET_UDP_PORT). C++11, POSIX only.
+**/
+
+#ifndef LJM_MODBUS_PIPELINE
+#define LJM_MODBUS_PIPELINE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "LJM_ModbusTCP.h"
+
+enum ModbusTransport {
+	MODBUS_TRANSPORT_TCP,
+	MODBUS_TRANSPORT_UDP
+};
+
+/**
+ * Desc: Counters for a ModbusPipeline. Latency is measured from when a request
+ *       is first sent until it completes, including any retries.
+**/
+struct ModbusPipelineStats
+{
+	long long submitted;
+	long long completed;
+	long long failed;
+	long long retries;
+	long long staleResponses;
+	double totalLatencyUS;
+	double maxLatencyUS;
+};
+
+/**
+ * Name: ModbusPipeline
+ * Desc: Requests are sent in submission order while fewer than window requests
+ *       are unanswered. Each request gets a fresh transaction ID every time it
+ *       is sent; a request that is not answered within timeoutMS is resent up
+ *       to maxRetries times, then completed with LJME_NO_RESPONSE_BYTES_RECEIVED.
+ *       Responses to transaction IDs that are no longer outstanding (late
+ *       answers to retried requests) are counted and dropped.
+ * Note: Not thread-safe. Completions run inside Poll/Drain.
+**/
+class ModbusPipeline
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	ModbusPipeline(int window = 8, int timeoutMS = LJM_DEFAULT_ETHERNET_SEND_RECEIVE_TIMEOUT_MS,
+		int maxRetries = 1);
+	~ModbusPipeline();
+
+	/**
+	 * Desc: Connects to ipAddress:port. Blocks for at most timeoutMS.
+	 * Para: ipAddress, as returned by LJM_IPToNumber / LJM_GetHandleInfo.
+	 * Retr: LJME_NOERROR or LJME_CANNOT_CONNECT.
+	**/
+	int Connect(unsigned int ipAddress, int port, ModbusTransport transport);
+	void Close();
+	bool IsConnected() const { return sock >= 0; }
+
+	void SetWindow(int newWindow) { window = newWindow > 0 ? newWindow : 1; }
+	int GetWindow() const { return window; }
+
+	/**
+	 * Desc: Queues a request ADU. Its transaction ID is replaced when sent.
+	**/
+	void Submit(const unsigned char * adu, int numBytes, ModbusCompletion completion);
+	void Submit(const std::vector<unsigned char> & adu, ModbusCompletion completion);
+
+	/**
+	 * Desc: Sends what the window allows, then waits up to timeoutMS for
+	 *       responses. Returns the number of requests completed, or -1 if the
+	 *       connection failed (every outstanding request is then completed
+	 *       with LJME_SOCKET_LEVEL_ERROR).
+	**/
+	int Poll(int timeoutMS);
+
+	/**
+	 * Desc: Polls until every submitted request has completed.
+	 * Retr: LJME_NOERROR, or LJME_SOCKET_LEVEL_ERROR if the connection failed.
+	**/
+	int Drain();
+
+	int NumQueued() const { return (int)queued.size(); }
+	int NumInFlight() const { return (int)inFlight.size(); }
+
+	ModbusPipelineStats GetStats() const { return stats; }
+
+private:
+	struct Request
+	{
+		std::vector<unsigned char> adu;
+		ModbusCompletion completion;
+		Clock::time_point firstSent;
+		Clock::time_point deadline;
+		int attempts;
+	};
+
+	int SendAllowed();
+	int SendRequest(Request & request);
+	int ReceiveAvailable();
+	int HandleResponse(const unsigned char * response, int numBytes);
+	int ExpireTimedOut();
+	int FailAll(int err);
+	void Complete(Request & request, int err, const unsigned char * response, int numBytes);
+
+	int sock;
+	ModbusTransport transport;
+	int window;
+	std::chrono::milliseconds timeout;
+	int maxRetries;
+	unsigned short nextTransactionID;
+
+	std::deque<Request> queued;
+	std::map<unsigned short, Request> inFlight;
+	std::vector<unsigned char> receiveBuffer;
+	ModbusPipelineStats stats;
+};
+
+
+// Source
+
+inline ModbusPipeline::ModbusPipeline(int window, int timeoutMS, int maxRetries) :
+	sock(-1),
+	transport(MODBUS_TRANSPORT_TCP),
+	window(window > 0 ? window : 1),
+	timeout(timeoutMS),
+	maxRetries(maxRetries),
+	nextTransactionID(1)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+inline ModbusPipeline::~ModbusPipeline()
+{
+	Close();
+}
+
+inline int ModbusPipeline::Connect(unsigned int ipAddress, int port, ModbusTransport newTransport)
+{
+	struct sockaddr_in address;
+	struct pollfd pfd;
+	int flags, err, one = 1;
+	socklen_t errLen = sizeof(err);
+
+	Close();
+	transport = newTransport;
+
+	sock = socket(AF_INET, transport == MODBUS_TRANSPORT_TCP ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if (sock < 0) {
+		return LJME_CANNOT_CONNECT;
+	}
+
+	flags = fcntl(sock, F_GETFL, 0);
+	fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+	if (transport == MODBUS_TRANSPORT_TCP) {
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons((unsigned short)port);
+	address.sin_addr.s_addr = htonl(ipAddress);
+
+	if (connect(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		if (errno != EINPROGRESS) {
+			Close();
+			return LJME_CANNOT_CONNECT;
+		}
+		pfd.fd = sock;
+		pfd.events = POLLOUT;
+		if (poll(&pfd, 1, (int)timeout.count()) != 1 ||
+			getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &errLen) < 0 || err != 0)
+		{
+			Close();
+			return LJME_CANNOT_CONNECT;
+		}
+	}
+
+	return LJME_NOERROR;
+}
+
+inline void ModbusPipeline::Close()
+{
+	if (sock >= 0) {
+		close(sock);
+		sock = -1;
+	}
+	receiveBuffer.clear();
+}
+
+inline void ModbusPipeline::Submit(const unsigned char * adu, int numBytes,
+	ModbusCompletion completion)
+{
+	Request request;
+	request.adu.assign(adu, adu + numBytes);
+	request.completion = completion;
+	request.attempts = 0;
+	queued.push_back(request);
+	++stats.submitted;
+}
+
+inline void ModbusPipeline::Submit(const std::vector<unsigned char> & adu,
+	ModbusCompletion completion)
+{
+	Submit(&adu[0], (int)adu.size(), completion);
+}
+
+inline int ModbusPipeline::SendRequest(Request & request)
+{
+	size_t sent = 0;
+	ssize_t result;
+	int waitMS;
+	struct pollfd pfd;
+
+	SetTransactionID(&request.adu[0], nextTransactionID);
+	if (request.attempts == 0) {
+		request.firstSent = Clock::now();
+	}
+	request.deadline = Clock::now() + timeout;
+	++request.attempts;
+
+	// Requests are small, so wait for socket space rather than buffer
+	// partially sent requests, but no longer than the request's timeout
+	while (sent < request.adu.size()) {
+		result = send(sock, &request.adu[sent], request.adu.size() - sent, MSG_NOSIGNAL);
+		if (result > 0) {
+			sent += (size_t)result;
+			continue;
+		}
+		if (result < 0 && errno == EINTR) {
+			continue;
+		}
+		if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			waitMS = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+				request.deadline - Clock::now()).count();
+			pfd.fd = sock;
+			pfd.events = POLLOUT;
+			if (waitMS > 0 && (poll(&pfd, 1, waitMS) > 0 || errno == EINTR)) {
+				continue;
+			}
+		}
+		// A request cut off part way leaves the stream out of frame, so it
+		// only fails alone if none of it went out
+		return sent > 0 ? LJME_SOCKET_LEVEL_ERROR : LJME_NO_COMMAND_BYTES_SENT;
+	}
+
+	return LJME_NOERROR;
+}
+
+/**
+ * Desc: Sends queued requests while the window allows.
+ * Retr: LJME_NOERROR, or LJME_SOCKET_LEVEL_ERROR if a request was only
+ *       partly sent, after failing every request and closing the socket.
+**/
+inline int ModbusPipeline::SendAllowed()
+{
+	int err;
+
+	unsigned short transactionID;
+
+	while (!queued.empty() && (int)inFlight.size() < window) {
+		// Skip transaction IDs that are still outstanding
+		while (inFlight.count(nextTransactionID)) {
+			++nextTransactionID;
+		}
+		transactionID = nextTransactionID;
+
+		Request & request = inFlight[transactionID];
+		request = queued.front();
+		queued.pop_front();
+
+		err = SendRequest(request);
+		if (err == LJME_SOCKET_LEVEL_ERROR) {
+			FailAll(err);
+			return err;
+		}
+		if (err != LJME_NOERROR) {
+			Complete(request, err, NULL, 0);
+			inFlight.erase(transactionID);
+		}
+		++nextTransactionID;
+	}
+	return LJME_NOERROR;
+}
+
+inline int ModbusPipeline::HandleResponse(const unsigned char * response, int numBytes)
+{
+	std::map<unsigned short, Request>::iterator found =
+		inFlight.find(GetTransactionID(response));
+	if (found == inFlight.end()) {
+		++stats.staleResponses;
+		return 0;
+	}
+
+	Complete(found->second, LJME_NOERROR, response, numBytes);
+	inFlight.erase(found);
+	return 1;
+}
+
+inline int ModbusPipeline::ReceiveAvailable()
+{
+	unsigned char buffer[MODBUS_MAX_ADU_SIZE * 4];
+	ssize_t numRead;
+	size_t consumed;
+	int aduSize;
+	int numCompleted = 0;
+
+	while (true) {
+		numRead = recv(sock, buffer, sizeof(buffer), 0);
+		if (numRead < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return numCompleted;
+			}
+			return -1;
+		}
+		if (numRead == 0 && transport == MODBUS_TRANSPORT_TCP) {
+			return -1;
+		}
+
+		if (transport == MODBUS_TRANSPORT_UDP) {
+			// One datagram holds exactly one ADU
+			if (numRead >= MODBUS_LENGTH_PREFIX_SIZE &&
+				GetADUSize(buffer) == (int)numRead)
+			{
+				numCompleted += HandleResponse(buffer, (int)numRead);
+			}
+			continue;
+		}
+
+		receiveBuffer.insert(receiveBuffer.end(), buffer, buffer + numRead);
+		consumed = 0;
+		while (receiveBuffer.size() - consumed >= MODBUS_LENGTH_PREFIX_SIZE) {
+			aduSize = GetADUSize(&receiveBuffer[consumed]);
+			if (aduSize < 0) {
+				return -1;
+			}
+			if (receiveBuffer.size() - consumed < (size_t)aduSize) {
+				break;
+			}
+			numCompleted += HandleResponse(&receiveBuffer[consumed], aduSize);
+			consumed += (size_t)aduSize;
+		}
+		receiveBuffer.erase(receiveBuffer.begin(), receiveBuffer.begin() + consumed);
+	}
+}
+
+inline int ModbusPipeline::ExpireTimedOut()
+{
+	int numCompleted = 0;
+	Clock::time_point now = Clock::now();
+	std::map<unsigned short, Request>::iterator it = inFlight.begin();
+	std::vector<Request> resend;
+
+	while (it != inFlight.end()) {
+		if (it->second.deadline > now) {
+			++it;
+			continue;
+		}
+		if (it->second.attempts <= maxRetries) {
+			resend.push_back(it->second);
+		}
+		else {
+			Complete(it->second, LJME_NO_RESPONSE_BYTES_RECEIVED, NULL, 0);
+			++numCompleted;
+		}
+		inFlight.erase(it++);
+	}
+
+	// Retries go ahead of requests that have not been sent yet
+	for (size_t i = resend.size(); i > 0; i--) {
+		++stats.retries;
+		queued.push_front(resend[i - 1]);
+	}
+
+	return numCompleted;
+}
+
+inline int ModbusPipeline::FailAll(int err)
+{
+	int numCompleted = 0;
+	std::map<unsigned short, Request>::iterator it;
+
+	for (it = inFlight.begin(); it != inFlight.end(); ++it) {
+		Complete(it->second, err, NULL, 0);
+		++numCompleted;
+	}
+	inFlight.clear();
+
+	while (!queued.empty()) {
+		Complete(queued.front(), err, NULL, 0);
+		queued.pop_front();
+		++numCompleted;
+	}
+
+	Close();
+	return numCompleted;
+}
+
+inline int ModbusPipeline::Poll(int timeoutMS)
+{
+	struct pollfd pfd;
+	int numCompleted = 0, numReceived;
+	int waitMS = timeoutMS;
+	long long untilDeadline;
+	std::map<unsigned short, Request>::iterator it;
+
+	if (sock < 0) {
+		FailAll(LJME_SOCKET_LEVEL_ERROR);
+		return -1;
+	}
+
+	if (SendAllowed() != LJME_NOERROR) {
+		return -1;
+	}
+
+	// Don't sleep past the earliest request deadline
+	for (it = inFlight.begin(); it != inFlight.end(); ++it) {
+		untilDeadline = std::chrono::duration_cast<std::chrono::milliseconds>(
+			it->second.deadline - Clock::now()).count() + 1;
+		if (untilDeadline < waitMS) {
+			waitMS = untilDeadline > 0 ? (int)untilDeadline : 0;
+		}
+	}
+
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (!inFlight.empty() && poll(&pfd, 1, waitMS) > 0) {
+		if (pfd.revents & (POLLERR | POLLNVAL)) {
+			FailAll(LJME_SOCKET_LEVEL_ERROR);
+			return -1;
+		}
+		numReceived = ReceiveAvailable();
+		if (numReceived < 0) {
+			FailAll(LJME_SOCKET_LEVEL_ERROR);
+			return -1;
+		}
+		numCompleted += numReceived;
+	}
+
+	numCompleted += ExpireTimedOut();
+	if (SendAllowed() != LJME_NOERROR) {
+		return -1;
+	}
+
+	return numCompleted;
+}
+
+inline int ModbusPipeline::Drain()
+{
+	while (!queued.empty() || !inFlight.empty()) {
+		if (Poll((int)timeout.count()) < 0) {
+			return LJME_SOCKET_LEVEL_ERROR;
+		}
+	}
+	return LJME_NOERROR;
+}
+
+inline void ModbusPipeline::Complete(Request & request, int err,
+	const unsigned char * response, int numBytes)
+{
+	double latencyUS = request.attempts == 0 ? 0.0 :
+		std::chrono::duration<double, std::micro>(Clock::now() - request.firstSent).count();
+
+	if (err == LJME_NOERROR) {
+		++stats.completed;
+	}
+	else {
+		++stats.failed;
+	}
+	stats.totalLatencyUS += latencyUS;
+	if (latencyUS > stats.maxLatencyUS) {
+		stats.maxLatencyUS = latencyUS;
+	}
+
+	if (request.completion) {
+		request.completion(err, response, numBytes);
+	}
+}
+
+#endif // #define LJM_MODBUS_PIPELINE
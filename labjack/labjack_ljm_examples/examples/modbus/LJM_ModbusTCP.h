@@ -0,0 +1,274 @@
+/**
+ * Name: LJM_ModbusTCP.h
+ * Desc: Encodes and decodes Modbus TCP application data units (ADUs) for
+ *       LabJack devices without going through LJM_MBFBComm. Feedback (MBFB)
+ *       commands are byte-for-byte what LJM_AddressesToMBFB produces for the
+ *       same frames. C++ only.
+**/
+
+#ifndef LJM_MODBUS_TCP
+#define LJM_MODBUS_TCP
+
+#include <string.h>
+
+#include <functional>
+#include <vector>
+
+#include "LabJackM.h"
+
+#include "../LJM_FramePlan.h"
+
+// MBAP header: transaction ID (2), protocol ID (2), length (2), unit ID (1)
+enum { MODBUS_MBAP_SIZE = 7 };
+
+// Bytes needed to know the size of a whole ADU
+enum { MODBUS_LENGTH_PREFIX_SIZE = 6 };
+
+enum {
+	MODBUS_FUNCTION_READ_HOLDING_REGISTERS = 0x03,
+	MODBUS_FUNCTION_WRITE_MULTIPLE_REGISTERS = 0x10,
+	MODBUS_FUNCTION_FEEDBACK = 0x4C,
+	MODBUS_EXCEPTION_FLAG = 0x80
+};
+
+// Largest ADU a T7 sends or receives over TCP
+enum { MODBUS_MAX_ADU_SIZE = 1040 };
+
+/**
+ * Desc: Called once per request submitted to a ModbusPipeline or ModbusEngine.
+ *       On success, err is LJME_NOERROR and response/numBytes is the response
+ *       ADU, valid only during the call.
+**/
+typedef std::function<void(int err, const unsigned char * response, int numBytes)>
+	ModbusCompletion;
+
+/**
+ * Desc: Reads/writes the big-endian 16-bit field at bytes[0] and bytes[1].
+**/
+unsigned short GetBigEndian16(const unsigned char * bytes);
+void SetBigEndian16(unsigned char * bytes, unsigned short value);
+
+/**
+ * Desc: Accessors for the MBAP header of an ADU.
+**/
+unsigned short GetTransactionID(const unsigned char * adu);
+void SetTransactionID(unsigned char * adu, unsigned short transactionID);
+
+/**
+ * Desc: Returns the total size of the ADU whose first MODBUS_LENGTH_PREFIX_SIZE
+ *       bytes are header, or -1 if the header is not a valid Modbus TCP header.
+**/
+int GetADUSize(const unsigned char * header);
+
+/**
+ * Desc: Encodes the frames of packet as a Feedback command.
+ * Para: packet, a packet from FramePlan::Packets().
+ *       aValues, the plan's values. Values are read from
+ *           aValues[packet.valueOffset] onwards.
+ *       unitID, LJM_DEFAULT_UNIT_ID unless the device documentation says otherwise.
+ *       transactionID, written into the MBAP header.
+ *       command, output. Replaced with the encoded ADU.
+ * Retr: LJME_NOERROR, or LJME_UNKNOWN_VALUE_TYPE for an unsupported type.
+**/
+int EncodeFeedbackCommand(const PlanPacket & packet, const double * aValues,
+	unsigned char unitID, unsigned short transactionID,
+	std::vector<unsigned char> & command);
+
+/**
+ * Desc: Decodes a Feedback response to a command encoded from packet, updating
+ *       the read values in aValues like LJM_UpdateValues does.
+ * Para: errorAddress, updated with the address of the frame that caused an
+ *           exception response, if known. May be NULL.
+ * Retr: LJME_NOERROR, a LJME_MBE* error for exception responses, or
+ *       LJME_INCORRECT_NUM_RESPONSE_BYTES_RECEIVED if the response is truncated.
+**/
+int DecodeFeedbackResponse(const unsigned char * response, int numBytes,
+	const PlanPacket & packet, double * aValues, int * errorAddress);
+
+/**
+ * Desc: Encodes a value of type as big-endian bytes at bytes, returning the
+ *       number of bytes written. Returns -1 for an unsupported type.
+**/
+int EncodeModbusValue(int type, double value, unsigned char * bytes);
+
+/**
+ * Desc: Decodes a big-endian value of type at bytes.
+**/
+double DecodeModbusValue(int type, const unsigned char * bytes);
+
+
+// Source
+
+inline unsigned short GetBigEndian16(const unsigned char * bytes)
+{
+	return (unsigned short)((bytes[0] << 8) | bytes[1]);
+}
+
+inline void SetBigEndian16(unsigned char * bytes, unsigned short value)
+{
+	bytes[0] = (unsigned char)(value >> 8);
+	bytes[1] = (unsigned char)(value & 0xFF);
+}
+
+inline unsigned short GetTransactionID(const unsigned char * adu)
+{
+	return GetBigEndian16(adu);
+}
+
+inline void SetTransactionID(unsigned char * adu, unsigned short transactionID)
+{
+	SetBigEndian16(adu, transactionID);
+}
+
+inline int GetADUSize(const unsigned char * header)
+{
+	int length = GetBigEndian16(header + 4);
+	if (GetBigEndian16(header + 2) != 0 || length < 2 ||
+		length + MODBUS_LENGTH_PREFIX_SIZE > MODBUS_MAX_ADU_SIZE)
+	{
+		return -1;
+	}
+	return MODBUS_LENGTH_PREFIX_SIZE + length;
+}
+
+inline int EncodeModbusValue(int type, double value, unsigned char * bytes)
+{
+	unsigned int u32;
+	float f32;
+
+	if (type == LJM_UINT16) {
+		SetBigEndian16(bytes, (unsigned short)value);
+		return 2;
+	}
+	if (type == LJM_BYTE) {
+		bytes[0] = (unsigned char)value;
+		return 1;
+	}
+	if (type == LJM_FLOAT32) {
+		f32 = (float)value;
+		memcpy(&u32, &f32, sizeof(u32));
+	}
+	else if (type == LJM_INT32) {
+		u32 = (unsigned int)(int)value;
+	}
+	else if (type == LJM_UINT32) {
+		u32 = (unsigned int)value;
+	}
+	else {
+		return -1;
+	}
+	SetBigEndian16(bytes, (unsigned short)(u32 >> 16));
+	SetBigEndian16(bytes + 2, (unsigned short)(u32 & 0xFFFF));
+	return 4;
+}
+
+inline double DecodeModbusValue(int type, const unsigned char * bytes)
+{
+	unsigned int u32;
+	float f32;
+
+	if (type == LJM_UINT16) {
+		return GetBigEndian16(bytes);
+	}
+	if (type == LJM_BYTE) {
+		return bytes[0];
+	}
+	u32 = ((unsigned int)GetBigEndian16(bytes) << 16) | GetBigEndian16(bytes + 2);
+	if (type == LJM_FLOAT32) {
+		memcpy(&f32, &u32, sizeof(f32));
+		return f32;
+	}
+	if (type == LJM_INT32) {
+		return (int)u32;
+	}
+	return u32;
+}
+
+inline int EncodeFeedbackCommand(const PlanPacket & packet, const double * aValues,
+	unsigned char unitID, unsigned short transactionID,
+	std::vector<unsigned char> & command)
+{
+	size_t frameI;
+	int valueI, registers, numBytes, offset;
+	const double * values = aValues + packet.valueOffset;
+
+	command.assign(MBFB_HEADER_SIZE, 0);
+	SetTransactionID(&command[0], transactionID);
+	command[6] = unitID;
+	command[7] = MODBUS_FUNCTION_FEEDBACK;
+
+	for (frameI = 0; frameI < packet.aAddresses.size(); frameI++) {
+		registers = NumRegistersForValues(packet.aTypes[frameI], packet.aNumValues[frameI]);
+		offset = (int)command.size();
+		command.resize(command.size() + MBFB_FRAME_HEADER_SIZE);
+		command[offset] = (unsigned char)(packet.aWrites[frameI] == LJM_WRITE ? 1 : 0);
+		SetBigEndian16(&command[offset + 1], (unsigned short)packet.aAddresses[frameI]);
+		command[offset + 3] = (unsigned char)registers;
+
+		if (packet.aWrites[frameI] == LJM_WRITE) {
+			offset = (int)command.size();
+			command.resize(command.size() + registers * LJM_BYTES_PER_REGISTER, 0);
+			for (valueI = 0; valueI < packet.aNumValues[frameI]; valueI++) {
+				numBytes = EncodeModbusValue(packet.aTypes[frameI], values[valueI],
+					&command[offset]);
+				if (numBytes < 0) {
+					return LJME_UNKNOWN_VALUE_TYPE;
+				}
+				offset += numBytes;
+			}
+		}
+		values += packet.aNumValues[frameI];
+	}
+
+	SetBigEndian16(&command[4], (unsigned short)(command.size() - MODBUS_LENGTH_PREFIX_SIZE));
+	return LJME_NOERROR;
+}
+
+inline int DecodeFeedbackResponse(const unsigned char * response, int numBytes,
+	const PlanPacket & packet, double * aValues, int * errorAddress)
+{
+	size_t frameI;
+	int valueI, step, frameIndex;
+	int offset = MBFB_HEADER_SIZE;
+	double * values = aValues + packet.valueOffset;
+
+	if (numBytes < MBFB_HEADER_SIZE) {
+		return LJME_INCORRECT_NUM_RESPONSE_BYTES_RECEIVED;
+	}
+
+	if (response[7] & MODBUS_EXCEPTION_FLAG) {
+		// Exception responses carry the Modbus exception code, then the index
+		// of the frame that failed
+		if (numBytes > 9 && errorAddress != NULL) {
+			frameIndex = response[9];
+			if (frameIndex < (int)packet.aAddresses.size()) {
+				*errorAddress = packet.aAddresses[frameIndex];
+			}
+		}
+		return numBytes > 8 ? LJME_MBE1_ILLEGAL_FUNCTION - 1 + response[8] :
+			LJME_UNKNOWN_ERROR;
+	}
+
+	if (numBytes != packet.responseBytes) {
+		return LJME_INCORRECT_NUM_RESPONSE_BYTES_RECEIVED;
+	}
+
+	for (frameI = 0; frameI < packet.aAddresses.size(); frameI++) {
+		if (packet.aWrites[frameI] == LJM_READ) {
+			step = packet.aTypes[frameI] == LJM_UINT16 ? 2 :
+				packet.aTypes[frameI] == LJM_BYTE ? 1 : 4;
+			for (valueI = 0; valueI < packet.aNumValues[frameI]; valueI++) {
+				values[valueI] = DecodeModbusValue(packet.aTypes[frameI],
+					response + offset);
+				offset += step;
+			}
+			// Odd byte counts are padded to a whole register
+			offset += (packet.aNumValues[frameI] * step) % 2;
+		}
+		values += packet.aNumValues[frameI];
+	}
+
+	return LJME_NOERROR;
+}
+
+#endif // #define LJM_MODBUS_TCP
@@ -0,0 +1,642 @@
+/**
+ * Name: ModbusStandIn.h
+ * Desc: A local Modbus TCP/UDP server that stands in for a LabJack device when
+ *       testing or benchmarking network code without hardware. It serves an
+ *       in-memory register space through Read Holding Registers (0x03), Write
+ *       Multiple Registers (0x10) and Feedback (0x4C), and can delay responses
+ *       to imitate network and device latency. It can also emulate a T7's Lua
+ *       debug buffer. C++11, POSIX only.
+**/
+
+#ifndef MODBUS_STAND_IN
+#define MODBUS_STAND_IN
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LJM_ModbusTCP.h"
+
+enum { MODBUS_NUM_REGISTERS = 65536 };
+
+// LUA_DEBUG_NUM_BYTES and LUA_DEBUG_DATA
+enum {
+	STAND_IN_LUA_DEBUG_NUM_BYTES_ADDRESS = 6022,
+	STAND_IN_LUA_DEBUG_DATA_ADDRESS = 6024
+};
+
+/**
+ * Name: ModbusStandIn
+ * Desc: Serves any number of TCP connections and a UDP socket from one thread.
+ *       Each TCP connection behaves like a separate device connection; all of
+ *       them share the register space. Responses are sent in order per
+ *       connection, responseDelayUS after the request arrived, so several
+ *       requests can be "on the wire" at once like on a real network.
+**/
+class ModbusStandIn
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	ModbusStandIn(unsigned int responseDelayUS = 0);
+	~ModbusStandIn();
+
+	/**
+	 * Desc: Starts serving on ipAddress, 127.0.0.1 by default. A port of 0
+	 *       picks a free port; see GetTCPPort/GetUDPPort. A negative udpPort
+	 *       disables UDP.
+	 * Note: LJM only connects to port 502. On Linux every 127.x.x.x address
+	 *       is local, so several stand-ins on port 502 and different
+	 *       ipAddresses can play several devices.
+	 * Retr: LJME_NOERROR or LJME_SOCKET_LEVEL_ERROR.
+	**/
+	int Start(int tcpPort = 0, int udpPort = -1, unsigned int ipAddress = INADDR_LOOPBACK);
+	void Stop();
+
+	int GetTCPPort() const { return tcpPort; }
+	int GetUDPPort() const { return udpPort; }
+
+	/**
+	 * Desc: The IPv4 address the stand-in listens on, in LJM_IPToNumber form.
+	**/
+	unsigned int GetIPAddress() const { return ipAddress; }
+
+	void SetResponseDelayUS(unsigned int delayUS) { responseDelayUS = delayUS; }
+
+	void SetRegister(int address, unsigned short value);
+	unsigned short GetRegister(int address);
+
+	/**
+	 * Desc: Stores value at address as type, big-endian like a device does.
+	**/
+	void SetValue(int address, int type, double value);
+	double GetValue(int address, int type);
+
+	/**
+	 * Desc: Emulates a T7's Lua debug buffer of bufferSize bytes, or stops
+	 *       emulating it if bufferSize is 0. LUA_DEBUG_NUM_BYTES then reads
+	 *       the bytes waiting, and each register read from LUA_DEBUG_DATA
+	 *       takes the next two bytes out of the buffer, padded with 0.
+	**/
+	void SetLuaDebugBufferSize(int bufferSize);
+
+	/**
+	 * Desc: Adds text to the Lua debug buffer, as a script's print does. Text
+	 *       that doesn't fit is dropped whole.
+	 * Retr: The number of bytes dropped.
+	**/
+	int LuaPrint(const std::string & text);
+
+	long long LuaDebugBytesDropped();
+
+	long long NumRequests() const { return numRequests; }
+	int NumConnections();
+
+private:
+	struct PendingResponse
+	{
+		Clock::time_point due;
+		std::vector<unsigned char> adu;
+	};
+
+	struct Connection
+	{
+		std::vector<unsigned char> received;
+		std::deque<PendingResponse> responses;
+		std::vector<unsigned char> unsent;
+	};
+
+	struct UDPResponse
+	{
+		Clock::time_point due;
+		struct sockaddr_in peer;
+		std::vector<unsigned char> adu;
+	};
+
+	void Run();
+	void Accept();
+	bool ReadConnection(int fd, Connection & connection);
+	bool FlushConnection(int fd, Connection & connection);
+	void ReadUDP();
+	void Respond(const unsigned char * request, int numBytes,
+		std::vector<unsigned char> & response);
+	void ReadRegisters(int address, int count, std::vector<unsigned char> & response);
+	void RespondException(const unsigned char * request, int exceptionCode,
+		int frameIndex, std::vector<unsigned char> & response);
+
+	std::atomic<unsigned int> responseDelayUS;
+	int listenSock;
+	int udpSock;
+	int tcpPort;
+	int udpPort;
+	unsigned int ipAddress;
+	int wakePipe[2];
+	std::atomic<bool> running;
+	std::atomic<long long> numRequests;
+
+	// Guarded by registerMutex
+	std::mutex registerMutex;
+	std::vector<unsigned short> registers;
+	int luaDebugBufferSize;
+	std::string luaDebug;
+	long long luaDebugDropped;
+
+	std::mutex connectionMutex;
+	std::map<int, Connection> connections;
+	std::deque<UDPResponse> udpResponses;
+	std::thread server;
+};
+
+
+// Source
+
+inline ModbusStandIn::ModbusStandIn(unsigned int responseDelayUS) :
+	responseDelayUS(responseDelayUS),
+	listenSock(-1),
+	udpSock(-1),
+	tcpPort(0),
+	udpPort(0),
+	ipAddress(INADDR_LOOPBACK),
+	running(false),
+	numRequests(0),
+	registers(MODBUS_NUM_REGISTERS, 0),
+	luaDebugBufferSize(0),
+	luaDebugDropped(0)
+{
+	wakePipe[0] = wakePipe[1] = -1;
+}
+
+inline ModbusStandIn::~ModbusStandIn()
+{
+	Stop();
+}
+
+static inline int ModbusStandInBind(int type, unsigned int ipAddress, int port,
+	int * boundPort)
+{
+	struct sockaddr_in address;
+	socklen_t addressLen = sizeof(address);
+	int one = 1;
+	int sock = socket(AF_INET, type, 0);
+	if (sock < 0) {
+		return -1;
+	}
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons((unsigned short)port);
+	address.sin_addr.s_addr = htonl(ipAddress);
+	if (bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+		(type == SOCK_STREAM && listen(sock, 1024) < 0) ||
+		getsockname(sock, (struct sockaddr *)&address, &addressLen) < 0)
+	{
+		close(sock);
+		return -1;
+	}
+	*boundPort = ntohs(address.sin_port);
+	return sock;
+}
+
+inline int ModbusStandIn::Start(int newTCPPort, int newUDPPort, unsigned int newIPAddress)
+{
+	Stop();
+
+	ipAddress = newIPAddress;
+	listenSock = ModbusStandInBind(SOCK_STREAM, ipAddress, newTCPPort, &tcpPort);
+	if (listenSock < 0) {
+		return LJME_SOCKET_LEVEL_ERROR;
+	}
+	if (newUDPPort >= 0) {
+		udpSock = ModbusStandInBind(SOCK_DGRAM, ipAddress, newUDPPort, &udpPort);
+		if (udpSock < 0) {
+			Stop();
+			return LJME_SOCKET_LEVEL_ERROR;
+		}
+	}
+	if (pipe(wakePipe) < 0) {
+		Stop();
+		return LJME_SOCKET_LEVEL_ERROR;
+	}
+
+	running = true;
+	server = std::thread(&ModbusStandIn::Run, this);
+	return LJME_NOERROR;
+}
+
+inline void ModbusStandIn::Stop()
+{
+	std::map<int, Connection>::iterator it;
+
+	if (running) {
+		running = false;
+		if (write(wakePipe[1], "x", 1) < 0) {
+			// The server thread still notices running within its poll timeout
+		}
+		server.join();
+	}
+
+	for (it = connections.begin(); it != connections.end(); ++it) {
+		close(it->first);
+	}
+	connections.clear();
+	udpResponses.clear();
+
+	if (listenSock >= 0) {
+		close(listenSock);
+		listenSock = -1;
+	}
+	if (udpSock >= 0) {
+		close(udpSock);
+		udpSock = -1;
+	}
+	if (wakePipe[0] >= 0) {
+		close(wakePipe[0]);
+		close(wakePipe[1]);
+		wakePipe[0] = wakePipe[1] = -1;
+	}
+}
+
+inline void ModbusStandIn::SetRegister(int address, unsigned short value)
+{
+	std::lock_guard<std::mutex> lock(registerMutex);
+	registers[address & 0xFFFF] = value;
+}
+
+inline unsigned short ModbusStandIn::GetRegister(int address)
+{
+	std::lock_guard<std::mutex> lock(registerMutex);
+	return registers[address & 0xFFFF];
+}
+
+inline void ModbusStandIn::SetValue(int address, int type, double value)
+{
+	unsigned char bytes[4] = {0, 0, 0, 0};
+	int numBytes = EncodeModbusValue(type, value, bytes);
+	int regI;
+
+	std::lock_guard<std::mutex> lock(registerMutex);
+	for (regI = 0; regI * 2 < numBytes; regI++) {
+		registers[(address + regI) & 0xFFFF] = GetBigEndian16(bytes + regI * 2);
+	}
+}
+
+inline double ModbusStandIn::GetValue(int address, int type)
+{
+	unsigned char bytes[4];
+	std::lock_guard<std::mutex> lock(registerMutex);
+	SetBigEndian16(bytes, registers[address & 0xFFFF]);
+	SetBigEndian16(bytes + 2, registers[(address + 1) & 0xFFFF]);
+	return DecodeModbusValue(type, bytes);
+}
+
+inline void ModbusStandIn::SetLuaDebugBufferSize(int bufferSize)
+{
+	std::lock_guard<std::mutex> lock(registerMutex);
+	luaDebugBufferSize = bufferSize;
+	luaDebug.clear();
+}
+
+inline int ModbusStandIn::LuaPrint(const std::string & text)
+{
+	std::lock_guard<std::mutex> lock(registerMutex);
+	if (luaDebug.size() + text.size() > (size_t)luaDebugBufferSize) {
+		luaDebugDropped += (long long)text.size();
+		return (int)text.size();
+	}
+	luaDebug += text;
+	return 0;
+}
+
+inline long long ModbusStandIn::LuaDebugBytesDropped()
+{
+	std::lock_guard<std::mutex> lock(registerMutex);
+	return luaDebugDropped;
+}
+
+inline int ModbusStandIn::NumConnections()
+{
+	std::lock_guard<std::mutex> lock(connectionMutex);
+	return (int)connections.size();
+}
+
+inline void ModbusStandIn::RespondException(const unsigned char * request,
+	int exceptionCode, int frameIndex, std::vector<unsigned char> & response)
+{
+	response.assign(request, request + MODBUS_MBAP_SIZE);
+	response.push_back((unsigned char)(request[7] | MODBUS_EXCEPTION_FLAG));
+	response.push_back((unsigned char)exceptionCode);
+	if (frameIndex >= 0) {
+		response.push_back((unsigned char)frameIndex);
+	}
+	SetBigEndian16(&response[4], (unsigned short)(response.size() - MODBUS_LENGTH_PREFIX_SIZE));
+}
+
+inline void ModbusStandIn::Respond(const unsigned char * request, int numBytes,
+	std::vector<unsigned char> & response)
+{
+	int function = request[7];
+	int address, count, regI, offset, frameIndex;
+
+	++numRequests;
+	response.assign(request, request + MBFB_HEADER_SIZE);
+
+	std::lock_guard<std::mutex> lock(registerMutex);
+
+	if (function == MODBUS_FUNCTION_READ_HOLDING_REGISTERS && numBytes >= 12) {
+		address = GetBigEndian16(request + 8);
+		count = GetBigEndian16(request + 10);
+		if (count < 1 || count > 125 || address + count > MODBUS_NUM_REGISTERS) {
+			RespondException(request, 2, -1, response);
+			return;
+		}
+		response.push_back((unsigned char)(count * 2));
+		ReadRegisters(address, count, response);
+	}
+	else if (function == MODBUS_FUNCTION_WRITE_MULTIPLE_REGISTERS && numBytes >= 13) {
+		address = GetBigEndian16(request + 8);
+		count = GetBigEndian16(request + 10);
+		if (count < 1 || address + count > MODBUS_NUM_REGISTERS ||
+			numBytes < 13 + count * 2)
+		{
+			RespondException(request, 2, -1, response);
+			return;
+		}
+		for (regI = 0; regI < count; regI++) {
+			registers[address + regI] = GetBigEndian16(request + 13 + regI * 2);
+		}
+		response.insert(response.end(), request + 8, request + 12);
+	}
+	else if (function == MODBUS_FUNCTION_FEEDBACK) {
+		offset = MBFB_HEADER_SIZE;
+		frameIndex = 0;
+		while (offset + MBFB_FRAME_HEADER_SIZE <= numBytes) {
+			address = GetBigEndian16(request + offset + 1);
+			count = request[offset + 3];
+			if (address + count > MODBUS_NUM_REGISTERS) {
+				RespondException(request, 2, frameIndex, response);
+				return;
+			}
+			if (request[offset] == 1) {
+				if (offset + MBFB_FRAME_HEADER_SIZE + count * 2 > numBytes) {
+					RespondException(request, 3, frameIndex, response);
+					return;
+				}
+				for (regI = 0; regI < count; regI++) {
+					registers[address + regI] = GetBigEndian16(
+						request + offset + MBFB_FRAME_HEADER_SIZE + regI * 2);
+				}
+				offset += MBFB_FRAME_HEADER_SIZE + count * 2;
+			}
+			else {
+				ReadRegisters(address, count, response);
+				offset += MBFB_FRAME_HEADER_SIZE;
+			}
+			++frameIndex;
+		}
+	}
+	else {
+		RespondException(request, 1, -1, response);
+		return;
+	}
+
+	SetBigEndian16(&response[4], (unsigned short)(response.size() - MODBUS_LENGTH_PREFIX_SIZE));
+}
+
+inline void ModbusStandIn::ReadRegisters(int address, int count,
+	std::vector<unsigned char> & response)
+{
+	int regI, byteI;
+	unsigned short value;
+
+	if (luaDebugBufferSize > 0 && address == STAND_IN_LUA_DEBUG_DATA_ADDRESS) {
+		// A buffer register: every register read takes the next two bytes
+		for (byteI = 0; byteI < count * 2; byteI++) {
+			response.push_back(byteI < (int)luaDebug.size() ?
+				(unsigned char)luaDebug[byteI] : 0);
+		}
+		luaDebug.erase(0, std::min(luaDebug.size(), (size_t)count * 2));
+		return;
+	}
+
+	for (regI = 0; regI < count; regI++) {
+		value = registers[address + regI];
+		if (luaDebugBufferSize > 0) {
+			if (address + regI == STAND_IN_LUA_DEBUG_NUM_BYTES_ADDRESS) {
+				value = (unsigned short)(luaDebug.size() >> 16);
+			}
+			else if (address + regI == STAND_IN_LUA_DEBUG_NUM_BYTES_ADDRESS + 1) {
+				value = (unsigned short)(luaDebug.size() & 0xFFFF);
+			}
+		}
+		response.push_back((unsigned char)(value >> 8));
+		response.push_back((unsigned char)(value & 0xFF));
+	}
+}
+
+inline void ModbusStandIn::Accept()
+{
+	int fd, one = 1;
+	while ((fd = accept(listenSock, NULL, NULL)) >= 0) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		std::lock_guard<std::mutex> lock(connectionMutex);
+		connections[fd] = Connection();
+	}
+}
+
+inline bool ModbusStandIn::ReadConnection(int fd, Connection & connection)
+{
+	unsigned char buffer[MODBUS_MAX_ADU_SIZE * 4];
+	ssize_t numRead;
+	size_t consumed;
+	int aduSize;
+	PendingResponse pending;
+
+	while (true) {
+		numRead = recv(fd, buffer, sizeof(buffer), 0);
+		if (numRead == 0) {
+			return false;
+		}
+		if (numRead < 0) {
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+
+		connection.received.insert(connection.received.end(), buffer, buffer + numRead);
+		consumed = 0;
+		while (connection.received.size() - consumed >= MBFB_HEADER_SIZE) {
+			aduSize = GetADUSize(&connection.received[consumed]);
+			if (aduSize < MBFB_HEADER_SIZE) {
+				return false;
+			}
+			if (connection.received.size() - consumed < (size_t)aduSize) {
+				break;
+			}
+			pending.due = Clock::now() + std::chrono::microseconds(responseDelayUS.load());
+			Respond(&connection.received[consumed], aduSize, pending.adu);
+			connection.responses.push_back(pending);
+			consumed += (size_t)aduSize;
+		}
+		connection.received.erase(connection.received.begin(),
+			connection.received.begin() + consumed);
+	}
+}
+
+inline bool ModbusStandIn::FlushConnection(int fd, Connection & connection)
+{
+	ssize_t sent;
+	Clock::time_point now = Clock::now();
+
+	while (!connection.responses.empty() && connection.responses.front().due <= now) {
+		connection.unsent.insert(connection.unsent.end(),
+			connection.responses.front().adu.begin(), connection.responses.front().adu.end());
+		connection.responses.pop_front();
+	}
+
+	if (!connection.unsent.empty()) {
+		sent = send(fd, &connection.unsent[0], connection.unsent.size(), MSG_NOSIGNAL);
+		if (sent < 0) {
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		connection.unsent.erase(connection.unsent.begin(), connection.unsent.begin() + sent);
+	}
+	return true;
+}
+
+inline void ModbusStandIn::ReadUDP()
+{
+	unsigned char buffer[MODBUS_MAX_ADU_SIZE];
+	ssize_t numRead;
+	socklen_t peerLen;
+	UDPResponse pending;
+
+	while (true) {
+		peerLen = sizeof(pending.peer);
+		numRead = recvfrom(udpSock, buffer, sizeof(buffer), 0,
+			(struct sockaddr *)&pending.peer, &peerLen);
+		if (numRead < 0) {
+			return;
+		}
+		if (numRead < MBFB_HEADER_SIZE || GetADUSize(buffer) != (int)numRead) {
+			continue;
+		}
+		pending.due = Clock::now() + std::chrono::microseconds(responseDelayUS.load());
+		Respond(buffer, (int)numRead, pending.adu);
+		udpResponses.push_back(pending);
+	}
+}
+
+inline void ModbusStandIn::Run()
+{
+	std::vector<struct pollfd> fds;
+	std::vector<int> closed;
+	std::map<int, Connection>::iterator it;
+	struct pollfd pfd;
+	size_t fdI;
+	long long waitNS;
+	struct timespec wait;
+	Clock::time_point now, nextDue;
+
+	while (running) {
+		fds.clear();
+		pfd.revents = 0;
+		pfd.fd = wakePipe[0];
+		pfd.events = POLLIN;
+		fds.push_back(pfd);
+		pfd.fd = listenSock;
+		fds.push_back(pfd);
+		if (udpSock >= 0) {
+			pfd.fd = udpSock;
+			fds.push_back(pfd);
+		}
+
+		now = Clock::now();
+		nextDue = now + std::chrono::milliseconds(100);
+		{
+			std::lock_guard<std::mutex> lock(connectionMutex);
+			for (it = connections.begin(); it != connections.end(); ++it) {
+				pfd.fd = it->first;
+				pfd.events = POLLIN;
+				if (!it->second.unsent.empty()) {
+					pfd.events |= POLLOUT;
+				}
+				fds.push_back(pfd);
+				if (!it->second.responses.empty() &&
+					it->second.responses.front().due < nextDue)
+				{
+					nextDue = it->second.responses.front().due;
+				}
+			}
+		}
+		if (!udpResponses.empty() && udpResponses.front().due < nextDue) {
+			nextDue = udpResponses.front().due;
+		}
+
+		// Microsecond response delays need a finer timeout than poll's
+		waitNS = std::chrono::duration_cast<std::chrono::nanoseconds>(nextDue - now).count();
+		if (waitNS < 0) {
+			waitNS = 0;
+		}
+		wait.tv_sec = (time_t)(waitNS / 1000000000LL);
+		wait.tv_nsec = (long)(waitNS % 1000000000LL);
+		ppoll(&fds[0], fds.size(), &wait, NULL);
+
+		if (fds[1].revents & POLLIN) {
+			Accept();
+		}
+		if (udpSock >= 0 && (fds[2].revents & POLLIN)) {
+			ReadUDP();
+		}
+
+		std::lock_guard<std::mutex> lock(connectionMutex);
+		closed.clear();
+		for (fdI = udpSock >= 0 ? 3 : 2; fdI < fds.size(); fdI++) {
+			it = connections.find(fds[fdI].fd);
+			if (it == connections.end()) {
+				continue;
+			}
+			if ((fds[fdI].revents & (POLLIN | POLLHUP | POLLERR)) &&
+				!ReadConnection(it->first, it->second))
+			{
+				closed.push_back(it->first);
+			}
+		}
+		for (it = connections.begin(); it != connections.end(); ++it) {
+			if (!FlushConnection(it->first, it->second)) {
+				closed.push_back(it->first);
+			}
+		}
+		for (fdI = 0; fdI < closed.size(); fdI++) {
+			if (connections.erase(closed[fdI])) {
+				close(closed[fdI]);
+			}
+		}
+
+		now = Clock::now();
+		while (!udpResponses.empty() && udpResponses.front().due <= now) {
+			UDPResponse & response = udpResponses.front();
+			sendto(udpSock, &response.adu[0], response.adu.size(), 0,
+				(struct sockaddr *)&response.peer, sizeof(response.peer));
+			udpResponses.pop_front();
+		}
+	}
+}
+
+#endif // #define MODBUS_STAND_IN
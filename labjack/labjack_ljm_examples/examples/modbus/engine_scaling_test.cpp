@@ -0,0 +1,186 @@
+/**
+ * Name: engine_scaling_test.cpp
+ * Desc: Measures how a single-threaded ModbusEngine scales with the number of
+ *       device connections. Every device reads AIN0 with a Feedback command in
+ *       a closed loop (one request in flight per device, like a T7
+ *       connection) for DURATION_MS, and the total requests per second and
+ *       latency are printed per device count.
+ * Usage: engine_scaling_test [IP address ...]
+ *        With IP addresses, opens one connection to each device at those
+ *        addresses. Without, connects to a local ModbusStandIn with a
+ *        simulated network delay, with increasing numbers of connections.
+**/
+
+// For printf
+#include <stdio.h>
+
+#include <chrono>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_ModbusEngine.h"
+#include "ModbusStandIn.h"
+
+enum { DURATION_MS = 1000 };
+
+// Simulated network delay of the stand-in, in microseconds
+enum { STAND_IN_DELAY_US = 500 };
+
+const int DEVICE_COUNTS[] = {1, 4, 16, 64, 256};
+enum { NUM_DEVICE_COUNTS = sizeof(DEVICE_COUNTS) / sizeof(DEVICE_COUNTS[0]) };
+
+/**
+ * Name: ScalingClient
+ * Desc: Keeps one Feedback read in flight on every device of an engine until
+ *       Stop is called, and counts the responses that fail to decode.
+**/
+class ScalingClient
+{
+public:
+	ScalingClient(ModbusEngine & engine, const std::vector<unsigned char> & command,
+		const PlanPacket & packet);
+
+	void Start(const std::vector<int> & deviceIDs);
+	void Stop() { running = false; }
+
+	int NumErrors() const { return numErrors; }
+
+private:
+	void SubmitNext(int deviceID);
+
+	ModbusEngine & engine;
+	const std::vector<unsigned char> & command;
+	const PlanPacket & packet;
+	std::vector<double> values;
+	bool running;
+	int numErrors;
+};
+
+/**
+ * Desc: Connects numDevices times to ipAddresses (cycling through them),
+ *       runs the closed loop for DURATION_MS and prints one result row.
+**/
+void ScalingTest(const std::vector<unsigned int> & ipAddresses, int port, int numDevices,
+	FramePlan & plan, const std::vector<unsigned char> & command);
+
+int main(int argc, char * argv[])
+{
+	int i;
+	std::vector<unsigned int> ipAddresses;
+	int port = LJM_TCP_PORT;
+	ModbusStandIn standIn(STAND_IN_DELAY_US);
+	FramePlan plan(LJM_MAX_ETHERNET_PACKET_NUM_BYTES_T7);
+	std::vector<unsigned char> command;
+
+	plan.AddRead(0, LJM_FLOAT32);
+	ErrorCheck(EncodeFeedbackCommand(plan.Packets()[0], plan.Values(),
+		LJM_DEFAULT_UNIT_ID, 0, command), "EncodeFeedbackCommand");
+
+	for (i = 1; i < argc; i++) {
+		ipAddresses.push_back(IPToNumber(argv[i]));
+	}
+	if (ipAddresses.empty()) {
+		ErrorCheck(standIn.Start(), "ModbusStandIn::Start");
+		ipAddresses.push_back(standIn.GetIPAddress());
+		port = standIn.GetTCPPort();
+		printf("Testing against a local Modbus stand-in with %d us response delay\n\n",
+			STAND_IN_DELAY_US);
+	}
+
+	printf("%8s %12s %12s %12s %12s %8s\n", "Devices", "Requests/s", "Per device",
+		"Avg latency", "Max latency", "Errors");
+
+	if (argc > 1) {
+		ScalingTest(ipAddresses, port, (int)ipAddresses.size(), plan, command);
+	}
+	else {
+		for (i = 0; i < NUM_DEVICE_COUNTS; i++) {
+			ScalingTest(ipAddresses, port, DEVICE_COUNTS[i], plan, command);
+		}
+	}
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+ScalingClient::ScalingClient(ModbusEngine & engine, const std::vector<unsigned char> & command,
+	const PlanPacket & packet) :
+	engine(engine),
+	command(command),
+	packet(packet),
+	values(packet.aAddresses.size(), 0.0),
+	running(false),
+	numErrors(0)
+{
+}
+
+void ScalingClient::Start(const std::vector<int> & deviceIDs)
+{
+	size_t i;
+
+	running = true;
+	for (i = 0; i < deviceIDs.size(); i++) {
+		SubmitNext(deviceIDs[i]);
+	}
+}
+
+void ScalingClient::SubmitNext(int deviceID)
+{
+	int err = engine.Submit(deviceID, command,
+		[this, deviceID](int err, const unsigned char * response, int numBytes) {
+			int errorAddress = INITIAL_ERR_ADDRESS;
+			if (err == LJME_NOERROR) {
+				err = DecodeFeedbackResponse(response, numBytes, packet, &values[0],
+					&errorAddress);
+			}
+			if (err != LJME_NOERROR) {
+				++numErrors;
+			}
+			if (running) {
+				SubmitNext(deviceID);
+			}
+		});
+	if (err != LJME_NOERROR) {
+		++numErrors;
+	}
+}
+
+void ScalingTest(const std::vector<unsigned int> & ipAddresses, int port, int numDevices,
+	FramePlan & plan, const std::vector<unsigned char> & command)
+{
+	int i, err, deviceID;
+	std::vector<int> deviceIDs;
+	ModbusEngine engine;
+	ScalingClient client(engine, command, plan.Packets()[0]);
+	std::chrono::steady_clock::time_point start, end;
+
+	for (i = 0; i < numDevices; i++) {
+		err = engine.AddDevice(ipAddresses[i % ipAddresses.size()], port, &deviceID);
+		ErrorCheck(err, "ModbusEngine::AddDevice(%d)", i);
+		deviceIDs.push_back(deviceID);
+	}
+
+	start = std::chrono::steady_clock::now();
+	end = start + std::chrono::milliseconds(DURATION_MS);
+	client.Start(deviceIDs);
+	while (std::chrono::steady_clock::now() < end) {
+		engine.Poll(DURATION_MS);
+	}
+	client.Stop();
+	engine.Drain();
+	double totalS = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+
+	ModbusEngineStats stats = engine.GetStats();
+	long long numRequests = stats.completed + stats.failed;
+	printf("%8d %12.0f %12.0f %9.3f ms %9.3f ms %8d\n", numDevices,
+		numRequests / totalS, numRequests / totalS / numDevices,
+		numRequests > 0 ? stats.totalLatencyUS / 1000.0 / numRequests : 0.0,
+		stats.maxLatencyUS / 1000.0, client.NumErrors());
+}
@@ -0,0 +1,172 @@
+/**
+ * Name: pipelined_speed_test.cpp
+ * Desc: Measures throughput and latency of Feedback transactions sent through
+ *       a ModbusPipeline with several transactions in flight, over TCP and UDP,
+ *       against the serialized LJM_eNames loop of testing/c-r_speed_test.c.
+ * Usage: pipelined_speed_test [IP address]
+ *        With an IP address, tests the device at that address. Without one,
+ *        tests against a local ModbusStandIn with a simulated network delay.
+**/
+
+// For printf
+#include <stdio.h>
+
+#include <chrono>
+#include <vector>
+
+// For the LabJackM Library
+#include "LabJackM.h"
+
+// For LabJackM helper functions
+#include "../LJM_Utilities.h"
+
+#include "LJM_ModbusPipeline.h"
+#include "ModbusStandIn.h"
+
+enum { NUM_ITERATIONS = 1000 };
+enum { NUM_AIN = 1 };
+
+// Simulated one-way network delay of the stand-in, in microseconds
+enum { STAND_IN_DELAY_US = 500 };
+
+const int WINDOWS[] = {1, 2, 4, 8, 16};
+enum { NUM_WINDOWS = sizeof(WINDOWS) / sizeof(WINDOWS[0]) };
+
+/**
+ * Desc: Calls LJM_eNames in a loop, like c-r_speed_test.c, over the given
+ *       connection type to the device at ipString.
+**/
+void SerializedSpeedTest(const char * ipString, int connectionType);
+
+/**
+ * Desc: Sends numIterations copies of the command through a ModbusPipeline
+ *       with window transactions in flight, then prints the results.
+**/
+void PipelinedSpeedTest(unsigned int ipAddress, int port, ModbusTransport transport,
+	int window, const std::vector<unsigned char> & command, FramePlan & plan);
+
+int main(int argc, char * argv[])
+{
+	int i;
+	const char * ipString = argc > 1 ? argv[1] : NULL;
+	unsigned int ipAddress;
+	int tcpPort = LJM_TCP_PORT;
+	int udpPort = LJM_ETHERNET_UDP_PORT;
+	ModbusStandIn standIn(STAND_IN_DELAY_US);
+	FramePlan plan(LJM_MAX_ETHERNET_PACKET_NUM_BYTES_T7);
+	std::vector<unsigned char> command;
+
+	// Same frames as c-r_speed_test.c: read AIN0 to AIN(NUM_AIN - 1)
+	for (i = 0; i < NUM_AIN; i++) {
+		plan.AddRead(i * 2, LJM_FLOAT32);
+	}
+	ErrorCheck(EncodeFeedbackCommand(plan.Packets()[0], plan.Values(),
+		LJM_DEFAULT_UNIT_ID, 0, command), "EncodeFeedbackCommand");
+
+	if (ipString != NULL) {
+		ipAddress = IPToNumber(ipString);
+		SerializedSpeedTest(ipString, LJM_ctTCP);
+		SerializedSpeedTest(ipString, LJM_ctETHERNET_UDP);
+	}
+	else {
+		ErrorCheck(standIn.Start(0, 0), "ModbusStandIn::Start");
+		ipAddress = standIn.GetIPAddress();
+		tcpPort = standIn.GetTCPPort();
+		udpPort = standIn.GetUDPPort();
+		printf("Testing against a local Modbus stand-in with %d us response delay\n\n",
+			STAND_IN_DELAY_US);
+	}
+
+	for (i = 0; i < NUM_WINDOWS; i++) {
+		PipelinedSpeedTest(ipAddress, tcpPort, MODBUS_TRANSPORT_TCP, WINDOWS[i],
+			command, plan);
+	}
+	for (i = 0; i < NUM_WINDOWS; i++) {
+		PipelinedSpeedTest(ipAddress, udpPort, MODBUS_TRANSPORT_UDP, WINDOWS[i],
+			command, plan);
+	}
+
+	WaitForUserIfWindows();
+
+	return LJME_NOERROR;
+}
+
+void SerializedSpeedTest(const char * ipString, int connectionType)
+{
+	int i, err, handle;
+	int errorAddress = INITIAL_ERR_ADDRESS;
+	char names[NUM_AIN][LJM_MAX_NAME_SIZE];
+	const char * aNames[NUM_AIN];
+	int aWrites[NUM_AIN];
+	int aNumValues[NUM_AIN];
+	double aValues[NUM_AIN];
+
+	for (i = 0; i < NUM_AIN; i++) {
+		sprintf(names[i], "AIN%d", i);
+		aNames[i] = names[i];
+		aWrites[i] = LJM_READ;
+		aNumValues[i] = 1;
+	}
+
+	err = LJM_Open(LJM_dtANY, connectionType, ipString, &handle);
+	ErrorCheck(err, "LJM_Open(LJM_dtANY, %s, %s)", NumberToConnectionType(connectionType),
+		ipString);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (i = 0; i < NUM_ITERATIONS; i++) {
+		err = LJM_eNames(handle, NUM_AIN, aNames, aWrites, aNumValues, aValues,
+			&errorAddress);
+		ErrorCheckWithAddress(err, errorAddress, "LJM_eNames");
+	}
+	double totalMS = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+
+	printf("Serialized LJM_eNames over %s:\n", NumberToConnectionType(connectionType));
+	printf("    %d iterations in %.1f ms\n", NUM_ITERATIONS, totalMS);
+	printf("    Throughput: %.0f transactions/s, average latency %.3f ms\n\n",
+		NUM_ITERATIONS / (totalMS / 1000.0), totalMS / NUM_ITERATIONS);
+
+	err = LJM_Close(handle);
+	ErrorCheck(err, "LJM_Close");
+}
+
+void PipelinedSpeedTest(unsigned int ipAddress, int port, ModbusTransport transport,
+	int window, const std::vector<unsigned char> & command, FramePlan & plan)
+{
+	int i, err;
+	int numErrors = 0;
+	int errorAddress = INITIAL_ERR_ADDRESS;
+	const PlanPacket & packet = plan.Packets()[0];
+	std::vector<double> values(plan.Values(), plan.Values() + plan.NumValues());
+	ModbusPipeline pipeline(window);
+
+	err = pipeline.Connect(ipAddress, port, transport);
+	ErrorCheck(err, "ModbusPipeline::Connect(port %d)", port);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (i = 0; i < NUM_ITERATIONS; i++) {
+		pipeline.Submit(command,
+			[&](int err, const unsigned char * response, int numBytes) {
+				if (err == LJME_NOERROR) {
+					err = DecodeFeedbackResponse(response, numBytes, packet,
+						&values[0], &errorAddress);
+				}
+				if (err != LJME_NOERROR) {
+					++numErrors;
+				}
+			});
+	}
+	err = pipeline.Drain();
+	double totalMS = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+	ErrorCheck(err, "ModbusPipeline::Drain");
+
+	ModbusPipelineStats stats = pipeline.GetStats();
+	printf("Pipelined over %s, window %d:\n",
+		transport == MODBUS_TRANSPORT_TCP ? "TCP" : "UDP", window);
+	printf("    %lld transactions in %.1f ms, %d errors, %lld retries\n",
+		stats.completed + stats.failed, totalMS, numErrors, stats.retries);
+	printf("    Throughput: %.0f transactions/s, latency average %.3f ms, max %.3f ms\n\n",
+		NUM_ITERATIONS / (totalMS / 1000.0),
+		stats.totalLatencyUS / 1000.0 / NUM_ITERATIONS, stats.maxLatencyUS / 1000.0);
+}
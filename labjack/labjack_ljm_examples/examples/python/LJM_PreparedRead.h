@@ -0,0 +1,139 @@
+/**
+ * Name: LJM_PreparedRead.h
+ * Desc: Reads a fixed list of register names over and over with everything
+ *       but the round trip done once. Python_LJM's ljm.eReadNames encodes
+ *       each name to a ctypes string, allocates the name, error and value
+ *       arrays, and has LJM look every name up again on every call. A
+ *       PreparedRead looks the names up once, plans the Feedback packets
+ *       once with a FramePlan, which also merges neighbouring registers
+ *       into array frames, and reads into the same values each time.
+ *       Each packet goes out through LJM_eAddresses rather than
+ *       FramePlan::Execute, as LJM_MBFBComm's raw path costs more per call
+ *       than LJM packing the frames itself. C++11.
+**/
+
+#ifndef LJM_PREPARED_READ
+#define LJM_PREPARED_READ
+
+#include <vector>
+
+#include "LabJackM.h"
+
+#include "../LJM_FramePlan.h"
+
+/**
+ * Name: PreparedRead
+ * Desc: Values() holds the value of each name, in the order given to
+ *       Prepare, and stays at the same place from Prepare until the next
+ *       Prepare, so a binding can map it once.
+**/
+class PreparedRead
+{
+public:
+	PreparedRead() : handle(0) {}
+
+	/**
+	 * Desc: Looks up names and plans their reads from handle.
+	 * Para: errorIndex, set to the index of the first name LJM doesn't
+	 *           know. May be NULL.
+	 * Note: Whether each register can be read isn't checked; a write-only
+	 *       one makes every Read fail.
+	 * Retr: LJME_NOERROR, LJME_INVALID_PARAMETER if numNames is below 1,
+	 *       the error of LJM_GetHandleInfo or LJM_NamesToAddresses, or
+	 *       LJME_INVALID_NAME for a name LJM doesn't know.
+	**/
+	int Prepare(int handle, int numNames, const char ** aNames, int * errorIndex = NULL);
+
+	/**
+	 * Desc: Reads every name into Values().
+	 * Para: errorAddress, updated with the device-reported address of an
+	 *           error if one occurs. May be NULL.
+	 * Retr: LJME_NOERROR or the first error.
+	**/
+	int Read(int * errorAddress = NULL);
+
+	double * Values() { return plan.Values(); }
+	int NumValues() const { return plan.NumValues(); }
+
+	/**
+	 * Desc: Returns the Feedback packets one Read sends.
+	**/
+	int NumPackets() { return plan.NumPackets(); }
+
+	/**
+	 * Desc: Returns the frames the reads were merged into.
+	**/
+	int NumFrames() const { return plan.NumFrames(); }
+
+private:
+	int handle;
+	FramePlan plan;
+};
+
+
+// Source
+
+inline int PreparedRead::Prepare(int newHandle, int numNames, const char ** aNames,
+	int * errorIndex)
+{
+	int deviceType, connectionType, serialNumber, ipAddress, port, maxBytesPerMB;
+
+	if (numNames < 1 || aNames == NULL) {
+		return LJME_INVALID_PARAMETER;
+	}
+
+	int err = LJM_GetHandleInfo(newHandle, &deviceType, &connectionType, &serialNumber,
+		&ipAddress, &port, &maxBytesPerMB);
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+
+	std::vector<int> aAddresses(numNames, LJM_INVALID_NAME_ADDRESS);
+	std::vector<int> aTypes(numNames, LJM_INVALID_NAME_ADDRESS);
+	err = LJM_NamesToAddresses(numNames, aNames, &aAddresses[0], &aTypes[0]);
+	for (int i = 0; i < numNames; i++) {
+		if (aAddresses[i] == LJM_INVALID_NAME_ADDRESS) {
+			if (errorIndex) {
+				*errorIndex = i;
+			}
+			return err != LJME_NOERROR ? err : LJME_INVALID_NAME;
+		}
+	}
+	if (err != LJME_NOERROR) {
+		return err;
+	}
+
+	handle = newHandle;
+	plan.Clear();
+	plan.SetMaxBytesPerMB(maxBytesPerMB);
+	for (int i = 0; i < numNames; i++) {
+		plan.AddRead(aAddresses[i], aTypes[i]);
+	}
+
+	// Plan the packets now rather than on the first Read
+	plan.NumPackets();
+	return LJME_NOERROR;
+}
+
+inline int PreparedRead::Read(int * errorAddress)
+{
+	int localErrorAddress = INITIAL_ERR_ADDRESS;
+	if (errorAddress == NULL) {
+		errorAddress = &localErrorAddress;
+	}
+
+	const std::vector<PlanPacket> & packets = plan.Packets();
+	double * values = plan.Values();
+	for (size_t packetI = 0; packetI < packets.size(); packetI++) {
+		const PlanPacket & packet = packets[packetI];
+		int err = LJM_eAddresses(handle, (int)packet.aAddresses.size(),
+			&packet.aAddresses[0], &packet.aTypes[0], &packet.aWrites[0],
+			&packet.aNumValues[0], &values[packet.valueOffset], errorAddress);
+		if (err != LJME_NOERROR) {
+			return err;
+		}
+	}
+	return LJME_NOERROR;
+}
+
+#endif // #ifndef LJM_PREPARED_READ
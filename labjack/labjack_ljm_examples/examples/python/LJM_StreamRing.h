@@ -0,0 +1,357 @@
+/**
+ * Name: LJM_StreamRing.h
+ * Desc: Reads a running stream on a native thread into a ring of
+ *       preallocated blocks. Python_LJM's ljm.eStreamRead allocates a ctypes
+ *       array on every read and converts it to a list of floats, which at
+ *       moderate scan rates costs more CPU than the script's own work. A
+ *       StreamRing's reader thread calls LJM_eStreamRead itself, outside
+ *       any interpreter lock, and the consumer takes the blocks in order
+ *       and gives each back when done with it, so nothing is allocated or
+ *       copied after Start. C++11.
+**/
+
+#ifndef LJM_STREAM_RING
+#define LJM_STREAM_RING
+
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "LabJackM.h"
+
+/**
+ * Name: StreamSimulator
+ * Desc: Stands in for LJM_eStreamRead without a device. Each channel reads
+ *       a ramp that starts at its index. With a scan rate, Read returns
+ *       when the scans would have arrived; with 0 it returns at once, to
+ *       measure how fast a consumer can go.
+**/
+class StreamSimulator
+{
+public:
+	StreamSimulator(int numChannels, int scansPerRead, double scanRate);
+
+	int NumChannels() const { return numChannels; }
+	int ScansPerRead() const { return scansPerRead; }
+
+	/**
+	 * Desc: Fills aData with the next scansPerRead scans, like
+	 *       LJM_eStreamRead.
+	**/
+	int Read(double * aData, int * deviceScanBacklog, int * LJMScanBacklog);
+
+private:
+	int numChannels;
+	int scansPerRead;
+	double scanRate;
+	long long numScans;
+	std::chrono::steady_clock::time_point start;
+};
+
+/**
+ * Desc: What a StreamRing has done since Start.
+ *       fullWaits counts reads the reader delayed because every block was
+ *       filled and not yet released; the stream then backs up in LJM's
+ *       buffer, and maxLJMScanBacklog shows by how much.
+ *       maxFilled is the most blocks that were filled at once.
+**/
+struct StreamRingStats
+{
+	long long reads;
+	long long scans;
+	long long fullWaits;
+	long long consumed;
+	int maxFilled;
+	int maxDeviceScanBacklog;
+	int maxLJMScanBacklog;
+	int stopError;
+};
+
+/**
+ * Name: StreamRing
+ * Desc: numBlocks blocks of scansPerRead scans, stored one after another in
+ *       one buffer that Data returns, so a binding can map the whole ring
+ *       once. The reader fills the blocks in order; Acquire hands out the
+ *       oldest filled block and Release gives it back.
+ * Note: A block may be read until it is released. After that the reader
+ *       may overwrite it.
+**/
+class StreamRing
+{
+public:
+	StreamRing();
+	~StreamRing();
+
+	/**
+	 * Desc: Starts reading the stream running on handle, which must have
+	 *       been started with numChannels channels and scansPerRead scans
+	 *       per read. Stop the ring before stopping the stream.
+	 * Para: simulator, read instead of the device if not NULL. The ring
+	 *           doesn't own it, and it must outlive Stop.
+	 * Retr: LJME_NOERROR, or LJME_INVALID_PARAMETER for sizes below 1.
+	**/
+	int Start(int handle, int numChannels, int scansPerRead, int numBlocks,
+		StreamSimulator * simulator = NULL);
+
+	/**
+	 * Desc: Stops the reader. Blocks already filled can still be acquired.
+	 * Retr: LJME_NOERROR, or the read error that stopped the reader early.
+	**/
+	int Stop();
+
+	double * Data() { return blocks.empty() ? NULL : &blocks[0]; }
+	int NumBlocks() const { return numBlocks; }
+	int BlockSize() const { return blockSize; }
+
+	/**
+	 * Desc: Waits for the oldest filled block that hasn't been acquired.
+	 * Para: timeoutMS, how long to wait, or a negative number to wait as
+	 *           long as it takes.
+	 *       block, set to the block's index in the ring.
+	 *       deviceScanBacklog, LJMScanBacklog, set to what the block's read
+	 *           returned. May be NULL.
+	 * Retr: LJME_NOERROR, LJME_NO_SCANS_RETURNED on timeout, or, once the
+	 *       reader has stopped and every filled block was acquired, the error
+	 *       that stopped it or LJME_STREAM_NOT_RUNNING.
+	**/
+	int Acquire(int timeoutMS, int * block, int * deviceScanBacklog = NULL,
+		int * LJMScanBacklog = NULL);
+
+	/**
+	 * Desc: Gives back the oldest acquired block.
+	 * Retr: LJME_NOERROR, or LJME_INVALID_PARAMETER if no block is acquired.
+	**/
+	int Release();
+
+	void GetStats(StreamRingStats * stats);
+
+private:
+	void Read();
+
+	int handle;
+	StreamSimulator * simulator;
+	int numChannels;
+	int numBlocks;
+	int blockSize;
+	std::vector<double> blocks;
+	std::vector<int> deviceBacklogs;
+	std::vector<int> LJMBacklogs;
+
+	// Blocks ever filled, acquired and released. The reader fills block
+	// filled % numBlocks while filled - released < numBlocks.
+	long long filled;
+	long long acquired;
+	long long released;
+	bool stopping;
+	bool reading;
+
+	std::mutex mutex;
+	std::condition_variable filledChanged;
+	std::condition_variable releasedChanged;
+	std::thread reader;
+	StreamRingStats stats;
+};
+
+
+// Source
+
+inline StreamSimulator::StreamSimulator(int numChannels, int scansPerRead, double scanRate) :
+	numChannels(numChannels),
+	scansPerRead(scansPerRead),
+	scanRate(scanRate),
+	numScans(0),
+	start(std::chrono::steady_clock::now())
+{
+}
+
+inline int StreamSimulator::Read(double * aData, int * deviceScanBacklog,
+	int * LJMScanBacklog)
+{
+	*deviceScanBacklog = 0;
+	*LJMScanBacklog = 0;
+	if (scanRate > 0) {
+		std::chrono::steady_clock::time_point due = start +
+			std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>((numScans + scansPerRead) / scanRate));
+		std::this_thread::sleep_until(due);
+		double behind = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - due).count();
+		*LJMScanBacklog = (int)(behind * scanRate);
+	}
+
+	for (int scan = 0; scan < scansPerRead; scan++) {
+		double ramp = ((numScans + scan) % 1000) * 0.001;
+		for (int channel = 0; channel < numChannels; channel++) {
+			aData[scan * numChannels + channel] = channel + ramp;
+		}
+	}
+	numScans += scansPerRead;
+	return LJME_NOERROR;
+}
+
+inline StreamRing::StreamRing() :
+	handle(0),
+	simulator(NULL),
+	numChannels(0),
+	numBlocks(0),
+	blockSize(0),
+	filled(0),
+	acquired(0),
+	released(0),
+	stopping(false),
+	reading(false)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+inline StreamRing::~StreamRing()
+{
+	Stop();
+}
+
+inline int StreamRing::Start(int newHandle, int newNumChannels, int scansPerRead,
+	int newNumBlocks, StreamSimulator * newSimulator)
+{
+	if (newNumChannels < 1 || scansPerRead < 1 || newNumBlocks < 1) {
+		return LJME_INVALID_PARAMETER;
+	}
+
+	Stop();
+
+	handle = newHandle;
+	simulator = newSimulator;
+	numChannels = newNumChannels;
+	numBlocks = newNumBlocks;
+	blockSize = numChannels * scansPerRead;
+	blocks.assign((size_t)numBlocks * blockSize, 0);
+	deviceBacklogs.assign(numBlocks, 0);
+	LJMBacklogs.assign(numBlocks, 0);
+	filled = 0;
+	acquired = 0;
+	released = 0;
+	stopping = false;
+	reading = true;
+	memset(&stats, 0, sizeof(stats));
+
+	reader = std::thread(&StreamRing::Read, this);
+	return LJME_NOERROR;
+}
+
+inline int StreamRing::Stop()
+{
+	if (!reader.joinable()) {
+		return LJME_NOERROR;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	releasedChanged.notify_all();
+	reader.join();
+	return stats.stopError;
+}
+
+inline void StreamRing::Read()
+{
+	int err = LJME_NOERROR;
+
+	while (true) {
+		long long next;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (!stopping && filled - released >= numBlocks) {
+				stats.fullWaits++;
+				releasedChanged.wait(lock, [this] {
+					return stopping || filled - released < numBlocks;
+				});
+			}
+			if (stopping) {
+				break;
+			}
+			next = filled;
+		}
+
+		// The block is the reader's until filled moves past it
+		int slot = (int)(next % numBlocks);
+		int deviceScanBacklog = 0, LJMScanBacklog = 0;
+		double * aData = &blocks[(size_t)slot * blockSize];
+		err = simulator ? simulator->Read(aData, &deviceScanBacklog, &LJMScanBacklog) :
+			LJM_eStreamRead(handle, aData, &deviceScanBacklog, &LJMScanBacklog);
+		if (err != LJME_NOERROR) {
+			break;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		deviceBacklogs[slot] = deviceScanBacklog;
+		LJMBacklogs[slot] = LJMScanBacklog;
+		filled++;
+		stats.reads++;
+		stats.scans += blockSize / numChannels;
+		int numFilled = (int)(filled - released);
+		stats.maxFilled = numFilled > stats.maxFilled ? numFilled : stats.maxFilled;
+		stats.maxDeviceScanBacklog = deviceScanBacklog > stats.maxDeviceScanBacklog ?
+			deviceScanBacklog : stats.maxDeviceScanBacklog;
+		stats.maxLJMScanBacklog = LJMScanBacklog > stats.maxLJMScanBacklog ?
+			LJMScanBacklog : stats.maxLJMScanBacklog;
+		filledChanged.notify_one();
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	stats.stopError = err;
+	reading = false;
+	filledChanged.notify_all();
+}
+
+inline int StreamRing::Acquire(int timeoutMS, int * block, int * deviceScanBacklog,
+	int * LJMScanBacklog)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	auto ready = [this] { return acquired < filled || !reading; };
+	if (timeoutMS < 0) {
+		filledChanged.wait(lock, ready);
+	}
+	else if (!filledChanged.wait_for(lock, std::chrono::milliseconds(timeoutMS), ready)) {
+		return LJME_NO_SCANS_RETURNED;
+	}
+	if (acquired == filled) {
+		return stats.stopError != LJME_NOERROR ? stats.stopError : LJME_STREAM_NOT_RUNNING;
+	}
+
+	int slot = (int)(acquired % numBlocks);
+	*block = slot;
+	if (deviceScanBacklog) {
+		*deviceScanBacklog = deviceBacklogs[slot];
+	}
+	if (LJMScanBacklog) {
+		*LJMScanBacklog = LJMBacklogs[slot];
+	}
+	acquired++;
+	stats.consumed++;
+	return LJME_NOERROR;
+}
+
+inline int StreamRing::Release()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (released == acquired) {
+			return LJME_INVALID_PARAMETER;
+		}
+		released++;
+	}
+	releasedChanged.notify_one();
+	return LJME_NOERROR;
+}
+
+inline void StreamRing::GetStats(StreamRingStats * result)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	*result = stats;
+}
+
+#endif // #ifndef LJM_STREAM_RING
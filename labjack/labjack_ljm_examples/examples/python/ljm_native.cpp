@@ -0,0 +1,226 @@
+/**
+ * Name: ljm_native.cpp
+ * Desc: A C interface to the native fast paths for Python_LJM, built as the
+ *       LJMNative shared library so ljm_native.py can call them through
+ *       ctypes. ctypes releases the interpreter lock for every call, so a
+ *       call that waits lets other Python threads run. Functions return LJM
+ *       error codes like the LJM library does.
+**/
+
+#include "LJM_PreparedRead.h"
+#include "LJM_StreamRing.h"
+
+#if defined(_WIN32)
+	#define LJM_NATIVE_EXPORT extern "C" __declspec(dllexport)
+#else
+	#define LJM_NATIVE_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+/**
+ * Desc: A StreamRing, and the simulator it reads when started simulated.
+**/
+struct LJMNativeStreamRing
+{
+	StreamRing ring;
+	StreamSimulator * simulator;
+};
+
+/**
+ * Desc: Creates a StreamRing. Free it with LJMNative_StreamRingDestroy.
+**/
+LJM_NATIVE_EXPORT int LJMNative_StreamRingCreate(void ** ring)
+{
+	if (!ring) {
+		return LJME_INVALID_PARAMETER;
+	}
+	LJMNativeStreamRing * native = new LJMNativeStreamRing;
+	native->simulator = NULL;
+	*ring = native;
+	return LJME_NOERROR;
+}
+
+/**
+ * Desc: Starts reading the stream running on handle, like StreamRing::Start.
+ *       With simulatedScanRate 0 or more, reads a StreamSimulator at that
+ *       rate instead, and handle is ignored.
+ * Para: data, set to the ring's first value. The ring's numBlocks blocks of
+ *           numChannels * scansPerRead values follow it, and stay there
+ *           until the next start or LJMNative_StreamRingDestroy.
+**/
+LJM_NATIVE_EXPORT int LJMNative_StreamRingStart(void * ring, int handle, int numChannels,
+	int scansPerRead, int numBlocks, double simulatedScanRate, double ** data)
+{
+	if (!ring || !data) {
+		return LJME_INVALID_PARAMETER;
+	}
+	LJMNativeStreamRing * native = (LJMNativeStreamRing *)ring;
+	native->ring.Stop();
+	delete native->simulator;
+	native->simulator = NULL;
+	if (simulatedScanRate >= 0) {
+		native->simulator = new StreamSimulator(numChannels, scansPerRead, simulatedScanRate);
+	}
+
+	int err = native->ring.Start(handle, numChannels, scansPerRead, numBlocks,
+		native->simulator);
+	*data = native->ring.Data();
+	return err;
+}
+
+/**
+ * Desc: StreamRing::Acquire. Waits without holding the interpreter lock.
+**/
+LJM_NATIVE_EXPORT int LJMNative_StreamRingAcquire(void * ring, int timeoutMS, int * block,
+	int * deviceScanBacklog, int * LJMScanBacklog)
+{
+	if (!ring || !block) {
+		return LJME_INVALID_PARAMETER;
+	}
+	return ((LJMNativeStreamRing *)ring)->ring.Acquire(timeoutMS, block, deviceScanBacklog,
+		LJMScanBacklog);
+}
+
+LJM_NATIVE_EXPORT int LJMNative_StreamRingRelease(void * ring)
+{
+	if (!ring) {
+		return LJME_INVALID_PARAMETER;
+	}
+	return ((LJMNativeStreamRing *)ring)->ring.Release();
+}
+
+LJM_NATIVE_EXPORT int LJMNative_StreamRingStop(void * ring)
+{
+	if (!ring) {
+		return LJME_INVALID_PARAMETER;
+	}
+	return ((LJMNativeStreamRing *)ring)->ring.Stop();
+}
+
+/**
+ * Desc: Copies the ring's StreamRingStats into stats.
+**/
+LJM_NATIVE_EXPORT int LJMNative_StreamRingStats(void * ring, StreamRingStats * stats)
+{
+	if (!ring || !stats) {
+		return LJME_INVALID_PARAMETER;
+	}
+	((LJMNativeStreamRing *)ring)->ring.GetStats(stats);
+	return LJME_NOERROR;
+}
+
+LJM_NATIVE_EXPORT void LJMNative_StreamRingDestroy(void * ring)
+{
+	LJMNativeStreamRing * native = (LJMNativeStreamRing *)ring;
+	if (native) {
+		native->ring.Stop();
+		delete native->simulator;
+		delete native;
+	}
+}
+
+/**
+ * Desc: Creates a StreamSimulator, for comparing ljm.eStreamRead's ctypes
+ *       path with a StreamRing without a device. Free it with
+ *       LJMNative_SimulatorDestroy.
+**/
+LJM_NATIVE_EXPORT int LJMNative_SimulatorCreate(int numChannels, int scansPerRead,
+	double scanRate, void ** simulator)
+{
+	if (numChannels < 1 || scansPerRead < 1 || !simulator) {
+		return LJME_INVALID_PARAMETER;
+	}
+	*simulator = new StreamSimulator(numChannels, scansPerRead, scanRate);
+	return LJME_NOERROR;
+}
+
+/**
+ * Desc: StreamSimulator::Read, with the arguments of LJM_eStreamRead.
+**/
+LJM_NATIVE_EXPORT int LJMNative_SimulatorRead(void * simulator, double * aData,
+	int * deviceScanBacklog, int * LJMScanBacklog)
+{
+	if (!simulator || !aData || !deviceScanBacklog || !LJMScanBacklog) {
+		return LJME_INVALID_PARAMETER;
+	}
+	return ((StreamSimulator *)simulator)->Read(aData, deviceScanBacklog, LJMScanBacklog);
+}
+
+LJM_NATIVE_EXPORT void LJMNative_SimulatorDestroy(void * simulator)
+{
+	delete (StreamSimulator *)simulator;
+}
+
+/**
+ * Desc: Creates a PreparedRead of aNames from handle. Free it with
+ *       LJMNative_PreparedReadDestroy.
+ * Para: values, set to the PreparedRead's Values(), numNames values that
+ *           each LJMNative_PreparedReadRead updates in place.
+ *       errorIndex, set to the index of a name that couldn't be resolved.
+**/
+LJM_NATIVE_EXPORT int LJMNative_PreparedReadCreate(int handle, int numNames,
+	const char ** aNames, void ** read, double ** values, int * errorIndex)
+{
+	if (!read || !values) {
+		return LJME_INVALID_PARAMETER;
+	}
+
+	PreparedRead * prepared = new PreparedRead();
+	int err = prepared->Prepare(handle, numNames, aNames, errorIndex);
+	if (err != LJME_NOERROR) {
+		delete prepared;
+		return err;
+	}
+
+	*read = prepared;
+	*values = prepared->Values();
+	return LJME_NOERROR;
+}
+
+/**
+ * Desc: PreparedRead::Read.
+**/
+LJM_NATIVE_EXPORT int LJMNative_PreparedReadRead(void * read, int * errorAddress)
+{
+	if (!read) {
+		return LJME_INVALID_PARAMETER;
+	}
+	return ((PreparedRead *)read)->Read(errorAddress);
+}
+
+/**
+ * Desc: Calls PreparedRead::Read numReads times, for measuring how much of
+ *       a read from Python is the call rather than the round trip.
+**/
+LJM_NATIVE_EXPORT int LJMNative_PreparedReadRepeat(void * read, int numReads,
+	int * errorAddress)
+{
+	if (!read) {
+		return LJME_INVALID_PARAMETER;
+	}
+	for (int i = 0; i < numReads; i++) {
+		int err = ((PreparedRead *)read)->Read(errorAddress);
+		if (err != LJME_NOERROR) {
+			return err;
+		}
+	}
+	return LJME_NOERROR;
+}
+
+/**
+ * Desc: Sets numPackets and numFrames to what one read sends.
+**/
+LJM_NATIVE_EXPORT int LJMNative_PreparedReadPlan(void * read, int * numPackets,
+	int * numFrames)
+{
+	if (!read || !numPackets || !numFrames) {
+		return LJME_INVALID_PARAMETER;
+	}
+	*numPackets = ((PreparedRead *)read)->NumPackets();
+	*numFrames = ((PreparedRead *)read)->NumFrames();
+	return LJME_NOERROR;
+}
+
+LJM_NATIVE_EXPORT void LJMNative_PreparedReadDestroy(void * read)
+{
+	delete (PreparedRead *)read;
+}
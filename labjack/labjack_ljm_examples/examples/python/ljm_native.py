@@ -0,0 +1,400 @@
+"""
+Python bindings for the LJMNative library built from ljm_native.cpp, native
+fast paths for the calls of the ljm package that cost the most in Python.
+
+StreamRing reads a stream on a native thread into a ring of preallocated
+blocks and hands them to Python as numpy arrays that view the ring, so no
+ctypes array or list of floats is made per read. Start the stream with
+ljm.eStreamStart as usual, then:
+
+    from ljm_native import StreamRing
+    ring = StreamRing()
+    ring.start(handle, num_addresses, scans_per_read)
+    while True:
+        block, device_backlog, ljm_backlog = ring.read()
+        # block is a (scans_per_read, num_addresses) float64 array
+    ring.stop()
+    ljm.eStreamStop(handle)
+
+A block stays valid until the next read; copy it to keep it longer. Blocks
+keep the ring's memory alive, so one kept past close or the next start
+holds stale values rather than pointing at freed memory. Without numpy,
+blocks are memoryviews of the same memory, or ctypes arrays on Python 2.
+
+PreparedRead reads a fixed list of names, like ljm.eReadNames, with the
+names looked up and the packets planned once, into one array it reuses:
+
+    from ljm_native import PreparedRead
+    read = PreparedRead(handle, ["AIN0", "AIN1", "AIN2"])
+    while True:
+        values = read.read()
+        # values is the same float64 array each time, updated in place
+
+"""
+
+import ctypes
+import os
+import sys
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+# The LJM error codes the library returns itself
+INVALID_PARAMETER = 1255
+STREAM_NOT_RUNNING = 1303
+NO_SCANS_RETURNED = 1309
+
+# Blocks in a StreamRing unless given
+DEFAULT_NUM_BLOCKS = 16
+
+
+class NativeError(Exception):
+    """Raised when the library returns an error code."""
+    def __init__(self, error_code, message):
+        Exception.__init__(self, "%s (error %d)" % (message, error_code))
+        self.error_code = error_code
+
+
+class StreamRingStats(ctypes.Structure):
+    """StreamRingStats in LJM_StreamRing.h."""
+    _fields_ = [("reads", ctypes.c_longlong),
+                ("scans", ctypes.c_longlong),
+                ("full_waits", ctypes.c_longlong),
+                ("consumed", ctypes.c_longlong),
+                ("max_filled", ctypes.c_int),
+                ("max_device_scan_backlog", ctypes.c_int),
+                ("max_ljm_scan_backlog", ctypes.c_int),
+                ("stop_error", ctypes.c_int)]
+
+
+def _load_library():
+    """Loads LJMNative from next to this file, or from the library path."""
+    if sys.platform.startswith("win32") or sys.platform.startswith("cygwin"):
+        name = "LJMNative.dll"
+    elif sys.platform.startswith("darwin"):
+        name = "libLJMNative.dylib"
+    else:
+        name = "libLJMNative.so"
+    local = os.path.join(os.path.dirname(os.path.abspath(__file__)), name)
+    library = ctypes.CDLL(local if os.path.exists(local) else name)
+
+    int_p = ctypes.POINTER(ctypes.c_int)
+    library.LJMNative_StreamRingCreate.argtypes = [ctypes.POINTER(ctypes.c_void_p)]
+    library.LJMNative_StreamRingCreate.restype = ctypes.c_int
+    library.LJMNative_StreamRingStart.argtypes = [
+        ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int,
+        ctypes.c_double, ctypes.POINTER(ctypes.POINTER(ctypes.c_double))]
+    library.LJMNative_StreamRingStart.restype = ctypes.c_int
+    library.LJMNative_StreamRingAcquire.argtypes = [
+        ctypes.c_void_p, ctypes.c_int, int_p, int_p, int_p]
+    library.LJMNative_StreamRingAcquire.restype = ctypes.c_int
+    library.LJMNative_StreamRingRelease.argtypes = [ctypes.c_void_p]
+    library.LJMNative_StreamRingRelease.restype = ctypes.c_int
+    library.LJMNative_StreamRingStop.argtypes = [ctypes.c_void_p]
+    library.LJMNative_StreamRingStop.restype = ctypes.c_int
+    library.LJMNative_StreamRingStats.argtypes = [
+        ctypes.c_void_p, ctypes.POINTER(StreamRingStats)]
+    library.LJMNative_StreamRingStats.restype = ctypes.c_int
+    library.LJMNative_StreamRingDestroy.argtypes = [ctypes.c_void_p]
+    library.LJMNative_StreamRingDestroy.restype = None
+    library.LJMNative_SimulatorCreate.argtypes = [
+        ctypes.c_int, ctypes.c_int, ctypes.c_double, ctypes.POINTER(ctypes.c_void_p)]
+    library.LJMNative_SimulatorCreate.restype = ctypes.c_int
+    library.LJMNative_SimulatorRead.argtypes = [
+        ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p]
+    library.LJMNative_SimulatorRead.restype = ctypes.c_int
+    library.LJMNative_SimulatorDestroy.argtypes = [ctypes.c_void_p]
+    library.LJMNative_SimulatorDestroy.restype = None
+    library.LJMNative_PreparedReadCreate.argtypes = [
+        ctypes.c_int, ctypes.c_int, ctypes.POINTER(ctypes.c_char_p),
+        ctypes.POINTER(ctypes.c_void_p), ctypes.POINTER(ctypes.POINTER(ctypes.c_double)),
+        int_p]
+    library.LJMNative_PreparedReadCreate.restype = ctypes.c_int
+    library.LJMNative_PreparedReadRead.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+    library.LJMNative_PreparedReadRead.restype = ctypes.c_int
+    library.LJMNative_PreparedReadRepeat.argtypes = [
+        ctypes.c_void_p, ctypes.c_int, int_p]
+    library.LJMNative_PreparedReadRepeat.restype = ctypes.c_int
+    library.LJMNative_PreparedReadPlan.argtypes = [ctypes.c_void_p, int_p, int_p]
+    library.LJMNative_PreparedReadPlan.restype = ctypes.c_int
+    library.LJMNative_PreparedReadDestroy.argtypes = [ctypes.c_void_p]
+    library.LJMNative_PreparedReadDestroy.restype = None
+    return library
+
+
+_library = _load_library()
+
+
+def _double_blocks(address, num_blocks, shape, owner):
+    """Returns num_blocks consecutive blocks of float64 values of shape at
+    address: a numpy array of them, or without numpy a list of memoryviews,
+    or of ctypes arrays on Python 2, whose memoryview can't cast. Each block
+    keeps owner alive while it exists."""
+    size = 1
+    for length in shape:
+        size *= length
+    values = (ctypes.c_double * (num_blocks * size)).from_address(address)
+    values._owner = owner
+    if numpy is not None:
+        return numpy.frombuffer(values, dtype=numpy.float64).reshape(
+            (num_blocks,) + tuple(shape))
+    if hasattr(memoryview, "cast"):
+        flat = memoryview(values).cast("B").cast("d")
+        return [flat[i*size:(i + 1)*size] for i in range(num_blocks)]
+    blocks = []
+    for i in range(num_blocks):
+        block = (ctypes.c_double * size).from_address(address + i*size*8)
+        block._owner = owner
+        blocks.append(block)
+    return blocks
+
+
+class _NativeStreamRing(object):
+    """Owns a native StreamRing. The blocks mapped from it hold a reference,
+    so it is destroyed, and its memory freed, only once StreamRing has let
+    go of it and no block is left."""
+    def __init__(self):
+        self.ring = ctypes.c_void_p()
+        error = _library.LJMNative_StreamRingCreate(ctypes.byref(self.ring))
+        if error:
+            self.ring = None
+            raise NativeError(error, "LJMNative_StreamRingCreate failed")
+
+    def __del__(self):
+        if self.ring:
+            _library.LJMNative_StreamRingDestroy(self.ring)
+            self.ring = None
+
+
+class StreamRing(object):
+    """Reads a running stream into num_blocks blocks on a native thread. The
+    reader waits when Python hasn't read the blocks yet, and the stream
+    then backs up in LJM's buffer as it would if Python called
+    ljm.eStreamRead late."""
+    def __init__(self, num_blocks=DEFAULT_NUM_BLOCKS):
+        self.num_blocks = num_blocks
+        self._native = _NativeStreamRing()
+        self._started = False
+        self._blocks = None
+        self._holding = False
+        self._block = ctypes.c_int(0)
+        self._device_backlog = ctypes.c_int(0)
+        self._ljm_backlog = ctypes.c_int(0)
+
+    def start(self, handle, num_channels, scans_per_read):
+        """Starts reading the stream running on handle, which must have been
+        started with num_channels addresses and scans_per_read."""
+        self._start(handle, num_channels, scans_per_read, -1.0)
+
+    def start_simulated(self, num_channels, scans_per_read, scan_rate=0.0):
+        """Starts reading a simulated stream at scan_rate, or as fast as
+        Python takes the blocks with 0."""
+        self._start(0, num_channels, scans_per_read, scan_rate)
+
+    @property
+    def _ring(self):
+        return self._native.ring if self._native else None
+
+    def _start(self, handle, num_channels, scans_per_read, simulated_scan_rate):
+        # Blocks of an earlier start may still be in use, so a restart gets
+        # a new native ring and leaves the old one to its blocks
+        if self._started:
+            self._abandon()
+            self._native = _NativeStreamRing()
+        self._started = True
+        data = ctypes.POINTER(ctypes.c_double)()
+        error = _library.LJMNative_StreamRingStart(
+            self._ring, handle, num_channels, scans_per_read, self.num_blocks,
+            simulated_scan_rate, ctypes.byref(data))
+        if error:
+            raise NativeError(error, "LJMNative_StreamRingStart failed")
+
+        # Map the whole ring once; each block is a view of it
+        self._blocks = _double_blocks(ctypes.addressof(data.contents), self.num_blocks,
+                                      (scans_per_read, num_channels), self._native)
+
+    def read(self, timeout=None):
+        """Gives back the block the previous read returned, waits for the
+        next one and returns (block, deviceScanBacklog, ljmScanBacklog), like
+        ljm.eStreamRead. Waits at most timeout seconds, if given. Other
+        Python threads run while it waits.
+
+        Raises NativeError with NO_SCANS_RETURNED on timeout, and with
+        STREAM_NOT_RUNNING or the read error once the ring has stopped and
+        every block was read."""
+        self.release()
+        timeout_ms = -1 if timeout is None else int(timeout * 1000)
+        error = _library.LJMNative_StreamRingAcquire(
+            self._ring, timeout_ms, ctypes.byref(self._block),
+            ctypes.byref(self._device_backlog), ctypes.byref(self._ljm_backlog))
+        if error:
+            raise NativeError(error, "StreamRing read failed")
+        self._holding = True
+        return (self._blocks[self._block.value], self._device_backlog.value,
+                self._ljm_backlog.value)
+
+    def release(self):
+        """Gives back the block the last read returned, if any, so the
+        reader can fill it again. read does this itself."""
+        if self._holding:
+            self._holding = False
+            _library.LJMNative_StreamRingRelease(self._ring)
+
+    def blocks(self, timeout=None):
+        """Yields each block, as read returns it, until the ring stops."""
+        while True:
+            try:
+                yield self.read(timeout)
+            except NativeError as e:
+                if e.error_code == STREAM_NOT_RUNNING:
+                    return
+                raise
+
+    def stop(self):
+        """Stops the reader. Blocks already read can still be read."""
+        error = _library.LJMNative_StreamRingStop(self._ring)
+        if error:
+            raise NativeError(error, "The stream ring stopped on an error")
+
+    def stats(self):
+        """Returns the ring's StreamRingStats."""
+        stats = StreamRingStats()
+        _library.LJMNative_StreamRingStats(self._ring, ctypes.byref(stats))
+        return stats
+
+    def _abandon(self):
+        """Stops the native ring and lets go of it and its blocks. Blocks
+        still referenced elsewhere keep its memory until they are gone."""
+        if getattr(self, "_native", None):
+            _library.LJMNative_StreamRingStop(self._native.ring)
+            self._native = None
+        self._blocks = None
+        self._holding = False
+
+    def close(self):
+        self._abandon()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc_info):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+
+class StreamSimulator(object):
+    """A simulated stream with the arguments of LJM_eStreamRead, for
+    measuring ljm.eStreamRead's ctypes path without a device."""
+    def __init__(self, num_channels, scans_per_read, scan_rate=0.0):
+        self._simulator = ctypes.c_void_p()
+        error = _library.LJMNative_SimulatorCreate(
+            num_channels, scans_per_read, scan_rate, ctypes.byref(self._simulator))
+        if error:
+            self._simulator = None
+            raise NativeError(error, "LJMNative_SimulatorCreate failed")
+
+    def stream_read(self, c_data, c_device_backlog, c_ljm_backlog):
+        """Calls the simulator as ljm.eStreamRead calls LJM_eStreamRead, with
+        byref arguments, and returns the error code."""
+        return _library.LJMNative_SimulatorRead(
+            self._simulator, ctypes.byref(c_data), ctypes.byref(c_device_backlog),
+            ctypes.byref(c_ljm_backlog))
+
+    def close(self):
+        if self._simulator:
+            _library.LJMNative_SimulatorDestroy(self._simulator)
+            self._simulator = None
+
+    def __del__(self):
+        self.close()
+
+
+class _NativePreparedRead(object):
+    """Owns a native PreparedRead. values holds a reference, so it is
+    destroyed only once PreparedRead has let go of it and values is gone."""
+    def __init__(self):
+        self.read = ctypes.c_void_p()
+
+    def __del__(self):
+        if self.read:
+            _library.LJMNative_PreparedReadDestroy(self.read)
+            self.read = None
+
+
+class PreparedRead(object):
+    """Reads names from handle, the names given once. values is a float64
+    numpy array, or a memoryview without numpy or a ctypes array on Python
+    2, of one value per name, in order, that every read updates in place;
+    copy it to keep a reading. values kept past close holds the last
+    reading."""
+    def __init__(self, handle, names):
+        self.names = list(names)
+        c_names = (ctypes.c_char_p * len(self.names))(
+            *[name.encode("ascii") for name in self.names])
+        self._native = _NativePreparedRead()
+        data = ctypes.POINTER(ctypes.c_double)()
+        error_index = ctypes.c_int(-1)
+        error = _library.LJMNative_PreparedReadCreate(
+            handle, len(self.names), c_names, ctypes.byref(self._native.read),
+            ctypes.byref(data), ctypes.byref(error_index))
+        if error:
+            self._native = None
+            if 0 <= error_index.value < len(self.names):
+                raise NativeError(error, "Could not prepare %s" %
+                                  self.names[error_index.value])
+            raise NativeError(error, "LJMNative_PreparedReadCreate failed")
+
+        self.values = _double_blocks(ctypes.addressof(data.contents), 1,
+                                     (len(self.names),), self._native)[0]
+
+        # Build the call's arguments once, too
+        self._error_address = ctypes.c_int(-1)
+        self._error_address_ref = ctypes.byref(self._error_address)
+        self._function = _library.LJMNative_PreparedReadRead
+
+    @property
+    def _read(self):
+        return self._native.read if self._native else None
+
+    def read(self):
+        """Reads every name and returns values. Raises NativeError with the
+        error's address, as error_address, if a read fails."""
+        error = self._function(self._read, self._error_address_ref)
+        if error:
+            e = NativeError(error, "PreparedRead read failed")
+            e.error_address = self._error_address.value
+            raise e
+        return self.values
+
+    def repeat(self, num_reads):
+        """Reads num_reads times in one call, for measuring what a read
+        costs without Python."""
+        error = _library.LJMNative_PreparedReadRepeat(
+            self._read, num_reads, ctypes.byref(self._error_address))
+        if error:
+            raise NativeError(error, "PreparedRead read failed")
+
+    def plan(self):
+        """Returns (packets, frames) one read sends."""
+        num_packets = ctypes.c_int(0)
+        num_frames = ctypes.c_int(0)
+        _library.LJMNative_PreparedReadPlan(
+            self._read, ctypes.byref(num_packets), ctypes.byref(num_frames))
+        return num_packets.value, num_frames.value
+
+    def close(self):
+        self._native = None
+        self.values = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc_info):
+        self.close()
+
+    def __del__(self):
+        self.close()
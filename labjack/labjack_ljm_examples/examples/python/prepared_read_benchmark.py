@@ -0,0 +1,99 @@
+"""
+Measures what a read of 1, 5 and 50 names costs from Python with
+ljm.eReadNames's ctypes path, with ljm.eReadAddresses and addresses looked up
+beforehand, and with ljm_native.PreparedRead, against what the same
+PreparedRead costs with no Python in the loop. The difference from that is
+the per-call overhead of each path; the round trip to the device is in all
+of them.
+
+Usage:
+    python prepared_read_benchmark.py [identifier] [reads]
+
+identifier defaults to "ANY", and reads, per measurement, to 1000.
+
+"""
+
+import sys
+import time
+
+from labjack import ljm
+
+import ljm_native
+
+# trade_fair.py's five AINs, one AIN, and a long list of AINs read over and
+# over
+NAME_LISTS = [["AIN0"],
+              ["AIN12", "AIN1", "AIN13", "AIN2", "AIN3"],
+              ["AIN%d" % (i % 14) for i in range(50)]]
+
+
+# Each measurement is the best of this many rounds, so a slow moment on the
+# network or the device doesn't land on one path only
+NUM_ROUNDS = 5
+
+
+def microseconds_per_read(read_n, num_reads):
+    """Returns the microseconds per read of read_n(n), which reads n times."""
+    reads_per_round = max(num_reads // NUM_ROUNDS, 1)
+    best = None
+    for round in range(NUM_ROUNDS):
+        start = time.perf_counter()
+        read_n(reads_per_round)
+        elapsed = (time.perf_counter() - start) * 1e6 / reads_per_round
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+def calls(call):
+    """Returns a read_n for microseconds_per_read that calls call n times."""
+    def read_n(n):
+        for i in range(n):
+            call()
+    return read_n
+
+
+def main():
+    identifier = sys.argv[1] if len(sys.argv) > 1 else "ANY"
+    num_reads = int(sys.argv[2]) if len(sys.argv) > 2 else 1000
+
+    handle = ljm.openS("ANY", "ANY", identifier)
+    info = ljm.getHandleInfo(handle)
+    print("Opened a LabJack with Device type: %i, Connection type: %i,\n"
+          "Serial number: %i, IP address: %s, Port: %i,\nMax bytes per MB: %i\n" %
+          (info[0], info[1], info[2], ljm.numberToIP(info[3]), info[4], info[5]))
+
+    print("Microseconds per read, %d reads each\n" % num_reads)
+    print("%-6s %-8s %12s %14s %12s %10s   %s" % (
+        "names", "packets", "eReadNames", "eReadAddresses", "PreparedRead",
+        "native", "overhead of each"))
+    for names in NAME_LISTS:
+        prepared = ljm_native.PreparedRead(handle, names)
+
+        # Both paths must return a value per name
+        expected = ljm.eReadNames(handle, len(names), names)
+        got = list(prepared.read())
+        if len(got) != len(expected):
+            raise RuntimeError("PreparedRead returned %d values for %d names" %
+                               (len(got), len(names)))
+
+        addresses, types = ljm.namesToAddresses(len(names), names)
+        names_us = microseconds_per_read(
+            calls(lambda: ljm.eReadNames(handle, len(names), names)), num_reads)
+        addresses_us = microseconds_per_read(
+            calls(lambda: ljm.eReadAddresses(handle, len(names), addresses, types)),
+            num_reads)
+        prepared_us = microseconds_per_read(calls(prepared.read), num_reads)
+        native_us = microseconds_per_read(prepared.repeat, num_reads)
+
+        num_packets = prepared.plan()[0]
+        print("%-6d %-8d %12.1f %14.1f %12.1f %10.1f   %.1f, %.1f, %.1f" % (
+            len(names), num_packets, names_us, addresses_us, prepared_us,
+            native_us, names_us - native_us, addresses_us - native_us,
+            prepared_us - native_us))
+        prepared.close()
+
+    ljm.close(handle)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,156 @@
+"""
+Measures the highest scan rate a Python script can keep up with when it reads
+a stream with ljm.eStreamRead's ctypes path, and with ljm_native.StreamRing.
+Both read the same simulated stream, which is ready as soon as it's asked
+for, so the scans per second Python gets through is the fastest stream it
+could sustain. For each block the script computes each channel's mean, the
+least a script does with its data. Needs no device, only the LJMNative
+library next to this file.
+
+Usage:
+    python stream_benchmark.py [seconds]
+
+seconds, per measurement, defaults to 2.
+
+"""
+
+import ctypes
+import sys
+import threading
+import time
+
+import ljm_native
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+# (channels, scans per read): trade_fair.py's five AINs at a modest and a
+# fast rate, and a wide scan list
+CASES = [(5, 50), (5, 500), (16, 1000)]
+
+
+def e_stream_read(simulator, size):
+    """ljm.eStreamRead, line for line, reading simulator instead of
+    LJM_eStreamRead."""
+    cData = (ctypes.c_double*size)()
+    cD_SBL = ctypes.c_int32(0)
+    cLJM_SBL = ctypes.c_int32(0)
+
+    error = simulator.stream_read(cData, cD_SBL, cLJM_SBL)
+    if error != 0:
+        raise ljm_native.NativeError(error, "LJMNative_SimulatorRead failed")
+
+    return [i for i in cData], cD_SBL.value, cLJM_SBL.value
+
+
+def list_means(data, num_channels):
+    return [sum(data[c::num_channels]) / (len(data) // num_channels)
+            for c in range(num_channels)]
+
+
+def scans_per_second(read_and_use, scans_per_read, seconds):
+    """Calls read_and_use for seconds and returns the scans per second."""
+    reads = 0
+    start = time.perf_counter()
+    while True:
+        read_and_use()
+        reads += 1
+        elapsed = time.perf_counter() - start
+        if elapsed >= seconds:
+            return reads * scans_per_read / elapsed
+
+
+def measure(num_channels, scans_per_read, seconds):
+    """Returns the scans per second of the ctypes path as lists, the ctypes
+    path converted to numpy, and StreamRing, and the ring's stats."""
+    size = num_channels * scans_per_read
+    simulator = ljm_native.StreamSimulator(num_channels, scans_per_read)
+
+    def ctypes_list():
+        data = e_stream_read(simulator, size)[0]
+        list_means(data, num_channels)
+
+    rates = [scans_per_second(ctypes_list, scans_per_read, seconds)]
+
+    if numpy is not None:
+        def ctypes_numpy():
+            data = numpy.array(e_stream_read(simulator, size)[0])
+            data.reshape(scans_per_read, num_channels).mean(axis=0)
+        rates.append(scans_per_second(ctypes_numpy, scans_per_read, seconds))
+
+        use = lambda block: block.mean(axis=0)
+    else:
+        rates.append(None)
+        use = lambda block: list_means(block, num_channels)
+    simulator.close()
+
+    ring = ljm_native.StreamRing()
+    ring.start_simulated(num_channels, scans_per_read)
+
+    def ring_read():
+        use(ring.read()[0])
+
+    rates.append(scans_per_second(ring_read, scans_per_read, seconds))
+    ring.stop()
+    stats = ring.stats()
+    ring.close()
+    return rates, stats
+
+
+def paced_with_busy_thread(num_channels, scans_per_read, scan_rate, seconds):
+    """Reads a StreamRing paced at scan_rate while another Python thread
+    spins, and returns the ring's stats. The reader doesn't need the
+    interpreter lock, so it keeps the pace however busy Python is."""
+    ring = ljm_native.StreamRing()
+    done = []
+
+    def spin():
+        count = 0
+        while not done:
+            count += 1
+
+    spinner = threading.Thread(target=spin)
+    spinner.start()
+    ring.start_simulated(num_channels, scans_per_read, scan_rate)
+    start = time.perf_counter()
+    while time.perf_counter() - start < seconds:
+        ring.read()
+    ring.stop()
+    done.append(True)
+    spinner.join()
+    stats = ring.stats()
+    ring.close()
+    return stats
+
+
+def main():
+    seconds = float(sys.argv[1]) if len(sys.argv) > 1 else 2.0
+
+    print("Highest sustainable scan rate from Python, scans/s, mean per channel "
+          "each read\n")
+    print("%-10s %-10s %14s %14s %14s %8s" % ("channels", "scans/read", "eStreamRead",
+                                               "+ numpy.array", "StreamRing",
+                                               "speedup"))
+    for num_channels, scans_per_read in CASES:
+        rates, stats = measure(num_channels, scans_per_read, seconds)
+        numpy_rate = "%14.0f" % rates[1] if rates[1] is not None else "%14s" % "-"
+        best_before = max(rate for rate in rates[:2] if rate is not None)
+        print("%-10d %-10d %14.0f %s %14.0f %7.1fx" % (
+            num_channels, scans_per_read, rates[0], numpy_rate, rates[2],
+            rates[2] / best_before))
+        if stats.max_ljm_scan_backlog or stats.max_device_scan_backlog:
+            print("    backlog: device %d, LJM %d" % (stats.max_device_scan_backlog,
+                                                      stats.max_ljm_scan_backlog))
+
+    print("\nBlocks are %s" % ("numpy arrays" if numpy is not None else "memoryviews"))
+
+    stats = paced_with_busy_thread(5, 100, 100000, seconds)
+    print("StreamRing paced at 100000 scans/s beside a spinning Python thread: "
+          "%d scans, LJM backlog at most %d scans, %d full-ring waits" % (
+              stats.scans, stats.max_ljm_scan_backlog, stats.full_waits))
+
+
+if __name__ == "__main__":
+    main()
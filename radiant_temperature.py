@@ -283,11 +283,9 @@ while True:
     name2 = "AIN13"
     name3 = "AIN2"
     name4 = "AIN3"
-    result0 = ljm.eReadName(handle, name0)
-    result1 = ljm.eReadName(handle, name1)
-    result2 = ljm.eReadName(handle, name2)
-    result3 = ljm.eReadName(handle, name3)
-    result4 = ljm.eReadName(handle, name4)
+    # One eReadNames call reads all five channels in a single round trip
+    result0, result1, result2, result3, result4 = ljm.eReadNames(
+        handle, 5, [name0, name1, name2, name3, name4])
 
     # 0  radiant temp voltage range of output
     resistance = float((100*result0)/(4.915 - result0))
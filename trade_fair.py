@@ -4,8 +4,10 @@ Reading all sensors voltage, convert value, send to DB
 """
 
 import random
+import os
 import sys
 import json
+import math
 import time
 import argparse
 import thread
@@ -16,6 +18,15 @@ from labjack import ljm
 from ws4py.client.threadedclient import WebSocketClient
 from cmd import Cmd
 
+# ISO 7730 PMV/PPD from the LJMConversion library; build it with make.sh in
+# labjack/labjack_ljm_examples/examples/conversion
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "labjack",
+                                "labjack_ljm_examples", "examples", "conversion"))
+try:
+    from ljm_conversion import thermal_comfort
+except (ImportError, OSError):
+    thermal_comfort = None
+
 ######## MOVEMENTFDSAFDSAFSDFSADFASDF 3$#$#$#$%$%$#
 
 import rospy
@@ -256,11 +267,9 @@ def take_measurements(x, y):
     name2 = "AIN13"
     name3 = "AIN2"
     name4 = "AIN3"
-    result0 = ljm.eReadName(handle, name0)
-    result1 = ljm.eReadName(handle, name1)
-    result2 = ljm.eReadName(handle, name2)
-    result3 = ljm.eReadName(handle, name3)
-    result4 = ljm.eReadName(handle, name4)
+    # One eReadNames call reads all five channels in a single round trip
+    result0, result1, result2, result3, result4 = ljm.eReadNames(
+        handle, 5, [name0, name1, name2, name3, name4])
 
     # 0  radiant temp voltage range of output
     resistance = float((100*result0)/(4.915 - result0))
@@ -313,6 +322,17 @@ def take_measurements(x, y):
         print("ane1Avg= %f" % (ane1Avg))
         print("ane2Avg= %f" % (ane2Avg))
         print("aneMagnitude= %f" % (aneMagAvg))
+
+        # Comfort at this cell from the averages. NaN, for readings out of
+        # the model's range, isn't valid JSON, so those cells go without.
+        comfort = ""
+        if thermal_comfort is not None:
+            pmv, ppd = thermal_comfort(ambAvg, radAvg, aneMagAvg, hudAvg,
+                                       met=args.met, clo=args.clo)
+            print("pmv= %f" % (pmv))
+            print("ppd= %f" % (ppd))
+            if not math.isnan(pmv):
+                comfort = ",\"pmv\":" + str(pmv) + ",\"ppd\":" + str(ppd)
         time.sleep(5)
         
         #to-do: send avg values to DB
@@ -322,7 +342,7 @@ def take_measurements(x, y):
             ",\"temp\":" + str(ambAvg) + \
             ",\"radtemp\":" + str(radAvg) + \
             ",\"humid\":" + str(hudAvg) + \
-            ",\"velocity\":" + str(aneMagAvg) + "}]"
+            ",\"velocity\":" + str(aneMagAvg) + comfort + "}]"
         
         if x<xDim:
             x=x+1
@@ -365,8 +385,17 @@ if __name__ == '__main__':
     parser.add_argument(
             '--print-raw', dest='print_raw', action="store_true",
             help='print raw websocket data in addition to parsed results')
+    parser.add_argument(
+            '--met', type=float, default=1.2,
+            help='metabolic rate of the occupants for PMV/PPD, in met')
+    parser.add_argument(
+            '--clo', type=float, default=0.7,
+            help='clothing insulation of the occupants for PMV/PPD, in clo')
     args = parser.parse_args()
 
+    if thermal_comfort is None:
+        log("* LJMConversion not found; uploading without pmv and ppd")
+
     ddpclient = DDPClient(
             'ws://' + args.ddp_endpoint + '/websocket',
             args.print_raw)